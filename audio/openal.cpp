@@ -27,6 +27,7 @@
 
 #include "base/assert.h"
 #include "base/logging.h"
+#include "base/metrics.h"
 #include "audio/device.h"
 #include "audio/source.h"
 #include "audio/stream.h"
@@ -183,6 +184,7 @@ private:
           , mSource(std::move(source))
           , mDevice(device)
           , mContext(context)
+          , mUnderruns(base::GetGlobalCounter("audio.underruns"))
         {
             const auto channels   = mSource->GetNumChannels();
             const auto samplerate = mSource->GetRateHz();
@@ -356,6 +358,8 @@ private:
                     // if source has more but the AL source queue has drained
                     // we're likely too slow and are having a buffer underrun :<
                     WARN("OpenAL stream encountered likely audio buffer underrun. [name='%1']", mSource->GetName());
+                    if (mUnderruns)
+                        mUnderruns->Increment();
                 }
 
                 // the core OpenAL API seems to have only alBufferData and no way to
@@ -425,6 +429,7 @@ private:
         std::uint64_t mCurrentBytes = 0;
         ALCdevice* mDevice = NULL;
         ALCcontext* mContext = NULL;
+        base::Counter* mUnderruns = nullptr;
         ALuint mHandle = 0;
         ALuint mBuffers[NumBuffers];
         ALint mHandleState = 0;
@@ -230,7 +230,7 @@ void SourceThreadProxy::ThreadLoop()
 
     DEBUG("Hello from audio source thread. [name='%1']", mSource->GetName());
     std::uint64_t bytes_read = 0;
-    std::unique_ptr<base::TraceLog> trace;
+    std::unique_ptr<base::Trace> trace;
     std::size_t my_thread_id = ThreadId++;
 
     try
@@ -244,7 +244,7 @@ void SourceThreadProxy::ThreadLoop()
                 if (TraceWriter && !base::GetThreadTrace())
                 {
                     // reserve AudioThread 0 for Player Thread
-                    trace = std::make_unique<base::TraceLog>(1000, base::TraceLog::ThreadId::AudioThread + 1 + my_thread_id);
+                    trace = TraceWriter->CreateThreadTrace(base::TraceLog::ThreadId::AudioThread + 1 + my_thread_id);
                     base::SetThreadTrace(trace.get());
                 }
                 else if (!TraceWriter && base::GetThreadTrace())
@@ -25,6 +25,7 @@
 
 #include "base/assert.h"
 #include "base/logging.h"
+#include "base/metrics.h"
 #include "audio/source.h"
 #include "audio/stream.h"
 #include "audio/device.h"
@@ -149,6 +150,7 @@ private:
     public:
         PlaybackStream(std::unique_ptr<Source> source, pa_context* context, unsigned buffer_size_ms)
             : source_(std::move(source))
+            , underruns_(base::GetGlobalCounter("audio.underruns"))
         {
             const auto channels   = source_->GetNumChannels();
             const auto samplerate = source_->GetRateHz();
@@ -268,6 +270,8 @@ private:
             auto* this_ = static_cast<PlaybackStream*>(user);
             if (!this_->source_)
                 return;
+            if (this_->underruns_)
+                this_->underruns_->Increment();
             if (base::IsLogEventEnabled(base::LogEvent::Verbose))
                 WARN("PulseAudio stream underflow callback. [name='%1']", this_->source_->GetName());
         }
@@ -396,6 +400,8 @@ private:
 
     private:
         std::unique_ptr<Source> source_;
+        // looked up once since the callback runs on the audio thread.
+        base::Counter* underruns_ = nullptr;
         pa_stream*  stream_  = nullptr;
         Stream::State state_ = Stream::State::None;
         std::uint64_t num_pcm_bytes_ = 0;
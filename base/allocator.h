@@ -18,11 +18,15 @@
 
 #include "config.h"
 
-#include <deque>
-#include <stack>
-#include <mutex>
+#include <atomic>
 #include <iterator>
 #include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
 
 #include "base/assert.h"
 #include "base/utility.h"
@@ -31,6 +35,93 @@ namespace base
 {
     namespace detail {
 
+        // Index of the most significant set bit. Value must be non-zero.
+        inline unsigned MostSignificantBit(uint64_t value) noexcept
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#elif defined(_MSC_VER) && defined(_WIN64)
+            unsigned long index = 0;
+            _BitScanReverse64(&index, value);
+            return static_cast<unsigned>(index);
+#else
+            unsigned index = 0;
+            while (value >>= 1)
+                ++index;
+            return index;
+#endif
+        }
+
+        // Array of elements that grows in blocks of geometrically increasing
+        // size. Blocks are never moved or released while the array is alive
+        // so a pointer to an element stays valid and a lookup can run
+        // concurrently with another thread growing the array. Block k holds
+        // BaseSize << k elements.
+        template<typename T>
+        class SegmentedArray
+        {
+        public:
+            SegmentedArray() = default;
+            SegmentedArray(const SegmentedArray&) = delete;
+           ~SegmentedArray()
+            {
+                for (auto& block : mBlocks)
+                    delete [] block.load(std::memory_order_relaxed);
+            }
+
+            // Get the element at index, allocating the block that contains
+            // it if needed. Safe to call concurrently from multiple threads.
+            [[nodiscard]]
+            T* Allocate(size_t index)
+            {
+                const auto location = Locate(index);
+                auto* block = mBlocks[location.block].load(std::memory_order_acquire);
+                if (block == nullptr)
+                {
+                    auto* fresh = new T[BaseSize << location.block]();
+                    if (mBlocks[location.block].compare_exchange_strong(block, fresh,
+                            std::memory_order_acq_rel, std::memory_order_acquire))
+                        block = fresh;
+                    else delete [] fresh; // some other thread won the race.
+                }
+                return &block[location.offset];
+            }
+            // Get the element at index or nullptr if the element has not
+            // been allocated yet.
+            [[nodiscard]]
+            T* Get(size_t index) const noexcept
+            {
+                const auto location = Locate(index);
+                if (location.block >= BlockCount)
+                    return nullptr;
+                auto* block = mBlocks[location.block].load(std::memory_order_acquire);
+                if (block == nullptr)
+                    return nullptr;
+                return &block[location.offset];
+            }
+            SegmentedArray& operator=(const SegmentedArray&) = delete;
+        private:
+            static constexpr size_t BaseShift = 6;
+            static constexpr size_t BaseSize  = size_t(1) << BaseShift;
+            static constexpr size_t BlockCount = 32;
+
+            struct Location {
+                size_t block  = 0;
+                size_t offset = 0;
+            };
+            static inline Location Locate(size_t index) noexcept
+            {
+                const auto biased = uint64_t(index) + BaseSize;
+                const auto msb = MostSignificantBit(biased);
+                Location ret;
+                ret.block  = msb - BaseShift;
+                ret.offset = biased - (uint64_t(1) << msb);
+                return ret;
+            }
+        private:
+            std::atomic<T*> mBlocks[BlockCount] = {};
+        };
+
         // suppress warning about non-standard extension
         // regarding the zero length array
 #if defined(__MSVC__)
@@ -41,7 +132,7 @@ namespace base
             enum Flags {
                 Created = 0x1
             };
-            uint32_t flags = 0;
+            std::atomic<uint32_t> flags = {0};
             char data[]; // non-standard
         };
 #if defined(__MSVC__)
@@ -59,41 +150,29 @@ namespace base
         template<typename T>
         class TypedAllocator : public ObjectAllocator {
         public:
-            inline size_t GetSize() const noexcept
-            { return mObjects.size(); }
-
             [[nodiscard]]
             virtual Memory* Allocate(size_t index)  override
             {
-                for (size_t i=mObjects.size(); i <= index; ++i)
-                    mObjects.emplace_back(Object {0});
-
-                ASSERT(index < mObjects.size());
-
-                auto& object = mObjects[index];
-                return reinterpret_cast<Memory*>(&object);
+                return reinterpret_cast<Memory*>(mObjects.Allocate(index));
             }
             [[nodiscard]]
             virtual Memory* Get(size_t index) noexcept override
             {
-                if (index >= mObjects.size())
-                    return nullptr;
-
-                auto& object = mObjects[index];
-                return reinterpret_cast<Memory*>(&object);
+                return reinterpret_cast<Memory*>(mObjects.Get(index));
             }
         private:
             static auto constexpr Padding = sizeof(T) % sizeof(intptr_t);
             static auto constexpr AlignedSize = sizeof(T) + (sizeof(intptr_t) - Padding);
 
             struct Object {
-                uint32_t flags = 0;
+                std::atomic<uint32_t> flags = {0};
                 char memory[AlignedSize];
             };
 
-            // important to use deque here so that push_back doesn't
-            // invalidate any previous iterators (pointers)
-            std::deque<Object> mObjects;
+            // important to use a segmented array here so that growing the
+            // storage doesn't invalidate any previous pointers and so that
+            // the lookup can run concurrently with the allocation.
+            SegmentedArray<Object> mObjects;
         };
 
         template<size_t N, typename... Ts> using NthTypeOf =
@@ -142,10 +221,10 @@ namespace base
             }
             void Destroy(size_t index) noexcept {
                 auto* memory = this_allocator.Get(index);
-                if (memory && (memory->flags & Memory::Flags::Created)) {
+                if (memory && (memory->flags.load(std::memory_order_acquire) & Memory::Flags::Created)) {
                     auto* object = reinterpret_cast<DataType*>(memory->data);
                     object->~DataType();
-                    memory->flags &= ~Memory::Flags::Created;
+                    memory->flags.fetch_and(~uint32_t(Memory::Flags::Created), std::memory_order_release);
                 }
                 next.Destroy(index);
             }
@@ -172,10 +251,10 @@ namespace base
             }
             void Destroy(size_t index) noexcept {
                 auto* memory = this_allocator.Get(index);
-                if (memory && (memory->flags & Memory::Flags::Created)) {
+                if (memory && (memory->flags.load(std::memory_order_acquire) & Memory::Flags::Created)) {
                     auto* object = reinterpret_cast<DataType*>(memory->data);
                     object->~DataType();
-                    memory->flags &= ~Memory::Flags::Created;
+                    memory->flags.fetch_and(~uint32_t(Memory::Flags::Created), std::memory_order_release);
                 }
             }
 
@@ -185,6 +264,16 @@ namespace base
 
     }// detail
 
+    // Allocator for allocating objects of several types so that objects
+    // of each type are stored in their own contiguous(ish) storage and
+    // objects that belong together share the same index.
+    //
+    // Index allocation (GetNextIndex, FreeIndex) is lock-free and the
+    // object storage never moves, so objects can be created and looked
+    // up concurrently from several threads. Destroying an object while
+    // another thread is using the same object is naturally still a bug.
+    // Long-lived references that must detect the index being recycled
+    // should use a Handle which carries the index generation.
     template<class... Types>
     class Allocator
     {
@@ -193,57 +282,115 @@ namespace base
         static constexpr auto TypeCount = sizeof...(Types);
         static constexpr auto AllocatorCount = sizeof...(Types);
 
+        // Versioned reference to an allocator index. The version is bumped
+        // every time the index is freed so a stale handle never resolves
+        // to an object that was created later in the same slot.
+        struct Handle {
+            size_t index = 0;
+            uint32_t version = 0;
+        };
+
         Allocator() = default;
         Allocator(const Allocator& other) = delete;
 
        ~Allocator()
         {
-            ASSERT(mCount == 0);
+            ASSERT(GetCount() == 0);
         }
 
         inline size_t GetCount() const noexcept
-        { return mCount; }
+        { return mCount.load(std::memory_order_relaxed); }
 
         inline size_t GetHighIndex() const noexcept
-        { return mHighIndex; }
+        { return mHighIndex.load(std::memory_order_acquire); }
 
         template<typename Type>
         Type* GetObject(size_t index) noexcept
         {
             auto* memory = mAllocators.template Get<Type>(index);
-            if (memory && (memory->flags & detail::Memory::Flags::Created))
+            if (memory && (memory->flags.load(std::memory_order_acquire) & detail::Memory::Flags::Created))
                 return reinterpret_cast<Type*>(memory->data);
 
             return nullptr;
         }
 
+        // Get a handle to the currently allocated index.
+        Handle GetHandle(size_t index) const noexcept
+        {
+            Handle handle;
+            handle.index = index;
+            if (const auto* slot = mSlots.Get(index))
+                handle.version = slot->version.load(std::memory_order_acquire);
+            return handle;
+        }
+        // Check whether the index referred to by the handle is still the
+        // same allocation that the handle was created for.
+        bool IsValid(const Handle& handle) const noexcept
+        {
+            const auto* slot = mSlots.Get(handle.index);
+            return slot && slot->version.load(std::memory_order_acquire) == handle.version;
+        }
+        // Get the object referred to by the handle or nullptr if the index
+        // has been freed since or the object doesn't exist.
+        template<typename Type>
+        Type* Resolve(const Handle& handle) noexcept
+        {
+            if (!IsValid(handle))
+                return nullptr;
+            return GetObject<Type>(handle.index);
+        }
+
         [[nodiscard]]
         size_t GetNextIndex() noexcept
         {
-            ++mCount;
-
-            if (mFreeIndices.empty())
-                return mHighIndex++;
+            mCount.fetch_add(1, std::memory_order_relaxed);
+
+            // pop from the free list. the head packs a modification tag in
+            // the high 32 bits and index+1 in the low 32 bits (0 for empty).
+            // the tag makes sure a pop racing with pop+push of the same
+            // index (ABA) fails the compare-exchange.
+            uint64_t head = mFreeHead.load(std::memory_order_acquire);
+            while (head & FreeIndexMask)
+            {
+                const auto index = size_t(head & FreeIndexMask) - 1;
+                const auto next  = mSlots.Get(index)->next_free.load(std::memory_order_relaxed);
+                const auto tagged = (((head >> 32) + 1) << 32) | next;
+                if (mFreeHead.compare_exchange_weak(head, tagged,
+                        std::memory_order_acquire, std::memory_order_acquire))
+                    return index;
+            }
 
-            auto index = mFreeIndices.top();
-            mFreeIndices.pop();
+            const auto index = mHighIndex.fetch_add(1, std::memory_order_acq_rel);
+            ASSERT(index < FreeIndexMask);
+            (void)mSlots.Allocate(index);
             return index;
         }
         void FreeIndex(size_t index) noexcept
         {
-            ASSERT(mCount > 0);
-            --mCount;
+            ASSERT(GetCount() > 0);
+
+            auto* slot = mSlots.Get(index);
+            ASSERT(slot);
+            slot->version.fetch_add(1, std::memory_order_release);
 
-            mFreeIndices.push(index);
+            uint64_t head = mFreeHead.load(std::memory_order_relaxed);
+            uint64_t tagged = 0;
+            do {
+                slot->next_free.store(uint32_t(head & FreeIndexMask), std::memory_order_relaxed);
+                tagged = (((head >> 32) + 1) << 32) | (uint64_t(index) + 1);
+            } while (!mFreeHead.compare_exchange_weak(head, tagged,
+                        std::memory_order_release, std::memory_order_relaxed));
+
+            mCount.fetch_sub(1, std::memory_order_relaxed);
         }
 
         template<typename Type, typename... Args>
         Type* CreateObject(size_t index, Args&&... args) 
         {
             auto* memory = mAllocators.template Allocate<Type>(index);
-            ASSERT((memory->flags & detail::Memory::Flags::Created) == 0);
+            ASSERT((memory->flags.load(std::memory_order_relaxed) & detail::Memory::Flags::Created) == 0);
             Type* object = new (memory->data) Type(std::forward<Args>(args)...);
-            memory->flags = detail::Memory::Flags::Created;
+            memory->flags.store(detail::Memory::Flags::Created, std::memory_order_release);
             return object;
         }
 
@@ -252,12 +399,12 @@ namespace base
         {
             auto* memory = mAllocators.template Get<Type>(index);
             ASSERT(memory);
-            ASSERT(memory->flags & detail::Memory::Flags::Created);
+            ASSERT(memory->flags.load(std::memory_order_relaxed) & detail::Memory::Flags::Created);
             ASSERT((void*)memory->data == (void*)carcass);
 
-            carcass->~Type();
+            memory->flags.fetch_and(~uint32_t(detail::Memory::Flags::Created), std::memory_order_release);
 
-            memory->flags &= ~detail::Memory::Flags::Created;
+            carcass->~Type();
         }
 
         void DestroyAll(size_t index) noexcept
@@ -265,28 +412,44 @@ namespace base
             mAllocators.Destroy(index);
         }
 
-        // for testing mostly.
+        // for testing mostly. Not thread safe.
         void Cleanup() noexcept
         {
-            for (size_t i=0; i<mHighIndex; ++i)
+            const auto high = GetHighIndex();
+            for (size_t i=0; i<high; ++i)
+            {
                 DestroyAll(i);
+                // invalidate any outstanding handles.
+                mSlots.Get(i)->version.fetch_add(1, std::memory_order_relaxed);
+            }
 
-            mCount = 0;
-            mHighIndex = 0;
+            mFreeHead.store(0, std::memory_order_relaxed);
+            mCount.store(0, std::memory_order_relaxed);
+            mHighIndex.store(0, std::memory_order_release);
         }
-        auto& GetMutex() const noexcept
-        { return mMutex; }
 
         Allocator& operator=(const Allocator&) = delete;
     private:
-        mutable std::mutex mMutex;
+        static constexpr uint64_t FreeIndexMask = 0xffffffff;
+
+        struct Slot {
+            // the version of the index, bumped when the index is freed.
+            std::atomic<uint32_t> version = {0};
+            // the next free index + 1 when this slot is in the free list.
+            std::atomic<uint32_t> next_free = {0};
+        };
         detail::Allocator<Types...> mAllocators;
-        std::stack<size_t> mFreeIndices;
-        std::size_t mHighIndex = 0;
-        std::size_t mCount = 0;
+        detail::SegmentedArray<Slot> mSlots;
+        std::atomic<uint64_t> mFreeHead = {0};
+        std::atomic<std::size_t> mHighIndex = {0};
+        std::atomic<std::size_t> mCount = {0};
     };
 
 
+    // Forward iterable view over objects of type T in the allocator.
+    // The range is fixed to the high index at the time when the sequence
+    // is created so objects allocated concurrently after that are not
+    // visited.
     template<class T, class... Types>
     class AllocatorSequence
     {
@@ -303,8 +466,9 @@ namespace base
         public:
             using iterator_category = std::forward_iterator_tag;
 
-            iterator(size_t index, AllocatorType* allocator) noexcept
+            iterator(size_t index, size_t end, AllocatorType* allocator) noexcept
               : mIndex(index)
+              , mEnd(end)
               , mAllocator(allocator)
             {}
             inline iterator& operator++() noexcept
@@ -314,7 +478,7 @@ namespace base
             }
             inline iterator operator++(int) noexcept
             {
-                iterator old(mIndex, mAllocator);
+                iterator old(mIndex, mEnd, mAllocator);
                 scan_next();
                 return old;
             }
@@ -336,37 +500,50 @@ namespace base
                 return mIndex != other.mIndex;
             }
         private:
+            friend class AllocatorSequence;
+
             void scan_next() noexcept
             {
-                do {
-                    if (mAllocator->template GetObject<T>(++mIndex))
+                while (++mIndex < mEnd)
+                {
+                    if (mAllocator->template GetObject<T>(mIndex))
                         break;
-                } while (mIndex < mAllocator->GetHighIndex());
+                }
+            }
+            void scan_first() noexcept
+            {
+                if (mIndex >= mEnd || mAllocator->template GetObject<T>(mIndex))
+                    return;
+                scan_next();
             }
         private:
             size_t mIndex = 0;
+            size_t mEnd   = 0;
             AllocatorType* mAllocator = nullptr;
         };
 
         explicit AllocatorSequence(AllocatorType* allocator) noexcept
           : mAllocator(allocator)
+          , mHighIndex(allocator->GetHighIndex())
         {}
 
         inline iterator begin() noexcept
         {
-            return iterator { 0, mAllocator };
+            iterator it { 0, mHighIndex, mAllocator };
+            it.scan_first();
+            return it;
         }
         inline iterator end() noexcept
         {
-            return iterator { mAllocator->GetHighIndex(), mAllocator };
+            return iterator { mHighIndex, mHighIndex, mAllocator };
         }
         inline size_type size() const noexcept
         {
-            return mAllocator->GetHighIndex();
+            return mHighIndex;
         }
         inline size_type max_size() const noexcept
         {
-            return mAllocator->GetHighIndex();
+            return mHighIndex;
         }
         inline void push_back(T* value) noexcept
         {
@@ -378,7 +555,7 @@ namespace base
         }
     private:
         AllocatorType* mAllocator;
+        size_t mHighIndex = 0;
     };
 
 } // namespace
-
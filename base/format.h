@@ -28,11 +28,16 @@
 #  endif
 #include "warnpop.h"
 
+#include <algorithm>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <iomanip>
 #include <tuple>
 #include <type_traits>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
 
 #include "base/bitflag.h"
 #include "base/types.h"
@@ -188,6 +193,228 @@ namespace base
     inline std::string FormatString(const std::string& fmt)
     { return fmt; }
 
+    // Format string whose "%1 %2" placeholders are parsed at compile time.
+    // The object keeps a copy of the format string and the list of literal
+    // text and placeholder segments so that formatting is a single pass
+    // over the segments without any searching or string replacing.
+    //
+    //   static constexpr base::CompiledFormat fmt("%1+%2");
+    //   char buffer[64];
+    //   base::FormatTo(buffer, fmt, "foo", 123);
+    //
+    // Unlike the runtime FormatString a placeholder consumes all the digits
+    // following the %, i.e. %12 refers to the 12th argument and not to the
+    // first argument followed by a '2'. Placeholders that don't refer to any
+    // argument are written out as-is.
+    template<std::size_t N>
+    class CompiledFormat
+    {
+    public:
+        struct Segment {
+            unsigned offset = 0;
+            unsigned length = 0;
+            // 1 based argument index or 0 for literal text.
+            unsigned index  = 0;
+        };
+
+        constexpr explicit CompiledFormat(const char (&str)[N])
+        {
+            for (std::size_t i=0; i<N; ++i)
+                mString[i] = str[i];
+
+            std::size_t pos = 0;
+            std::size_t text_start = 0;
+            while (pos < N-1)
+            {
+                if (str[pos] != '%' || !IsDigit(str[pos+1]))
+                {
+                    ++pos;
+                    continue;
+                }
+                if (pos > text_start)
+                    AddSegment(text_start, pos - text_start, 0);
+
+                std::size_t end = pos + 1;
+                unsigned index = 0;
+                while (IsDigit(str[end]))
+                    index = index * 10 + (str[end++] - '0');
+
+                AddSegment(pos, end - pos, index);
+                pos = end;
+                text_start = end;
+            }
+            if (pos > text_start)
+                AddSegment(text_start, pos - text_start, 0);
+        }
+        constexpr std::size_t GetNumSegments() const
+        { return mNumSegments; }
+        constexpr const Segment& GetSegment(std::size_t index) const
+        { return mSegments[index]; }
+        constexpr const char* GetString() const
+        { return mString; }
+        // Get a (loose) estimate of the formatted string length.
+        constexpr std::size_t GetLength() const
+        { return N - 1; }
+    private:
+        static constexpr bool IsDigit(char c)
+        { return c >= '0' && c <= '9'; }
+        constexpr void AddSegment(std::size_t offset, std::size_t length, unsigned index)
+        {
+            auto& segment = mSegments[mNumSegments++];
+            segment.offset = static_cast<unsigned>(offset);
+            segment.length = static_cast<unsigned>(length);
+            segment.index  = index;
+        }
+    private:
+        char mString[N] = {};
+        Segment mSegments[N] = {};
+        std::size_t mNumSegments = 0;
+    };
+
+    template<std::size_t N>
+    CompiledFormat(const char (&str)[N]) -> CompiledFormat<N>;
+
+    namespace detail {
+        // Output into a caller provided character buffer. Keeps count of
+        // every character written even when the buffer has run out so that
+        // the caller can find out the size required for the whole string.
+        class FormatBuffer
+        {
+        public:
+            FormatBuffer(char* buffer, std::size_t size) noexcept
+              : mBuffer(buffer)
+              , mSize(size)
+            {}
+            inline void Append(const char* str, std::size_t len) noexcept
+            {
+                if (mLength < mSize)
+                    std::memcpy(mBuffer + mLength, str, std::min(len, mSize - mLength));
+                mLength += len;
+            }
+            inline void Append(char c) noexcept
+            {
+                if (mLength < mSize)
+                    mBuffer[mLength] = c;
+                ++mLength;
+            }
+            // Null terminate the string, truncating it if needed.
+            inline void Terminate() noexcept
+            {
+                if (mSize == 0)
+                    return;
+                mBuffer[std::min(mLength, mSize - 1)] = 0;
+            }
+            inline std::size_t GetLength() const noexcept
+            { return mLength; }
+        private:
+            char* mBuffer = nullptr;
+            std::size_t mSize = 0;
+            std::size_t mLength = 0;
+        };
+
+        template<typename T> inline
+        void FormatArg(FormatBuffer& out, const T& value)
+        {
+            if constexpr (std::is_same_v<T, bool>)
+                out.Append(value ? '1' : '0');
+            else if constexpr (std::is_same_v<T, char>)
+                out.Append(value);
+            else if constexpr (std::is_integral_v<T>)
+            {
+                char buffer[32];
+                const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+                out.Append(buffer, result.ptr - buffer);
+            }
+            else if constexpr (std::is_floating_point_v<T>)
+            {
+                // same output as std::to_string which the runtime
+                // formatting uses, i.e. printf %f
+                char buffer[64];
+                int len = 0;
+                if constexpr (std::is_same_v<T, long double>)
+                    len = std::snprintf(buffer, sizeof(buffer), "%Lf", value);
+                else len = std::snprintf(buffer, sizeof(buffer), "%f", static_cast<double>(value));
+                if (len < int(sizeof(buffer)))
+                    out.Append(buffer, len);
+                else
+                {
+                    const auto& str = std::to_string(value);
+                    out.Append(str.data(), str.size());
+                }
+            }
+#if defined(BASE_FORMAT_SUPPORT_MAGIC_ENUM)
+            else if constexpr (std::is_enum_v<T>)
+            {
+                const auto name = magic_enum::enum_name(value);
+                out.Append(name.data(), name.size());
+            }
+#endif
+            else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+            {
+                const std::string_view str(value);
+                out.Append(str.data(), str.size());
+            }
+            else
+            {
+                // fall back on the ToString conversion (found through ADL)
+                const auto& str = ToString(value);
+                out.Append(str.data(), str.size());
+            }
+        }
+        inline void FormatArg(FormatBuffer& out, const char* str)
+        { out.Append(str, std::strlen(str)); }
+
+        template<std::size_t N, typename... Args>
+        std::size_t FormatTo(FormatBuffer& out, const CompiledFormat<N>& fmt, const Args&... args)
+        {
+            const auto* str = fmt.GetString();
+            for (std::size_t i=0; i<fmt.GetNumSegments(); ++i)
+            {
+                const auto& segment = fmt.GetSegment(i);
+                if (segment.index == 0 || segment.index > sizeof...(Args))
+                {
+                    out.Append(str + segment.offset, segment.length);
+                    continue;
+                }
+                std::size_t arg_index = 1;
+                ((arg_index++ == segment.index ? FormatArg(out, args) : void()), ...);
+            }
+            out.Terminate();
+            return out.GetLength();
+        }
+    } // detail
+
+    // Format the string into the given buffer. The result is always null
+    // terminated (if size > 0) and truncated if it doesn't fit. Returns the
+    // length of the complete formatted string without the terminating null,
+    // i.e. if the return value is >= size the output was truncated.
+    template<std::size_t N, typename... Args> inline
+    std::size_t FormatTo(char* buffer, std::size_t size, const CompiledFormat<N>& fmt, const Args&... args)
+    {
+        detail::FormatBuffer out(buffer, size);
+        return detail::FormatTo(out, fmt, args...);
+    }
+    template<std::size_t BufferSize, std::size_t N, typename... Args> inline
+    std::size_t FormatTo(char (&buffer)[BufferSize], const CompiledFormat<N>& fmt, const Args&... args)
+    {
+        detail::FormatBuffer out(buffer, BufferSize);
+        return detail::FormatTo(out, fmt, args...);
+    }
+
+    template<std::size_t N, typename... Args> inline
+    std::string FormatString(const CompiledFormat<N>& fmt, const Args&... args)
+    {
+        char buffer[256];
+        const auto length = FormatTo(buffer, fmt, args...);
+        if (length < sizeof(buffer))
+            return std::string(buffer, length);
+
+        std::string ret;
+        ret.resize(length);
+        FormatTo(ret.data(), length + 1, fmt, args...);
+        return ret;
+    }
+
     // bring ToString also into base namespace scope
     using detail::ToString;
 
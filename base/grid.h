@@ -127,6 +127,48 @@ namespace base
                 }
             }
         }
+        // Erase the objects that satisfy the predicate but only look
+        // for them in the cells that intersect with the given rectangle.
+        // When the rectangle is the same rectangle that was used to
+        // insert the object this finds all the cells the object was
+        // inserted into without having to visit the whole grid.
+        template<typename Predicate>
+        void Erase(const base::FRect& rect, Predicate predicate)
+        {
+            const auto sub_rect = Intersect(mRect, rect);
+            if (sub_rect.IsEmpty())
+                return;
+
+            for_each_cell(sub_rect, [&predicate](const auto& c_items) {
+                auto& items = const_cast<ItemList&>(c_items);
+                for (auto it = items.begin(); it != items.end();)
+                {
+                    auto& item = *it;
+                    if constexpr (ItemTraits::CacheRect) {
+                        if (predicate(item.object, item.rect))
+                            it = items.erase(it);
+                        else ++it;
+                    } else {
+                        if (predicate(item.object))
+                            it = items.erase(it);
+                        else ++it;
+                    }
+                }
+                return true;
+            });
+        }
+        // Move an object from its previous rectangle to a new rectangle.
+        // The previous rectangle must be the rectangle that was used to
+        // insert the object. Returns false if the new rectangle is not
+        // within the grid in which case the object is only erased.
+        bool Move(const FRect& old_rect, const FRect& new_rect, Object object)
+        {
+            Erase(old_rect, [&object](const Object& other, const FRect&) {
+                return other == object;
+            });
+            return Insert(new_rect, std::move(object));
+        }
+
         // Erase objects whose rects intersect with the given rectangle.
         void Erase(const base::FRect& rect) noexcept
         {
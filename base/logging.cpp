@@ -32,6 +32,7 @@
 #include <iostream>
 #include <iomanip>
 #include <atomic>
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include "base/assert.h"
@@ -52,6 +53,101 @@ static std::atomic<bool> isGlobalWarnLogEnabled(true);
 static std::atomic<bool> isGlobalInfoLogEnabled(true);
 static std::atomic<bool> isGlobalErrorLogEnabled(true);
 
+// source of unique IDs for the AsyncLogger objects. used to map
+// the thread specific ring buffers to their logger objects.
+static std::atomic<std::uint64_t> nextAsyncLoggerId(1);
+
+// the calling thread's ring buffers for AsyncLoggers. Normally
+// there's only one AsyncLogger so this has a single item.
+struct ThreadLogBuffer {
+    std::uint64_t logger_id = 0;
+    std::shared_ptr<base::LogRingBuffer> buffer;
+};
+struct ThreadLogBuffers {
+    std::vector<ThreadLogBuffer> buffers;
+   ~ThreadLogBuffers()
+    {
+        // let the logger know the producer is gone so that it can
+        // release the buffer once it's been drained.
+        for (auto& buffer : buffers)
+            buffer.buffer->Close();
+    }
+};
+thread_local ThreadLogBuffers threadLogBuffers;
+
+std::size_t RoundUpToPowerOfTwo(std::size_t value)
+{
+    std::size_t ret = 1;
+    while (ret < value)
+        ret <<= 1;
+    return ret;
+}
+
+const char* StripPath(const char* file)
+{
+#if defined(POSIX_OS)
+    const char* p = file;
+    while (*file) {
+        if (*file == '/')
+            p = file + 1;
+        ++file;
+    }
+    return p;
+#elif defined(WINDOWS_OS)
+    const char* p = file;
+    while (*file) {
+        if (*file == '\\')
+            p = file + 1;
+        ++file;
+    }
+    return p;
+#else
+    return file;
+#endif
+}
+
+std::chrono::steady_clock::time_point GetFirstEventTime()
+{
+    // magic static is thread safe.
+    static const auto first_event_time = std::chrono::steady_clock::now();
+    return first_event_time;
+}
+
+// Get the log event time in seconds since the first log event.
+double GetEventSeconds(std::chrono::steady_clock::time_point time)
+{
+    const auto elapsed = time - GetFirstEventTime();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 1000.0;
+}
+
+std::int64_t GetSteadyClockNanos()
+{
+    const auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+}
+
+// Write the log message into the logger according to the
+// logger's write mask.
+void WriteLoggerMessage(base::Logger* logger, base::LogEvent type, const char* file, int line,
+                        const char* message, double seconds)
+{
+    using WriteType = base::Logger::WriteType;
+
+    if (logger->TestWriteMask(WriteType::WriteRaw))
+        logger->Write(type, file, line, message, seconds);
+
+    if (logger->TestWriteMask(WriteType::WriteFormatted))
+    {
+        // format the whole log string.
+        // todo: fix this potential buffer issue here.
+        char formatted_log_message[512] = {0};
+        std::snprintf(formatted_log_message, sizeof(formatted_log_message) - 1,
+                      "[%f] %s: %s:%d \"%s\"\n",
+                      seconds, base::ToString(type), file, line, message);
+        logger->Write(type, formatted_log_message);
+    }
+}
+
 } // namespace
 
 namespace base
@@ -323,6 +419,265 @@ void EmscriptenLogger::Flush()
 }
 #endif // __EMSCRIPTEN__
 
+LogRingBuffer::LogRingBuffer(std::size_t capacity)
+  : mRecords(RoundUpToPowerOfTwo(std::max(capacity, std::size_t(2))))
+  , mMask(mRecords.size() - 1)
+{}
+
+LogRingBuffer::~LogRingBuffer() noexcept
+{
+    // destroy any records that were never consumed.
+    while (auto* record = Front())
+    {
+        record->destroy(record->storage);
+        Pop();
+    }
+}
+
+AsyncLogger::AsyncLogger(std::unique_ptr<Logger> sink,
+                         OverflowPolicy policy,
+                         unsigned flush_interval_ms,
+                         std::size_t ring_buffer_capacity)
+  : mId(nextAsyncLoggerId.fetch_add(1, std::memory_order_relaxed))
+  , mPolicy(policy)
+  , mFlushInterval(flush_interval_ms)
+  , mRingBufferCapacity(ring_buffer_capacity)
+  , mSink(std::move(sink))
+{
+    ASSERT(mSink);
+    // make sure the log time base is established before
+    // any record is queued.
+    GetFirstEventTime();
+
+    if (mFlushInterval)
+        mThread = std::thread(&AsyncLogger::ThreadMain, this);
+}
+
+AsyncLogger::~AsyncLogger() noexcept
+{
+    if (mThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mThreadMutex);
+            mShutdown = true;
+        }
+        mCondition.notify_one();
+        mThread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mDrainMutex);
+    {
+        // mark all the buffers closed so that the threads will
+        // drop their stale buffers the next time they log.
+        std::lock_guard<std::mutex> lock(mBufferMutex);
+        for (auto& buffer : mBuffers)
+            buffer->Close();
+    }
+    DrainLocked();
+    mSink->Flush();
+}
+
+void AsyncLogger::Write(LogEvent type, const char* file, int line, const char* msg, double time)
+{
+    PushMessage(type, file, line, msg);
+}
+
+void AsyncLogger::Write(LogEvent type, const char* msg)
+{
+    PushMessage(type, nullptr, 0, msg);
+}
+
+void AsyncLogger::Flush()
+{
+    std::lock_guard<std::mutex> lock(mDrainMutex);
+    DrainLocked();
+    mSink->Flush();
+}
+
+void AsyncLogger::Dispatch()
+{
+    std::lock_guard<std::mutex> lock(mDrainMutex);
+    DrainLocked();
+}
+
+AsyncLogger::Stats AsyncLogger::GetStats() const
+{
+    Stats stats;
+    stats.written = mWriteCount.load(std::memory_order_relaxed);
+    stats.dropped = mDropCount.load(std::memory_order_relaxed);
+    stats.blocked = mBlockCount.load(std::memory_order_relaxed);
+    stats.max_latency_us = mLatencyMaxUs.load(std::memory_order_relaxed);
+    if (stats.written)
+        stats.avg_latency_us = double(mLatencySumUs.load(std::memory_order_relaxed)) / double(stats.written);
+    return stats;
+}
+
+LogRingBuffer* AsyncLogger::GetThreadBuffer()
+{
+    auto& buffers = threadLogBuffers.buffers;
+    for (const auto& buffer : buffers)
+    {
+        if (buffer.logger_id == mId)
+            return buffer.buffer.get();
+    }
+
+    // drop the buffers of any loggers that have been deleted.
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const auto& buffer) {
+        return buffer.buffer->IsClosed();
+    }), buffers.end());
+
+    ThreadLogBuffer buffer;
+    buffer.logger_id = mId;
+    buffer.buffer    = std::make_shared<LogRingBuffer>(mRingBufferCapacity);
+    {
+        std::lock_guard<std::mutex> lock(mBufferMutex);
+        mBuffers.push_back(buffer.buffer);
+    }
+    buffers.push_back(buffer);
+    return buffer.buffer.get();
+}
+
+LogRecord* AsyncLogger::BeginRecord(LogRingBuffer* buffer, LogEvent type, const char* file, int line)
+{
+    auto* record = buffer->BeginPush();
+    if (record == nullptr && mPolicy == OverflowPolicy::Block && mThread.joinable())
+    {
+        mBlockCount.fetch_add(1, std::memory_order_relaxed);
+        mCondition.notify_one();
+        while ((record = buffer->BeginPush()) == nullptr)
+            std::this_thread::yield();
+    }
+    if (record == nullptr)
+    {
+        mDropCount.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    // wake up the dispatch thread early when the buffer is filling up
+    // instead of waiting for the flush interval to expire.
+    if (mThread.joinable() && buffer->GetSize() >= mRingBufferCapacity * 3 / 4)
+        mCondition.notify_one();
+
+    record->type      = type;
+    record->file      = file;
+    record->line      = line;
+    record->format    = nullptr;
+    record->time_ns   = GetSteadyClockNanos();
+    return record;
+}
+
+void AsyncLogger::PushMessage(LogEvent type, const char* file, int line, const char* msg)
+{
+    auto* buffer = GetThreadBuffer();
+    auto* record = BeginRecord(buffer, type, file, line);
+    if (record == nullptr)
+        return;
+    new (record->storage) std::string(msg);
+    record->formatter = [](const char*, const void* storage, std::string* out) {
+        *out = *static_cast<const std::string*>(storage);
+    };
+    record->destroy = &DestroyArgs<std::string>;
+    buffer->EndPush();
+}
+
+void AsyncLogger::ThreadMain()
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mThreadMutex);
+            if (!mShutdown)
+                mCondition.wait_for(lock, std::chrono::milliseconds(mFlushInterval));
+            if (mShutdown)
+                return;
+        }
+        std::lock_guard<std::mutex> lock(mDrainMutex);
+        const auto count = mWriteCount.load(std::memory_order_relaxed);
+        DrainLocked();
+        if (count != mWriteCount.load(std::memory_order_relaxed))
+            mSink->Flush();
+    }
+}
+
+void AsyncLogger::DrainLocked()
+{
+    {
+        std::lock_guard<std::mutex> lock(mBufferMutex);
+        mDrainBuffers = mBuffers;
+    }
+
+    for (auto& buffer : mDrainBuffers)
+    {
+        // only take what is in the buffer right now so that a
+        // thread that keeps on logging can't keep us here forever.
+        auto count = buffer->GetSize();
+        while (count--)
+        {
+            auto* record = buffer->Front();
+
+            Message message;
+            message.type    = record->type;
+            message.file    = record->file;
+            message.line    = record->line;
+            message.time_ns = record->time_ns;
+            record->formatter(record->format, record->storage, &message.msg);
+            record->destroy(record->storage);
+            buffer->Pop();
+            mMessages.push_back(std::move(message));
+        }
+    }
+
+    {
+        // remove the buffers whose producer thread has exited and
+        // which have been completely drained.
+        std::lock_guard<std::mutex> lock(mBufferMutex);
+        mBuffers.erase(std::remove_if(mBuffers.begin(), mBuffers.end(), [](const auto& buffer) {
+            return buffer->IsClosed() && buffer->GetSize() == 0;
+        }), mBuffers.end());
+    }
+    mDrainBuffers.clear();
+
+    // merge the messages from the different threads in the order
+    // in which they were written.
+    std::stable_sort(mMessages.begin(), mMessages.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.time_ns < rhs.time_ns;
+    });
+
+    for (const auto& message : mMessages)
+    {
+        if (message.file == nullptr)
+        {
+            mSink->Write(message.type, message.msg.c_str());
+        }
+        else
+        {
+            const auto since_epoch = std::chrono::nanoseconds(message.time_ns);
+            const auto time = std::chrono::steady_clock::time_point(
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(since_epoch));
+            WriteLoggerMessage(mSink.get(), message.type, StripPath(message.file), message.line,
+                               message.msg.c_str(), GetEventSeconds(time));
+        }
+
+        const auto latency_us = std::max(std::int64_t(0), (GetSteadyClockNanos() - message.time_ns) / 1000);
+        mLatencySumUs.fetch_add(latency_us, std::memory_order_relaxed);
+        if (std::uint64_t(latency_us) > mLatencyMaxUs.load(std::memory_order_relaxed))
+            mLatencyMaxUs.store(latency_us, std::memory_order_relaxed);
+        mWriteCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    mMessages.clear();
+
+    // let the sink know that messages were lost so that a gap in the
+    // log doesn't go unnoticed.
+    const auto dropped = mDropCount.load(std::memory_order_relaxed);
+    if (dropped != mReportedDropCount)
+    {
+        const auto& msg = FormatString("Dropped %1 log message(s) because of a full log buffer.",
+                                       dropped - mReportedDropCount);
+        WriteLoggerMessage(mSink.get(), LogEvent::Warning, StripPath(__FILE__), __LINE__,
+                           msg.c_str(), GetEventSeconds(std::chrono::steady_clock::now()));
+        mReportedDropCount = dropped;
+    }
+}
+
 Logger* SetGlobalLog(Logger* log)
 {
     auto ret = globalLogger;
@@ -403,64 +758,34 @@ void EnableDebugLog(bool on_off)
     isGlobalDebugLogEnabled = on_off;
 }
 
+AsyncLogger* GetDeferredLog()
+{
+    auto* logger = threadLogger ? threadLogger : globalLogger;
+    if (logger && logger->TestWriteMask(Logger::WriteType::WriteDeferred))
+        return static_cast<AsyncLogger*>(logger);
+    return nullptr;
+}
+
 void WriteLogMessage(LogEvent type, const char* file, int line, const std::string& message)
 {
     // strip the path from the file name.
-#if defined(POSIX_OS)
-    const char* p = file;
-    while (*file) {
-        if (*file == '/')
-            p = file + 1;
-        ++file;
-    }
-    file = p;
-#elif defined(WINDOWS_OS)
-    const char* p = file;
-    while (*file) {
-        if (*file == '\\')
-            p = file + 1;
-        ++file;
-    }
-    file = p;
-#endif
-
-    using steady_clock = std::chrono::steady_clock;
-    // magic static is thread safe.
-    static const auto first_event_time = steady_clock::now();
-    const auto current_event_time = steady_clock::now();
-    const auto elapsed = current_event_time - first_event_time;
-    const double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 1000.0;
+    file = StripPath(file);
 
-    // format the whole log string.
-    // todo: fix this potential buffer issue here.
-    char formatted_log_message[512] = {0};
+    const double seconds = GetEventSeconds(std::chrono::steady_clock::now());
 
     auto* thread_log = GetThreadLog();
-    auto* global_log = GetGlobalLog();
-    if ((thread_log && thread_log->TestWriteMask(Logger::WriteType::WriteFormatted)) ||
-        (global_log && global_log->TestWriteMask(Logger::WriteType::WriteFormatted)))
-    {
-        std::snprintf(formatted_log_message, sizeof(formatted_log_message) - 1,
-                      "[%f] %s: %s:%d \"%s\"\n",
-                      seconds, ToString(type), file, line, message.c_str());
-    }
     if (thread_log)
     {
-        if (thread_log->TestWriteMask(Logger::WriteType::WriteRaw))
-            thread_log->Write(type, file, line, message.c_str(), seconds);
-        if (thread_log->TestWriteMask(Logger::WriteType::WriteFormatted))
-            thread_log->Write(type, formatted_log_message);
+        WriteLoggerMessage(thread_log, type, file, line, message.c_str(), seconds);
         return;
     }
 
     // acquire access to the global logger
+    auto* global_log = GetGlobalLog();
     if (!global_log)
         return;
 
-    if (global_log->TestWriteMask(Logger::WriteType::WriteRaw))
-        global_log->Write(type, file, line, message.c_str(), seconds);
-    if (global_log->TestWriteMask(Logger::WriteType::WriteFormatted))
-        global_log->Write(type, formatted_log_message);
+    WriteLoggerMessage(global_log, type, file, line, message.c_str(), seconds);
 }
 
 } // base
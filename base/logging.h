@@ -21,6 +21,17 @@
 #include <iosfwd>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <tuple>
+#include <type_traits>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 
 #include "base/format.h"
 #include "base/bitflag.h"
@@ -105,7 +116,10 @@ namespace base
 
         enum class WriteType {
             WriteRaw,
-            WriteFormatted
+            WriteFormatted,
+            // The logger is an AsyncLogger that can capture the format
+            // arguments and do the formatting later on its own thread.
+            WriteDeferred
         };
         virtual base::bitflag<WriteType> GetWriteMask() const
         {
@@ -347,6 +361,279 @@ namespace base
 #endif
 
 
+    // A log message waiting in the AsyncLogger's queue. The record holds
+    // either a copy of the format string and the format arguments or an
+    // already formatted message. Both are stored inline in the record.
+    struct LogRecord {
+        // Makes the whole record 256 bytes.
+        static constexpr std::size_t StorageSize = 208;
+        // Produce the final message string from the stored data.
+        using FormatFunc  = void (*)(const char* format, const void* storage, std::string* out);
+        // Destroy the objects stored in the record storage.
+        using DestroyFunc = void (*)(void* storage);
+
+        LogEvent type = LogEvent::Debug;
+        int line = 0;
+        // source file, nullptr for a preformatted message.
+        const char* file = nullptr;
+        // the copy of the format string in the record storage when
+        // the formatting is deferred, otherwise nullptr
+        const char* format = nullptr;
+        FormatFunc formatter = nullptr;
+        DestroyFunc destroy  = nullptr;
+        // steady clock time when the record was queued.
+        std::int64_t time_ns = 0;
+        alignas(std::max_align_t) unsigned char storage[StorageSize];
+    };
+
+    // Single producer, single consumer lock free queue of log records.
+    // The producer is the thread that writes the log messages and the
+    // consumer is the AsyncLogger's dispatch thread.
+    class LogRingBuffer
+    {
+    public:
+        explicit LogRingBuffer(std::size_t capacity);
+       ~LogRingBuffer() noexcept;
+        LogRingBuffer(const LogRingBuffer&) = delete;
+
+        // Get the next free record for writing or nullptr if the buffer is full.
+        // Once the record has been written it's published with EndPush.
+        inline LogRecord* BeginPush() noexcept
+        {
+            const auto head = mHead.load(std::memory_order_relaxed);
+            const auto tail = mTail.load(std::memory_order_acquire);
+            if (head - tail == mRecords.size())
+                return nullptr;
+            return &mRecords[head & mMask];
+        }
+        inline void EndPush() noexcept
+        {
+            const auto head = mHead.load(std::memory_order_relaxed);
+            mHead.store(head + 1, std::memory_order_release);
+        }
+        // Get the oldest record in the buffer or nullptr if the buffer is empty.
+        inline LogRecord* Front() noexcept
+        {
+            const auto tail = mTail.load(std::memory_order_relaxed);
+            const auto head = mHead.load(std::memory_order_acquire);
+            if (head == tail)
+                return nullptr;
+            return &mRecords[tail & mMask];
+        }
+        // Release the oldest record back to the producer.
+        inline void Pop() noexcept
+        {
+            const auto tail = mTail.load(std::memory_order_relaxed);
+            mTail.store(tail + 1, std::memory_order_release);
+        }
+        inline std::size_t GetSize() const noexcept
+        {
+            const auto tail = mTail.load(std::memory_order_acquire);
+            const auto head = mHead.load(std::memory_order_acquire);
+            return head - tail;
+        }
+        // Mark the buffer closed, i.e. the producer will not push more records.
+        inline void Close() noexcept
+        { mClosed.store(true, std::memory_order_release); }
+        inline bool IsClosed() const noexcept
+        { return mClosed.load(std::memory_order_acquire); }
+        inline std::size_t GetCapacity() const noexcept
+        { return mRecords.size(); }
+
+        LogRingBuffer& operator=(const LogRingBuffer&) = delete;
+    private:
+        std::vector<LogRecord> mRecords;
+        const std::size_t mMask = 0;
+        alignas(64) std::atomic<std::uint64_t> mHead = {0};
+        alignas(64) std::atomic<std::uint64_t> mTail = {0};
+        std::atomic<bool> mClosed = {false};
+    };
+
+    namespace detail {
+        // Check whether a log format argument can be copied into a log record
+        // and formatted later on another thread. Types that refer to memory
+        // owned by someone else (pointers, string views etc.) must not be
+        // deferred since the memory might be gone by the time the message is
+        // formatted. Specialize for any other value type that is safe to copy.
+        template<typename T>
+        struct IsDeferredLogArg : std::integral_constant<bool,
+            std::is_arithmetic<T>::value || std::is_enum<T>::value> {};
+        template<> struct IsDeferredLogArg<std::string> : std::true_type {};
+        template<> struct IsDeferredLogArg<FRect> : std::true_type {};
+        template<> struct IsDeferredLogArg<FSize> : std::true_type {};
+        template<> struct IsDeferredLogArg<FPoint> : std::true_type {};
+        template<> struct IsDeferredLogArg<FDegrees> : std::true_type {};
+        template<> struct IsDeferredLogArg<FRadians> : std::true_type {};
+        template<> struct IsDeferredLogArg<Color4f> : std::true_type {};
+        template<typename Enum>
+        struct IsDeferredLogArg<bitflag<Enum>> : std::true_type {};
+#if defined(BASE_FORMAT_SUPPORT_GLM)
+        template<> struct IsDeferredLogArg<glm::vec2> : std::true_type {};
+        template<> struct IsDeferredLogArg<glm::vec3> : std::true_type {};
+        template<> struct IsDeferredLogArg<glm::vec4> : std::true_type {};
+#endif
+
+        // The format arguments and the format string (FormatSize chars
+        // including the terminating null) must fit in the record storage.
+        template<std::size_t FormatSize, typename... Args>
+        constexpr bool CanDeferLogArgs()
+        {
+            using ArgTuple = std::tuple<Args...>;
+            return (IsDeferredLogArg<Args>::value && ...) &&
+                   sizeof(ArgTuple) + FormatSize <= LogRecord::StorageSize &&
+                   alignof(ArgTuple) <= alignof(std::max_align_t);
+        }
+    } // detail
+
+    // Asynchronous logger that moves the formatting and the I/O off the
+    // calling thread. Each writing thread pushes its log records into its
+    // own lock free ring buffer and a background thread periodically drains
+    // the buffers, formats the messages and writes them into the wrapped
+    // (sink) logger in the order of their timestamps. The sink is only ever
+    // accessed by one thread at a time, so it doesn't need to be thread safe.
+    //
+    // When the log macros are used with a char array (string literal) format
+    // string and arguments that can be deferred (see IsDeferredLogArg) the
+    // format string and the arguments are copied into the log record and the
+    // string formatting happens on the background thread. Other log messages are formatted on the calling
+    // thread as before and only the I/O is deferred.
+    //
+    // If the flush interval is 0 no background thread is created and the
+    // log records are dispatched into the sink when Dispatch or Flush is
+    // called. This is useful when the sink has thread affinity such as the
+    // EmscriptenLogger.
+    class AsyncLogger : public Logger
+    {
+    public:
+        // What to do when the calling thread's ring buffer is full.
+        enum class OverflowPolicy {
+            // Drop the new log message and count the drop. The number
+            // of dropped messages is written into the sink as a warning
+            // on the next dispatch.
+            Drop,
+            // Block the calling thread until the background thread has
+            // made space in the buffer. Without a background thread
+            // this is the same as Drop.
+            Block
+        };
+        struct Stats {
+            // Number of messages written into the sink.
+            std::uint64_t written = 0;
+            // Number of messages dropped because of a full buffer.
+            std::uint64_t dropped = 0;
+            // Number of times a writer was blocked because of a full buffer.
+            std::uint64_t blocked = 0;
+            // Time from queuing a message until it was written into the sink.
+            double avg_latency_us = 0.0;
+            std::uint64_t max_latency_us = 0;
+        };
+
+        explicit AsyncLogger(std::unique_ptr<Logger> sink,
+                             OverflowPolicy policy = OverflowPolicy::Drop,
+                             unsigned flush_interval_ms = 20,
+                             std::size_t ring_buffer_capacity = 512);
+       ~AsyncLogger() noexcept;
+        AsyncLogger(const AsyncLogger&) = delete;
+
+        virtual void Write(LogEvent type, const char* file, int line, const char* msg, double time) override;
+        virtual void Write(LogEvent type, const char* msg) override;
+        // Dispatch all the queued log messages and flush the sink. Thread safe.
+        virtual void Flush() override;
+        virtual bitflag<WriteType> GetWriteMask() const override
+        {
+            bitflag<WriteType> writes;
+            writes.set(WriteType::WriteRaw);
+            writes.set(WriteType::WriteDeferred);
+            return writes;
+        }
+
+        // Write a log message with the format string and the format
+        // arguments captured by value.
+        template<std::size_t N, typename... Args>
+        void WriteDeferred(LogEvent type, const char* file, int line, const char (&fmt)[N], const Args&... args)
+        {
+            static_assert(detail::CanDeferLogArgs<N, Args...>(), "Log arguments can't be deferred.");
+            using ArgTuple = std::tuple<Args...>;
+
+            auto* buffer = GetThreadBuffer();
+            auto* record = BeginRecord(buffer, type, file, line);
+            if (record == nullptr)
+                return;
+            new (record->storage) ArgTuple(args...);
+            // copy the format string too since a char array format
+            // string isn't necessarily a string literal.
+            auto* format = reinterpret_cast<char*>(record->storage) + sizeof(ArgTuple);
+            std::memcpy(format, fmt, N);
+            format[N-1] = 0;
+            record->format    = format;
+            record->formatter = &FormatArgs<Args...>;
+            record->destroy   = &DestroyArgs<ArgTuple>;
+            buffer->EndPush();
+        }
+
+        // Dispatch the queued log messages into the sink on the calling thread.
+        void Dispatch();
+
+        Stats GetStats() const;
+
+        Logger& GetSink()
+        { return *mSink; }
+
+        AsyncLogger& operator=(const AsyncLogger&) = delete;
+    private:
+        template<typename... Args>
+        static void FormatArgs(const char* format, const void* storage, std::string* out)
+        {
+            const auto& tuple = *static_cast<const std::tuple<Args...>*>(storage);
+            *out = std::apply([format](const auto&... args) {
+                return FormatString(format, args...);
+            }, tuple);
+        }
+        template<typename T>
+        static void DestroyArgs(void* storage)
+        {
+            static_cast<T*>(storage)->~T();
+        }
+        LogRingBuffer* GetThreadBuffer();
+        LogRecord* BeginRecord(LogRingBuffer* buffer, LogEvent type, const char* file, int line);
+        void PushMessage(LogEvent type, const char* file, int line, const char* msg);
+        void ThreadMain();
+        void DrainLocked();
+    private:
+        struct Message {
+            LogEvent type = LogEvent::Debug;
+            const char* file = nullptr;
+            int line = 0;
+            std::int64_t time_ns = 0;
+            std::string msg;
+        };
+        const std::uint64_t mId = 0;
+        const OverflowPolicy mPolicy = OverflowPolicy::Drop;
+        const unsigned mFlushInterval = 0;
+        const std::size_t mRingBufferCapacity = 0;
+        // protects the sink and the consumer side of the ring buffers.
+        std::mutex mDrainMutex;
+        std::unique_ptr<Logger> mSink;
+        std::vector<Message> mMessages;
+        std::vector<std::shared_ptr<LogRingBuffer>> mDrainBuffers;
+        // drop count that has already been reported to the sink.
+        std::uint64_t mReportedDropCount = 0;
+        // protects the list of ring buffers.
+        std::mutex mBufferMutex;
+        std::vector<std::shared_ptr<LogRingBuffer>> mBuffers;
+        // the dispatch thread state
+        std::thread mThread;
+        std::mutex mThreadMutex;
+        std::condition_variable mCondition;
+        bool mShutdown = false;
+        // stats
+        std::atomic<std::uint64_t> mWriteCount = {0};
+        std::atomic<std::uint64_t> mDropCount = {0};
+        std::atomic<std::uint64_t> mBlockCount = {0};
+        std::atomic<std::uint64_t> mLatencySumUs = {0};
+        std::atomic<std::uint64_t> mLatencyMaxUs = {0};
+    };
+
     // Set the logger object for all threads to use. Each thread can override
     // this setting by setting a thread specific log. If a thread specific
     // logger is set that will the precedence over global logger.
@@ -398,6 +685,30 @@ namespace base
         WriteLogMessage(type, file, line, FormatString(fmt, args...));
     }
 
+    // Get the calling thread's logger (or the global logger) if it
+    // supports deferred formatting, i.e. it's an AsyncLogger.
+    AsyncLogger* GetDeferredLog();
+
+    // Overload for char array (string literal) format strings. When the logger
+    // is an AsyncLogger and the format string and the arguments can be copied
+    // the formatting is deferred to the logger's dispatch thread.
+    template<std::size_t N, typename... Args>
+    void WriteLog(LogEvent type, const char* file, int line, const char (&fmt)[N], const Args&... args)
+    {
+        if (!IsLogEventEnabled(type))
+            return;
+
+        if constexpr (detail::CanDeferLogArgs<N, Args...>())
+        {
+            if (auto* logger = GetDeferredLog())
+            {
+                logger->WriteDeferred(type, file, line, fmt, args...);
+                return;
+            }
+        }
+        WriteLogMessage(type, file, line, FormatString(fmt, args...));
+    }
+
 } // base
 
 // C style interface for doing dymamic address / function resolution.
@@ -25,6 +25,7 @@
 #include <algorithm>
 #include <vector>
 #include <utility>
+#include <type_traits>
 #include <new>
 
 #include "base/assert.h"
@@ -417,6 +418,204 @@ namespace mem
         std::vector<PoolAllocator> mPools;
     };
 
+    // Linear allocator for short-lived scratch data such as data that is
+    // rebuilt every frame. Allocations are bumped from a single heap block
+    // and released all at once with Reset. When the block runs out more
+    // overflow blocks are allocated from the heap and on the next Reset
+    // the arena (lazily) grows the main block to cover the previous peak
+    // usage. In steady state the arena thus performs no heap allocations.
+    // Individual allocations cannot be freed and no destructors are run
+    // by the arena. Not thread safe.
+    class FrameArena
+    {
+    public:
+        explicit FrameArena(size_t initial_bytes = 0) noexcept
+          : mNextCapacity(initial_bytes)
+        {}
+        FrameArena(const FrameArena&) = delete;
+       ~FrameArena() noexcept
+        {
+            FreeOverflow();
+            std::free(mMainBlock);
+        }
+
+        // Allocate a new block of memory with the given alignment. The
+        // alignment must be a power of two.
+        // Throws std::bad_alloc if the heap allocation fails.
+        [[nodiscard]]
+        inline void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+        {
+            ASSERT(alignment && (alignment & (alignment - 1)) == 0);
+            if (mBuffer)
+            {
+                const auto offset = AlignOffset(mBuffer, mOffset, alignment);
+                if (offset + bytes <= mBufferSize)
+                {
+                    mUsedBytes += offset - mOffset + bytes;
+                    mOffset = offset + bytes;
+                    return mBuffer + offset;
+                }
+            }
+            return AllocateSlow(bytes, alignment);
+        }
+
+        // Release all allocations at once. If overflow blocks were needed
+        // the main block is replaced with a bigger one on next allocation.
+        void Reset() noexcept
+        {
+            if (mOverflow)
+            {
+                FreeOverflow();
+                std::free(mMainBlock);
+                mMainBlock    = nullptr;
+                mMainSize     = 0;
+                mNextCapacity = std::max(mNextCapacity, mUsedBytes + mUsedBytes / 2);
+            }
+            mBuffer     = mMainBlock;
+            mBufferSize = mMainSize;
+            mOffset     = 0;
+            mUsedBytes  = 0;
+            mHeapAllocs = 0;
+        }
+
+        // Number of bytes allocated (including alignment padding)
+        // since the last Reset.
+        inline size_t GetUsedBytes() const noexcept
+        { return mUsedBytes; }
+        // Capacity of the main block in bytes.
+        inline size_t GetCapacity() const noexcept
+        { return mMainSize; }
+        // Number of heap allocations done since the last Reset.
+        inline size_t GetHeapAllocCount() const noexcept
+        { return mHeapAllocs; }
+        // Number of heap allocations done during the arena's lifetime.
+        inline size_t GetTotalHeapAllocCount() const noexcept
+        { return mTotalHeapAllocs; }
+
+        FrameArena& operator=(const FrameArena&) = delete;
+    private:
+        struct OverflowBlock {
+            OverflowBlock* next = nullptr;
+        };
+        // keep the data following the header maximally aligned.
+        static constexpr size_t OverflowHeaderSize = (sizeof(OverflowBlock) + alignof(std::max_align_t) - 1) &
+                                                    ~(alignof(std::max_align_t) - 1);
+
+        static size_t AlignOffset(const std::uint8_t* buffer, size_t offset, size_t alignment) noexcept
+        {
+            const auto base = reinterpret_cast<std::uintptr_t>(buffer);
+            return mem::align(base + offset, alignment) - base;
+        }
+
+        void* AllocateSlow(size_t bytes, size_t alignment)
+        {
+            // the heap blocks are only aligned to max_align_t so reserve
+            // room for aligning an allocation with a stricter alignment.
+            const auto padding = alignment > alignof(std::max_align_t)
+                               ? alignment - alignof(std::max_align_t) : 0;
+            bytes += padding;
+
+            if (mMainBlock == nullptr && mOverflow == nullptr)
+            {
+                const auto size = std::max(mNextCapacity, bytes);
+                mMainBlock = (std::uint8_t*)std::malloc(size);
+                if (mMainBlock == nullptr)
+                    throw std::bad_alloc();
+                mMainSize   = size;
+                mBuffer     = mMainBlock;
+                mBufferSize = size;
+            }
+            else
+            {
+                // grow geometrically so that the number of overflow blocks
+                // during a single frame stays small.
+                const auto size = std::max(bytes, std::max(mBufferSize * 2, size_t(4096)));
+                auto* block = (std::uint8_t*)std::malloc(OverflowHeaderSize + size);
+                if (block == nullptr)
+                    throw std::bad_alloc();
+                auto* header = (OverflowBlock*)block;
+                header->next = mOverflow;
+                mOverflow    = header;
+                mBuffer      = block + OverflowHeaderSize;
+                mBufferSize  = size;
+            }
+            ++mHeapAllocs;
+            ++mTotalHeapAllocs;
+            const auto offset = AlignOffset(mBuffer, 0, alignment);
+            ASSERT(offset <= padding);
+            mOffset     = bytes - padding + offset;
+            mUsedBytes += mOffset;
+            return mBuffer + offset;
+        }
+        void FreeOverflow() noexcept
+        {
+            while (mOverflow)
+            {
+                auto* next = mOverflow->next;
+                std::free(mOverflow);
+                mOverflow = next;
+            }
+        }
+    private:
+        // the main block that is re-used across resets.
+        std::uint8_t* mMainBlock = nullptr;
+        std::size_t mMainSize = 0;
+        // the current block we're bumping from. either
+        // the main block or the latest overflow block.
+        std::uint8_t* mBuffer = nullptr;
+        std::size_t mBufferSize = 0;
+        std::size_t mOffset = 0;
+        // list of overflow blocks allocated since last reset.
+        OverflowBlock* mOverflow = nullptr;
+        std::size_t mNextCapacity = 0;
+        std::size_t mUsedBytes = 0;
+        std::size_t mHeapAllocs = 0;
+        std::size_t mTotalHeapAllocs = 0;
+    };
+
+    // Standard library compatible allocator adapter for allocating
+    // container memory from a FrameArena. Deallocation is a no-op,
+    // the memory is reclaimed when the arena is reset. Any container
+    // using the arena must therefore not be used after the reset.
+    template<typename T>
+    class ArenaAllocator
+    {
+    public:
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::true_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        explicit ArenaAllocator(FrameArena* arena) noexcept
+          : mArena(arena)
+        {}
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+          : mArena(other.GetArena())
+        {}
+
+        [[nodiscard]]
+        inline T* allocate(size_t n)
+        { return static_cast<T*>(mArena->Allocate(n * sizeof(T), alignof(T))); }
+        inline void deallocate(T*, size_t) noexcept
+        { /* intentionally empty */ }
+
+        inline FrameArena* GetArena() const noexcept
+        { return mArena; }
+
+        template<typename U>
+        inline bool operator==(const ArenaAllocator<U>& other) const noexcept
+        { return mArena == other.GetArena(); }
+        template<typename U>
+        inline bool operator!=(const ArenaAllocator<U>& other) const noexcept
+        { return mArena != other.GetArena(); }
+    private:
+        FrameArena* mArena = nullptr;
+    };
+
+    template<typename T>
+    using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
     struct StandardAllocatorTag {};
 
     template<typename T>
@@ -0,0 +1,248 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include "warnpush.h"
+#  include <nlohmann/json.hpp>
+#include "warnpop.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "base/metrics.h"
+
+namespace {
+base::MetricsRegistry* global_metrics = nullptr;
+
+unsigned FindMostSignificantBit(std::uint64_t value) noexcept
+{
+    unsigned ret = 0;
+    for (unsigned shift = 32; shift; shift >>= 1)
+    {
+        if (value >> shift)
+        {
+            value >>= shift;
+            ret += shift;
+        }
+    }
+    return ret;
+}
+
+template<typename Metric, typename Map>
+Metric& GetOrCreate(Map& map, std::string_view name)
+{
+    auto it = map.find(name);
+    if (it != map.end())
+        return *it->second;
+    auto metric = std::make_unique<Metric>();
+    auto* ret = metric.get();
+    map.emplace(std::string(name), std::move(metric));
+    return *ret;
+}
+
+template<typename Metric, typename Map>
+const Metric* Find(const Map& map, std::string_view name)
+{
+    auto it = map.find(name);
+    if (it != map.end())
+        return it->second.get();
+    return nullptr;
+}
+
+} // namespace
+
+namespace base
+{
+
+Histogram::Histogram() noexcept
+{
+    for (auto& bucket : mBuckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::Record(std::uint64_t value) noexcept
+{
+    mBuckets[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(value, std::memory_order_relaxed);
+
+    auto min = mMin.load(std::memory_order_relaxed);
+    while (value < min && !mMin.compare_exchange_weak(min, value, std::memory_order_relaxed))
+        ;
+    auto max = mMax.load(std::memory_order_relaxed);
+    while (value > max && !mMax.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        ;
+}
+
+std::uint64_t Histogram::GetPercentile(double percentile) const noexcept
+{
+    const auto count = GetCount();
+    if (count == 0)
+        return 0;
+
+    percentile = std::clamp(percentile, 0.0, 100.0);
+    const auto target = std::max<std::uint64_t>(1, (std::uint64_t)std::ceil(percentile / 100.0 * count));
+
+    std::uint64_t sum = 0;
+    for (unsigned i=0; i<BucketCount; ++i)
+    {
+        sum += mBuckets[i].load(std::memory_order_relaxed);
+        if (sum >= target)
+            return std::clamp(GetBucketHighValue(i), GetMin(), GetMax());
+    }
+    return GetMax();
+}
+
+void Histogram::Reset() noexcept
+{
+    for (auto& bucket : mBuckets)
+        bucket.store(0, std::memory_order_relaxed);
+    mCount.store(0, std::memory_order_relaxed);
+    mSum.store(0, std::memory_order_relaxed);
+    mMin.store(~std::uint64_t(0), std::memory_order_relaxed);
+    mMax.store(0, std::memory_order_relaxed);
+}
+
+// static
+unsigned Histogram::GetBucketIndex(std::uint64_t value) noexcept
+{
+    if (value < SubBucketCount)
+        return static_cast<unsigned>(value);
+
+    // the top SubBucketBits+1 bits of the value select the bucket
+    // inside the power of two range indicated by the most significant bit.
+    const auto shift = FindMostSignificantBit(value) - SubBucketBits;
+    const auto sub_bucket = static_cast<unsigned>(value >> shift) - SubBucketCount;
+    return SubBucketCount + shift * SubBucketCount + sub_bucket;
+}
+// static
+std::uint64_t Histogram::GetBucketLowValue(unsigned index) noexcept
+{
+    if (index < SubBucketCount)
+        return index;
+
+    const auto shift = (index - SubBucketCount) / SubBucketCount;
+    const auto sub_bucket = (index - SubBucketCount) % SubBucketCount;
+    return std::uint64_t(SubBucketCount + sub_bucket) << shift;
+}
+// static
+std::uint64_t Histogram::GetBucketHighValue(unsigned index) noexcept
+{
+    if (index < SubBucketCount)
+        return index;
+
+    const auto shift = (index - SubBucketCount) / SubBucketCount;
+    return GetBucketLowValue(index) + ((std::uint64_t(1) << shift) - 1);
+}
+
+Counter& MetricsRegistry::GetCounter(std::string_view name)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return GetOrCreate<Counter>(mCounters, name);
+}
+Gauge& MetricsRegistry::GetGauge(std::string_view name)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return GetOrCreate<Gauge>(mGauges, name);
+}
+Histogram& MetricsRegistry::GetHistogram(std::string_view name)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return GetOrCreate<Histogram>(mHistograms, name);
+}
+
+const Counter* MetricsRegistry::FindCounter(std::string_view name) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return Find<Counter>(mCounters, name);
+}
+const Gauge* MetricsRegistry::FindGauge(std::string_view name) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return Find<Gauge>(mGauges, name);
+}
+const Histogram* MetricsRegistry::FindHistogram(std::string_view name) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return Find<Histogram>(mHistograms, name);
+}
+
+void MetricsRegistry::Reset()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& pair : mCounters)
+        pair.second->Reset();
+    for (auto& pair : mGauges)
+        pair.second->Reset();
+    for (auto& pair : mHistograms)
+        pair.second->Reset();
+}
+
+std::string MetricsRegistry::ToJson() const
+{
+    nlohmann::json json;
+    json["counters"]   = nlohmann::json::object();
+    json["gauges"]     = nlohmann::json::object();
+    json["histograms"] = nlohmann::json::object();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (const auto& pair : mCounters)
+        json["counters"][pair.first] = pair.second->GetValue();
+    for (const auto& pair : mGauges)
+        json["gauges"][pair.first] = pair.second->GetValue();
+    for (const auto& pair : mHistograms)
+    {
+        const auto& histogram = *pair.second;
+        auto& obj = json["histograms"][pair.first];
+        obj["count"] = histogram.GetCount();
+        obj["min"]   = histogram.GetMin();
+        obj["max"]   = histogram.GetMax();
+        obj["mean"]  = histogram.GetMean();
+        obj["p50"]   = histogram.GetPercentile(50.0);
+        obj["p90"]   = histogram.GetPercentile(90.0);
+        obj["p99"]   = histogram.GetPercentile(99.0);
+        obj["p999"]  = histogram.GetPercentile(99.9);
+    }
+    return json.dump();
+}
+
+MetricsRegistry* SetGlobalMetrics(MetricsRegistry* metrics)
+{
+    auto* ret = global_metrics;
+    global_metrics = metrics;
+    return ret;
+}
+
+MetricsRegistry* GetGlobalMetrics()
+{
+    return global_metrics;
+}
+
+Counter* GetGlobalCounter(std::string_view name)
+{
+    return global_metrics ? &global_metrics->GetCounter(name) : nullptr;
+}
+Gauge* GetGlobalGauge(std::string_view name)
+{
+    return global_metrics ? &global_metrics->GetGauge(name) : nullptr;
+}
+Histogram* GetGlobalHistogram(std::string_view name)
+{
+    return global_metrics ? &global_metrics->GetHistogram(name) : nullptr;
+}
+
+} // namespace
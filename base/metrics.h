@@ -0,0 +1,184 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace base
+{
+    // Monotonically increasing event count. Thread safe.
+    class Counter
+    {
+    public:
+        inline void Increment(std::uint64_t count = 1) noexcept
+        { mValue.fetch_add(count, std::memory_order_relaxed); }
+        inline std::uint64_t GetValue() const noexcept
+        { return mValue.load(std::memory_order_relaxed); }
+        inline void Reset() noexcept
+        { mValue.store(0, std::memory_order_relaxed); }
+    private:
+        std::atomic<std::uint64_t> mValue = {0};
+    };
+
+    // The last value of some quantity, for example the number of
+    // draw calls on the last frame. Thread safe.
+    class Gauge
+    {
+    public:
+        inline void SetValue(double value) noexcept
+        { mValue.store(value, std::memory_order_relaxed); }
+        inline double GetValue() const noexcept
+        { return mValue.load(std::memory_order_relaxed); }
+        inline void Reset() noexcept
+        { mValue.store(0.0, std::memory_order_relaxed); }
+    private:
+        std::atomic<double> mValue = {0.0};
+    };
+
+    // Distribution of integer values such as latencies in microseconds.
+    // The values are recorded into log-linear buckets (similar to HDR
+    // histogram) so that each bucket covers ~3% of its value range.
+    // Values below 32 are recorded exactly. Recording is lock free and
+    // thread safe. The percentiles are approximations within the bucket
+    // precision.
+    class Histogram
+    {
+    public:
+        static constexpr unsigned SubBucketBits  = 5;
+        static constexpr unsigned SubBucketCount = 1u << SubBucketBits;
+        static constexpr unsigned BucketCount    = SubBucketCount + (64 - SubBucketBits) * SubBucketCount;
+
+        Histogram() noexcept;
+
+        void Record(std::uint64_t value) noexcept;
+
+        inline std::uint64_t GetCount() const noexcept
+        { return mCount.load(std::memory_order_relaxed); }
+        inline std::uint64_t GetSum() const noexcept
+        { return mSum.load(std::memory_order_relaxed); }
+        inline std::uint64_t GetMin() const noexcept
+        { return GetCount() ? mMin.load(std::memory_order_relaxed) : 0; }
+        inline std::uint64_t GetMax() const noexcept
+        { return mMax.load(std::memory_order_relaxed); }
+        inline double GetMean() const noexcept
+        {
+            const auto count = GetCount();
+            return count ? double(GetSum()) / double(count) : 0.0;
+        }
+        // Get the (approximate) value at the given percentile [0.0, 100.0].
+        // Returns 0 if the histogram is empty.
+        std::uint64_t GetPercentile(double percentile) const noexcept;
+
+        void Reset() noexcept;
+
+        // Map a value to a bucket index and a bucket index to the
+        // lowest value recorded in the bucket.
+        static unsigned GetBucketIndex(std::uint64_t value) noexcept;
+        static std::uint64_t GetBucketLowValue(unsigned index) noexcept;
+        static std::uint64_t GetBucketHighValue(unsigned index) noexcept;
+    private:
+        std::array<std::atomic<std::uint64_t>, BucketCount> mBuckets;
+        std::atomic<std::uint64_t> mCount = {0};
+        std::atomic<std::uint64_t> mSum   = {0};
+        std::atomic<std::uint64_t> mMin   = {~std::uint64_t(0)};
+        std::atomic<std::uint64_t> mMax   = {0};
+    };
+
+    // Record the time spent in a scope into a histogram in microseconds.
+    // A nullptr histogram is allowed and turns the timer into a no-op.
+    class HistogramTimer
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit HistogramTimer(Histogram* histogram) noexcept
+          : mHistogram(histogram)
+        {
+            if (mHistogram)
+                mStart = Clock::now();
+        }
+       ~HistogramTimer() noexcept
+        {
+            if (!mHistogram)
+                return;
+            const auto gone = Clock::now() - mStart;
+            mHistogram->Record(std::chrono::duration_cast<std::chrono::microseconds>(gone).count());
+        }
+        HistogramTimer(const HistogramTimer&) = delete;
+        HistogramTimer& operator=(const HistogramTimer&) = delete;
+    private:
+        Histogram* mHistogram = nullptr;
+        Clock::time_point mStart;
+    };
+
+    // Collection of named metrics. Once created a metric object remains
+    // valid for the lifetime of the registry so the subsystems can look up
+    // their metrics once and then update them without going through the
+    // registry. Creating and finding metrics is thread safe.
+    class MetricsRegistry
+    {
+    public:
+        Counter& GetCounter(std::string_view name);
+        Gauge& GetGauge(std::string_view name);
+        Histogram& GetHistogram(std::string_view name);
+
+        const Counter* FindCounter(std::string_view name) const;
+        const Gauge* FindGauge(std::string_view name) const;
+        const Histogram* FindHistogram(std::string_view name) const;
+
+        // Reset the values of all the metrics.
+        void Reset();
+
+        // Take a snapshot of all the current metric values in JSON.
+        // Histograms are summarized with count, min, max, mean and
+        // p50, p90, p99 and p999 percentiles.
+        std::string ToJson() const;
+    private:
+        template<typename Metric>
+        using MetricMap = std::map<std::string, std::unique_ptr<Metric>, std::less<>>;
+
+        mutable std::mutex mMutex;
+        MetricMap<Counter> mCounters;
+        MetricMap<Gauge> mGauges;
+        MetricMap<Histogram> mHistograms;
+    };
+
+    // Set the metrics registry used by all threads and subsystems.
+    // Returns the previous registry (if any). nullptr is a valid value
+    // and turns off the metrics collection.
+    MetricsRegistry* SetGlobalMetrics(MetricsRegistry* metrics);
+
+    // Get access to the global metrics registry (if any).
+    MetricsRegistry* GetGlobalMetrics();
+
+    // Find or create a metric in the global registry. If there's no
+    // global registry these return nullptr.
+    Counter* GetGlobalCounter(std::string_view name);
+    Gauge* GetGlobalGauge(std::string_view name);
+    Histogram* GetGlobalHistogram(std::string_view name);
+
+} // namespace
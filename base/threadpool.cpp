@@ -21,6 +21,9 @@
 #include <functional>
 #include <mutex>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <cstdint>
 
 #include "base/assert.h"
 #include "base/logging.h"
@@ -29,12 +32,139 @@
 
 namespace {
     base::ThreadPool* global_thread_pool;
+    std::atomic<std::int64_t> task_wait_spin_limit_us = {200};
+
+// Chase-Lev work stealing deque. The owner thread pushes and pops
+// items at the bottom end and any other thread can steal items from
+// the top end. Based on "Correct and Efficient Work-Stealing for Weak
+// Memory Models" by Lê, Pop, Cohen and Nardelli.
+template<typename T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(std::int64_t capacity = 256)
+    {
+        mBuffers.push_back(std::make_unique<Buffer>(capacity));
+        mBuffer.store(mBuffers.back().get(), std::memory_order_relaxed);
+    }
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+
+    // Push a new item at the bottom of the deque. Owner only.
+    void Push(T item)
+    {
+        const auto bottom = mBottom.load(std::memory_order_relaxed);
+        const auto top    = mTop.load(std::memory_order_acquire);
+        auto* buffer = mBuffer.load(std::memory_order_relaxed);
+        if (bottom - top > buffer->capacity - 1)
+            buffer = Grow(buffer, top, bottom);
+
+        buffer->Put(bottom, item);
+        mBottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    // Pop the most recently pushed item from the bottom of the deque. Owner only.
+    bool Pop(T* item)
+    {
+        const auto bottom = mBottom.load(std::memory_order_relaxed) - 1;
+        auto* buffer = mBuffer.load(std::memory_order_relaxed);
+        mBottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = mTop.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            // deque was empty.
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        *item = buffer->Get(bottom);
+        if (top == bottom)
+        {
+            // last item, race against the thieves.
+            const bool won = mTop.compare_exchange_strong(top, top + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Steal the oldest item from the top of the deque. Any thread.
+    bool Steal(T* item)
+    {
+        auto top = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto bottom = mBottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return false;
+
+        auto* buffer = mBuffer.load(std::memory_order_acquire);
+        const auto ret = buffer->Get(top);
+        if (!mTop.compare_exchange_strong(top, top + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false;
+
+        *item = ret;
+        return true;
+    }
+
+    bool IsEmpty() const noexcept
+    {
+        const auto bottom = mBottom.load(std::memory_order_relaxed);
+        const auto top    = mTop.load(std::memory_order_relaxed);
+        return top >= bottom;
+    }
+
+private:
+    struct Buffer {
+        explicit Buffer(std::int64_t size)
+          : capacity(size)
+          , items(new std::atomic<T>[size])
+        {}
+        void Put(std::int64_t index, T item) noexcept
+        { items[index & (capacity - 1)].store(item, std::memory_order_relaxed); }
+        T Get(std::int64_t index) const noexcept
+        { return items[index & (capacity - 1)].load(std::memory_order_relaxed); }
+
+        const std::int64_t capacity;
+        std::unique_ptr<std::atomic<T>[]> items;
+    };
+
+    Buffer* Grow(Buffer* buffer, std::int64_t top, std::int64_t bottom)
+    {
+        auto next = std::make_unique<Buffer>(buffer->capacity * 2);
+        for (auto i=top; i<bottom; ++i)
+            next->Put(i, buffer->Get(i));
+
+        // the previous buffers must be kept alive since a thief
+        // could still be reading from them.
+        mBuffers.push_back(std::move(next));
+        mBuffer.store(mBuffers.back().get(), std::memory_order_release);
+        return mBuffers.back().get();
+    }
+
+private:
+    std::atomic<std::int64_t> mTop    = {0};
+    std::atomic<std::int64_t> mBottom = {0};
+    std::atomic<Buffer*> mBuffer = {nullptr};
+    std::vector<std::unique_ptr<Buffer>> mBuffers;
+};
+
 } // namespace
 
 namespace base
 {
 struct ThreadPool::State {
+    static constexpr size_t MaxWorkers = 64;
+
     std::atomic<size_t> num_tasks = 0;
+    // the number of tasks waiting in the worker deques/inboxes
+    // that any worker thread can take.
+    std::atomic<size_t> num_stealable = 0;
+    // worker threads that participate in work stealing.
+    std::atomic<RealThread*> workers[MaxWorkers] = {};
+    std::atomic<size_t> num_workers = 0;
 };
 
 class ThreadPool::Thread
@@ -52,7 +182,14 @@ public:
        : mState(std::move(state))
        , mThreadId(id)
     {}
+   ~RealThread()
+    {
+        std::shared_ptr<ThreadTask>* task = nullptr;
+        while (mDeque.Pop(&task))
+            delete task;
+    }
 
+    // Submit a task that only this thread can execute.
     void Submit(std::shared_ptr<ThreadTask> task) override
     {
         std::lock_guard<std::mutex> lock(mMutex);
@@ -60,11 +197,57 @@ public:
         mCondition.notify_one();
     }
 
+    // Submit a task that any worker thread can execute.
+    void SubmitStealable(std::shared_ptr<ThreadTask> task)
+    {
+        // if we're on this worker thread the task can go into the
+        // lock-free deque directly, otherwise it goes into the inbox.
+        mState->num_stealable++;
+        if (CurrentThread == this)
+        {
+            mDeque.Push(new std::shared_ptr<ThreadTask>(std::move(task)));
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mInboxMutex);
+            mInbox.push_back(std::move(task));
+        }
+        WakeIdleWorker();
+    }
+
+    // Try to take a task that was submitted to this worker's deque or
+    // inbox. Can be called from any thread.
+    std::shared_ptr<ThreadTask> StealTask()
+    {
+        std::shared_ptr<ThreadTask>* boxed = nullptr;
+        if (mDeque.Steal(&boxed))
+        {
+            std::shared_ptr<ThreadTask> task = std::move(*boxed);
+            delete boxed;
+            mState->num_stealable--;
+            return task;
+        }
+        std::unique_lock<std::mutex> lock(mInboxMutex, std::try_to_lock);
+        if (lock.owns_lock() && !mInbox.empty())
+        {
+            std::shared_ptr<ThreadTask> task = std::move(mInbox.front());
+            mInbox.pop_front();
+            mState->num_stealable--;
+            return task;
+        }
+        return nullptr;
+    }
+
     size_t GetThreadId() const override
     {
         return mThreadId;
     }
 
+    bool IsWorker() const noexcept
+    {
+        return (mThreadId & 0xff00) != 0;
+    }
+
     void Shutdown()
     {
         {
@@ -97,11 +280,100 @@ public:
         mCondition.notify_one();
     }
 
+    static void ExecuteTask(ThreadTask* task)
+    {
+        if (task->TestFlag(ThreadTask::Flags::Tracing))
+        {
+            // record the time the task waited for its inputs and for
+            // a thread to pick it up so that the critical path of a
+            // task graph can be seen in the trace.
+            using us = std::chrono::microseconds;
+            const auto now = ThreadTask::Clock::now();
+            const auto input_wait = std::chrono::duration_cast<us>(task->mReadyTime - task->mSubmitTime);
+            const auto queue_wait = std::chrono::duration_cast<us>(now - task->mReadyTime);
+            TRACE_CALL("Task::Execute", task->Execute(), "%s input_wait=%uus queue_wait=%uus",
+                       task->GetTaskName().c_str(),
+                       unsigned(input_wait.count()),
+                       unsigned(queue_wait.count()));
+        }
+        else
+        {
+            task->Execute();
+        }
+    }
+
+    // Take a stealable task from any worker, starting from the given
+    // worker index so that the thieves spread out over the victims.
+    static std::shared_ptr<ThreadTask> StealAny(State& state, size_t start)
+    {
+        const auto count = state.num_workers.load(std::memory_order_acquire);
+        for (size_t i=0; i<count; ++i)
+        {
+            auto* victim = state.workers[(start + i) % count].load(std::memory_order_acquire);
+            if (auto task = victim->StealTask())
+                return task;
+        }
+        return nullptr;
+    }
+
 private:
+    void WakeIdleWorker()
+    {
+        const auto count = mState->num_workers.load(std::memory_order_acquire);
+        for (size_t i=0; i<count; ++i)
+        {
+            auto* worker = mState->workers[i].load(std::memory_order_acquire);
+            if (worker->mIdle.load())
+            {
+                std::lock_guard<std::mutex> lock(worker->mMutex);
+                worker->mCondition.notify_one();
+                return;
+            }
+        }
+    }
+
+    // Find the next task for this thread to execute. The thread's own
+    // tasks are preferred over the tasks taken from the other workers.
+    std::shared_ptr<ThreadTask> FindTask()
+    {
+        if (!IsWorker())
+            return nullptr;
+
+        std::shared_ptr<ThreadTask>* boxed = nullptr;
+        if (mDeque.Pop(&boxed))
+        {
+            std::shared_ptr<ThreadTask> task = std::move(*boxed);
+            delete boxed;
+            mState->num_stealable--;
+            return task;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mInboxMutex);
+            if (!mInbox.empty())
+            {
+                std::shared_ptr<ThreadTask> task = std::move(mInbox.front());
+                mInbox.pop_front();
+                mState->num_stealable--;
+                return task;
+            }
+        }
+        if (mState->num_stealable.load() == 0)
+            return nullptr;
+
+        return StealAny(*mState, mStealIndex++);
+    }
+
+    bool HasStealableWork() const noexcept
+    {
+        return IsWorker() && mState->num_stealable.load() > 0;
+    }
+
     void ThreadMain()
     {
         DEBUG("Hello from thread pool thread. [id=%1]", mThreadId);
-        std::unique_ptr<base::TraceLog> trace;
+        std::unique_ptr<base::Trace> trace;
+
+        CurrentThread = this;
 
         while (true)
         {
@@ -110,7 +382,7 @@ private:
                 std::lock_guard<std::mutex> lock(mMutex);
                 if (mTraceWriter && !base::GetThreadTrace())
                 {
-                    trace = std::make_unique<base::TraceLog>(1000, base::TraceLog::ThreadId::TaskThread + mThreadId);
+                    trace = mTraceWriter->CreateThreadTrace(base::TraceLog::ThreadId::TaskThread + mThreadId);
                     base::SetThreadTrace(trace.get());
                 }
                 else if (!mTraceWriter && base::GetThreadTrace())
@@ -136,22 +408,38 @@ private:
                 ///TRACE_SCOPE("WaitTask");
                 std::unique_lock<std::mutex> lock(mMutex);
 
-                // use a loop in order to protect against spurious
-                // signals on the condition
-                while (mRunThread && mTaskQueue.empty())
+                // the thread's own queue has the tasks that were explicitly
+                // submitted for this thread. Those must run here.
+                while (true)
                 {
-                    mCondition.wait(lock);
-                }
-
-                if (!mTaskQueue.empty())
-                {
-                    task = std::move(mTaskQueue.front());
-                    mTaskQueue.pop();
+                    if (!mTaskQueue.empty())
+                    {
+                        task = std::move(mTaskQueue.front());
+                        mTaskQueue.pop();
+                        break;
+                    }
+                    lock.unlock();
+                    task = FindTask();
+                    lock.lock();
+                    if (task || !mRunThread)
+                        break;
+
+                    // announce that we're about to go idle *before* checking
+                    // for the stealable work again so that a concurrent submit
+                    // either sees the idle flag or we see the new task.
+                    mIdle.store(true);
+                    // use a loop in order to protect against spurious
+                    // signals on the condition
+                    while (mRunThread && mTaskQueue.empty() && !HasStealableWork())
+                    {
+                        mCondition.wait(lock);
+                    }
+                    mIdle.store(false);
                 }
                 running = mRunThread;
             }
 
-            if (!running)
+            if (!running && !task)
             {
                 ///TRACE_LEAVE(MainLoop);
                 break;
@@ -159,14 +447,12 @@ private:
 
             if (task)
             {
-                if (task->TestFlag(ThreadTask::Flags::Tracing))
-                {
-                    TRACE_CALL("Task::Execute", task->Execute());
-                }
-                else
-                {
-                    task->Execute();
-                }
+                // if there's more work pending make sure that some other
+                // idle worker wakes up to take it.
+                if (HasStealableWork())
+                    WakeIdleWorker();
+
+                ExecuteTask(task.get());
                 mState->num_tasks--;
             }
 
@@ -184,9 +470,14 @@ private:
             }
 
         }
+        CurrentThread = nullptr;
         DEBUG("Thread pool thread exiting... [id=%1]", mThreadId);
     }
 
+public:
+    // The pool thread (if any) that is running on the calling thread.
+    static thread_local RealThread* CurrentThread;
+
 private:
     std::shared_ptr<State> mState;
     std::mutex mMutex;
@@ -194,12 +485,23 @@ private:
     std::unique_ptr<std::thread> mThread;
     std::queue<std::shared_ptr<ThreadTask>> mTaskQueue;
 
+    // Tasks that any worker can execute. The deque has the tasks
+    // submitted by this worker thread itself and the inbox has the
+    // tasks submitted from other threads.
+    WorkStealingDeque<std::shared_ptr<ThreadTask>*> mDeque;
+    std::mutex mInboxMutex;
+    std::deque<std::shared_ptr<ThreadTask>> mInbox;
+    std::atomic<bool> mIdle = {false};
+    std::size_t mStealIndex = 0;
+
     base::TraceWriter* mTraceWriter = nullptr;
     bool mEnableTrace = false;
     bool mRunThread = true;
     std::size_t mThreadId = 0;
 };
 
+thread_local ThreadPool::RealThread* ThreadPool::RealThread::CurrentThread = nullptr;
+
 class ThreadPool::MainThread : public ThreadPool::Thread
 {
 public:
@@ -207,8 +509,11 @@ public:
       : state_(std::move(state))
     {}
 
+    // Note that tasks can be submitted from other threads when
+    // a task that the main thread task depends on completes.
     void Submit(std::shared_ptr<ThreadTask> task) override
     {
+        std::lock_guard<std::mutex> lock(mutex_);
         queue_.push(std::move(task));
     }
     size_t GetThreadId() const override
@@ -220,22 +525,20 @@ public:
     {
         ///TRACE_SCOPE("ExecuteMainThread");
 
-        while (!queue_.empty())
+        while (true)
         {
-            auto task = queue_.front();
-
-            queue_.pop();
+            std::shared_ptr<ThreadTask> task;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (queue_.empty())
+                    break;
+                task = std::move(queue_.front());
+                queue_.pop();
+            }
 
             if (!task->IsComplete())
             {
-                if (task->TestFlag(ThreadTask::Flags::Tracing))
-                {
-                    TRACE_CALL("Task::Execute", task->Execute());
-                }
-                else
-                {
-                    task->Execute();
-                }
+                RealThread::ExecuteTask(task.get());
             }
 
             state_->num_tasks--;
@@ -243,13 +546,68 @@ public:
     }
 private:
     std::shared_ptr<State> state_;
+    std::mutex mutex_;
     std::queue<std::shared_ptr<ThreadTask>> queue_;
 
 };
 
 
+void ThreadTask::Complete()
+{
+    std::vector<std::shared_ptr<ThreadTask>> dependents;
+    {
+        std::lock_guard<std::mutex> lock(mDependentMutex);
+        mDone.store(true, std::memory_order_release);
+        std::swap(dependents, mDependents);
+        if (mHasWaiters)
+            mDoneCondition.notify_all();
+    }
+
+    const bool failed = HasException() || Failed();
+
+    for (auto& dependent : dependents)
+    {
+        if (failed)
+            dependent->mDependencyFailed.store(true);
+
+        if (--dependent->mPendingDependencies == 0)
+        {
+            auto* pool = dependent->mPool;
+            const auto threadId = dependent->mThreadId;
+            pool->Dispatch(std::move(dependent), threadId);
+        }
+    }
+}
+
+bool ThreadTask::AddDependent(std::shared_ptr<ThreadTask> task)
+{
+    std::lock_guard<std::mutex> lock(mDependentMutex);
+    if (mDone.load(std::memory_order_acquire))
+        return false;
+
+    mDependents.push_back(std::move(task));
+    return true;
+}
+
+void ThreadTask::WaitComplete()
+{
+    std::unique_lock<std::mutex> lock(mDependentMutex);
+    mHasWaiters = true;
+    mDoneCondition.wait(lock, [this]() {
+        return mDone.load(std::memory_order_acquire);
+    });
+}
+
 void TaskHandle::Wait(WaitStrategy strategy) noexcept
 {
+    Wait(strategy, nullptr);
+}
+
+void TaskHandle::Wait(WaitStrategy strategy, WaitStats* stats) noexcept
+{
+    using clock = std::chrono::steady_clock;
+    using us = std::chrono::microseconds;
+
     // assuming our current thread is the "main" thread
     // if we call here to wait for completion we'll spin
     // indefinitely since the current thread would then
@@ -257,12 +615,58 @@ void TaskHandle::Wait(WaitStrategy strategy) noexcept
 
     if (mThreadId == ThreadPool::MainThreadID)
     {
+        // the task can only execute once its dependencies are done.
+        while (!IsComplete())
+        {
+            if (mTask->IsReady())
+            {
+                mTask->Execute();
+                break;
+            }
+            if (strategy == WaitStrategy::Sleep)
+                std::this_thread::sleep_for(std::chrono::microseconds(1));
+        }
+    }
+
+    if (strategy == WaitStrategy::WaitCondition || strategy == WaitStrategy::SpinThenPark)
+    {
+        const auto spin_start = clock::now();
+        const auto spin_limit = strategy == WaitStrategy::SpinThenPark ? GetSpinLimit() : us(0);
+
+        // spin first in the hope that the task completes soon and
+        // we can avoid the cost of putting the thread to sleep and
+        // waking it up again.
+        if (spin_limit.count() && !IsComplete())
+        {
+            TRACE_ENTER(Spin);
+            for (unsigned i=1; !IsComplete(); ++i)
+            {
+                // don't read the clock on every iteration.
+                if ((i % 64) == 0 && clock::now() - spin_start >= spin_limit)
+                    break;
+            }
+            TRACE_LEAVE(Spin);
+        }
+        const auto park_start = clock::now();
+
         if (!IsComplete())
         {
-            mTask->Execute();
+            TRACE_ENTER(Park);
+            mTask->WaitComplete();
+            TRACE_LEAVE(Park);
+        }
+
+        if (stats)
+        {
+            const auto now = clock::now();
+            stats->spin_time = std::chrono::duration_cast<us>(park_start - spin_start);
+            stats->park_time = std::chrono::duration_cast<us>(now - park_start);
         }
+        return;
     }
 
+    const auto start = clock::now();
+
     while (!IsComplete())
     {
         // holy hell batman, let's not cause a stall here by blocking the
@@ -275,11 +679,30 @@ void TaskHandle::Wait(WaitStrategy strategy) noexcept
             std::this_thread::sleep_for(std::chrono::microseconds(1));
         }
     }
+    if (stats)
+    {
+        const auto time = std::chrono::duration_cast<us>(clock::now() - start);
+        if (strategy == WaitStrategy::Sleep)
+            stats->park_time = time;
+        else stats->spin_time = time;
+    }
+}
+
+// static
+void TaskHandle::SetSpinLimit(std::chrono::microseconds limit) noexcept
+{
+    task_wait_spin_limit_us.store(limit.count());
+}
+// static
+std::chrono::microseconds TaskHandle::GetSpinLimit() noexcept
+{
+    return std::chrono::microseconds(task_wait_spin_limit_us.load());
 }
 
 
-ThreadPool::ThreadPool()
+ThreadPool::ThreadPool(Scheduler scheduler)
   : mState(std::make_shared<State>())
+  , mScheduler(scheduler)
 {}
 
 ThreadPool::~ThreadPool()
@@ -290,6 +713,13 @@ ThreadPool::~ThreadPool()
 void ThreadPool::AddRealThread(size_t threadId)
 {
     auto thread = std::make_unique<RealThread>(mState, threadId);
+    if (thread->IsWorker())
+    {
+        const auto index = mState->num_workers.load();
+        ASSERT(index < State::MaxWorkers);
+        mState->workers[index].store(thread.get());
+        mState->num_workers.store(index + 1);
+    }
     thread->Start();
     mRealThreads.push_back(std::move(thread));
     DEBUG("Added real thread pool thread.");
@@ -304,6 +734,61 @@ void ThreadPool::AddMainThread()
 
 TaskHandle ThreadPool::SubmitTask(std::unique_ptr<ThreadTask> task, size_t threadId)
 {
+    std::shared_ptr<ThreadTask> shared(std::move(task));
+
+    TaskHandle handle(shared, threadId);
+
+    shared->mPool       = this;
+    shared->mThreadId   = threadId;
+    shared->mSubmitTime = ThreadTask::Clock::now();
+
+    mState->num_tasks++;
+
+    Dispatch(std::move(shared), threadId);
+
+    return handle;
+}
+
+TaskHandle ThreadPool::SubmitTask(std::unique_ptr<ThreadTask> task, size_t threadId,
+                                  const std::vector<TaskHandle>& dependencies)
+{
+    std::shared_ptr<ThreadTask> shared(std::move(task));
+
+    TaskHandle handle(shared, threadId);
+
+    shared->mPool       = this;
+    shared->mThreadId   = threadId;
+    shared->mSubmitTime = ThreadTask::Clock::now();
+
+    mState->num_tasks++;
+
+    // hold one extra reference on the pending count while the dependencies
+    // are being added so that a dependency completing concurrently can't
+    // dispatch the task before we're done here.
+    shared->mPendingDependencies.store(dependencies.size() + 1);
+
+    for (const auto& dependency : dependencies)
+    {
+        if (dependency.IsValid() && dependency.mTask->AddDependent(shared))
+            continue;
+
+        // the dependency has already completed.
+        if (dependency.IsValid() && (dependency.mTask->HasException() || dependency.mTask->Failed()))
+            shared->mDependencyFailed.store(true);
+
+        shared->mPendingDependencies--;
+    }
+
+    if (--shared->mPendingDependencies == 0)
+        Dispatch(std::move(shared), threadId);
+
+    return handle;
+}
+
+void ThreadPool::Dispatch(std::shared_ptr<ThreadTask> task, std::size_t threadId)
+{
+    task->mReadyTime = ThreadTask::Clock::now();
+
     Thread* thread = nullptr;
 
     if (threadId == ThreadPool::MainThreadID)
@@ -313,18 +798,25 @@ TaskHandle ThreadPool::SubmitTask(std::unique_ptr<ThreadTask> task, size_t threa
     }
     else if (threadId == ThreadPool::AnyWorkerThreadID)
     {
-        std::vector<RealThread*> workers;
-        for (auto& t : mRealThreads)
-        {
-            if (t->GetThreadId() & 0xff00)
-                workers.push_back(t.get());
+        const auto num_workers = mState->num_workers.load();
+        ASSERT(num_workers && "The thread pool has no worker threads.");
 
-        }
-
-        ASSERT(!workers.empty() && "The thread pool has no worker threads.");
-        thread = workers[mRoundRobin % workers.size()];
-        mRoundRobin++;
+        auto* worker = mState->workers[mRoundRobin++ % num_workers].load();
 
+        if (mScheduler == Scheduler::WorkStealing)
+        {
+            // prefer the current worker's own deque when submitting
+            // from one of this pool's worker threads.
+            for (size_t i=0; i<num_workers; ++i)
+            {
+                auto* current = mState->workers[i].load();
+                if (current == RealThread::CurrentThread)
+                    worker = current;
+            }
+            worker->SubmitStealable(std::move(task));
+            return;
+        }
+        thread = worker;
     }
     else
     {
@@ -339,15 +831,7 @@ TaskHandle ThreadPool::SubmitTask(std::unique_ptr<ThreadTask> task, size_t threa
         ASSERT(thread && "No such named thread has been added to the thread pool.");
     }
 
-    std::shared_ptr<ThreadTask> shared(std::move(task));
-
-    TaskHandle handle(shared, threadId);
-
-    thread->Submit(std::move(shared));
-
-    mState->num_tasks++;
-
-    return handle;
+    thread->Submit(std::move(task));
 }
 
 void ThreadPool::Shutdown()
@@ -359,6 +843,7 @@ void ThreadPool::Shutdown()
         thread->Shutdown();
     }
     mRealThreads.clear();
+    mState->num_workers.store(0);
 
     mMainThread.reset();
 }
@@ -388,6 +873,27 @@ bool ThreadPool::HasThread(std::size_t threadId) const
     return false;
 }
 
+std::size_t ThreadPool::GetWorkerCount() const noexcept
+{
+    return mState->num_workers.load();
+}
+
+bool ThreadPool::HelpExecute()
+{
+    if (mScheduler != Scheduler::WorkStealing)
+        return false;
+    if (mState->num_stealable.load() == 0)
+        return false;
+
+    auto task = RealThread::StealAny(*mState, mRoundRobin.load());
+    if (!task)
+        return false;
+
+    RealThread::ExecuteTask(task.get());
+    mState->num_tasks--;
+    return true;
+}
+
 void ThreadPool::ExecuteMainThread()
 {
     if (mMainThread)
@@ -24,6 +24,12 @@
 #include <stdexcept>
 #include <chrono>
 #include <optional>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
 
 #include "base/platform.h"
 #include "base/logging.h"
@@ -32,10 +38,13 @@
 namespace base
 {
     class TraceWriter;
+    class ThreadPool;
 
     class ThreadTask
     {
     public:
+        using Clock = std::chrono::steady_clock;
+
         struct Description {
             std::string name;
             std::string desc;
@@ -57,6 +66,15 @@ namespace base
         inline bool IsComplete() const noexcept
         { return mDone.load(std::memory_order_acquire); }
 
+        // Check whether all the tasks this task depends on have completed.
+        inline bool IsReady() const noexcept
+        { return mPendingDependencies.load(std::memory_order_acquire) == 0; }
+
+        // Check whether the task was skipped because one of the
+        // tasks it depends on failed.
+        inline bool DependencyFailed() const noexcept
+        { return mDependencyFailed.load(std::memory_order_acquire); }
+
         inline bool TestFlag(Flags flag) const noexcept
         { return mFlags.test(flag); }
 
@@ -100,17 +118,49 @@ namespace base
         inline std::string GetErrorString() const noexcept
         { return mErrorString; }
 
+        inline void EnableTracing(bool on_off) noexcept
+        { mFlags.set(Flags::Tracing, on_off); }
+
+        // Get the time the task spent waiting for the tasks it depends
+        // on to complete, i.e. the time from submit until the task was
+        // ready to run. Only valid after the task has completed.
+        inline Clock::duration GetDependencyWaitTime() const noexcept
+        { return mReadyTime - mSubmitTime; }
+        // Get the time the task spent in the thread's queue after it
+        // was ready to run. Only valid after the task has completed.
+        inline Clock::duration GetQueueWaitTime() const noexcept
+        { return mStartTime - mReadyTime; }
+        // Get the time it took to execute the task itself.
+        // Only valid after the task has completed.
+        inline Clock::duration GetExecutionTime() const noexcept
+        { return mFinishTime - mStartTime; }
+
+        inline Clock::time_point GetStartTime() const noexcept
+        { return mStartTime; }
+        inline Clock::time_point GetFinishTime() const noexcept
+        { return mFinishTime; }
+
         void Execute()
         {
-            try
+            mStartTime = Clock::now();
+            if (DependencyFailed())
             {
-                DoTask();
+                // skip the work since the inputs are not valid.
+                SetError("Task dependency failed.");
             }
-            catch (const std::exception&)
+            else
             {
-               mException = std::current_exception();
+                try
+                {
+                    DoTask();
+                }
+                catch (const std::exception&)
+                {
+                   mException = std::current_exception();
+                }
             }
-            mDone.store(true, std::memory_order_release);
+            mFinishTime = Clock::now();
+            Complete();
         }
 
         void RethrowException() const
@@ -142,6 +192,17 @@ namespace base
             static std::atomic<size_t> id(1);
             return id++;
         }
+        // Mark the task complete and dispatch the dependent tasks
+        // that have no more pending dependencies.
+        void Complete();
+        // Add a task to be released once this task completes.
+        // Returns false if this task has already completed.
+        bool AddDependent(std::shared_ptr<ThreadTask> task);
+        // Block the calling thread until the task has completed.
+        void WaitComplete();
+
+        friend class ThreadPool;
+        friend class TaskHandle;
 
     private:
         std::size_t mTaskId = 0;
@@ -149,6 +210,20 @@ namespace base
         std::atomic<bool> mDone = {false};
         std::optional<Description> mDescription;
         std::string mErrorString;
+        // task dependency graph. the dependents are the tasks
+        // that are waiting for this task to complete.
+        std::mutex mDependentMutex;
+        std::condition_variable mDoneCondition;
+        std::vector<std::shared_ptr<ThreadTask>> mDependents;
+        bool mHasWaiters = false;
+        std::atomic<std::size_t> mPendingDependencies = {0};
+        std::atomic<bool> mDependencyFailed = {false};
+        ThreadPool* mPool = nullptr;
+        std::size_t mThreadId = 0;
+        Clock::time_point mSubmitTime;
+        Clock::time_point mReadyTime;
+        Clock::time_point mStartTime;
+        Clock::time_point mFinishTime;
     };
 
 
@@ -168,10 +243,33 @@ namespace base
         }
 
         enum class WaitStrategy {
-            BusyLoop, Sleep, WaitCondition
+            // Spin on the calling thread until the task completes.
+            BusyLoop,
+            // Sleep in small increments until the task completes.
+            Sleep,
+            // Block the calling thread on a condition that is signaled
+            // when the task completes.
+            WaitCondition,
+            // Spin for a bounded time (see SetSpinLimit) and if the task
+            // still hasn't completed block on the completion condition.
+            SpinThenPark
+        };
+
+        // Time spent in Wait. Each wait also records its spin and
+        // park phases as trace scopes ("Spin" and "Park") when tracing
+        // is enabled.
+        struct WaitStats {
+            std::chrono::microseconds spin_time = {};
+            std::chrono::microseconds park_time = {};
         };
 
         void Wait(WaitStrategy strategy) noexcept;
+        void Wait(WaitStrategy strategy, WaitStats* stats) noexcept;
+
+        // Set the maximum time to spin before parking the
+        // waiting thread with WaitStrategy::SpinThenPark.
+        static void SetSpinLimit(std::chrono::microseconds limit) noexcept;
+        static std::chrono::microseconds GetSpinLimit() noexcept;
 
         const ThreadTask* GetTask() const noexcept
         {
@@ -219,6 +317,7 @@ namespace base
         }
 
     private:
+        friend class ThreadPool;
         std::shared_ptr<ThreadTask> mTask;
         std::size_t mThreadId = 0;
     };
@@ -240,7 +339,18 @@ namespace base
 
         static constexpr size_t AnyWorkerThreadID = 0xffff;
 
-        ThreadPool();
+        // How tasks submitted with AnyWorkerThreadID are distributed
+        // between the worker threads.
+        enum class Scheduler {
+            // Each task is assigned to a single worker in round-robin
+            // order and only that worker can ever execute it.
+            RoundRobin,
+            // Each worker has its own lock-free deque and idle workers
+            // steal pending tasks from the other workers' queues.
+            WorkStealing
+        };
+
+        explicit ThreadPool(Scheduler scheduler = Scheduler::WorkStealing);
        ~ThreadPool();
 
         void AddRealThread(size_t threadId);
@@ -249,6 +359,17 @@ namespace base
         TaskHandle SubmitTask(std::unique_ptr<ThreadTask> task,
                               std::size_t threadID = AnyWorkerThreadID);
 
+        // Submit a task that will only be queued for execution once all
+        // the tasks it depends on have completed. This allows a chain or
+        // a graph of tasks to run without the submitting thread having to
+        // wait in between. If any of the dependencies fails (throws an
+        // exception or sets the error flag) the task will not execute but
+        // completes with an error and the failure propagates further
+        // to its own dependents.
+        TaskHandle SubmitTask(std::unique_ptr<ThreadTask> task,
+                              std::size_t threadID,
+                              const std::vector<TaskHandle>& dependencies);
+
         void Shutdown();
 
         void WaitAll();
@@ -257,6 +378,19 @@ namespace base
 
         bool HasThread(std::size_t threadId) const;
 
+        // Get the number of worker threads that can execute tasks
+        // submitted with AnyWorkerThreadID.
+        std::size_t GetWorkerCount() const noexcept;
+
+        // Try to take one pending task that was submitted for any worker
+        // thread and execute it on the calling thread. This lets a thread
+        // that is waiting for a set of tasks to complete help out instead
+        // of idling. Returns true if a task was executed.
+        bool HelpExecute();
+
+        inline Scheduler GetScheduler() const noexcept
+        { return mScheduler; }
+
         void ExecuteMainThread();
 
         void SetThreadTraceWriter(base::TraceWriter* writer);
@@ -266,11 +400,15 @@ namespace base
         struct State;
         class RealThread;
         class MainThread;
+        friend class ThreadTask;
+
+        void Dispatch(std::shared_ptr<ThreadTask> task, std::size_t threadId);
     private:
         std::shared_ptr<State> mState;
         std::vector<std::unique_ptr<RealThread>> mRealThreads;
         std::unique_ptr<MainThread> mMainThread;
-        std::size_t mRoundRobin = 0;
+        std::atomic<std::size_t> mRoundRobin = {0};
+        const Scheduler mScheduler;
     };
 
     ThreadPool* GetGlobalThreadPool();
@@ -282,4 +420,114 @@ namespace base
         return GetGlobalThreadPool() != nullptr;
     }
 
+    namespace detail {
+        template<typename Function>
+        class ParallelForTask : public ThreadTask
+        {
+        public:
+            ParallelForTask(std::size_t begin, std::size_t end, const Function* function) noexcept
+              : mBegin(begin)
+              , mEnd(end)
+              , mFunction(function)
+            {}
+        protected:
+            void DoTask() override
+            {
+                for (std::size_t i=mBegin; i<mEnd; ++i)
+                    (*mFunction)(i);
+            }
+        private:
+            const std::size_t mBegin = 0;
+            const std::size_t mEnd   = 0;
+            const Function* mFunction = nullptr;
+        };
+    } // detail
+
+    // Call function(i) for every i in [begin, end). The range is split into
+    // chunks of chunk_size indices and each chunk is executed as a separate
+    // task on the worker threads. The calling thread executes the first chunk
+    // and then helps with the remaining tasks until all chunks are done.
+    // If there's no thread pool (or it has no worker threads) the loop runs
+    // serially on the calling thread.
+    // If the function throws, the first exception is rethrown on the calling
+    // thread after all the chunks have completed.
+    template<typename Function>
+    void ParallelFor(std::size_t begin, std::size_t end, std::size_t chunk_size,
+                     const Function& function, ThreadPool* pool = GetGlobalThreadPool())
+    {
+        if (begin >= end)
+            return;
+        if (chunk_size == 0)
+            chunk_size = 1;
+
+        const auto count = end - begin;
+        if (pool == nullptr || pool->GetWorkerCount() == 0 || count <= chunk_size)
+        {
+            for (std::size_t i=begin; i<end; ++i)
+                function(i);
+            return;
+        }
+
+        using TaskType = detail::ParallelForTask<Function>;
+
+        std::vector<TaskHandle> handles;
+        handles.reserve(count / chunk_size + 1);
+        for (std::size_t chunk_begin = begin + chunk_size; chunk_begin < end; chunk_begin += chunk_size)
+        {
+            const auto chunk_end = std::min(chunk_begin + chunk_size, end);
+            auto task = std::make_unique<TaskType>(chunk_begin, chunk_end, &function);
+            handles.push_back(pool->SubmitTask(std::move(task), ThreadPool::AnyWorkerThreadID));
+        }
+
+        std::exception_ptr exception;
+        try
+        {
+            for (std::size_t i=begin; i<begin + chunk_size; ++i)
+                function(i);
+        }
+        catch (const std::exception&)
+        {
+            exception = std::current_exception();
+        }
+
+        // the tasks refer to the function object on our stack so we must
+        // wait for every one of them to complete even when there's an error.
+        for (auto& handle : handles)
+        {
+            while (!handle.IsComplete())
+            {
+                if (!pool->HelpExecute())
+                    std::this_thread::yield();
+            }
+            const auto* task = handle.GetTask();
+            if (task->HasException() && !exception)
+            {
+                try
+                {
+                    task->RethrowException();
+                }
+                catch (const std::exception&)
+                {
+                    exception = std::current_exception();
+                }
+            }
+        }
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+
+    // Call function(item) for every item in a random access container
+    // such as std::vector. See ParallelFor for details.
+    template<typename Container, typename Function>
+    void ParallelForEach(Container& container, std::size_t chunk_size,
+                         const Function& function, ThreadPool* pool = GetGlobalThreadPool())
+    {
+        auto begin = std::begin(container);
+        const auto size = static_cast<std::size_t>(std::distance(begin, std::end(container)));
+
+        ParallelFor(0, size, chunk_size, [&begin, &function](std::size_t index) {
+            function(*(begin + index));
+        }, pool);
+    }
+
 } // namespace
@@ -18,6 +18,9 @@
 
 #include <atomic>
 #include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 #include "base/assert.h"
 #include "base/trace.h"
@@ -52,7 +55,7 @@ unsigned TraceLog::BeginScope(const char* name)
     entry.name        = name;
     entry.tid         = mThreadId;
     entry.level       = mStackDepth++;
-    entry.start_time  = GetTime();
+    entry.start_time  = GetTraceTime();
     entry.finish_time = 0;
     mCallTrace[mTraceIndex] = std::move(entry);
     return mTraceIndex++;
@@ -68,7 +71,7 @@ void TraceLog::EndScope(unsigned int index)
     if (index == mTraceIndex)
         return;
 
-    mCallTrace[index].finish_time = GetTime();
+    mCallTrace[index].finish_time = GetTraceTime();
     mStackDepth--;
 }
 
@@ -130,6 +133,12 @@ void TraceComment(std::string str, unsigned index)
         thread_tracer->Comment(std::move(str), index);
 }
 
+void TraceComment(const char* str, unsigned index)
+{
+    if (thread_tracer && enable_tracing)
+        thread_tracer->Comment(str, index);
+}
+
 void TraceEvent(std::string name)
 {
     if (thread_tracer && enable_tracing)
@@ -146,8 +155,7 @@ void EnableTracing(bool on_off)
     enable_tracing = on_off;
 }
 
-// static
-unsigned int TraceLog::GetTime()
+std::uint64_t GetTraceTime()
 {
     using clock = std::chrono::high_resolution_clock;
     using time_point = clock::time_point;
@@ -172,7 +180,7 @@ unsigned int TraceLog::GetTime()
 
     // get access to the global variable
     // using static here to avoid doing the shared memory mapping
-    // on every call to GetTime
+    // on every call to GetTraceTime
     static mem::SharedMemoryVariable<time_point> start_time_accessor("/global_trace_start_time");
 #endif
 
@@ -218,6 +226,11 @@ void TextFileTraceWriter::Flush()
     std::fflush(mFile);
 }
 
+std::unique_ptr<Trace> TraceWriter::CreateThreadTrace(unsigned thread_id)
+{
+    return std::make_unique<TraceLog>(1000, thread_id);
+}
+
 ChromiumTraceJsonWriter::ChromiumTraceJsonWriter(const std::string& file)
 {
     mFile = std::fopen(file.c_str(), "w");
@@ -258,12 +271,12 @@ void ChromiumTraceJsonWriter::Write(const TraceEntry& entry)
 
 
 constexpr static auto* JsonFormat =
-  R"(%c { "pid":0, "tid":%u, "ph":"X", "ts":%u, "dur":%u, "name":"%s", "args": { "markers": "%s", "comment": "%s" } }
+  R"(%c { "pid":0, "tid":%u, "ph":"X", "ts":%llu, "dur":%llu, "name":"%s", "args": { "markers": "%s", "comment": "%s" } }
 )";
     std::fprintf(mFile, JsonFormat, mCommaNeeded ? ',' : ' ',
                  (unsigned)threadId,
-                 (unsigned)start,
-                 (unsigned)duration,
+                 (unsigned long long)start,
+                 (unsigned long long)duration,
                  entry.name, markers.c_str(), entry.comment.c_str());
 
     mCommaNeeded = true;
@@ -272,11 +285,11 @@ constexpr static auto* JsonFormat =
 void ChromiumTraceJsonWriter::Write(const struct TraceEvent& event)
 {
     constexpr static auto* JsonFormat =
-R"(%c { "pid":0, "tid":%u, "ph":"i", "ts":%u, "s":"g", "name":"%s"  }
+R"(%c { "pid":0, "tid":%u, "ph":"i", "ts":%llu, "s":"g", "name":"%s"  }
 )";
     std::fprintf(mFile, JsonFormat, mCommaNeeded ? ',': ' ',
                  (unsigned)event.tid,
-                 (unsigned)event.time,
+                 (unsigned long long)event.time,
                  event.name.c_str());
 
     mCommaNeeded = true;
@@ -287,4 +300,533 @@ void ChromiumTraceJsonWriter::Flush()
     std::fflush(mFile);
 }
 
+namespace {
+// binary trace file format. (little endian, whatever the host is)
+//
+// header:  u32 magic, u32 version
+// chunks:  u8 chunk type followed by chunk data
+//   string chunk:  u32 string id, u16 length, string bytes
+//   records chunk: u32 thread id, u32 record count, records
+// record:  u64 time, u32 name id, u8 type, u16 level, u8 text length, text bytes
+constexpr std::uint32_t BinaryTraceMagic   = 0x42525444; // DTRB
+constexpr std::uint32_t BinaryTraceVersion = 1;
+constexpr std::uint8_t  StringChunk  = 'S';
+constexpr std::uint8_t  RecordsChunk = 'R';
+
+template<typename T>
+void WriteValue(FILE* file, const T& value)
+{
+    std::fwrite(&value, sizeof(value), 1, file);
+}
+template<typename T>
+bool ReadValue(FILE* file, T* value)
+{
+    return std::fread(value, sizeof(T), 1, file) == 1;
+}
+
+std::size_t RoundUpToPowerOfTwo(std::size_t value)
+{
+    std::size_t ret = 1;
+    while (ret < value)
+        ret <<= 1;
+    return ret;
+}
+
+} // namespace
+
+TraceRingBuffer::TraceRingBuffer(std::size_t capacity, unsigned thread_id)
+  : mRecords(RoundUpToPowerOfTwo(std::max(capacity, std::size_t(2))))
+  , mMask(mRecords.size() - 1)
+  , mThreadId(thread_id)
+{}
+
+std::size_t TraceRingBuffer::Pop(TraceRecord* records, std::size_t max) noexcept
+{
+    const auto tail = mTail.load(std::memory_order_relaxed);
+    const auto head = mHead.load(std::memory_order_acquire);
+    const auto count = std::min<std::size_t>(head - tail, max);
+    for (std::size_t i=0; i<count; ++i)
+    {
+        records[i] = mRecords[(tail + i) & mMask];
+    }
+    mTail.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+RingBufferTrace::RingBufferTrace(BinaryTraceWriter* writer, std::shared_ptr<TraceRingBuffer> buffer)
+  : mWriter(writer)
+  , mBuffer(std::move(buffer))
+{
+    mNameCache.reserve(256);
+}
+
+RingBufferTrace::~RingBufferTrace() noexcept
+{
+    mBuffer->Close();
+}
+
+unsigned RingBufferTrace::BeginScope(const char* name)
+{
+    const auto level = mStackDepth++;
+
+    TraceRecord record;
+    record.type  = TraceRecord::Type::BeginScope;
+    record.time  = GetTraceTime();
+    record.name  = GetNameId(name);
+    record.level = level;
+    if (!mBuffer->Push(record) && level < 64)
+        mDroppedScopes |= (std::uint64_t(1) << level);
+    return level;
+}
+
+void RingBufferTrace::EndScope(unsigned index)
+{
+    ASSERT(mStackDepth);
+    mStackDepth--;
+
+    if (index < 64 && (mDroppedScopes & (std::uint64_t(1) << index)))
+    {
+        mDroppedScopes &= ~(std::uint64_t(1) << index);
+        return;
+    }
+
+    TraceRecord record;
+    record.type  = TraceRecord::Type::EndScope;
+    record.time  = GetTraceTime();
+    record.level = index;
+    mBuffer->Push(record);
+}
+
+void RingBufferTrace::Marker(std::string str, unsigned index)
+{
+    PushText(TraceRecord::Type::Marker, str.c_str(), str.size(), index);
+}
+void RingBufferTrace::Comment(std::string str, unsigned index)
+{
+    PushText(TraceRecord::Type::Comment, str.c_str(), str.size(), index);
+}
+void RingBufferTrace::Comment(const char* str, unsigned index)
+{
+    PushText(TraceRecord::Type::Comment, str, std::strlen(str), index);
+}
+void RingBufferTrace::Event(std::string name)
+{
+    PushText(TraceRecord::Type::Event, name.c_str(), name.size(), 0);
+}
+
+void RingBufferTrace::RenameBlock(const char* name, unsigned index)
+{
+    TraceRecord record;
+    record.type  = TraceRecord::Type::Rename;
+    record.time  = GetTraceTime();
+    record.name  = GetNameId(name);
+    record.level = index;
+    mBuffer->Push(record);
+}
+
+const char* RingBufferTrace::StoreString(std::string str)
+{
+    return mWriter->StoreString(std::move(str));
+}
+
+std::uint32_t RingBufferTrace::GetNameId(const char* name)
+{
+    auto it = mNameCache.find(name);
+    if (it != mNameCache.end())
+        return it->second;
+
+    const auto id = mWriter->InternString(name);
+    mNameCache[name] = id;
+    return id;
+}
+
+void RingBufferTrace::PushText(TraceRecord::Type type, const char* str, std::size_t len, unsigned index)
+{
+    TraceRecord record;
+    record.type   = type;
+    record.time   = GetTraceTime();
+    record.level  = index;
+    record.length = std::min(len, sizeof(record.text));
+    std::memcpy(record.text, str, record.length);
+    mBuffer->Push(record);
+}
+
+BinaryTraceWriter::BinaryTraceWriter(const std::string& file, unsigned flush_interval_ms, std::size_t ring_buffer_capacity)
+  : mFlushInterval(flush_interval_ms)
+  , mRingBufferCapacity(ring_buffer_capacity)
+{
+    mFile = std::fopen(file.c_str(), "wb");
+    if (mFile == nullptr)
+        throw std::runtime_error("failed to open trace file: " + file);
+
+    WriteValue(mFile, BinaryTraceMagic);
+    WriteValue(mFile, BinaryTraceVersion);
+
+    mScratch.resize(1024);
+    mThread = std::thread(&BinaryTraceWriter::ThreadMain, this);
+}
+
+BinaryTraceWriter::~BinaryTraceWriter() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(mThreadMutex);
+        mShutdown = true;
+        mCondition.notify_one();
+    }
+    mThread.join();
+
+    Drain();
+
+    if (const auto drops = GetDropCount())
+        WARN("Trace records were dropped because of full trace buffer(s). [count=%1]", drops);
+
+    std::fclose(mFile);
+}
+
+void BinaryTraceWriter::Write(const TraceEntry& entry)
+{
+    std::lock_guard<std::mutex> lock(mFileMutex);
+
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    record.type  = TraceRecord::Type::BeginScope;
+    record.time  = entry.start_time;
+    record.name  = InternString(entry.name);
+    record.level = entry.level;
+    records.push_back(record);
+
+    const auto AddText = [&records, &entry](TraceRecord::Type type, const std::string& str) {
+        TraceRecord record;
+        record.type   = type;
+        record.time   = entry.start_time;
+        record.level  = entry.level;
+        record.length = std::min(str.size(), sizeof(record.text));
+        std::memcpy(record.text, str.data(), record.length);
+        records.push_back(record);
+    };
+    if (!entry.comment.empty())
+        AddText(TraceRecord::Type::Comment, entry.comment);
+    for (const auto& marker : entry.markers)
+        AddText(TraceRecord::Type::Marker, marker);
+
+    record.type  = TraceRecord::Type::EndScope;
+    record.time  = entry.finish_time;
+    record.name  = 0;
+    records.push_back(record);
+
+    WriteStrings();
+    WriteRecords(entry.tid, records.data(), records.size());
+}
+
+void BinaryTraceWriter::Write(const struct TraceEvent& event)
+{
+    std::lock_guard<std::mutex> lock(mFileMutex);
+
+    TraceRecord record;
+    record.type   = TraceRecord::Type::Event;
+    record.time   = event.time;
+    record.length = std::min(event.name.size(), sizeof(record.text));
+    std::memcpy(record.text, event.name.data(), record.length);
+
+    WriteRecords(event.tid, &record, 1);
+}
+
+void BinaryTraceWriter::Flush()
+{
+    Drain();
+}
+
+std::unique_ptr<Trace> BinaryTraceWriter::CreateThreadTrace(unsigned thread_id)
+{
+    auto buffer = std::make_shared<TraceRingBuffer>(mRingBufferCapacity, thread_id);
+
+    std::lock_guard<std::mutex> lock(mBufferMutex);
+    mBuffers.push_back(buffer);
+    return std::make_unique<RingBufferTrace>(this, std::move(buffer));
+}
+
+std::uint32_t BinaryTraceWriter::InternString(const char* str)
+{
+    std::lock_guard<std::mutex> lock(mStringMutex);
+    return InternStringLocked(str);
+}
+
+const char* BinaryTraceWriter::StoreString(std::string str)
+{
+    std::lock_guard<std::mutex> lock(mStringMutex);
+    const auto id = InternStringLocked(str);
+    return mStrings[id - 1].c_str();
+}
+
+std::uint64_t BinaryTraceWriter::GetDropCount() const
+{
+    std::lock_guard<std::mutex> lock(mBufferMutex);
+    auto ret = mDropCount;
+    for (const auto& buffer : mBuffers)
+        ret += buffer->GetDropCount();
+    return ret;
+}
+
+std::uint64_t BinaryTraceWriter::GetRecordCount() const
+{
+    std::lock_guard<std::mutex> lock(mFileMutex);
+    return mRecordCount;
+}
+
+void BinaryTraceWriter::ThreadMain()
+{
+    std::unique_lock<std::mutex> lock(mThreadMutex);
+    while (!mShutdown)
+    {
+        mCondition.wait_for(lock, std::chrono::milliseconds(mFlushInterval));
+        lock.unlock();
+        Drain();
+        lock.lock();
+    }
+}
+
+void BinaryTraceWriter::Drain()
+{
+    std::lock_guard<std::mutex> lock(mFileMutex);
+    {
+        std::lock_guard<std::mutex> lock(mBufferMutex);
+        mDrainBuffers = mBuffers;
+    }
+
+    for (auto& buffer : mDrainBuffers)
+    {
+        // check the closed flag first so that we know that all the
+        // records have been pushed before we do the final drain.
+        const auto closed = buffer->IsClosed();
+        while (const auto count = buffer->Pop(mScratch.data(), mScratch.size()))
+        {
+            // write the strings first so that the strings referred
+            // by the records are always in the file before the records.
+            WriteStrings();
+            WriteRecords(buffer->GetThreadId(), mScratch.data(), count);
+        }
+        if (!closed)
+            continue;
+
+        std::lock_guard<std::mutex> lock(mBufferMutex);
+        mDropCount += buffer->GetDropCount();
+        mBuffers.erase(std::find(mBuffers.begin(), mBuffers.end(), buffer));
+    }
+    mDrainBuffers.clear();
+
+    std::fflush(mFile);
+}
+
+void BinaryTraceWriter::WriteStrings()
+{
+    std::lock_guard<std::mutex> lock(mStringMutex);
+    for (; mStringsWritten < mStrings.size(); ++mStringsWritten)
+    {
+        const auto& str = mStrings[mStringsWritten];
+        const auto id  = static_cast<std::uint32_t>(mStringsWritten + 1);
+        const auto len = static_cast<std::uint16_t>(std::min(str.size(), std::size_t(0xffff)));
+        WriteValue(mFile, StringChunk);
+        WriteValue(mFile, id);
+        WriteValue(mFile, len);
+        std::fwrite(str.data(), 1, len, mFile);
+    }
+}
+
+void BinaryTraceWriter::WriteRecords(unsigned thread_id, const TraceRecord* records, std::size_t count)
+{
+    WriteValue(mFile, RecordsChunk);
+    WriteValue(mFile, static_cast<std::uint32_t>(thread_id));
+    WriteValue(mFile, static_cast<std::uint32_t>(count));
+    for (std::size_t i=0; i<count; ++i)
+    {
+        const auto& record = records[i];
+        WriteValue(mFile, record.time);
+        WriteValue(mFile, record.name);
+        WriteValue(mFile, static_cast<std::uint8_t>(record.type));
+        WriteValue(mFile, record.level);
+        WriteValue(mFile, static_cast<std::uint8_t>(record.length));
+        std::fwrite(record.text, 1, record.length, mFile);
+    }
+    mRecordCount += count;
+}
+
+std::uint32_t BinaryTraceWriter::InternStringLocked(std::string_view str)
+{
+    auto it = mStringIds.find(str);
+    if (it != mStringIds.end())
+        return it->second;
+
+    mStrings.emplace_back(str);
+    const auto id = static_cast<std::uint32_t>(mStrings.size());
+    mStringIds[mStrings.back()] = id;
+    return id;
+}
+
+void ConvertBinaryTrace(const std::string& file, TraceWriter& writer)
+{
+    struct ThreadState {
+        std::vector<TraceEntry> entries;
+        std::vector<std::size_t> stack;
+        std::uint64_t time = 0;
+    };
+    std::unordered_map<unsigned, ThreadState> threads;
+    // deque so that the c_str pointers remain valid when new strings are added.
+    std::deque<std::string> strings;
+
+    std::unique_ptr<FILE, int(*)(FILE*)> in(std::fopen(file.c_str(), "rb"), std::fclose);
+    if (!in)
+        throw std::runtime_error("failed to open trace file: " + file);
+
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    if (!ReadValue(in.get(), &magic) || !ReadValue(in.get(), &version) ||
+        magic != BinaryTraceMagic || version != BinaryTraceVersion)
+        throw std::runtime_error("not a binary trace file: " + file);
+
+    const auto GetString = [&strings](std::uint32_t id) {
+        return id && id <= strings.size() ? strings[id-1].c_str() : "";
+    };
+    // the entries are written once the top level scope (the whole frame)
+    // has finished since a block can be renamed after it has been closed.
+    const auto FlushEntries = [&writer](ThreadState& thread) {
+        for (auto index : thread.stack)
+            thread.entries[index].finish_time = thread.time;
+        for (const auto& entry : thread.entries)
+            writer.Write(entry);
+        thread.entries.clear();
+        thread.stack.clear();
+    };
+    const auto FindOpenScope = [](ThreadState& thread, unsigned level) -> TraceEntry* {
+        for (auto it = thread.stack.rbegin(); it != thread.stack.rend(); ++it)
+        {
+            if (thread.entries[*it].level == level)
+                return &thread.entries[*it];
+        }
+        return nullptr;
+    };
+
+    std::uint8_t chunk = 0;
+    while (ReadValue(in.get(), &chunk))
+    {
+        if (chunk == StringChunk)
+        {
+            std::uint32_t id = 0;
+            std::uint16_t len = 0;
+            if (!ReadValue(in.get(), &id) || !ReadValue(in.get(), &len))
+                break;
+            std::string str;
+            str.resize(len);
+            if (std::fread(str.data(), 1, len, in.get()) != len)
+                break;
+            if (id != strings.size() + 1)
+                throw std::runtime_error("corrupt binary trace file: " + file);
+            strings.push_back(std::move(str));
+            continue;
+        }
+        else if (chunk != RecordsChunk)
+            throw std::runtime_error("corrupt binary trace file: " + file);
+
+        std::uint32_t tid = 0;
+        std::uint32_t count = 0;
+        if (!ReadValue(in.get(), &tid) || !ReadValue(in.get(), &count))
+            break;
+
+        auto& thread = threads[tid];
+        for (std::uint32_t i=0; i<count; ++i)
+        {
+            TraceRecord record;
+            std::uint8_t type = 0;
+            std::uint8_t length = 0;
+            if (!ReadValue(in.get(), &record.time) ||
+                !ReadValue(in.get(), &record.name) ||
+                !ReadValue(in.get(), &type) ||
+                !ReadValue(in.get(), &record.level) ||
+                !ReadValue(in.get(), &length) ||
+                length > sizeof(record.text) ||
+                std::fread(record.text, 1, length, in.get()) != length)
+            {
+                // the file can be truncated if the application crashed
+                // or was killed. write out what we've got so far.
+                WARN("Binary trace file is truncated. [file='%1']", file);
+                for (auto& pair : threads)
+                    FlushEntries(pair.second);
+                return;
+            }
+            const std::string text(record.text, length);
+            thread.time = record.time;
+
+            switch (static_cast<TraceRecord::Type>(type))
+            {
+                case TraceRecord::Type::BeginScope:
+                {
+                    // close any scopes that were not properly closed
+                    // because of dropped records.
+                    while (!thread.stack.empty() && thread.entries[thread.stack.back()].level >= record.level)
+                    {
+                        thread.entries[thread.stack.back()].finish_time = record.time;
+                        thread.stack.pop_back();
+                    }
+                    if (record.level == 0)
+                        FlushEntries(thread);
+
+                    TraceEntry entry;
+                    entry.name       = GetString(record.name);
+                    entry.start_time = record.time;
+                    entry.level      = record.level;
+                    entry.tid        = tid;
+                    thread.stack.push_back(thread.entries.size());
+                    thread.entries.push_back(std::move(entry));
+                }
+                break;
+
+                case TraceRecord::Type::EndScope:
+                    if (auto* entry = FindOpenScope(thread, record.level))
+                    {
+                        entry->finish_time = record.time;
+                        while (&thread.entries[thread.stack.back()] != entry)
+                            thread.stack.pop_back();
+                        thread.stack.pop_back();
+                    }
+                    break;
+
+                case TraceRecord::Type::Marker:
+                    if (auto* entry = FindOpenScope(thread, record.level))
+                        entry->markers.push_back(text);
+                    break;
+
+                case TraceRecord::Type::Comment:
+                    if (auto* entry = FindOpenScope(thread, record.level))
+                        entry->comment = text;
+                    break;
+
+                case TraceRecord::Type::Rename:
+                    for (auto it = thread.entries.rbegin(); it != thread.entries.rend(); ++it)
+                    {
+                        if (it->level == record.level)
+                        {
+                            it->name = GetString(record.name);
+                            break;
+                        }
+                    }
+                    break;
+
+                case TraceRecord::Type::Event:
+                {
+                    struct TraceEvent event;
+                    event.name = text;
+                    event.time = record.time;
+                    event.tid  = tid;
+                    writer.Write(event);
+                }
+                break;
+
+                default:
+                    throw std::runtime_error("corrupt binary trace file: " + file);
+            }
+        }
+    }
+    for (auto& pair : threads)
+        FlushEntries(pair.second);
+}
+
 } // namespace
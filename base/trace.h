@@ -21,8 +21,16 @@
 #include <vector>
 #include <string>
 #include <cstdio>
+#include <cstdint>
 #include <exception>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <string_view>
 #include <forward_list>
 
 #include "base/platform.h"
@@ -33,8 +41,8 @@ namespace base
 {
     struct TraceEntry {
         const char* name     = nullptr;
-        unsigned start_time  = 0;
-        unsigned finish_time = 0;
+        std::uint64_t start_time  = 0;
+        std::uint64_t finish_time = 0;
         unsigned level       = 0;
         unsigned tid         = 0;
         std::vector<std::string> markers;
@@ -43,10 +51,15 @@ namespace base
 
     struct TraceEvent {
         std::string name;
-        unsigned time = 0;
+        std::uint64_t time = 0;
         unsigned tid  = 0;
     };
 
+    // Get the current trace time in microseconds since the (global) trace start.
+    std::uint64_t GetTraceTime();
+
+    class Trace;
+
     class TraceWriter
     {
     public:
@@ -54,6 +67,10 @@ namespace base
         virtual void Write(const TraceEntry& entry) = 0;
         virtual void Write(const struct TraceEvent& event) = 0;
         virtual void Flush() = 0;
+        // Create a new trace object for recording the trace calls on some
+        // thread identified by thread_id. The default is to create a TraceLog
+        // that needs to be written to this writer periodically by calling Write.
+        virtual std::unique_ptr<Trace> CreateThreadTrace(unsigned thread_id);
     private:
     };
 
@@ -67,7 +84,9 @@ namespace base
         virtual void EndScope(unsigned index) = 0;
         virtual void Marker(std::string marker, unsigned index) = 0;
         virtual void Comment(std::string comment, unsigned index) = 0;
+        virtual void Comment(const char* comment, unsigned index) = 0;
         virtual void Event(std::string name) = 0;
+        virtual void RenameBlock(const char* name, unsigned index) = 0;
 
         virtual unsigned GetCurrentTraceIndex() const = 0;
 
@@ -140,11 +159,18 @@ namespace base
                 return;
             mCallTrace[index].comment = std::move(str);
         }
+        virtual void Comment(const char* str, unsigned index) override
+        {
+            ASSERT(index <= mTraceIndex);
+            if (index == mCallTrace.size())
+                return;
+            mCallTrace[index].comment = str;
+        }
         virtual void Event(std::string name) override
         {
             struct TraceEvent event;
             event.name = std::move(name);
-            event.time = GetTime();
+            event.time = GetTraceTime();
             event.tid  = mThreadId;
             mTraceEvents.push_back(std::move(event));
         }
@@ -161,7 +187,7 @@ namespace base
             return mDynamicStrings.front().c_str();
         }
 
-        inline void RenameBlock(const char* name, unsigned index) noexcept
+        virtual void RenameBlock(const char* name, unsigned index) override
         {
             ASSERT(index <= mTraceIndex);
             if (index == mCallTrace.size())
@@ -174,8 +200,6 @@ namespace base
         inline const TraceEntry& GetEntry(size_t index) const noexcept
         { return mCallTrace[index]; }
 
-    private:
-        static unsigned GetTime();
     private:
         std::vector<TraceEntry> mCallTrace;
         std::size_t mTraceIndex = 0;
@@ -253,6 +277,187 @@ namespace base
         WrappedWriter mWriter;
     };
 
+    // Fixed size trace record that is written by the RingBufferTrace into the
+    // thread's trace ring buffer. Scope names are interned strings and only
+    // dynamic text (comments, markers, events) is stored inline. Any text that
+    // doesn't fit in the inline buffer is truncated.
+    struct TraceRecord {
+        enum class Type : std::uint16_t {
+            BeginScope, EndScope, Marker, Comment, Event, Rename
+        };
+        std::uint64_t time   = 0;
+        std::uint32_t name   = 0;
+        Type type            = Type::BeginScope;
+        std::uint16_t level  = 0;
+        std::uint16_t length = 0;
+        char text[46];
+    };
+    static_assert(sizeof(TraceRecord) == 64, "Unexpected trace record size.");
+
+    // Single producer, single consumer lock free queue of trace records.
+    // The producer is the thread that owns the trace and the consumer is the
+    // thread that streams the records into the output file. When the buffer
+    // is full new records are dropped (and counted) instead of blocking the
+    // producer.
+    class TraceRingBuffer
+    {
+    public:
+        TraceRingBuffer(std::size_t capacity, unsigned thread_id);
+
+        bool Push(const TraceRecord& record) noexcept
+        {
+            const auto head = mHead.load(std::memory_order_relaxed);
+            const auto tail = mTail.load(std::memory_order_acquire);
+            if (head - tail == mRecords.size())
+            {
+                mDropCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            mRecords[head & mMask] = record;
+            mHead.store(head + 1, std::memory_order_release);
+            return true;
+        }
+        std::size_t Pop(TraceRecord* records, std::size_t max) noexcept;
+
+        // Mark the buffer closed, i.e. the producer will not push more records.
+        inline void Close() noexcept
+        { mClosed.store(true, std::memory_order_release); }
+        inline bool IsClosed() const noexcept
+        { return mClosed.load(std::memory_order_acquire); }
+        inline unsigned GetThreadId() const noexcept
+        { return mThreadId; }
+        inline std::size_t GetCapacity() const noexcept
+        { return mRecords.size(); }
+        inline std::uint64_t GetDropCount() const noexcept
+        { return mDropCount.load(std::memory_order_relaxed); }
+    private:
+        std::vector<TraceRecord> mRecords;
+        const std::size_t mMask = 0;
+        const unsigned mThreadId = 0;
+        alignas(64) std::atomic<std::uint64_t> mHead = {0};
+        alignas(64) std::atomic<std::uint64_t> mTail = {0};
+        std::atomic<std::uint64_t> mDropCount = {0};
+        std::atomic<bool> mClosed = {false};
+    };
+
+    class BinaryTraceWriter;
+
+    // Always-on trace that writes fixed size records into a lock free per
+    // thread ring buffer without allocating memory (once the scope names
+    // have been seen once). The records are streamed continuously into a
+    // file by the BinaryTraceWriter so there's no need to Start or Write
+    // the trace on every frame. The trace index returned by BeginScope is
+    // the scope's stack level.
+    class RingBufferTrace : public Trace
+    {
+    public:
+        RingBufferTrace(BinaryTraceWriter* writer, std::shared_ptr<TraceRingBuffer> buffer);
+       ~RingBufferTrace() noexcept;
+
+        virtual void Start() override
+        {}
+        virtual void Write(TraceWriter&) const override
+        {}
+        virtual unsigned BeginScope(const char* name) override;
+        virtual void EndScope(unsigned index) override;
+        virtual void Marker(std::string str, unsigned index) override;
+        virtual void Comment(std::string str, unsigned index) override;
+        virtual void Comment(const char* str, unsigned index) override;
+        virtual void Event(std::string name) override;
+        virtual void RenameBlock(const char* name, unsigned index) override;
+        virtual unsigned GetCurrentTraceIndex() const override
+        {
+            ASSERT(mStackDepth > 0);
+            return mStackDepth - 1;
+        }
+        virtual const char* StoreString(std::string str) override;
+
+        inline const TraceRingBuffer& GetBuffer() const noexcept
+        { return *mBuffer; }
+    private:
+        std::uint32_t GetNameId(const char* name);
+        void PushText(TraceRecord::Type type, const char* str, std::size_t len, unsigned index);
+    private:
+        BinaryTraceWriter* mWriter = nullptr;
+        std::shared_ptr<TraceRingBuffer> mBuffer;
+        // cache for mapping the (static) scope name string pointers to
+        // interned string IDs without taking the global string table lock.
+        std::unordered_map<const char*, std::uint32_t> mNameCache;
+        unsigned mStackDepth = 0;
+        // bit mask of stack levels whose begin record was dropped. used
+        // to drop the matching end record in order to keep the trace balanced.
+        std::uint64_t mDroppedScopes = 0;
+    };
+
+    // Stream the trace records from all the RingBufferTraces created through
+    // this writer continuously into a compact binary file. The records are
+    // drained by a background thread every flush interval. The binary file
+    // can be converted to the Chromium JSON format with ConvertBinaryTrace.
+    class BinaryTraceWriter : public TraceWriter
+    {
+    public:
+        explicit BinaryTraceWriter(const std::string& file,
+                                   unsigned flush_interval_ms = 50,
+                                   std::size_t ring_buffer_capacity = 1 << 14);
+       ~BinaryTraceWriter() noexcept;
+        BinaryTraceWriter(const BinaryTraceWriter&) = delete;
+
+        // Write a complete trace entry or event from a TraceLog. These are
+        // written directly to the file and are thread safe.
+        virtual void Write(const TraceEntry& entry) override;
+        virtual void Write(const struct TraceEvent& event) override;
+        // Drain all the ring buffers into the file and flush the file.
+        virtual void Flush() override;
+        virtual std::unique_ptr<Trace> CreateThreadTrace(unsigned thread_id) override;
+
+        // Intern the string and return its unique ID. Thread safe.
+        std::uint32_t InternString(const char* str);
+        // Intern the string and return a pointer to a string that remains
+        // valid for the lifetime of the writer. Thread safe.
+        const char* StoreString(std::string str);
+
+        // Get the total number of records dropped because of full ring buffers.
+        std::uint64_t GetDropCount() const;
+        // Get the total number of records written into the file.
+        std::uint64_t GetRecordCount() const;
+
+        BinaryTraceWriter& operator=(const BinaryTraceWriter&) = delete;
+    private:
+        void ThreadMain();
+        void Drain();
+        void WriteStrings();
+        void WriteRecords(unsigned thread_id, const TraceRecord* records, std::size_t count);
+        std::uint32_t InternStringLocked(std::string_view str);
+    private:
+        FILE* mFile = nullptr;
+        const unsigned mFlushInterval = 0;
+        const std::size_t mRingBufferCapacity = 0;
+        std::thread mThread;
+        // protects the file and the drain (consumer) side of the ring buffers
+        mutable std::mutex mFileMutex;
+        std::vector<TraceRecord> mScratch;
+        std::uint64_t mRecordCount = 0;
+        // protects the list of ring buffers
+        mutable std::mutex mBufferMutex;
+        std::vector<std::shared_ptr<TraceRingBuffer>> mBuffers;
+        std::vector<std::shared_ptr<TraceRingBuffer>> mDrainBuffers;
+        std::uint64_t mDropCount = 0;
+        // protects the string table
+        std::mutex mStringMutex;
+        std::deque<std::string> mStrings;
+        std::unordered_map<std::string_view, std::uint32_t> mStringIds;
+        std::size_t mStringsWritten = 0;
+        // the streaming thread state
+        std::mutex mThreadMutex;
+        std::condition_variable mCondition;
+        bool mShutdown = false;
+    };
+
+    // Read a binary trace file produced by the BinaryTraceWriter and write
+    // the trace entries and events into the given trace writer, for example
+    // ChromiumTraceJsonWriter. Throws std::runtime_error on error.
+    void ConvertBinaryTrace(const std::string& file, TraceWriter& writer);
+
     Trace* GetThreadTrace();
     void SetThreadTrace(Trace* trace);
     void TraceStart();
@@ -262,6 +467,7 @@ namespace base
 
     void TraceComment(std::string str);
     void TraceComment(std::string str, unsigned index);
+    void TraceComment(const char* str, unsigned index);
 
     void TraceEvent(std::string name);
 
@@ -271,7 +477,49 @@ namespace base
     unsigned TraceBeginScope(const char* name);
     void TraceEndScope(unsigned index);
 
+    namespace detail {
+        // Trace scope comment formatted into a stack buffer in order to
+        // avoid allocating memory for the comment string.
+        class TraceText
+        {
+        public:
+            TraceText() = default;
+            explicit TraceText(const char* str) noexcept
+              : mString(str)
+            {}
+            template<typename... Args>
+            explicit TraceText(const char* fmt, Args... args) noexcept
+            {
+                std::snprintf(mBuffer, sizeof(mBuffer), fmt, args...);
+                mString = mBuffer;
+            }
+            TraceText(const TraceText&) = delete;
+            inline bool IsEmpty() const noexcept
+            { return mString[0] == 0; }
+            inline const char* GetString() const noexcept
+            { return mString; }
+            TraceText& operator=(const TraceText&) = delete;
+        private:
+            const char* mString = "";
+            char mBuffer[256];
+        };
+
+        template<typename... Args>
+        TraceText FormatTraceComment(const char* fmt, Args... args)
+        { return TraceText(fmt, args...); }
+        inline TraceText FormatTraceComment(const char* fmt)
+        { return TraceText(fmt); }
+        inline TraceText FormatTraceComment()
+        { return TraceText(); }
+    } // namespace
+
     struct AutoTracingScope {
+        AutoTracingScope(const char* name, const detail::TraceText& comment) noexcept
+        {
+            index = TraceBeginScope(name);
+            if (!comment.IsEmpty())
+                TraceComment(comment.GetString(), index);
+        }
         AutoTracingScope(const char* name, std::string comment) noexcept
         {
             index = TraceBeginScope(name);
@@ -291,6 +539,12 @@ namespace base
     };
 
     struct ManualTracingScope {
+        ManualTracingScope(const char* name, const detail::TraceText& comment) noexcept
+        {
+            index = TraceBeginScope(name);
+            if (!comment.IsEmpty())
+                TraceComment(comment.GetString(), index);
+        }
         ManualTracingScope(const char* name, std::string comment) noexcept
         {
             index = TraceBeginScope(name);
@@ -319,20 +573,6 @@ namespace base
         unsigned index = 0;
     };
 
-    namespace detail {
-        template<typename... Args>
-        std::string FormatTraceComment(const char* fmt, Args... args)
-        {
-            static char pray[256] = {0};
-            std::snprintf(pray, sizeof(pray),fmt, args...);
-            return pray;
-        }
-        inline std::string FormatTraceComment(const char* fmt)
-        { return fmt; }
-        inline std::string FormatTraceComment()
-        { return ""; }
-    } // namespace
-
 } // namespace
 
 #if defined(BASE_TRACING_ENABLE_TRACING)
@@ -22,6 +22,7 @@
 #include <vector>
 #include <unordered_map>
 #include <cmath>
+#include <cstdint>
 
 #include "base/assert.h"
 #include "base/memory.h"
@@ -36,10 +37,36 @@ namespace base
     // scene graph)
     // The root of the tree can be denoted by using a special
     // pointer value, the nullptr.
+    // The topology is owned by the parent/children hash maps but
+    // the traversal operations run over a flat pre-order array of
+    // the nodes which is rebuilt lazily whenever the topology has
+    // changed. This keeps the (frequent) traversals from chasing
+    // hash map nodes all over the heap.
+    // Note that since the flat array is rebuilt on the first traversal
+    // after a topology change, concurrent traversals of a modified tree
+    // are only safe after calling RebuildFlatTree first.
     template<typename Element>
     class RenderTree
     {
     public:
+        static constexpr std::uint32_t NoParent = 0xffffffff;
+
+        // Node in the flat pre-order representation of the tree.
+        // The descendants of a node are stored immediately after
+        // the node itself, i.e. the subtree of the node at index i
+        // spans the indices [i, i+size).
+        struct FlatNode {
+            // The tree node itself. The root is the nullptr.
+            const Element* node = nullptr;
+            // Index of the parent node in the flat array or NoParent
+            // if the node has no parent.
+            std::uint32_t parent = NoParent;
+            // The number of nodes in the subtree rooted at this
+            // node including the node itself.
+            std::uint32_t size = 0;
+        };
+        using FlatTree = std::vector<FlatNode>;
+
         template<typename T>
         class TVisitor
         {
@@ -68,6 +95,7 @@ namespace base
         {
             mParents.clear();
             mChildren.clear();
+            mFlatDirty = true;
         }
 
         void PreOrderTraverse(Visitor& visitor, Element* parent = nullptr)
@@ -92,6 +120,40 @@ namespace base
         void ForEachChild(Function function, Element* parent = nullptr)
         { for_each_child<Element>(std::move(function), parent); }
 
+        // Rebuild the flat pre-order representation of the tree if the
+        // topology has changed since it was last built. This happens
+        // automatically when the tree is traversed but can be done
+        // explicitly in order to share a const tree between threads.
+        void RebuildFlatTree() const
+        {
+            if (mFlatDirty)
+                flatten();
+        }
+
+        // Get the flat pre-order representation of the tree. The root
+        // (nullptr) is always the first node. Subtrees whose root has no
+        // parent in this tree follow after the nullptr root's subtree.
+        const FlatTree& GetFlatTree() const
+        {
+            RebuildFlatTree();
+            return mFlat;
+        }
+
+        // Find the index of the given node in the flat pre-order
+        // representation of the tree. The root (nullptr) is always at
+        // index 0. If the node is not in the tree returns NoParent.
+        std::uint32_t FindFlatIndex(const Element* node) const
+        { return find_flat_index(node); }
+
+        // Get the version of the flat tree. The version changes every
+        // time the flat tree is rebuilt, i.e. any data indexed by the
+        // flat node indices is stale when the version has changed.
+        std::uint64_t GetFlatTreeVersion() const
+        {
+            RebuildFlatTree();
+            return mFlatVersion;
+        }
+
         // Convenience operation for moving a child node to a new parent.
         void ReparentChild(const Element* parent, const Element* child)
         {
@@ -118,6 +180,7 @@ namespace base
                 }
             }
             mParents.erase(child);
+            mFlatDirty = true;
         }
 
         // Delete all the children of a parent.
@@ -134,6 +197,7 @@ namespace base
                 mParents.erase(child);
             }
             children.clear();
+            mFlatDirty = true;
         }
 
         // Link a child node to a parent node.
@@ -146,6 +210,7 @@ namespace base
             ASSERT(mParents.find(child) == mParents.end());
             mChildren[parent].push_back(child);
             mParents[child] = parent;
+            mFlatDirty = true;
         }
 
         // re-order the children so that the node 'before' comes right before
@@ -171,6 +236,7 @@ namespace base
 
             children.erase(children.begin() + before_index);
             children.insert(children.begin() + after_index, before);
+            mFlatDirty = true;
         }
 
         // Break a child node away from its parent. The descendants
@@ -195,6 +261,7 @@ namespace base
                 }
             }
             mParents.erase(it);
+            mFlatDirty = true;
         }
 
         // Get the parent node of a child node.
@@ -248,22 +315,99 @@ namespace base
             }
         }
     private:
+        void flatten() const
+        {
+            mFlat.clear();
+            mFlatIndex.clear();
+            mFlat.reserve(mParents.size() + 1);
+            mFlatIndex.reserve(mParents.size());
+            // the nullptr root is always the first node even when
+            // the tree is empty.
+            flatten_subtree(nullptr, NoParent);
+            // nodes that have children but no parent are roots of
+            // subtrees that are not reachable from the nullptr root.
+            // they can still be traversed explicitly.
+            for (const auto& pair : mChildren)
+            {
+                const auto* node = pair.first;
+                if (node == nullptr || mParents.find(node) != mParents.end())
+                    continue;
+                flatten_subtree(node, NoParent);
+            }
+            mFlatDirty = false;
+            ++mFlatVersion;
+        }
+        std::uint32_t flatten_subtree(const Element* node, std::uint32_t parent) const
+        {
+            const auto index = static_cast<std::uint32_t>(mFlat.size());
+            FlatNode flat;
+            flat.node   = node;
+            flat.parent = parent;
+            flat.size   = 1;
+            mFlat.push_back(flat);
+            if (node)
+                mFlatIndex[node] = index;
+
+            auto it = mChildren.find(node);
+            if (it == mChildren.end())
+                return 1;
+
+            std::uint32_t size = 1;
+            for (const auto* child : it->second)
+                size += flatten_subtree(child, index);
+            mFlat[index].size = size;
+            return size;
+        }
+        std::uint32_t find_flat_index(const Element* node) const
+        {
+            RebuildFlatTree();
+            if (node == nullptr)
+                return 0;
+            auto it = mFlatIndex.find(node);
+            if (it == mFlatIndex.end())
+                return NoParent;
+            return it->second;
+        }
+
         template<typename T>
         void preorder_traverse(TVisitor<T>& visitor, T* parent = nullptr) const
         {
-            visitor.EnterNode(parent);
-            auto it = mChildren.find(parent);
-            if (it != mChildren.end())
+            const auto begin = find_flat_index(parent);
+            if (begin == NoParent)
             {
-                const auto& children = it->second;
-                for (auto *child : children)
+                // not a node in this tree, thus no children either.
+                visitor.EnterNode(parent);
+                visitor.LeaveNode(parent);
+                return;
+            }
+            // the node that was entered last and hasn't been left yet.
+            auto current = begin;
+            visitor.EnterNode(const_cast<Element*>(mFlat[begin].node));
+            for (auto next = begin + 1; ; ++next)
+            {
+                // leave every node whose subtree ends before the next node.
+                while (current + mFlat[current].size == next)
                 {
-                    preorder_traverse<T>(visitor, const_cast<Element*>(child));
+                    visitor.LeaveNode(const_cast<Element*>(mFlat[current].node));
+                    if (current == begin)
+                        return;
+                    current = mFlat[current].parent;
                     if (visitor.IsDone())
-                        break;
+                    {
+                        // skip the rest of the nodes but still leave
+                        // the nodes that have been entered.
+                        for (;;)
+                        {
+                            visitor.LeaveNode(const_cast<Element*>(mFlat[current].node));
+                            if (current == begin)
+                                return;
+                            current = mFlat[current].parent;
+                        }
+                    }
                 }
+                visitor.EnterNode(const_cast<Element*>(mFlat[next].node));
+                current = next;
             }
-            visitor.LeaveNode(parent);
         }
         template<typename T, typename Function>
         void preorder_traverse_for_each(Function callback, T* parent = nullptr) const
@@ -283,12 +427,14 @@ namespace base
         template<typename T, typename Function>
         void for_each_child(Function callback, T* parent = nullptr) const
         {
-            auto it = mChildren.find(parent);
-            if (it == mChildren.end())
+            const auto index = find_flat_index(parent);
+            if (index == NoParent)
                 return;
-            const auto& children = it->second;
-            for (auto* child : children)
-                callback(const_cast<T*>(child));
+            // the children are the roots of the consecutive subtrees
+            // following the parent node.
+            const auto end = index + mFlat[index].size;
+            for (auto child = index + 1; child < end; child += mFlat[child].size)
+                callback(const_cast<T*>(mFlat[child].node));
         }
     private:
         using ChildList = std::vector<const Element*>;
@@ -296,6 +442,14 @@ namespace base
         std::unordered_map<const Element*, ChildList> mChildren;
         // lookup table for mapping children to their parents
         std::unordered_map<const Element*, const Element*> mParents;
+        // flat pre-order representation of the tree for traversal.
+        mutable FlatTree mFlat;
+        // lookup table for mapping nodes to their flat array index.
+        mutable std::unordered_map<const Element*, std::uint32_t> mFlatIndex;
+        // whether the topology has changed since the flat tree was built.
+        mutable bool mFlatDirty = true;
+        // incremented every time the flat tree is rebuilt.
+        mutable std::uint64_t mFlatVersion = 0;
 
         template<typename T> friend class RenderTree;
     };
@@ -462,23 +616,36 @@ namespace base
                 // in one quadrant to another object in an adjacent quadrant. doing this
                 // would require some kind of split-table/link or place a requirement
                 // on the type T to be uniquely identifiable.
-                size_t items = 0;
                 for (int i=0; i<4; ++i)
                 {
                     mQuadrants[i]->Erase(predicate, alloc, max_items);
-                    items += mQuadrants[i]->GetNumItems();
                 }
-                if (items > max_items)
+                MergeQuadrants(alloc, max_items);
+            }
+            // Erase the objects that satisfy the predicate but only look
+            // for them in the quadrants that intersect with the given rect.
+            template<typename Predicate>
+            void Erase(const base::FRect& rect, Predicate predicate, mem::Allocator& alloc, unsigned max_items) noexcept
+            {
+                for (auto it = mItems.begin(); it != mItems.end();)
+                {
+                    auto& item = *it;
+                    if (predicate(item.object, GetItemRect(item)))
+                        it = mItems.erase(it);
+                    else ++it;
+                }
+                if (!HasChildren())
                     return;
 
                 for (int i=0; i<4; ++i)
                 {
-                    mQuadrants[i]->MoveItems(mItems);
-                    mQuadrants[i]->Clear(alloc);
-                    mQuadrants[i]->~QuadTreeNode();
-                    alloc.Free((void*)mQuadrants[i]);
-                    mQuadrants[i] = nullptr;
+                    // same test as when inserting into the quadrants.
+                    const auto& intersection = base::Intersect(mQuadrants[i]->GetRect(), rect);
+                    if (intersection.IsEmpty())
+                        continue;
+                    mQuadrants[i]->Erase(rect, predicate, alloc, max_items);
                 }
+                MergeQuadrants(alloc, max_items);
             }
 
             inline bool HasChildren() const noexcept
@@ -516,6 +683,30 @@ namespace base
 
             void MoveItems(std::vector<ItemType>& out) const
             { base::AppendVector(out, std::move(mItems)); }
+
+            // Collapse the quadrants back into this node if they're
+            // all leaf nodes and hold no more than max items in total.
+            void MergeQuadrants(mem::Allocator& alloc, unsigned max_items) noexcept
+            {
+                size_t items = 0;
+                for (int i=0; i<4; ++i)
+                {
+                    if (mQuadrants[i]->HasChildren())
+                        return;
+                    items += mQuadrants[i]->GetNumItems();
+                }
+                if (items > max_items)
+                    return;
+
+                for (int i=0; i<4; ++i)
+                {
+                    mQuadrants[i]->MoveItems(mItems);
+                    mQuadrants[i]->Clear(alloc);
+                    mQuadrants[i]->~QuadTreeNode();
+                    alloc.Free((void*)mQuadrants[i]);
+                    mQuadrants[i] = nullptr;
+                }
+            }
         private:
             base::FRect mRect;
             std::vector<ItemType> mItems;
@@ -586,6 +777,21 @@ namespace base
         template<typename Predicate>
         void Erase(Predicate predicate) noexcept
         { mRoot.Erase(std::move(predicate), mPool, mMaxItems); }
+        // Erase the objects that satisfy the predicate but only visit the
+        // parts of the tree that intersect with the given rectangle.
+        template<typename Predicate>
+        void Erase(const base::FRect& rect, Predicate predicate) noexcept
+        { mRoot.Erase(rect, std::move(predicate), mPool, mMaxItems); }
+        // Move an object from its previous rectangle to a new rectangle.
+        // The previous rectangle must be the rectangle that was used
+        // to insert the object.
+        bool Move(const base::FRect& old_rect, const base::FRect& new_rect, Object object)
+        {
+            Erase(old_rect, [&object](const Object& other, const base::FRect&) {
+                return other == object;
+            });
+            return Insert(new_rect, object);
+        }
 
         const TreeNode& GetRoot() const noexcept
         { return mRoot; }
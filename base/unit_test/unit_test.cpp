@@ -19,6 +19,12 @@
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <stack>
+#include <vector>
+#include <deque>
+#include <algorithm>
 
 #include "base/test_minimal.h"
 #include "base/test_float.h"
@@ -29,6 +35,8 @@
 #include "base/utility.h"
 #include "base/allocator.h"
 #include "base/memory.h"
+#include "base/metrics.h"
+#include "base/format.h"
 
 #if !defined(UNIT_TEST_BUNDLE)
 #  include "base/json.cpp"
@@ -36,6 +44,7 @@
 #  include "base/trace.cpp"
 #  include "base/assert.cpp"
 #  include "base/memory.cpp"
+#  include "base/metrics.cpp"
 #endif
 
 template<typename T>
@@ -376,6 +385,252 @@ void unit_test_trace()
 }
 
 
+void unit_test_trace_ring_buffer()
+{
+    TEST_CASE(test::Type::Feature)
+
+    // ring buffer drops records when full
+    {
+        base::TraceRingBuffer buffer(3, 1);
+        TEST_REQUIRE(buffer.GetCapacity() == 4);
+
+        base::TraceRecord record;
+        for (unsigned i=0; i<4; ++i)
+        {
+            record.level = i;
+            TEST_REQUIRE(buffer.Push(record));
+        }
+        TEST_REQUIRE(buffer.Push(record) == false);
+        TEST_REQUIRE(buffer.GetDropCount() == 1);
+
+        base::TraceRecord records[8];
+        TEST_REQUIRE(buffer.Pop(records, 3) == 3);
+        TEST_REQUIRE(records[0].level == 0);
+        TEST_REQUIRE(records[2].level == 2);
+        TEST_REQUIRE(buffer.Push(record));
+        TEST_REQUIRE(buffer.Pop(records, 8) == 2);
+        TEST_REQUIRE(records[0].level == 3);
+        TEST_REQUIRE(buffer.Pop(records, 8) == 0);
+    }
+
+    class TestWriter : public base::TraceWriter
+    {
+    public:
+        virtual void Write(const base::TraceEntry& entry) override
+        {
+            names.push_back(entry.name);
+            entries.push_back(entry);
+            entries.back().name = names.back().c_str();
+        }
+        virtual void Write(const struct base::TraceEvent& event) override
+        { events.push_back(event); }
+        virtual void Flush() override
+        {}
+        std::vector<base::TraceEntry> entries;
+        std::vector<struct base::TraceEvent> events;
+        // the entry names refer to the strings owned by the converter
+        std::deque<std::string> names;
+    };
+
+    // stream trace from multiple threads into a file and convert it back.
+    {
+        base::BinaryTraceWriter writer("unit_test_trace.bin", 1);
+
+        std::thread thread([&writer]() {
+            auto trace = writer.CreateThreadTrace(base::TraceLog::TaskThread);
+            base::SetThreadTrace(trace.get());
+            base::EnableTracing(true);
+            for (unsigned i=0; i<10; ++i)
+            {
+                TRACE_SCOPE("Task", "task=%u", i);
+                TRACE_CALL("Work", std::this_thread::sleep_for(std::chrono::milliseconds(1)));
+            }
+            base::SetThreadTrace(nullptr);
+        });
+
+        auto trace = writer.CreateThreadTrace(base::TraceLog::MainThread);
+        base::SetThreadTrace(trace.get());
+        base::EnableTracing(true);
+        for (unsigned i=0; i<3; ++i)
+        {
+            {
+                using namespace tracing_test;
+                TRACE_SCOPE("unit_test");
+                foo();
+                meh();
+            }
+            TRACE_EVENT("Frame");
+            if (i == 1)
+                trace->RenameBlock("BadFrame", 0);
+        }
+        base::SetThreadTrace(nullptr);
+        thread.join();
+
+        writer.Flush();
+        // main thread has 5 scopes, 2 comments, 1 marker and 1 event per frame
+        // plus 1 rename. task thread has 2 scopes and 1 comment per iteration.
+        TEST_REQUIRE(writer.GetRecordCount() == 3*(2*5 + 2 + 1 + 1) + 1 + 10*(2*2 + 1));
+        TEST_REQUIRE(writer.GetDropCount() == 0);
+    }
+
+    TestWriter out;
+    base::ConvertBinaryTrace("unit_test_trace.bin", out);
+    TEST_REQUIRE(out.events.size() == 3);
+    TEST_REQUIRE(out.events[0].name == "Frame");
+    TEST_REQUIRE(out.events[0].tid == base::TraceLog::MainThread);
+
+    std::vector<base::TraceEntry> main;
+    std::vector<base::TraceEntry> task;
+    for (const auto& entry : out.entries)
+    {
+        TEST_REQUIRE(entry.finish_time >= entry.start_time);
+        if (entry.tid == base::TraceLog::MainThread)
+            main.push_back(entry);
+        else if (entry.tid == base::TraceLog::TaskThread)
+            task.push_back(entry);
+        else TEST_REQUIRE(!"unexpected thread id");
+    }
+    TEST_REQUIRE(main.size() == 3*5);
+    TEST_REQUIRE(main[0].name == std::string("unit_test"));
+    TEST_REQUIRE(main[0].level == 0);
+    TEST_REQUIRE(main[1].name == std::string("foo"));
+    TEST_REQUIRE(main[1].level == 1);
+    TEST_REQUIRE(main[2].name == std::string("bar"));
+    TEST_REQUIRE(main[2].level == 2);
+    TEST_REQUIRE(main[3].name == std::string("meh"));
+    TEST_REQUIRE(main[3].comment == "foo=123");
+    TEST_REQUIRE(main[4].name == std::string("keke"));
+    TEST_REQUIRE(main[4].comment == "keke");
+    TEST_REQUIRE(main[4].markers.size() == 1);
+    TEST_REQUIRE(main[4].markers[0] == "keke");
+    TEST_REQUIRE(main[5].name == std::string("BadFrame"));
+    TEST_REQUIRE(main[10].name == std::string("unit_test"));
+    TEST_REQUIRE(main[0].finish_time >= main[4].finish_time);
+
+    TEST_REQUIRE(task.size() == 10*2);
+    TEST_REQUIRE(task[0].name == std::string("Task"));
+    TEST_REQUIRE(task[0].comment == "task=0");
+    TEST_REQUIRE(task[1].name == std::string("Work"));
+    TEST_REQUIRE(task[1].level == 1);
+    TEST_REQUIRE(task[19].name == std::string("Work"));
+    TEST_REQUIRE(task[18].comment == "task=9");
+}
+
+
+void unit_test_metrics()
+{
+    TEST_CASE(test::Type::Feature)
+
+    // bucket mapping
+    {
+        for (std::uint64_t value=0; value<100000; ++value)
+        {
+            const auto index = base::Histogram::GetBucketIndex(value);
+            TEST_REQUIRE(index < base::Histogram::BucketCount);
+            TEST_REQUIRE(base::Histogram::GetBucketLowValue(index) <= value);
+            TEST_REQUIRE(base::Histogram::GetBucketHighValue(index) >= value);
+        }
+        const auto max = ~std::uint64_t(0);
+        TEST_REQUIRE(base::Histogram::GetBucketIndex(max) == base::Histogram::BucketCount-1);
+        TEST_REQUIRE(base::Histogram::GetBucketHighValue(base::Histogram::BucketCount-1) == max);
+    }
+
+    // small values are exact
+    {
+        base::Histogram histogram;
+        TEST_REQUIRE(histogram.GetCount() == 0);
+        TEST_REQUIRE(histogram.GetPercentile(50.0) == 0);
+        TEST_REQUIRE(histogram.GetMin() == 0);
+
+        for (unsigned i=1; i<=10; ++i)
+            histogram.Record(i);
+        TEST_REQUIRE(histogram.GetCount() == 10);
+        TEST_REQUIRE(histogram.GetSum() == 55);
+        TEST_REQUIRE(histogram.GetMin() == 1);
+        TEST_REQUIRE(histogram.GetMax() == 10);
+        TEST_REQUIRE(histogram.GetMean() == 5.5);
+        TEST_REQUIRE(histogram.GetPercentile(0.0) == 1);
+        TEST_REQUIRE(histogram.GetPercentile(50.0) == 5);
+        TEST_REQUIRE(histogram.GetPercentile(90.0) == 9);
+        TEST_REQUIRE(histogram.GetPercentile(100.0) == 10);
+
+        histogram.Reset();
+        TEST_REQUIRE(histogram.GetCount() == 0);
+        TEST_REQUIRE(histogram.GetMax() == 0);
+    }
+
+    // large values are within the bucket precision
+    {
+        base::Histogram histogram;
+        for (unsigned i=1; i<=100000; ++i)
+            histogram.Record(i);
+
+        const auto CheckPercentile = [&histogram](double percentile, double expected) {
+            const auto value = histogram.GetPercentile(percentile);
+            return std::abs(double(value) - expected) / expected <= 1.0 / base::Histogram::SubBucketCount;
+        };
+        TEST_REQUIRE(CheckPercentile(50.0, 50000.0));
+        TEST_REQUIRE(CheckPercentile(99.0, 99000.0));
+        TEST_REQUIRE(CheckPercentile(99.9, 99900.0));
+        TEST_REQUIRE(histogram.GetPercentile(100.0) == 100000);
+    }
+
+    // concurrent recording
+    {
+        base::MetricsRegistry registry;
+        auto& histogram = registry.GetHistogram("time");
+        auto& counter = registry.GetCounter("count");
+
+        std::vector<std::thread> threads;
+        for (unsigned i=0; i<4; ++i)
+        {
+            threads.emplace_back([&histogram, &counter]() {
+                for (unsigned i=0; i<10000; ++i)
+                {
+                    histogram.Record(i);
+                    counter.Increment();
+                }
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        TEST_REQUIRE(counter.GetValue() == 40000);
+        TEST_REQUIRE(histogram.GetCount() == 40000);
+        TEST_REQUIRE(histogram.GetMin() == 0);
+        TEST_REQUIRE(histogram.GetMax() == 9999);
+    }
+
+    // registry
+    {
+        base::MetricsRegistry registry;
+        TEST_REQUIRE(registry.FindCounter("foo") == nullptr);
+        auto& counter = registry.GetCounter("foo");
+        TEST_REQUIRE(&registry.GetCounter("foo") == &counter);
+        TEST_REQUIRE(registry.FindCounter("foo") == &counter);
+        TEST_REQUIRE(registry.FindGauge("foo") == nullptr);
+
+        counter.Increment(3);
+        registry.GetGauge("bar").SetValue(1.5);
+        registry.GetHistogram("meh").Record(16);
+
+        const auto& json = registry.ToJson();
+        TEST_REQUIRE(json.find("\"foo\":3") != std::string::npos);
+        TEST_REQUIRE(json.find("\"bar\":1.5") != std::string::npos);
+        TEST_REQUIRE(json.find("\"p99\":16") != std::string::npos);
+
+        registry.Reset();
+        TEST_REQUIRE(counter.GetValue() == 0);
+        TEST_REQUIRE(registry.FindHistogram("meh")->GetCount() == 0);
+
+        TEST_REQUIRE(base::GetGlobalCounter("foo") == nullptr);
+        base::SetGlobalMetrics(&registry);
+        TEST_REQUIRE(base::GetGlobalCounter("foo") == &counter);
+        base::SetGlobalMetrics(nullptr);
+    }
+}
+
+
 void unit_test_util()
 {
     TEST_CASE(test::Type::Feature)
@@ -555,6 +810,227 @@ void unit_test_allocator()
 
 }
 
+void unit_test_allocator_handle()
+{
+    TEST_CASE(test::Type::Feature)
+
+    struct Kiwi {
+        std::string foo;
+    };
+    using Allocator = base::Allocator<Kiwi>;
+
+    Allocator allocator;
+    auto index = allocator.GetNextIndex();
+    allocator.CreateObject<Kiwi>(index)->foo = "kiwi0";
+
+    const auto handle = allocator.GetHandle(index);
+    TEST_REQUIRE(allocator.IsValid(handle));
+    TEST_REQUIRE(allocator.Resolve<Kiwi>(handle)->foo == "kiwi0");
+
+    allocator.DestroyAll(index);
+    allocator.FreeIndex(index);
+    TEST_REQUIRE(!allocator.IsValid(handle));
+    TEST_REQUIRE(allocator.Resolve<Kiwi>(handle) == nullptr);
+
+    // same index is recycled but the old handle must not resolve to the new object
+    auto recycled = allocator.GetNextIndex();
+    TEST_REQUIRE(recycled == index);
+    allocator.CreateObject<Kiwi>(recycled)->foo = "kiwi1";
+    TEST_REQUIRE(allocator.Resolve<Kiwi>(handle) == nullptr);
+    TEST_REQUIRE(allocator.Resolve<Kiwi>(allocator.GetHandle(recycled))->foo == "kiwi1");
+
+    // sequence begins with the first live object.
+    {
+        using Sequence = base::AllocatorSequence<Kiwi, Kiwi>;
+        auto other = allocator.GetNextIndex();
+        allocator.CreateObject<Kiwi>(other)->foo = "kiwi2";
+        allocator.DestroyAll(recycled);
+        allocator.FreeIndex(recycled);
+
+        Sequence sequence(&allocator);
+        auto beg = sequence.begin();
+        TEST_REQUIRE(beg != sequence.end());
+        TEST_REQUIRE(beg->foo == "kiwi2");
+        ++beg;
+        TEST_REQUIRE(beg == sequence.end());
+    }
+    allocator.Cleanup();
+}
+
+void unit_test_allocator_concurrent()
+{
+    TEST_CASE(test::Type::Feature)
+
+    struct Kiwi {
+        explicit Kiwi(unsigned value) noexcept
+          : value(value)
+        {}
+        unsigned value = 0;
+    };
+    using Allocator = base::Allocator<Kiwi>;
+    using Sequence  = base::AllocatorSequence<Kiwi, Kiwi>;
+
+    constexpr auto ThreadCount = 4;
+    constexpr auto Iterations  = 20000;
+
+    Allocator allocator;
+    std::atomic<bool> done = {false};
+
+    // iterate over the objects while other threads are allocating.
+    std::thread reader([&allocator, &done]() {
+        while (!done.load())
+        {
+            Sequence sequence(&allocator);
+            for (auto& kiwi : sequence)
+            {
+                TEST_REQUIRE(kiwi.value != 0);
+            }
+        }
+    });
+
+    // objects are only ever destroyed by the thread that iterates them
+    // so the writers here only create objects and churn free indices.
+    std::vector<size_t> kept[ThreadCount];
+    std::vector<std::thread> threads;
+    for (int t=0; t<ThreadCount; ++t)
+    {
+        threads.emplace_back([&allocator, &kept, t]() {
+            for (int i=0; i<Iterations; ++i)
+            {
+                const auto index = allocator.GetNextIndex();
+                if (i % 3 == 0)
+                {
+                    allocator.CreateObject<Kiwi>(index, t + 1);
+                    kept[t].push_back(index);
+                    continue;
+                }
+                const auto handle = allocator.GetHandle(index);
+                TEST_REQUIRE(allocator.IsValid(handle));
+                allocator.FreeIndex(index);
+                TEST_REQUIRE(!allocator.IsValid(handle));
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    done = true;
+    reader.join();
+
+    // no index may have been handed out twice.
+    std::vector<bool> seen(allocator.GetHighIndex(), false);
+    for (int t=0; t<ThreadCount; ++t)
+    {
+        for (auto index : kept[t])
+        {
+            TEST_REQUIRE(!seen[index]);
+            seen[index] = true;
+            TEST_REQUIRE(allocator.GetObject<Kiwi>(index)->value == unsigned(t + 1));
+        }
+    }
+
+    size_t live = 0;
+    for (size_t i=0; i<allocator.GetHighIndex(); ++i)
+    {
+        if (allocator.GetObject<Kiwi>(i))
+            ++live;
+    }
+    TEST_REQUIRE(live == allocator.GetCount());
+    TEST_REQUIRE(live == size_t(ThreadCount * ((Iterations + 2) / 3)));
+
+    allocator.Cleanup();
+}
+
+// Compare index allocation throughput under contention between the
+// allocator's lock-free free list and the previous mutex + std::stack
+// scheme.
+void perf_test_allocator_contention()
+{
+    TEST_CASE(test::Type::Performance)
+
+    struct Kiwi {
+        std::string foo;
+    };
+
+    class LockedIndexAllocator {
+    public:
+        size_t GetNextIndex()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            ++mCount;
+            if (mFreeIndices.empty())
+                return mHighIndex++;
+            auto index = mFreeIndices.top();
+            mFreeIndices.pop();
+            return index;
+        }
+        void FreeIndex(size_t index)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            --mCount;
+            mFreeIndices.push(index);
+        }
+    private:
+        std::mutex mMutex;
+        std::stack<size_t> mFreeIndices;
+        size_t mHighIndex = 0;
+        size_t mCount = 0;
+    };
+
+    constexpr auto Iterations = 10000;
+    constexpr auto Batch = 16;
+
+    const auto hardware = std::max(2u, std::thread::hardware_concurrency());
+
+    for (unsigned thread_count = 1; thread_count <= hardware; thread_count *= 2)
+    {
+        {
+            auto ret = test::TimedTest(10, [thread_count]() {
+                base::Allocator<Kiwi> allocator;
+                std::vector<std::thread> threads;
+                for (unsigned t=0; t<thread_count; ++t)
+                {
+                    threads.emplace_back([&allocator]() {
+                        size_t indices[Batch];
+                        for (int i=0; i<Iterations; ++i)
+                        {
+                            for (auto& index : indices)
+                                index = allocator.GetNextIndex();
+                            for (auto index : indices)
+                                allocator.FreeIndex(index);
+                        }
+                    });
+                }
+                for (auto& thread : threads)
+                    thread.join();
+            });
+            test::PrintTestTimes(base::FormatString("Allocator lock-free index (%1 threads)", thread_count).c_str(), ret);
+        }
+        {
+            auto ret = test::TimedTest(10, [thread_count]() {
+                LockedIndexAllocator allocator;
+                std::vector<std::thread> threads;
+                for (unsigned t=0; t<thread_count; ++t)
+                {
+                    threads.emplace_back([&allocator]() {
+                        size_t indices[Batch];
+                        for (int i=0; i<Iterations; ++i)
+                        {
+                            for (auto& index : indices)
+                                index = allocator.GetNextIndex();
+                            for (auto index : indices)
+                                allocator.FreeIndex(index);
+                        }
+                    });
+                }
+                for (auto& thread : threads)
+                    thread.join();
+            });
+            test::PrintTestTimes(base::FormatString("Allocator mutex index (%1 threads)", thread_count).c_str(), ret);
+        }
+    }
+}
+
 void unit_test_string()
 {
     TEST_CASE(test::Type::Feature)
@@ -596,6 +1072,110 @@ void unit_test_string()
     }
 }
 
+void unit_test_format()
+{
+    TEST_CASE(test::Type::Feature)
+
+    // parsing
+    {
+        constexpr base::CompiledFormat fmt("foo %1 bar %2%3");
+        static_assert(fmt.GetNumSegments() == 5);
+        static_assert(fmt.GetSegment(0).index == 0);
+        static_assert(fmt.GetSegment(1).index == 1);
+        static_assert(fmt.GetSegment(2).index == 0);
+        static_assert(fmt.GetSegment(3).index == 2);
+        static_assert(fmt.GetSegment(4).index == 3);
+
+        constexpr base::CompiledFormat empty("");
+        static_assert(empty.GetNumSegments() == 0);
+
+        constexpr base::CompiledFormat text("100% done %");
+        static_assert(text.GetNumSegments() == 1);
+    }
+
+    // same output as the runtime formatting.
+    {
+        static constexpr base::CompiledFormat fmt("%1 %2 %3 %4 %5 %6");
+        const std::string str = "string";
+        TEST_REQUIRE(base::FormatString(fmt, 1, -2, 3u, 4.5f, 5.25, str) ==
+                     base::FormatString("%1 %2 %3 %4 %5 %6", 1, -2, 3u, 4.5f, 5.25, str));
+        TEST_REQUIRE(base::FormatString(fmt, "a", 'b', true, 10ull, -20ll, base::FSize(1.0f, 2.0f)) ==
+                     base::FormatString("%1 %2 %3 %4 %5 %6", "a", 'b', true, 10ull, -20ll, base::FSize(1.0f, 2.0f)));
+    }
+
+    // placeholders in any order, repeated and missing.
+    {
+        static constexpr base::CompiledFormat fmt("%2 %1 %2 %3");
+        TEST_REQUIRE(base::FormatString(fmt, "foo", "bar") == "bar foo bar %3");
+        static constexpr base::CompiledFormat text("no placeholders");
+        TEST_REQUIRE(base::FormatString(text) == "no placeholders");
+        TEST_REQUIRE(base::FormatString(text, 123) == "no placeholders");
+    }
+
+    // caller provided buffer and truncation
+    {
+        static constexpr base::CompiledFormat fmt("%1+%2");
+        char buffer[16];
+        TEST_REQUIRE(base::FormatTo(buffer, fmt, "Color", 1234) == 10);
+        TEST_REQUIRE(std::string(buffer) == "Color+1234");
+
+        char small[6];
+        TEST_REQUIRE(base::FormatTo(small, fmt, "Color", 1234) == 10);
+        TEST_REQUIRE(std::string(small) == "Color");
+
+        TEST_REQUIRE(base::FormatTo(nullptr, 0, fmt, "Color", 1234) == 10);
+    }
+
+    // longer than the internal stack buffer.
+    {
+        static constexpr base::CompiledFormat fmt("%1%1%1");
+        const std::string str(200, 'x');
+        TEST_REQUIRE(base::FormatString(fmt, str) == str + str + str);
+    }
+}
+
+// Compare the compile time parsed format strings against the runtime
+// placeholder search and replace.
+void perf_test_format()
+{
+    TEST_CASE(test::Type::Performance)
+
+    const std::string name = "Sprite";
+    {
+        auto ret = test::TimedTest(1000, [&name]() {
+            for (int i=0; i<100; ++i)
+            {
+                const auto& str = base::FormatString("%1+%2 (%3, %4)", name, i, 1.0f, 2u);
+                TEST_REQUIRE(!str.empty());
+            }
+        });
+        test::PrintTestTimes("FormatString runtime", ret);
+    }
+    {
+        auto ret = test::TimedTest(1000, [&name]() {
+            static constexpr base::CompiledFormat fmt("%1+%2 (%3, %4)");
+            for (int i=0; i<100; ++i)
+            {
+                const auto& str = base::FormatString(fmt, name, i, 1.0f, 2u);
+                TEST_REQUIRE(!str.empty());
+            }
+        });
+        test::PrintTestTimes("FormatString compiled", ret);
+    }
+    {
+        auto ret = test::TimedTest(1000, [&name]() {
+            static constexpr base::CompiledFormat fmt("%1+%2 (%3, %4)");
+            char buffer[128];
+            for (int i=0; i<100; ++i)
+            {
+                const auto len = base::FormatTo(buffer, fmt, name, i, 1.0f, 2u);
+                TEST_REQUIRE(len < sizeof(buffer));
+            }
+        });
+        test::PrintTestTimes("FormatTo compiled", ret);
+    }
+}
+
 void unit_test_color()
 {
     TEST_CASE(test::Type::Feature)
@@ -658,13 +1238,20 @@ int test_main(int argc, char* argv[])
     unit_test_rect_test_point<float>();
     unit_test_rect_mapping();
     unit_test_string();
+    unit_test_format();
     unit_test_color();
 
     unit_test_shmem();
     unit_test_trace();
+    unit_test_trace_ring_buffer();
+    unit_test_metrics();
     unit_test_util();
     unit_test_allocator();
+    unit_test_allocator_handle();
+    unit_test_allocator_concurrent();
 
+    perf_test_allocator_contention();
+    perf_test_format();
     return 0;
 }
 ) // TEST_MAIN
@@ -428,6 +428,51 @@ void unit_test_insert_query()
         TEST_REQUIRE(ret.size() == 1);
     }
 
+    // erase single object by its rect
+    {
+        base::DenseSpatialGrid<Entity*> grid(100.0f, 100.0f, 2, 2);
+
+        Entity e1;
+        grid.Insert(base::FRect(40.0f, 40.0f, 20.0f , 20.0f), &e1);
+        Entity e2;
+        grid.Insert(base::FRect(45.0f, 45.0f, 10.0f , 10.0f), &e2);
+        TEST_REQUIRE(grid.GetNumItems() == 8);
+
+        grid.Erase(base::FRect(40.0f, 40.0f, 20.0f , 20.0f), [&e1](Entity* entity, const base::FRect&) {
+            return entity == &e1;
+        });
+        TEST_REQUIRE(grid.GetNumItems() == 4);
+        TEST_REQUIRE(grid.GetObject(0, 0, 0) == &e2);
+        TEST_REQUIRE(grid.GetObject(1, 1, 0) == &e2);
+    }
+
+    // move object
+    {
+        base::DenseSpatialGrid<Entity*> grid(100.0f, 100.0f, 2, 2);
+
+        Entity e1;
+        grid.Insert(base::FRect(10.0f, 10.0f, 20.0f , 20.0f), &e1);
+        Entity e2;
+        grid.Insert(base::FRect(15.0f, 15.0f, 20.0f , 20.0f), &e2);
+
+        TEST_REQUIRE(grid.Move(base::FRect(10.0f, 10.0f, 20.0f , 20.0f),
+                               base::FRect(40.0f, 60.0f, 20.0f , 20.0f), &e1));
+        TEST_REQUIRE(grid.GetNumItems(0, 0) == 1);
+        TEST_REQUIRE(grid.GetObject(0, 0, 0) == &e2);
+        TEST_REQUIRE(grid.GetNumItems(1, 0) == 1);
+        TEST_REQUIRE(grid.GetNumItems(1, 1) == 1);
+
+        std::vector<Entity*> ret;
+        grid.Find(base::FPoint(50.0f, 70.0f), &ret);
+        TEST_REQUIRE(ret.size() == 1);
+        TEST_REQUIRE(ret[0] == &e1);
+
+        // outside the grid, the object is only erased.
+        TEST_REQUIRE(grid.Move(base::FRect(40.0f, 60.0f, 20.0f , 20.0f),
+                               base::FRect(140.0f, 60.0f, 20.0f , 20.0f), &e1) == false);
+        TEST_REQUIRE(grid.GetNumItems() == 1);
+    }
+
 
 }
 
@@ -18,6 +18,9 @@
 
 #include <thread>
 #include <iostream>
+#include <sstream>
+#include <memory>
+#include <cstring>
 
 #include "base/test_minimal.h"
 #include "base/test_float.h"
@@ -120,6 +123,122 @@ int test_main(int argc, char* argv[])
         base::SetThreadLog(nullptr);
     }
 
+    // test async logger with deferred formatting
+    {
+        using Sink = base::BufferLogger<base::NullLogger>;
+        auto sink = std::make_unique<Sink>();
+        sink->EnableWrite(base::Logger::WriteType::WriteFormatted, false);
+        auto* buffer = sink.get();
+
+        // no background thread, dispatch manually.
+        base::AsyncLogger log(std::move(sink), base::AsyncLogger::OverflowPolicy::Drop, 0);
+        base::SetGlobalLog(&log);
+        TEST_REQUIRE(base::GetDeferredLog() == &log);
+
+        DEBUG("deferred %1 %2 %3", 42, std::string("foo"), 1.5f);
+        // char array argument can't be deferred and is formatted immediately.
+        INFO("immediate %1", "bar");
+        // std::string format string is formatted immediately.
+        WARN(std::string("string %1"), 123);
+        // char array format string on the stack is copied.
+        {
+            char format[32];
+            std::strcpy(format, "stack %1");
+            ERROR(format, 7);
+            std::strcpy(format, "gone %1");
+        }
+        TEST_REQUIRE(buffer->GetBufferMsgCount() == 0);
+
+        log.Dispatch();
+        TEST_REQUIRE(buffer->GetBufferMsgCount() == 4);
+        TEST_REQUIRE(buffer->GetMessage(0).msg == "deferred 42 foo 1.500000");
+        TEST_REQUIRE(buffer->GetMessage(0).type == base::LogEvent::Debug);
+        TEST_REQUIRE(buffer->GetMessage(0).file == "unit_test_log.cpp");
+        TEST_REQUIRE(buffer->GetMessage(0).line != 0);
+        TEST_REQUIRE(buffer->GetMessage(1).msg == "immediate bar");
+        TEST_REQUIRE(buffer->GetMessage(1).type == base::LogEvent::Info);
+        TEST_REQUIRE(buffer->GetMessage(2).msg == "string 123");
+        TEST_REQUIRE(buffer->GetMessage(2).type == base::LogEvent::Warning);
+        TEST_REQUIRE(buffer->GetMessage(3).msg == "stack 7");
+        TEST_REQUIRE(buffer->GetMessage(3).type == base::LogEvent::Error);
+
+        const auto& stats = log.GetStats();
+        TEST_REQUIRE(stats.written == 4);
+        TEST_REQUIRE(stats.dropped == 0);
+        base::SetGlobalLog(nullptr);
+    }
+
+    // test async logger drop policy
+    {
+        using Sink = base::BufferLogger<base::NullLogger>;
+        auto sink = std::make_unique<Sink>();
+        sink->EnableWrite(base::Logger::WriteType::WriteFormatted, false);
+        auto* buffer = sink.get();
+
+        base::AsyncLogger log(std::move(sink), base::AsyncLogger::OverflowPolicy::Drop, 0, 4);
+        base::SetGlobalLog(&log);
+        for (int i=0; i<10; ++i)
+            INFO("message %1", i);
+
+        log.Dispatch();
+        // the dropped messages are reported after the written messages.
+        TEST_REQUIRE(buffer->GetBufferMsgCount() == 5);
+        TEST_REQUIRE(buffer->GetMessage(0).msg == "message 0");
+        TEST_REQUIRE(buffer->GetMessage(3).msg == "message 3");
+        TEST_REQUIRE(buffer->GetMessage(4).msg == "Dropped 6 log message(s) because of a full log buffer.");
+        TEST_REQUIRE(buffer->GetMessage(4).type == base::LogEvent::Warning);
+        TEST_REQUIRE(log.GetStats().dropped == 6);
+        TEST_REQUIRE(log.GetStats().written == 4);
+
+        // space is available again, the drops are reported only once.
+        INFO("message %1", 10);
+        log.Dispatch();
+        TEST_REQUIRE(buffer->GetBufferMsgCount() == 6);
+        TEST_REQUIRE(buffer->GetMessage(5).msg == "message 10");
+        base::SetGlobalLog(nullptr);
+    }
+
+    // test async logger with multiple threads and blocking policy
+    {
+        using Sink = base::BufferLogger<base::NullLogger>;
+        auto sink = std::make_unique<Sink>();
+        sink->EnableWrite(base::Logger::WriteType::WriteFormatted, false);
+        auto* buffer = sink.get();
+
+        base::AsyncLogger log(std::move(sink), base::AsyncLogger::OverflowPolicy::Block, 1, 8);
+        base::SetGlobalLog(&log);
+
+        auto writer = [](int thread) {
+            for (int i=0; i<1000; ++i)
+                INFO("%1 %2", thread, i);
+        };
+        std::thread t0(writer, 0);
+        std::thread t1(writer, 1);
+        writer(2);
+        t0.join();
+        t1.join();
+        log.Flush();
+
+        const auto& stats = log.GetStats();
+        TEST_REQUIRE(stats.dropped == 0);
+        TEST_REQUIRE(stats.written == 3000);
+        TEST_REQUIRE(buffer->GetBufferMsgCount() == 3000);
+
+        // messages from each thread must be in the order they were written.
+        int expected[3] = {0, 0, 0};
+        for (size_t i=0; i<buffer->GetBufferMsgCount(); ++i)
+        {
+            int thread = 0;
+            int index  = 0;
+            std::stringstream ss(buffer->GetMessage(i).msg);
+            ss >> thread >> index;
+            TEST_REQUIRE(thread >= 0 && thread < 3);
+            TEST_REQUIRE(index == expected[thread]);
+            ++expected[thread];
+        }
+        base::SetGlobalLog(nullptr);
+    }
+
     // test some terminal colors
     {
         base::OStreamLogger logger(std::cout);
@@ -20,6 +20,7 @@
 #include <memory>
 #include <vector>
 #include <unordered_map>
+#include <cstring>
 
 #include "base/test_minimal.h"
 #include "base/test_help.h"
@@ -326,6 +327,93 @@ void unit_test_bump()
     TEST_REQUIRE(GetEntityStack().GetSize() == 0);
 }
 
+void unit_test_frame_arena()
+{
+    TEST_CASE(test::Type::Feature)
+
+    struct Command {
+        std::string name;
+        double value = 0.0;
+    };
+
+    mem::FrameArena arena(256);
+    TEST_REQUIRE(arena.GetUsedBytes() == 0);
+    TEST_REQUIRE(arena.GetHeapAllocCount() == 0);
+
+    // alignment
+    {
+        auto* a = arena.Allocate(1, 1);
+        auto* b = arena.Allocate(sizeof(double), alignof(double));
+        TEST_REQUIRE(a);
+        TEST_REQUIRE(((uintptr_t)b % alignof(double)) == 0);
+        TEST_REQUIRE(arena.GetHeapAllocCount() == 1);
+        arena.Reset();
+    }
+
+    // alignment stricter than the heap block alignment
+    {
+        mem::FrameArena other;
+        auto* a = other.Allocate(10, 64);
+        auto* b = other.Allocate(1, 1);
+        auto* c = other.Allocate(8, 128);
+        auto* d = other.Allocate(4096, 256); // overflow block
+        TEST_REQUIRE(((uintptr_t)a % 64) == 0);
+        TEST_REQUIRE(((uintptr_t)c % 128) == 0);
+        TEST_REQUIRE(((uintptr_t)d % 256) == 0);
+        TEST_REQUIRE(b);
+        TEST_REQUIRE(other.GetHeapAllocCount() == 3);
+        std::memset(d, 0, 4096);
+        other.Reset();
+
+        auto* e = other.Allocate(4096, 256);
+        TEST_REQUIRE(((uintptr_t)e % 256) == 0);
+        TEST_REQUIRE(other.GetHeapAllocCount() == 1);
+    }
+
+    // first frames warm up the arena, after that the same
+    // workload should not need any more heap allocations.
+    for (int frame=0; frame<5; ++frame)
+    {
+        {
+            mem::ArenaVector<Command> commands{mem::ArenaAllocator<Command>(&arena)};
+            for (int i=0; i<1000; ++i)
+            {
+                Command cmd;
+                cmd.name  = "cmd";
+                cmd.value = i;
+                commands.push_back(std::move(cmd));
+            }
+            TEST_REQUIRE(commands.size() == 1000);
+            TEST_REQUIRE(commands[999].value == 999.0);
+
+            mem::ArenaVector<mem::ArenaVector<int>> lists{mem::ArenaAllocator<mem::ArenaVector<int>>(&arena)};
+            for (int i=0; i<10; ++i)
+            {
+                lists.emplace_back(mem::ArenaAllocator<int>(&arena));
+                lists.back().resize(i * 10);
+            }
+        }
+        if (frame == 0)
+            TEST_REQUIRE(arena.GetHeapAllocCount() > 1); // overflow
+        else if (frame == 1)
+            TEST_REQUIRE(arena.GetHeapAllocCount() == 1); // grown main block
+        else TEST_REQUIRE(arena.GetHeapAllocCount() == 0);
+        arena.Reset();
+        TEST_REQUIRE(arena.GetUsedBytes() == 0);
+    }
+    TEST_REQUIRE(arena.GetCapacity() > 256);
+    const auto total = arena.GetTotalHeapAllocCount();
+
+    // steady state
+    {
+        mem::ArenaVector<Command> commands{mem::ArenaAllocator<Command>(&arena)};
+        commands.resize(1000);
+    }
+    TEST_REQUIRE(arena.GetHeapAllocCount() == 0);
+    TEST_REQUIRE(arena.GetTotalHeapAllocCount() == total);
+    arena.Reset();
+}
+
 // do some tests comparing different allocation strategies
 void measure_allocation_times()
 {
@@ -493,6 +581,7 @@ int test_main(int argc, char* argv[])
     unit_test_ptr();
     unit_test_pool();
     unit_test_bump();
+    unit_test_frame_arena();
 
     unit_test_refcount_lifecycle();
 
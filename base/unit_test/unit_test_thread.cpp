@@ -17,6 +17,9 @@
 #include "config.h"
 
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <numeric>
 
 #include "base/math.h"
 #include "base/test_minimal.h"
@@ -103,12 +106,349 @@ void unit_test_pool()
 }
 
 
+void unit_test_wait_strategy()
+{
+    TEST_CASE(test::Type::Feature)
+
+    class SleepTask : public base::ThreadTask
+    {
+    public:
+        explicit SleepTask(std::chrono::milliseconds duration) noexcept
+          : mDuration(duration)
+        {}
+    protected:
+        void DoTask() override
+        {
+            std::this_thread::sleep_for(mDuration);
+        }
+    private:
+        const std::chrono::milliseconds mDuration;
+    };
+
+    base::ThreadPool threads;
+    threads.AddRealThread(base::ThreadPool::Worker0ThreadID);
+    threads.AddRealThread(base::ThreadPool::Worker1ThreadID);
+
+    using WaitStrategy = base::TaskHandle::WaitStrategy;
+
+    for (auto strategy : {WaitStrategy::BusyLoop, WaitStrategy::Sleep,
+                          WaitStrategy::WaitCondition, WaitStrategy::SpinThenPark})
+    {
+        auto handle = threads.SubmitTask(std::make_unique<SleepTask>(std::chrono::milliseconds(5)));
+        handle.Wait(strategy);
+        TEST_REQUIRE(handle.IsComplete());
+    }
+
+    // long task, spin for the spin limit and then park.
+    {
+        const auto spin_limit = base::TaskHandle::GetSpinLimit();
+        base::TaskHandle::SetSpinLimit(std::chrono::microseconds(500));
+
+        base::TaskHandle::WaitStats stats;
+        auto handle = threads.SubmitTask(std::make_unique<SleepTask>(std::chrono::milliseconds(20)));
+        handle.Wait(WaitStrategy::SpinThenPark, &stats);
+        TEST_REQUIRE(handle.IsComplete());
+        TEST_REQUIRE(stats.spin_time >= std::chrono::microseconds(500));
+        TEST_REQUIRE(stats.spin_time <  std::chrono::milliseconds(10));
+        TEST_REQUIRE(stats.park_time >  std::chrono::milliseconds(5));
+
+        base::TaskHandle::SetSpinLimit(spin_limit);
+    }
+
+    // many waiters on the same task.
+    {
+        auto handle = threads.SubmitTask(std::make_unique<SleepTask>(std::chrono::milliseconds(10)));
+        std::vector<std::thread> waiters;
+        for (int i=0; i<4; ++i)
+        {
+            waiters.emplace_back([handle]() mutable {
+                handle.Wait(WaitStrategy::WaitCondition);
+            });
+        }
+        for (auto& waiter : waiters)
+            waiter.join();
+        TEST_REQUIRE(handle.IsComplete());
+    }
+
+    threads.WaitAll();
+    threads.Shutdown();
+}
+
+void unit_test_parallel_for()
+{
+    TEST_CASE(test::Type::Feature)
+
+    base::ThreadPool threads;
+    threads.AddRealThread(base::ThreadPool::Worker0ThreadID);
+    threads.AddRealThread(base::ThreadPool::Worker1ThreadID);
+    threads.AddRealThread(base::ThreadPool::Worker2ThreadID);
+    TEST_REQUIRE(threads.GetWorkerCount() == 3);
+
+    // every index is visited exactly once.
+    {
+        std::vector<unsigned> values;
+        values.resize(10000);
+        base::ParallelFor(0, values.size(), 100, [&values](size_t index) {
+            values[index]++;
+        }, &threads);
+        TEST_REQUIRE(std::all_of(values.begin(), values.end(), [](unsigned v) { return v == 1; }));
+    }
+
+    // chunk that doesn't divide the range evenly
+    {
+        std::vector<unsigned> values;
+        values.resize(1001);
+        base::ParallelFor(0, values.size(), 7, [&values](size_t index) {
+            values[index] = unsigned(index);
+        }, &threads);
+        for (size_t i=0; i<values.size(); ++i)
+            TEST_REQUIRE(values[i] == i);
+    }
+
+    // for each
+    {
+        std::vector<int> values;
+        values.resize(5000, 1);
+        base::ParallelForEach(values, 64, [](int& value) {
+            value *= 2;
+        }, &threads);
+        TEST_REQUIRE(std::accumulate(values.begin(), values.end(), 0) == 10000);
+    }
+
+    // nested parallel for inside a worker task must not deadlock.
+    {
+        std::atomic_int counter {0};
+        base::ParallelFor(0, 16, 1, [&counter, &threads](size_t) {
+            base::ParallelFor(0, 100, 10, [&counter](size_t) {
+                counter++;
+            }, &threads);
+        }, &threads);
+        TEST_REQUIRE(counter == 1600);
+    }
+
+    // exception is propagated to the caller
+    {
+        TEST_EXCEPTION(base::ParallelFor(0, 100, 10, [](size_t index) {
+            if (index == 55)
+                throw std::runtime_error("oops");
+        }, &threads));
+    }
+
+    // no thread pool, serial execution
+    {
+        std::vector<unsigned> values;
+        values.resize(100);
+        base::ParallelFor(0, values.size(), 10, [&values](size_t index) {
+            values[index]++;
+        }, nullptr);
+        TEST_REQUIRE(std::all_of(values.begin(), values.end(), [](unsigned v) { return v == 1; }));
+    }
+
+    threads.WaitAll();
+    threads.Shutdown();
+}
+
+void unit_test_task_graph()
+{
+    TEST_CASE(test::Type::Feature)
+
+    class RecordTask : public base::ThreadTask
+    {
+    public:
+        RecordTask(std::string name, std::vector<std::string>* order, std::mutex* mutex, bool fail = false)
+          : mOrder(order)
+          , mMutex(mutex)
+          , mFail(fail)
+        {
+            SetTaskName(std::move(name));
+        }
+    protected:
+        void DoTask() override
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (mFail)
+                throw std::runtime_error("oops");
+
+            std::lock_guard<std::mutex> lock(*mMutex);
+            mOrder->push_back(GetTaskName());
+        }
+    private:
+        std::vector<std::string>* mOrder = nullptr;
+        std::mutex* mMutex = nullptr;
+        const bool mFail = false;
+    };
+
+    const auto IndexOf = [](const std::vector<std::string>& order, const std::string& name) {
+        return std::find(order.begin(), order.end(), name) - order.begin();
+    };
+
+    base::ThreadPool threads;
+    threads.AddRealThread(base::ThreadPool::Worker0ThreadID);
+    threads.AddRealThread(base::ThreadPool::Worker1ThreadID);
+    threads.AddRealThread(base::ThreadPool::UpdateThreadID);
+    threads.AddMainThread();
+
+    // diamond shaped graph where B and C depend on A
+    // and D depends on both B and C.
+    for (int i=0; i<10; ++i)
+    {
+        std::vector<std::string> order;
+        std::mutex mutex;
+
+        auto a = threads.SubmitTask(std::make_unique<RecordTask>("A", &order, &mutex),
+                                    base::ThreadPool::AnyWorkerThreadID);
+        auto b = threads.SubmitTask(std::make_unique<RecordTask>("B", &order, &mutex),
+                                    base::ThreadPool::AnyWorkerThreadID, {a});
+        auto c = threads.SubmitTask(std::make_unique<RecordTask>("C", &order, &mutex),
+                                    base::ThreadPool::UpdateThreadID, {a});
+        auto d = threads.SubmitTask(std::make_unique<RecordTask>("D", &order, &mutex),
+                                    base::ThreadPool::AnyWorkerThreadID, {b, c});
+        d.Wait(base::TaskHandle::WaitStrategy::Sleep);
+        TEST_REQUIRE(a.IsComplete());
+        TEST_REQUIRE(b.IsComplete());
+        TEST_REQUIRE(c.IsComplete());
+
+        TEST_REQUIRE(order.size() == 4);
+        TEST_REQUIRE(order[0] == "A");
+        TEST_REQUIRE(order[3] == "D");
+        TEST_REQUIRE(IndexOf(order, "B") < IndexOf(order, "D"));
+        TEST_REQUIRE(IndexOf(order, "C") < IndexOf(order, "D"));
+
+        // D waited for B and C which both waited for A
+        const auto* task = d.GetTask();
+        TEST_REQUIRE(task->GetDependencyWaitTime() >= std::chrono::milliseconds(2));
+        TEST_REQUIRE(!task->DependencyFailed());
+    }
+
+    // dependency on a task that has already completed.
+    {
+        std::vector<std::string> order;
+        std::mutex mutex;
+        auto a = threads.SubmitTask(std::make_unique<RecordTask>("A", &order, &mutex));
+        a.Wait(base::TaskHandle::WaitStrategy::Sleep);
+
+        auto b = threads.SubmitTask(std::make_unique<RecordTask>("B", &order, &mutex),
+                                    base::ThreadPool::AnyWorkerThreadID, {a});
+        b.Wait(base::TaskHandle::WaitStrategy::Sleep);
+        TEST_REQUIRE(order.size() == 2);
+        TEST_REQUIRE(order[1] == "B");
+    }
+
+    // continuation on the main thread.
+    {
+        std::vector<std::string> order;
+        std::mutex mutex;
+        auto a = threads.SubmitTask(std::make_unique<RecordTask>("A", &order, &mutex));
+        auto b = threads.SubmitTask(std::make_unique<RecordTask>("B", &order, &mutex),
+                                    base::ThreadPool::MainThreadID, {a});
+        b.Wait(base::TaskHandle::WaitStrategy::Sleep);
+        TEST_REQUIRE(order.size() == 2);
+        TEST_REQUIRE(order[0] == "A");
+        TEST_REQUIRE(order[1] == "B");
+        threads.ExecuteMainThread();
+    }
+
+    // failure propagates through the graph.
+    {
+        std::vector<std::string> order;
+        std::mutex mutex;
+        auto a = threads.SubmitTask(std::make_unique<RecordTask>("A", &order, &mutex, true));
+        auto b = threads.SubmitTask(std::make_unique<RecordTask>("B", &order, &mutex),
+                                    base::ThreadPool::AnyWorkerThreadID, {a});
+        auto c = threads.SubmitTask(std::make_unique<RecordTask>("C", &order, &mutex),
+                                    base::ThreadPool::AnyWorkerThreadID, {b});
+        c.Wait(base::TaskHandle::WaitStrategy::Sleep);
+        TEST_REQUIRE(a.GetTask()->HasException());
+        TEST_REQUIRE(b.GetTask()->DependencyFailed());
+        TEST_REQUIRE(b.GetTask()->Failed());
+        TEST_REQUIRE(c.GetTask()->DependencyFailed());
+        TEST_REQUIRE(order.empty());
+    }
+
+    threads.WaitAll();
+    threads.Shutdown();
+}
+
+// Compare the throughput and the task latency (from submit to completion)
+// of the round-robin and work stealing schedulers. The workload has mostly
+// short tasks with an occasional long task which stalls every task that is
+// queued behind it when the tasks can't move between the workers.
+void perf_test_scheduler()
+{
+    TEST_CASE(test::Type::Performance)
+
+    using clock = std::chrono::steady_clock;
+
+    class SpinTask : public base::ThreadTask
+    {
+    public:
+        SpinTask(std::chrono::microseconds duration, double* latency) noexcept
+          : mSubmitTime(clock::now())
+          , mDuration(duration)
+          , mLatency(latency)
+        {}
+    protected:
+        void DoTask() override
+        {
+            const auto start = clock::now();
+            while (clock::now() - start < mDuration)
+                ;
+            *mLatency = std::chrono::duration<double, std::milli>(clock::now() - mSubmitTime).count();
+        }
+    private:
+        const clock::time_point mSubmitTime;
+        const std::chrono::microseconds mDuration;
+        double* mLatency = nullptr;
+    };
+
+    const auto Run = [](base::ThreadPool::Scheduler scheduler, const char* name) {
+        base::ThreadPool threads(scheduler);
+        threads.AddRealThread(base::ThreadPool::Worker0ThreadID);
+        threads.AddRealThread(base::ThreadPool::Worker1ThreadID);
+        threads.AddRealThread(base::ThreadPool::Worker2ThreadID);
+        threads.AddRealThread(base::ThreadPool::Worker3ThreadID);
+
+        constexpr auto TaskCount = 2000;
+
+        std::vector<double> latencies;
+        latencies.resize(TaskCount);
+
+        const auto start = clock::now();
+        for (int i=0; i<TaskCount; ++i)
+        {
+            const auto duration = i % 50 == 0 ? std::chrono::microseconds(5000)
+                                               : std::chrono::microseconds(20);
+            threads.SubmitTask(std::make_unique<SpinTask>(duration, &latencies[i]));
+        }
+        threads.WaitAll();
+        const auto total = std::chrono::duration<double>(clock::now() - start).count();
+        threads.Shutdown();
+
+        std::sort(latencies.begin(), latencies.end());
+        test::Print(test::Color::Info, "\n %s\n", name);
+        test::Print(test::Color::Info, " -------------------------------------------\n");
+        test::Print(test::Color::Info, "  tasks  = %d\n", TaskCount);
+        test::Print(test::Color::Info, "  total  = %.3f ms\n", total * 1000.0);
+        test::Print(test::Color::Info, "  rate   = %.0f tasks/s\n", TaskCount / total);
+        test::Print(test::Color::Info, "  p50    = %.3f ms\n", latencies[TaskCount * 50 / 100]);
+        test::Print(test::Color::Info, "  p99    = %.3f ms\n", latencies[TaskCount * 99 / 100]);
+        test::Print(test::Color::Info, "  max    = %.3f ms\n", latencies.back());
+    };
+    Run(base::ThreadPool::Scheduler::RoundRobin,   "Round-robin scheduler");
+    Run(base::ThreadPool::Scheduler::WorkStealing, "Work stealing scheduler");
+    test::Print(test::Color::Info, "\n");
+}
+
 EXPORT_TEST_MAIN(
 int test_main(int argc, char* argv[])
 {
     test::TestLogger logger("unit_test_thread_pool.log");
 
     unit_test_pool();
+    unit_test_wait_strategy();
+    unit_test_parallel_for();
+    unit_test_task_graph();
+    perf_test_scheduler();
     return 0;
 }
 ) // TEST_MAIN
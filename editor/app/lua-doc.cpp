@@ -536,6 +536,16 @@ void InitLuaDoc()
                                   "The index must be from a previous call to trace.enter.",
                  "unsigned", "index");
     DOC_FUNCTION_1("void", "event", "Record an instantaneous trace event.", "string", "name");
+    DOC_FUNCTION_1("unsigned", "counter", "Get the current value of an engine metrics counter.<br>"
+                                     "Returns 0 if no such counter exists or if the metrics are not enabled.",
+                   "string", "name");
+    DOC_FUNCTION_1("float", "gauge", "Get the current value of an engine metrics gauge.<br>"
+                                    "Returns 0 if no such gauge exists or if the metrics are not enabled.",
+                   "string", "name");
+    DOC_FUNCTION_2("unsigned", "percentile", "Get the approximate value at the given percentile [0.0, 100.0] in an engine metrics histogram.<br>"
+                                        "Returns 0 if no such histogram exists or if the metrics are not enabled.",
+                   "string", "name", "float", "percentile");
+    DOC_FUNCTION_0("string", "metrics", "Get a snapshot of all the engine metrics as a JSON string.");
 
     DOC_TABLE("base.FRect");
     DOC_METHOD_0("base.FRect", "new", "Construct a new axis aligned rectangle without any size.");
@@ -1031,6 +1041,12 @@ void InitLuaDoc()
                                             "and the state set by the user via any developer UI.<br>"
                                             "Debug drawing will be off when both states are off and on when either one is on.",
                                             "bool", "enabled");
+    DOC_METHOD_1("void", "EnableRenderInterpolation", "Request to enable / disable render interpolation.<br>"
+                                                      "When enabled the rendered entity nodes are interpolated between the two latest "
+                                                      "simulation steps which allows the game to update at a lower rate than it renders "
+                                                      "while keeping the motion smooth. The rendered state then lags one update step behind.<br>"
+                                                      "The initial state is set by the 'render_interpolation' engine setting in config.json.",
+                                                      "bool", "enabled");
     DOC_METHOD_1("void", "DebugPause", "Initiate a debug pause or leave previous debug pause.", "bool", "pause");
     DOC_METHOD_1("void", "DebugPrint", "Print a debug message in the game window.", "string", "message");
     DOC_METHOD_4("void", "DebugDrawCircle", "Draw a debug circle with the given radius around the center point in game space.",
@@ -1366,7 +1382,8 @@ void InitLuaDoc()
 
 
     DOC_TABLE2("game.EntityNodeTransform", "Entity node transform data.");
-    DOC_OBJECT_PROPERTY("glm.vec2", "translation", "Translation value relative to parent node.");
+    DOC_OBJECT_PROPERTY("glm.vec2", "translation", "Translation value relative to parent node.<br>"
+                                                   "The vector properties are returned as copies, assign the whole vector in order to change the value.");
     DOC_OBJECT_PROPERTY("glm.vec2", "scale", "Scale factor that applies to this node and its descendants.");
     DOC_OBJECT_PROPERTY("glm.vec2", "size", "Node size in game units. Affects drawable items, rigid bodies, spatial nodes etc.");
     DOC_OBJECT_PROPERTY("float", "rotation", "Rotation around the Z axis in radians.");
@@ -1738,6 +1755,26 @@ void InitLuaDoc()
                                    "starting and finishing the filtering.",
                  "function", "predicate");
 
+    DOC_TABLE("game.SpatialQueryResult");
+    DOC_METHOD_0("game.SpatialQueryResult", "new", "Construct a new empty spatial query result.<br>"
+                                                   "The result object can be reused for multiple queries in order to avoid allocating "
+                                                   "a new result set on every query.");
+    DOC_METHOD_0("bool", "IsEmpty", "Check whether the result has no entity nodes.");
+    DOC_METHOD_0("void", "Clear", "Clear the result of all the entity nodes and queries.");
+    DOC_METHOD_0("unsigned", "GetSize", "Get the number of entity nodes in the result over all the queries.");
+    DOC_METHOD_0("unsigned", "GetNumQueries", "Get the number of queries whose results are in the result object.<br>"
+                                              "A batch query adds one query per query shape.");
+    DOC_METHOD_1("unsigned", "GetQueryBegin", "Get the index of the first entity node of the query's result.<br>"
+                                              "The query index must be valid. Note that the query and node indices are 0 based.",
+                 "unsigned", "query");
+    DOC_METHOD_1("unsigned", "GetQuerySize", "Get the number of entity nodes in the query's result. The query index must be valid.",
+                 "unsigned", "query");
+    DOC_METHOD_1("game.EntityNode", "GetNode", "Get the entity node at the given index. The index must be valid.",
+                 "unsigned", "index");
+    DOC_METHOD_1("float", "GetDistance", "Get the distance of the entity node at the given index from the query shape. The index must be valid.<br>"
+                                         "The distance is only computed for the nearest queries and the queries that order the result by distance.",
+                 "unsigned", "index");
+
     DOC_TABLE("game.ScriptVar");
     DOC_METHOD_0("bool|float|string|int|vec2", "GetValue", "Get the value of the script variable.");
     DOC_METHOD_0("string", "GetName", "Get the script variable name.");
@@ -1821,6 +1858,76 @@ void InitLuaDoc()
     DOC_METHOD_1("glm.vec2", "MapVectorToScene", "Map a direction vector from the map plan plane to scene.",
                  "glm.vec2", "vector");
 
+    DOC_TABLE("game.MapPathfinder");
+    DOC_METHOD_1("game.MapPathfinder", "new", "Construct a new pathfinder on the tiles of the given map layer.<br>"
+                                              "Tiles with a data value of 1 or greater are obstacles.",
+                 "game.MapLayer", "layer");
+    DOC_METHOD_3("game.MapPathfinder", "new", "Construct a new pathfinder on the tiles of the given map layer.<br>"
+                                              "Tiles with a data value equal to or greater than the obstacle value are obstacles.<br>"
+                                              "The map is divided into clusters of cluster size x cluster size tiles for the path search.",
+                 "game.MapLayer", "layer", "unsigned", "cluster_size", "int", "obstacle_value");
+    DOC_METHOD_4("bool, unsigned, util.Vec2Array", "FindPath", "Find a path between two tiles on the calling thread.<br>"
+                                                               "Returns whether a path was found, the cost of the path and the path tiles "
+                                                               "from start to goal where x is the tile column and y is the tile row.",
+                 "unsigned", "start_row", "unsigned", "start_col", "unsigned", "goal_row", "unsigned", "goal_col");
+    DOC_METHOD_4("unsigned", "SubmitQuery", "Queue a path query between two tiles to be solved in the background.<br>"
+                                            "The queued queries are dispatched on the next call to Update. "
+                                            "Returns the query ID used to take the result with GetResult.",
+                 "unsigned", "start_row", "unsigned", "start_col", "unsigned", "goal_row", "unsigned", "goal_col");
+    DOC_METHOD_0("void", "Update", "Commit the pending tile changes, dispatch the queued queries and collect the completed queries.");
+    DOC_METHOD_1("bool, unsigned, util.Vec2Array", "GetResult", "Take the result of a completed path query. The result can only be taken once.<br>"
+                                                                "The result is the same as with FindPath. It's an error to take the result "
+                                                                "of a query that is still pending or that is not known.",
+                 "unsigned", "query");
+    DOC_METHOD_1("bool", "IsPending", "Check whether the path query has been submitted but its result is not yet available.",
+                 "unsigned", "query");
+    DOC_METHOD_5("void", "UpdateTiles", "Re-read the tiles in the given region of the map layer after they have changed.<br>"
+                                        "The changes apply to the queries dispatched after the next Update. "
+                                        "The layer must be the same size as the pathfinder.",
+                 "game.MapLayer", "layer", "unsigned", "row", "unsigned", "col", "unsigned", "num_rows", "unsigned", "num_cols");
+    DOC_METHOD_2("bool", "IsPassable", "Check whether the tile at the given row and column can be moved through.",
+                 "unsigned", "row", "unsigned", "col");
+    DOC_METHOD_0("unsigned", "GetWidth", "Get the width of the pathfinder map in tiles.");
+    DOC_METHOD_0("unsigned", "GetHeight", "Get the height of the pathfinder map in tiles.");
+
+    DOC_TABLE("game.MapVisibility");
+    DOC_METHOD_1("game.MapVisibility", "new", "Construct a new tile visibility (fog of war) on the tiles of the given map layer.<br>"
+                                              "Tiles with a data value of 1 or greater block the line of sight.",
+                 "game.MapLayer", "layer");
+    DOC_METHOD_2("game.MapVisibility", "new", "Construct a new tile visibility (fog of war) on the tiles of the given map layer.<br>"
+                                              "Tiles with a data value equal to or greater than the obstacle value block the line of sight.",
+                 "game.MapLayer", "layer", "int", "obstacle_value");
+    DOC_METHOD_0("unsigned", "GetWidth", "Get the width of the visibility map in tiles.");
+    DOC_METHOD_0("unsigned", "GetHeight", "Get the height of the visibility map in tiles.");
+    DOC_METHOD_0("unsigned", "GetObserverCount", "Get the number of observers.");
+    DOC_METHOD_3("unsigned", "AddObserver", "Add a new observer at the given tile. The observer sees the tiles within the radius (in tiles) "
+                                            "that are not blocked.<br>"
+                                            "Returns the observer ID used to move, change or remove the observer.",
+                 "unsigned", "row", "unsigned", "col", "unsigned", "radius");
+    DOC_METHOD_3("void", "MoveObserver", "Move the observer to a new tile. The field of view is recomputed on the next Update.",
+                 "unsigned", "observer", "unsigned", "row", "unsigned", "col");
+    DOC_METHOD_2("void", "SetObserverRadius", "Change the radius (in tiles) of the observer's field of view.",
+                 "unsigned", "observer", "unsigned", "radius");
+    DOC_METHOD_1("void", "RemoveObserver", "Remove the observer. The tiles it saw stay explored.",
+                 "unsigned", "observer");
+    DOC_METHOD_1("bool", "HasObserver", "Check whether an observer by the given ID exists.",
+                 "unsigned", "observer");
+    DOC_METHOD_0("void", "Update", "Recompute the field of view of the observers that have changed (moved, changed radius or see changed tiles).");
+    DOC_METHOD_1("void", "Update", "Recompute the field of view of the observers that have changed (moved, changed radius or see changed tiles) "
+                                   "and write the fog tiles that changed to the fog layer.<br>"
+                                   "The fog layer must be the same size as the visibility map and is expected to start out unexplored.",
+                 "game.MapLayer", "fog");
+    DOC_METHOD_5("void", "UpdateTiles", "Re-read the tiles in the given region of the map layer after they have changed.<br>"
+                                        "The observers that can see into the region are recomputed on the next Update. "
+                                        "The layer must be the same size as the visibility map.",
+                 "game.MapLayer", "layer", "unsigned", "row", "unsigned", "col", "unsigned", "num_rows", "unsigned", "num_cols");
+    DOC_METHOD_2("bool", "IsVisible", "Check whether the tile is visible to any observer.",
+                 "unsigned", "row", "unsigned", "col");
+    DOC_METHOD_2("bool", "IsExplored", "Check whether the tile is visible now or has been visible before.",
+                 "unsigned", "row", "unsigned", "col");
+    DOC_METHOD_4("bool", "HasLineOfSight", "Check whether there's a clear line of sight between two tiles.",
+                 "unsigned", "row0", "unsigned", "col0", "unsigned", "row1", "unsigned", "col1");
+
 
     DOC_TABLE("game.Scene");
     DOC_METHOD_0("bool|float|string|int|vec2", "index", "Lua index meta method.<br>"
@@ -1830,7 +1937,11 @@ void InitLuaDoc()
                                                            "The scene's script variables are accessible as properties of the scene object.<br>"
                                                            "For example a script variable named 'score' would be accessible as object.score.");
     DOC_METHOD_1("game.EntityList", "ListEntitiesByClassName", "List all entities of the given class identified by its class name", "string", "class");
-    DOC_METHOD_1("game.EntityList", "ListEntitiesByTag", "List all entities that match the given tag string.", "string", "tag");
+    DOC_METHOD_1("game.EntityList", "ListEntitiesByTag", "List all entities that match the given tag string.<br>"
+                                                         "Looking up an indexed tag doesn't need to check all the entities.", "string", "tag");
+    DOC_METHOD_1("void", "IndexEntityTag", "Create an index for looking up the entities that match the given tag string.<br>"
+                                           "Every indexed tag adds to the cost of spawning and killing entities and changing their tags "
+                                           "so only tags that are looked up frequently should be indexed.", "string", "tag");
     DOC_METHOD_0("unsigned", "GetNumEntities", "Get the number of entities currently in the scene.");
     DOC_METHOD_1("game.Entity", "FindEntityByInstanceId", "Find an entity with the given instance ID.<br>"
                                                           "Returns nil if no such entity could be found.",
@@ -1850,6 +1961,22 @@ void InitLuaDoc()
                                        "for one more iteration of the game loop until it's deleted at the end of this *next* iteration.<br>"
                                        "This two step design allows any engine subsystems (or game) to realize and react to entities being killed by looking at the kill flag state.",
                                        "game.Entity", "carcass");
+    DOC_METHOD_1("void", "SetEntityPoolCapacity", "Set the maximum number of killed entities to keep per entity class for reuse by later spawns.<br>"
+                                                  "Reusing killed entities avoids the cost of creating and deleting entities when the same types "
+                                                  "of entities are spawned and killed continuously. Zero disables the pooling and is the default.<br>"
+                                                  "The nodes of the pooled entities are not visible in the entity class node allocator.",
+                 "unsigned", "capacity");
+    DOC_METHOD_0("unsigned", "GetEntityPoolCapacity", "Get the maximum number of killed entities kept per entity class for reuse.");
+    DOC_METHOD_2("void", "PrewarmEntityPool", "Create entities of the given class ahead of time into the entity pool.<br>"
+                                              "The next count spawns of the class will then reuse the pooled entities. Useful for example during a loading screen.",
+                 "string", "klass_name", "unsigned", "count");
+    DOC_METHOD_2("void", "PrewarmEntityPool", "Create entities of the given class ahead of time into the entity pool.<br>"
+                                              "The next count spawns of the class will then reuse the pooled entities. Useful for example during a loading screen.",
+                 "game.EntityClass", "klass", "unsigned", "count");
+    DOC_METHOD_0("void", "ClearEntityPool", "Delete all the pooled entities.");
+    DOC_METHOD_0("table", "GetEntityPoolStats", "Get the entity pool statistics.<br>"
+                                                "The returned table has the number of spawns that reused a pooled entity (hits), "
+                                                "the number of spawns that created a new entity (misses) and the number of entities currently in the pools (pooled).");
     DOC_METHOD_2("game.Entity", "SpawnEntity", "Spawn a new entity in the scene.<br>"
                                                "Spawning a new entity doesn't immediately place the entity in the scene but will only add it to the list of "
                                                "entities to be spawned at the start of the next iteration of the game loop.<br>"
@@ -1948,6 +2075,46 @@ void InitLuaDoc()
                                                                     " - 'Closest' to find  the closest only.<br>"
                                                                     " - 'First' to find the first object",
                  "base.FPoint|glm.vec2", "point", "float", "radius", "string", "mode");
+    DOC_METHOD_5("void", "QuerySpatialNodesInto", "Query the scene for entity nodes that have a spatial node attachment and "
+                                                  "whose spatial nodes intersect with the given line between point A and point B.<br>"
+                                                  "The found entity nodes are added to the result object.<br>"
+                                                  "Order is one of 'None' or 'Distance' and defaults to 'None'.",
+                 "game.SpatialQueryResult", "result", "glm.vec2", "a", "glm.vec2", "b", "string", "mode", "string", "order");
+    DOC_METHOD_5("void", "QuerySpatialNodesInto", "Query the scene for entity nodes that have a spatial node attachment and "
+                                                  "whose spatial nodes intersect with the given point within the given radius from the point.<br>"
+                                                  "The found entity nodes are added to the result object.<br>"
+                                                  "Order is one of 'None' or 'Distance' and defaults to 'None'.",
+                 "game.SpatialQueryResult", "result", "glm.vec2", "point", "float", "radius", "string", "mode", "string", "order");
+    DOC_METHOD_4("void", "QuerySpatialNodesInto", "Query the scene for entity nodes that have a spatial node attachment and "
+                                                  "whose spatial nodes intersect with the given point.<br>"
+                                                  "The found entity nodes are added to the result object.<br>"
+                                                  "Order is one of 'None' or 'Distance' and defaults to 'None'.",
+                 "game.SpatialQueryResult", "result", "glm.vec2", "point", "string", "mode", "string", "order");
+    DOC_METHOD_3("void", "QuerySpatialNodesInto", "Query the scene for entity nodes that have a spatial node attachment and "
+                                                  "whose spatial nodes intersect with the given search rectangle.<br>"
+                                                  "The found entity nodes are added to the result object.<br>"
+                                                  "Order is one of 'None' or 'Distance' and defaults to 'None'.",
+                 "game.SpatialQueryResult", "result", "base.FRect", "area_of_interest", "string", "order");
+    DOC_METHOD_3("void", "QuerySpatialNodesInRectsInto", "Query the scene for entity nodes that have a spatial node attachment and "
+                                                         "whose spatial nodes intersect with the given search rectangles.<br>"
+                                                         "Each rectangle is a separate query in the result object.",
+                 "game.SpatialQueryResult", "result", "table", "rects", "string", "order");
+    DOC_METHOD_4("void", "QuerySpatialNodesAtPointsInto", "Query the scene for entity nodes that have a spatial node attachment and "
+                                                          "whose spatial nodes intersect with the given points (glm.vec2).<br>"
+                                                          "Each point is a separate query in the result object.",
+                 "game.SpatialQueryResult", "result", "table", "points", "string", "mode", "string", "order");
+    DOC_METHOD_5("void", "QuerySpatialNodesInCirclesInto", "Query the scene for entity nodes that have a spatial node attachment and "
+                                                           "whose spatial nodes intersect with the given points (glm.vec2) within the radius from each point.<br>"
+                                                           "Each point is a separate query in the result object.",
+                 "game.SpatialQueryResult", "result", "table", "points", "float", "radius", "string", "mode", "string", "order");
+    DOC_METHOD_4("void", "QueryNearestSpatialNodes", "Query the scene for the k nearest entity nodes that have a spatial node attachment "
+                                                     "and whose spatial nodes are within the maximum distance from the point.<br>"
+                                                     "The found entity nodes are added to the result object ordered by distance.<br>"
+                                                     "The maximum distance is optional and defaults to no limit.",
+                 "game.SpatialQueryResult", "result", "glm.vec2", "point", "unsigned", "k", "float", "max_distance");
+    DOC_METHOD_4("void", "QueryNearestSpatialNodes", "Query the scene for the k nearest entity nodes to each of the given points (glm.vec2).<br>"
+                                                     "Each point is a separate query in the result object.",
+                 "game.SpatialQueryResult", "result", "table", "points", "unsigned", "k", "float", "max_distance");
     DOC_METHOD_1("game.ScriptVar", "FindScriptVarById", "Find a script variable by its ID. Returns nil if no such variable was found.", "string", "id");
     DOC_METHOD_1("game.ScriptVar", "FindScriptVarByName", "Find a script variable byt its name. Returns nil if no such variable was found.", "string", "name");
 
@@ -389,6 +389,8 @@ public:
             base::JsonReadSafe(engine_settings, "default_mag_filter", &config.default_mag_filter);
             base::JsonReadSafe(engine_settings, "updates_per_second", &config.updates_per_second);
             base::JsonReadSafe(engine_settings, "ticks_per_second", &config.ticks_per_second);
+            base::JsonReadSafe(engine_settings, "task_wait_spin_limit", &config.task_wait_spin_limit);
+            base::JsonReadSafe(engine_settings, "render_interpolation", &config.render_interpolation);
             DEBUG("time_step = 1.0/%1, tick_step = 1.0/%2", config.updates_per_second, config.ticks_per_second);
         }
         if (json.contains("mouse_cursor"))
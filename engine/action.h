@@ -138,6 +138,9 @@ namespace engine
     struct EnableDebugDraw {
         bool enabled = false;
     };
+    struct EnableRenderInterpolation {
+        bool enabled = false;
+    };
 
     // Actions express some want the game wants to take
     // such as opening a menu, playing a scene and so on.
@@ -162,6 +165,7 @@ namespace engine
             ShowDeveloperUIAction,
             EnableEffectAction,
             EnableTracing,
-            EnableDebugDraw>;
+            EnableDebugDraw,
+            EnableRenderInterpolation>;
 
 } // namespace
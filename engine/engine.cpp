@@ -180,6 +180,8 @@ public:
         mClearColor = conf.clear_color;
         mGameTimeStep = 1.0f / conf.updates_per_second;
         mGameTickStep = 1.0f / conf.ticks_per_second;
+        base::TaskHandle::SetSpinLimit(std::chrono::microseconds(conf.task_wait_spin_limit));
+        mFlags.set(Flags::EnableRenderInterpolation, conf.render_interpolation);
         mSurfaceWidth  = init.surface_width;
         mSurfaceHeight = init.surface_height;
         mCursorUnits   = conf.mouse_cursor.units;
@@ -489,60 +491,97 @@ public:
         // run at the same time when we're drawing.
         TRACE_CALL("Renderer::DrawFrame", mRenderer.DrawFrame(*mDevice));
 
+        // The fraction of the simulation step that has elapsed since
+        // the latest simulation step was taken.
+        const auto interpolation = GetRenderInterpolation();
+
 #if defined(ENGINE_USE_UPDATE_THREAD)
+        base::TaskHandle debug_draw_task;
         base::TaskHandle next_frame_task;
 
-        // if we had updates running in parallel then complete (wait)
-        // the tasks here. This is unfortunately needed in order to
-        // make sure that the update thread is no longer touching
-        // the UI system or the scene.
-        if (!mUpdateTasks.empty())
+        // when interpolating the frame changes even if there were no
+        // simulation steps taken since the previous frame.
+        if (!mFrameTasks.empty() || mFlags.test(Flags::EnableRenderInterpolation))
         {
-            // Wait each update task
-            for (auto& handle: mUpdateTasks)
-            {
-                TRACE_CALL("WaitSceneUpdate", handle.Wait(base::TaskHandle::WaitStrategy::BusyLoop));
-                const auto* task = handle.GetTask();
-                if (task->HasException())
-                    task->RethrowException();
-            }
-            mUpdateTasks.clear();
+            class SyncDebugDrawTask : public base::ThreadTask {
+            public:
+                explicit SyncDebugDrawTask(GameStudioEngine* engine)
+                  : mEngine(engine)
+                {
+                    SetTaskName("SyncDebugDraws");
+                    EnableTracing(true);
+                }
+            protected:
+                void DoTask() override
+                {
+                    // update the debug draws only after updating the game
+                    // if this is done per each frame they will not be seen
+                    // by the user if the rendering is running very fast.
+                    mEngine->mPendingDebugDraws.clear();
+                    mEngine->mRuntime->TransferDebugQueue(&mEngine->mPendingDebugDraws);
+                }
+            private:
+                GameStudioEngine* mEngine = nullptr;
+            };
 
             class CreateNextFrameTask : public base::ThreadTask {
             public:
-                explicit CreateNextFrameTask(GameStudioEngine* engine)
+                CreateNextFrameTask(GameStudioEngine* engine, float interpolation)
                   : mEngine(engine)
-                {}
+                  , mInterpolation(interpolation)
+                {
+                    SetTaskName("CreateNextFrame");
+                    EnableTracing(true);
+                }
             protected:
                 void DoTask() override
                 {
-                    mEngine->CreateNextFrame();
+                    mEngine->CreateNextFrame(mInterpolation);
                 }
 
             private:
                 GameStudioEngine* mEngine = nullptr;
+                const float mInterpolation = 1.0f;
             };
 
-            // create task to create the next frame in the renderer
-            // we can do this in parallel while this thread can proceed
-            // to draw game UI, debug objects etc.
+            // The frame graph that was started in Update continues on the
+            // update thread. The runtime nodes call into the game runtime
+            // (scripts) and run one after another.
+            //   audio events -> update game -> update UI -> .. -> sync debug draws
+            // The next frame is created once the runtime nodes are done,
+            // in parallel with this thread drawing the UI and the debug
+            // objects below. The previous frame has been drawn above so
+            // the renderer state is free to change.
             auto* thread_pool = base::GetGlobalThreadPool();
-            auto thread_task = std::make_unique<CreateNextFrameTask>(this);
-            next_frame_task = thread_pool->SubmitTask(std::move(thread_task), base::ThreadPool::UpdateThreadID);
-
-            // update the debug draws only after updating the game
-            // if this is done per each frame they will not be seen
-            // by the user if the rendering is running very fast.
-            std::vector<engine::DebugDrawCmd> debug_draws;
-            mRuntime->TransferDebugQueue(&debug_draws);
-            std::swap(mDebugDraws, debug_draws);
+            if (mFrameHasUpdates)
+            {
+                auto task = std::make_unique<SyncDebugDrawTask>(this);
+                debug_draw_task = SubmitRuntimeTask(thread_pool, std::move(task));
+            }
+            std::vector<base::TaskHandle> dependencies;
+            if (mRuntimeTask)
+                dependencies.push_back(mRuntimeTask);
+            auto task = std::make_unique<CreateNextFrameTask>(this, interpolation);
+            next_frame_task = SubmitFrameTask(thread_pool, std::move(task), dependencies);
+
+            // The update thread must no longer be touching the UI system
+            // when we draw the UI.
+            if (mUITask)
+                WaitFrameTask(mUITask, "WaitUIUpdate");
         }
 #else
-        CreateNextFrame();
+        CreateNextFrame(interpolation);
 #endif
-        // Continue drawing more stuff while the renderer update
-        // task runs in parallel.
+        // Continue drawing more stuff while the next frame is
+        // created in parallel.
         TRACE_CALL("Engine::DrawGameUI",        DrawGameUI());
+#if defined(ENGINE_USE_UPDATE_THREAD)
+        if (debug_draw_task)
+        {
+            WaitFrameTask(debug_draw_task, "WaitDebugDraws");
+            std::swap(mDebugDraws, mPendingDebugDraws);
+        }
+#endif
         TRACE_CALL("Engine::DrawDebugObjects",  DrawDebugObjects());
         TRACE_CALL("Engine::DrawDebugMessages", DrawDebugMessages());
         TRACE_CALL("Engine::DrawMousePointer",  DrawMousePointer(dt));
@@ -552,11 +591,16 @@ public:
         // be nothing that is creating needless GPU resources.
 
 #if defined(ENGINE_USE_UPDATE_THREAD)
-        // complete the update/render loop, wait this task here
-        // so that the update/rendering stay in sync.
+        // complete the update/render loop, wait the next frame here so
+        // that the update/rendering stay in sync and the scene is no
+        // longer being read when the game actions are processed below.
         if (next_frame_task)
         {
-            TRACE_CALL("WaitCreateFrame", next_frame_task.Wait(base::TaskHandle::WaitStrategy::BusyLoop));
+            WaitFrameTask(next_frame_task, "WaitCreateFrame");
+            mFrameTasks.clear();
+            mRuntimeTask = base::TaskHandle();
+            mUITask = base::TaskHandle();
+            mFrameHasUpdates = false;
         }
 #endif
 
@@ -573,10 +617,19 @@ public:
         // service the audio system once.
         std::vector<engine::AudioEvent> audio_events;
         TRACE_CALL("Audio::Update", mAudio->Update(&audio_events));
+#if defined(ENGINE_USE_UPDATE_THREAD)
+        // the events are dispatched to the game on the update thread
+        // as the first node of the frame's task graph. See Update.
+        for (auto& event : audio_events)
+        {
+            mAudioEvents.push_back(std::move(event));
+        }
+#else
         for (const auto& event : audio_events)
         {
             mRuntime->OnAudioEvent(event);
         }
+#endif
     }
 
     virtual void Step() override
@@ -586,6 +639,40 @@ public:
 
     virtual void Update(float dt) override
     {
+#if defined(ENGINE_USE_UPDATE_THREAD)
+        auto* thread_pool = base::GetGlobalThreadPool();
+
+        class AudioEventTask : public base::ThreadTask {
+        public:
+            AudioEventTask(GameStudioEngine* engine, std::vector<engine::AudioEvent>&& events) noexcept
+              : mEngine(engine)
+              , mEvents(std::move(events))
+            {
+                SetTaskName("AudioEvents");
+                EnableTracing(true);
+            }
+        protected:
+            void DoTask() override
+            {
+                for (const auto& event : mEvents)
+                {
+                    mEngine->mRuntime->OnAudioEvent(event);
+                }
+            }
+        private:
+            GameStudioEngine* mEngine = nullptr;
+            std::vector<engine::AudioEvent> mEvents;
+        };
+
+        // the audio events are dispatched even when the game is paused.
+        if (!mAudioEvents.empty())
+        {
+            auto task = std::make_unique<AudioEventTask>(this, std::move(mAudioEvents));
+            SubmitRuntimeTask(thread_pool, std::move(task));
+            mAudioEvents.clear();
+        }
+#endif
+
         // Game play update. NOT the place for any kind of
         // real time/wall time subsystem (such as audio) service
         if (mDebug.debug_pause && !mStepForward)
@@ -598,25 +685,29 @@ public:
         mTimeAccum += dt;
 
 #if defined(ENGINE_USE_UPDATE_THREAD)
-        auto* thread_pool = base::GetGlobalThreadPool();
-
         class UpdateTask : public base::ThreadTask {
         public:
-            explicit UpdateTask(GameStudioEngine* engine, double total_time, float time_step) noexcept
+            UpdateTask(GameStudioEngine* engine, double total_time, float time_step, bool ui) noexcept
               : mGameTimeTotal(total_time)
               , mGameTimeStep(time_step)
               , mEngine(engine)
-            {}
+              , mUpdateUI(ui)
+            {
+                SetTaskName(ui ? "UpdateGameUI" : "UpdateGame");
+                EnableTracing(true);
+            }
         protected:
             void DoTask() override
             {
-                TRACE_CALL("UpdateGame", mEngine->UpdateGame(mGameTimeTotal, mGameTimeStep));
-                TRACE_CALL("UpdateGameUI", mEngine->UpdateGameUI(mGameTimeTotal, mGameTimeStep));
+                if (mUpdateUI)
+                    TRACE_CALL("UpdateGameUI", mEngine->UpdateGameUI(mGameTimeTotal, mGameTimeStep));
+                else TRACE_CALL("UpdateGame", mEngine->UpdateGame(mGameTimeTotal, mGameTimeStep));
             }
         private:
             const double mGameTimeTotal = 0.0;
             const double mGameTimeStep  = 0.0;
             GameStudioEngine* mEngine = nullptr;
+            const bool mUpdateUI = false;
         };
 #endif
 
@@ -627,8 +718,11 @@ public:
             // is advancing one time step from current mGameTimeTotal.
             // this is consistent with the tick time accumulation below.
 #if defined(ENGINE_USE_UPDATE_THREAD)
-            auto task = std::make_unique<UpdateTask>(this, mGameTimeTotal, mGameTimeStep);
-            mUpdateTasks.push_back(thread_pool->SubmitTask(std::move(task), base::ThreadPool::UpdateThreadID));
+            auto game = std::make_unique<UpdateTask>(this, mGameTimeTotal, mGameTimeStep, false);
+            auto ui   = std::make_unique<UpdateTask>(this, mGameTimeTotal, mGameTimeStep, true);
+            SubmitRuntimeTask(thread_pool, std::move(game));
+            mUITask = SubmitRuntimeTask(thread_pool, std::move(ui));
+            mFrameHasUpdates = true;
 #else
             TRACE_CALL("UpdateGame", UpdateGame(mGameTimeTotal, mGameTimeStep));
             TRACE_CALL("UpdateGameUI", UpdateGameUI(mGameTimeTotal, mGameTimeStep));
@@ -689,6 +783,10 @@ public:
         {
             DEBUG("FPS: %1, wall_time: %2, frames: %3",
                   stats.current_fps, stats.total_wall_time, stats.num_frames_rendered);
+
+            const auto& frame = mRenderer.GetFrameStats();
+            DEBUG("Renderer scratch: %1 bytes, block allocs: %2",
+                  frame.scratch_bytes, frame.scratch_block_allocs);
         }
 
         if (!mDebug.debug_pause)
@@ -715,6 +813,10 @@ public:
         stats->dynamic_vbo_mem_use     = rs.dynamic_vbo_mem_use;
         stats->streaming_vbo_mem_alloc = rs.streaming_vbo_mem_alloc;
         stats->streaming_vbo_mem_use   = rs.streaming_vbo_mem_use;
+
+        const auto& frame = mRenderer.GetFrameStats();
+        stats->renderer_scratch_bytes        = frame.scratch_bytes;
+        stats->renderer_scratch_block_allocs = frame.scratch_block_allocs;
         return true;
     }
     virtual void TakeScreenshot(const std::string& filename) const override
@@ -1062,6 +1164,11 @@ private:
         DEBUG("Enable debug draw. [value=%1]", action.enabled ? "enable" : "disable");
         mRequests.EnableDebugDraw(action.enabled);
     }
+    void OnAction(const engine::EnableRenderInterpolation& action)
+    {
+        DEBUG("Enable render interpolation. [value=%1]", action.enabled ? "enable" : "disable");
+        mFlags.set(Flags::EnableRenderInterpolation, action.enabled);
+    }
 
     void UpdateGame(double game_time, float dt)
     {
@@ -1143,7 +1250,7 @@ private:
         }
     }
 
-    void CreateNextFrame()
+    void CreateNextFrame(float interpolation)
     {
         const auto now = mGameTimeTotal;
         if (mRenderTimeStamp == 0.0)
@@ -1155,7 +1262,12 @@ private:
         {
             if (SetRendererState())
             {
+                if (mTilemap)
+                {
+                    TRACE_CALL("Tilemap::UpdateStreaming", mTilemap->UpdateStreaming(mRenderer.ComputeMapViewRect(*mTilemap)));
+                }
                 TRACE_CALL("Renderer::Update", mRenderer.Update(*mScene, mTilemap.get(), mRenderTimeTotal, dt));
+                mRenderer.SetInterpolation(interpolation);
                 TRACE_CALL("Renderer::CreateFrame", mRenderer.CreateFrame(*mScene, mTilemap.get()));
                 if (mFlags.test(GameStudioEngine::Flags::EditingMode))
                 {
@@ -1167,6 +1279,61 @@ private:
         mRenderTimeStamp = now;
     }
 
+#if defined(ENGINE_USE_UPDATE_THREAD)
+    // Submit a node of the frame's task graph on the update thread.
+    // The node runs once all of its dependencies have completed without
+    // this thread having to wait.
+    base::TaskHandle SubmitFrameTask(base::ThreadPool* pool, std::unique_ptr<base::ThreadTask> task,
+                                     const std::vector<base::TaskHandle>& dependencies)
+    {
+        auto handle = pool->SubmitTask(std::move(task), base::ThreadPool::UpdateThreadID, dependencies);
+        mFrameTasks.push_back(handle);
+        return handle;
+    }
+    // Submit a node that calls into the game runtime. The runtime isn't
+    // thread safe so the runtime nodes depend on each other and run in
+    // the order of submission.
+    base::TaskHandle SubmitRuntimeTask(base::ThreadPool* pool, std::unique_ptr<base::ThreadTask> task)
+    {
+        std::vector<base::TaskHandle> dependencies;
+        if (mRuntimeTask)
+            dependencies.push_back(mRuntimeTask);
+
+        mRuntimeTask = SubmitFrameTask(pool, std::move(task), dependencies);
+        return mRuntimeTask;
+    }
+    // Wait for a node of the frame's task graph to complete. If a node
+    // has failed the rest of the graph is skipped and the exception is
+    // rethrown once every node has completed.
+    void WaitFrameTask(base::TaskHandle& handle, const char* name)
+    {
+        TRACE_CALL(name, handle.Wait(base::TaskHandle::WaitStrategy::SpinThenPark));
+
+        for (auto& node : mFrameTasks)
+        {
+            if (!node.IsComplete() || !node.GetTask()->HasException())
+                continue;
+
+            for (auto& other : mFrameTasks)
+                other.Wait(base::TaskHandle::WaitStrategy::SpinThenPark);
+
+            const auto* task = node.GetTask();
+            mFrameTasks.clear();
+            mRuntimeTask = base::TaskHandle();
+            mUITask = base::TaskHandle();
+            mFrameHasUpdates = false;
+            task->RethrowException();
+        }
+    }
+#endif
+
+    float GetRenderInterpolation() const
+    {
+        if (!mFlags.test(Flags::EnableRenderInterpolation) || mGameTimeStep <= 0.0f)
+            return 1.0f;
+        return math::clamp(0.0f, 1.0f, mTimeAccum / mGameTimeStep);
+    }
+
     bool SetRendererState()
     {
         // configure renderer
@@ -1500,7 +1667,10 @@ private:
         // flag to control physics world creation.
         EnablePhysics,
         // master flag to control bloom PP in the renderer, controlled by the game.
-        EnableBloom
+        EnableBloom,
+        // flag to control interpolating the rendered node transforms
+        // between the previous and the current simulation step.
+        EnableRenderInterpolation
     };
     // current engine flags to control execution etc.
     base::bitflag<Flags> mFlags;
@@ -1580,7 +1750,18 @@ private:
     double mRenderTimeTotal = 0.0;
     double mRenderTimeStamp = 0.0;
 
-    std::vector<base::TaskHandle> mUpdateTasks;
+    // the nodes of the current frame's task graph (when using the
+    // update thread) and whether the graph has any update steps.
+    std::vector<base::TaskHandle> mFrameTasks;
+    // the latest node that calls into the game runtime.
+    base::TaskHandle mRuntimeTask;
+    // the latest node that updates the game UI.
+    base::TaskHandle mUITask;
+    bool mFrameHasUpdates = false;
+    // audio events pending dispatch to the game on the update thread.
+    std::vector<engine::AudioEvent> mAudioEvents;
+    // the debug draws transferred from the game on the update thread.
+    std::vector<engine::DebugDrawCmd> mPendingDebugDraws;
 
     // The bitbag for storing game state.
     engine::KeyValueStore mStateStore;
@@ -235,6 +235,14 @@ namespace engine
             unsigned updates_per_second = 60;
             // The current expected number of Tick calls per second.
             unsigned ticks_per_second = 1;
+            // The maximum time in microseconds the main thread spins while
+            // waiting for the update thread before going to sleep.
+            unsigned task_wait_spin_limit = 200;
+            // Whether to interpolate the rendered node transforms between
+            // the two latest simulation steps. This allows the simulation
+            // to run at a lower rate than the rendering without the motion
+            // looking choppy at the cost of one update step of latency.
+            bool render_interpolation = false;
             // configuration data for the physics engine.
             struct {
                 // Whether the physics engine/simulation is enabled or not.
@@ -419,6 +427,10 @@ namespace engine
             std::size_t static_vbo_mem_alloc  = 0;
             std::size_t streaming_vbo_mem_use = 0;
             std::size_t streaming_vbo_mem_alloc = 0;
+            // renderer per frame scratch memory use and the number of
+            // scratch memory blocks allocated for it on the last frame.
+            std::size_t renderer_scratch_bytes = 0;
+            std::size_t renderer_scratch_block_allocs = 0;
         };
         // Get the current statistics collected by the app implementation.
         // Returns false if not available.
@@ -19,6 +19,7 @@
 #include "base/assert.h"
 #include "base/logging.h"
 #include "base/trace.h"
+#include "base/metrics.h"
 #include "game/enum.h"
 #include "engine/graphics.h"
 #include "graphics/framebuffer.h"
@@ -38,6 +39,19 @@
 namespace engine
 {
 
+void LowLevelRenderer::Metrics::Refresh()
+{
+    auto* metrics = base::GetGlobalMetrics();
+    if (metrics == registry)
+        return;
+
+    registry = metrics;
+    packets          = metrics ? &metrics->GetGauge("renderer.packets") : nullptr;
+    culled_packets   = metrics ? &metrics->GetGauge("renderer.culled_packets") : nullptr;
+    draw_calls       = metrics ? &metrics->GetGauge("renderer.draw_calls") : nullptr;
+    total_draw_calls = metrics ? &metrics->GetCounter("renderer.total_draw_calls") : nullptr;
+}
+
 LowLevelRenderer::LowLevelRenderer(const std::string* name, gfx::Device& device)
   : mRendererName(name)
   , mDevice(device)
@@ -194,11 +208,27 @@ void LowLevelRenderer::Draw(DrawPacketList& packets, LightList& lights,
     scene_painter.SetPixelRatio(pixel_ratio);
     scene_painter.SetFramebuffer(fbo);
 
+    // all the per frame layer data is allocated from the frame arena
+    // which is reset by the owner after the frame has been drawn.
+    mem::FrameArena temp_arena;
+    mem::FrameArena* arena = mFrameArena ? mFrameArena : &temp_arena;
+
     // Each entity in the scene is assigned to a scene/entity layer and each
     // entity node within an entity is assigned to an entity layer.
     // Thus, to have the right ordering both indices of each
     // render packet must be considered!
-    std::vector<std::vector<RenderLayer>> layers;
+    SceneRenderLayerList layers {SceneRenderLayerList::allocator_type(arena)};
+
+    const auto GetRenderLayer = [&layers, arena](unsigned render_layer_index, unsigned packet_index) -> RenderLayer& {
+        while (render_layer_index >= layers.size())
+            layers.emplace_back(EntityRenderLayerList::allocator_type(arena));
+
+        auto& render_layer = layers[render_layer_index];
+        while (packet_index >= render_layer.size())
+            render_layer.emplace_back(arena);
+
+        return render_layer[packet_index];
+    };
 
     // assign lights to render layers
     TRACE_ENTER(LightLayers);
@@ -210,22 +240,19 @@ void LowLevelRenderer::Draw(DrawPacketList& packets, LightList& lights,
 
         const auto render_layer_index = light.render_layer;
         ASSERT(render_layer_index >= 0);
-        if (render_layer_index >= layers.size())
-            layers.resize(render_layer_index + 1);
-
-        auto& render_layer = layers[render_layer_index];
 
         const auto packet_index = light.packet_index;
         ASSERT(packet_index >= 0);
-        if (packet_index >= render_layer.size())
-            render_layer.resize(packet_index + 1);
 
-        RenderLayer& layer = render_layer[packet_index];
+        RenderLayer& layer = GetRenderLayer(render_layer_index, packet_index);
         layer.layer_lights.push_back(&light);
     }
     TRACE_LEAVE(LightLayers);
 
 
+    std::size_t culled_packets = 0;
+    std::size_t draw_commands  = 0;
+
     TRACE_ENTER(CreateDrawCmd);
     for (auto& packet : packets)
     {
@@ -251,7 +278,10 @@ void LowLevelRenderer::Draw(DrawPacketList& packets, LightList& lights,
             continue;
 
         if (packet.flags.test(DrawPacket::Flags::CullPacket))
+        {
+            ++culled_packets;
             continue;
+        }
 
         gfx::Painter::DrawCommand draw;
         draw.user               = (void*)&packet;
@@ -269,17 +299,11 @@ void LowLevelRenderer::Draw(DrawPacketList& packets, LightList& lights,
 
         const auto render_layer_index = packet.render_layer;
         ASSERT(render_layer_index >= 0);
-        if (render_layer_index >= layers.size())
-            layers.resize(render_layer_index + 1);
-
-        auto& render_layer = layers[render_layer_index];
 
         const auto packet_index = packet.packet_index;
         ASSERT(packet_index >= 0);
-        if (packet_index >= render_layer.size())
-            render_layer.resize(packet_index + 1);
 
-        RenderLayer& layer = render_layer[packet_index];
+        RenderLayer& layer = GetRenderLayer(render_layer_index, packet_index);
         if (packet.pass == DrawPacket::RenderPass::DrawColor)
             layer.draw_color_list.push_back(draw);
         else if (packet.pass == DrawPacket::RenderPass::MaskCover)
@@ -340,6 +364,10 @@ void LowLevelRenderer::Draw(DrawPacketList& packets, LightList& lights,
             for (auto* light : entity_layer.layer_lights)
                 program.AddLight(light->light);
 
+            draw_commands += entity_layer.mask_cover_list.size() +
+                             entity_layer.mask_expose_list.size() +
+                             entity_layer.draw_color_list.size();
+
             if (!entity_layer.mask_cover_list.empty() && !entity_layer.mask_expose_list.empty())
             {
                 gfx::StencilShaderProgram stencil_program;
@@ -385,6 +413,14 @@ void LowLevelRenderer::Draw(DrawPacketList& packets, LightList& lights,
         }
     }
 
+    if (mMetrics && mMetrics->registry)
+    {
+        mMetrics->packets->SetValue(packets.size());
+        mMetrics->culled_packets->SetValue(culled_packets);
+        mMetrics->draw_calls->SetValue(draw_commands);
+        mMetrics->total_draw_calls->Increment(draw_commands);
+    }
+
     // draw editor packets
     if (mSettings.editing_mode)
     {
@@ -569,11 +605,12 @@ bool LowLevelRenderer::CullDrawPacket(const DrawPacket& packet, const glm::mat4&
     // take the model view bounding box (which we should probably get from the drawable)
     // and project all the 6 corners on the rendering plane. cull the packet if it's
     // outside the NDC the X, Y axis.
-    std::vector<glm::vec4> corners;
+    glm::vec4 corners[8];
+    unsigned corner_count = 0;
 
     if (Is3DShape(*shape))
     {
-        corners.resize(8);
+        corner_count = 8;
         corners[0] = glm::vec4 { -0.5f,  0.5f, 0.5f, 1.0f };
         corners[1] = glm::vec4 { -0.5f, -0.5f, 0.5f, 1.0f };
         corners[2] = glm::vec4 {  0.5f,  0.5f, 0.5f, 1.0f };
@@ -588,7 +625,7 @@ bool LowLevelRenderer::CullDrawPacket(const DrawPacket& packet, const glm::mat4&
         // regarding the Y value, remember the complication
         // in the 2D vertex shader. huhu.. should really fix
         // this one soon...
-        corners.resize(4);
+        corner_count = 4;
         corners[0] = glm::vec4 { 0.0f,  0.0f, 0.0f, 1.0f };
         corners[1] = glm::vec4 { 0.0f,  1.0f, 0.0f, 1.0f };
         corners[2] = glm::vec4 { 1.0f,  1.0f, 0.0f, 1.0f };
@@ -601,9 +638,9 @@ bool LowLevelRenderer::CullDrawPacket(const DrawPacket& packet, const glm::mat4&
     float max_x = std::numeric_limits<float>::lowest();
     float min_y = std::numeric_limits<float>::max();
     float max_y = std::numeric_limits<float>::lowest();
-    for (const auto& p0 : corners)
+    for (unsigned i=0; i<corner_count; ++i)
     {
-        auto p1 = transform * packet.transform * p0;
+        auto p1 = transform * packet.transform * corners[i];
         p1 /= p1.w;
         min_x = std::min(min_x, p1.x);
         max_x = std::max(max_x, p1.x);
@@ -27,6 +27,7 @@
 #include <memory>
 
 #include "base/bitflag.h"
+#include "base/memory.h"
 #include "graphics/types.h"
 #include "graphics/painter.h"
 #include "graphics/fwd.h"
@@ -35,6 +36,12 @@
 #include "engine/color.h"
 #include "game/enum.h"
 
+namespace base {
+    class MetricsRegistry;
+    class Counter;
+    class Gauge;
+} // namespace
+
 namespace engine
 {
     struct DrawPacket {
@@ -126,15 +133,26 @@ namespace engine
         virtual bool InspectPacket(DrawPacket& packet) { return true; }
     };
 
+    // Per frame render layer data. All the lists are allocated
+    // from the renderer's frame arena.
     struct RenderLayer {
-        std::vector<gfx::Painter::DrawCommand> draw_color_list;
-        std::vector<gfx::Painter::DrawCommand> mask_cover_list;
-        std::vector<gfx::Painter::DrawCommand> mask_expose_list;
-        std::vector<const Light*> layer_lights;
+        using DrawCommandList = mem::ArenaVector<gfx::Painter::DrawCommand>;
+        using LightList = mem::ArenaVector<const Light*>;
+
+        explicit RenderLayer(mem::FrameArena* arena) noexcept
+          : draw_color_list(DrawCommandList::allocator_type(arena))
+          , mask_cover_list(DrawCommandList::allocator_type(arena))
+          , mask_expose_list(DrawCommandList::allocator_type(arena))
+          , layer_lights(LightList::allocator_type(arena))
+        {}
+        DrawCommandList draw_color_list;
+        DrawCommandList mask_cover_list;
+        DrawCommandList mask_expose_list;
+        LightList layer_lights;
     };
 
-    using EntityRenderLayerList = std::vector<RenderLayer>;
-    using SceneRenderLayerList  = std::vector<EntityRenderLayerList>;
+    using EntityRenderLayerList = mem::ArenaVector<RenderLayer>;
+    using SceneRenderLayerList  = mem::ArenaVector<EntityRenderLayerList>;
     using DrawPacketList = std::vector<DrawPacket>;
     using LightList = std::vector<Light>;
 
@@ -197,6 +215,19 @@ namespace engine
         using Surface = LowLevelRendererHook::Surface;
         using RenderSettings = LowLevelRendererHook::RenderSettings;
 
+        // The metrics updated on every DrawPackets. The metric objects are
+        // looked up from the global metrics registry once (and again only
+        // if the registry changes) and kept by the owner of the renderer.
+        struct Metrics {
+            base::MetricsRegistry* registry = nullptr;
+            base::Gauge* packets = nullptr;
+            base::Gauge* culled_packets = nullptr;
+            base::Gauge* draw_calls = nullptr;
+            base::Counter* total_draw_calls = nullptr;
+            // Look up the metric objects if the global registry has changed.
+            void Refresh();
+        };
+
         LowLevelRenderer(const std::string* name, gfx::Device& device);
 
         inline void SetBloom(const BloomParams& bloom) noexcept
@@ -238,6 +269,17 @@ namespace engine
         {
             mPacketFilter = packet_filter;
         }
+        // Set the arena for allocating the per frame scratch data.
+        // The arena must stay valid for the duration of DrawPackets.
+        // If no arena is set a temporary arena is used.
+        inline void SetFrameArena(mem::FrameArena* arena) noexcept
+        {
+            mFrameArena = arena;
+        }
+        inline void SetMetrics(const Metrics* metrics) noexcept
+        {
+            mMetrics = metrics;
+        }
 
         void DrawPackets(DrawPacketList& packets, LightList& lights) const;
         void BlitImage() const;
@@ -264,6 +306,8 @@ namespace engine
         const std::string* mRendererName = nullptr;
         LowLevelRendererHook* mRenderHook = nullptr;
         PacketFilter* mPacketFilter = nullptr;
+        mem::FrameArena* mFrameArena = nullptr;
+        const Metrics* mMetrics = nullptr;
         RenderSettings mSettings;
         mutable gfx::Texture* mMainImage = nullptr;
         mutable gfx::Texture* mBloomImage = nullptr;
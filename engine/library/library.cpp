@@ -75,7 +75,7 @@ ENGINE_DLL_EXPORT void Gamestudio_CreateRuntime(interop::IRuntime** factory)
         {
             base::EnableLogEvent(event, on_off);
         }
-        void SetThisThreadTracer(base::TraceLog* tracer) override
+        void SetThisThreadTracer(base::Trace* tracer) override
         {
             base::SetThreadTrace(tracer);
         }
@@ -84,6 +84,10 @@ ENGINE_DLL_EXPORT void Gamestudio_CreateRuntime(interop::IRuntime** factory)
         {
             mThreadPool.SetThreadTraceWriter(writer);
         }
+        void SetGlobalMetrics(base::MetricsRegistry* metrics) override
+        {
+            base::SetGlobalMetrics(metrics);
+        }
         void EnableTracing(bool on_off) override
         {
             base::EnableTracing(on_off);
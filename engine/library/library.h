@@ -23,6 +23,7 @@
 
 #include "base/platform.h"
 #include "base/trace.h"
+#include "base/metrics.h"
 #include "base/logging.h"
 #include "engine/engine.h"
 #include "engine/loader.h"
@@ -57,8 +58,9 @@ namespace interop {
         virtual void SetGlobalLogger(base::Logger* logger) = 0;
         virtual void EnableLogEvent(base::LogEvent event, bool on_off) = 0;
 
-        virtual void SetThisThreadTracer(base::TraceLog* tracer) = 0;
+        virtual void SetThisThreadTracer(base::Trace* tracer) = 0;
         virtual void SetGlobalTraceWriter(base::TraceWriter* writer) = 0;
+        virtual void SetGlobalMetrics(base::MetricsRegistry* metrics) = 0;
         virtual void EnableTracing(bool on_off) = 0;
 
         virtual void Release() = 0;
@@ -144,6 +144,58 @@ private:
     std::vector<char> mFileData;
 };
 
+// Read only tilemap data that reads the data from the file on demand
+// instead of keeping the whole file in memory. This is used for the
+// streaming tilemap layers that only access a small part of the data
+// at a time.
+class TilemapDataFile : public game::TilemapData
+{
+public:
+    TilemapDataFile(const std::string& filename, std::ifstream&& stream, size_t size)
+      : mFileName(filename)
+      , mStream(std::move(stream))
+      , mFileSize(size)
+    {}
+    virtual void Write(const void* ptr, size_t bytes, size_t offset) override
+    {
+        BUG("Write to read only tilemap data file.");
+    }
+    virtual void Read(void* ptr, size_t bytes, size_t offset) const override
+    {
+        ASSERT(offset + bytes <= mFileSize);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStream.seekg(offset, std::ios::beg);
+        mStream.read((char*)ptr, bytes);
+        if ((std::size_t)mStream.gcount() != bytes)
+        {
+            ERROR("Failed to read tilemap data file. [file='%1', offset=%2, bytes=%3]", mFileName, offset, bytes);
+            mStream.clear();
+        }
+    }
+    virtual size_t AppendChunk(size_t bytes) override
+    {
+        BUG("Append to read only tilemap data file.");
+        return 0;
+    }
+    virtual size_t GetByteCount() const override
+    {
+        return mFileSize;
+    }
+    virtual void Resize(size_t bytes) override
+    {
+        BUG("Resize of read only tilemap data file.");
+    }
+    virtual void ClearChunk(const void* value, size_t value_size, size_t offset, size_t num_values) override
+    {
+        BUG("Clear of read only tilemap data file.");
+    }
+private:
+    const std::string mFileName;
+    mutable std::mutex mMutex;
+    mutable std::ifstream mStream;
+    const size_t mFileSize = 0;
+};
+
 template<typename Interface>
 class FileBuffer : public Interface
 {
@@ -584,6 +636,23 @@ public:
 
         const auto& filename = ResolveURI(desc.uri);
 
+        // a streaming layer that can't be modified by the game can read
+        // its data from the file on demand unless it's been preloaded already.
+        if (desc.streaming && desc.read_only && mPreloadedFiles.find(filename) == mPreloadedFiles.end())
+        {
+            auto in = base::OpenBinaryInputStream(filename);
+            if (!in.is_open())
+            {
+                ERROR("Failed to open file for reading. [file='%1']", filename);
+                return nullptr;
+            }
+            in.seekg(0, std::ios::end);
+            const auto size = (std::size_t)in.tellg();
+            in.seekg(0, std::ios::beg);
+            DEBUG("Opened tilemap data file for streaming. [file='%1', bytes=%2]", filename, size);
+            return std::make_shared<TilemapDataFile>(desc.uri, std::move(in), size);
+        }
+
         std::vector<char> buffer;
         if (!LoadFileBuffer(filename, &buffer))
             return nullptr;
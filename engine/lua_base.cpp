@@ -24,6 +24,7 @@
 #include "base/math.h"
 #include "base/logging.h"
 #include "base/trace.h"
+#include "base/metrics.h"
 #include "game/types.h"
 
 using namespace game;
@@ -116,6 +117,28 @@ void BindBase(sol::state& L)
     trace["leave"] = &base::TraceEndScope;
     trace["event"] = &base::TraceEvent;
 
+    // metrics queries return 0 when the metric doesn't exist or
+    // when the metrics collection has not been enabled.
+    trace["counter"] = [](const std::string& name) {
+        const auto* metrics = base::GetGlobalMetrics();
+        const auto* counter = metrics ? metrics->FindCounter(name) : nullptr;
+        return counter ? counter->GetValue() : std::uint64_t(0);
+    };
+    trace["gauge"] = [](const std::string& name) {
+        const auto* metrics = base::GetGlobalMetrics();
+        const auto* gauge = metrics ? metrics->FindGauge(name) : nullptr;
+        return gauge ? gauge->GetValue() : 0.0;
+    };
+    trace["percentile"] = [](const std::string& name, double percentile) {
+        const auto* metrics = base::GetGlobalMetrics();
+        const auto* histogram = metrics ? metrics->FindHistogram(name) : nullptr;
+        return histogram ? histogram->GetPercentile(percentile) : std::uint64_t(0);
+    };
+    trace["metrics"] = []() {
+        const auto* metrics = base::GetGlobalMetrics();
+        return metrics ? metrics->ToJson() : std::string("{}");
+    };
+
     sol::constructors<base::FRect(), base::FRect(float, float, float, float)> rect_ctors;
     auto rect = base.new_usertype<base::FRect>("FRect", rect_ctors);
     rect["GetHeight"]      = &base::FRect::GetHeight;
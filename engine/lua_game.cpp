@@ -51,6 +51,8 @@
 #include "game/entity_node_light.h"
 #include "game/scriptvar.h"
 #include "game/tilemap.h"
+#include "game/tilemap_pathfinder.h"
+#include "game/tilemap_visibility.h"
 #include "uikit/window.h"
 #include "uikit/widget.h"
 
@@ -448,51 +450,66 @@ public:
     using Vector = std::vector<T>;
     ResultVector(Vector&& result)
       : mResult(std::move(result))
-    { mBegin = mResult.begin(); }
+    {}
     ResultVector(const Vector& result)
       : mResult(result)
-    { mBegin = mResult.begin(); }
-    ResultVector()
-    { mBegin = mResult.begin(); }
+    {}
+    ResultVector() = default;
+
+    // Create a result that refers to a vector owned by someone else
+    // instead of copying it. The iteration is by index so a change to
+    // the vector during the iteration doesn't invalidate the iteration,
+    // but an item might be skipped or visited twice.
+    static ResultVector View(std::shared_ptr<const Vector> vector)
+    {
+        ResultVector ret;
+        ret.mView = std::move(vector);
+        return ret;
+    }
+
     void BeginIteration()
-    { mBegin = mResult.begin(); }
+    { mIndex = 0; }
     bool HasNext() const
-    { return mBegin != mResult.end(); }
+    { return mIndex < GetVector().size(); }
     bool IsEmpty() const
-    { return mResult.empty(); }
+    { return GetVector().empty(); }
     bool Next()
-    {  return ++mBegin != mResult.end(); }
+    {  return ++mIndex < GetVector().size(); }
     const T& GetCurrent() const
     {
-        if (mBegin == mResult.end())
+        if (mIndex >= GetVector().size())
             throw GameError("ResultVector iteration error.");
-        return *mBegin;
+        return GetVector()[mIndex];
     }
     const T& GetNext()
     {
-        if (mBegin == mResult.end())
+        if (mIndex >= GetVector().size())
             throw GameError("ResultVector iteration error.");
-        return *mBegin++;
+        return GetVector()[mIndex++];
     }
     const T& GetAt(size_t index) const
     {
-        if (index >= mResult.size())
+        if (index >= GetVector().size())
             throw GameError("ResultVector index out of bounds.");
-        return mResult[index];
+        return GetVector()[index];
     }
     size_t GetSize() const
-    { return mResult.size(); }
+    { return GetVector().size(); }
 
     static ResultVector Join(const ResultVector& lhs, const ResultVector& rhs)
     {
         Vector vec;
-        base::AppendVector(vec, lhs.mResult);
-        base::AppendVector(vec, rhs.mResult);
+        base::AppendVector(vec, lhs.GetVector());
+        base::AppendVector(vec, rhs.GetVector());
         return  ResultVector(std::move(vec));
     }
 private:
+    const Vector& GetVector() const
+    { return mView ? *mView : mResult; }
+
     Vector mResult;
-    typename Vector::iterator mBegin;
+    std::shared_ptr<const Vector> mView;
+    std::size_t mIndex = 0;
 };
 
 } // namespace
@@ -1289,6 +1306,34 @@ void BindGameLib(sol::state& L)
         results.BeginIteration();
     };
 
+    using DynamicSpatialQueryResult = game::Scene::SpatialQueryResult;
+    auto query_result = table.new_usertype<DynamicSpatialQueryResult>("SpatialQueryResult",
+        sol::constructors<DynamicSpatialQueryResult()>());
+    query_result["IsEmpty"]       = &DynamicSpatialQueryResult::IsEmpty;
+    query_result["Clear"]         = &DynamicSpatialQueryResult::Clear;
+    query_result["GetSize"]       = &DynamicSpatialQueryResult::GetSize;
+    query_result["GetNumQueries"] = &DynamicSpatialQueryResult::GetNumQueries;
+    query_result["GetQueryBegin"] = [](const DynamicSpatialQueryResult& result, size_t query) {
+        if (query >= result.GetNumQueries())
+            throw GameError("SpatialQueryResult query index out of bounds.");
+        return result.GetQueryBegin(query);
+    };
+    query_result["GetQuerySize"]  = [](const DynamicSpatialQueryResult& result, size_t query) {
+        if (query >= result.GetNumQueries())
+            throw GameError("SpatialQueryResult query index out of bounds.");
+        return result.GetQuerySize(query);
+    };
+    query_result["GetNode"]       = [](const DynamicSpatialQueryResult& result, size_t index) {
+        if (index >= result.GetSize())
+            throw GameError("SpatialQueryResult index out of bounds.");
+        return result.GetObject(index);
+    };
+    query_result["GetDistance"]   = [](const DynamicSpatialQueryResult& result, size_t index) {
+        if (index >= result.GetSize())
+            throw GameError("SpatialQueryResult index out of bounds.");
+        return result.GetDistance(index);
+    };
+
     auto script_var = table.new_usertype<ScriptVar>("ScriptVar");
     script_var["GetValue"]   = ObjectFromScriptVarValue;
     script_var["GetName"]    = &ScriptVar::GetName;
@@ -1367,6 +1412,113 @@ void BindGameLib(sol::state& L)
     layer["GetTileSizeScale"] = &TilemapLayer::GetTileSizeScaler;
     layer["GetType"]          = [](TilemapLayer* map) { return base::ToString(map->GetType()); };
 
+    // paths are returned to the scripts as arrays of tile coordinates
+    // where x is the tile column and y is the tile row.
+    using PathArray = ArrayInterface<glm::vec2, ArrayDataObject>;
+    const auto ReturnPath = [](TilemapPathfinder::Path&& path) {
+        std::vector<glm::vec2> tiles;
+        tiles.reserve(path.tiles.size());
+        for (const auto& tile : path.tiles)
+            tiles.push_back(glm::vec2(tile.col, tile.row));
+        return std::make_tuple(path.found, path.cost, PathArray(true, std::move(tiles)));
+    };
+
+    auto pathfinder = table.new_usertype<TilemapPathfinder>("MapPathfinder",
+        sol::factories(
+            [](const TilemapLayer& layer) {
+                return std::make_unique<TilemapPathfinder>(layer);
+            },
+            [](const TilemapLayer& layer, unsigned cluster_size, int obstacle_value) {
+                if (cluster_size == 0)
+                    throw GameError("Invalid pathfinder cluster size.");
+                TilemapPathfinder::Settings settings;
+                settings.cluster_size   = cluster_size;
+                settings.obstacle_value = obstacle_value;
+                return std::make_unique<TilemapPathfinder>(layer, settings);
+            }));
+    pathfinder["GetWidth"]    = &TilemapPathfinder::GetWidth;
+    pathfinder["GetHeight"]   = &TilemapPathfinder::GetHeight;
+    pathfinder["IsPassable"]  = [](const TilemapPathfinder& finder, unsigned row, unsigned col) {
+        if (row >= finder.GetHeight() || col >= finder.GetWidth())
+            throw GameError("Tile row/col out of bounds.");
+        return finder.IsPassable(row, col);
+    };
+    pathfinder["FindPath"]    = [ReturnPath](TilemapPathfinder& finder, unsigned start_row, unsigned start_col,
+                                                                       unsigned goal_row, unsigned goal_col) {
+        return ReturnPath(finder.FindPath({start_row, start_col}, {goal_row, goal_col}));
+    };
+    pathfinder["SubmitQuery"] = [](TilemapPathfinder& finder, unsigned start_row, unsigned start_col,
+                                                              unsigned goal_row, unsigned goal_col) {
+        return finder.SubmitQuery({start_row, start_col}, {goal_row, goal_col});
+    };
+    pathfinder["IsPending"]   = &TilemapPathfinder::IsPending;
+    pathfinder["Update"]      = &TilemapPathfinder::Update;
+    pathfinder["GetResult"]   = [ReturnPath](TilemapPathfinder& finder, TilemapPathfinder::QueryId id) {
+        TilemapPathfinder::Path path;
+        if (!finder.TakeResult(id, &path))
+            throw GameError("No such path query result.");
+        return ReturnPath(std::move(path));
+    };
+    pathfinder["UpdateTiles"] = [](TilemapPathfinder& finder, const TilemapLayer& layer,
+                                   unsigned row, unsigned col, unsigned num_rows, unsigned num_cols) {
+        if (layer.GetWidth() != finder.GetWidth() || layer.GetHeight() != finder.GetHeight())
+            throw GameError("Pathfinder and map layer size mismatch.");
+        finder.UpdateTiles(layer, base::URect(col, row, num_cols, num_rows));
+    };
+
+    auto visibility = table.new_usertype<TilemapVisibility>("MapVisibility",
+        sol::factories(
+            [](const TilemapLayer& layer) {
+                return std::make_unique<TilemapVisibility>(layer);
+            },
+            [](const TilemapLayer& layer, int obstacle_value) {
+                TilemapVisibility::Settings settings;
+                settings.obstacle_value = obstacle_value;
+                return std::make_unique<TilemapVisibility>(layer, settings);
+            }));
+    const auto CheckTile = [](const TilemapVisibility& visibility, unsigned row, unsigned col) {
+        if (row >= visibility.GetHeight() || col >= visibility.GetWidth())
+            throw GameError("Tile row/col out of bounds.");
+    };
+    visibility["GetWidth"]          = &TilemapVisibility::GetWidth;
+    visibility["GetHeight"]         = &TilemapVisibility::GetHeight;
+    visibility["GetObserverCount"]  = &TilemapVisibility::GetObserverCount;
+    visibility["AddObserver"]       = [CheckTile](TilemapVisibility& visibility, unsigned row, unsigned col, unsigned radius) {
+        CheckTile(visibility, row, col);
+        return visibility.AddObserver(row, col, radius);
+    };
+    visibility["MoveObserver"]      = [CheckTile](TilemapVisibility& visibility, TilemapVisibility::ObserverId id, unsigned row, unsigned col) {
+        CheckTile(visibility, row, col);
+        visibility.MoveObserver(id, row, col);
+    };
+    visibility["SetObserverRadius"] = &TilemapVisibility::SetObserverRadius;
+    visibility["RemoveObserver"]    = &TilemapVisibility::RemoveObserver;
+    visibility["HasObserver"]       = &TilemapVisibility::HasObserver;
+    visibility["Update"]            = sol::overload(
+        [](TilemapVisibility& visibility) {
+            visibility.Update();
+        },
+        [](TilemapVisibility& visibility, TilemapLayer* fog) {
+            if (fog && (fog->GetWidth() != visibility.GetWidth() || fog->GetHeight() != visibility.GetHeight()))
+                throw GameError("Visibility and fog layer size mismatch.");
+            visibility.Update(fog);
+        });
+    visibility["UpdateTiles"]       = [](TilemapVisibility& visibility, const TilemapLayer& layer,
+                                         unsigned row, unsigned col, unsigned num_rows, unsigned num_cols) {
+        if (layer.GetWidth() != visibility.GetWidth() || layer.GetHeight() != visibility.GetHeight())
+            throw GameError("Visibility and map layer size mismatch.");
+        visibility.UpdateTiles(layer, base::URect(col, row, num_cols, num_rows));
+    };
+    visibility["IsVisible"]         = [CheckTile](const TilemapVisibility& visibility, unsigned row, unsigned col) {
+        CheckTile(visibility, row, col);
+        return visibility.IsVisible(row, col);
+    };
+    visibility["IsExplored"]        = [CheckTile](const TilemapVisibility& visibility, unsigned row, unsigned col) {
+        CheckTile(visibility, row, col);
+        return visibility.IsExplored(row, col);
+    };
+    visibility["HasLineOfSight"]    = &TilemapVisibility::HasLineOfSight;
+
 
     auto map = table.new_usertype<Tilemap>("Map");
     map["GetClassName"]         = &Tilemap::GetClassName;
@@ -1447,12 +1599,17 @@ void BindGameLib(sol::state& L)
     auto scene = table.new_usertype<Scene>("Scene",
        sol::meta_function::index,     &GetScriptVar<Scene>,
        sol::meta_function::new_index, &SetScriptVar<Scene>);
+    // the script gets a view to the scene's entity list. the list can
+    // change while the script is iterating over it (for example when
+    // the script changes an entity's tag) but the iteration is by index
+    // and bounds checked.
     scene["ListEntitiesByClassName"]    = [](Scene& scene, const std::string& name) {
-        return EntityList(scene.ListEntitiesByClassName(name));
+        return EntityList::View(scene.ListEntitiesByClassName(name).GetContainer());
     };
     scene["ListEntitiesByTag"] = [](Scene& scene, const std::string& tag) {
-        return EntityList(scene.ListEntitiesByTag(tag));
+        return EntityList::View(scene.ListEntitiesByTag(tag).GetContainer());
     };
+    scene["IndexEntityTag"]             = &Scene::IndexEntityTag;
     scene["GetMap"]                     = (Tilemap*(Scene::*)())&Scene::GetMap;
     scene["GetTime"]                    = &Scene::GetTime;
     scene["GetClassName"]               = &Scene::GetClassName;
@@ -1466,6 +1623,38 @@ void BindGameLib(sol::state& L)
     scene["FindScriptVarById"]          = &Scene::FindScriptVarById;
     scene["FindScriptVarByName"]        = &Scene::FindScriptVarByName;
     scene["KillEntity"]                 = &Scene::KillEntity;
+    scene["SetEntityPoolCapacity"]      = &Scene::SetEntityPoolCapacity;
+    scene["GetEntityPoolCapacity"]      = &Scene::GetEntityPoolCapacity;
+    scene["ClearEntityPool"]            = &Scene::ClearEntityPool;
+    scene["PrewarmEntityPool"]          = sol::overload(
+        [](Scene& scene, const std::string& klass, unsigned count, sol::this_state this_state) {
+            sol::state_view L(this_state);
+            ClassLibrary* classlib = L["ClassLib"];
+            auto entity_klass = classlib->FindEntityClassByName(klass);
+            if (!entity_klass)
+            {
+                ERROR("Failed to pre-warm entity pool. No such entity class. [klass='%1']", klass);
+                return;
+            }
+            scene.PrewarmEntityPool(entity_klass, count);
+        },
+        [](Scene& scene, std::shared_ptr<const EntityClass> klass, unsigned count) {
+            if (klass == nullptr)
+            {
+                ERROR("Failed to pre-warm entity pool. Entity class is nil.");
+                return;
+            }
+            scene.PrewarmEntityPool(klass, count);
+        });
+    scene["GetEntityPoolStats"]         = [](const Scene& scene, sol::this_state this_state) {
+        sol::state_view L(this_state);
+        const auto& stats = scene.GetEntityPoolStats();
+        sol::table table = L.create_table();
+        table["hits"]   = stats.hits;
+        table["misses"] = stats.misses;
+        table["pooled"] = stats.pooled;
+        return table;
+    };
     scene["FindEntityTransform"]        = &Scene::FindEntityTransform;
     scene["FindEntityNodeTransform"]    = &Scene::FindEntityNodeTransform;
     scene["FindEntityNodeBoundingRect"] = &Scene::FindEntityNodeBoundingRect;
@@ -1674,6 +1863,91 @@ void BindGameLib(sol::state& L)
         }
     );
 
+    // Query into a result object owned by the caller so that the same
+    // result storage can be re-used from one query to the next.
+    const auto GetQueryMode = [](const std::string& mode) {
+        const auto enum_val = magic_enum::enum_cast<game::Scene::SpatialQueryMode>(mode);
+        if (!enum_val.has_value())
+            throw GameError("No such spatial query mode: " + mode);
+        return enum_val.value();
+    };
+    const auto GetQueryOrder = [](const std::string& order) {
+        const auto enum_val = magic_enum::enum_cast<game::Scene::SpatialQueryOrder>(order);
+        if (!enum_val.has_value())
+            throw GameError("No such spatial query order: " + order);
+        return enum_val.value();
+    };
+    scene["QuerySpatialNodesInto"] = sol::overload(
+        [GetQueryMode, GetQueryOrder](Scene& scene, DynamicSpatialQueryResult* result, const glm::vec2& a, const glm::vec2& b,
+                                      const std::string& mode, sol::optional<std::string> order) {
+            scene.QuerySpatialNodes(base::FPoint(a.x, a.y), base::FPoint(b.x, b.y), result, GetQueryMode(mode),
+                                    GetQueryOrder(order.value_or("None")));
+        },
+        [GetQueryMode, GetQueryOrder](Scene& scene, DynamicSpatialQueryResult* result, const glm::vec2& point, float radius,
+                                      const std::string& mode, sol::optional<std::string> order) {
+            scene.QuerySpatialNodes(base::FPoint(point.x, point.y), radius, result, GetQueryMode(mode),
+                                    GetQueryOrder(order.value_or("None")));
+        },
+        [GetQueryMode, GetQueryOrder](Scene& scene, DynamicSpatialQueryResult* result, const glm::vec2& point,
+                                      const std::string& mode, sol::optional<std::string> order) {
+            scene.QuerySpatialNodes(base::FPoint(point.x, point.y), result, GetQueryMode(mode),
+                                    GetQueryOrder(order.value_or("None")));
+        },
+        [GetQueryOrder](Scene& scene, DynamicSpatialQueryResult* result, const base::FRect& rect, sol::optional<std::string> order) {
+            scene.QuerySpatialNodes(rect, result, GetQueryOrder(order.value_or("None")));
+        });
+    // the batch queries take the query shapes as Lua arrays (tables)
+    // and write the results of every query into the same result object.
+    const auto GetPoints = [](const sol::table& table) {
+        std::vector<base::FPoint> points;
+        points.reserve(table.size());
+        for (size_t i=1; i<=table.size(); ++i) {
+            const sol::optional<glm::vec2> point = table[i];
+            if (!point.has_value())
+                throw GameError("Spatial query point at index " + std::to_string(i) + " is not a vec2.");
+            points.push_back(base::FPoint(point->x, point->y));
+        }
+        return points;
+    };
+    scene["QuerySpatialNodesInRectsInto"] = [GetQueryOrder](Scene& scene, DynamicSpatialQueryResult* result,
+                                                            const sol::table& table, sol::optional<std::string> order) {
+        std::vector<base::FRect> rects;
+        rects.reserve(table.size());
+        for (size_t i=1; i<=table.size(); ++i) {
+            const sol::optional<base::FRect> rect = table[i];
+            if (!rect.has_value())
+                throw GameError("Spatial query rect at index " + std::to_string(i) + " is not a FRect.");
+            rects.push_back(rect.value());
+        }
+        scene.QuerySpatialNodes(rects, result, GetQueryOrder(order.value_or("None")));
+    };
+    scene["QuerySpatialNodesAtPointsInto"] = [GetQueryMode, GetQueryOrder, GetPoints](Scene& scene, DynamicSpatialQueryResult* result,
+                                                                                      const sol::table& table, const std::string& mode,
+                                                                                      sol::optional<std::string> order) {
+        scene.QuerySpatialNodes(GetPoints(table), result, GetQueryMode(mode), GetQueryOrder(order.value_or("None")));
+    };
+    scene["QuerySpatialNodesInCirclesInto"] = [GetQueryMode, GetQueryOrder, GetPoints](Scene& scene, DynamicSpatialQueryResult* result,
+                                                                                       const sol::table& table, float radius, const std::string& mode,
+                                                                                       sol::optional<std::string> order) {
+        std::vector<base::FCircle> circles;
+        for (const auto& point : GetPoints(table))
+            circles.push_back(base::FCircle(point, radius));
+        scene.QuerySpatialNodes(circles, result, GetQueryMode(mode), GetQueryOrder(order.value_or("None")));
+    };
+    // the point overload must come first since a sol::table argument
+    // also accepts userdata such as a vec2.
+    scene["QueryNearestSpatialNodes"] = sol::overload(
+        [](Scene& scene, DynamicSpatialQueryResult* result, const glm::vec2& point,
+           unsigned k, sol::optional<float> max_distance) {
+            scene.QueryNearestSpatialNodes(base::FPoint(point.x, point.y), k, result,
+                                           max_distance.value_or(std::numeric_limits<float>::max()));
+        },
+        [GetPoints](Scene& scene, DynamicSpatialQueryResult* result, const sol::table& points,
+                    unsigned k, sol::optional<float> max_distance) {
+            scene.QueryNearestSpatialNodes(GetPoints(points), k, result,
+                                           max_distance.value_or(std::numeric_limits<float>::max()));
+        });
+
     auto physics = table.new_usertype<PhysicsEngine>("Physics");
     physics["ApplyImpulseToCenter"] = sol::overload(
         [](PhysicsEngine& self, const std::string& id, const glm::vec2& vec) {
@@ -1951,10 +2225,37 @@ void BindGameLib(sol::state& L)
     game_event["message"] = &GameEvent::message;
 
     auto transform = table.new_usertype<game::EntityNodeTransform>("EntityNodeTransform");
-    transform["translation"] = &EntityNodeTransform::translation;
-    transform["scale"]       = &EntityNodeTransform::scale;
-    transform["size"]        = &EntityNodeTransform::size;
-    transform["rotation"]    = &EntityNodeTransform::rotation;
+    // The vector members are returned by value, writing to a component
+    // of the returned vector doesn't change the transform. The setters
+    // keep the entity's cached node matrices valid.
+    transform["translation"] = sol::property(
+        [](const EntityNodeTransform& transform) {
+            return transform.translation;
+        },
+        [](EntityNodeTransform& transform, const glm::vec2& translation) {
+            transform.SetTranslation(translation);
+        });
+    transform["scale"] = sol::property(
+        [](const EntityNodeTransform& transform) {
+            return transform.scale;
+        },
+        [](EntityNodeTransform& transform, const glm::vec2& scale) {
+            transform.SetScale(scale);
+        });
+    transform["size"] = sol::property(
+        [](const EntityNodeTransform& transform) {
+            return transform.size;
+        },
+        [](EntityNodeTransform& transform, const glm::vec2& size) {
+            transform.SetSize(size);
+        });
+    transform["rotation"] = sol::property(
+        [](const EntityNodeTransform& transform) {
+            return transform.rotation;
+        },
+        [](EntityNodeTransform& transform, float rotation) {
+            transform.SetRotation(rotation);
+        });
     transform["SetRotation"] = &EntityNodeTransform::SetRotation;
     transform["SetScale"]    = sol::overload(
         [](EntityNodeTransform& transform, float x, float y) {
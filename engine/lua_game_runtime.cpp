@@ -32,6 +32,7 @@
 #include "base/color4f.h"
 #include "base/format.h"
 #include "base/trace.h"
+#include "base/metrics.h"
 #include "data/writer.h"
 #include "data/io.h"
 #include "audio/graph.h"
@@ -170,6 +171,11 @@ using namespace engine::lua;
 // code turned into "Lua game errors" which is not what we should want to do!!
 
 namespace {
+// Histogram for recording the time spent in each call into Lua.
+// Looked up from the global metrics registry when the runtime is
+// initialized. nullptr when there's no metrics registry.
+base::Histogram* lua_call_time = nullptr;
+
 // Call into Lua, i.e. invoke a function in some Lua script.
 // Returns true if the call was executed, or false to indicate that
 // there's no such function to call. Throws an exception on script error.
@@ -179,6 +185,7 @@ bool CallLua(const sol::environment& env, const char* name, const Args&... args)
     const sol::protected_function& func = env[name];
     if (!func.valid())
         return false;
+    base::HistogramTimer timer(lua_call_time);
     const auto& result = func(args...);
     // All the calls into Lua begin by the engine calling into Lua.
     // The protected_function will create a new protected scope and
@@ -208,6 +215,7 @@ bool CallLua(Ret* retval, const sol::environment& env, const char* name, const A
     const sol::protected_function& func = env[name];
     if (!func.valid())
         return false;
+    base::HistogramTimer timer(lua_call_time);
     const auto& result = func(args...);
     // All the calls into Lua begin by the engine calling into Lua.
     // The protected_function will create a new protected scope and
@@ -303,6 +311,8 @@ void LuaRuntime::SetCurrentUI(uik::Window* window)
 
 void LuaRuntime::Init()
 {
+    lua_call_time = base::GetGlobalHistogram("lua.call_time_us");
+
     mLuaState = std::make_unique<sol::state>();
     mLuaState->open_libraries();
     mLuaState->clear_package_loaders();
@@ -525,6 +535,11 @@ void LuaRuntime::Init()
         action.enabled = enabled;
         self.mActionQueue.push(action);
     };
+    engine["EnableRenderInterpolation"] = [](LuaRuntime& self, bool enabled) {
+        EnableRenderInterpolation action;
+        action.enabled = enabled;
+        self.mActionQueue.push(action);
+    };
 
     engine["SetCameraPosition"] = sol::overload(
          [](LuaRuntime& self, float x, float y) {
@@ -940,14 +955,10 @@ void LuaRuntime::Update(double game_time, double dt)
             {
                 auto* allocator = &klass->GetAllocator();
 
-                // have to hold the allocator lock here to make sure
-                // that the allocator's world view stays consistent
-                // during the update.
-                // This might actually cause a bit of contention between
-                // any background entity allocation since the Lua updates
-                // are stupidly slow.
-                std::lock_guard<std::mutex> lock(allocator->GetMutex());
-
+                // no lock needed here. the allocator's index allocation
+                // is lock-free and the storage doesn't move so any background
+                // entity allocation can proceed concurrently. Nodes are only
+                // ever released on this (update) thread.
                 CallLua(*pair.second, "UpdateNodes", allocator, game_time, dt, klass);
             }
         }
@@ -313,6 +313,7 @@ namespace engine
     BindArrayInterface<glm::vec3,   ArrayDataPointer>(util, "Vec3ArrayInterface");
     BindArrayInterface<glm::vec4,   ArrayDataPointer>(util, "Vec4ArrayInterface");
     BindArrayInterface<std::string, ArrayDataObject>(util, "StringArray");
+    BindArrayInterface<glm::vec2,   ArrayDataObject>(util, "Vec2Array");
     BindArrayInterface<Entity*,     ArrayObjectReference>(util, "EntityRefArray");
     BindArrayInterface<EntityNode*, ArrayObjectReference>(util, "EntityNodeRefArray");
     BindArrayInterface<MaterialClassHandle, ArrayDataObject>(util, "MaterialRefArray");
@@ -32,6 +32,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <fstream>
 
 #if defined(LINUX_OS)
 #  include <fenv.h>
@@ -55,6 +56,7 @@
 #include "base/utility.h"
 #include "base/json.h"
 #include "base/trace.h"
+#include "base/metrics.h"
 #include "data/json.h"
 #include "device/device.h"
 #include "engine/library/library.h"
@@ -390,88 +392,6 @@ void CenterWindowOnScreen(wdk::Window& window)
     DEBUG("Reformat the window. %1x%2 @ %3,%4", surface_width, surface_height, xpos, ypos);
 }
 
-class MainLogger : public base::Logger
-{
-public:
-    struct LogMessage {
-        base::LogEvent type;
-        std::string msg;
-        std::string file;
-        int line = 0;
-        double time = 0.0;
-    };
-    MainLogger()
-    {
-        std::lock_guard<std::mutex> lock(mMutex);
-        mRunning = true;
-        mThread = std::thread([this]() {
-
-            base::OStreamLogger logger(std::cout);
-            logger.SetStyle(base::OStreamLogger::Style::FancyColor);
-
-            bool run_tread = true;
-
-            LogBuffer buffer;
-            while (run_tread)
-            {
-                {
-                    std::lock_guard<std::mutex> lock(mMutex);
-                    run_tread = mRunning;
-                    std::swap(buffer, mBuffer);
-                }
-                for (const auto& entry : buffer)
-                {
-                    logger.Write(entry.type,
-                                 entry.file.c_str(),
-                                 entry.line,
-                                 entry.msg.c_str(),
-                                 entry.time);
-                }
-                buffer.clear();
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            }
-        });
-    }
-   ~MainLogger() override
-    {
-        {
-            std::lock_guard<std::mutex> lock(mMutex);
-            mRunning = false;
-        }
-        mThread.join();
-    }
-
-    void Write(base::LogEvent type, const char* file, int line, const char* msg, double time) override
-    {
-        LogMessage m;
-        m.type = type;
-        m.msg  = msg;
-        m.file = file;
-        m.line = line;
-        m.time = time;
-        m.msg  = msg;
-
-        std::lock_guard<std::mutex> lock(mMutex);
-
-        mBuffer.push_back(std::move(m));
-    }
-    void Write(base::LogEvent type, const char* msg) override
-    { /* not supported */ }
-    void Flush() override
-    { /* not supported */ }
-
-    base::bitflag<WriteType> GetWriteMask() const override
-    { return WriteType::WriteRaw; }
-private:
-    std::mutex mMutex;
-    std::thread mThread;
-
-    using LogBuffer = std::vector<LogMessage>;
-    LogBuffer mBuffer;
-
-    bool mRunning = true;
-};
-
 int main(int argc, char* argv[])
 {
 #if defined(LINUX_OS)
@@ -509,8 +429,10 @@ int main(int argc, char* argv[])
         bool trace_jank = true;
         bool report_jank = false;
         float jank_factor = 1.25f;
+        float metrics_interval = 10.0f;
 
         std::string trace_file;
+        std::string metrics_file;
         std::string config_file;
         std::string cmdline_error;
         // skip arg 0 since that's the executable name
@@ -526,9 +448,12 @@ int main(int argc, char* argv[])
         opt.Add("--debug-show-fps", "Show FPS counter and stats. You'll need to use --debug-font.");
         opt.Add("--debug-show-msg", "Show debug messages. You'll need to use --debug-font.");
         opt.Add("--debug-print-fps", "Print FPS counter and stats to log.");
-        opt.Add("--trace-file", "Record engine function call trace and timing info into a file.", std::string("trace.txt"));
+        opt.Add("--trace-file", "Record engine function call trace and timing info into a file. (.txt, .json or .bin)", std::string("trace.txt"));
+        opt.Add("--trace-convert", "Convert a binary trace file into a Chromium JSON trace file and exit. (requires --trace-file).", std::string("trace.bin"));
         opt.Add("--trace-start", "Start tracing immediately on application start. (requires --trace-file).");
         opt.Add("--trace-jank", "Try to detect and trace jank frames only.");
+        opt.Add("--metrics-file", "Periodically append a JSON snapshot of the engine metrics into a file.", std::string("metrics.json"));
+        opt.Add("--metrics-interval", "The metrics snapshot interval in seconds. (requires --metrics-file)", metrics_interval);
         opt.Add("--jank-factor", "The 'jank frame' time scaling factor. (time > avg * factor => 'jank')", jank_factor);
         opt.Add("--report-jank", "Report janky frames to log.");
         opt.Add("--vsync", "Force vsync on or off.", false);
@@ -546,10 +471,22 @@ int main(int argc, char* argv[])
         {
             trace_file = opt.GetValue<std::string>("--trace-file");
         }
+        if (opt.WasGiven("--trace-convert"))
+        {
+            const auto& binary_file = opt.GetValue<std::string>("--trace-convert");
+            base::ChromiumTraceJsonWriter writer(opt.WasGiven("--trace-file") ? trace_file : std::string("trace.json"));
+            base::ConvertBinaryTrace(binary_file, writer);
+            return 0;
+        }
         if (opt.WasGiven("--vsync"))
         {
             vsync_override = opt.GetValue<bool>("--vsync");
         }
+        if (opt.WasGiven("--metrics-file"))
+        {
+            metrics_file = opt.GetValue<std::string>("--metrics-file");
+        }
+        metrics_interval = opt.GetValue<float>("--metrics-interval");
 
         jank_factor = opt.GetValue<float>("--jank-factor");
         trace_jank  = opt.WasGiven("--trace-jank");
@@ -629,7 +566,16 @@ int main(int argc, char* argv[])
         // Two(?) solutions for this:
         //  - move the shared common code into a shared library
         //  - change the locking mechanism and put it into the logger.
-        MainLogger logger;
+        // The async logger formats the messages and writes them out on its
+        // own thread so that the audio and update threads don't have to
+        // take a lock or wait on the console I/O when logging.
+        // A writer that finds its buffer full (for example because of an
+        // error repeating every frame) must not stall the audio or update
+        // thread so the message is dropped. The number of dropped messages
+        // is written into the console log as a warning.
+        auto console = std::make_unique<base::OStreamLogger>(std::cout);
+        console->SetStyle(base::OStreamLogger::Style::FancyColor);
+        base::AsyncLogger logger(std::move(console), base::AsyncLogger::OverflowPolicy::Drop, 100);
         base::SetGlobalLog(&logger);
         base::EnableLogEvent(base::LogEvent::Debug,   global_log_debug);
         base::EnableLogEvent(base::LogEvent::Info,    global_log_info);
@@ -650,7 +596,7 @@ int main(int argc, char* argv[])
         unsigned trace_enabled_counter = 0;
 
         std::unique_ptr<base::TraceWriter> trace_writer;
-        std::unique_ptr<base::TraceLog> trace_logger;
+        std::unique_ptr<base::Trace> trace_logger;
         if (opt.WasGiven("--trace-file"))
         {
             if (base::EndsWith(trace_file, ".json"))
@@ -658,12 +604,17 @@ int main(int argc, char* argv[])
                 using TraceWriter = base::LockedTraceWriter<base::ChromiumTraceJsonWriter>;
                 trace_writer.reset(new TraceWriter((base::ChromiumTraceJsonWriter(trace_file))));
             }
+            else if (base::EndsWith(trace_file, ".bin"))
+            {
+                // continuous streaming of every frame, --trace-jank has no effect.
+                trace_writer.reset(new base::BinaryTraceWriter(trace_file));
+            }
             else
             {
                 using TraceWriter = base::LockedTraceWriter<base::TextFileTraceWriter>;
                 trace_writer.reset(new TraceWriter((base::TextFileTraceWriter(trace_file))));
             }
-            trace_logger.reset(new base::TraceLog(1000, base::TraceLog::MainThread));
+            trace_logger = trace_writer->CreateThreadTrace(base::TraceLog::MainThread);
 
             if (opt.WasGiven("--trace-start"))
             {
@@ -694,12 +645,25 @@ int main(int argc, char* argv[])
         GameLibCreateLoaders   = (Gamestudio_CreateFileLoadersFunc)LoadFunction("Gamestudio_CreateFileLoaders");
         GameLibCreateRuntime = (Gamestudio_CreateRuntimeFunc) LoadFunction("Gamestudio_CreateRuntime");
 
+        // The metrics are written as JSON lines, i.e. each snapshot is a
+        // complete JSON object on its own line.
+        base::MetricsRegistry metrics;
+        std::ofstream metrics_stream;
+        if (!metrics_file.empty())
+        {
+            metrics_stream = base::OpenBinaryOutputStream(metrics_file);
+            if (!metrics_stream.is_open())
+                throw std::runtime_error("failed to open metrics file: " + metrics_file);
+            base::SetGlobalMetrics(&metrics);
+        }
+
         interop::Runtime runtime;
         GameLibCreateRuntime(&runtime.get_ref());
 
         // we've created the logger object, so pass it to the engine library
         // which has its own copies of the global state.
         runtime->SetGlobalLogger(&logger);
+        runtime->SetGlobalMetrics(base::GetGlobalMetrics());
         runtime->EnableLogEvent(base::LogEvent::Debug, global_log_debug);
         runtime->EnableLogEvent(base::LogEvent::Warning, global_log_warn);
         runtime->EnableLogEvent(base::LogEvent::Info, global_log_info);
@@ -827,6 +791,8 @@ int main(int argc, char* argv[])
             base::JsonReadSafe(engine_settings, "default_mag_filter", &config.default_mag_filter);
             base::JsonReadSafe(engine_settings, "updates_per_second", &config.updates_per_second);
             base::JsonReadSafe(engine_settings, "ticks_per_second", &config.ticks_per_second);
+            base::JsonReadSafe(engine_settings, "task_wait_spin_limit", &config.task_wait_spin_limit);
+            base::JsonReadSafe(engine_settings, "render_interpolation", &config.render_interpolation);
             DEBUG("time_step = 1.0/%1, tick_step = 1.0/%2", config.updates_per_second, config.ticks_per_second);
         }
         if (json.contains("mouse_cursor"))
@@ -969,6 +935,12 @@ int main(int argc, char* argv[])
         double iteration_time_sum = 0.0;
         double iteration_time_avg = 0.0;
 
+        auto* frame_time_histogram = base::GetGlobalHistogram("frame.time_us");
+        double metrics_seconds = 0.0;
+        const auto WriteMetrics = [&metrics, &metrics_stream](double wall_time) {
+            metrics_stream << R"({"wall_time":)" << wall_time << R"(,"metrics":)" << metrics.ToJson() << "}" << std::endl;
+        };
+
         ElapsedSeconds<TimeId::LoopTime>();
 
         while (engine->IsRunning() && !quit)
@@ -1085,6 +1057,18 @@ int main(int argc, char* argv[])
             iteration_index = (iteration_index + 1) % 10;
             iteration_counter++;
 
+            if (frame_time_histogram)
+            {
+                frame_time_histogram->Record(static_cast<std::uint64_t>(loop_time_now * 1000000.0));
+
+                metrics_seconds += loop_time_now;
+                if (metrics_seconds >= metrics_interval)
+                {
+                    WriteMetrics(wall_time);
+                    metrics_seconds = 0.0;
+                }
+            }
+
             // how should this work? take the median and standard deviation
             // and consider jank when it's some STD away from the median?
             // use an absolute value?
@@ -1158,9 +1142,20 @@ int main(int argc, char* argv[])
 
         window.Destroy();
 
+        if (metrics_stream.is_open())
+            WriteMetrics(CurrentRuntime());
+
         runtime->SetGlobalLogger(nullptr);
+        // the queued log records can refer to code in the game library
+        // so dispatch them while the library is still loaded.
+        logger.Flush();
+        const auto& log_stats = logger.GetStats();
+        if (log_stats.dropped)
+            WARN("Log messages were dropped. [dropped=%1, written=%2]", log_stats.dropped, log_stats.written);
+        runtime->SetGlobalMetrics(nullptr);
         runtime->SetGlobalTraceWriter(nullptr);
         runtime->SetThisThreadTracer(nullptr);
+        base::SetGlobalMetrics(nullptr);
         DEBUG("Exiting...");
     }
     catch (const std::exception& e)
@@ -20,6 +20,7 @@
 
 #include "base/logging.h"
 #include "base/math.h"
+#include "base/metrics.h"
 #include "graphics/transform.h"
 #include "graphics/painter.h"
 #include "graphics/drawable.h"
@@ -453,7 +454,10 @@ void PhysicsEngine::Step(std::vector<ContactEvent>* contacts)
     ContactListener listener(*this, contacts);
 
     mWorld->SetContactListener(contacts ? &listener : (b2ContactListener*)nullptr);
-    mWorld->Step(mTimestep, mNumVelocityIterations, mNumPositionIterations);
+    {
+        base::HistogramTimer timer(mStepTime);
+        mWorld->Step(mTimestep, mNumVelocityIterations, mNumPositionIterations);
+    }
     mWorld->SetContactListener(nullptr);
 }
 
@@ -619,6 +623,7 @@ void PhysicsEngine::CreateWorld(const Scene& scene)
     mNodes.clear();
     mWorld.reset();
     mWorld = std::make_unique<b2World>(gravity);
+    mStepTime = base::GetGlobalHistogram("physics.step_time_us");
 
     Transform transform;
     transform.Scale(glm::vec2(1.0f, 1.0f) / mScale);
@@ -644,6 +649,7 @@ void PhysicsEngine::CreateWorld(const Entity& entity)
     mNodes.clear();
     mWorld.reset();
     mWorld = std::make_unique<b2World>(gravity);
+    mStepTime = base::GetGlobalHistogram("physics.step_time_us");
 
     Transform transform;
     transform.Scale(glm::vec2(1.0f, 1.0f) / mScale);
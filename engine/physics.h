@@ -34,6 +34,10 @@
 
 class b2World;
 
+namespace base {
+    class Histogram;
+} // namespace
+
 namespace engine
 {
     class ClassLibrary;
@@ -312,6 +316,9 @@ namespace engine
         float mTimestep = 1.0/60.0f;
         unsigned mNumVelocityIterations = 8;
         unsigned mNumPositionIterations = 3;
+        // Histogram of the step times looked up from the global
+        // metrics registry when the world is created.
+        base::Histogram* mStepTime = nullptr;
     };
 
 } // namespace
@@ -160,12 +160,21 @@ void Renderer::UpdateRendererState(const game::Tilemap& map)
 
 void Renderer::CreateFrame(const game::Scene& scene, const game::Tilemap* map)
 {
+    // re-use the buffers of an earlier frame in order to avoid
+    // re-allocating the packet and light buffers on every frame.
     std::vector<DrawPacket> packets;
     std::vector<Light> lights;
+    std::swap(packets, mPacketScratch);
+    std::swap(lights, mLightScratch);
+    const auto packet_capacity = packets.capacity();
+    const auto light_capacity  = lights.capacity();
+
+    // nothing from the previous frame refers to the arena anymore.
+    mCreateFrameArena.Reset();
 
     if (map)
     {
-        std::vector<TileBatch> batches;
+        TileBatchList batches {TileBatchList::allocator_type(&mCreateFrameArena)};
 
         constexpr auto obey_klass_flags   = false;
         constexpr auto draw_render_layers = true;
@@ -225,9 +234,21 @@ void Renderer::CreateFrame(const game::Scene& scene, const game::Tilemap* map)
         TRACE_CALL("OffsetPacketLayers", OffsetPacketLayers(packets, lights));
     }
 
+    mCreateFrameScratchBytes = mCreateFrameArena.GetUsedBytes();
+    mCreateFrameBlockAllocs  = mCreateFrameArena.GetHeapAllocCount() +
+                               (packets.capacity() != packet_capacity ? 1 : 0) +
+                               (lights.capacity() != light_capacity ? 1 : 0);
+
     // this is the outcome that the draw function will then actually draw
     std::swap(mRenderBuffer, packets);
     std::swap(mLightBuffer, lights);
+
+    // clearing drops the references to the previous frame's drawables
+    // and materials but retains the capacity for the next frame.
+    packets.clear();
+    lights.clear();
+    std::swap(mPacketScratch, packets);
+    std::swap(mLightScratch, lights);
 }
 
 void Renderer::CreateFrame(const game::SceneClass& scene, const game::Tilemap* map, SceneClassDrawHook* scene_hook)
@@ -261,9 +282,11 @@ void Renderer::CreateFrame(const game::SceneClass& scene, const game::Tilemap* m
     std::vector<DrawPacket> packets;
     std::vector<Light> lights;
 
+    mCreateFrameArena.Reset();
+
     if (map)
     {
-        std::vector<TileBatch> batches;
+        TileBatchList batches {TileBatchList::allocator_type(&mCreateFrameArena)};
 
         constexpr auto obey_klass_flags   = false;
         constexpr auto draw_render_layers = true;
@@ -505,7 +528,9 @@ void Renderer::CreateFrame(const game::Tilemap& map, bool draw_render_layer, boo
     constexpr auto obey_klass_flags = true;
     constexpr auto use_tile_batching = false;
 
-    std::vector<TileBatch> batches;
+    mCreateFrameArena.Reset();
+
+    TileBatchList batches {TileBatchList::allocator_type(&mCreateFrameArena)};
     PrepareMapTileBatches(map, batches, draw_render_layer, draw_data_layer, obey_klass_flags, use_tile_batching);
 
     std::vector<DrawPacket> packets;
@@ -558,6 +583,8 @@ void Renderer::DrawFrame(gfx::Device& device) const
     if (mStyle == RenderingStyle::BasicShading)
         enable_lights = true;
 
+    mDrawMetrics.Refresh();
+
     LowLevelRenderer low_level_renderer(&mRendererName, device);
     low_level_renderer.SetCamera(mCamera);
     low_level_renderer.SetEditingMode(mEditingMode);
@@ -567,12 +594,26 @@ void Renderer::DrawFrame(gfx::Device& device) const
     low_level_renderer.SetBloom(mBloom);
     low_level_renderer.EnableBloom(enable_bloom);
     low_level_renderer.EnableLights(enable_lights);
+    low_level_renderer.SetFrameArena(&mDrawFrameArena);
+    low_level_renderer.SetMetrics(&mDrawMetrics);
     TRACE_CALL("DrawPackets", low_level_renderer.DrawPackets(mRenderBuffer, mLightBuffer));
     TRACE_CALL("BlitImage", low_level_renderer.BlitImage());
+
+    mDrawFrameScratchBytes = mDrawFrameArena.GetUsedBytes();
+    mDrawFrameBlockAllocs  = mDrawFrameArena.GetHeapAllocCount();
+    mDrawFrameArena.Reset();
+}
+
+Renderer::FrameStats Renderer::GetFrameStats() const noexcept
+{
+    FrameStats stats;
+    stats.scratch_bytes        = mCreateFrameScratchBytes + mDrawFrameScratchBytes;
+    stats.scratch_block_allocs = mCreateFrameBlockAllocs + mDrawFrameBlockAllocs;
+    return stats;
 }
 
 void Renderer::GenerateMapDrawPackets(const game::Tilemap& map,
-                                      const std::vector<TileBatch>& batches,
+                                      const TileBatchList& batches,
                                       std::vector<DrawPacket>& packets) const
 {
     const auto map_view = map.GetPerspective();
@@ -658,13 +699,7 @@ void Renderer::GenerateMapDrawPackets(const game::Tilemap& map,
     }
 }
 
-void Renderer::PrepareMapTileBatches(const game::Tilemap& map,
-                                     std::vector<TileBatch>& batches,
-                                     bool draw_render_layer,
-                                     bool draw_data_layer,
-                                     bool obey_klass_flags,
-                                     bool use_batching)
-
+FRect Renderer::ComputeMapViewRect(const game::Tilemap& map) const
 {
     // The logical game world is mapped inside the device viewport
     // through projection and clip transformations. thus it should
@@ -692,8 +727,20 @@ void Renderer::PrepareMapTileBatches(const game::Tilemap& map,
     const auto top    = corners[1].y; // top right
     const auto bottom = corners[2].y; // bottom left
     const auto right  = corners[3].x; // bottom right
-    const auto& top_left  = glm::vec2{left, top};
-    const auto& bot_right = glm::vec2{right, bottom};
+    return FRect(left, top, right - left, bottom - top);
+}
+
+void Renderer::PrepareMapTileBatches(const game::Tilemap& map,
+                                     TileBatchList& batches,
+                                     bool draw_render_layer,
+                                     bool draw_data_layer,
+                                     bool obey_klass_flags,
+                                     bool use_batching)
+
+{
+    const auto& view_rect = ComputeMapViewRect(map);
+    const auto& top_left  = glm::vec2{view_rect.GetMinX(), view_rect.GetMinY()};
+    const auto& bot_right = glm::vec2{view_rect.GetMaxX(), view_rect.GetMaxY()};
 
     for (unsigned layer_index=0; layer_index<map.GetNumLayers(); ++layer_index)
     {
@@ -1140,6 +1187,56 @@ void Renderer::UpdateLightResources(const EntityType& entity, const EntityNodeTy
     }
 }
 
+template<typename NodeType>
+void Renderer::SetNodeTransform(const game::FBox& box, bool first_update, NodeType& node)
+{
+    // keep the transform from the previous update around for interpolating
+    // between the two states. a node that was just created has no
+    // previous state so it starts out from where it is now.
+    if (first_update)
+    {
+        node.prev_world_pos      = box.GetTopLeft();
+        node.prev_world_scale    = box.GetSize();
+        node.prev_world_rotation = box.GetRotation();
+    }
+    else
+    {
+        node.prev_world_pos      = node.world_pos;
+        node.prev_world_scale    = node.world_scale;
+        node.prev_world_rotation = node.world_rotation;
+    }
+    node.world_pos      = box.GetTopLeft();
+    node.world_scale    = box.GetSize();
+    node.world_rotation = box.GetRotation();
+}
+
+template<typename NodeType>
+gfx::Transform Renderer::GetNodeTransform(const NodeType& node, float rotation_sign) const
+{
+    gfx::Transform transform;
+    if (mInterpolation >= 1.0f)
+    {
+        transform.Scale(node.world_scale);
+        transform.RotateAroundZ(node.world_rotation * rotation_sign);
+        transform.Translate(node.world_pos);
+        return transform;
+    }
+    const auto t = math::clamp(0.0f, 1.0f, mInterpolation);
+
+    // interpolate the rotation along the shorter arc so that a rotation
+    // wrapping around from +Pi to -Pi doesn't spin the node the long way.
+    auto delta = node.world_rotation - node.prev_world_rotation;
+    if (delta > math::Pi)
+        delta -= math::Circle;
+    else if (delta < -math::Pi)
+        delta += math::Circle;
+
+    transform.Scale(math::lerp(node.prev_world_scale, node.world_scale, t));
+    transform.RotateAroundZ((node.prev_world_rotation + delta * t) * rotation_sign);
+    transform.Translate(math::lerp(node.prev_world_pos, node.world_pos, t));
+    return transform;
+}
+
 template<typename EntityType, typename EntityNodeType>
 void Renderer::CreatePaintNodes(const EntityType& entity, gfx::Transform& transform, std::string prefix)
 {
@@ -1168,31 +1265,28 @@ void Renderer::CreatePaintNodes(const EntityType& entity, gfx::Transform& transf
 
             if (const auto* item = node->GetDrawable())
             {
-                auto& paint_node = mRenderer.mPaintNodes["drawable/" + mPrefix + node->GetId()];
-                paint_node.visited        = true;
-                paint_node.world_pos      = box.GetTopLeft();
-                paint_node.world_scale    = box.GetSize();
-                paint_node.world_rotation = box.GetRotation();
+                auto [it, inserted] = mRenderer.mPaintNodes.try_emplace("drawable/" + mPrefix + node->GetId());
+                auto& paint_node = it->second;
+                paint_node.visited = true;
+                SetNodeTransform(box, inserted, paint_node);
                 mRenderer.CreateDrawableResources<EntityType, EntityNodeType>(mEntity, *node, paint_node);
             }
 
             if (const auto* text = node->GetTextItem())
             {
-                auto& paint_node = mRenderer.mPaintNodes["text-item/" + mPrefix + node->GetId()];
-                paint_node.visited        = true;
-                paint_node.world_pos      = box.GetTopLeft();
-                paint_node.world_scale    = box.GetSize();
-                paint_node.world_rotation = box.GetRotation();
+                auto [it, inserted] = mRenderer.mPaintNodes.try_emplace("text-item/" + mPrefix + node->GetId());
+                auto& paint_node = it->second;
+                paint_node.visited = true;
+                SetNodeTransform(box, inserted, paint_node);
                 mRenderer.CreateTextResources<EntityType, EntityNodeType>(mEntity, *node, paint_node);
             }
 
             if (const auto* light = node->GetBasicLight())
             {
-                auto& light_node = mRenderer.mLightNodes["basic/" + mPrefix + node->GetId()];
-                light_node.visited        = true;
-                light_node.world_pos      = box.GetTopLeft();
-                light_node.world_scale    = box.GetSize();
-                light_node.world_rotation = box.GetRotation();
+                auto [it, inserted] = mRenderer.mLightNodes.try_emplace("basic/" + mPrefix + node->GetId());
+                auto& light_node = it->second;
+                light_node.visited = true;
+                SetNodeTransform(box, inserted, light_node);
                 mRenderer.CreateLightResources<EntityType, EntityNodeType>(mEntity, *node, light_node);
             }
         }
@@ -1399,10 +1493,7 @@ void Renderer::CreateDrawableDrawPackets(const EntityType& entity,
 
     const bool entity_visible = entity.TestFlag(EntityType::Flags::VisibleInGame);
 
-    gfx::Transform transform;
-    transform.Scale(paint_node.world_scale);
-    transform.RotateAroundZ(paint_node.world_rotation);
-    transform.Translate(paint_node.world_pos);
+    gfx::Transform transform = GetNodeTransform(paint_node);
 
     glm::vec2 sort_point = {0.5f, 1.0f};
     if (const auto* map = entity_node.GetMapNode())
@@ -1541,10 +1632,7 @@ void Renderer::CreateTextDrawPackets(const EntityType& entity,
 
     const bool entity_visible = entity.TestFlag(EntityType::Flags::VisibleInGame);
 
-    gfx::Transform transform;
-    transform.Scale(paint_node.world_scale);
-    transform.RotateAroundZ(paint_node.world_rotation);
-    transform.Translate(paint_node.world_pos);
+    gfx::Transform transform = GetNodeTransform(paint_node);
 
     glm::vec2 sort_point = {0.5f, 1.0f};
     if (const auto* map = entity_node.GetMapNode())
@@ -1610,10 +1698,7 @@ void Renderer::CreateLights(const EntityType& entity,
     if (!node_light || !node_light->IsEnabled() || !light_node.light)
         return;
 
-    gfx::Transform transform;
-    transform.Scale(light_node.world_scale);
-    transform.RotateAroundZ(light_node.world_rotation * -1.0);
-    transform.Translate(light_node.world_pos);
+    gfx::Transform transform = GetNodeTransform(light_node, -1.0f);
     transform.Push();
          transform.Translate(node_light->GetTranslation());
 
@@ -1677,7 +1762,7 @@ template<typename LayerType>
 void Renderer::PrepareRenderLayerTileBatches(const game::Tilemap& map,
                                              const game::TilemapLayer& layer,
                                              const game::URect& visible_region,
-                                             std::vector<TileBatch>& batches,
+                                             TileBatchList& batches,
                                              std::uint16_t layer_index,
                                              bool use_batching)
 
@@ -1713,7 +1798,7 @@ void Renderer::PrepareRenderLayerTileBatches(const game::Tilemap& map,
         {
             // the tiles index value is an index into the tile map
             // sprite palette.
-            const auto material_index = ptr->GetTile(row, col).index;
+            const auto material_index = ptr->GetResidentTile(row, col).index;
             // special index max means "no value". this is needed in order
             // to be able to have "holes" in some layer and let the layer
             // below show through. could have used zero but that would
@@ -1756,7 +1841,7 @@ template<typename LayerType>
 void Renderer::PrepareDataLayerTileBatches(const game::Tilemap& map,
                                            const game::TilemapLayer& layer,
                                            const game::URect& visible_region,
-                                           std::vector<TileBatch>& batches,
+                                           TileBatchList& batches,
                                            std::uint16_t layer_index,
                                            bool use_batching)
 {
@@ -1792,7 +1877,7 @@ void Renderer::PrepareDataLayerTileBatches(const game::Tilemap& map,
         {
             // the tiles index value is an index into the tile map
             // sprite palette.
-            const auto value = NormalizeTileDataValue(ptr->GetTile(row, col));
+            const auto value = NormalizeTileDataValue(ptr->GetResidentTile(row, col));
             const auto r = value;
             const auto g = value;
             const auto b = value;
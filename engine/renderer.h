@@ -28,8 +28,10 @@
 #include <vector>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
 
 #include "base/bitflag.h"
+#include "base/memory.h"
 #include "graphics/fwd.h"
 #include "graphics/drawable.h"
 #include "graphics/tilebatch.h"
@@ -146,6 +148,12 @@ namespace engine
         { mStyle = style; }
         inline void SetTileSizeFudge(float fudge) noexcept
         { mTileSizeFudge = fudge; }
+        // Set the interpolation factor for blending the node transforms
+        // between the previous and the current renderer state update when
+        // creating the draw packets. 0.0 draws the nodes where they were
+        // on the previous update and 1.0 (the default) where they are now.
+        inline void SetInterpolation(float alpha) noexcept
+        { mInterpolation = alpha; }
 
         void BeginFrame();
 
@@ -191,6 +199,10 @@ namespace engine
         void CreateFrame(const game::Tilemap& map, bool draw_render_layer, bool draw_data_layer,
                          TileBatchDrawHook* hook = nullptr);
 
+        // Compute the region of the map that is visible through the
+        // current camera. The region is in map units on the tile plane.
+        FRect ComputeMapViewRect(const game::Tilemap& map) const;
+
         // Draw the current frame rendering state, i.e. the currently
         // enqueued and created draw commands.
         void DrawFrame(gfx::Device& painter) const;
@@ -199,6 +211,20 @@ namespace engine
 
         void ClearPaintState();
 
+        // Statistics about the per frame scratch data.
+        struct FrameStats {
+            // Number of bytes of scratch memory used by the last
+            // CreateFrame and DrawFrame.
+            std::size_t scratch_bytes = 0;
+            // Number of scratch memory blocks allocated by the last
+            // CreateFrame and DrawFrame. This counts the arena blocks and
+            // any growth of the re-used packet buffers. Heap allocations
+            // outside of the scratch memory, such as the GPU resource ID
+            // strings that the painter looks up per draw, are not counted.
+            std::size_t scratch_block_allocs = 0;
+        };
+        FrameStats GetFrameStats() const noexcept;
+
         size_t GetNumPaintNodes() const
         { return mPaintNodes.size(); }
     private:
@@ -219,6 +245,8 @@ namespace engine
             glm::vec3 tile_size = {0.0f, 0.0f, 0.0f};
             glm::vec2 render_size = {0.0f, 0.0f};
         };
+        // the tile batches are per frame scratch data allocated from the frame arena.
+        using TileBatchList = mem::ArenaVector<TileBatch>;
 
         template<typename EntityType, typename NodeType>
         void CreatePaintNodes(const EntityType& entity, gfx::Transform& transform, std::string prefix = "");
@@ -236,6 +264,11 @@ namespace engine
         void UpdateLightResources(const EntityType& entity, const EntityNodeType& entity_node, LightNode& light_node,
                                   double time, float dt) const;
 
+        template<typename NodeType>
+        static void SetNodeTransform(const game::FBox& box, bool first_update, NodeType& node);
+        template<typename NodeType>
+        gfx::Transform GetNodeTransform(const NodeType& node, float rotation_sign = 1.0f) const;
+
         template<typename EntityType, typename EntityNodeType>
         void CreateDrawableResources(const EntityType& entity, const EntityNodeType& entity_node, PaintNode& paint_node) const;
         template<typename EntityType, typename EntityNodeType>
@@ -265,11 +298,11 @@ namespace engine
         void OffsetPacketLayers(std::vector<DrawPacket>& packets, std::vector<Light>& lights) const;
 
         void GenerateMapDrawPackets(const game::Tilemap& map,
-                                    const std::vector<TileBatch>& batches,
+                                    const TileBatchList& batches,
                                     std::vector<DrawPacket>& packets) const;
 
         void PrepareMapTileBatches(const game::Tilemap& map,
-                                   std::vector<TileBatch>& batches,
+                                   TileBatchList& batches,
                                    bool draw_render_layer,
                                    bool draw_data_layer,
                                    bool obey_klass_flags,
@@ -278,14 +311,14 @@ namespace engine
         void PrepareDataLayerTileBatches(const game::Tilemap& map,
                                          const game::TilemapLayer& layer,
                                          const game::URect& visible_region,
-                                         std::vector<TileBatch>& batches,
+                                         TileBatchList& batches,
                                          std::uint16_t layer_index,
                                          bool use_batching);
         template<typename LayerType>
         void PrepareRenderLayerTileBatches(const game::Tilemap& map,
                                            const game::TilemapLayer& layer,
                                            const game::URect& visible_region,
-                                           std::vector<TileBatch>& batches,
+                                           TileBatchList& batches,
                                            std::uint16_t layer_index,
                                            bool use_batching);
 
@@ -315,6 +348,10 @@ namespace engine
             glm::vec2 world_scale;
             glm::vec2 world_pos;
             float world_rotation = 0.0f;
+            // the world transform on the previous state update.
+            glm::vec2 prev_world_scale;
+            glm::vec2 prev_world_pos;
+            float prev_world_rotation = 0.0f;
         };
 
         struct LightNode {
@@ -323,6 +360,10 @@ namespace engine
             glm::vec2 world_scale;
             glm::vec2 world_pos;
             float world_rotation = 0.0f;
+            // the world transform on the previous state update.
+            glm::vec2 prev_world_scale;
+            glm::vec2 prev_world_pos;
+            float prev_world_rotation = 0.0f;
         };
 
         std::unordered_map<std::string, PaintNode> mPaintNodes;
@@ -349,12 +390,30 @@ namespace engine
         // the size they're supposed to be it's possible that some gaps
         // appear between them.
         float mTileSizeFudge = 0.5f;
+        // interpolation factor between the previous and current
+        // node transforms when creating draw packets.
+        float mInterpolation = 1.0f;
 
         PacketFilter* mPacketFilter = nullptr;
         LowLevelRendererHook* mLowLevelRendererHook = nullptr;
 
         mutable std::vector<DrawPacket> mRenderBuffer;
         mutable std::vector<Light> mLightBuffer;
+        // the buffers of the previous frame kept around for re-use.
+        std::vector<DrawPacket> mPacketScratch;
+        std::vector<Light> mLightScratch;
+
+        // Per frame scratch memory. CreateFrame and DrawFrame each have
+        // their own arena so that the update thread creating the next frame
+        // and the render thread drawing the current frame never share one.
+        mem::FrameArena mCreateFrameArena;
+        mutable mem::FrameArena mDrawFrameArena;
+        std::atomic<std::size_t> mCreateFrameScratchBytes = {0};
+        std::atomic<std::size_t> mCreateFrameBlockAllocs = {0};
+        mutable std::atomic<std::size_t> mDrawFrameScratchBytes = {0};
+        mutable std::atomic<std::size_t> mDrawFrameBlockAllocs = {0};
+        // the metric objects updated by the low level renderer.
+        mutable LowLevelRenderer::Metrics mDrawMetrics;
 
     };
 
@@ -2404,7 +2404,7 @@ function UpdateNodes1(nodes, game_time, dt, class)
     for i = 0, hi do
         local transform = nodes:GetTransform(i)
         if transform ~= nil then
-            transform.translation.y = transform.translation.y + dt * 5.0
+            transform:Translate(0.0, dt * 5.0)
         end
     end
 end
@@ -2413,7 +2413,7 @@ end
 function UpdateNodes2(nodes, game_time, dt)
    for i=1, #nodes do
       local transform = nodes[i]
-      transform.translation.y = transform.translation.y + dt * 5.0
+      transform:Translate(0.0, dt * 5.0)
    end
 end
 
@@ -2422,7 +2422,7 @@ function UpdateNodes3(nodes, game_time, dt)
     local transforms = nodes:GetTransforms()
     for i=1, #transforms do
         local transform = transforms[i]
-        transform.translation.y = transform.translation.y + dt * 5.0
+        transform:Translate(0.0, dt * 5.0)
     end
 end
         )");
@@ -2480,7 +2480,7 @@ end
                 {
                     auto* transform = allocator->template GetObject<game::EntityNodeTransform>(i);
                     if (transform) {
-                        transform->translation.y = transform->translation.y + 1.0 * 2.0;
+                        transform->Translate(0.0f, 1.0f * 2.0f);
                     }
                 }
             });
@@ -895,6 +895,84 @@ void unit_test_transform_precision()
     }
 }
 
+// test interpolating the node transforms between renderer state updates.
+void unit_test_transform_interpolation()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto klass = std::make_shared<game::EntityClass>();
+    {
+        game::DrawableItemClass drawable;
+        drawable.SetMaterialId("red");
+        drawable.SetDrawableId("rect");
+        drawable.SetLayer(0);
+
+        game::EntityNodeClass node;
+        node.SetName("node");
+        node.SetSize(glm::vec2(100.0f, 100.0f));
+        node.SetTranslation(glm::vec2(100.0f, 100.0f));
+        node.SetDrawable(drawable);
+        klass->LinkChild(nullptr, klass->AddNode(std::move(node)));
+    }
+    auto entity = game::CreateEntityInstance(klass);
+    auto* node = entity->FindNodeByClassName("node");
+
+    class Hook : public engine::EntityInstanceDrawHook {
+    public:
+        virtual bool InspectPacket(const game::EntityNode* node, engine::DrawPacket& packet) override
+        {
+            mPackets.push_back(packet);
+            return true;
+        }
+        glm::mat4 GetTransform() const
+        {
+            TEST_REQUIRE(mPackets.size() == 1);
+            return mPackets[0].transform;
+        }
+    private:
+        std::vector<engine::DrawPacket> mPackets;
+    };
+
+    DummyClassLib classlib;
+    engine::Renderer renderer(&classlib);
+
+    const auto& CreateFrame = [&renderer, &entity](float alpha) {
+        Hook hook;
+        renderer.SetInterpolation(alpha);
+        renderer.BeginFrame();
+        renderer.CreateFrame(*entity, &hook);
+        renderer.EndFrame();
+        return hook.GetTransform();
+    };
+    const auto& GetPosition = [&CreateFrame](float alpha) {
+        return game::ComputeBoundingRect(CreateFrame(alpha)).GetPosition();
+    };
+    const auto& GetRotation = [&CreateFrame](float alpha) {
+        const auto& mat = CreateFrame(alpha);
+        return std::atan2(mat[0][1], mat[0][0]);
+    };
+
+    // a new node has no previous state to interpolate from.
+    renderer.UpdateRendererState(*entity);
+    TEST_REQUIRE(GetPosition(0.0f) == game::FPoint(50.0f, 50.0f));
+    TEST_REQUIRE(GetPosition(1.0f) == game::FPoint(50.0f, 50.0f));
+
+    node->SetTranslation(glm::vec2(300.0f, 100.0f));
+    renderer.UpdateRendererState(*entity);
+    TEST_REQUIRE(GetPosition(0.0f) == game::FPoint(50.0f, 50.0f));
+    TEST_REQUIRE(GetPosition(0.5f) == game::FPoint(150.0f, 50.0f));
+    TEST_REQUIRE(GetPosition(1.0f) == game::FPoint(250.0f, 50.0f));
+
+    // rotation wraps around along the shorter arc.
+    node->SetRotation(3.0f);
+    renderer.UpdateRendererState(*entity);
+    node->SetRotation(-3.0f);
+    renderer.UpdateRendererState(*entity);
+    TEST_REQUIRE(std::abs(GetRotation(0.0f) - 3.0f) < 0.001f);
+    TEST_REQUIRE(std::abs(GetRotation(1.0f) + 3.0f) < 0.001f);
+    TEST_REQUIRE(std::abs(GetRotation(0.5f)) > 3.1f);
+}
+
 void unit_test_axis_aligned_map()
 {
     TEST_CASE(test::Type::Feature)
@@ -1294,6 +1372,7 @@ int test_main(int argc, char* argv[])
     unit_test_scene_layering();
     unit_test_entity_lifecycle();
     unit_test_transform_precision();
+    unit_test_transform_interpolation();
 
     unit_test_axis_aligned_map();
 
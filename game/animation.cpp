@@ -29,6 +29,47 @@
 #include "game/property_animator.h"
 #include "game/entity.h"
 
+namespace {
+using TransformCurve = game::AnimationCurves::TransformCurve;
+
+// Evaluate a baked transform curve at the normalized animation
+// position. Does the same as the TransformAnimator would do
+// through its Start, Apply and Finish methods.
+template<typename State>
+void ApplyCurve(const TransformCurve& curve, State& state, game::EntityNode& node, float pos)
+{
+    if (pos < curve.start)
+        return;
+    else if (pos >= curve.end)
+    {
+        if (!state.ended)
+        {
+            node.SetTranslation(curve.end_position);
+            node.SetRotation(curve.end_rotation);
+            node.SetSize(curve.end_size);
+            node.SetScale(curve.end_scale);
+            state.ended = true;
+        }
+        return;
+    }
+    if (!state.started)
+    {
+        state.start_position = node.GetTranslation();
+        state.start_size     = node.GetSize();
+        state.start_scale    = node.GetScale();
+        state.start_rotation = node.GetRotation();
+        state.started = true;
+    }
+    const auto t = math::clamp(0.0f, 1.0f, (pos - curve.start) / curve.duration);
+    const auto method = curve.method;
+    node.SetTranslation(math::interpolate(state.start_position, curve.end_position, t, method));
+    node.SetSize(math::interpolate(state.start_size, curve.end_size, t, method));
+    node.SetRotation(math::interpolate(state.start_rotation, curve.end_rotation, t, method));
+    node.SetScale(math::interpolate(state.start_scale, curve.end_scale, t, method));
+}
+
+} // namespace
+
 namespace game
 {
 
@@ -57,6 +98,7 @@ AnimationClass::AnimationClass(AnimationClass&& other) noexcept
     mDuration  = other.mDuration;
     mLooping   = other.mLooping;
     mDelay     = other.mDelay;
+    mAnimatorsShared = other.mAnimatorsShared;
 }
 
 void AnimationClass::DeleteAnimator(std::size_t index) noexcept
@@ -65,6 +107,7 @@ void AnimationClass::DeleteAnimator(std::size_t index) noexcept
     auto it = mAnimators.begin();
     std::advance(it, index);
     mAnimators.erase(it);
+    ++mRevision;
 }
 
 bool AnimationClass::DeleteAnimatorById(const std::string& id) noexcept
@@ -73,6 +116,7 @@ bool AnimationClass::DeleteAnimatorById(const std::string& id) noexcept
     {
         if ((*it)->GetId() == id) {
             mAnimators.erase(it);
+            ++mRevision;
             return true;
         }
     }
@@ -81,8 +125,10 @@ bool AnimationClass::DeleteAnimatorById(const std::string& id) noexcept
 AnimatorClass* AnimationClass::FindAnimatorById(const std::string& id) noexcept
 {
     for (auto& animator : mAnimators) {
-        if (animator->GetId() == id)
+        if (animator->GetId() == id) {
+            mAnimatorsShared = true;
             return animator.get();
+        }
     }
     return nullptr;
 }
@@ -112,6 +158,27 @@ std::unique_ptr<Animator> AnimationClass::CreateAnimatorInstance(std::size_t ind
     return {};
 }
 
+std::shared_ptr<const AnimationCurves> AnimationClass::GetCurves() const
+{
+    // the class is mutable (for example in the editor) so the
+    // curves are re-baked whenever the class state has changed.
+    std::lock_guard<std::mutex> lock(mCurveMutex);
+    const bool same_revision = mCurvesBaked && mCurveRevision == mRevision;
+    if (same_revision && !mAnimatorsShared)
+        return mCurves;
+
+    const auto hash = GetHash();
+    if (same_revision && mCurveHash == hash)
+        return mCurves;
+
+    auto curves = std::make_shared<AnimationCurves>(*this);
+    mCurves        = curves->IsValid() ? std::move(curves) : nullptr;
+    mCurveHash     = hash;
+    mCurveRevision = mRevision;
+    mCurvesBaked   = true;
+    return mCurves;
+}
+
 std::size_t AnimationClass::GetHash() const noexcept
 {
     std::size_t hash = 0;
@@ -145,6 +212,8 @@ void AnimationClass::IntoJson(data::Writer& data) const
 
 bool AnimationClass::FromJson(const data::Reader& data)
 {
+    ++mRevision;
+
     bool ok = true;
     ok &= data.Read("id",       &mId);
     ok &= data.Read("name",     &mName);
@@ -211,21 +280,67 @@ AnimationClass& AnimationClass::operator=(const AnimationClass& other)
     std::swap(mDuration, copy.mDuration);
     std::swap(mLooping, copy.mLooping);
     std::swap(mDelay, copy.mDelay);
+    // the animators are new copies that nobody else refers to.
+    mAnimatorsShared = false;
+    ++mRevision;
     return *this;
 }
 
+AnimationCurves::AnimationCurves(const AnimationClass& klass)
+{
+    // a dynamic transform animator instance can have its end state
+    // changed at runtime and would also need to keep its relative
+    // order with the baked curves. don't bake such a class at all.
+    for (size_t i=0; i<klass.GetNumAnimators(); ++i)
+    {
+        const auto& animator = klass.GetAnimatorClass(i);
+        if (animator.GetType() != AnimatorClass::Type::TransformAnimator)
+            continue;
+        if (!animator.TestFlag(AnimatorClass::Flags::StaticInstance))
+            return;
+    }
+
+    for (size_t i=0; i<klass.GetNumAnimators(); ++i)
+    {
+        const auto* transform = AsTransformAnimatorClass(&klass.GetAnimatorClass(i));
+        if (transform == nullptr)
+        {
+            mAnimatorCurves.push_back(NoCurve);
+            continue;
+        }
+        TransformCurve curve;
+        curve.node         = transform->GetNodeId();
+        curve.start        = transform->GetStartTime();
+        curve.duration     = transform->GetDuration();
+        curve.end          = math::clamp(0.0f, 1.0f, curve.start + curve.duration);
+        curve.method       = transform->GetInterpolation();
+        curve.end_position = transform->GetEndPosition();
+        curve.end_size     = transform->GetEndSize();
+        curve.end_scale    = transform->GetEndScale();
+        curve.end_rotation = transform->GetEndRotation();
+        mAnimatorCurves.push_back(mCurves.size());
+        mCurves.push_back(std::move(curve));
+    }
+    mValid = !mCurves.empty();
+}
+
 Animation::Animation(const std::shared_ptr<const AnimationClass>& klass)
     : mClass(klass)
 {
+    mCurves = mClass->GetCurves();
+
     for (size_t i=0; i< mClass->GetNumAnimators(); ++i)
     {
         AnimatorState track;
         track.animator = mClass->CreateAnimatorInstance(i);
         track.node     = track.animator->GetNodeId();
+        track.baked    = mCurves && mCurves->FindCurve(i) != AnimationCurves::NoCurve;
         track.ended    = false;
         track.started  = false;
         mTracks.push_back(std::move(track));
     }
+    if (mCurves)
+        mCurveStates.resize(mCurves->GetNumCurves());
     mDelay = klass->GetDelay();
     // start at negative delay time, then the actual animation playback
     // starts after the current time reaches 0 and all delay has been "consumed".
@@ -242,20 +357,27 @@ Animation::Animation(const Animation& other) : mClass(other.mClass)
         AnimatorState track;
         track.node     = other.mTracks[i].node;
         track.animator = other.mTracks[i].animator->Copy();
+        track.baked    = other.mTracks[i].baked;
         track.ended    = other.mTracks[i].ended;
         track.started  = other.mTracks[i].started;
         mTracks.push_back(std::move(track));
     }
-    mCurrentTime = other.mCurrentTime;
-    mDelay       = other.mDelay;
+    mCurves       = other.mCurves;
+    mCurveStates  = other.mCurveStates;
+    mCurveBinding = other.mCurveBinding;
+    mCurrentTime  = other.mCurrentTime;
+    mDelay        = other.mDelay;
 }
     // Move ctor.
 Animation::Animation(Animation&& other) noexcept
 {
-    mClass       = other.mClass;
-    mCurrentTime = other.mCurrentTime;
-    mDelay       = other.mDelay;
-    mTracks      = std::move(other.mTracks);
+    mClass        = other.mClass;
+    mCurrentTime  = other.mCurrentTime;
+    mDelay        = other.mDelay;
+    mTracks       = std::move(other.mTracks);
+    mCurves       = std::move(other.mCurves);
+    mCurveStates  = std::move(other.mCurveStates);
+    mCurveBinding = other.mCurveBinding;
 }
 
 void Animation::Update(float dt) noexcept
@@ -273,11 +395,22 @@ void Animation::Apply(EntityNode& node) const
     const auto duration = mClass->GetDuration();
     const auto pos = mCurrentTime / duration;
 
+    // the baked curves only modify the node transform and the
+    // animators only modify other node state so the curves can
+    // be applied separately from the animators.
+    for (size_t i=0; i<mCurveStates.size(); ++i)
+    {
+        const auto& curve = mCurves->GetCurve(i);
+        if (curve.node != node.GetClassId())
+            continue;
+        ApplyCurve(curve, mCurveStates[i], node, pos);
+    }
+
     // todo: keep the tracks in some smarter data structure or perhaps
     // in a sorted vector and then binary search.
     for (auto& track : mTracks)
     {
-        if (track.node != node.GetClassId())
+        if (track.baked || track.node != node.GetClassId())
             continue;
 
         const auto start = track.animator->GetStartTime();
@@ -304,15 +437,107 @@ void Animation::Apply(EntityNode& node) const
     }
 }
 
+void Animation::Apply(Entity& entity) const
+{
+    if (mCurrentTime < 0)
+        return;
+    const auto pos = GetCurvePosition();
+
+    BindCurves(entity);
+    for (size_t i=0; i<mCurveStates.size(); ++i)
+    {
+        auto& state = mCurveStates[i];
+        if (!state.bound)
+            continue;
+        ApplyCurve(mCurves->GetCurve(i), state, entity.GetNode(state.node), pos);
+    }
+    ApplyAnimators(entity);
+}
+
+void Animation::ApplyAnimators(Entity& entity) const
+{
+    if (mCurrentTime < 0)
+        return;
+    if (mTracks.size() == mCurveStates.size())
+        return;
+    const auto duration = mClass->GetDuration();
+    const auto pos = mCurrentTime / duration;
+
+    for (size_t i=0; i<entity.GetNumNodes(); ++i)
+    {
+        auto& node = entity.GetNode(i);
+        for (auto& track : mTracks)
+        {
+            if (track.baked || track.node != node.GetClassId())
+                continue;
+            const auto start = track.animator->GetStartTime();
+            const auto len   = track.animator->GetDuration();
+            const auto end   = math::clamp(0.0f, 1.0f, start + len);
+            if (pos < start)
+                continue;
+            else if (pos >= end)
+            {
+                if (!track.ended)
+                {
+                    track.animator->Finish(node);
+                    track.ended = true;
+                }
+                continue;
+            }
+            if (!track.started)
+            {
+                track.animator->Start(node);
+                track.started = true;
+            }
+            const auto t = math::clamp(0.0f, 1.0f, (pos - start) / len);
+            track.animator->Apply(node, t);
+        }
+    }
+}
+
+void Animation::BindCurves(const Entity& entity) const
+{
+    // the entity nodes are created in the same order as the nodes
+    // are in the entity class so the binding can be shared by all
+    // the entities of the same class.
+    const auto* klass = &entity.GetClass();
+    if (mCurveBinding == klass)
+        return;
+
+    for (size_t i=0; i<mCurveStates.size(); ++i)
+    {
+        auto& state = mCurveStates[i];
+        state.bound = false;
+        for (size_t j=0; j<entity.GetNumNodes(); ++j)
+        {
+            if (entity.GetNode(j).GetClassId() != mCurves->GetCurve(i).node)
+                continue;
+            state.node  = static_cast<std::uint32_t>(j);
+            state.bound = true;
+            break;
+        }
+    }
+    mCurveBinding = klass;
+}
+
 void Animation::Restart() noexcept
 {
     for (auto& track : mTracks)
     {
+        if (track.baked)
+            continue;
         ASSERT(track.started);
         ASSERT(track.ended);
         track.started = false;
         track.ended   = false;
     }
+    for (auto& state : mCurveStates)
+    {
+        ASSERT(state.started);
+        ASSERT(state.ended);
+        state.started = false;
+        state.ended   = false;
+    }
     mCurrentTime = -mDelay;
 }
 
@@ -320,7 +545,12 @@ bool Animation::IsComplete() const noexcept
 {
     for (const auto& track : mTracks)
     {
-        if (!track.ended)
+        if (!track.baked && !track.ended)
+            return false;
+    }
+    for (const auto& state : mCurveStates)
+    {
+        if (!state.ended)
             return false;
     }
     if (mCurrentTime >= mClass->GetDuration())
@@ -366,6 +596,72 @@ const Animator* Animation::FindAnimatorByName(const std::string& name) const noe
     return nullptr;
 }
 
+void AnimationBatch::Add(const Animation* animation, Entity* entity)
+{
+    ASSERT(animation->HasCurves());
+    const auto* curves = animation->mCurves.get();
+
+    auto it = mGroupIndex.find(curves);
+    if (it == mGroupIndex.end())
+    {
+        it = mGroupIndex.insert({curves, mGroups.size()}).first;
+        mGroups.emplace_back();
+    }
+    auto& group = mGroups[it->second];
+    group.curves = curves;
+    group.animations.push_back(animation);
+    group.entities.push_back(entity);
+    ++mSize;
+}
+
+void AnimationBatch::Apply()
+{
+    for (auto& group : mGroups)
+    {
+        const auto count = group.animations.size();
+        if (count == 0)
+            continue;
+
+        group.positions.resize(count);
+        for (size_t i=0; i<count; ++i)
+        {
+            const auto* animation = group.animations[i];
+            animation->BindCurves(*group.entities[i]);
+            // negative position means the animation is still delaying.
+            group.positions[i] = animation->mCurrentTime < 0.0f
+                                 ? -1.0f : animation->GetCurvePosition();
+        }
+
+        const auto* curves = group.curves;
+        for (size_t c=0; c<curves->GetNumCurves(); ++c)
+        {
+            const auto& curve = curves->GetCurve(c);
+            for (size_t i=0; i<count; ++i)
+            {
+                const auto pos = group.positions[i];
+                if (pos < 0.0f)
+                    continue;
+                auto& state = group.animations[i]->mCurveStates[c];
+                if (!state.bound)
+                    continue;
+                ApplyCurve(curve, state, group.entities[i]->GetNode(state.node), pos);
+            }
+        }
+    }
+}
+
+void AnimationBatch::Clear() noexcept
+{
+    // keep the groups around in order to reuse the allocations
+    // since the same animations are likely to be batched again.
+    for (auto& group : mGroups)
+    {
+        group.animations.clear();
+        group.entities.clear();
+    }
+    mSize = 0;
+}
+
 std::unique_ptr<Animation> CreateAnimationInstance(const std::shared_ptr<const AnimationClass>& klass)
 {
     return std::make_unique<Animation>(klass);
@@ -24,9 +24,13 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
 #include <unordered_map>
 
 #include "base/utility.h"
+#include "base/math.h"
 #include "data/fwd.h"
 
 #include "base/snafu.h"
@@ -35,6 +39,9 @@ namespace game
 {
     class Animator;
     class AnimatorClass;
+    class AnimationCurves;
+    class Entity;
+    class EntityClass;
     class EntityNode;
 
     // AnimationClass defines a new type of animation that includes the
@@ -53,10 +60,10 @@ namespace game
         { mName = name; }
         // Set the animation duration in seconds.
         inline void SetDuration(float duration) noexcept
-        { mDuration = duration; }
+        { mDuration = duration; ++mRevision; }
         // Set animation delay in seconds.
         inline void SetDelay(float delay) noexcept
-        { mDelay = delay; }
+        { mDelay = delay; ++mRevision; }
         // Enable/disable looping flag. A looping animation will never end
         // and will reset after the reaching the end. I.e. all the animators
         // involved will have their states reset to the initial state which
@@ -65,7 +72,7 @@ namespace game
         // that the animation nodes back to their initial state before the end
         // of the animation track.
         inline void SetLooping(bool looping) noexcept
-        { mLooping = looping; }
+        { mLooping = looping; ++mRevision; }
         // Get the human-readable name of the animation track.
         inline const std::string& GetName() const noexcept
         { return mName; }
@@ -88,10 +95,16 @@ namespace game
         {
             std::shared_ptr<AnimatorClass> foo(new Animator(animator));
             mAnimators.push_back(std::move(foo));
+            ++mRevision;
         }
         // Add a new animator that applies state update/action on some animation node.
+        // The caller can keep on changing the animator through the shared pointer.
         void AddAnimator(std::shared_ptr<AnimatorClass> animator)
-        { mAnimators.push_back(std::move(animator)); }
+        {
+            mAnimators.push_back(std::move(animator));
+            mAnimatorsShared = true;
+            ++mRevision;
+        }
 
         // Delete the animator at the given index.
         void DeleteAnimator(std::size_t index) noexcept;
@@ -104,13 +117,16 @@ namespace game
         const AnimatorClass* FindAnimatorById(const std::string& id) const noexcept;
         // Clear (and delete) all animator previously added to the animation.
         inline void Clear() noexcept
-        { mAnimators.clear(); }
+        { mAnimators.clear(); ++mRevision; }
         // Get the number of animators currently added to this animation track.
         inline std::size_t GetNumAnimators() const noexcept
         { return mAnimators.size(); }
         // Get the animator class object at the given index.
         inline AnimatorClass& GetAnimatorClass(std::size_t index) noexcept
-        { return *mAnimators[index]; }
+        {
+            mAnimatorsShared = true;
+            return *mAnimators[index];
+        }
         // Get the animator class object at the given index.
         inline const AnimatorClass& GetAnimatorClass(std::size_t index) const noexcept
         { return *mAnimators[index]; }
@@ -119,6 +135,14 @@ namespace game
         // TransformAnimatorClass then the returned object will be an
         // instance of TransformAnimator.
         std::unique_ptr<Animator> CreateAnimatorInstance(std::size_t index) const;
+        // Get the baked curves of the animation. The curves are baked
+        // on the first call and then shared by all the callers until
+        // the animation class changes. Returns nullptr if the animation
+        // can't be baked. Safe to call concurrently.
+        // The class state is only hashed to detect changes after mutable
+        // animator objects have been handed out, otherwise the class
+        // revision is enough.
+        std::shared_ptr<const AnimationCurves> GetCurves() const;
         // Get the hash value based on the static data.
         std::size_t GetHash() const noexcept;
         // Serialize the animation into JSON.
@@ -143,6 +167,68 @@ namespace game
         float mDuration = 1.0f;
         // Loop animation or not. If looping then never completes.
         bool mLooping = false;
+        // Incremented on every change made through the class API.
+        std::uint64_t mRevision = 0;
+        // True when the animators can have been changed outside of the
+        // class API, i.e. a mutable animator has been handed out.
+        bool mAnimatorsShared = false;
+        // The baked curves (if any) and the revision and the hash of
+        // the class state they were baked from. The curves are nullptr
+        // when the class can't be baked.
+        mutable std::mutex mCurveMutex;
+        mutable std::shared_ptr<const AnimationCurves> mCurves;
+        mutable std::size_t mCurveHash = 0;
+        mutable std::uint64_t mCurveRevision = 0;
+        mutable bool mCurvesBaked = false;
+    };
+
+    // AnimationCurves is the baked form of an AnimationClass. Each
+    // transform animator of the class is compiled into a flat curve
+    // that interpolates the node's transform from the state at the
+    // start of the curve to the animator's end state. The curves are
+    // evaluated directly without going through the Animator interface.
+    // Only animators with a static instance are baked. Other animator
+    // types don't touch the node transform and are always evaluated
+    // through the Animator interface. A class with a dynamic transform
+    // animator instance isn't baked at all.
+    class AnimationCurves
+    {
+    public:
+        static constexpr std::size_t NoCurve = ~std::size_t(0);
+
+        struct TransformCurve {
+            // ID of the node the curve applies to.
+            std::string node;
+            // Normalized start time, duration and end time.
+            float start    = 0.0f;
+            float duration = 0.0f;
+            float end      = 0.0f;
+            math::Interpolation method = math::Interpolation::Linear;
+            glm::vec2 end_position = {0.0f, 0.0f};
+            glm::vec2 end_size     = {1.0f, 1.0f};
+            glm::vec2 end_scale    = {1.0f, 1.0f};
+            float end_rotation = 0.0f;
+        };
+        // Bake the curves of the given animation class.
+        explicit AnimationCurves(const AnimationClass& klass);
+
+        // Returns true if the animation class could be baked.
+        inline bool IsValid() const noexcept
+        { return mValid; }
+        inline std::size_t GetNumCurves() const noexcept
+        { return mCurves.size(); }
+        inline const TransformCurve& GetCurve(std::size_t index) const noexcept
+        { return mCurves[index]; }
+        // Find the curve that the animator at the given index in the
+        // animation class was baked into. Returns NoCurve if the animator
+        // is not baked.
+        inline std::size_t FindCurve(std::size_t animator) const noexcept
+        { return mValid ? mAnimatorCurves[animator] : NoCurve; }
+    private:
+        std::vector<TransformCurve> mCurves;
+        // Animator index to curve index mapping.
+        std::vector<std::size_t> mAnimatorCurves;
+        bool mValid = false;
     };
 
 
@@ -168,6 +254,14 @@ namespace game
         // Apply animation actions, such as transformations or material changes
         // onto the given entity node.
         void Apply(EntityNode& node) const;
+        // Apply animation actions onto the nodes of the given entity. This is
+        // the same as applying the animation on each node of the entity but
+        // the baked curves are bound to the entity nodes only once.
+        void Apply(Entity& entity) const;
+        // Apply only the animation actions that aren't baked into curves onto
+        // the nodes of the given entity. The curves are then expected to be
+        // applied through an AnimationBatch.
+        void ApplyAnimators(Entity& entity) const;
         // Prepare the animation track to restart.
         void Restart() noexcept;
         // Returns true if the animation is complete, i.e. all the
@@ -216,6 +310,14 @@ namespace game
         // Shortcut operator for accessing the members of the track's class object.
         inline const AnimationClass* operator->() const noexcept
         { return mClass.get(); }
+        // Returns true if the animation has baked curves.
+        inline bool HasCurves() const noexcept
+        { return !mCurveStates.empty(); }
+    private:
+        friend class AnimationBatch;
+        void BindCurves(const Entity& entity) const;
+        float GetCurvePosition() const noexcept
+        { return mCurrentTime / mClass->GetDuration(); }
     private:
         // the class object
         std::shared_ptr<const AnimationClass> mClass;
@@ -224,16 +326,66 @@ namespace game
         struct AnimatorState {
             std::string node;
             std::unique_ptr<Animator> animator;
+            // true when the animator is baked into a curve and the
+            // animator instance is not used for evaluation.
+            bool baked = false;
             mutable bool started = false;
             mutable bool ended   = false;
         };
         std::vector<AnimatorState> mTracks;
+        // Per instance state of each baked curve. The state of the
+        // node when the curve started and the index of the entity
+        // node the curve is bound to.
+        struct CurveState {
+            glm::vec2 start_position = {0.0f, 0.0f};
+            glm::vec2 start_size     = {1.0f, 1.0f};
+            glm::vec2 start_scale    = {1.0f, 1.0f};
+            float start_rotation     = 0.0f;
+            std::uint32_t node = 0;
+            bool bound   = false;
+            bool started = false;
+            bool ended   = false;
+        };
+        std::shared_ptr<const AnimationCurves> mCurves;
+        mutable std::vector<CurveState> mCurveStates;
+        // The entity class the curves are currently bound to.
+        mutable const EntityClass* mCurveBinding = nullptr;
         // One time delay before starting the animation.
         float mDelay = 0.0f;
         // current play back time for this track.
         float mCurrentTime = 0.0f;
     };
 
+    // AnimationBatch applies the baked curves of a number of animation
+    // instances in one go. The instances are grouped by their curves and
+    // each curve is evaluated over all the instances in the group before
+    // moving on to the next curve. Each animation instance must be playing
+    // on a different entity.
+    class AnimationBatch
+    {
+    public:
+        // Add an animation instance playing on the given entity to the
+        // batch. The animation must have baked curves.
+        void Add(const Animation* animation, Entity* entity);
+        // Apply the baked curves of all the animations in the batch.
+        void Apply();
+        // Remove all the animations from the batch.
+        void Clear() noexcept;
+        // Get the number of animations in the batch.
+        inline std::size_t GetSize() const noexcept
+        { return mSize; }
+    private:
+        struct Group {
+            const AnimationCurves* curves = nullptr;
+            std::vector<const Animation*> animations;
+            std::vector<Entity*> entities;
+            std::vector<float> positions;
+        };
+        std::vector<Group> mGroups;
+        std::unordered_map<const AnimationCurves*, std::size_t> mGroupIndex;
+        std::size_t mSize = 0;
+    };
+
     std::unique_ptr<Animation> CreateAnimationInstance(const std::shared_ptr<const AnimationClass>& klass);
 
 
@@ -18,6 +18,7 @@
 
 #include "warnpush.h"
 #  include <glm/glm.hpp> // for glm::inverse
+#  include <neargye/magic_enum.hpp>
 #include "warnpop.h"
 
 #include <atomic>
@@ -43,6 +44,32 @@
 #include "game/entity_node_spatial_node.h"
 #include "game/entity_node_fixture.h"
 #include "game/entity_node_tilemap_node.h"
+#include "game/scene.h"
+#include "game/scene_snapshot.h"
+
+namespace {
+// The drawable and transformer instance flags are only accessible
+// through the flag getter/setter so pack/unpack them one by one.
+template<typename Flags, typename Object>
+std::uint32_t GetFlagBits(const Object& object)
+{
+    std::uint32_t bits = 0;
+    for (const auto flag : magic_enum::enum_values<Flags>())
+    {
+        if (object.TestFlag(flag))
+            bits |= 1u << static_cast<unsigned>(flag);
+    }
+    return bits;
+}
+template<typename Flags, typename Object>
+void SetFlagBits(Object& object, std::uint32_t bits)
+{
+    for (const auto flag : magic_enum::enum_values<Flags>())
+    {
+        object.SetFlag(flag, (bits >> static_cast<unsigned>(flag)) & 1u);
+    }
+}
+} // namespace
 
 namespace game
 {
@@ -881,6 +908,7 @@ Entity::Entity(std::shared_ptr<const EntityClass> klass)
             auto node_klass = mClass->GetSharedEntityNodeClass(i);
             EntityNode node(node_klass, &allocator);
             node.SetEntity(this);
+            node.GetTransform()->entity_dirty = &mTransformCacheDirty;
             mNodes.push_back(std::move(node));
             map[node_klass.get()] = &mNodes.back();
         }
@@ -892,6 +920,298 @@ Entity::Entity(std::shared_ptr<const EntityClass> klass)
             });
     );
 
+    CreateInstanceState();
+}
+
+Entity::Entity(const EntityArgs& args) : Entity(args.klass)
+{
+    ApplyArgs(args);
+}
+
+Entity::Entity(const EntityClass& klass)
+  : Entity(std::make_shared<EntityClass>(klass))
+{}
+
+Entity::~Entity()
+{
+    auto& allocator = mClass->GetAllocator();
+
+    for (auto& node: mNodes)
+    {
+        node.Release(&allocator);
+    }
+}
+
+void Entity::Reset(const EntityArgs& args)
+{
+    ASSERT(args.klass == mClass);
+
+    // reset the nodes in place. the render tree and the node
+    // attachments stay the same since they're defined by the class.
+    auto& allocator = mClass->GetAllocator();
+    for (auto& node : mNodes)
+    {
+        node.Reset(&allocator);
+        node.SetEntity(this);
+        node.GetTransform()->entity_dirty = &mTransformCacheDirty;
+    }
+    mTransformCacheDirty = true;
+
+    mInstanceId   = FastId(10);
+    mInstanceName.clear();
+    mInstanceTag  = mClass->GetTag();
+    mParentNodeId.clear();
+    mAnimator.reset();
+    mCurrentAnimations.clear();
+    mScriptVars.clear();
+    mJoints.clear();
+    mScene = nullptr;
+    mScheduledDeath.reset();
+    mCurrentTime = 0.0;
+    mLifetime    = mClass->GetLifetime();
+    mLayer       = 0;
+    mFlags       = mClass->GetFlags();
+    mIdleTrackId = mClass->GetIdleTrackId();
+    mControlFlags.clear();
+    mFinishedAnimations.clear();
+    mAnimationQueue = {};
+    mTimers.clear();
+    mEvents.clear();
+    mDeferAnimation    = false;
+    mDeferredAnimation = nullptr;
+    mNumRecomputedTransforms = 0;
+
+    CreateInstanceState();
+    ApplyArgs(args);
+}
+
+void Entity::ReleaseNodeData()
+{
+    auto& allocator = mClass->GetAllocator();
+    for (auto& node : mNodes)
+    {
+        node.Release(&allocator);
+    }
+}
+
+void Entity::IntoSnapshot(SnapshotWriter& writer) const
+{
+    writer.Write(mClass->GetId());
+    writer.Write(mInstanceName);
+    writer.Write(mInstanceTag);
+    writer.Write(mIdleTrackId);
+    writer.Write(static_cast<std::int32_t>(mLayer));
+    writer.Write(mFlags.value());
+    writer.Write(mCurrentTime);
+    writer.Write(mLifetime);
+    writer.Write(static_cast<std::uint8_t>(mScheduledDeath.has_value()));
+    writer.Write(mScheduledDeath.value_or(0.0f));
+
+    writer.Write(static_cast<std::uint32_t>(mTimers.size()));
+    for (const auto& timer : mTimers)
+    {
+        writer.Write(timer.name);
+        writer.Write(timer.when);
+    }
+
+    writer.Write(static_cast<std::uint32_t>(mScriptVars.size()));
+    for (const auto& var : mScriptVars)
+    {
+        writer.Write(var.GetId());
+        writer.Write(var.GetVariantValue());
+    }
+
+    writer.Write(static_cast<std::uint32_t>(mNodes.size()));
+    for (const auto& node : mNodes)
+    {
+        const auto* transformer = node.GetTransformer();
+        const auto* drawable = node.GetDrawable();
+        writer.Write(node.GetTranslation());
+        writer.Write(node.GetScale());
+        writer.Write(node.GetSize());
+        writer.Write(node.GetRotation());
+        writer.Write(static_cast<std::uint8_t>((transformer ? 1 : 0) | (drawable ? 2 : 0)));
+        if (transformer)
+        {
+            writer.Write(GetFlagBits<NodeTransformer::Flags>(*transformer));
+            writer.Write(transformer->GetLinearVelocity());
+            writer.Write(transformer->GetLinearAcceleration());
+            writer.Write(transformer->GetAngularVelocity());
+            writer.Write(transformer->GetAngularAcceleration());
+        }
+        if (drawable)
+        {
+            writer.Write(GetFlagBits<DrawableItem::Flags>(*drawable));
+            writer.Write(drawable->GetMaterialId());
+            writer.Write(drawable->GetTimeScale());
+            writer.Write(drawable->GetCurrentMaterialTime());
+        }
+    }
+
+    writer.Write(static_cast<std::uint32_t>(mCurrentAnimations.size()));
+    for (const auto& animation : mCurrentAnimations)
+    {
+        writer.Write(animation->GetClassId());
+        writer.Write(animation->GetCurrentTime());
+        writer.Write(animation->GetDelay());
+    }
+}
+
+bool Entity::FromSnapshot(SnapshotReader& reader)
+{
+    std::string class_id;
+    std::string name;
+    std::string tag;
+    std::int32_t layer = 0;
+    std::uint32_t flags = 0;
+    std::uint8_t has_scheduled_death = 0;
+    float scheduled_death = 0.0f;
+    if (!reader.Read(&class_id) || class_id != mClass->GetId())
+        return false;
+    if (!reader.Read(&name) || !reader.Read(&tag) || !reader.Read(&mIdleTrackId))
+        return false;
+    if (!reader.Read(&layer) || !reader.Read(&flags))
+        return false;
+    if (!reader.Read(&mCurrentTime) || !reader.Read(&mLifetime))
+        return false;
+    if (!reader.Read(&has_scheduled_death) || !reader.Read(&scheduled_death))
+        return false;
+    // the scene keeps the name lookup up to date, the tag
+    // index is updated by SetTag.
+    mInstanceName = std::move(name);
+    mLayer = layer;
+    mFlags.set_from_value(flags);
+    mScheduledDeath.reset();
+    if (has_scheduled_death)
+        mScheduledDeath = scheduled_death;
+    SetTag(tag);
+
+    std::uint32_t count = 0;
+    if (!reader.Read(&count))
+        return false;
+    mTimers.resize(count);
+    for (auto& timer : mTimers)
+    {
+        if (!reader.Read(&timer.name) || !reader.Read(&timer.when))
+            return false;
+    }
+
+    if (!reader.Read(&count))
+        return false;
+    for (std::uint32_t i=0; i<count; ++i)
+    {
+        std::string id;
+        ScriptVar::VariantType value;
+        if (!reader.Read(&id) || !reader.Read(&value))
+            return false;
+        auto it = std::find_if(mScriptVars.begin(), mScriptVars.end(), [&id](const auto& var) {
+            return var.GetId() == id;
+        });
+        if (it == mScriptVars.end())
+        {
+            // A read-only variable that was given a value on spawn
+            // through the entity args has a mutable copy. See ApplyArgs.
+            const auto* var = mClass->FindScriptVarById(id);
+            if (var == nullptr)
+                return false;
+            mScriptVars.push_back(*var);
+            mScriptVars.back().SetReadOnly(false);
+            it = mScriptVars.end() - 1;
+        }
+        if (ScriptVar::GetTypeFromVariant(value) != it->GetType())
+            return false;
+        it->SetData(std::move(value));
+    }
+
+    if (!reader.Read(&count) || count != mNodes.size())
+        return false;
+    for (auto& node : mNodes)
+    {
+        glm::vec2 translation;
+        glm::vec2 scale;
+        glm::vec2 size;
+        float rotation = 0.0f;
+        std::uint8_t components = 0;
+        if (!reader.Read(&translation) || !reader.Read(&scale) || !reader.Read(&size))
+            return false;
+        if (!reader.Read(&rotation) || !reader.Read(&components))
+            return false;
+        node.SetTranslation(translation);
+        node.SetScale(scale);
+        node.SetSize(size);
+        node.SetRotation(rotation);
+
+        auto* transformer = node.GetTransformer();
+        auto* drawable = node.GetDrawable();
+        if (((components & 1) != 0) != (transformer != nullptr))
+            return false;
+        if (((components & 2) != 0) != (drawable != nullptr))
+            return false;
+        if (transformer)
+        {
+            std::uint32_t bits = 0;
+            glm::vec2 linear_velocity;
+            glm::vec2 linear_acceleration;
+            float angular_velocity = 0.0f;
+            float angular_acceleration = 0.0f;
+            if (!reader.Read(&bits) || !reader.Read(&linear_velocity) || !reader.Read(&linear_acceleration))
+                return false;
+            if (!reader.Read(&angular_velocity) || !reader.Read(&angular_acceleration))
+                return false;
+            SetFlagBits<NodeTransformer::Flags>(*transformer, bits);
+            transformer->SetLinearVelocity(linear_velocity);
+            transformer->SetLinearAcceleration(linear_acceleration);
+            transformer->SetAngularVelocity(angular_velocity);
+            transformer->SetAngularAcceleration(angular_acceleration);
+        }
+        if (drawable)
+        {
+            std::uint32_t bits = 0;
+            std::string material;
+            float time_scale = 0.0f;
+            double material_time = 0.0;
+            if (!reader.Read(&bits) || !reader.Read(&material))
+                return false;
+            if (!reader.Read(&time_scale) || !reader.Read(&material_time))
+                return false;
+            SetFlagBits<DrawableItem::Flags>(*drawable, bits);
+            drawable->SetMaterialId(std::move(material));
+            drawable->SetTimeScale(time_scale);
+            drawable->SetCurrentMaterialTime(material_time);
+        }
+    }
+
+    if (!reader.Read(&count))
+        return false;
+    mCurrentAnimations.clear();
+    mFinishedAnimations.clear();
+    mAnimationQueue = {};
+    mDeferredAnimation = nullptr;
+    for (std::uint32_t i=0; i<count; ++i)
+    {
+        std::string id;
+        float time  = 0.0f;
+        float delay = 0.0f;
+        if (!reader.Read(&id) || !reader.Read(&time) || !reader.Read(&delay))
+            return false;
+        std::shared_ptr<const AnimationClass> klass;
+        for (size_t j=0; j<mClass->GetNumAnimations(); ++j)
+        {
+            if (mClass->GetSharedAnimationClass(j)->GetId() == id)
+                klass = mClass->GetSharedAnimationClass(j);
+        }
+        if (!klass)
+            return false;
+        auto animation = std::make_unique<Animation>(klass);
+        animation->SetDelay(delay);
+        animation->Update(time - animation->GetCurrentTime());
+        mCurrentAnimations.push_back(std::move(animation));
+    }
+    return true;
+}
+
+void Entity::CreateInstanceState()
+{
     // assign the script variables.
     for (size_t i=0; i<mClass->GetNumScriptVars(); ++i)
     {
@@ -909,11 +1229,8 @@ Entity::Entity(std::shared_ptr<const EntityClass> klass)
     for (size_t i=0; i<mClass->GetNumJoints(); ++i)
     {
         const auto& joint_klass = mClass->GetSharedJoint(i);
-        const auto* klass_src_node = mClass->FindNodeById(joint_klass->src_node_id);
-        const auto* klass_dst_node = mClass->FindNodeById(joint_klass->dst_node_id);
-        ASSERT(klass_src_node && klass_dst_node);
-        auto* inst_src_node = map[klass_src_node];
-        auto* inst_dst_node = map[klass_dst_node];
+        auto* inst_src_node = FindNodeByClassId(joint_klass->src_node_id);
+        auto* inst_dst_node = FindNodeByClassId(joint_klass->dst_node_id);
         ASSERT(inst_src_node && inst_dst_node);
         PhysicsJoint joint(joint_klass,
                            FastId(10),
@@ -934,7 +1251,7 @@ Entity::Entity(std::shared_ptr<const EntityClass> klass)
     }
 }
 
-Entity::Entity(const EntityArgs& args) : Entity(args.klass)
+void Entity::ApplyArgs(const EntityArgs& args)
 {
     mInstanceName = args.name;
     mLayer        = args.layer;
@@ -1008,20 +1325,6 @@ Entity::Entity(const EntityArgs& args) : Entity(args.klass)
     mControlFlags.set(ControlFlags::EnableLogging, args.enable_logging);
 }
 
-Entity::Entity(const EntityClass& klass)
-  : Entity(std::make_shared<EntityClass>(klass))
-{}
-
-Entity::~Entity()
-{
-    auto& allocator = mClass->GetAllocator();
-
-    for (auto& node: mNodes)
-    {
-        node.Release(&allocator);
-    }
-}
-
 EntityNode& Entity::GetNode(size_t index)
 {
     ASSERT(index < mNodes.size());
@@ -1130,34 +1433,122 @@ glm::vec2 Entity::MapCoordsToNodeBox(const glm::vec2& pos, const EntityNode* nod
 
 glm::mat4 Entity::FindNodeTransform(const EntityNode* node) const
 {
-    return game::FindNodeTransform(mRenderTree, node);
+    const auto index = UpdateTransformCache(node);
+    if (index == RenderTree::NoParent)
+        return game::FindNodeTransform(mRenderTree, node);
+
+    return mTransformCache[index];
 }
 glm::mat4 Entity::FindNodeModelTransform(const EntityNode* node) const
 {
-    return game::FindNodeModelTransform(mRenderTree, node);
+    const auto index = UpdateTransformCache(node);
+    if (index == RenderTree::NoParent)
+        return game::FindNodeModelTransform(mRenderTree, node);
+
+    return mTransformCache[index] * node->GetModelTransform();
 }
 
 glm::mat4 Entity::FindRelativeTransform(const EntityNode* parent, const EntityNode* child) const
 {
-    const auto& parent_to_world = game::FindNodeTransform(mRenderTree, parent);
-    const auto& child_to_world  = game::FindNodeTransform(mRenderTree, child);
+    const auto& parent_to_world = FindNodeTransform(parent);
+    const auto& child_to_world  = FindNodeTransform(child);
     const auto& world_to_parent = glm::inverse(parent_to_world);
     return world_to_parent * child_to_world;
 }
 
 FRect Entity::FindNodeBoundingRect(const EntityNode* node) const
 {
-    return game::FindBoundingRect(mRenderTree, node);
+    return ComputeBoundingRect(FindNodeModelTransform(node));
 }
 
 FRect Entity::GetBoundingRect() const
 {
-    return game::FindBoundingRect(mRenderTree);
+    UpdateTransformCache(nullptr);
+
+    // only the nodes that are reachable from the root, i.e. the
+    // root's subtree in the flat tree, contribute to the bounds.
+    const auto& tree = mRenderTree.GetFlatTree();
+    FRect ret;
+    for (std::uint32_t i=1; i<tree[0].size; ++i)
+    {
+        const auto& model_to_entity = mTransformCache[i] * tree[i].node->GetModelTransform();
+        ret = Union(ret, ComputeBoundingRect(model_to_entity));
+    }
+    return ret;
 }
 
 FBox Entity::FindNodeBoundingBox(const EntityNode* node) const
 {
-    return game::FindBoundingBox(mRenderTree, node);
+    return FBox(FindNodeModelTransform(node));
+}
+
+std::uint32_t Entity::UpdateTransformCache(const EntityNode* node) const
+{
+    const auto& tree = mRenderTree.GetFlatTree();
+    const auto version = mRenderTree.GetFlatTreeVersion();
+
+    // if the topology has changed the flat node indices have changed
+    // and every cached matrix needs to be recomputed.
+    const bool rebuild = version != mTransformCacheVersion;
+    if (rebuild)
+    {
+        mTransformCache.resize(tree.size());
+        mTransformRecomputed.resize(tree.size());
+        mTransformCacheVersion = version;
+        // the root (nullptr) at index 0 has no transform.
+        mTransformCache[0] = glm::mat4(1.0f);
+        mTransformRecomputed[0] = 0;
+    }
+
+    // the node transforms raise the entity's dirty flag when they
+    // change so the walk over the nodes is only needed when something
+    // has actually changed.
+    if (rebuild || mTransformCacheDirty)
+    {
+        // walk the tree in pre-order, which means that the parent matrix
+        // is always up to date by the time the children are visited.
+        // a node needs to be recomputed when its own transform has changed
+        // or when its parent was recomputed.
+        std::size_t count = 0;
+        for (std::uint32_t i=1; i<tree.size(); ++i)
+        {
+            const auto& flat = tree[i];
+            const auto* transform = flat.node->GetTransform();
+            const bool parent_recomputed = flat.parent != RenderTree::NoParent && mTransformRecomputed[flat.parent];
+            const bool recompute = rebuild || transform->dirty || parent_recomputed;
+            mTransformRecomputed[i] = recompute;
+            if (!recompute)
+                continue;
+
+            const auto& node_to_parent = flat.node->GetNodeTransform();
+            if (flat.parent == RenderTree::NoParent)
+                mTransformCache[i] = node_to_parent;
+            else mTransformCache[i] = mTransformCache[flat.parent] * node_to_parent;
+            transform->dirty = false;
+            transform->cache_index = i;
+            ++count;
+        }
+        mNumRecomputedTransforms += count;
+        if (count)
+            ++mTransformRevision;
+        mTransformCacheDirty = false;
+    }
+
+    if (node == nullptr)
+        return 0;
+
+    // every node in the tree got its index when the cache was last
+    // rebuilt, a node that isn't in the tree falls back to the search.
+    const auto index = node->GetTransform()->cache_index;
+    if (index < tree.size() && tree[index].node == node)
+        return index;
+    return mRenderTree.FindFlatIndex(node);
+}
+
+std::uint64_t Entity::GetTransformRevision() const
+{
+    UpdateTransformCache(nullptr);
+    return mTransformRevision;
 }
 
 void Entity::Die()
@@ -1169,6 +1560,17 @@ void Entity::DieIn(float seconds)
     mScheduledDeath = seconds;
 }
 
+void Entity::SetTag(const std::string& tag)
+{
+    if (tag == mInstanceTag)
+        return;
+
+    const std::string old_tag = std::move(mInstanceTag);
+    mInstanceTag = tag;
+    if (mScene)
+        mScene->update_entity_tag(this, old_tag);
+}
+
 void Entity::Update(float dt, std::vector<Event>* events)
 {
     mCurrentTime += dt;
@@ -1215,6 +1617,9 @@ void Entity::Update(float dt, std::vector<Event>* events)
         auto* transformer = node.GetTransformer();
         if (!transformer || !transformer->IsEnabled())
             continue;
+        // the batch (if any) takes care of the integration.
+        if (transformer->IsBatched())
+            continue;
 
         const auto integrator = transformer->GetIntegrator();
         if (integrator == NodeTransformerClass::Integrator::Euler)
@@ -1237,6 +1642,8 @@ void Entity::Update(float dt, std::vector<Event>* events)
         }
     }
 
+    mDeferredAnimation = nullptr;
+
     if (mCurrentAnimations.empty())
     {
         if (mAnimationQueue.empty())
@@ -1256,15 +1663,38 @@ void Entity::Update(float dt, std::vector<Event>* events)
         animation->Update(dt);
     }
 
+    // When a single animation is playing its baked curves can be
+    // applied by the caller in a batch with the other entities.
+    // With multiple animations the order in which the animations
+    // are applied on the nodes must be kept so they're applied here.
+    if (mDeferAnimation && mCurrentAnimations.size() == 1 && mCurrentAnimations[0]->HasCurves())
+    {
+        mDeferredAnimation = mCurrentAnimations[0].get();
+        return;
+    }
+
     // Apply animation state transforms/actions on the entity nodes.
-    for (auto& node : mNodes)
+    for (auto& animation : mCurrentAnimations)
     {
-        for (auto& animation : mCurrentAnimations)
-        {
-            animation->Apply(node);
-        }
+        animation->Apply(*this);
     }
 
+    FinishAnimations();
+}
+
+void Entity::FinishAnimationUpdate()
+{
+    if (mDeferredAnimation == nullptr)
+        return;
+
+    mDeferredAnimation->ApplyAnimators(*this);
+    mDeferredAnimation = nullptr;
+
+    FinishAnimations();
+}
+
+void Entity::FinishAnimations()
+{
     for (auto& animation : mCurrentAnimations)
     {
         if (!animation->IsComplete())
@@ -32,6 +32,7 @@
 #include <optional>
 #include <variant>
 #include <queue>
+#include <cstdint>
 
 #include "base/allocator.h"
 #include "base/bitflag.h"
@@ -52,6 +53,8 @@
 namespace game
 {
     class Scene;
+    class SnapshotWriter;
+    class SnapshotReader;
 
     class EntityClass
     {
@@ -538,6 +541,25 @@ namespace game
         Entity(const Entity& other) = delete;
 
         ~Entity();
+
+        // Reset the entity back to the initial state based on the entity
+        // class object's state and the given arguments. The entity is
+        // then equivalent to a new entity created with the same arguments
+        // but the node objects and their allocations are reused.
+        // The args must refer to the same class as the entity.
+        void Reset(const EntityArgs& args);
+        // Release the node transforms and data back to the class allocator
+        // while the entity is kept in the scene's entity pool. This keeps
+        // the parked nodes out of the allocator and thus out of the scripts
+        // that iterate over the allocator. Reset allocates them again.
+        void ReleaseNodeData();
+
+        // Write the entity instance state into a scene snapshot record.
+        void IntoSnapshot(SnapshotWriter& writer) const;
+        // Restore the entity instance state from a scene snapshot record
+        // written by IntoSnapshot. The record must be for an entity of
+        // the same class. Returns false if the record is not valid.
+        bool FromSnapshot(SnapshotReader& reader);
         
         // Get the entity node by index. The index must be valid.
         EntityNode& GetNode(size_t index);
@@ -598,10 +620,30 @@ namespace game
         // Compute the oriented bounding box (OOB) for the given entity node.
         FBox FindNodeBoundingBox(const EntityNode* node) const;
 
-        // todo:
+        // Find the transform for transforming the node into the entity
+        // coordinate space. The matrices are cached per node and only
+        // the nodes whose transform (or a parent's transform) has changed
+        // since the previous lookup are recomputed.
+        // Note that the lookup updates the cache and is therefore not
+        // safe to call concurrently on the same entity.
         glm::mat4 FindNodeTransform(const EntityNode* node) const;
+        // Find the transform for transforming the node's model (i.e. the
+        // unit box) into the entity coordinate space.
         glm::mat4 FindNodeModelTransform(const EntityNode* node) const;
+        // Find the transform for transforming the child node into the
+        // parent node's coordinate space.
         glm::mat4 FindRelativeTransform(const EntityNode* parent, const EntityNode* child) const;
+        // Get the number of cached node matrices that have been recomputed
+        // since the counter was last reset.
+        std::size_t GetNumRecomputedTransforms() const noexcept
+        { return mNumRecomputedTransforms; }
+        void ResetNumRecomputedTransforms() noexcept
+        { mNumRecomputedTransforms = 0; }
+        // Bring the cached node matrices up to date and get the transform
+        // revision. The revision changes whenever any of the entity's
+        // node matrices has changed, i.e. a node transform has changed
+        // or the render tree topology has changed.
+        std::uint64_t GetTransformRevision() const;
 
         void Die();
         void DieIn(float seconds);
@@ -624,6 +666,23 @@ namespace game
 
         void Update(float dt, std::vector<Event>* events = nullptr);
 
+        // Enable/disable deferring the evaluation of the baked animation
+        // curves from Update to the caller. When enabled and the entity
+        // is playing a single animation with baked curves Update only
+        // advances the animation. The caller is then expected to apply
+        // the deferred animation's curves (for example through an
+        // AnimationBatch) and then call FinishAnimationUpdate.
+        inline void SetAnimationDeferred(bool on_off) noexcept
+        { mDeferAnimation = on_off; }
+        // Get the animation whose curves were deferred by the previous
+        // call to Update or nullptr if nothing was deferred.
+        inline const Animation* GetDeferredAnimation() const noexcept
+        { return mDeferredAnimation; }
+        // Finish the animation update after the deferred animation
+        // curves have been applied. Applies the rest of the deferred
+        // animation and handles the completed animations.
+        void FinishAnimationUpdate();
+
         using EntityStateUpdate = game::EntityStateController::StateUpdate;
         using EntityState = game::EntityState;
         using EntityStateTransition = game::EntityStateTransition;
@@ -715,8 +774,9 @@ namespace game
         const ScriptVar* FindScriptVarByName(const std::string& name) const;
         const ScriptVar* FindScriptVarById(const std::string& id) const;
 
-        void SetTag(const std::string& tag)
-        { mInstanceTag = tag; }
+        // Set the entity instance tag. If the entity is in a scene
+        // the scene's tag lookup is updated.
+        void SetTag(const std::string& tag);
         void SetFlag(ControlFlags flag, bool on_off) noexcept
         { mControlFlags.set(flag, on_off); }
         void SetFlag(Flags flag, bool on_off) noexcept
@@ -814,6 +874,8 @@ namespace game
         { return mRenderTree; }
         const EntityClass& GetClass() const noexcept
         { return *mClass.get(); }
+        std::shared_ptr<const EntityClass> GetSharedClass() const noexcept
+        { return mClass; }
         const EntityClass* operator->() const noexcept
         { return mClass.get(); }
         Entity& operator=(const Entity&) = delete;
@@ -872,6 +934,37 @@ namespace game
         std::vector<Timer> mTimers;
         std::vector<PostedEvent> mEvents;
 
+        // Whether to defer applying the animation curves to the caller.
+        bool mDeferAnimation = false;
+        // The animation whose curves were deferred during the update.
+        Animation* mDeferredAnimation = nullptr;
+
+        // Handle the current animations that have completed.
+        void FinishAnimations();
+        // Create the per instance state (script variables, joints
+        // and the state controller) based on the class.
+        void CreateInstanceState();
+        // Apply the entity creation arguments.
+        void ApplyArgs(const EntityArgs& args);
+        // Bring the cached node matrices up to date and return the
+        // node's index in the cache or RenderTree::NoParent if the node
+        // is not in the render tree.
+        std::uint32_t UpdateTransformCache(const EntityNode* node) const;
+        // Cached node-to-entity matrices indexed by the node's index in
+        // the render tree's flat pre-order representation.
+        mutable std::vector<glm::mat4> mTransformCache;
+        // Per node flag indicating that the matrix was recomputed during
+        // the current cache update. Used to propagate the change to the
+        // descendants.
+        mutable std::vector<std::uint8_t> mTransformRecomputed;
+        // The version of the flat render tree the cache was built against.
+        mutable std::uint64_t mTransformCacheVersion = 0;
+        // The number of matrices recomputed since the last reset.
+        mutable std::size_t mNumRecomputedTransforms = 0;
+        // Incremented every time any cached matrix is recomputed.
+        mutable std::uint64_t mTransformRevision = 1;
+        // Raised by the node transforms whenever any of them changes.
+        mutable bool mTransformCacheDirty = true;
     };
 
     std::unique_ptr<Entity> CreateEntityInstance(std::shared_ptr<const EntityClass> klass);
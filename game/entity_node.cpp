@@ -363,8 +363,6 @@ EntityNode::EntityNode(std::shared_ptr<const EntityNodeClass> klass, EntityNodeA
 {
     if (allocator)
     {
-        std::lock_guard<std::mutex> lock(allocator->GetMutex());
-
         mAllocatorIndex = allocator->GetNextIndex();
         mTransform = allocator->CreateObject<EntityNodeTransform>(mAllocatorIndex, *mClass);
         mNodeData  = allocator->CreateObject<EntityNodeData>(mAllocatorIndex, FastId(10), mClass->GetName());
@@ -425,8 +423,6 @@ void EntityNode::Release(EntityNodeAllocator* allocator)
 {
     if (mTransform)
     {
-        std::lock_guard<std::mutex> lock(allocator->GetMutex());
-
         allocator->DestroyObject(mAllocatorIndex, mTransform);
         allocator->DestroyObject(mAllocatorIndex, mNodeData);
         allocator->FreeIndex(mAllocatorIndex);
@@ -435,6 +431,41 @@ void EntityNode::Release(EntityNodeAllocator* allocator)
     }
 }
 
+void EntityNode::Reset(EntityNodeAllocator* allocator)
+{
+    ASSERT(!mTransformer || !mTransformer->IsBatched());
+
+    if (mTransform)
+    {
+        *mTransform = EntityNodeTransform(*mClass);
+        mNodeData->mInstanceId   = FastId(10);
+        mNodeData->mInstanceName = mClass->GetName();
+    }
+    else
+    {
+        mAllocatorIndex = allocator->GetNextIndex();
+        mTransform = allocator->CreateObject<EntityNodeTransform>(mAllocatorIndex, *mClass);
+        mNodeData  = allocator->CreateObject<EntityNodeData>(mAllocatorIndex, FastId(10), mClass->GetName());
+    }
+
+    if (mDrawable)
+        *mDrawable = DrawableItem(mClass->GetSharedDrawable());
+    if (mRigidBody)
+        *mRigidBody = RigidBody(mClass->GetSharedRigidBody());
+    if (mTextItem)
+        *mTextItem = TextItem(mClass->GetSharedTextItem());
+    if (mSpatialNode)
+        *mSpatialNode = SpatialNode(mClass->GetSharedSpatialNode());
+    if (mFixture)
+        *mFixture = Fixture(mClass->GetSharedFixture());
+    if (mMapNode)
+        *mMapNode = MapNode(mClass->GetSharedMapNode());
+    if (mTransformer)
+        *mTransformer = NodeTransformer(mClass->GetSharedTransformer());
+    if (mBasicLight)
+        *mBasicLight = BasicLight(mClass->GetSharedBasicLight());
+}
+
 DrawableItem* EntityNode::GetDrawable()
 { return mDrawable.get(); }
 
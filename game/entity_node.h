@@ -35,6 +35,7 @@ namespace game
 {
     class NodeTransformerClass;
     class NodeTransformer;
+    class NodeTransformerBatch;
     class RigidBodyClass;
     class RigidBody;
     class DrawableItemClass;
@@ -342,6 +343,19 @@ namespace game
         glm::vec2 size = {1.0f, 1.0f};
         // Rotation around z axis in radians relative to parent.
         float rotation = 0.0f;
+        // Set whenever the transform changes. The entity uses this to
+        // find the nodes whose cached node-to-entity matrices (and the
+        // matrices of their descendants) need to be recomputed.
+        // Code that writes the member variables directly must also call
+        // MarkDirty.
+        mutable bool dirty = true;
+        // The owning entity's flag indicating that at least one of its
+        // node transforms has changed. Set by the entity, lets the entity
+        // skip walking its nodes when nothing has changed.
+        bool* entity_dirty = nullptr;
+        // The node's index in the owning entity's transform cache.
+        // Maintained by the entity.
+        mutable std::uint32_t cache_index = 0xffffffff;
 
         EntityNodeTransform() = default;
         EntityNodeTransform(const EntityNodeClass& klass)
@@ -351,30 +365,37 @@ namespace game
           , rotation(klass.GetRotation())
         {}
 
+        inline void MarkDirty() noexcept
+        {
+            dirty = true;
+            if (entity_dirty)
+                *entity_dirty = true;
+        }
+
         inline void SetScale(glm::vec2 scale) noexcept
-        { this->scale = scale; }
+        { this->scale = scale; MarkDirty(); }
         inline void SetScale(float sx, float sy) noexcept
-        { this->scale = glm::vec2(sx, sy); }
+        { this->scale = glm::vec2(sx, sy); MarkDirty(); }
         inline void SetSize(glm::vec2 size) noexcept
-        { this->size = size; }
+        { this->size = size; MarkDirty(); }
         inline void SetSize(float width, float height) noexcept
-        { this->size = glm::vec2(width, height); }
+        { this->size = glm::vec2(width, height); MarkDirty(); }
         inline void SetTranslation(glm::vec2 pos) noexcept
-        { this->translation = pos; }
+        { this->translation = pos; MarkDirty(); }
         inline void SetTranslation(float x, float y) noexcept
-        { this->translation = glm::vec2(x, y); }
+        { this->translation = glm::vec2(x, y); MarkDirty(); }
         inline void SetRotation(float rotation) noexcept
-        { this->rotation = rotation; }
+        { this->rotation = rotation; MarkDirty(); }
         inline void Translate(glm::vec2 vec) noexcept
-        { this->translation += vec; }
+        { this->translation += vec; MarkDirty(); }
         inline void Translate(float dx, float dy) noexcept
-        { this->translation += glm::vec2(dx, dy); }
+        { this->translation += glm::vec2(dx, dy); MarkDirty(); }
         inline void Rotate(float dr) noexcept
-        { this->rotation += dr; }
+        { this->rotation += dr; MarkDirty(); }
         inline void Grow(glm::vec2 vec) noexcept
-        { this->size += vec; }
+        { this->size += vec; MarkDirty(); }
         inline void Grow(float dx, float dy) noexcept
-        { this->size += glm::vec2(dx, dy); }
+        { this->size += glm::vec2(dx, dy); MarkDirty(); }
 
         inline glm::vec2 GetTranslation() const noexcept
         { return this->translation; }
@@ -441,32 +462,39 @@ namespace game
        ~EntityNode();
 
         void Release(EntityNodeAllocator* allocator);
+        // Reset the node back to the initial state based on the node
+        // class and give it a new instance ID. The node's transform and
+        // data objects and its attachments are reused. If the transform
+        // and data have been released they're allocated again from the
+        // allocator. Any node transformer must have been detached from
+        // its batch.
+        void Reset(EntityNodeAllocator* allocator);
 
         // transformation
         inline void SetScale(glm::vec2 scale) noexcept
-        { mTransform->scale = scale; }
+        { mTransform->SetScale(scale); }
         inline void SetScale(float sx, float sy) noexcept
-        { mTransform->scale = glm::vec2(sx, sy); }
+        { mTransform->SetScale(sx, sy); }
         inline void SetSize(const glm::vec2& size) noexcept
-        { mTransform->size = size; }
+        { mTransform->SetSize(size); }
         inline void SetSize(float width, float height) noexcept
-        { mTransform->size = glm::vec2(width, height); }
+        { mTransform->SetSize(width, height); }
         inline void SetTranslation(glm::vec2 pos) noexcept
-        { mTransform->translation = pos; }
+        { mTransform->SetTranslation(pos); }
         inline void SetTranslation(float x, float y) noexcept
-        { mTransform->translation = glm::vec2(x, y); }
+        { mTransform->SetTranslation(x, y); }
         inline void SetRotation(float rotation) noexcept
-        { mTransform->rotation = rotation; }
+        { mTransform->SetRotation(rotation); }
         inline void Translate(const glm::vec2& vec) noexcept
-        { mTransform->translation += vec; }
+        { mTransform->Translate(vec); }
         inline void Translate(float dx, float dy) noexcept
-        { mTransform->translation += glm::vec2(dx, dy); }
+        { mTransform->Translate(dx, dy); }
         inline void Rotate(float dr) noexcept
-        { mTransform->rotation += dr; }
+        { mTransform->Rotate(dr); }
         inline void Grow(glm::vec2 vec) noexcept
-        { mTransform->size += vec; }
+        { mTransform->Grow(vec); }
         inline void Grow(float dx, float dy) noexcept
-        { mTransform->size += glm::vec2(dx, dy); }
+        { mTransform->Grow(dx, dy); }
         inline glm::vec2 GetTranslation() const noexcept
         { return mTransform->translation; }
         inline glm::vec2 GetScale() const noexcept
@@ -14,6 +14,16 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define GAME_TRANSFORMER_SIMD_SSE2
+#elif defined(__wasm_simd128__)
+#  include <wasm_simd128.h>
+#  define GAME_TRANSFORMER_SIMD_WASM
+#endif
+
+#include "base/assert.h"
+#include "game/entity_node.h"
 #include "game/entity_node_transformer.h"
 
 #include "base/hash.h"
@@ -57,4 +67,145 @@ bool NodeTransformerClass::FromJson(const data::Reader& data)
     return ok;
 }
 
+NodeTransformerBatch::~NodeTransformerBatch()
+{
+    DetachAll();
+}
+
+void NodeTransformerBatch::Attach(NodeTransformer* transformer, EntityNodeTransform* transform)
+{
+    ASSERT(transformer->mBatch == nullptr);
+    ASSERT(transformer->GetIntegrator() == NodeTransformerClass::Integrator::Euler);
+
+    mLinearVelocityX.push_back(transformer->mLinearVelocity.x);
+    mLinearVelocityY.push_back(transformer->mLinearVelocity.y);
+    mLinearAccelerationX.push_back(transformer->mLinearAcceleration.x);
+    mLinearAccelerationY.push_back(transformer->mLinearAcceleration.y);
+    mAngularVelocity.push_back(transformer->mAngularVelocity);
+    mAngularAcceleration.push_back(transformer->mAngularAcceleration);
+    mEnabled.push_back(transformer->IsEnabled() ? ~0u : 0u);
+    mTransformers.push_back(transformer);
+    mTransforms.push_back(transform);
+
+    transformer->mBatch = this;
+    transformer->mBatchIndex = mTransformers.size() - 1;
+}
+
+void NodeTransformerBatch::Detach(NodeTransformer* transformer)
+{
+    ASSERT(transformer->mBatch == this);
+    const auto index = transformer->mBatchIndex;
+    const auto last  = mTransformers.size() - 1;
+
+    // move the motion state back into the transformer.
+    transformer->mLinearVelocity      = glm::vec2(mLinearVelocityX[index], mLinearVelocityY[index]);
+    transformer->mLinearAcceleration  = glm::vec2(mLinearAccelerationX[index], mLinearAccelerationY[index]);
+    transformer->mAngularVelocity     = mAngularVelocity[index];
+    transformer->mAngularAcceleration = mAngularAcceleration[index];
+    transformer->mBatch = nullptr;
+    transformer->mBatchIndex = 0;
+
+    // swap the last item into the place of the removed item
+    // in order to keep the arrays dense.
+    if (index != last)
+    {
+        mLinearVelocityX[index]     = mLinearVelocityX[last];
+        mLinearVelocityY[index]     = mLinearVelocityY[last];
+        mLinearAccelerationX[index] = mLinearAccelerationX[last];
+        mLinearAccelerationY[index] = mLinearAccelerationY[last];
+        mAngularVelocity[index]     = mAngularVelocity[last];
+        mAngularAcceleration[index] = mAngularAcceleration[last];
+        mEnabled[index]             = mEnabled[last];
+        mTransformers[index]        = mTransformers[last];
+        mTransforms[index]          = mTransforms[last];
+        mTransformers[index]->mBatchIndex = index;
+    }
+    mLinearVelocityX.pop_back();
+    mLinearVelocityY.pop_back();
+    mLinearAccelerationX.pop_back();
+    mLinearAccelerationY.pop_back();
+    mAngularVelocity.pop_back();
+    mAngularAcceleration.pop_back();
+    mEnabled.pop_back();
+    mTransformers.pop_back();
+    mTransforms.pop_back();
+}
+
+void NodeTransformerBatch::DetachAll()
+{
+    while (!mTransformers.empty())
+    {
+        Detach(mTransformers.back());
+    }
+}
+
+void NodeTransformerBatch::Integrate(float dt)
+{
+    const auto count = mTransformers.size();
+    mDeltaX.resize(count);
+    mDeltaY.resize(count);
+    mDeltaRotation.resize(count);
+
+    // Semi-implicit Euler, same as the entity update does per node.
+    //   velocity += acceleration * dt
+    //   position += velocity * dt
+    // The velocity of a disabled transformer is kept as is.
+    // Only multiplications and additions are used (no fused multiply-add)
+    // so that the results are identical to the scalar code.
+    std::size_t i = 0;
+#if defined(GAME_TRANSFORMER_SIMD_SSE2)
+    const __m128 step = _mm_set1_ps(dt);
+    const auto Integrate4 = [step](float* velocity, const float* acceleration, const std::uint32_t* enabled, float* delta) {
+        const __m128 mask = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(enabled)));
+        const __m128 old_velocity = _mm_loadu_ps(velocity);
+        const __m128 new_velocity = _mm_add_ps(old_velocity, _mm_mul_ps(_mm_loadu_ps(acceleration), step));
+        _mm_storeu_ps(velocity, _mm_or_ps(_mm_and_ps(mask, new_velocity), _mm_andnot_ps(mask, old_velocity)));
+        _mm_storeu_ps(delta, _mm_mul_ps(new_velocity, step));
+    };
+    for (; i + 4 <= count; i += 4)
+    {
+        Integrate4(&mLinearVelocityX[i], &mLinearAccelerationX[i], &mEnabled[i], &mDeltaX[i]);
+        Integrate4(&mLinearVelocityY[i], &mLinearAccelerationY[i], &mEnabled[i], &mDeltaY[i]);
+        Integrate4(&mAngularVelocity[i], &mAngularAcceleration[i], &mEnabled[i], &mDeltaRotation[i]);
+    }
+#elif defined(GAME_TRANSFORMER_SIMD_WASM)
+    const v128_t step = wasm_f32x4_splat(dt);
+    const auto Integrate4 = [step](float* velocity, const float* acceleration, const std::uint32_t* enabled, float* delta) {
+        const v128_t mask = wasm_v128_load(enabled);
+        const v128_t old_velocity = wasm_v128_load(velocity);
+        const v128_t new_velocity = wasm_f32x4_add(old_velocity, wasm_f32x4_mul(wasm_v128_load(acceleration), step));
+        wasm_v128_store(velocity, wasm_v128_bitselect(new_velocity, old_velocity, mask));
+        wasm_v128_store(delta, wasm_f32x4_mul(new_velocity, step));
+    };
+    for (; i + 4 <= count; i += 4)
+    {
+        Integrate4(&mLinearVelocityX[i], &mLinearAccelerationX[i], &mEnabled[i], &mDeltaX[i]);
+        Integrate4(&mLinearVelocityY[i], &mLinearAccelerationY[i], &mEnabled[i], &mDeltaY[i]);
+        Integrate4(&mAngularVelocity[i], &mAngularAcceleration[i], &mEnabled[i], &mDeltaRotation[i]);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        if (!mEnabled[i])
+            continue;
+        mLinearVelocityX[i] += mLinearAccelerationX[i] * dt;
+        mLinearVelocityY[i] += mLinearAccelerationY[i] * dt;
+        mAngularVelocity[i] += mAngularAcceleration[i] * dt;
+        mDeltaX[i] = mLinearVelocityX[i] * dt;
+        mDeltaY[i] = mLinearVelocityY[i] * dt;
+        mDeltaRotation[i] = mAngularVelocity[i] * dt;
+    }
+
+    // the node transforms are scattered in the entity node allocator
+    // so the final update is done one node at a time.
+    for (i=0; i<count; ++i)
+    {
+        if (!mEnabled[i])
+            continue;
+        auto* transform = mTransforms[i];
+        transform->Rotate(mDeltaRotation[i]);
+        transform->Translate(mDeltaX[i], mDeltaY[i]);
+    }
+}
+
 } // namespace
\ No newline at end of file
@@ -21,9 +21,13 @@
 #include "warnpush.h"
 #include "warnpop.h"
 
+#include <algorithm>
 #include <memory>
 #include <set>
 #include <vector>
+#include <unordered_map>
+#include <limits>
+#include <cmath>
 #include <cstddef>
 
 #include "base/grid.h"
@@ -34,6 +38,66 @@
 
 namespace game
 {
+    template<typename T>
+    class SpatialIndex;
+
+    // Result container for spatial index queries that can be reused
+    // across queries. The buffers keep their capacity so once they
+    // have grown to the working size the queries don't allocate.
+    // Each object is stored only once per query. A batch query stores
+    // the results of each query consecutively and the results of a
+    // single query can be accessed by the query index.
+    template<typename T>
+    class SpatialQueryResult
+    {
+    public:
+        struct Hit {
+            T* object = nullptr;
+            // The distance from the query origin to the object's rectangle.
+            // The origin is the query point, the center of the query
+            // rectangle or the start of the query line.
+            float distance = 0.0f;
+        };
+        using const_iterator = typename std::vector<Hit>::const_iterator;
+
+        inline void Clear() noexcept
+        {
+            mHits.clear();
+            mQueries.clear();
+        }
+        inline bool IsEmpty() const noexcept
+        { return mHits.empty(); }
+        inline std::size_t GetSize() const noexcept
+        { return mHits.size(); }
+        inline T* GetObject(std::size_t index) const noexcept
+        { return base::SafeIndex(mHits, index).object; }
+        inline float GetDistance(std::size_t index) const noexcept
+        { return base::SafeIndex(mHits, index).distance; }
+        inline const Hit& operator[](std::size_t index) const noexcept
+        { return base::SafeIndex(mHits, index); }
+        inline const_iterator begin() const noexcept
+        { return mHits.begin(); }
+        inline const_iterator end() const noexcept
+        { return mHits.end(); }
+
+        // Get the number of queries whose results are stored.
+        inline std::size_t GetNumQueries() const noexcept
+        { return mQueries.size(); }
+        // Get the index of the first hit of the query.
+        inline std::size_t GetQueryBegin(std::size_t query) const noexcept
+        { return query ? base::SafeIndex(mQueries, query-1) : 0; }
+        // Get the number of hits of the query.
+        inline std::size_t GetQuerySize(std::size_t query) const noexcept
+        { return base::SafeIndex(mQueries, query) - GetQueryBegin(query); }
+    private:
+        friend class SpatialIndex<T>;
+        std::vector<Hit> mHits;
+        // the end index of the hits of each query.
+        std::vector<std::size_t> mQueries;
+        // the raw (possibly duplicate) objects found by the index.
+        std::vector<T*> mFound;
+    };
+
     template<typename T>
     class SpatialIndex
     {
@@ -44,8 +108,20 @@ namespace game
         };
 
         virtual ~SpatialIndex() = default;
+        // Rebuild the whole index with the given items in the space
+        // defined by the given rectangle.
         virtual void Insert(const FRect& rect, const std::vector<Item>& items) = 0;
+        // Incrementally update the index with items that have been added
+        // or have moved since they were last inserted. If any item falls
+        // outside the current index space nothing is updated and false
+        // is returned. The index then needs to be rebuilt with Insert.
+        virtual bool Update(const std::vector<Item>& items) = 0;
+        // Erase the given objects from the index.
         virtual void Erase(const std::set<T*>& killset) = 0;
+        // Get the rectangle that defines the current index space.
+        virtual FRect GetRect() const = 0;
+        // Get the number of objects in the index.
+        virtual std::size_t GetNumItems() const = 0;
 
         // Query interface functions for specific query parameters
         // and result container types.
@@ -94,6 +170,54 @@ namespace game
         inline void Query(const FPoint& a, const FPoint& b, std::vector<const T*>* result, QueryMode mode)
         { ExecuteQuery(LineQuery<std::vector<const T*>>(a, b, mode, result)); }
 
+        // Query interface functions that store the results in a reusable
+        // result container. Any previous results are cleared first. The
+        // results are in no particular order unless they are ordered by
+        // distance from the query origin.
+        enum class QueryOrder {
+            None, Distance
+        };
+        using QueryResult = SpatialQueryResult<T>;
+
+        inline void Query(const FRect& area, QueryResult* result, QueryOrder order = QueryOrder::None) const
+        { QueryBatch(&area, 1, result, QueryMode::All, order); }
+        inline void Query(const FPoint& point, QueryResult* result, QueryMode mode, QueryOrder order = QueryOrder::None) const
+        { QueryBatch(&point, 1, result, mode, order); }
+        inline void Query(const FPoint& point, float radius, QueryResult* result, QueryMode mode, QueryOrder order = QueryOrder::None) const
+        {
+            const FCircle circle(point, radius);
+            QueryBatch(&circle, 1, result, mode, order);
+        }
+        inline void Query(const FPoint& a, const FPoint& b, QueryResult* result, QueryMode mode, QueryOrder order = QueryOrder::None) const
+        {
+            const FLine line(a, b);
+            QueryBatch(&line, 1, result, mode, order);
+        }
+
+        // Batch query interface functions. Answer all the queries with
+        // a single call into the index and store the results of each
+        // query in the result container in the query order.
+        inline void Query(const std::vector<FRect>& areas, QueryResult* result, QueryOrder order = QueryOrder::None) const
+        { QueryBatch(areas.data(), areas.size(), result, QueryMode::All, order); }
+        inline void Query(const std::vector<FPoint>& points, QueryResult* result, QueryMode mode, QueryOrder order = QueryOrder::None) const
+        { QueryBatch(points.data(), points.size(), result, mode, order); }
+        inline void Query(const std::vector<FCircle>& circles, QueryResult* result, QueryMode mode, QueryOrder order = QueryOrder::None) const
+        { QueryBatch(circles.data(), circles.size(), result, mode, order); }
+
+        // Find the k objects whose rectangles are nearest to the point
+        // and no further than the maximum distance. The results are
+        // ordered by distance.
+        inline void QueryNearest(const FPoint& point, unsigned k, QueryResult* result,
+                                 float max_distance = std::numeric_limits<float>::max()) const
+        { QueryNearest(&point, 1, k, result, max_distance); }
+        inline void QueryNearest(const std::vector<FPoint>& points, unsigned k, QueryResult* result,
+                                 float max_distance = std::numeric_limits<float>::max()) const
+        { QueryNearest(points.data(), points.size(), k, result, max_distance); }
+
+        // Get the rectangle the object was last inserted with.
+        // Returns nullptr if the object is not in the index.
+        virtual const FRect* FindObjectRect(const T* object) const = 0;
+
     protected:
         class SpatialQuery {
         public:
@@ -102,6 +226,229 @@ namespace game
             virtual void Execute(const base::DenseSpatialGrid<T*>& grid) const = 0;
         private:
         };
+
+        static float GetDistance(const FPoint& point, const FRect& rect) noexcept
+        {
+            const auto x = point.GetX();
+            const auto y = point.GetY();
+            const auto dx = std::max(std::max(rect.GetX() - x, 0.0f), x - (rect.GetX() + rect.GetWidth()));
+            const auto dy = std::max(std::max(rect.GetY() - y, 0.0f), y - (rect.GetY() + rect.GetHeight()));
+            return std::sqrt(dx*dx + dy*dy);
+        }
+        static FPoint GetOrigin(const FRect& rect) noexcept
+        { return rect.GetCenter(); }
+        static FPoint GetOrigin(const FPoint& point) noexcept
+        { return point; }
+        static FPoint GetOrigin(const FCircle& circle) noexcept
+        { return circle.GetCenter(); }
+        static FPoint GetOrigin(const FLine& line) noexcept
+        { return line.GetPointA(); }
+
+        static base::QuadTreeQueryMode MapQuadTreeMode(QueryMode mode) noexcept
+        {
+            if (mode == QueryMode::Closest)
+                return base::QuadTreeQueryMode::Closest;
+            else if (mode == QueryMode::First)
+                return base::QuadTreeQueryMode::First;
+            return base::QuadTreeQueryMode::All;
+        }
+        static typename base::DenseSpatialGrid<T*>::FindMode MapGridMode(QueryMode mode) noexcept
+        {
+            using FindMode = typename base::DenseSpatialGrid<T*>::FindMode;
+            if (mode == QueryMode::Closest)
+                return FindMode::Closest;
+            else if (mode == QueryMode::First)
+                return FindMode::First;
+            return FindMode::All;
+        }
+
+        static void Find(const FRect& rect, const base::QuadTree<T*>& tree, QueryMode, std::vector<T*>* found)
+        { QueryQuadTree(rect, tree, found); }
+        static void Find(const FPoint& point, const base::QuadTree<T*>& tree, QueryMode mode, std::vector<T*>* found)
+        { QueryQuadTree(point, tree, found, MapQuadTreeMode(mode)); }
+        static void Find(const FCircle& circle, const base::QuadTree<T*>& tree, QueryMode mode, std::vector<T*>* found)
+        { QueryQuadTree(circle.GetCenter(), circle.GetRadius(), tree, found, MapQuadTreeMode(mode)); }
+        static void Find(const FLine& line, const base::QuadTree<T*>& tree, QueryMode mode, std::vector<T*>* found)
+        { QueryQuadTree(line.GetPointA(), line.GetPointB(), tree, found, MapQuadTreeMode(mode)); }
+        static void Find(const FRect& rect, const base::DenseSpatialGrid<T*>& grid, QueryMode, std::vector<T*>* found)
+        { grid.Find(rect, found); }
+        static void Find(const FPoint& point, const base::DenseSpatialGrid<T*>& grid, QueryMode mode, std::vector<T*>* found)
+        { grid.Find(point, found, MapGridMode(mode)); }
+        static void Find(const FCircle& circle, const base::DenseSpatialGrid<T*>& grid, QueryMode mode, std::vector<T*>* found)
+        { grid.Find(circle.GetCenter(), circle.GetRadius(), found, MapGridMode(mode)); }
+        static void Find(const FLine& line, const base::DenseSpatialGrid<T*>& grid, QueryMode mode, std::vector<T*>* found)
+        { grid.Find(line.GetPointA(), line.GetPointB(), found, MapGridMode(mode)); }
+
+        // Move the objects found by the index into the result hits
+        // removing any duplicates and computing the distances when
+        // the results need to be ordered.
+        void StoreHits(const FPoint& origin, QueryOrder order, QueryResult* result) const
+        {
+            auto& found = result->mFound;
+            auto& hits  = result->mHits;
+            std::sort(found.begin(), found.end());
+            found.erase(std::unique(found.begin(), found.end()), found.end());
+
+            const auto first = hits.size();
+            for (auto* object : found)
+            {
+                typename QueryResult::Hit hit;
+                hit.object = object;
+                if (order == QueryOrder::Distance)
+                {
+                    if (const auto* rect = FindObjectRect(object))
+                        hit.distance = GetDistance(origin, *rect);
+                }
+                hits.push_back(hit);
+            }
+            if (order == QueryOrder::Distance)
+            {
+                std::sort(hits.begin() + first, hits.end(), [](const auto& lhs, const auto& rhs) {
+                    return lhs.distance < rhs.distance;
+                });
+            }
+            result->mQueries.push_back(hits.size());
+        }
+
+        template<typename Shape>
+        class BatchQuery final : public SpatialQuery {
+        public:
+            BatchQuery(const SpatialIndex* index, const Shape* shapes, std::size_t count,
+                       QueryMode mode, QueryOrder order, QueryResult* result)
+              : mIndex(index)
+              , mShapes(shapes)
+              , mCount(count)
+              , mMode(mode)
+              , mOrder(order)
+              , mResult(result)
+            {}
+            virtual void Execute(const base::QuadTree<T*>& tree) const override
+            { ExecuteBatch(tree); }
+            virtual void Execute(const base::DenseSpatialGrid<T*>& grid) const override
+            { ExecuteBatch(grid); }
+        private:
+            template<typename Index>
+            void ExecuteBatch(const Index& index) const
+            {
+                for (std::size_t i=0; i<mCount; ++i)
+                {
+                    mResult->mFound.clear();
+                    Find(mShapes[i], index, mMode, &mResult->mFound);
+                    mIndex->StoreHits(GetOrigin(mShapes[i]), mOrder, mResult);
+                }
+            }
+        private:
+            const SpatialIndex* mIndex;
+            const Shape* mShapes;
+            const std::size_t mCount;
+            const QueryMode mMode;
+            const QueryOrder mOrder;
+            QueryResult* mResult;
+        };
+
+        class NearestQuery final : public SpatialQuery {
+        public:
+            NearestQuery(const SpatialIndex* index, const FPoint* points, std::size_t count,
+                         unsigned k, float max_distance, QueryResult* result)
+              : mIndex(index)
+              , mPoints(points)
+              , mCount(count)
+              , mCapacity(k)
+              , mMaxDistance(max_distance)
+              , mResult(result)
+            {}
+            virtual void Execute(const base::QuadTree<T*>& tree) const override
+            { ExecuteBatch(tree); }
+            virtual void Execute(const base::DenseSpatialGrid<T*>& grid) const override
+            { ExecuteBatch(grid); }
+        private:
+            template<typename Index>
+            void ExecuteBatch(const Index& index) const
+            {
+                const auto& space = mIndex->GetRect();
+                const auto num_items = mIndex->GetNumItems();
+                auto& hits = mResult->mHits;
+
+                for (std::size_t i=0; i<mCount; ++i)
+                {
+                    const auto& point = mPoints[i];
+                    const auto first = hits.size();
+                    if (mCapacity == 0 || num_items == 0)
+                    {
+                        mResult->mQueries.push_back(first);
+                        continue;
+                    }
+                    // no object can be further away than the furthest corner
+                    // of the index space.
+                    const auto max_x = std::max(std::abs(point.GetX() - space.GetX()),
+                                                std::abs(point.GetX() - space.GetX() - space.GetWidth()));
+                    const auto max_y = std::max(std::abs(point.GetY() - space.GetY()),
+                                                std::abs(point.GetY() - space.GetY() - space.GetHeight()));
+                    const auto max_radius = std::min(mMaxDistance, std::sqrt(max_x*max_x + max_y*max_y));
+
+                    // start with a circle that would contain k objects if
+                    // the objects were evenly distributed and grow it until
+                    // it contains at least k objects. any object outside the
+                    // circle is further away than any object inside it.
+                    const auto area = std::max(space.GetWidth() * space.GetHeight(), 1.0f);
+                    auto radius = std::min(std::sqrt(area * mCapacity / (num_items * 3.14159f)), max_radius);
+                    while (true)
+                    {
+                        hits.resize(first);
+                        mResult->mFound.clear();
+                        Find(FCircle(point, radius), index, QueryMode::All, &mResult->mFound);
+                        mIndex->StoreHits(point, QueryOrder::None, mResult);
+                        mResult->mQueries.pop_back();
+
+                        std::size_t count = 0;
+                        for (auto it = hits.begin() + first; it != hits.end(); ++it)
+                        {
+                            const auto* rect = mIndex->FindObjectRect(it->object);
+                            it->distance = rect ? GetDistance(point, *rect) : 0.0f;
+                            if (it->distance <= radius)
+                                ++count;
+                        }
+                        if (count >= mCapacity || radius >= max_radius)
+                            break;
+                        radius = std::min(radius * 2.0f, max_radius);
+                    }
+
+                    const auto ByDistance = [](const auto& lhs, const auto& rhs) {
+                        return lhs.distance < rhs.distance;
+                    };
+                    const auto end = std::remove_if(hits.begin() + first, hits.end(), [radius](const auto& hit) {
+                        return hit.distance > radius;
+                    });
+                    hits.erase(end, hits.end());
+                    if (hits.size() - first > mCapacity)
+                    {
+                        std::nth_element(hits.begin() + first, hits.begin() + first + mCapacity, hits.end(), ByDistance);
+                        hits.resize(first + mCapacity);
+                    }
+                    std::sort(hits.begin() + first, hits.end(), ByDistance);
+                    mResult->mQueries.push_back(hits.size());
+                }
+            }
+        private:
+            const SpatialIndex* mIndex;
+            const FPoint* mPoints;
+            const std::size_t mCount;
+            const unsigned mCapacity;
+            const float mMaxDistance;
+            QueryResult* mResult;
+        };
+
+        template<typename Shape>
+        void QueryBatch(const Shape* shapes, std::size_t count, QueryResult* result, QueryMode mode, QueryOrder order) const
+        {
+            result->Clear();
+            ExecuteQuery(BatchQuery<Shape>(this, shapes, count, mode, order, result));
+        }
+        void QueryNearest(const FPoint* points, std::size_t count, unsigned k, QueryResult* result, float max_distance) const
+        {
+            result->Clear();
+            ExecuteQuery(NearestQuery(this, points, count, k, max_distance, result));
+        }
         template<typename ResultContainer>
         class RectangleQuery final : public SpatialQuery {
         public:
@@ -237,15 +584,61 @@ namespace game
             // todo: find some way to balance the tree ?
             mTree.Clear();
             mTree.Reshape(rect, mMaxItems, mMaxLevels);
+            mRects.clear();
             for (const auto& item : items)
+            {
                 mTree.Insert(item.rect, item.object);
+                mRects[item.object] = item.rect;
+            }
+        }
+        virtual bool Update(const std::vector<Item>& items) override
+        {
+            // the quadtree would silently drop any part of the object
+            // that is outside the root rect.
+            const auto& space = mTree->GetRect();
+            for (const auto& item : items)
+            {
+                if (!base::Contains(space, item.rect))
+                    return false;
+            }
+            for (const auto& item : items)
+            {
+                auto it = mRects.find(item.object);
+                if (it == mRects.end())
+                {
+                    mTree.Insert(item.rect, item.object);
+                    mRects[item.object] = item.rect;
+                }
+                else
+                {
+                    mTree.Move(it->second, item.rect, item.object);
+                    it->second = item.rect;
+                }
+            }
+            return true;
         }
 
         virtual void Erase(const std::set<T*>& killset) override
         {
-            mTree.Erase([&killset](T* object, const base::FRect&) {
-                return base::Contains(killset, object);
-            });
+            for (auto* object : killset)
+            {
+                auto it = mRects.find(object);
+                if (it == mRects.end())
+                    continue;
+                mTree.Erase(it->second, [object](T* other, const base::FRect&) {
+                    return other == object;
+                });
+                mRects.erase(it);
+            }
+        }
+        virtual FRect GetRect() const override
+        { return mTree->GetRect(); }
+        virtual std::size_t GetNumItems() const override
+        { return mRects.size(); }
+        virtual const FRect* FindObjectRect(const T* object) const override
+        {
+            auto it = mRects.find(const_cast<T*>(object));
+            return it == mRects.end() ? nullptr : &it->second;
         }
     protected:
         using SpatialQuery = typename SpatialIndex<T>::SpatialQuery;
@@ -255,6 +648,8 @@ namespace game
         const unsigned mMaxItems = 0;
         const unsigned mMaxLevels = 0;
         QuadTree<T*> mTree;
+        // the rectangle each object was last inserted with.
+        std::unordered_map<T*, FRect> mRects;
     };
 
     template<typename T>
@@ -273,15 +668,62 @@ namespace game
             // todo: find some way to balance the grid ?
             mGrid.Clear();
             mGrid.Reshape(rect, mNumRows, mNumCols);
+            mRects.clear();
             for (const auto& item : items)
-                mGrid.Insert(item.rect, item.object);
+            {
+                if (mGrid.Insert(item.rect, item.object))
+                    mRects[item.object] = item.rect;
+            }
+        }
+        virtual bool Update(const std::vector<Item>& items) override
+        {
+            if (!mGrid.IsValid())
+                return false;
+
+            const auto& space = mGrid.GetRect();
+            for (const auto& item : items)
+            {
+                if (!base::Contains(space, item.rect))
+                    return false;
+            }
+            for (const auto& item : items)
+            {
+                auto it = mRects.find(item.object);
+                if (it == mRects.end())
+                {
+                    mGrid.Insert(item.rect, item.object);
+                    mRects[item.object] = item.rect;
+                }
+                else
+                {
+                    mGrid.Move(it->second, item.rect, item.object);
+                    it->second = item.rect;
+                }
+            }
+            return true;
         }
 
         virtual void Erase(const std::set<T*>& killset) override
         {
-            mGrid.Erase([&killset](T* object, const base::FRect& rect) {
-                return base::Contains(killset, object);
-            });
+            for (auto* object : killset)
+            {
+                auto it = mRects.find(object);
+                if (it == mRects.end())
+                    continue;
+                mGrid.Erase(it->second, [object](T* other, const base::FRect&) {
+                    return other == object;
+                });
+                mRects.erase(it);
+            }
+        }
+        virtual FRect GetRect() const override
+        { return mGrid.GetRect(); }
+        virtual std::size_t GetNumItems() const override
+        { return mRects.size(); }
+        virtual const FRect* FindObjectRect(const T* object) const override
+        {
+            auto it = mRects.find(const_cast<T*>(object));
+            return it == mRects.end() ? nullptr : &it->second;
         }
     protected:
         using SpatialQuery = typename SpatialIndex<T>::SpatialQuery;
@@ -291,6 +733,8 @@ namespace game
         const unsigned mNumRows = 0;
         const unsigned mNumCols = 0;
         base::DenseSpatialGrid<T*> mGrid;
+        // the rectangle each object was last inserted with.
+        std::unordered_map<T*, FRect> mRects;
     };
 
 } // namespace
@@ -72,6 +72,9 @@ namespace game
             // data object URI.
             std::string uri;
             bool read_only = false;
+            // The layer streams its data in chunks and doesn't
+            // need the whole data to be resident in memory.
+            bool streaming = false;
         };
         // Load the data for a tilemap layer based on the layer ID and the
         // associated data file URI. The read only flag indicates whether
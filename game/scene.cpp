@@ -21,6 +21,8 @@
 #include "warnpop.h"
 
 #include <unordered_set>
+#include <set>
+#include <tuple>
 #include <stack>
 
 #include "base/format.h"
@@ -28,14 +30,19 @@
 #include "base/threadpool.h"
 #include "base/trace.h"
 #include "base/hash.h"
+#include "base/metrics.h"
 #include "data/reader.h"
 #include "data/writer.h"
 #include "game/util.h"
 #include "game/scene.h"
+#include "game/scene_snapshot.h"
+#include "game/tilemap.h"
 #include "game/entity.h"
+#include "game/animation.h"
 #include "game/treeop.h"
 #include "game/transform.h"
 #include "game/entity_node_spatial_node.h"
+#include "game/entity_node_transformer.h"
 
 namespace {
 template<typename Result, typename Entity, typename Node>
@@ -182,8 +189,15 @@ Scene::Scene(std::shared_ptr<const SceneClass> klass)
         entity_placement_map[&placement] = entity.get();
         mIdMap[entity->GetId()] = entity.get();
         mNameMap[entity->GetName()] = entity.get();
+        index_entity(entity.get());
         mEntities.push_back(std::move(entity));
     }
+    mTransformerBatch = std::make_unique<NodeTransformerBatch>();
+    for (auto& entity : mEntities)
+    {
+        attach_transformers(*entity);
+    }
+    mAnimationBatch = std::make_unique<AnimationBatch>();
     mRenderTree.FromTree(mClass->GetRenderTree(), [&entity_placement_map](const EntityPlacement* placement) {
         return entity_placement_map[placement];
     });
@@ -245,49 +259,44 @@ Entity* Scene::FindEntityByInstanceName(const std::string& name)
         return nullptr;
     return it->second;
 }
-std::vector<Entity*> Scene::ListEntitiesByClassName(const std::string& name)
+Scene::EntityList Scene::ListEntitiesByClassName(const std::string& name)
 {
-    std::vector<Entity*> ret;
-    for (auto& entity : mEntities)
-    {
-        if (entity->GetClassName() == name)
-            ret.push_back(entity.get());
-    }
-    return ret;
+    static const std::vector<Entity*> none;
+    auto it = mClassNameMap.find(name);
+    if (it == mClassNameMap.end())
+        return EntityList(&none);
+    return EntityList(&it->second);
 }
 
-std::vector<const Entity*> Scene::ListEntitiesByClassName(const std::string& name) const
+Scene::ConstEntityList Scene::ListEntitiesByClassName(const std::string& name) const
 {
-    std::vector<const Entity*> ret;
-    for (auto& entity : mEntities)
-    {
-        if (entity->GetClassName() == name)
-            ret.push_back(entity.get());
-    }
-    return ret;
+    static const std::vector<Entity*> none;
+    auto it = mClassNameMap.find(name);
+    if (it == mClassNameMap.end())
+        return ConstEntityList(&none);
+    return ConstEntityList(&it->second);
 }
 
-std::vector<Entity*> Scene::ListEntitiesByTag(const std::string& tag)
+void Scene::IndexEntityTag(const std::string& tag)
 {
-    std::vector<Entity*> ret;
-    for (auto& entity : mEntities)
+    if (mTagMap.find(tag) != mTagMap.end())
+        return;
+
+    auto& entities = mTagMap[tag];
+    for (const auto& entity : mEntities)
     {
-        const auto& tag_string = entity->GetTag();
-        if (base::Contains(tag_string, tag))
-            ret.push_back(entity.get());
+        if (base::Contains(entity->GetTag(), tag))
+            entities.push_back(entity.get());
     }
-    return ret;
 }
-std::vector<const Entity*> Scene::ListEntitiesByTag(const std::string& tag) const
+
+Scene::EntityList Scene::ListEntitiesByTag(const std::string& tag)
 {
-    std::vector<const Entity*> ret;
-    for (auto& entity : mEntities)
-    {
-        const auto& tag_string = entity->GetTag();
-        if (base::Contains(tag_string, tag))
-            ret.push_back(entity.get());
-    }
-    return ret;
+    return EntityList(find_entities_by_tag(tag));
+}
+Scene::ConstEntityList Scene::ListEntitiesByTag(const std::string& tag) const
+{
+    return ConstEntityList(find_entities_by_tag(tag));
 }
 
 const Entity& Scene::GetEntity(size_t index) const
@@ -375,7 +384,7 @@ Entity* Scene::SpawnEntity(const EntityArgs& args, bool link_to_root)
     // we must have the klass of the entity and an id.
     // the invariant that must hold is that entity IDs are
     // always going to be unique.
-    auto instance = CreateEntityInstance(args);
+    auto instance = create_entity(args);
     instance->SetScene(this);
     if (instance->HasIdleTrack())
     {
@@ -394,8 +403,409 @@ Entity* Scene::SpawnEntity(const EntityArgs& args, bool link_to_root)
     return mSpawnList.back().instance.get();
 }
 
+void Scene::SetEntityPoolCapacity(std::size_t capacity)
+{
+    mEntityPoolCapacity = capacity;
+
+    // shrink the pools that are now over the capacity. pre-warmed
+    // pools keep their capacity.
+    for (auto it = mEntityPools.begin(); it != mEntityPools.end();)
+    {
+        auto& pool = it->second;
+        pool.capacity = std::max(pool.capacity, capacity);
+        if (pool.entities.size() > pool.capacity)
+            pool.entities.resize(pool.capacity);
+        if (pool.capacity == 0)
+            it = mEntityPools.erase(it);
+        else ++it;
+    }
+}
+
+void Scene::PrewarmEntityPool(std::shared_ptr<const EntityClass> klass, std::size_t count)
+{
+    TRACE_SCOPE("Scene::PrewarmEntityPool");
+
+    ASSERT(klass);
+    auto& pool = mEntityPools[klass.get()];
+    pool.klass    = klass;
+    pool.capacity = std::max(pool.capacity, std::max(count, mEntityPoolCapacity));
+
+    pool.entities.reserve(count);
+    while (pool.entities.size() < count)
+    {
+        pool.entities.push_back(CreateEntityInstance(klass));
+        pool.entities.back()->ReleaseNodeData();
+    }
+}
+
+void Scene::ClearEntityPool()
+{
+    mEntityPools.clear();
+}
+
+Scene::EntityPoolStats Scene::GetEntityPoolStats() const
+{
+    EntityPoolStats stats;
+    stats.hits   = mEntityPoolHits;
+    stats.misses = mEntityPoolMisses;
+    for (const auto& [klass, pool] : mEntityPools)
+    {
+        stats.pooled += pool.entities.size();
+    }
+    return stats;
+}
+
+void Scene::CaptureSnapshot(SceneSnapshot* snapshot, std::shared_ptr<const SceneSnapshot> base) const
+{
+    TRACE_SCOPE("Scene::CaptureSnapshot");
+
+    auto& buffer = snapshot->mBuffer;
+    buffer.clear();
+    // patch a previously written placeholder size/count value.
+    const auto patch = [&buffer](std::size_t offset, std::uint32_t value) {
+        std::memcpy(buffer.data() + offset, &value, sizeof(value));
+    };
+
+    SnapshotWriter writer(&buffer);
+    writer.Write(SceneSnapshot::Magic);
+    writer.Write(SceneSnapshot::Version);
+    writer.Write(static_cast<std::uint8_t>(base != nullptr));
+    writer.Write(mCurrentTime);
+
+    const auto scene_state_offset = writer.GetSize();
+    writer.Write(std::uint32_t(0));
+    writer.Write(static_cast<std::uint32_t>(mScriptVars.size()));
+    for (const auto& var : mScriptVars)
+    {
+        writer.Write(var.GetId());
+        writer.Write(var.GetVariantValue());
+    }
+    patch(scene_state_offset, writer.GetSize() - scene_state_offset - sizeof(std::uint32_t));
+
+    const auto entity_count_offset = writer.GetSize();
+    std::uint32_t entity_count = 0;
+    writer.Write(entity_count);
+    for (const auto& entity : mEntities)
+    {
+        if (entity->HasBeenKilled() || base::Contains(mKillSet, entity.get()))
+            continue;
+
+        writer.Write(entity->GetId());
+        const auto stored_offset = writer.GetSize();
+        writer.Write(std::uint8_t(1));
+        writer.Write(std::uint32_t(0));
+        const auto record_offset = writer.GetSize();
+        entity->IntoSnapshot(writer);
+        const auto record_size = writer.GetSize() - record_offset;
+
+        // drop the record when the base has an identical record.
+        const auto* record = base ? base->FindEntity(entity->GetId()) : nullptr;
+        if (record && record->size == record_size &&
+            !std::memcmp(record->owner->mBuffer.data() + record->offset, buffer.data() + record_offset, record_size))
+        {
+            buffer.resize(stored_offset);
+            writer.Write(std::uint8_t(0));
+        }
+        else patch(record_offset - sizeof(std::uint32_t), record_size);
+        ++entity_count;
+    }
+    patch(entity_count_offset, entity_count);
+
+    const auto layer_count = mMap ? mMap->GetNumLayers() : 0;
+    writer.Write(static_cast<std::uint32_t>(layer_count));
+    for (size_t i=0; i<layer_count; ++i)
+    {
+        writer.Write(mMap->GetLayer(i).GetRevision());
+    }
+
+    const auto block_count_offset = writer.GetSize();
+    std::uint32_t block_count = 0;
+    writer.Write(block_count);
+    std::vector<URect> blocks;
+    for (size_t i=0; i<layer_count; ++i)
+    {
+        const auto& layer = mMap->GetLayer(i);
+        const auto& klass = layer.GetClass();
+        // the layer revision goes back to 0 when the layer is reloaded
+        // after which the base revision no longer applies.
+        std::uint64_t revision = 0;
+        if (base && i < base->mLayerRevisions.size() && base->mLayerRevisions[i] <= layer.GetRevision())
+            revision = base->mLayerRevisions[i];
+
+        blocks.clear();
+        layer.ListModifiedBlocks(revision, &blocks);
+
+        const std::uint8_t components = (klass.HasRenderComponent() ? 1 : 0) |
+                                        (klass.HasDataComponent() ? 2 : 0);
+        for (const auto& block : blocks)
+        {
+            writer.Write(static_cast<std::uint32_t>(i));
+            writer.Write(static_cast<std::uint32_t>(block.GetX()));
+            writer.Write(static_cast<std::uint32_t>(block.GetY()));
+            writer.Write(static_cast<std::uint32_t>(block.GetWidth()));
+            writer.Write(static_cast<std::uint32_t>(block.GetHeight()));
+            writer.Write(components);
+            for (unsigned row=block.GetY(); row<block.GetY() + block.GetHeight(); ++row)
+            {
+                for (unsigned col=block.GetX(); col<block.GetX() + block.GetWidth(); ++col)
+                {
+                    if (components & 1)
+                    {
+                        std::uint8_t index = 0;
+                        layer.GetTilePaletteIndex(&index, row, col);
+                        writer.Write(index);
+                    }
+                    if (components & 2)
+                    {
+                        std::int32_t value = 0;
+                        layer.GetTileValue(&value, row, col);
+                        writer.Write(value);
+                    }
+                }
+            }
+            ++block_count;
+        }
+    }
+    patch(block_count_offset, block_count);
+
+    snapshot->mBase = std::move(base);
+    const bool ret = snapshot->ReadIndex();
+    ASSERT(ret);
+}
+
+bool Scene::RestoreSnapshot(const SceneSnapshot& snapshot, const EntityClassLookup& lookup)
+{
+    TRACE_SCOPE("Scene::RestoreSnapshot");
+
+    bool success = true;
+
+    // restore the time first so that the re-spawned
+    // entities are placed in the scene on the next loop.
+    mCurrentTime = snapshot.GetSceneTime();
+
+    SnapshotReader scene_state(snapshot.mBuffer.data() + snapshot.mSceneStateOffset,
+                               snapshot.mBuffer.size() - snapshot.mSceneStateOffset);
+    std::uint32_t var_count = 0;
+    scene_state.Read(&var_count);
+    for (std::uint32_t i=0; i<var_count; ++i)
+    {
+        std::string id;
+        ScriptVar::VariantType value;
+        if (!scene_state.Read(&id) || !scene_state.Read(&value))
+        {
+            success = false;
+            break;
+        }
+        auto it = std::find_if(mScriptVars.begin(), mScriptVars.end(), [&id](const auto& var) {
+            return var.GetId() == id;
+        });
+        if (it != mScriptVars.end() && ScriptVar::GetTypeFromVariant(value) == it->GetType())
+            it->SetData(std::move(value));
+    }
+
+    // the entity classes of the entities currently in the scene for
+    // re-spawning the entities that have been killed since.
+    std::unordered_map<std::string, std::shared_ptr<const EntityClass>> classes;
+    for (const auto& entity : mEntities)
+    {
+        classes[entity->GetClassId()] = entity->GetSharedClass();
+    }
+    for (const auto& [klass, pool] : mEntityPools)
+    {
+        classes[klass->GetId()] = pool.klass;
+    }
+
+    // kill the entities that didn't exist when the snapshot was captured.
+    // any child entity that did exist is moved to the root first so that
+    // it's not killed with its parent.
+    for (auto& entity : mEntities)
+    {
+        if (snapshot.HasEntity(entity->GetId()))
+        {
+            // resurrect the entities that were killed after the capture.
+            mKillSet.erase(entity.get());
+            entity->SetFlag(Entity::ControlFlags::Killed, false);
+            entity->SetFlag(Entity::ControlFlags::WantsToDie, false);
+            continue;
+        }
+        if (entity->HasBeenKilled())
+            continue;
+        std::vector<Entity*> children;
+        mRenderTree.ForEachChild([&children](Entity* child) {
+            children.push_back(child);
+        }, entity.get());
+        for (auto* child : children)
+        {
+            if (snapshot.HasEntity(child->GetId()))
+                mRenderTree.ReparentChild(nullptr, child);
+        }
+        entity->SetFlag(Entity::ControlFlags::Killed, true);
+        mKillSet.erase(entity.get());
+    }
+    base::EraseRemove(mSpawnList, [&snapshot](const auto& spawn) {
+        return !snapshot.HasEntity(spawn.instance->GetId());
+    });
+
+    for (const auto& record : snapshot.GetEntities())
+    {
+        SnapshotReader reader(record.owner->mBuffer.data() + record.offset, record.size);
+
+        Entity* entity = nullptr;
+        if (auto it = mIdMap.find(record.id); it != mIdMap.end())
+            entity = it->second;
+        else
+        {
+            for (auto& spawn : mSpawnList)
+            {
+                if (spawn.instance->GetId() == record.id)
+                    entity = spawn.instance.get();
+            }
+        }
+        if (entity == nullptr)
+        {
+            std::string class_id;
+            SnapshotReader(reader).Read(&class_id);
+            std::shared_ptr<const EntityClass> klass;
+            if (const auto* known = base::SafeFind(classes, class_id))
+                klass = *known;
+            else if (lookup)
+                klass = lookup(class_id);
+            if (!klass)
+            {
+                ERROR("Failed to restore scene entity. No such entity class. [entity='%1', class='%2']", record.id, class_id);
+                success = false;
+                continue;
+            }
+            EntityArgs args;
+            args.klass = klass;
+            args.id    = record.id;
+            args.enable_logging = false;
+            entity = SpawnEntity(args, true);
+            classes[class_id] = std::move(klass);
+        }
+
+        const auto name = entity->GetName();
+        if (!entity->FromSnapshot(reader) || !reader.IsEnd())
+        {
+            ERROR("Failed to restore scene entity state. [entity='%1']", record.id);
+            success = false;
+            continue;
+        }
+        if (entity->GetName() != name && base::Contains(mIdMap, entity->GetId()))
+        {
+            if (auto it = mNameMap.find(name); it != mNameMap.end() && it->second == entity)
+                mNameMap.erase(it);
+            mNameMap[entity->GetName()] = entity;
+        }
+    }
+
+    if (mMap == nullptr)
+        return success;
+
+    std::vector<const SceneSnapshot*> chain;
+    for (const auto* snap = &snapshot; snap; snap = snap->GetBase().get())
+        chain.push_back(snap);
+
+    // the snapshot chain has the tiles of every block written between
+    // loading the layer and capturing the snapshot. any other block that
+    // has been written after the capture had the tiles of the loaded
+    // layer data at capture and is reverted to those tiles.
+    std::set<std::tuple<std::uint32_t, unsigned, unsigned>> captured_blocks;
+    for (const auto* snap : chain)
+    {
+        for (const auto& block : snap->GetTileBlocks())
+            captured_blocks.insert({block.layer, block.rect.GetX(), block.rect.GetY()});
+    }
+    std::vector<URect> modified_blocks;
+    for (size_t i=0; i<mMap->GetNumLayers(); ++i)
+    {
+        auto& layer = mMap->GetLayer(i);
+        // the layer revision goes back to 0 when the layer is reloaded.
+        std::uint64_t revision = 0;
+        if (i < snapshot.mLayerRevisions.size() && snapshot.mLayerRevisions[i] <= layer.GetRevision())
+            revision = snapshot.mLayerRevisions[i];
+
+        modified_blocks.clear();
+        layer.ListModifiedBlocks(revision, &modified_blocks);
+        for (const auto& block : modified_blocks)
+        {
+            if (!base::Contains(captured_blocks, std::make_tuple(std::uint32_t(i), block.GetX(), block.GetY())))
+                layer.RevertBlock(block);
+        }
+    }
+
+    // apply the tile blocks starting from the oldest snapshot.
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    {
+        const auto* snap = *it;
+        for (const auto& block : snap->GetTileBlocks())
+        {
+            if (block.layer >= mMap->GetNumLayers())
+            {
+                success = false;
+                continue;
+            }
+            auto& layer = mMap->GetLayer(block.layer);
+            SnapshotReader reader(snap->mBuffer.data() + block.offset, snap->mBuffer.size() - block.offset);
+            for (unsigned row=block.rect.GetY(); row<block.rect.GetY() + block.rect.GetHeight(); ++row)
+            {
+                for (unsigned col=block.rect.GetX(); col<block.rect.GetX() + block.rect.GetWidth(); ++col)
+                {
+                    std::uint8_t index = 0;
+                    std::int32_t value = 0;
+                    if (block.components & 1)
+                    {
+                        reader.Read(&index);
+                        layer.SetTilePaletteIndex(index, row, col);
+                    }
+                    if (block.components & 2)
+                    {
+                        reader.Read(&value);
+                        layer.SetTileValue(value, row, col);
+                    }
+                }
+            }
+        }
+    }
+    return success;
+}
+
 void Scene::BeginLoop()
 {
+    // report the number of cached entity node matrices that were
+    // recomputed during the previous iteration of the game loop.
+    std::size_t recomputed_transforms = 0;
+    for (auto& entity : mEntities)
+    {
+        recomputed_transforms += entity->GetNumRecomputedTransforms();
+        entity->ResetNumRecomputedTransforms();
+    }
+    if (auto* metrics = base::GetGlobalMetrics(); metrics != mMetrics.registry)
+    {
+        mMetrics = Metrics {};
+        mMetrics.registry = metrics;
+        if (metrics)
+        {
+            mMetrics.transforms_recomputed       = &metrics->GetGauge("scene.transforms_recomputed");
+            mMetrics.total_transforms_recomputed = &metrics->GetCounter("scene.total_transforms_recomputed");
+            mMetrics.entity_pool_hits            = &metrics->GetGauge("scene.entity_pool_hits");
+            mMetrics.entity_pool_misses          = &metrics->GetGauge("scene.entity_pool_misses");
+            mMetrics.total_entity_pool_hits      = &metrics->GetCounter("scene.total_entity_pool_hits");
+            mMetrics.total_entity_pool_misses    = &metrics->GetCounter("scene.total_entity_pool_misses");
+        }
+    }
+    if (mMetrics.registry)
+    {
+        mMetrics.transforms_recomputed->SetValue(recomputed_transforms);
+        mMetrics.total_transforms_recomputed->Increment(recomputed_transforms);
+        mMetrics.entity_pool_hits->SetValue(mEntityPoolLoopHits);
+        mMetrics.entity_pool_misses->SetValue(mEntityPoolLoopMisses);
+        mMetrics.total_entity_pool_hits->Increment(mEntityPoolLoopHits);
+        mMetrics.total_entity_pool_misses->Increment(mEntityPoolLoopMisses);
+    }
+    mEntityPoolLoopHits   = 0;
+    mEntityPoolLoopMisses = 0;
+
     // turn on the kill flag for entities that were killed
     // during the last iteration of the game play.
     for (auto* entity : mKillSet)
@@ -437,7 +847,9 @@ void Scene::BeginLoop()
 
         mIdMap[entity->GetId()]     = entity.get();
         mNameMap[entity->GetName()] = entity.get();
+        index_entity(entity.get());
         mRenderTree.LinkChild(nullptr, entity.get());
+        attach_transformers(*entity);
         mEntities.push_back(std::move(entity));
     }
 
@@ -446,6 +858,11 @@ void Scene::BeginLoop()
     });
 
     mKillSet.clear();
+
+    // the scene tree topology is final for this iteration of the game
+    // loop. build the flat tree now instead of the first const traversal
+    // doing it lazily, possibly on several threads at once.
+    mRenderTree.RebuildFlatTree();
 }
 
 void Scene::EndLoop()
@@ -469,8 +886,11 @@ void Scene::EndLoop()
         if (entity->TestFlag(Entity::ControlFlags::EnableLogging))
             DEBUG("Entity '%1/%2' was deleted.", entity->GetClassName(), entity->GetName());
         mRenderTree.DeleteNode(entity.get());
+        mSpatialState.erase(entity.get());
+        detach_transformers(*entity);
         mIdMap.erase(entity->GetId());
         mNameMap.erase(entity->GetName());
+        mKilledEntities.push_back(entity.get());
 
         if (mSpatialIndex)
         {
@@ -485,20 +905,36 @@ void Scene::EndLoop()
     if (mSpatialIndex)
         mSpatialIndex->Erase(killed_spatial_nodes);
 
+    unindex_killed_entities(mKilledEntities);
+    mKilledEntities.clear();
+
+    // the killed entities have been removed from the scene tree.
+    // rebuild the flat tree before the renderer reads the scene.
+    mRenderTree.RebuildFlatTree();
+
+    // move the killed entities to the end of the entity list while
+    // keeping the order of the remaining entities. the killed entities
+    // go to the entity pool or get deleted.
+    auto it = std::stable_partition(mEntities.begin(), mEntities.end(), [](const auto& entity) {
+        return !entity->TestFlag(Entity::ControlFlags::Killed);
+    });
+    std::vector<std::unique_ptr<Entity>> carcasses;
+    for (auto carcass = it; carcass != mEntities.end(); ++carcass)
+    {
+        if (!recycle_entity(*carcass))
+            carcasses.push_back(std::move(*carcass));
+    }
+    mEntities.erase(it, mEntities.end());
+
+    if (carcasses.empty())
+        return;
+
     if (auto* task_pool = base::GetGlobalThreadPool())
     {
         // delete de-allocation to the task pool since allocation
         // is also there which means that the there might be a lock
         // on the entity node allocator which means the deletion
         // is blocked until the allocator is unlocked.
-        std::vector<std::unique_ptr<Entity>> carcasses;
-
-        auto it = std::remove_if(mEntities.begin(), mEntities.end(), [](const auto& entity) {
-            return entity->TestFlag(Entity::ControlFlags::Killed);
-        });
-        std::move(it, mEntities.end(), std::back_inserter(carcasses));
-        mEntities.erase(it, mEntities.end());
-
         class DeleteEntitiesTask : public base::ThreadTask {
         public:
             DeleteEntitiesTask(std::vector<std::unique_ptr<Entity>>&& carcasses)
@@ -516,13 +952,6 @@ void Scene::EndLoop()
         auto task = std::make_unique<DeleteEntitiesTask>(std::move(carcasses));
         task_pool->SubmitTask(std::move(task), base::ThreadPool::AnyWorkerThreadID);
     }
-    else
-    {
-        // delete the entities that were killed from the container
-        mEntities.erase(std::remove_if(mEntities.begin(), mEntities.end(), [](const auto& entity) {
-            return entity->TestFlag(Entity::ControlFlags::Killed);
-        }), mEntities.end());
-    }
 }
 
 std::vector<Scene::ConstSceneNode> Scene::CollectNodes() const
@@ -700,60 +1129,348 @@ const ScriptVar* Scene::FindScriptVarById(const std::string& id) const
     return mClass->FindScriptVarById(id);
 }
 
+void Scene::SetTransformerBatch(bool on_off)
+{
+    if (on_off == IsTransformerBatchEnabled())
+        return;
+
+    if (on_off)
+    {
+        mTransformerBatch = std::make_unique<NodeTransformerBatch>();
+        for (auto& entity : mEntities)
+        {
+            attach_transformers(*entity);
+        }
+    }
+    else
+    {
+        // the batch detaches the transformers and the entities
+        // go back to integrating their nodes themselves.
+        mTransformerBatch.reset();
+    }
+}
+
+void Scene::SetAnimationBatch(bool on_off)
+{
+    if (on_off == IsAnimationBatchEnabled())
+        return;
+
+    if (on_off)
+        mAnimationBatch = std::make_unique<AnimationBatch>();
+    else mAnimationBatch.reset();
+}
+
 void Scene::Update(float dt, std::vector<Event>* events)
 {
     mCurrentTime += dt;
 
+    // The entity update would integrate each node transformer before
+    // updating the animations etc. Since the entities are independent
+    // the same result is achieved by integrating all of the (batched)
+    // node transformers first.
+    if (mTransformerBatch)
+        mTransformerBatch->Integrate(dt);
+
+    // The entities are independent of each other during the update so
+    // they can be updated in parallel. The entities are split into fixed
+    // size chunks and each chunk collects its events into its own buffer.
+    // The buffers are then merged in the chunk order which produces the
+    // same events in the same order as the serial update.
     // todo: limit which entities are getting updated.
-    for (auto& entity : mEntities)
+    const auto entity_count = mEntities.size();
+    const auto chunk_size   = ParallelUpdateChunkSize;
+    const auto* pool = base::GetGlobalThreadPool();
+    if (!mParallelUpdate || pool == nullptr || pool->GetWorkerCount() == 0 || entity_count <= chunk_size)
     {
         std::vector<Entity::Event> entity_events;
-        entity->Update(dt, events ? &entity_events : nullptr);
-        for (auto& entity_event : entity_events)
+        for (auto& entity : mEntities)
         {
-            if (auto* ptr = std::get_if<Entity::TimerEvent>(&entity_event))
-            {
-                EntityTimerEvent timer;
-                timer.entity = entity.get();
-                timer.event  = std::move(*ptr);
-                events->push_back(std::move(timer));
-            }
-            else if (auto* ptr = std::get_if<Entity::PostedEvent>(&entity_event))
-            {
-                EntityEventPostedEvent posted_event;
-                posted_event.entity  = entity.get();
-                posted_event.event   = std::move(*ptr);
-                events->push_back(std::move(posted_event));
-            }
+            update_entity(*entity, dt, &entity_events, events);
+        }
+        apply_animation_batch();
+        return;
+    }
+
+    // the flat trees are rebuilt lazily on traversal which isn't
+    // safe when several threads traverse the same tree.
+    rebuild_flat_trees();
+
+    const auto chunk_count = (entity_count + chunk_size - 1) / chunk_size;
+    mUpdateEvents.resize(chunk_count);
+
+    base::ParallelFor(0, chunk_count, 1, [this, dt, events, entity_count, chunk_size](std::size_t chunk) {
+        const auto chunk_begin = chunk * chunk_size;
+        const auto chunk_end   = std::min(chunk_begin + chunk_size, entity_count);
+        auto* chunk_events = events ? &mUpdateEvents[chunk] : nullptr;
+
+        std::vector<Entity::Event> entity_events;
+        for (std::size_t i=chunk_begin; i<chunk_end; ++i)
+        {
+            update_entity(*mEntities[i], dt, &entity_events, chunk_events);
         }
+    });
 
-        if (entity->HasExpired())
+    if (events)
+    {
+        for (auto& chunk_events : mUpdateEvents)
         {
-            if (entity->TestFlag(Entity::Flags::KillAtLifetime))
-                entity->SetFlag(Entity::ControlFlags::Killed , true);
-            continue;
+            base::AppendVector(*events, std::move(chunk_events));
+            chunk_events.clear();
         }
-        if (entity->IsAnimating())
-            continue;
+    }
+    apply_animation_batch();
+}
 
-        if (!entity->HasIdleTrack())
-            continue;
+void Scene::rebuild_flat_trees()
+{
+    mRenderTree.RebuildFlatTree();
+    for (auto& entity : mEntities)
+    {
+        // the class tree is shared by all the entities of the class.
+        entity->GetClass().GetRenderTree().RebuildFlatTree();
+        entity->GetRenderTree().RebuildFlatTree();
+    }
+}
+
+void Scene::apply_animation_batch()
+{
+    if (!mAnimationBatch)
+        return;
+
+    // The entities that are playing a single animation with baked
+    // curves have deferred applying the curves. Apply all of them
+    // at once grouped by the animation and then let the entities
+    // finish their animation update.
+    for (auto& entity : mEntities)
+    {
+        if (const auto* animation = entity->GetDeferredAnimation())
+            mAnimationBatch->Add(animation, entity.get());
+    }
+    if (mAnimationBatch->GetSize())
+    {
+        mAnimationBatch->Apply();
+        mAnimationBatch->Clear();
+    }
+
+    // check for the expired entities and the idle tracks only once
+    // the animations have been completed in order to have the same
+    // results as without the batch.
+    for (auto& entity : mEntities)
+    {
+        entity->FinishAnimationUpdate();
+        finish_entity_update(*entity);
+    }
+}
+
+void Scene::attach_transformers(Entity& entity)
+{
+    if (!mTransformerBatch)
+        return;
+
+    for (size_t i=0; i<entity.GetNumNodes(); ++i)
+    {
+        auto& node = entity.GetNode(i);
+        if (auto* transformer = node.GetTransformer())
+            mTransformerBatch->Attach(transformer, node.GetTransform());
+    }
+}
+
+void Scene::detach_transformers(Entity& entity)
+{
+    if (!mTransformerBatch)
+        return;
+
+    for (size_t i=0; i<entity.GetNumNodes(); ++i)
+    {
+        auto& node = entity.GetNode(i);
+        auto* transformer = node.GetTransformer();
+        if (transformer && transformer->IsBatched())
+            mTransformerBatch->Detach(transformer);
+    }
+}
+
+void Scene::index_entity(Entity* entity)
+{
+    mClassNameMap[entity->GetClassName()].push_back(entity);
+
+    const auto& tag = entity->GetTag();
+    for (auto& [key, entities] : mTagMap)
+    {
+        if (base::Contains(tag, key))
+            entities.push_back(entity);
+    }
+}
+
+void Scene::unindex_killed_entities(const std::vector<Entity*>& killed)
+{
+    if (killed.empty())
+        return;
+
+    // find the lists that contain any killed entity and then remove
+    // the killed entities with a single pass over each list.
+    std::vector<std::vector<Entity*>*> lists;
+    for (const auto* entity : killed)
+    {
+        auto it = mClassNameMap.find(entity->GetClassName());
+        if (it != mClassNameMap.end())
+            lists.push_back(&it->second);
 
-        const auto& finished_animations = entity->GetFinishedAnimations();
-        bool play_idle = true;
-        for (const auto* anim : finished_animations)
+        const auto& tag = entity->GetTag();
+        for (auto& [key, entities] : mTagMap)
         {
-            const auto& idle_track_id = entity->GetIdleTrackId();
-            const auto& prev_track_id = anim->GetClassId();
-            if (idle_track_id == prev_track_id)
-            {
-                play_idle = false;
-                break;
-            }
+            if (base::Contains(tag, key))
+                lists.push_back(&entities);
+        }
+    }
+    std::sort(lists.begin(), lists.end());
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+    for (auto* list : lists)
+    {
+        base::EraseRemove(*list, [](const Entity* entity) {
+            return entity->TestFlag(Entity::ControlFlags::Killed);
+        });
+    }
+}
+
+void Scene::update_entity_tag(Entity* entity, const std::string& old_tag)
+{
+    // entities that are still waiting to be spawned are
+    // indexed with their current tag when they're spawned.
+    auto it = mIdMap.find(entity->GetId());
+    if (it == mIdMap.end() || it->second != entity)
+        return;
+
+    const auto& tag = entity->GetTag();
+    for (auto& [key, entities] : mTagMap)
+    {
+        const bool had_tag = base::Contains(old_tag, key);
+        const bool has_tag = base::Contains(tag, key);
+        if (had_tag && !has_tag)
+            entities.erase(std::find(entities.begin(), entities.end(), entity));
+        else if (has_tag && !had_tag)
+            entities.push_back(entity);
+    }
+}
+
+std::shared_ptr<const std::vector<Entity*>> Scene::find_entities_by_tag(const std::string& tag) const
+{
+    // the indexed tags are returned as non-owning views.
+    auto it = mTagMap.find(tag);
+    if (it != mTagMap.end())
+        return std::shared_ptr<const std::vector<Entity*>>(std::shared_ptr<const std::vector<Entity*>>(), &it->second);
+
+    auto entities = std::make_shared<std::vector<Entity*>>();
+    for (const auto& entity : mEntities)
+    {
+        if (base::Contains(entity->GetTag(), tag))
+            entities->push_back(entity.get());
+    }
+    return entities;
+}
+
+std::unique_ptr<Entity> Scene::create_entity(const EntityArgs& args)
+{
+    auto it = mEntityPools.find(args.klass.get());
+    if (it != mEntityPools.end() && !it->second.entities.empty())
+    {
+        auto& pool = it->second.entities;
+        auto entity = std::move(pool.back());
+        pool.pop_back();
+        entity->Reset(args);
+        ++mEntityPoolHits;
+        ++mEntityPoolLoopHits;
+        return entity;
+    }
+    ++mEntityPoolMisses;
+    ++mEntityPoolLoopMisses;
+    return CreateEntityInstance(args);
+}
+
+bool Scene::recycle_entity(std::unique_ptr<Entity>& entity)
+{
+    // the pool is keyed by the class object and the pool keeps the
+    // class alive. the entity is reset only when it's reused but the
+    // node data goes back to the allocator right away.
+    auto klass = entity->GetSharedClass();
+    auto it = mEntityPools.find(klass.get());
+    if (it == mEntityPools.end())
+    {
+        if (mEntityPoolCapacity == 0)
+            return false;
+        it = mEntityPools.insert({klass.get(), EntityPool{}}).first;
+        it->second.klass    = klass;
+        it->second.capacity = mEntityPoolCapacity;
+    }
+    auto& pool = it->second;
+    if (pool.entities.size() >= pool.capacity)
+        return false;
+
+    entity->ReleaseNodeData();
+    pool.entities.push_back(std::move(entity));
+    return true;
+}
+
+void Scene::update_entity(Entity& entity, float dt, std::vector<Entity::Event>* entity_events, std::vector<Event>* events)
+{
+    entity_events->clear();
+    entity.SetAnimationDeferred(mAnimationBatch != nullptr);
+    entity.Update(dt, events ? entity_events : nullptr);
+    for (auto& entity_event : *entity_events)
+    {
+        if (auto* ptr = std::get_if<Entity::TimerEvent>(&entity_event))
+        {
+            EntityTimerEvent timer;
+            timer.entity = &entity;
+            timer.event  = std::move(*ptr);
+            events->push_back(std::move(timer));
+        }
+        else if (auto* ptr = std::get_if<Entity::PostedEvent>(&entity_event))
+        {
+            EntityEventPostedEvent posted_event;
+            posted_event.entity  = &entity;
+            posted_event.event   = std::move(*ptr);
+            events->push_back(std::move(posted_event));
+        }
+    }
+
+    // with the animation batch the entity's animation update isn't
+    // complete until the batch has been applied. the rest of the
+    // update is done after that.
+    if (mAnimationBatch)
+        return;
+
+    finish_entity_update(entity);
+}
+
+void Scene::finish_entity_update(Entity& entity)
+{
+    if (entity.HasExpired())
+    {
+        if (entity.TestFlag(Entity::Flags::KillAtLifetime))
+            entity.SetFlag(Entity::ControlFlags::Killed , true);
+        return;
+    }
+    if (entity.IsAnimating())
+        return;
+
+    if (!entity.HasIdleTrack())
+        return;
+
+    const auto& finished_animations = entity.GetFinishedAnimations();
+    bool play_idle = true;
+    for (const auto* anim : finished_animations)
+    {
+        const auto& idle_track_id = entity.GetIdleTrackId();
+        const auto& prev_track_id = anim->GetClassId();
+        if (idle_track_id == prev_track_id)
+        {
+            play_idle = false;
+            break;
         }
-        if (play_idle)
-            entity->PlayIdle();
     }
+    if (play_idle)
+        entity.PlayIdle();
 }
 
 void Scene::Rebuild()
@@ -774,21 +1491,26 @@ void Scene::Rebuild()
     if (!mSpatialIndex && !has_boundary_condition)
         return;
 
-    // Iterate over the render tree and look for entity nodes that have
-    // SpatialNode attachment. For the nodes with spatial node compute
-    // the node's AABB and place that node into the spatial index.
+    // Iterate over the render tree and look for entities that have moved
+    // since the last rebuild, i.e. entities whose node transforms have
+    // changed or whose parent entity has moved. Only for those entities
+    // the node AABBs are recomputed, the spatial index is updated and the
+    // boundary conditions are checked. Entities that were just spawned
+    // have no previous state and are always considered moved.
+    // The change detection uses the entity's transform revision which
+    // is driven by the node transforms' dirty flags, so an entity that
+    // hasn't moved costs a flag check per node instead of comparing
+    // and copying every node transform.
     class Visitor final : public RenderTree::Visitor {
     public:
-        Visitor(SpatialIndex* index, Scene* scene, float left, float right, float top, float bottom)
+        using SpatialIndexItem = game::SpatialIndex<EntityNode>::Item;
+
+        Visitor(Scene* scene, bool indexing, float left, float right, float top, float bottom)
             : mLeftBound(left)
             , mRightBound(right)
             , mTopBound(top)
             , mBottomBound(bottom)
-            , mLeft(std::numeric_limits<double>::max())
-            , mRight(std::numeric_limits<double>::lowest())
-            , mTop(std::numeric_limits<double>::max())
-            , mBottom(std::numeric_limits<double>::lowest())
-            , mIndex(index)
+            , mIndexing(indexing)
             , mScene(scene)
         {}
 
@@ -797,13 +1519,43 @@ void Scene::Rebuild()
             if (!entity)
                 return;
 
-            if (const auto* parent = GetParent())
+            // copy, the parent stack is about to grow.
+            const Parent parent = mParents.empty() ? Parent() : mParents.back();
+            const EntityNode* parent_node = nullptr;
+            if (parent.entity)
+                parent_node = parent.entity->FindNodeByClassId(entity->GetParentNodeClassId());
+
+            auto& state = mScene->mSpatialState[entity];
+
+            const auto revision = entity->GetTransformRevision();
+
+            bool moved = parent.moved ||
+                         state.parent != parent.entity ||
+                         state.parent_node != parent_node ||
+                         state.transform_revision != revision ||
+                         state.rects.size() != entity->GetNumNodes();
+            if (!moved && mIndexing && entity->HasSpatialNodes())
             {
-                const auto* parent_node = parent->FindNodeByClassId(entity->GetParentNodeClassId());
-                mTransform.Push(parent->FindNodeTransform(parent_node));
+                for (size_t i=0; i<entity->GetNumNodes() && !moved; ++i)
+                {
+                    if (IsIndexed(entity->GetNode(i)) != state.indexed[i])
+                        moved = true;
+                }
             }
+            mParents.push_back({entity, &state, moved});
+            if (!moved)
+                return;
 
-            mParents.push(entity);
+            state.parent      = parent.entity;
+            state.parent_node = parent_node;
+            state.transform_revision = revision;
+            state.entity_to_scene = glm::mat4(1.0f);
+            if (parent.entity)
+                state.entity_to_scene = parent.state->entity_to_scene * parent.entity->FindNodeTransform(parent_node);
+
+            const auto num_nodes = entity->GetNumNodes();
+            state.rects.resize(num_nodes);
+            state.indexed.resize(num_nodes, false);
 
             // if the entity has no spatial nodes and is not expected
             // to be killed at the scene boundary then the rest of the
@@ -813,29 +1565,25 @@ void Scene::Rebuild()
                 return;
 
             FRect rect;
-            for (size_t i=0; i<entity->GetNumNodes(); ++i)
+            for (size_t i=0; i<num_nodes; ++i)
             {
-                const auto& node = entity->GetNode(i);
-                mTransform.Push(entity->FindNodeModelTransform(&node));
-                const auto& aabb = ComputeBoundingRect(mTransform.GetAsMatrix());
-                if (const auto* spatial = node.GetSpatialNode(); spatial && spatial->IsEnabled() && mIndex)
+                auto& node = entity->GetNode(i);
+                const auto& aabb = ComputeBoundingRect(state.entity_to_scene * entity->FindNodeModelTransform(&node));
+                const bool indexed = mIndexing && IsIndexed(node);
+                if (indexed)
                 {
-                    const auto left   = (double)aabb.GetX();
-                    const auto right  = (double)aabb.GetX() + aabb.GetWidth();
-                    const auto top    = (double)aabb.GetY();
-                    const auto bottom = (double)aabb.GetY() + aabb.GetHeight();
-                    mLeft   = std::min(mLeft, left);
-                    mRight  = std::max(mRight, right);
-                    mTop    = std::min(mTop, top);
-                    mBottom = std::max(mBottom, bottom);
-
-                    if (spatial->GetShape() == SpatialNode::Shape::AABB)
+                    if (node.GetSpatialNode()->GetShape() == SpatialNode::Shape::AABB)
                     {
-                        mItems.push_back({const_cast<EntityNode*>(&node), aabb});
+                        mMovedItems.push_back({&node, aabb});
                     } else BUG("Unimplemented spatial shape insertion.");
                 }
+                else if (state.indexed[i])
+                {
+                    mErasedItems.insert(&node);
+                }
+                state.indexed[i] = indexed;
+                state.rects[i]   = aabb;
                 rect = base::Union(rect, aabb);
-                mTransform.Pop();
             }
             // if the entity has already been killed there's no point
             // to test whether it should be killed if it has gone
@@ -861,50 +1609,33 @@ void Scene::Rebuild()
         {
             if (!entity)
                 return;
-            mParents.pop();
-            if (const auto* parent = GetParent())
-                mTransform.Pop();
-        }
-        void Update() const
-        {
-            if (mIndex)
-            {
-                // because of numerical stability with floats (precision loss)
-                // we're going to artificially enlarge the spatial rectangle little
-                // bit to make sure that all the spatial node rects will be enclosed
-                // inside the main rect.
-                // Todo: using a hard coded value here, the scale of the adjustment
-                // should depend on scale of the floats min/max themselves.
-                const auto xpos   = mLeft - 1.0;
-                const auto ypos   = mTop -1.0;
-                const auto width  = mRight - mLeft + 2.0f;
-                const auto height = mBottom - mTop + 2.0f;
-                mIndex->Insert(FRect(xpos, ypos, width, height), mItems);
-            }
+            mParents.pop_back();
         }
+        const std::vector<SpatialIndexItem>& GetMovedItems() const noexcept
+        { return mMovedItems; }
+        const std::set<EntityNode*>& GetErasedItems() const noexcept
+        { return mErasedItems; }
     private:
-        Entity* GetParent() const noexcept
+        static bool IsIndexed(const EntityNode& node) noexcept
         {
-            if (mParents.empty())
-                return nullptr;
-            return mParents.top();
+            const auto* spatial = node.GetSpatialNode();
+            return spatial && spatial->IsEnabled();
         }
     private:
-        using SpatialIndexItem = game::SpatialIndex<EntityNode>::Item;
-
+        struct Parent {
+            Entity* entity = nullptr;
+            const EntitySpatialState* state = nullptr;
+            bool moved = false;
+        };
         const double mLeftBound;
         const double mRightBound;
         const double mTopBound;
         const double mBottomBound;
-        double mLeft;
-        double mRight;
-        double mTop;
-        double mBottom;
+        const bool mIndexing;
 
-        std::vector<SpatialIndexItem> mItems;
-        std::stack<Entity*> mParents;
-        Transform mTransform;
-        SpatialIndex* mIndex = nullptr;
+        std::vector<SpatialIndexItem> mMovedItems;
+        std::set<EntityNode*> mErasedItems;
+        std::vector<Parent> mParents;
         Scene* mScene = nullptr;
     };
 
@@ -913,12 +1644,61 @@ void Scene::Rebuild()
     const auto top_boundary_value    = top_boundary    ? *top_boundary    : std::numeric_limits<float>::lowest();
     const auto bottom_boundary_value = bottom_boundary ? *bottom_boundary : std::numeric_limits<float>::max();
 
-    Visitor visitor(mSpatialIndex.get(), this,
+    Visitor visitor(this, !!mSpatialIndex,
         left_boundary_value, right_boundary_value,
         top_boundary_value, bottom_boundary_value);
     mRenderTree.PreOrderTraverse(visitor);
 
-    visitor.Update();
+    if (!mSpatialIndex)
+        return;
+
+    if (!visitor.GetErasedItems().empty())
+        mSpatialIndex->Erase(visitor.GetErasedItems());
+
+    // if all the moved items are still within the current index
+    // space they can be moved incrementally, otherwise the whole
+    // index needs to be rebuilt.
+    if (visitor.GetMovedItems().empty() || mSpatialIndex->Update(visitor.GetMovedItems()))
+        return;
+
+    std::vector<SpatialIndex::Item> items;
+    double left   = std::numeric_limits<double>::max();
+    double right  = std::numeric_limits<double>::lowest();
+    double top    = std::numeric_limits<double>::max();
+    double bottom = std::numeric_limits<double>::lowest();
+    for (auto& entity : mEntities)
+    {
+        auto it = mSpatialState.find(entity.get());
+        if (it == mSpatialState.end())
+            continue;
+        const auto& state = it->second;
+        for (size_t i=0; i<state.indexed.size(); ++i)
+        {
+            if (!state.indexed[i])
+                continue;
+            const auto& rect = state.rects[i];
+            left   = std::min(left,   (double)rect.GetX());
+            right  = std::max(right,  (double)rect.GetX() + rect.GetWidth());
+            top    = std::min(top,    (double)rect.GetY());
+            bottom = std::max(bottom, (double)rect.GetY() + rect.GetHeight());
+            items.push_back({&entity->GetNode(i), rect});
+        }
+    }
+    // because of numerical stability with floats (precision loss)
+    // we're going to artificially enlarge the spatial rectangle little
+    // bit to make sure that all the spatial node rects will be enclosed
+    // inside the main rect. On top of that leave some slack around the
+    // current objects so that objects moving near the edges don't
+    // immediately require yet another rebuild.
+    // Todo: using a hard coded value here, the scale of the adjustment
+    // should depend on scale of the floats min/max themselves.
+    const auto slack_x = (right - left) * 0.1 + 1.0;
+    const auto slack_y = (bottom - top) * 0.1 + 1.0;
+    const auto xpos   = left - slack_x;
+    const auto ypos   = top - slack_y;
+    const auto width  = right - left + 2.0 * slack_x;
+    const auto height = bottom - top + 2.0 * slack_y;
+    mSpatialIndex->Insert(FRect(xpos, ypos, width, height), items);
 }
 
 std::unique_ptr<Scene> CreateSceneInstance(std::shared_ptr<const SceneClass> klass)
@@ -29,11 +29,14 @@
 #include <memory>
 #include <variant>
 #include <algorithm>
+#include <iterator>
 #include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <set>
 #include <mutex>
+#include <functional>
+#include <cstddef>
 
 #include "base/bitflag.h"
 #include "data/fwd.h"
@@ -45,9 +48,92 @@
 #include "game/scene_class.h"
 #include "game/scriptvar.h"
 
+namespace base {
+    class MetricsRegistry;
+    class Counter;
+    class Gauge;
+} // namespace
+
 namespace game
 {
     class Tilemap;
+    class SceneSnapshot;
+
+    // A view to a list of entities maintained by the scene for entity
+    // lookups. The view doesn't copy the entities and refers to the
+    // scene's current state, i.e. the entities it contains change as
+    // entities are spawned, killed and their tags change. Changing the
+    // entities' tags invalidates any iteration in progress.
+    // A list that isn't maintained by the scene (such as the result of
+    // a lookup with a tag that isn't indexed) is owned by the list and
+    // doesn't change.
+    template<typename EntityType>
+    class SceneEntityList
+    {
+    public:
+        using Container = std::vector<Entity*>;
+        class const_iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = EntityType*;
+            using difference_type = std::ptrdiff_t;
+            using pointer = EntityType**;
+            using reference = EntityType*;
+
+            const_iterator() = default;
+            explicit const_iterator(Container::const_iterator it)
+              : mIter(it)
+            {}
+            inline EntityType* operator*() const noexcept
+            { return *mIter; }
+            inline const_iterator& operator++() noexcept
+            {
+                ++mIter;
+                return *this;
+            }
+            inline const_iterator operator++(int) noexcept
+            {
+                const_iterator ret(mIter);
+                ++mIter;
+                return ret;
+            }
+            inline bool operator==(const const_iterator& other) const noexcept
+            { return mIter == other.mIter; }
+            inline bool operator!=(const const_iterator& other) const noexcept
+            { return mIter != other.mIter; }
+        private:
+            Container::const_iterator mIter;
+        };
+
+        // Create a view to a list maintained by the scene.
+        explicit SceneEntityList(const Container* entities) noexcept
+          : mEntities(std::shared_ptr<const Container>(), entities)
+        {}
+        // Create a list that owns its entity list.
+        explicit SceneEntityList(std::shared_ptr<const Container> entities) noexcept
+          : mEntities(std::move(entities))
+        {}
+        inline bool IsEmpty() const noexcept
+        { return mEntities->empty(); }
+        inline std::size_t GetSize() const noexcept
+        { return mEntities->size(); }
+        inline EntityType* GetEntity(std::size_t index) const noexcept
+        { return base::SafeIndex(*mEntities, index); }
+        inline EntityType* operator[](std::size_t index) const noexcept
+        { return base::SafeIndex(*mEntities, index); }
+        inline const_iterator begin() const noexcept
+        { return const_iterator(mEntities->begin()); }
+        inline const_iterator end() const noexcept
+        { return const_iterator(mEntities->end()); }
+        // Get the underlying container. A view to a list maintained by
+        // the scene doesn't own the container, i.e. the container must
+        // not be used after the scene has been deleted.
+        inline std::shared_ptr<const Container> GetContainer() const noexcept
+        { return mEntities; }
+    private:
+        std::shared_ptr<const Container> mEntities;
+    };
 
     // Scene is the runtime representation of a scene based on some scene class
     // object instance. When a new Scene instance is created the scene class
@@ -64,6 +150,8 @@ namespace game
         using RenderTreeValue = Entity;
         using SpatialIndex    = game::SpatialIndex<EntityNode>;
         using BloomFilter     = SceneClass::BloomFilter;
+        using EntityList      = SceneEntityList<Entity>;
+        using ConstEntityList = SceneEntityList<const Entity>;
 
         explicit Scene(std::shared_ptr<const SceneClass> klass);
         explicit Scene(const SceneClass& klass);
@@ -79,13 +167,24 @@ namespace game
         // name it's undefined which one is returned.
         Entity* FindEntityByInstanceName(const std::string& name);
         // List all entities of the given class identified by its class name.
-        std::vector<Entity*> ListEntitiesByClassName(const std::string& name);
+        // The entities are looked up from an index that is kept up to date
+        // as entities are spawned and killed.
+        EntityList ListEntitiesByClassName(const std::string& name);
         // List all entities of the given class identified by its class name.
-        std::vector<const Entity*> ListEntitiesByClassName(const std::string& name) const;
-        // List entities that have a matching tag string.
-        std::vector<Entity*> ListEntitiesByTag(const std::string& tag);
-        // List entities that have a matching tag string.
-        std::vector<const Entity*> ListEntitiesByTag(const std::string& tag) const;
+        ConstEntityList ListEntitiesByClassName(const std::string& name) const;
+        // Create an index for the given tag. The index is kept up to date
+        // as entities are spawned, killed and their tags change so that
+        // listing the entities with the tag doesn't need to check all the
+        // entities. Every indexed tag adds to the cost of spawning, killing
+        // and changing the tags of entities so only the tags that are
+        // looked up frequently should be indexed.
+        void IndexEntityTag(const std::string& tag);
+        // List entities whose tag string contains the given tag. If the
+        // tag is indexed the list is a view to the index, otherwise the
+        // list is a copy created by checking all the entities.
+        EntityList ListEntitiesByTag(const std::string& tag);
+        // List entities whose tag string contains the given tag.
+        ConstEntityList ListEntitiesByTag(const std::string& tag) const;
         // Get the node by index. The index must be valid.
         const Entity& GetEntity(size_t index) const;
         // Find entity by id. Returns nullptr if  no such node could be found.
@@ -106,6 +205,57 @@ namespace game
         // entity in the scene graph.
         Entity* SpawnEntity(const EntityArgs& args, bool link_to_root = true);
 
+        // Entity pool statistics.
+        struct EntityPoolStats {
+            // The number of spawns that reused a pooled entity.
+            std::size_t hits = 0;
+            // The number of spawns that had to create a new entity.
+            std::size_t misses = 0;
+            // The number of entities currently in the pools.
+            std::size_t pooled = 0;
+        };
+        // Set the maximum number of killed entities to keep per entity class
+        // for reuse by later spawns. Pooling avoids the cost of creating and
+        // deleting entities when the same types of entities are spawned and
+        // killed continuously. Zero disables the pooling (of classes that
+        // haven't been pre-warmed) and is the default. Asynchronous spawns
+        // always create new entities on the worker thread.
+        void SetEntityPoolCapacity(std::size_t capacity);
+        inline std::size_t GetEntityPoolCapacity() const noexcept
+        { return mEntityPoolCapacity; }
+        // Create entities of the given class ahead of time into the entity
+        // pool so that the next count spawns of the class don't need to
+        // create any entities. The pool capacity for the class is raised
+        // to at least count. Useful for example during a loading screen.
+        void PrewarmEntityPool(std::shared_ptr<const EntityClass> klass, std::size_t count);
+        // Delete all the pooled entities.
+        void ClearEntityPool();
+        // Get the entity pool statistics.
+        EntityPoolStats GetEntityPoolStats() const;
+
+        // Capture the current state of the scene into a snapshot. When a
+        // base snapshot is given the snapshot is captured as a delta that
+        // only stores the entities whose state differs from the base and
+        // the tilemap blocks written since the base was captured. The base
+        // must have been captured from this scene. Entities that are still
+        // waiting to be spawned are not included.
+        void CaptureSnapshot(SceneSnapshot* snapshot, std::shared_ptr<const SceneSnapshot> base = nullptr) const;
+
+        // Lookup function for finding the class of an entity that needs to
+        // be re-spawned when restoring a snapshot.
+        using EntityClassLookup = std::function<std::shared_ptr<const EntityClass> (const std::string& class_id)>;
+        // Restore the scene state from a snapshot. Entities that are not in
+        // the snapshot are killed and entities that no longer exist are
+        // spawned again with their original ids (their classes are found
+        // from the scene or through the lookup function). The re-spawned
+        // entities are linked to the scene root and are placed in the scene
+        // on the next BeginLoop. Returns false if any entity could not be
+        // restored.
+        // Not restored are the entity state controller states, the animation
+        // queues, the animator states of non-baked animations and the tiles
+        // written after the snapshot that are not in any captured block.
+        bool RestoreSnapshot(const SceneSnapshot& snapshot, const EntityClassLookup& lookup = nullptr);
+
         // Prepare the scene for the next iteration of the game loop.
         void BeginLoop();
         // Perform end of game loop iteration cleanup etc.
@@ -206,8 +356,43 @@ namespace game
         using Event = std::variant<EntityTimerEvent,
                 EntityEventPostedEvent>;
 
+        // Update the entities, i.e. their animations, timers etc.
+        // When parallel update is enabled and there's a global thread
+        // pool the entities are updated on the worker threads. The
+        // results (including the order of the events) are identical
+        // to the serial update.
         void Update(float dt, std::vector<Event>* events = nullptr);
 
+        // Enable/disable updating the entities in parallel. A scene whose
+        // entities are not independent of each other during the update
+        // (for example because they share some state through a native
+        // extension) should opt out. Parallel update is on by default.
+        inline void SetParallelUpdate(bool on_off) noexcept
+        { mParallelUpdate = on_off; }
+        inline bool IsParallelUpdateEnabled() const noexcept
+        { return mParallelUpdate; }
+
+        // Enable/disable integrating the entity node transformers in a
+        // batch. When enabled the motion state of every node transformer
+        // in the scene is kept in structure of arrays storage and the
+        // nodes are integrated with SIMD instructions at the start of
+        // Update instead of each entity integrating its own nodes. The
+        // results are identical either way. Enabled by default.
+        // Note that when enabled Entity::Update no longer integrates
+        // the entity's node transformers.
+        void SetTransformerBatch(bool on_off);
+        inline bool IsTransformerBatchEnabled() const noexcept
+        { return mTransformerBatch != nullptr; }
+
+        // Enable/disable applying the baked animation curves in a batch.
+        // When enabled the curves of the entities that play the same
+        // animation are evaluated together after the entities have been
+        // updated instead of each entity evaluating its own animation.
+        // The results are identical either way. Enabled by default.
+        void SetAnimationBatch(bool on_off);
+        inline bool IsAnimationBatchEnabled() const noexcept
+        { return mAnimationBatch != nullptr; }
+
         void Rebuild();
 
         inline void QuerySpatialNodes(const FRect& area_of_interest, std::set<EntityNode*>* result)
@@ -248,6 +433,32 @@ namespace game
         inline void QuerySpatialNodes(const FPoint& a, const FPoint& b, std::vector<const EntityNode*>* result, SpatialQueryMode mode = SpatialQueryMode::All) const
         { query_spatial_nodes_by_line(a, b, result, mode); }
 
+        using SpatialQueryOrder  = SpatialIndex::QueryOrder;
+        using SpatialQueryResult = SpatialIndex::QueryResult;
+
+        // Spatial queries that store the results in a reusable result
+        // container instead of allocating a new container for every query.
+        inline void QuerySpatialNodes(const FRect& area_of_interest, SpatialQueryResult* result, SpatialQueryOrder order = SpatialQueryOrder::None)
+        { query_spatial_nodes([&](const auto& index) { index.Query(area_of_interest, result, order); }, result); }
+        inline void QuerySpatialNodes(const FPoint& point, SpatialQueryResult* result, SpatialQueryMode mode = SpatialQueryMode::All, SpatialQueryOrder order = SpatialQueryOrder::None)
+        { query_spatial_nodes([&](const auto& index) { index.Query(point, result, mode, order); }, result); }
+        inline void QuerySpatialNodes(const FPoint& point, float radius, SpatialQueryResult* result, SpatialQueryMode mode = SpatialQueryMode::All, SpatialQueryOrder order = SpatialQueryOrder::None)
+        { query_spatial_nodes([&](const auto& index) { index.Query(point, radius, result, mode, order); }, result); }
+        inline void QuerySpatialNodes(const FPoint& a, const FPoint& b, SpatialQueryResult* result, SpatialQueryMode mode = SpatialQueryMode::All, SpatialQueryOrder order = SpatialQueryOrder::None)
+        { query_spatial_nodes([&](const auto& index) { index.Query(a, b, result, mode, order); }, result); }
+        // Batch queries, the results of each query are stored consecutively.
+        inline void QuerySpatialNodes(const std::vector<FRect>& areas, SpatialQueryResult* result, SpatialQueryOrder order = SpatialQueryOrder::None)
+        { query_spatial_nodes([&](const auto& index) { index.Query(areas, result, order); }, result); }
+        inline void QuerySpatialNodes(const std::vector<FPoint>& points, SpatialQueryResult* result, SpatialQueryMode mode = SpatialQueryMode::All, SpatialQueryOrder order = SpatialQueryOrder::None)
+        { query_spatial_nodes([&](const auto& index) { index.Query(points, result, mode, order); }, result); }
+        inline void QuerySpatialNodes(const std::vector<FCircle>& circles, SpatialQueryResult* result, SpatialQueryMode mode = SpatialQueryMode::All, SpatialQueryOrder order = SpatialQueryOrder::None)
+        { query_spatial_nodes([&](const auto& index) { index.Query(circles, result, mode, order); }, result); }
+        // Find the k nearest nodes ordered by distance.
+        inline void QueryNearestSpatialNodes(const FPoint& point, unsigned k, SpatialQueryResult* result, float max_distance = std::numeric_limits<float>::max())
+        { query_spatial_nodes([&](const auto& index) { index.QueryNearest(point, k, result, max_distance); }, result); }
+        inline void QueryNearestSpatialNodes(const std::vector<FPoint>& points, unsigned k, SpatialQueryResult* result, float max_distance = std::numeric_limits<float>::max())
+        { query_spatial_nodes([&](const auto& index) { index.QueryNearest(points, k, result, max_distance); }, result); }
+
         const Tilemap* GetMap() const noexcept
         { return mMap; }
         Tilemap* GetMap() noexcept
@@ -293,6 +504,13 @@ namespace game
         // Disabled.
         Scene& operator=(const Scene&) = delete;
     private:
+        template<typename Query>
+        void query_spatial_nodes(const Query& query, SpatialQueryResult* result) const
+        {
+            if (mSpatialIndex)
+                query(*mSpatialIndex);
+            else result->Clear();
+        }
         template<typename ResultContainer>
         void query_spatial_nodes_by_point(const FPoint& point, ResultContainer* result, SpatialQueryMode mode) const
         {
@@ -317,8 +535,24 @@ namespace game
             if (mSpatialIndex)
                 mSpatialIndex->Query(a, b, result, mode);
         }
+        std::unique_ptr<Entity> create_entity(const EntityArgs& args);
+        bool recycle_entity(std::unique_ptr<Entity>& entity);
+        void update_entity(Entity& entity, float dt, std::vector<Entity::Event>* entity_events, std::vector<Event>* events);
+        void finish_entity_update(Entity& entity);
+        void apply_animation_batch();
+        void rebuild_flat_trees();
+        void attach_transformers(Entity& entity);
+        void detach_transformers(Entity& entity);
+        void index_entity(Entity* entity);
+        void unindex_killed_entities(const std::vector<Entity*>& killed);
+        void update_entity_tag(Entity* entity, const std::string& old_tag);
+        std::shared_ptr<const std::vector<Entity*>> find_entities_by_tag(const std::string& tag) const;
+        friend class Entity;
 
     private:
+        // the number of entities updated by a single task when
+        // updating the entities in parallel.
+        static constexpr std::size_t ParallelUpdateChunkSize = 64;
         // the class object.
         std::shared_ptr<const SceneClass> mClass;
         // Entities currently in the scene.
@@ -329,6 +563,13 @@ namespace game
         // the names are *human-readable* and set by the designer
         // so it's possible that there could be name collisions.
         std::unordered_map<std::string, Entity*> mNameMap;
+        // lookup table for mapping entity class names to entities.
+        std::unordered_map<std::string, std::vector<Entity*>> mClassNameMap;
+        // lookup table for mapping the indexed tags to entities whose
+        // tag string contains the tag.
+        std::unordered_map<std::string, std::vector<Entity*>> mTagMap;
+        // the entities killed on the current EndLoop.
+        std::vector<Entity*> mKilledEntities;
         // The list of script variables.
         std::vector<ScriptVar> mScriptVars;
         // The scene graph/render tree for hierarchical traversal
@@ -341,6 +582,25 @@ namespace game
         std::unordered_set<Entity*> mKillSet;
         // Spatial index for object (entity node) queries (if any)
         std::unique_ptr<SpatialIndex> mSpatialIndex;
+
+        // Spatial state of an entity as of the last call to Rebuild.
+        // Used to detect the entities that have moved since and to
+        // only update those in the spatial index.
+        struct EntitySpatialState {
+            // the parent entity and the parent entity's node that
+            // the entity is linked to (if any).
+            const Entity* parent = nullptr;
+            const EntityNode* parent_node = nullptr;
+            // transformation from the entity's space to scene space.
+            glm::mat4 entity_to_scene;
+            // the entity's transform revision.
+            std::uint64_t transform_revision = 0;
+            // the entity node AABBs in scene space.
+            std::vector<FRect> rects;
+            // whether the entity node is in the spatial index.
+            std::vector<bool> indexed;
+        };
+        std::unordered_map<const Entity*, EntitySpatialState> mSpatialState;
         // for convenience..
         Tilemap* mMap = nullptr;
 
@@ -357,6 +617,41 @@ namespace game
             std::vector<SpawnRecord> spawn_list;
         };
         std::shared_ptr<AsyncSpawnState> mAsyncSpawnState;
+        // Killed entities kept for reuse by later spawns of the same class.
+        struct EntityPool {
+            std::shared_ptr<const EntityClass> klass;
+            std::vector<std::unique_ptr<Entity>> entities;
+            std::size_t capacity = 0;
+        };
+        std::unordered_map<const EntityClass*, EntityPool> mEntityPools;
+        // The default maximum number of pooled entities per class.
+        std::size_t mEntityPoolCapacity = 0;
+        // Pool hits and misses (in total and since the last BeginLoop).
+        std::size_t mEntityPoolHits = 0;
+        std::size_t mEntityPoolMisses = 0;
+        std::size_t mEntityPoolLoopHits = 0;
+        std::size_t mEntityPoolLoopMisses = 0;
+        // The metric objects updated on BeginLoop. Looked up from the
+        // global metrics registry once (and again if the registry changes).
+        struct Metrics {
+            base::MetricsRegistry* registry = nullptr;
+            base::Gauge* transforms_recomputed = nullptr;
+            base::Counter* total_transforms_recomputed = nullptr;
+            base::Gauge* entity_pool_hits = nullptr;
+            base::Gauge* entity_pool_misses = nullptr;
+            base::Counter* total_entity_pool_hits = nullptr;
+            base::Counter* total_entity_pool_misses = nullptr;
+        } mMetrics;
+        // Per chunk event buffers for the parallel entity update.
+        std::vector<std::vector<Event>> mUpdateEvents;
+        // whether to update the entities in parallel when possible.
+        bool mParallelUpdate = true;
+        // SoA storage for the node transformers of the entities in the
+        // scene (if enabled). Declared after the entities so that it's
+        // destroyed (and detaches the transformers) first.
+        std::unique_ptr<NodeTransformerBatch> mTransformerBatch;
+        // Batch for applying the baked animation curves (if enabled).
+        std::unique_ptr<AnimationBatch> mAnimationBatch;
     };
 
     std::unique_ptr<Scene> CreateSceneInstance(std::shared_ptr<const SceneClass> klass);
@@ -0,0 +1,251 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <variant>
+
+#include "base/assert.h"
+#include "base/logging.h"
+#include "game/scene_snapshot.h"
+
+namespace {
+template<typename T>
+void WriteArray(game::SnapshotWriter& writer, const std::vector<T>& array)
+{
+    for (const auto& item : array)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+            writer.Write(static_cast<std::uint8_t>(item));
+        else if constexpr (std::is_same_v<T, std::string>)
+            writer.Write(item);
+        else if constexpr (std::is_trivially_copyable_v<T>)
+            writer.Write(item);
+        else writer.Write(item.id); // object references
+    }
+}
+template<typename T>
+bool ReadArray(game::SnapshotReader& reader, std::size_t size, std::vector<T>* array)
+{
+    array->resize(size);
+    for (std::size_t i=0; i<size; ++i)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            std::uint8_t value = 0;
+            if (!reader.Read(&value))
+                return false;
+            (*array)[i] = value != 0;
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            if (!reader.Read(&(*array)[i]))
+                return false;
+        }
+        else if constexpr (std::is_trivially_copyable_v<T>)
+        {
+            if (!reader.Read(&(*array)[i]))
+                return false;
+        }
+        else if (!reader.Read(&(*array)[i].id))
+            return false;
+    }
+    return true;
+}
+
+template<std::size_t Index>
+bool ReadVariant(game::SnapshotReader& reader, std::size_t index, std::size_t size,
+                 game::ScriptVar::VariantType* variant)
+{
+    using VariantType = game::ScriptVar::VariantType;
+    if constexpr (Index < std::variant_size_v<VariantType>)
+    {
+        if (index != Index)
+            return ReadVariant<Index + 1>(reader, index, size, variant);
+
+        std::variant_alternative_t<Index, VariantType> array;
+        if (!ReadArray(reader, size, &array))
+            return false;
+        *variant = std::move(array);
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+namespace game
+{
+
+void SnapshotWriter::Write(const ScriptVar::VariantType& variant)
+{
+    Write(static_cast<std::uint8_t>(variant.index()));
+    std::visit([this](const auto& array) {
+        Write(static_cast<std::uint32_t>(array.size()));
+        WriteArray(*this, array);
+    }, variant);
+}
+
+bool SnapshotReader::Read(ScriptVar::VariantType* variant)
+{
+    std::uint8_t index = 0;
+    std::uint32_t size = 0;
+    if (!Read(&index) || !Read(&size))
+        return false;
+    // every item takes at least one byte.
+    if (size > mSize - mOffset)
+        return false;
+    return ReadVariant<0>(*this, index, size, variant);
+}
+
+bool SceneSnapshot::FromBuffer(std::vector<std::uint8_t> buffer, std::shared_ptr<const SceneSnapshot> base)
+{
+    mBuffer = std::move(buffer);
+    mBase   = std::move(base);
+    if (!ReadIndex())
+    {
+        mBuffer.clear();
+        mBase.reset();
+        mEntities.clear();
+        mEntityIndex.clear();
+        mTileBlocks.clear();
+        mLayerRevisions.clear();
+        return false;
+    }
+    return true;
+}
+
+bool SceneSnapshot::ReadIndex()
+{
+    mEntities.clear();
+    mEntityIndex.clear();
+    mTileBlocks.clear();
+    mLayerRevisions.clear();
+    mNumStoredEntities = 0;
+    mNumTileBlocks = 0;
+
+    SnapshotReader reader(mBuffer.data(), mBuffer.size());
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    std::uint8_t delta = 0;
+    if (!reader.Read(&magic) || magic != Magic)
+    {
+        ERROR("Scene snapshot data is not a snapshot.");
+        return false;
+    }
+    if (!reader.Read(&version) || version != Version)
+    {
+        ERROR("Unsupported scene snapshot version. [version=%1]", version);
+        return false;
+    }
+    if (!reader.Read(&delta) || !reader.Read(&mSceneTime))
+        return false;
+    if (delta && !mBase)
+    {
+        ERROR("Delta scene snapshot has no base snapshot.");
+        return false;
+    }
+    if (!delta && mBase)
+        mBase.reset();
+
+    std::uint32_t scene_state_size = 0;
+    if (!reader.Read(&scene_state_size))
+        return false;
+    mSceneStateOffset = reader.GetOffset();
+    if (!reader.Skip(scene_state_size))
+        return false;
+
+    std::uint32_t entity_count = 0;
+    if (!reader.Read(&entity_count))
+        return false;
+    mEntities.reserve(entity_count);
+    mEntityIndex.reserve(entity_count);
+    for (std::uint32_t i=0; i<entity_count; ++i)
+    {
+        Entity entity;
+        std::uint8_t stored = 0;
+        if (!reader.Read(&entity.id) || !reader.Read(&stored))
+            return false;
+        if (stored)
+        {
+            std::uint32_t size = 0;
+            if (!reader.Read(&size))
+                return false;
+            entity.owner  = this;
+            entity.offset = reader.GetOffset();
+            entity.size   = size;
+            if (!reader.Skip(size))
+                return false;
+            ++mNumStoredEntities;
+        }
+        else
+        {
+            const auto* base = mBase ? mBase->FindEntity(entity.id) : nullptr;
+            if (base == nullptr)
+            {
+                ERROR("Scene snapshot entity is missing from the base snapshot. [id='%1']", entity.id);
+                return false;
+            }
+            entity.owner  = base->owner;
+            entity.offset = base->offset;
+            entity.size   = base->size;
+        }
+        mEntityIndex[entity.id] = mEntities.size();
+        mEntities.push_back(std::move(entity));
+    }
+
+    std::uint32_t layer_count = 0;
+    if (!reader.Read(&layer_count))
+        return false;
+    for (std::uint32_t i=0; i<layer_count; ++i)
+    {
+        std::uint64_t revision = 0;
+        if (!reader.Read(&revision))
+            return false;
+        mLayerRevisions.push_back(revision);
+    }
+
+    std::uint32_t block_count = 0;
+    if (!reader.Read(&block_count))
+        return false;
+    for (std::uint32_t i=0; i<block_count; ++i)
+    {
+        TileBlock block;
+        std::uint32_t x = 0, y = 0, w = 0, h = 0;
+        std::uint8_t components = 0;
+        if (!reader.Read(&block.layer) || block.layer >= layer_count)
+            return false;
+        if (!reader.Read(&x) || !reader.Read(&y) || !reader.Read(&w) || !reader.Read(&h))
+            return false;
+        if (!reader.Read(&components))
+            return false;
+        block.rect   = URect(x, y, w, h);
+        block.components = components;
+        block.offset = reader.GetOffset();
+        std::size_t tile_size = 0;
+        if (components & 1)
+            tile_size += sizeof(std::uint8_t);
+        if (components & 2)
+            tile_size += sizeof(std::int32_t);
+        if (!reader.Skip(std::size_t(w) * h * tile_size))
+            return false;
+        mTileBlocks.push_back(block);
+    }
+    mNumTileBlocks = mTileBlocks.size();
+    return reader.IsEnd();
+}
+
+} // namespace
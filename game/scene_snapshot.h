@@ -0,0 +1,215 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <type_traits>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#include "game/types.h"
+#include "game/scriptvar.h"
+
+namespace game
+{
+    // Write values in a compact binary (native byte order) form
+    // into a byte buffer. The values are appended to the buffer.
+    class SnapshotWriter
+    {
+    public:
+        explicit SnapshotWriter(std::vector<std::uint8_t>* buffer) noexcept
+          : mBuffer(buffer)
+        {}
+        template<typename T>
+        void Write(const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const auto offset = mBuffer->size();
+            mBuffer->resize(offset + sizeof(T));
+            std::memcpy(mBuffer->data() + offset, &value, sizeof(T));
+        }
+        void Write(const std::string& str)
+        {
+            Write(static_cast<std::uint32_t>(str.size()));
+            mBuffer->insert(mBuffer->end(), str.begin(), str.end());
+        }
+        void Write(const ScriptVar::VariantType& variant);
+
+        inline std::size_t GetSize() const noexcept
+        { return mBuffer->size(); }
+    private:
+        std::vector<std::uint8_t>* mBuffer = nullptr;
+    };
+
+    // Read values written by the SnapshotWriter. Every read is
+    // bounds checked and fails when the data runs out.
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader(const std::uint8_t* data, std::size_t size) noexcept
+          : mData(data)
+          , mSize(size)
+        {}
+        template<typename T>
+        bool Read(T* value) noexcept
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            if (mSize - mOffset < sizeof(T))
+                return false;
+            std::memcpy(value, mData + mOffset, sizeof(T));
+            mOffset += sizeof(T);
+            return true;
+        }
+        bool Read(std::string* str)
+        {
+            std::uint32_t size = 0;
+            if (!Read(&size) || mSize - mOffset < size)
+                return false;
+            str->assign(reinterpret_cast<const char*>(mData + mOffset), size);
+            mOffset += size;
+            return true;
+        }
+        bool Read(ScriptVar::VariantType* variant);
+
+        bool Skip(std::size_t bytes) noexcept
+        {
+            if (mSize - mOffset < bytes)
+                return false;
+            mOffset += bytes;
+            return true;
+        }
+        inline const std::uint8_t* GetPosition() const noexcept
+        { return mData + mOffset; }
+        inline std::size_t GetOffset() const noexcept
+        { return mOffset; }
+        inline bool IsEnd() const noexcept
+        { return mOffset == mSize; }
+    private:
+        const std::uint8_t* mData = nullptr;
+        std::size_t mSize   = 0;
+        std::size_t mOffset = 0;
+    };
+
+    // Binary snapshot of the dynamic state of a running scene.
+    // The snapshot contains the entities currently in the scene with
+    // their instance state (flags, timers, script variables, node
+    // transforms, transformers, drawables and current animations), the
+    // scene's script variables and the tiles of the blocks written in
+    // the scene's tilemap layers.
+    //
+    // A delta snapshot is captured against a base snapshot and only
+    // stores the entities whose state has changed and the tile blocks
+    // written since the base was captured. The rest is looked up from
+    // the base (which can itself be a delta) so the base must be kept
+    // around for as long as the delta snapshot is used.
+    //
+    // See Scene::CaptureSnapshot and Scene::RestoreSnapshot.
+    class SceneSnapshot
+    {
+    public:
+        // Check whether this is a delta snapshot.
+        inline bool IsDelta() const noexcept
+        { return mBase != nullptr; }
+        // Get the base snapshot of a delta snapshot.
+        inline const std::shared_ptr<const SceneSnapshot>& GetBase() const noexcept
+        { return mBase; }
+        // Get the scene time when the snapshot was captured.
+        inline double GetSceneTime() const noexcept
+        { return mSceneTime; }
+        // Get the number of entities in the scene state.
+        inline std::size_t GetNumEntities() const noexcept
+        { return mEntities.size(); }
+        // Get the number of entities whose state is stored in this
+        // snapshot, i.e. not looked up from the base.
+        inline std::size_t GetNumStoredEntities() const noexcept
+        { return mNumStoredEntities; }
+        // Get the number of tile blocks stored in this snapshot.
+        inline std::size_t GetNumTileBlocks() const noexcept
+        { return mNumTileBlocks; }
+        // Get the number of bytes in the snapshot data.
+        inline std::size_t GetByteCount() const noexcept
+        { return mBuffer.size(); }
+        // Get the snapshot data for example for writing it into a file.
+        inline const std::vector<std::uint8_t>& GetBuffer() const noexcept
+        { return mBuffer; }
+        // Check whether the snapshot contains an entity by its id.
+        inline bool HasEntity(const std::string& id) const
+        { return mEntityIndex.find(id) != mEntityIndex.end(); }
+
+        // Load the snapshot from data previously returned by GetBuffer.
+        // A delta snapshot must be given the same base snapshot it was
+        // captured against. Returns false if the data is not valid.
+        bool FromBuffer(std::vector<std::uint8_t> buffer, std::shared_ptr<const SceneSnapshot> base = nullptr);
+
+        // The state of an entity. The record is in the buffer of the
+        // snapshot that stores it which is either this snapshot or one
+        // of its bases.
+        struct Entity {
+            std::string id;
+            const SceneSnapshot* owner = nullptr;
+            std::size_t offset = 0;
+            std::size_t size   = 0;
+        };
+        // The tiles of a block of tiles in a tilemap layer.
+        struct TileBlock {
+            std::uint32_t layer = 0;
+            URect rect;
+            // bit 0 is set when the tiles have a palette index
+            // and bit 1 when the tiles have a data value.
+            std::uint8_t components = 0;
+            // the offset of the tile data in the buffer.
+            std::size_t offset = 0;
+        };
+        inline const std::vector<Entity>& GetEntities() const noexcept
+        { return mEntities; }
+        inline const Entity* FindEntity(const std::string& id) const
+        {
+            auto it = mEntityIndex.find(id);
+            return it == mEntityIndex.end() ? nullptr : &mEntities[it->second];
+        }
+        inline const std::vector<TileBlock>& GetTileBlocks() const noexcept
+        { return mTileBlocks; }
+        inline const std::vector<std::uint64_t>& GetLayerRevisions() const noexcept
+        { return mLayerRevisions; }
+
+        static constexpr std::uint32_t Magic   = 0x50534e44; // 'DNSP'
+        static constexpr std::uint32_t Version = 1;
+    private:
+        friend class Scene;
+        bool ReadIndex();
+    private:
+        std::shared_ptr<const SceneSnapshot> mBase;
+        std::vector<std::uint8_t> mBuffer;
+        std::vector<Entity> mEntities;
+        std::unordered_map<std::string, std::size_t> mEntityIndex;
+        std::vector<TileBlock> mTileBlocks;
+        // the revision of each tilemap layer at capture.
+        std::vector<std::uint64_t> mLayerRevisions;
+        std::size_t mNumStoredEntities = 0;
+        std::size_t mNumTileBlocks = 0;
+        double mSceneTime = 0.0;
+        // the offset of the scene script variables in the buffer.
+        std::size_t mSceneStateOffset = 0;
+    };
+
+} // namespace
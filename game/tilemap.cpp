@@ -20,15 +20,21 @@
 #include "warnpop.h"
 
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
 #include <vector>
 #include <tuple>
 #include <set>
+#include <unordered_set>
+#include <unordered_map>
 #include <limits>
+#include <mutex>
 
 #include "base/logging.h"
 #include "base/utility.h"
 #include "base/hash.h"
+#include "base/math.h"
+#include "base/threadpool.h"
 #include "data/writer.h"
 #include "data/reader.h"
 #include "game/tilemap.h"
@@ -221,124 +227,103 @@ public:
         data.Write(&header, sizeof(header), 0);
     }
 
-    virtual void LoadCache(const game::TilemapData& data, const Tile& default_tile,
-                           TileCache& cache, size_t cache_index,
+    virtual bool LoadCache(const game::TilemapData& data, const Tile& default_tile,
+                           TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
                            unsigned layer_width_tiles,
                            unsigned layer_height_tiles) const override
     {
-        const auto layer_tile_count  = layer_width_tiles * layer_height_tiles;
-        const auto cache_size_tiles  = cache.size();
-        const auto cache_index_tiles = cache_index * cache_size_tiles;
-        const auto max_tiles = std::min(cache_size_tiles, layer_tile_count - cache_index_tiles);
+        ASSERT(cache.size() == cache_width_tiles * cache_height_tiles);
+
+        // the first tile covered by the cache in layer rows and columns.
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        const auto max_rows  = std::min(cache_height_tiles, layer_height_tiles - first_row);
+        const auto max_cols  = std::min(cache_width_tiles, layer_width_tiles - first_col);
 
         // the size of the layer in even blocks.
-        const auto layer_width_blocks  = base::EvenMultiple(layer_width_tiles, mBlockWidth) / mBlockWidth;
-        const auto layer_height_blocks = base::EvenMultiple(layer_height_tiles, mBlockHeight) / mBlockHeight;
+        const auto layer_width_blocks = base::EvenMultiple(layer_width_tiles, mBlockWidth) / mBlockWidth;
 
-        TileBlock* block = nullptr;
+        std::fill(cache.begin(), cache.end(), default_tile);
 
-        for (size_t i=0; i<max_tiles; ++i)
+        for (unsigned row=0; row<max_rows; ++row)
         {
-            const auto tile_index   = cache_index_tiles + i;
-            // index of the tile in the layer expressed in layer row and column.
-            const auto tile_row    = tile_index / layer_width_tiles;
-            const auto tile_col    = tile_index % layer_width_tiles;
-            // index of the tile expressed in block row and column.
-            const auto block_row   = tile_row / mBlockHeight;
-            const auto block_col   = tile_col / mBlockWidth;
-            // index of the block
-            const auto block_index = block_row * layer_width_blocks + block_col;
-            // offset of the tile within the block.
+            const auto tile_row  = first_row + row;
+            const auto block_row = tile_row / mBlockHeight;
             const auto inside_block_row = tile_row & (mBlockHeight - 1);
-            const auto inside_block_col = tile_col & (mBlockWidth - 1);
-            const auto inside_block_tile_index = inside_block_row * mBlockWidth + inside_block_col;
-            // sanity.
-            ASSERT(tile_row < layer_height_tiles && tile_col < layer_width_tiles);
-            ASSERT(block_row < layer_height_blocks && block_col < layer_width_blocks);
-            ASSERT(inside_block_row < mBlockHeight && inside_block_col < mBlockWidth);
-
-            if ((block == nullptr) || (block->block_index != block_index))
-            {
-                block = nullptr;
-                // lower bound returns an iterator pointing to a first value in the range
-                // such that the contained value is equal or greater than searched value
-                // or end() when no such value is found.
-                auto it = std::lower_bound(mBlocks.begin(), mBlocks.end(), block_index,
-                    [](const TileBlock& block, size_t index) {
-                        return block.block_index < index;
-                    });
-                if (it != mBlocks.end() && (*it).block_index == block_index)
-                    block = &(*it);
-            }
-            if (block)
-            {
-                data.Read(&cache[i], sizeof(Tile), block->data_byte_offset + inside_block_tile_index * sizeof(Tile));
-            }
-            else
+            auto* cache_tiles = &cache[row * cache_width_tiles];
+
+            // copy the cache row in runs of tiles that are
+            // contiguous inside a single tile block.
+            for (unsigned col=0; col<max_cols;)
             {
-                cache[i] = default_tile;
+                const auto tile_col  = first_col + col;
+                const auto block_col = tile_col / mBlockWidth;
+                const auto inside_block_col = tile_col & (mBlockWidth - 1);
+                const auto run_tiles = std::min(max_cols - col, mBlockWidth - inside_block_col);
+                const auto block_index = block_row * layer_width_blocks + block_col;
+
+                auto it = FindBlock(block_index);
+                if (it != mBlocks.end() && it->block_index == block_index)
+                {
+                    const auto inside_block_tile_index = inside_block_row * mBlockWidth + inside_block_col;
+                    data.Read(&cache_tiles[col], run_tiles * sizeof(Tile),
+                              it->data_byte_offset + inside_block_tile_index * sizeof(Tile));
+                }
+                col += run_tiles;
             }
         }
+        return true;
     }
     virtual void SaveCache(game::TilemapData& data, const Tile& default_tile,
-                           const TileCache& cache, size_t cache_index,
+                           const TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
                            unsigned layer_width_tiles,
                            unsigned layer_height_tiles) override
     {
+        ASSERT(cache.size() == cache_width_tiles * cache_height_tiles);
 
-        const auto layer_tile_count  = layer_width_tiles * layer_height_tiles;
-        const auto cache_size_tiles  = cache.size();
-        const auto cache_index_tiles = cache_index * cache_size_tiles;
-        const auto max_tiles = std::min(cache_size_tiles, layer_tile_count - cache_index_tiles);
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        const auto max_rows  = std::min(cache_height_tiles, layer_height_tiles - first_row);
+        const auto max_cols  = std::min(cache_width_tiles, layer_width_tiles - first_col);
 
         // the size of the layer in even blocks.
-        const auto layer_width_blocks  = base::EvenMultiple(layer_width_tiles, mBlockWidth) / mBlockWidth;
-        const auto layer_height_blocks = base::EvenMultiple(layer_height_tiles, mBlockHeight) / mBlockHeight;
+        const auto layer_width_blocks = base::EvenMultiple(layer_width_tiles, mBlockWidth) / mBlockWidth;
 
-        TileBlock* block = nullptr;
-
-        for (size_t i=0; i<max_tiles; ++i)
+        for (unsigned row=0; row<max_rows; ++row)
         {
-            // this optimization breaks when the intention is to actually
-            // "remove" the value previously written to a tile.
-            //if (cache[i] == default_tile)
-            //    continue;
-
-            // index of the tile in the layer
-            const auto tile_index  = cache_index_tiles + i;
-            // index of the tile in the layer expressed in layer row and column.
-            const auto tile_row    = tile_index / layer_width_tiles;
-            const auto tile_col    = tile_index % layer_width_tiles;
-            // index of the tile expressed in block row and column.
-            const auto block_row   = tile_row / mBlockHeight;
-            const auto block_col   = tile_col / mBlockWidth;
-            // index of the block
-            const auto block_index = block_row * layer_width_blocks + block_col;
-            // offset of the tile within the block.
+            const auto tile_row  = first_row + row;
+            const auto block_row = tile_row / mBlockHeight;
             const auto inside_block_row = tile_row & (mBlockHeight - 1);
-            const auto inside_block_col = tile_col & (mBlockWidth - 1);
-            const auto inside_block_tile_index = inside_block_row * mBlockWidth + inside_block_col;
-
-            // sanity.
-            ASSERT(tile_row < layer_height_tiles && tile_col < layer_width_tiles);
-            ASSERT(block_row < layer_height_blocks && block_col < layer_width_blocks);
-            ASSERT(inside_block_row < mBlockHeight && inside_block_col < mBlockWidth);
+            const auto* cache_tiles = &cache[row * cache_width_tiles];
 
-            if ((block == nullptr) || (block->block_index != block_index))
+            for (unsigned col=0; col<max_cols;)
             {
-                // lower bound returns an iterator pointing to a first value in the range
-                // such that the contained value is equal or greater than searched value
-                // or end() when no such value is found.
-                auto it = std::lower_bound(mBlocks.begin(), mBlocks.end(), block_index,
-                    [](const TileBlock& block, size_t index) {
-                        return block.block_index < index;
-                    });
-                
-                if (it == mBlocks.end() && cache[i] == default_tile)
-                    continue;
-
-                if (it == mBlocks.end() || (*it).block_index != block_index)
+                const auto tile_col  = first_col + col;
+                const auto block_col = tile_col / mBlockWidth;
+                const auto inside_block_col = tile_col & (mBlockWidth - 1);
+                const auto run_tiles = std::min(max_cols - col, mBlockWidth - inside_block_col);
+                const auto block_index = block_row * layer_width_blocks + block_col;
+                const auto* run_begin = &cache_tiles[col];
+                const auto* run_end   = &cache_tiles[col + run_tiles];
+                col += run_tiles;
+
+                auto it = FindBlock(block_index);
+                if (it == mBlocks.end() || it->block_index != block_index)
                 {
+                    // no need to allocate a new block for writing default tiles.
+                    // note that we can't skip writing default tiles into an existing
+                    // block since that would break "removing" a previously written value.
+                    if (std::all_of(run_begin, run_end, [&default_tile](const Tile& tile) {
+                            return tile == default_tile;
+                        }))
+                        continue;
+
                     const auto block_size_bytes = mBlockHeight * mBlockWidth * sizeof(Tile);
                     const auto block_base_offset = data.AppendChunk(block_size_bytes + sizeof(BlockHeader));
                     const auto block_data_offset = block_base_offset + sizeof(BlockHeader);
@@ -352,9 +337,10 @@ public:
                     data.ClearChunk(&default_tile, sizeof(Tile), block_data_offset, mBlockHeight*mBlockWidth);
                     it = mBlocks.insert(it, next_block);
                 }
-                block = &(*it);
+                const auto inside_block_tile_index = inside_block_row * mBlockWidth + inside_block_col;
+                data.Write(run_begin, run_tiles * sizeof(Tile),
+                           it->data_byte_offset + inside_block_tile_index * sizeof(Tile));
             }
-            data.Write(&cache[i], sizeof(Tile),  block->data_byte_offset + inside_block_tile_index * sizeof(Tile));
         }
     }
     virtual size_t GetByteCount() const override
@@ -371,6 +357,16 @@ private:
             return block_index < other.block_index;
         }
     };
+    typename std::vector<TileBlock>::iterator FindBlock(size_t block_index) const
+    {
+        // lower bound returns an iterator pointing to a first value in the range
+        // such that the contained value is equal or greater than searched value
+        // or end() when no such value is found.
+        return std::lower_bound(mBlocks.begin(), mBlocks.end(), block_index,
+            [](const TileBlock& block, size_t index) {
+                return block.block_index < index;
+            });
+    }
     uint32_t mBlockWidth  = 32;
     uint32_t mBlockHeight = 32;
     mutable std::vector<TileBlock> mBlocks;
@@ -473,37 +469,909 @@ public:
     virtual void SaveState(game::TilemapData& data) const override
     {}
 
-    virtual void LoadCache(const game::TilemapData& data, const Tile& default_tile,
-                           TileCache& cache, size_t cache_index,
+    virtual bool LoadCache(const game::TilemapData& data, const Tile& default_tile,
+                           TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
                            unsigned layer_width_tiles,
                            unsigned layer_height_tiles) const override
     {
-        const auto [bytes_read, buff_byte_offset] = ToBytes(cache_index, cache.size(), layer_width_tiles, layer_height_tiles);
+        ASSERT(cache.size() == cache_width_tiles * cache_height_tiles);
+
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        const auto max_rows  = std::min(cache_height_tiles, layer_height_tiles - first_row);
+        const auto max_cols  = std::min(cache_width_tiles, layer_width_tiles - first_col);
+
+        // the parts of the cache block outside the layer get the default value.
+        if (max_rows < cache_height_tiles || max_cols < cache_width_tiles)
+            std::fill(cache.begin(), cache.end(), default_tile);
 
-        data.Read(cache.data(), bytes_read, buff_byte_offset + sizeof(Header));
+        for (unsigned row=0; row<max_rows; ++row)
+        {
+            const auto buff_byte_offset = ((first_row + row) * layer_width_tiles + first_col) * sizeof(Tile);
+            data.Read(&cache[row * cache_width_tiles], max_cols * sizeof(Tile), buff_byte_offset + sizeof(Header));
+        }
+        return true;
     }
     virtual void SaveCache(game::TilemapData& data, const Tile& default_tile,
-                           const TileCache& cache, size_t cache_index,
+                           const TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
                            unsigned layer_width_tiles,
                            unsigned layer_height_tiles) override
     {
-        const auto [bytes_write, buff_byte_offset] = ToBytes(cache_index, cache.size(), layer_width_tiles, layer_height_tiles);
+        ASSERT(cache.size() == cache_width_tiles * cache_height_tiles);
+
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        const auto max_rows  = std::min(cache_height_tiles, layer_height_tiles - first_row);
+        const auto max_cols  = std::min(cache_width_tiles, layer_width_tiles - first_col);
 
-        data.Write(cache.data(), bytes_write, buff_byte_offset + sizeof(Header));
+        for (unsigned row=0; row<max_rows; ++row)
+        {
+            const auto buff_byte_offset = ((first_row + row) * layer_width_tiles + first_col) * sizeof(Tile);
+            data.Write(&cache[row * cache_width_tiles], max_cols * sizeof(Tile), buff_byte_offset + sizeof(Header));
+        }
     }
     virtual size_t GetByteCount() const override
     {
         return 0;
     }
+};
+
+// Compress the tiles by encoding runs of identical tiles. Each run is
+// encoded as a byte specifying the run length - 1 followed by the tile
+// bytes. Works well for data layers that tend to have large areas of
+// the same value.
+void CompressRunLength(const uint8_t* tiles, size_t tile_size, size_t tile_count, std::vector<uint8_t>* out)
+{
+    out->clear();
+    for (size_t i=0; i<tile_count;)
+    {
+        const auto* tile = &tiles[i * tile_size];
+        size_t run = 1;
+        while (i + run < tile_count && run < 256 &&
+               std::memcmp(tile, &tiles[(i + run) * tile_size], tile_size) == 0)
+            ++run;
+        out->push_back(static_cast<uint8_t>(run - 1));
+        out->insert(out->end(), tile, tile + tile_size);
+        i += run;
+    }
+}
+bool DecompressRunLength(const uint8_t* src, size_t src_bytes, size_t tile_size, size_t tile_count, uint8_t* tiles)
+{
+    const auto* end = src + src_bytes;
+    size_t count = 0;
+    while (src < end)
+    {
+        if (src + 1 + tile_size > end)
+            return false;
+        const size_t run = size_t(*src++) + 1;
+        if (count + run > tile_count)
+            return false;
+        for (size_t i=0; i<run; ++i, ++count)
+            std::memcpy(&tiles[count * tile_size], src, tile_size);
+        src += tile_size;
+    }
+    return count == tile_count;
+}
+
+// LZ77 byte compression using the LZ4 block sequence layout. Each sequence
+// is a token byte with the literal length in the high and the match length
+// (minus the minimum match) in the low nibble, optional length extension
+// bytes, the literals and a 16bit offset back to the match. The last
+// sequence has only literals. Works well for render layers where the same
+// patterns of tiles tend to repeat.
+constexpr size_t LZMinMatch = 4;
+constexpr size_t LZHashBits = 12;
+constexpr unsigned LZMaxChain = 16;
+
+void WriteLZLength(size_t length, std::vector<uint8_t>* out)
+{
+    for (; length >= 255; length -= 255)
+        out->push_back(255);
+    out->push_back(static_cast<uint8_t>(length));
+}
+void WriteLZSequence(const uint8_t* literals, size_t literal_count, size_t offset, size_t match_length,
+                     std::vector<uint8_t>* out)
+{
+    const auto match_code = match_length ? match_length - LZMinMatch : 0;
+    const auto token = (std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15);
+    out->push_back(static_cast<uint8_t>(token));
+    if (literal_count >= 15)
+        WriteLZLength(literal_count - 15, out);
+    out->insert(out->end(), literals, literals + literal_count);
+    if (match_length == 0)
+        return;
+    out->push_back(static_cast<uint8_t>(offset & 0xff));
+    out->push_back(static_cast<uint8_t>(offset >> 8));
+    if (match_code >= 15)
+        WriteLZLength(match_code - 15, out);
+}
+void CompressLZ(const uint8_t* src, size_t src_bytes, std::vector<uint8_t>* out)
+{
+    out->clear();
+
+    // hash chains of previous positions with the same 4 byte sequence.
+    // the blocks are small so keeping a chain link for every position
+    // and searching a few links back for the longest match is cheap.
+    int32_t head[1 << LZHashBits];
+    std::fill(std::begin(head), std::end(head), -1);
+    std::vector<int32_t> chain;
+    chain.resize(src_bytes, -1);
+
+    const auto read32 = [src](size_t pos) {
+        uint32_t value;
+        std::memcpy(&value, &src[pos], sizeof(value));
+        return value;
+    };
+    const auto hash = [](uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - LZHashBits);
+    };
+    const auto insert = [&](size_t pos) {
+        const auto h = hash(read32(pos));
+        chain[pos] = head[h];
+        head[h] = static_cast<int32_t>(pos);
+    };
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + LZMinMatch <= src_bytes)
+    {
+        const auto sequence = read32(pos);
+        size_t match_length = 0;
+        size_t match_offset = 0;
+        auto candidate = head[hash(sequence)];
+        for (unsigned depth=0; depth<LZMaxChain && candidate >= 0; ++depth, candidate = chain[candidate])
+        {
+            if (pos - candidate > 0xffff)
+                break;
+            if (read32(candidate) != sequence)
+                continue;
+            size_t length = LZMinMatch;
+            while (pos + length < src_bytes && src[candidate + length] == src[pos + length])
+                ++length;
+            if (length > match_length)
+            {
+                match_length = length;
+                match_offset = pos - candidate;
+            }
+        }
+        if (match_length == 0)
+        {
+            insert(pos++);
+            continue;
+        }
+        WriteLZSequence(&src[anchor], pos - anchor, match_offset, match_length, out);
+        for (const auto end = pos + match_length; pos < end; ++pos)
+        {
+            if (pos + LZMinMatch <= src_bytes)
+                insert(pos);
+        }
+        anchor = pos;
+    }
+    WriteLZSequence(&src[anchor], src_bytes - anchor, 0, 0, out);
+}
+bool ReadLZLength(const uint8_t*& src, const uint8_t* end, size_t* length)
+{
+    uint8_t byte = 0;
+    do {
+        if (src == end)
+            return false;
+        byte = *src++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+bool DecompressLZ(const uint8_t* src, size_t src_bytes, uint8_t* dst, size_t dst_bytes)
+{
+    const auto* end = src + src_bytes;
+    size_t pos = 0;
+    while (src < end)
+    {
+        const auto token = *src++;
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !ReadLZLength(src, end, &literal_count))
+            return false;
+        if (literal_count > size_t(end - src) || pos + literal_count > dst_bytes)
+            return false;
+        std::memcpy(&dst[pos], src, literal_count);
+        src += literal_count;
+        pos += literal_count;
+        if (src == end)
+            break;
+
+        if (end - src < 2)
+            return false;
+        const size_t offset = size_t(src[0]) | (size_t(src[1]) << 8);
+        src += 2;
+        size_t match_length = token & 0xf;
+        if (match_length == 15 && !ReadLZLength(src, end, &match_length))
+            return false;
+        match_length += LZMinMatch;
+        if (offset == 0 || offset > pos || pos + match_length > dst_bytes)
+            return false;
+        // the match can overlap with the output so copy byte by byte.
+        for (size_t i=0; i<match_length; ++i, ++pos)
+            dst[pos] = dst[pos - offset];
+    }
+    return pos == dst_bytes;
+}
+
+template<typename Tile>
+class CompressedTilemapLayer : public game::detail::TilemapLayerLoader<Tile>
+{
+public:
+    using TileCache = typename game::detail::TilemapLayerLoader<Tile>::TileCache;
+
+    // The size of the compressed blocks in tiles in both dimensions. The
+    // cache blocks are never larger than this so each cache block is
+    // contained inside a single compressed block.
+    static constexpr unsigned BlockSize = 32;
+
+    enum class Codec : uint32_t {
+        RunLength, LZ
+    };
+
+    struct Header {
+        uint32_t magic       = 0x5e1c0a7d;
+        uint32_t version     = 1;
+        uint32_t codec       = 0;
+        uint32_t block_count = 0;
+    };
+    // The block table follows the header and has an entry for every
+    // block of tiles in the layer in row major order.
+    struct BlockHeader {
+        // offset into the data buffer where the compressed block is.
+        uint32_t data_byte_offset = 0;
+        // the size of the compressed block data in bytes. zero means
+        // that the block has only default tiles and the size of the
+        // uncompressed tiles means that the block is stored as is.
+        uint32_t data_byte_size   = 0;
+    };
+
+    static void Initialize(const game::TilemapLayerClass& klass,
+                           game::TilemapData& data,
+                           unsigned map_width,
+                           unsigned map_height)
+    {
+        const auto layer_width  = klass.MapDimension(map_width);
+        const auto layer_height = klass.MapDimension(map_height);
+        const auto layer_width_blocks  = base::EvenMultiple(layer_width, BlockSize) / BlockSize;
+        const auto layer_height_blocks = base::EvenMultiple(layer_height, BlockSize) / BlockSize;
+
+        Header header;
+        header.codec = static_cast<uint32_t>(klass.HasRenderComponent() ? Codec::LZ : Codec::RunLength);
+        header.block_count = layer_width_blocks * layer_height_blocks;
+        data.Resize(sizeof(header) + header.block_count * sizeof(BlockHeader));
+        data.Write(&header, sizeof(header), 0);
+
+        // all the blocks start out with just the default tiles.
+        BlockHeader block;
+        data.ClearChunk(&block, sizeof(block), sizeof(header), header.block_count);
+        DEBUG("Initialized compressed tilemap layer on data. [layer_width=%1, layer_height=%2, blocks=%3]",
+              layer_width, layer_height, header.block_count);
+    }
+    static void ResizeCopy(const game::TilemapLayerClass& klass,
+                           const game::USize& src_map_size,
+                           const game::USize& dst_map_size,
+                           const game::TilemapData& src,
+                           game::TilemapData& dst)
+    {
+        CompressedTilemapLayer<Tile> src_layer;
+        CompressedTilemapLayer<Tile> dst_layer;
+
+        src_layer.LoadState(src);
+        dst_layer.LoadState(dst);
+
+        const auto src_layer_width_tiles  = klass.MapDimension(src_map_size.GetWidth());
+        const auto src_layer_height_tiles = klass.MapDimension(src_map_size.GetHeight());
+        const auto dst_layer_width_tiles  = klass.MapDimension(dst_map_size.GetWidth());
+        const auto dst_layer_height_tiles = klass.MapDimension(dst_map_size.GetHeight());
+
+        const auto& default_tile = klass.template GetDefaultTileValue<Tile>();
+
+        // the blocks are the same size in both layers so copy the layer
+        // over block by block. any tiles outside the src layer are
+        // filled with the default tile by the src block load.
+        const auto max_rows = std::min(src_layer_height_tiles, dst_layer_height_tiles);
+        const auto max_cols = std::min(src_layer_width_tiles, dst_layer_width_tiles);
+        const auto max_block_rows = base::EvenMultiple(max_rows, BlockSize) / BlockSize;
+        const auto max_block_cols = base::EvenMultiple(max_cols, BlockSize) / BlockSize;
+
+        TileCache tiles;
+        tiles.resize(BlockSize * BlockSize);
+
+        for (unsigned block_row=0; block_row<max_block_rows; ++block_row)
+        {
+            for (unsigned block_col=0; block_col<max_block_cols; ++block_col)
+            {
+                src_layer.LoadCache(src, default_tile, tiles, block_row, block_col, BlockSize, BlockSize,
+                                    src_layer_width_tiles, src_layer_height_tiles);
+                dst_layer.SaveCache(dst, default_tile, tiles, block_row, block_col, BlockSize, BlockSize,
+                                    dst_layer_width_tiles, dst_layer_height_tiles);
+            }
+        }
+        dst_layer.SaveState(dst);
+    }
+
+    virtual void LoadState(const game::TilemapData& data) override
+    {
+        Header header;
+        data.Read(&header, sizeof(header), 0);
+
+        std::vector<BlockHeader> headers;
+        headers.resize(header.block_count);
+        if (header.block_count)
+            data.Read(&headers[0], header.block_count * sizeof(BlockHeader), sizeof(header));
+
+        std::vector<TileBlock> blocks;
+        blocks.reserve(header.block_count);
+        for (const auto& block_header : headers)
+        {
+            TileBlock block;
+            block.data_byte_offset   = block_header.data_byte_offset;
+            block.data_byte_size     = block_header.data_byte_size;
+            block.data_byte_capacity = block_header.data_byte_size;
+            blocks.push_back(block);
+        }
+        mCodec        = static_cast<Codec>(header.codec);
+        mBlocks       = std::move(blocks);
+        mGarbageBytes = 0;
+        mScratchBlock = NoBlock;
+    }
+    virtual void SaveState(game::TilemapData& data) const override
+    {
+        const auto table_bytes = sizeof(Header) + mBlocks.size() * sizeof(BlockHeader);
+
+        // blocks that have grown have been moved to the end of the buffer
+        // leaving their previous data unused and blocks that have shrunk
+        // leave some unused space behind. compact the buffer so that the
+        // saved data is as small as possible.
+        auto unused_bytes = mGarbageBytes;
+        for (const auto& block : mBlocks)
+            unused_bytes += block.data_byte_capacity - block.data_byte_size;
+
+        if (unused_bytes)
+        {
+            std::vector<std::vector<uint8_t>> payloads;
+            payloads.resize(mBlocks.size());
+            for (size_t i=0; i<mBlocks.size(); ++i)
+            {
+                const auto& block = mBlocks[i];
+                if (block.data_byte_size == 0)
+                    continue;
+                payloads[i].resize(block.data_byte_size);
+                data.Read(&payloads[i][0], block.data_byte_size, block.data_byte_offset);
+            }
+            data.Resize(table_bytes);
+            for (size_t i=0; i<mBlocks.size(); ++i)
+            {
+                auto& block = mBlocks[i];
+                block.data_byte_offset   = 0;
+                block.data_byte_capacity = block.data_byte_size;
+                if (block.data_byte_size == 0)
+                    continue;
+                block.data_byte_offset = data.AppendChunk(block.data_byte_size);
+                data.Write(&payloads[i][0], block.data_byte_size, block.data_byte_offset);
+            }
+            mGarbageBytes = 0;
+        }
+
+        Header header;
+        header.codec       = static_cast<uint32_t>(mCodec);
+        header.block_count = mBlocks.size();
+        data.Write(&header, sizeof(header), 0);
+
+        std::vector<BlockHeader> headers;
+        headers.reserve(mBlocks.size());
+        for (const auto& block : mBlocks)
+        {
+            BlockHeader block_header;
+            block_header.data_byte_offset = block.data_byte_offset;
+            block_header.data_byte_size   = block.data_byte_size;
+            headers.push_back(block_header);
+        }
+        if (!headers.empty())
+            data.Write(&headers[0], headers.size() * sizeof(BlockHeader), sizeof(header));
+    }
+
+    virtual bool LoadCache(const game::TilemapData& data, const Tile& default_tile,
+                           TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
+                           unsigned layer_width_tiles,
+                           unsigned layer_height_tiles) const override
+    {
+        ASSERT(cache.size() == cache_width_tiles * cache_height_tiles);
+
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        const auto max_rows  = std::min(cache_height_tiles, layer_height_tiles - first_row);
+        const auto max_cols  = std::min(cache_width_tiles, layer_width_tiles - first_col);
+        const auto layer_width_blocks = base::EvenMultiple(layer_width_tiles, BlockSize) / BlockSize;
+
+        // the parts of the cache block outside the layer get the default value.
+        if (max_rows < cache_height_tiles || max_cols < cache_width_tiles)
+            std::fill(cache.begin(), cache.end(), default_tile);
+
+        // visit each compressed block overlapping the cache block and
+        // copy the overlapping rows of tiles over.
+        for (unsigned row=0; row<max_rows;)
+        {
+            const auto tile_row = first_row + row;
+            const auto inside_block_row = tile_row % BlockSize;
+            const auto rows = std::min(max_rows - row, BlockSize - inside_block_row);
+            for (unsigned col=0; col<max_cols;)
+            {
+                const auto tile_col = first_col + col;
+                const auto inside_block_col = tile_col % BlockSize;
+                const auto cols = std::min(max_cols - col, BlockSize - inside_block_col);
+                const auto block_index = (tile_row / BlockSize) * layer_width_blocks + tile_col / BlockSize;
+                const auto* tiles = load_block(data, default_tile, block_index);
+                for (unsigned i=0; i<rows; ++i)
+                {
+                    std::copy_n(&tiles[(inside_block_row + i) * BlockSize + inside_block_col], cols,
+                                &cache[(row + i) * cache_width_tiles + col]);
+                }
+                col += cols;
+            }
+            row += rows;
+        }
+        return true;
+    }
+    virtual void SaveCache(game::TilemapData& data, const Tile& default_tile,
+                           const TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
+                           unsigned layer_width_tiles,
+                           unsigned layer_height_tiles) override
+    {
+        ASSERT(cache.size() == cache_width_tiles * cache_height_tiles);
+
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        const auto max_rows  = std::min(cache_height_tiles, layer_height_tiles - first_row);
+        const auto max_cols  = std::min(cache_width_tiles, layer_width_tiles - first_col);
+        const auto layer_width_blocks = base::EvenMultiple(layer_width_tiles, BlockSize) / BlockSize;
+
+        for (unsigned row=0; row<max_rows;)
+        {
+            const auto tile_row = first_row + row;
+            const auto inside_block_row = tile_row % BlockSize;
+            const auto rows = std::min(max_rows - row, BlockSize - inside_block_row);
+            for (unsigned col=0; col<max_cols;)
+            {
+                const auto tile_col = first_col + col;
+                const auto inside_block_col = tile_col % BlockSize;
+                const auto cols = std::min(max_cols - col, BlockSize - inside_block_col);
+                const auto block_index = (tile_row / BlockSize) * layer_width_blocks + tile_col / BlockSize;
+                auto* tiles = load_block(data, default_tile, block_index);
+                for (unsigned i=0; i<rows; ++i)
+                {
+                    std::copy_n(&cache[(row + i) * cache_width_tiles + col], cols,
+                                &tiles[(inside_block_row + i) * BlockSize + inside_block_col]);
+                }
+                save_block(data, default_tile, block_index);
+                col += cols;
+            }
+            row += rows;
+        }
+    }
+    virtual size_t GetByteCount() const override
+    {
+        return mBlocks.size() * sizeof(TileBlock) + mScratch.size() * sizeof(Tile);
+    }
 private:
-    std::tuple<size_t, size_t> ToBytes(size_t cache_index, size_t cache_size, unsigned layer_width, unsigned layer_height) const
+    static constexpr auto NoBlock = std::numeric_limits<std::size_t>::max();
+
+    struct TileBlock {
+        uint32_t data_byte_offset   = 0;
+        uint32_t data_byte_size     = 0;
+        // the size of the space allocated for the block in the data buffer.
+        uint32_t data_byte_capacity = 0;
+    };
+
+    // Decompress the block into the scratch buffer. The last decompressed
+    // block is kept around since consecutive cache loads and saves tend to
+    // hit the same block.
+    Tile* load_block(const game::TilemapData& data, const Tile& default_tile, std::size_t block_index) const
     {
-        const auto cache_size_bytes = cache_size * sizeof(Tile);
-        const auto buff_size_bytes  = layer_width * layer_height * sizeof(Tile);
-        const auto buff_byte_offset = cache_index * cache_size_bytes;
-        const auto max_bytes = std::min(buff_size_bytes - buff_byte_offset, cache_size_bytes);
-        return {max_bytes, buff_byte_offset};
+        ASSERT(block_index < mBlocks.size());
+        if (mScratchBlock == block_index)
+            return &mScratch[0];
+
+        mScratch.resize(BlockSize * BlockSize);
+        mScratchBlock = block_index;
+
+        const auto& block = mBlocks[block_index];
+        if (block.data_byte_size == 0)
+        {
+            std::fill(mScratch.begin(), mScratch.end(), default_tile);
+            return &mScratch[0];
+        }
+        mBuffer.resize(block.data_byte_size);
+        data.Read(&mBuffer[0], block.data_byte_size, block.data_byte_offset);
+
+        auto* tiles = reinterpret_cast<uint8_t*>(&mScratch[0]);
+        if (mBuffer.size() == mScratch.size() * sizeof(Tile))
+        {
+            std::memcpy(tiles, &mBuffer[0], mBuffer.size());
+            return &mScratch[0];
+        }
+        const auto ok = mCodec == Codec::LZ
+            ? DecompressLZ(&mBuffer[0], mBuffer.size(), tiles, mScratch.size() * sizeof(Tile))
+            : DecompressRunLength(&mBuffer[0], mBuffer.size(), sizeof(Tile), mScratch.size(), tiles);
+        if (!ok)
+        {
+            ERROR("Failed to decompress tilemap layer block. [block=%1]", block_index);
+            std::fill(mScratch.begin(), mScratch.end(), default_tile);
+        }
+        return &mScratch[0];
     }
+    // Compress the scratch buffer back into the block.
+    void save_block(game::TilemapData& data, const Tile& default_tile, std::size_t block_index)
+    {
+        ASSERT(mScratchBlock == block_index);
+        auto& block = mBlocks[block_index];
+
+        if (std::all_of(mScratch.begin(), mScratch.end(), [&default_tile](const Tile& tile) {
+                return tile == default_tile;
+            }))
+        {
+            mGarbageBytes += block.data_byte_capacity;
+            block.data_byte_offset   = 0;
+            block.data_byte_size     = 0;
+            block.data_byte_capacity = 0;
+            return;
+        }
+
+        const auto* tiles = reinterpret_cast<const uint8_t*>(&mScratch[0]);
+        if (mCodec == Codec::LZ)
+            CompressLZ(tiles, mScratch.size() * sizeof(Tile), &mBuffer);
+        else CompressRunLength(tiles, sizeof(Tile), mScratch.size(), &mBuffer);
+
+        // store the tiles as is if they don't compress.
+        if (mBuffer.size() >= mScratch.size() * sizeof(Tile))
+            mBuffer.assign(tiles, tiles + mScratch.size() * sizeof(Tile));
+
+        // if the block no longer fits in its place move it
+        // to the end of the buffer.
+        if (mBuffer.size() > block.data_byte_capacity)
+        {
+            mGarbageBytes += block.data_byte_capacity;
+            block.data_byte_offset   = data.AppendChunk(mBuffer.size());
+            block.data_byte_capacity = mBuffer.size();
+        }
+        block.data_byte_size = mBuffer.size();
+        data.Write(&mBuffer[0], mBuffer.size(), block.data_byte_offset);
+    }
+
+    Codec mCodec = Codec::RunLength;
+    mutable std::vector<TileBlock> mBlocks;
+    mutable std::size_t mGarbageBytes = 0;
+    // the most recently decompressed block.
+    mutable TileCache mScratch;
+    mutable std::size_t mScratchBlock = NoBlock;
+    // buffer for the compressed block data.
+    mutable std::vector<uint8_t> mBuffer;
+};
+
+// Streaming wrapper over the actual layer storage. The layer is divided into
+// square chunks of tiles which are loaded from the underlying storage by
+// background tasks on the thread pool and evicted once they're no longer
+// near the streaming region. Cache loads for chunks that aren't resident
+// fall back to the default tile.
+template<typename Tile>
+class StreamingTilemapLayer : public game::detail::TilemapLayerLoader<Tile>
+{
+public:
+    using TileLoader = game::detail::TilemapLayerLoader<Tile>;
+    using TileCache  = typename TileLoader::TileCache;
+    static constexpr auto ChunkSize = game::TilemapLayerClass::StreamingChunkSize;
+
+    explicit StreamingTilemapLayer(std::unique_ptr<TileLoader> loader)
+      : mState(std::make_shared<StreamState>())
+    {
+        mState->loader = std::move(loader);
+    }
+    virtual void LoadState(const game::TilemapData& data) override
+    {
+        std::lock_guard<std::mutex> lock(mState->io_mutex);
+        mState->loader->LoadState(data);
+        // any chunks still being loaded from the previous
+        // data will be ignored when they arrive.
+        ++mGeneration;
+        mChunks.clear();
+        mPending.clear();
+    }
+    virtual void SaveState(game::TilemapData& data) const override
+    {
+        std::lock_guard<std::mutex> lock(mState->io_mutex);
+        const auto layer_width_chunks = GetLayerChunks(mLayerWidth);
+        for (auto& [index, chunk] : mChunks)
+        {
+            if (!chunk.dirty)
+                continue;
+            const auto chunk_row = static_cast<unsigned>(index / layer_width_chunks);
+            const auto chunk_col = static_cast<unsigned>(index % layer_width_chunks);
+            mState->loader->SaveCache(data, mDefaultTile, chunk.tiles, chunk_row, chunk_col,
+                                      ChunkSize, ChunkSize, mLayerWidth, mLayerHeight);
+            chunk.dirty = false;
+        }
+        mState->loader->SaveState(data);
+    }
+    virtual bool LoadCache(const game::TilemapData& data, const Tile& default_tile,
+                           TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
+                           unsigned layer_width_tiles,
+                           unsigned layer_height_tiles) const override
+    {
+        // the cache blocks are never larger than a chunk so each
+        // cache block is always contained inside a single chunk.
+        ASSERT(ChunkSize % cache_width_tiles == 0 && ChunkSize % cache_height_tiles == 0);
+
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        const auto index = GetChunkIndex(first_row, first_col, layer_width_tiles);
+        const auto* chunk = base::SafeFind(mChunks, index);
+        if (chunk == nullptr)
+        {
+            std::fill(cache.begin(), cache.end(), default_tile);
+            return false;
+        }
+        const auto inside_chunk_row = first_row % ChunkSize;
+        const auto inside_chunk_col = first_col % ChunkSize;
+        for (unsigned row=0; row<cache_height_tiles; ++row)
+        {
+            std::copy_n(&chunk->tiles[(inside_chunk_row + row) * ChunkSize + inside_chunk_col],
+                        cache_width_tiles, &cache[row * cache_width_tiles]);
+        }
+        return true;
+    }
+    virtual void SaveCache(game::TilemapData& data, const Tile& default_tile,
+                           const TileCache& cache,
+                           unsigned cache_row, unsigned cache_col,
+                           unsigned cache_width_tiles,
+                           unsigned cache_height_tiles,
+                           unsigned layer_width_tiles,
+                           unsigned layer_height_tiles) override
+    {
+        ASSERT(ChunkSize % cache_width_tiles == 0 && ChunkSize % cache_height_tiles == 0);
+
+        const auto first_row = cache_row * cache_height_tiles;
+        const auto first_col = cache_col * cache_width_tiles;
+        WaitStreaming(data, default_tile, first_row, first_col, layer_width_tiles, layer_height_tiles);
+
+        auto& chunk = mChunks[GetChunkIndex(first_row, first_col, layer_width_tiles)];
+        const auto inside_chunk_row = first_row % ChunkSize;
+        const auto inside_chunk_col = first_col % ChunkSize;
+        for (unsigned row=0; row<cache_height_tiles; ++row)
+        {
+            std::copy_n(&cache[row * cache_width_tiles], cache_width_tiles,
+                        &chunk.tiles[(inside_chunk_row + row) * ChunkSize + inside_chunk_col]);
+        }
+        // modified chunks stay resident until saved.
+        chunk.dirty   = true;
+        mDefaultTile  = default_tile;
+        mLayerWidth   = layer_width_tiles;
+        mLayerHeight  = layer_height_tiles;
+    }
+    virtual size_t GetByteCount() const override
+    {
+        return mState->loader->GetByteCount() + mChunks.size() * ChunkSize * ChunkSize * sizeof(Tile);
+    }
+    virtual bool IsStreaming() const override
+    {
+        return true;
+    }
+    virtual bool UpdateStreaming(const std::shared_ptr<const game::TilemapData>& data,
+                                 const Tile& default_tile,
+                                 const game::URect& tile_region,
+                                 unsigned layer_width_tiles,
+                                 unsigned layer_height_tiles) override
+    {
+        bool committed = false;
+
+        std::vector<LoadedChunk> loaded;
+        {
+            std::lock_guard<std::mutex> lock(mState->mutex);
+            std::swap(loaded, mState->loaded);
+        }
+        for (auto& chunk : loaded)
+        {
+            if (chunk.generation != mGeneration)
+                continue;
+            mPending.erase(chunk.index);
+            // could have been loaded synchronously already.
+            if (mChunks.find(chunk.index) != mChunks.end())
+                continue;
+            mChunks[chunk.index].tiles = std::move(chunk.tiles);
+            ++mStats.loaded_chunks;
+            committed = true;
+        }
+
+        const auto layer_width_chunks  = GetLayerChunks(layer_width_tiles);
+        const auto layer_height_chunks = GetLayerChunks(layer_height_tiles);
+        if (layer_width_chunks == 0 || layer_height_chunks == 0)
+            return committed;
+
+        // the range of chunks covering the region and a margin of one
+        // chunk around it so that the chunks are already resident by
+        // the time the region moves over them.
+        const auto min_col = std::min(tile_region.GetX() / ChunkSize, layer_width_chunks - 1);
+        const auto min_row = std::min(tile_region.GetY() / ChunkSize, layer_height_chunks - 1);
+        const auto max_col = std::min((tile_region.GetX() + std::max(tile_region.GetWidth(), 1u) - 1) / ChunkSize, layer_width_chunks - 1);
+        const auto max_row = std::min((tile_region.GetY() + std::max(tile_region.GetHeight(), 1u) - 1) / ChunkSize, layer_height_chunks - 1);
+        const auto first_col = min_col > 0 ? min_col - 1 : 0;
+        const auto first_row = min_row > 0 ? min_row - 1 : 0;
+        const auto last_col  = std::min(max_col + 1, layer_width_chunks - 1);
+        const auto last_row  = std::min(max_row + 1, layer_height_chunks - 1);
+
+        auto* pool = base::GetGlobalThreadPool();
+
+        for (unsigned row=first_row; row<=last_row; ++row)
+        {
+            for (unsigned col=first_col; col<=last_col; ++col)
+            {
+                const std::size_t index = row * layer_width_chunks + col;
+                if (mChunks.find(index) != mChunks.end() || mPending.find(index) != mPending.end())
+                    continue;
+
+                if (pool)
+                {
+                    auto task = std::make_unique<LoadChunkTask>(mState, data, default_tile, mGeneration, index,
+                                                                row, col, layer_width_tiles, layer_height_tiles);
+                    task->SetTaskName("LoadTilemapChunk");
+                    pool->SubmitTask(std::move(task), base::ThreadPool::AnyWorkerThreadID);
+                    mPending.insert(index);
+                }
+                else
+                {
+                    auto& chunk = mChunks[index];
+                    LoadChunk(*mState, *data, default_tile, row, col, layer_width_tiles, layer_height_tiles, &chunk.tiles);
+                    ++mStats.loaded_chunks;
+                    committed = true;
+                }
+            }
+        }
+
+        for (auto it = mChunks.begin(); it != mChunks.end();)
+        {
+            const auto row = static_cast<unsigned>(it->first / layer_width_chunks);
+            const auto col = static_cast<unsigned>(it->first % layer_width_chunks);
+            const auto inside = row >= first_row && row <= last_row &&
+                                col >= first_col && col <= last_col;
+            if (inside || it->second.dirty)
+            {
+                ++it;
+                continue;
+            }
+            it = mChunks.erase(it);
+            ++mStats.evicted_chunks;
+        }
+        return committed;
+    }
+    virtual void WaitStreaming(const game::TilemapData& data,
+                               const Tile& default_tile,
+                               unsigned tile_row, unsigned tile_col,
+                               unsigned layer_width_tiles,
+                               unsigned layer_height_tiles) override
+    {
+        const auto index = GetChunkIndex(tile_row, tile_col, layer_width_tiles);
+        if (mChunks.find(index) != mChunks.end())
+            return;
+
+        // load the chunk on the calling thread, if there's a pending
+        // load for the same chunk the result will be discarded.
+        auto& chunk = mChunks[index];
+        LoadChunk(*mState, data, default_tile, tile_row / ChunkSize, tile_col / ChunkSize,
+                  layer_width_tiles, layer_height_tiles, &chunk.tiles);
+        ++mStats.loaded_chunks;
+    }
+    virtual game::TilemapLayerStreamStats GetStreamStats() const override
+    {
+        auto stats = mStats;
+        stats.resident_chunks = mChunks.size();
+        stats.pending_chunks  = mPending.size();
+        return stats;
+    }
+private:
+    struct LoadedChunk {
+        unsigned generation = 0;
+        std::size_t index = 0;
+        TileCache tiles;
+    };
+    // State shared with the background chunk loading tasks.
+    struct StreamState {
+        // serialize the access to the underlying loader and data.
+        std::mutex io_mutex;
+        // protect the list of loaded chunks.
+        std::mutex mutex;
+        std::unique_ptr<TileLoader> loader;
+        std::vector<LoadedChunk> loaded;
+    };
+    struct Chunk {
+        TileCache tiles;
+        bool dirty = false;
+    };
+
+    class LoadChunkTask : public base::ThreadTask {
+    public:
+        LoadChunkTask(std::shared_ptr<StreamState> state,
+                      std::shared_ptr<const game::TilemapData> data,
+                      const Tile& default_tile,
+                      unsigned generation, std::size_t index,
+                      unsigned chunk_row, unsigned chunk_col,
+                      unsigned layer_width_tiles, unsigned layer_height_tiles) noexcept
+          : mState(std::move(state))
+          , mData(std::move(data))
+          , mDefaultTile(default_tile)
+          , mGeneration(generation)
+          , mIndex(index)
+          , mChunkRow(chunk_row)
+          , mChunkCol(chunk_col)
+          , mLayerWidth(layer_width_tiles)
+          , mLayerHeight(layer_height_tiles)
+        {}
+    protected:
+        virtual void DoTask() override
+        {
+            LoadedChunk chunk;
+            chunk.generation = mGeneration;
+            chunk.index      = mIndex;
+            LoadChunk(*mState, *mData, mDefaultTile, mChunkRow, mChunkCol, mLayerWidth, mLayerHeight, &chunk.tiles);
+
+            std::lock_guard<std::mutex> lock(mState->mutex);
+            mState->loaded.push_back(std::move(chunk));
+        }
+    private:
+        std::shared_ptr<StreamState> mState;
+        std::shared_ptr<const game::TilemapData> mData;
+        const Tile mDefaultTile;
+        const unsigned mGeneration = 0;
+        const std::size_t mIndex = 0;
+        const unsigned mChunkRow = 0;
+        const unsigned mChunkCol = 0;
+        const unsigned mLayerWidth = 0;
+        const unsigned mLayerHeight = 0;
+    };
+
+    static void LoadChunk(StreamState& state, const game::TilemapData& data, const Tile& default_tile,
+                          unsigned chunk_row, unsigned chunk_col,
+                          unsigned layer_width_tiles, unsigned layer_height_tiles,
+                          TileCache* tiles)
+    {
+        tiles->resize(ChunkSize * ChunkSize);
+        std::lock_guard<std::mutex> lock(state.io_mutex);
+        state.loader->LoadCache(data, default_tile, *tiles, chunk_row, chunk_col,
+                                ChunkSize, ChunkSize, layer_width_tiles, layer_height_tiles);
+    }
+    static unsigned GetLayerChunks(unsigned layer_tiles)
+    {
+        return (layer_tiles + ChunkSize - 1) / ChunkSize;
+    }
+    static std::size_t GetChunkIndex(unsigned tile_row, unsigned tile_col, unsigned layer_width_tiles)
+    {
+        return (tile_row / ChunkSize) * GetLayerChunks(layer_width_tiles) + tile_col / ChunkSize;
+    }
+private:
+    std::shared_ptr<StreamState> mState;
+    mutable std::unordered_map<std::size_t, Chunk> mChunks;
+    std::unordered_set<std::size_t> mPending;
+    game::TilemapLayerStreamStats mStats;
+    unsigned mGeneration = 0;
+    // the layer properties as of the last cache save.
+    Tile mDefaultTile;
+    unsigned mLayerWidth  = 0;
+    unsigned mLayerHeight = 0;
 };
 
 typedef std::unique_ptr<game::TilemapLayer> (*LayerFactoryFunction)(const std::shared_ptr<const game::TilemapLayerClass>& klass,
@@ -514,7 +1382,9 @@ std::unique_ptr<game::TilemapLayer> CreateLayer(const std::shared_ptr<const game
 {
     using TileLoaderType = TileLoader<Tile>;
     using TileLayerType  = game::detail::TilemapLayerBase<Tile>;
-    auto loader = std::make_unique<TileLoaderType>();
+    std::unique_ptr<game::detail::TilemapLayerLoader<Tile>> loader = std::make_unique<TileLoaderType>();
+    if (klass->IsStreaming())
+        loader = std::make_unique<StreamingTilemapLayer<Tile>>(std::move(loader));
     auto layer  = std::make_unique<TileLayerType>(klass, std::move(loader), map_width, map_height);
     return layer;
 }
@@ -545,6 +1415,7 @@ std::size_t TilemapLayerClass::GetHash() const noexcept
     hash = base::hash_combine(hash, mStorage);
     hash = base::hash_combine(hash, GetType());
     hash = base::hash_combine(hash, mCache);
+    hash = base::hash_combine(hash, mCacheBudget);
     hash = base::hash_combine(hash, mResolution);
     hash = base::hash_combine(hash, mDefault);
     hash = base::hash_combine(hash, mDepth);
@@ -696,6 +1567,13 @@ void TilemapLayerClass::Initialize(unsigned map_width,
             DenseTilemapLayer<TileType>::Initialize(*this, data, map_width, map_height);
         }, mDefault);
     }
+    else if (mStorage == Storage::Compressed)
+    {
+        std::visit([&data, this, map_width, map_height](const auto& variant_value) {
+            using TileType = std::decay_t<decltype(variant_value)>;
+            CompressedTilemapLayer<TileType>::Initialize(*this, data, map_width, map_height);
+        }, mDefault);
+    }
     else
     {
         std::visit([&data, this, map_width, map_height](const auto& variant_value) {
@@ -717,6 +1595,13 @@ void TilemapLayerClass::ResizeCopy(const USize& src_map_size,
             DenseTilemapLayer<TileType>::ResizeCopy(*this, src_map_size, dst_map_size, src, dst);
         }, mDefault);
     }
+    else if (mStorage == Storage::Compressed)
+    {
+        std::visit([&src_map_size, &dst_map_size, &src, &dst, this](const auto& variant_value) {
+            using TileType = std::decay_t<decltype(variant_value)>;
+            CompressedTilemapLayer<TileType>::ResizeCopy(*this, src_map_size, dst_map_size, src, dst);
+        }, mDefault);
+    }
     else
     {
         std::visit([&src_map_size, &dst_map_size, &src, &dst, this](const auto& variant_value) {
@@ -737,6 +1622,7 @@ void TilemapLayerClass::IntoJson(data::Writer& data) const
     data.Write("storage",      mStorage);
     data.Write("type",         type);
     data.Write("cache",        mCache);
+    data.Write("cache_budget", mCacheBudget);
     data.Write("rez",          mResolution);
     data.Write("depth",        mDepth);
     data.Write("layer",        mRenderLayer);
@@ -779,6 +1665,8 @@ bool TilemapLayerClass::FromJson(const data::Reader& data)
     ok &= data.Read("flags",        &mFlags);
     ok &= data.Read("storage",      &mStorage);
     ok &= data.Read("cache",        &mCache);
+    if (data.HasValue("cache_budget"))
+        ok &= data.Read("cache_budget", &mCacheBudget);
     ok &= data.Read("rez",          &mResolution);
     ok &= data.Read("depth",        &mDepth);
     ok &= data.Read("layer",        &mRenderLayer);
@@ -902,6 +1790,38 @@ size_t TilemapLayerClass::GetCacheSize(Cache cache) noexcept
     return 0;
 }
 // static
+void TilemapLayerClass::GetCacheBlockSize(Cache cache, unsigned* block_width_tiles, unsigned* block_height_tiles) noexcept
+{
+    // the cache blocks are square or twice as wide as they're high
+    // so that both row scans and 2D neighborhood access stay local.
+    const auto cache_size = GetCacheSize(cache);
+    unsigned width  = 1;
+    unsigned height = 1;
+    while (width * height < cache_size)
+    {
+        if (width == height)
+            width *= 2;
+        else height *= 2;
+    }
+    *block_width_tiles  = width;
+    *block_height_tiles = height;
+}
+// static
+unsigned TilemapLayerClass::GetCacheBlockCount(Cache cache, unsigned budget_bytes, size_t tile_data_size,
+                                               unsigned layer_width_tiles, unsigned layer_height_tiles) noexcept
+{
+    unsigned block_width  = 0;
+    unsigned block_height = 0;
+    GetCacheBlockSize(cache, &block_width, &block_height);
+
+    const auto block_size_bytes = block_width * block_height * tile_data_size;
+    const auto layer_width_blocks  = (layer_width_tiles + block_width - 1) / block_width;
+    const auto layer_height_blocks = (layer_height_tiles + block_height - 1) / block_height;
+    const auto layer_blocks = std::max(1u, layer_width_blocks * layer_height_blocks);
+    const auto budget_blocks = std::max(size_t(1), budget_bytes / block_size_bytes);
+    return (unsigned)std::min(budget_blocks, size_t(layer_blocks));
+}
+// static
 unsigned TilemapLayerClass::MapDimension(Resolution res, unsigned dim)
 {
     if (res == Resolution::Original) return dim;
@@ -1250,6 +2170,7 @@ bool Tilemap::Load(const Loader& loader)
         desc.data      = klass.GetDataId();
         desc.uri       = klass.GetDataUri();
         desc.read_only = klass.IsReadOnly();
+        desc.streaming = layer->IsStreaming();
         auto data = loader.LoadTilemapData(desc);
         if (data)
         {
@@ -1266,6 +2187,26 @@ bool Tilemap::Load(const Loader& loader)
     return success;
 }
 
+void Tilemap::UpdateStreaming(const FRect& map_region)
+{
+    for (auto& layer : mLayers)
+    {
+        if (!layer->IsLoaded() || !layer->IsStreaming())
+            continue;
+
+        const auto layer_tile_width  = mClass->GetTileWidth() * layer->GetTileSizeScaler();
+        const auto layer_tile_height = mClass->GetTileHeight() * layer->GetTileSizeScaler();
+        const auto layer_width  = layer->GetWidth();
+        const auto layer_height = layer->GetHeight();
+
+        const auto min_col = (unsigned)math::clamp(0.0f, (float)layer_width,  map_region.GetX() / layer_tile_width);
+        const auto min_row = (unsigned)math::clamp(0.0f, (float)layer_height, map_region.GetY() / layer_tile_height);
+        const auto max_col = (unsigned)math::clamp(0.0f, (float)layer_width,  map_region.GetMaxX() / layer_tile_width);
+        const auto max_row = (unsigned)math::clamp(0.0f, (float)layer_height, map_region.GetMaxY() / layer_tile_height);
+        layer->UpdateStreaming(URect(min_col, min_row, max_col - min_col, max_row - min_row));
+    }
+}
+
 void Tilemap::AddLayer(std::unique_ptr<TilemapLayer> layer)
 {
     mLayers.push_back(std::move(layer));
@@ -1346,35 +2287,46 @@ std::unique_ptr<TilemapLayer> CreateTilemapLayer(const std::shared_ptr<const Til
         LayerFactoryFunction function;
     };
     static LayerParamCombination combinations[] = {
-        {Type::Render,            Storage::Dense,  &CreateLayer<Render_Tile, DenseTilemapLayer>},
-        {Type::Render,            Storage::Dense,  &CreateLayer<Render_Tile, DenseTilemapLayer>},
-        {Type::Render,            Storage::Sparse, &CreateLayer<Render_Tile, SparseTilemapLayer>},
-        {Type::Render,            Storage::Sparse, &CreateLayer<Render_Tile, SparseTilemapLayer>},
-
-        {Type::Render_DataSInt4,  Storage::Dense,  &CreateLayer<Render_Data_Tile_SInt4,  DenseTilemapLayer>},
-        {Type::Render_DataSInt4,  Storage::Sparse, &CreateLayer<Render_Data_Tile_SInt4,  SparseTilemapLayer>},
-        {Type::Render_DataUInt4,  Storage::Dense,  &CreateLayer<Render_Data_Tile_UInt4,  DenseTilemapLayer>},
-        {Type::Render_DataUInt4,  Storage::Sparse, &CreateLayer<Render_Data_Tile_UInt4,  SparseTilemapLayer>},
-
-        {Type::Render_DataUInt8,  Storage::Dense,  &CreateLayer<Render_Data_Tile_UInt8,  DenseTilemapLayer>},
-        {Type::Render_DataUInt8,  Storage::Sparse, &CreateLayer<Render_Data_Tile_UInt8,  SparseTilemapLayer>},
-        {Type::Render_DataSInt8,  Storage::Dense,  &CreateLayer<Render_Data_Tile_SInt8,  DenseTilemapLayer>},
-        {Type::Render_DataSInt8,  Storage::Sparse, &CreateLayer<Render_Data_Tile_SInt8,  SparseTilemapLayer>},
-
-        {Type::Render_DataSInt24, Storage::Dense,  &CreateLayer<Render_Data_Tile_SInt24, DenseTilemapLayer>},
-        {Type::Render_DataSInt24, Storage::Sparse, &CreateLayer<Render_Data_Tile_SInt24, SparseTilemapLayer>},
-        {Type::Render_DataUInt24, Storage::Dense,  &CreateLayer<Render_Data_Tile_UInt24, DenseTilemapLayer>},
-        {Type::Render_DataUInt24, Storage::Sparse, &CreateLayer<Render_Data_Tile_UInt24, SparseTilemapLayer>},
-
-        {Type::DataUInt8,         Storage::Dense,  &CreateLayer<Data_Tile_UInt8, DenseTilemapLayer>},
-        {Type::DataUInt8,         Storage::Sparse, &CreateLayer<Data_Tile_UInt8, SparseTilemapLayer>},
-        {Type::DataSInt8,         Storage::Dense,  &CreateLayer<Data_Tile_SInt8, DenseTilemapLayer>},
-        {Type::DataSInt8,         Storage::Sparse, &CreateLayer<Data_Tile_SInt8, SparseTilemapLayer>},
-
-        {Type::DataUInt16,        Storage::Dense,  &CreateLayer<Data_Tile_UInt16, DenseTilemapLayer>},
-        {Type::DataUInt16,        Storage::Sparse, &CreateLayer<Data_Tile_UInt16, SparseTilemapLayer>},
-        {Type::DataSInt16,        Storage::Dense,  &CreateLayer<Data_Tile_SInt16, DenseTilemapLayer>},
-        {Type::DataSInt16,        Storage::Sparse, &CreateLayer<Data_Tile_SInt16, SparseTilemapLayer>},
+        {Type::Render,            Storage::Dense,      &CreateLayer<Render_Tile, DenseTilemapLayer>},
+        {Type::Render,            Storage::Dense,      &CreateLayer<Render_Tile, DenseTilemapLayer>},
+        {Type::Render,            Storage::Sparse,     &CreateLayer<Render_Tile, SparseTilemapLayer>},
+        {Type::Render,            Storage::Sparse,     &CreateLayer<Render_Tile, SparseTilemapLayer>},
+        {Type::Render,            Storage::Compressed, &CreateLayer<Render_Tile, CompressedTilemapLayer>},
+
+        {Type::Render_DataSInt4,  Storage::Dense,      &CreateLayer<Render_Data_Tile_SInt4,  DenseTilemapLayer>},
+        {Type::Render_DataSInt4,  Storage::Sparse,     &CreateLayer<Render_Data_Tile_SInt4,  SparseTilemapLayer>},
+        {Type::Render_DataSInt4,  Storage::Compressed, &CreateLayer<Render_Data_Tile_SInt4,  CompressedTilemapLayer>},
+        {Type::Render_DataUInt4,  Storage::Dense,      &CreateLayer<Render_Data_Tile_UInt4,  DenseTilemapLayer>},
+        {Type::Render_DataUInt4,  Storage::Sparse,     &CreateLayer<Render_Data_Tile_UInt4,  SparseTilemapLayer>},
+        {Type::Render_DataUInt4,  Storage::Compressed, &CreateLayer<Render_Data_Tile_UInt4,  CompressedTilemapLayer>},
+
+        {Type::Render_DataUInt8,  Storage::Dense,      &CreateLayer<Render_Data_Tile_UInt8,  DenseTilemapLayer>},
+        {Type::Render_DataUInt8,  Storage::Sparse,     &CreateLayer<Render_Data_Tile_UInt8,  SparseTilemapLayer>},
+        {Type::Render_DataUInt8,  Storage::Compressed, &CreateLayer<Render_Data_Tile_UInt8,  CompressedTilemapLayer>},
+        {Type::Render_DataSInt8,  Storage::Dense,      &CreateLayer<Render_Data_Tile_SInt8,  DenseTilemapLayer>},
+        {Type::Render_DataSInt8,  Storage::Sparse,     &CreateLayer<Render_Data_Tile_SInt8,  SparseTilemapLayer>},
+        {Type::Render_DataSInt8,  Storage::Compressed, &CreateLayer<Render_Data_Tile_SInt8,  CompressedTilemapLayer>},
+
+        {Type::Render_DataSInt24, Storage::Dense,      &CreateLayer<Render_Data_Tile_SInt24, DenseTilemapLayer>},
+        {Type::Render_DataSInt24, Storage::Sparse,     &CreateLayer<Render_Data_Tile_SInt24, SparseTilemapLayer>},
+        {Type::Render_DataSInt24, Storage::Compressed, &CreateLayer<Render_Data_Tile_SInt24, CompressedTilemapLayer>},
+        {Type::Render_DataUInt24, Storage::Dense,      &CreateLayer<Render_Data_Tile_UInt24, DenseTilemapLayer>},
+        {Type::Render_DataUInt24, Storage::Sparse,     &CreateLayer<Render_Data_Tile_UInt24, SparseTilemapLayer>},
+        {Type::Render_DataUInt24, Storage::Compressed, &CreateLayer<Render_Data_Tile_UInt24, CompressedTilemapLayer>},
+
+        {Type::DataUInt8,         Storage::Dense,      &CreateLayer<Data_Tile_UInt8, DenseTilemapLayer>},
+        {Type::DataUInt8,         Storage::Sparse,     &CreateLayer<Data_Tile_UInt8, SparseTilemapLayer>},
+        {Type::DataUInt8,         Storage::Compressed, &CreateLayer<Data_Tile_UInt8, CompressedTilemapLayer>},
+        {Type::DataSInt8,         Storage::Dense,      &CreateLayer<Data_Tile_SInt8, DenseTilemapLayer>},
+        {Type::DataSInt8,         Storage::Sparse,     &CreateLayer<Data_Tile_SInt8, SparseTilemapLayer>},
+        {Type::DataSInt8,         Storage::Compressed, &CreateLayer<Data_Tile_SInt8, CompressedTilemapLayer>},
+
+        {Type::DataUInt16,        Storage::Dense,      &CreateLayer<Data_Tile_UInt16, DenseTilemapLayer>},
+        {Type::DataUInt16,        Storage::Sparse,     &CreateLayer<Data_Tile_UInt16, SparseTilemapLayer>},
+        {Type::DataUInt16,        Storage::Compressed, &CreateLayer<Data_Tile_UInt16, CompressedTilemapLayer>},
+        {Type::DataSInt16,        Storage::Dense,      &CreateLayer<Data_Tile_SInt16, DenseTilemapLayer>},
+        {Type::DataSInt16,        Storage::Sparse,     &CreateLayer<Data_Tile_SInt16, SparseTilemapLayer>},
+        {Type::DataSInt16,        Storage::Compressed, &CreateLayer<Data_Tile_SInt16, CompressedTilemapLayer>},
     };
     const auto type = klass->GetType();
     const auto storage = klass->GetStorage();
@@ -22,6 +22,7 @@
 
 #include "warnpop.h"
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <memory>
@@ -312,12 +313,23 @@ namespace game
             VisibleInEditor,
             Visible,
             ReadOnly,
-            Enabled
+            Enabled,
+            // Load the layer data in chunks around the current view
+            // instead of keeping all of the layer data resident.
+            Streaming
         };
 
+        // The size of a streaming chunk in tiles in both dimensions.
+        static constexpr unsigned StreamingChunkSize = 64;
+
         enum class Storage {
             Sparse,
-            Dense
+            Dense,
+            // Store the layer in compressed blocks of tiles. Data layers
+            // are run length encoded and render layers use a LZ77 (LZ4
+            // style) byte compression. Blocks are decompressed when
+            // loading the tile cache.
+            Compressed
         };
         enum class Cache {
             Automatic,
@@ -370,6 +382,8 @@ namespace game
         { return mFlags.test(Flags::Visible); }
         inline bool IsEnabled() const noexcept
         { return mFlags.test(Flags::Enabled); }
+        inline bool IsStreaming() const noexcept
+        { return mFlags.test(Flags::Streaming); }
         inline bool TestFlag(Flags flag) const noexcept
         { return mFlags.test(flag); }
         inline Cache GetCache() const noexcept
@@ -408,6 +422,8 @@ namespace game
         { mFlags.set(Flags::Enabled, on_off); }
         inline void SetReadOnly(bool on_off) noexcept
         { mFlags.set(Flags::ReadOnly, on_off); }
+        inline void SetStreaming(bool on_off) noexcept
+        { mFlags.set(Flags::Streaming, on_off); }
         inline void SetFlags(base::bitflag<Flags> flags) noexcept
         { mFlags = flags; }
         inline void SetDepth(int depth) noexcept
@@ -416,6 +432,14 @@ namespace game
         { mRenderLayer = layer; }
         inline size_t GetCacheSize() const noexcept
         { return GetCacheSize(mCache); }
+        inline unsigned GetCacheMemoryBudget() const noexcept
+        { return mCacheBudget; }
+        inline void SetCacheMemoryBudget(unsigned bytes) noexcept
+        { mCacheBudget = bytes; }
+        inline void GetCacheBlockSize(unsigned* block_width_tiles, unsigned* block_height_tiles) const noexcept
+        { GetCacheBlockSize(mCache, block_width_tiles, block_height_tiles); }
+        inline unsigned GetCacheBlockCount(unsigned layer_width_tiles, unsigned layer_height_tiles) const noexcept
+        { return GetCacheBlockCount(mCache, mCacheBudget, GetTileDataSize(), layer_width_tiles, layer_height_tiles); }
         inline void SetPaletteMaterialId(std::string material, std::size_t palette_index)
         { mPalette[palette_index].materialId = std::move(material); }
         inline void SetPaletteMaterialTileIndex(std::uint8_t tile_index, std::size_t palette_index)
@@ -493,6 +517,13 @@ namespace game
         // Get the size of the layer's data unit.
         static size_t GetTileDataSize(Type type);
         static size_t GetCacheSize(Cache cache) noexcept;
+        // Get the dimensions of a single cache block. The cache blocks are
+        // 2D tiled and the cache size is the number of tiles in a block.
+        static void GetCacheBlockSize(Cache cache, unsigned* block_width_tiles, unsigned* block_height_tiles) noexcept;
+        // Compute how many cache blocks fit in the cache memory budget. This is
+        // always at least 1 and at most the number of blocks in the layer.
+        static unsigned GetCacheBlockCount(Cache cache, unsigned budget_bytes, size_t tile_data_size,
+                                           unsigned layer_width_tiles, unsigned layer_height_tiles) noexcept;
         static unsigned MapDimension(Resolution res, unsigned dim);
         static float GetTileSizeScaler(Resolution res);
 
@@ -515,12 +546,35 @@ namespace game
         std::unordered_map<std::size_t, PaletteEntry> mPalette;
         Storage mStorage = Storage::Dense;
         Cache mCache = Cache::Cache64;
+        // the maximum number of bytes used by a layer instance
+        // for caching the tile blocks.
+        unsigned mCacheBudget = 64 * 1024;
         Resolution mResolution = Resolution::Original;
         DefaultValue  mDefault;
         int mDepth = 0;
         int mRenderLayer = 0;
     };
 
+    struct TilemapLayerCacheStats {
+        // number of tile accesses that were served from the cache.
+        std::uint64_t hits = 0;
+        // number of tile accesses that needed a block to be loaded.
+        std::uint64_t misses = 0;
+        // number of dirty blocks written back to the layer data.
+        std::uint64_t writes = 0;
+    };
+
+    struct TilemapLayerStreamStats {
+        // number of chunks currently resident in memory.
+        std::size_t resident_chunks = 0;
+        // number of chunks currently being loaded.
+        std::size_t pending_chunks = 0;
+        // total number of chunks loaded.
+        std::uint64_t loaded_chunks = 0;
+        // total number of chunks evicted.
+        std::uint64_t evicted_chunks = 0;
+    };
+
     class TilemapLayer
     {
     public:
@@ -542,6 +596,22 @@ namespace game
 
         virtual void FlushCache() = 0;
 
+        virtual TilemapLayerCacheStats GetCacheStats() const = 0;
+        virtual void ResetCacheStats() = 0;
+
+        // Streaming layers keep only the chunks of data around the current
+        // tile region resident. Update the tile region (in layer tiles) to
+        // request the chunks in and around the region to be loaded, commit
+        // any chunks that have finished loading and evict chunks that are
+        // no longer needed. Reading or writing a tile whose chunk is not
+        // resident loads the chunk synchronously. Only the renderer reads
+        // the tiles without waiting (see TilemapLayerBase::GetResidentTile)
+        // in which case the tiles that are not resident read as the layer's
+        // default tile.
+        virtual bool IsStreaming() const = 0;
+        virtual void UpdateStreaming(const URect& tile_region) = 0;
+        virtual TilemapLayerStreamStats GetStreamStats() const = 0;
+
         virtual unsigned GetWidth() const = 0;
         virtual unsigned GetHeight() const = 0;
         virtual int GetDepth() const = 0;
@@ -557,6 +627,21 @@ namespace game
         virtual bool SetTileValue(int32_t value, unsigned row, unsigned col) = 0;
         virtual bool GetTileValue(int32_t* value, unsigned row, unsigned col) const = 0;
 
+        // The layer keeps track of the tiles written since the layer was
+        // loaded in blocks of tiles (the same blocks as in the tile cache).
+        // The layer revision is advanced on every tile write and each block
+        // records the revision of the last write into the block.
+        virtual std::uint64_t GetRevision() const = 0;
+        // Get the tile rectangles of the blocks that have been written
+        // after the given revision. Revision 0 lists every block written
+        // since the layer was loaded.
+        virtual void ListModifiedBlocks(std::uint64_t revision, std::vector<URect>* blocks) const = 0;
+        // Revert the tiles of a block (as returned by ListModifiedBlocks)
+        // back to the tiles the block had when the layer was loaded.
+        // The layer keeps a copy of the original tiles of every block
+        // that has been written since the layer was loaded for this.
+        virtual void RevertBlock(const URect& block) = 0;
+
         virtual void SetFlags(base::bitflag<Flags> flags) = 0;
 
         virtual const Class& GetClass() const = 0;
@@ -591,15 +676,49 @@ namespace game
 
             using TileCache = std::vector<Tile>;
 
-            virtual void LoadCache(const TilemapData& data, const Tile& default_tile,
-                                   TileCache& cache, size_t cache_index,
+            // The cache is a 2D block of cache_width_tiles x cache_height_tiles
+            // tiles in row-major order. The block at cache row and col covers
+            // the layer tiles starting at cache_row * cache_height_tiles and
+            // cache_col * cache_width_tiles. Parts of the block that fall outside
+            // the layer are filled with the default tile on load and ignored on save.
+            // Returns false if the data is not available yet (streaming) and
+            // the cache was filled with the default tile instead.
+            virtual bool LoadCache(const TilemapData& data, const Tile& default_tile,
+                                   TileCache& cache,
+                                   unsigned cache_row, unsigned cache_col,
+                                   unsigned cache_width_tiles,
+                                   unsigned cache_height_tiles,
                                    unsigned layer_width_tiles,
                                    unsigned layer_height_tiles) const = 0;
             virtual void SaveCache(TilemapData& data, const Tile& default_tile,
-                                   const TileCache& cache, size_t cache_index,
+                                   const TileCache& cache,
+                                   unsigned cache_row, unsigned cache_col,
+                                   unsigned cache_width_tiles,
+                                   unsigned cache_height_tiles,
                                    unsigned layer_width_tiles,
                                    unsigned layer_height_tiles) = 0;
             virtual size_t GetByteCount() const = 0;
+
+            // Streaming support. See TilemapLayer::UpdateStreaming. Returns true
+            // when new data has become resident.
+            virtual bool IsStreaming() const
+            { return false; }
+            virtual bool UpdateStreaming(const std::shared_ptr<const TilemapData>& data,
+                                         const Tile& default_tile,
+                                         const URect& tile_region,
+                                         unsigned layer_width_tiles,
+                                         unsigned layer_height_tiles)
+            { return false; }
+            // Make sure that the data for the tile at the given row and col
+            // is resident, blocking the caller until it is.
+            virtual void WaitStreaming(const TilemapData& data,
+                                       const Tile& default_tile,
+                                       unsigned tile_row, unsigned tile_col,
+                                       unsigned layer_width_tiles,
+                                       unsigned layer_height_tiles)
+            {}
+            virtual TilemapLayerStreamStats GetStreamStats() const
+            { return {}; }
         private:
         };
 
@@ -643,24 +762,108 @@ namespace game
 
             virtual void Load(const std::shared_ptr<TilemapData>& data) override
             {
-                const auto cache = mClass->GetCache();
+                const auto layer_width  = mClass->MapDimension(mMapWidth);
+                const auto layer_height = mClass->MapDimension(mMapHeight);
+
+                unsigned block_width  = 0;
+                unsigned block_height = 0;
+                mClass->GetCacheBlockSize(&block_width, &block_height);
+                mCacheBlockWidthShift  = 0;
+                mCacheBlockHeightShift = 0;
+                while ((1u << mCacheBlockWidthShift) < block_width)
+                    ++mCacheBlockWidthShift;
+                while ((1u << mCacheBlockHeightShift) < block_height)
+                    ++mCacheBlockHeightShift;
+                ASSERT((1u << mCacheBlockWidthShift) == block_width);
+                ASSERT((1u << mCacheBlockHeightShift) == block_height);
+
+                // divide the cache blocks into a power of two number of sets
+                // of N blocks. Each layer block maps to exactly one set and
+                // is LRU replaced within the set.
+                const auto block_count = mClass->GetCacheBlockCount(layer_width, layer_height);
+                mCacheWays = std::min(block_count, CacheWays);
+                mCacheSets = 1;
+                while (mCacheSets * 2 * mCacheWays <= block_count)
+                    mCacheSets *= 2;
+
                 mData = data;
-                mDirtyCache = false;
-                mTileCache.clear();
-                mTileCache.resize(mClass->GetCacheSize());
+                mLayerWidthBlocks = (layer_width + block_width - 1) / block_width;
+                mLayerHeightBlocks = (layer_height + block_height - 1) / block_height;
+                mBlockRevisions.clear();
+                mBlockRevisions.resize(mLayerWidthBlocks * mLayerHeightBlocks, 0);
+                mRevision = 0;
+                mOriginalBlocks.clear();
+
+                // dense layers read the tiles straight from the layer data
+                // so there's nothing to gain from the 2D block lookup. when
+                // the whole layer fits in the cache memory budget the layer
+                // is kept resident, otherwise a single span of tiles on one
+                // row is cached the same as the (linear) cache size.
+                mDenseSpan = DenseSpan {};
+                if (mClass->GetStorage() == TilemapLayerClass::Storage::Dense && !mLoader->IsStreaming() && layer_width)
+                {
+                    const auto layer_bytes = std::size_t(layer_width) * layer_height * sizeof(Tile);
+                    if (mClass->GetCacheMemoryBudget() >= layer_bytes)
+                    {
+                        mDenseSpan.width = layer_width;
+                        mDenseSpan.rows  = std::max(1u, layer_height);
+                    }
+                    else
+                    {
+                        mDenseSpan.width = (unsigned)std::min(mClass->GetCacheSize(), std::size_t(layer_width));
+                        mDenseSpan.rows  = 1;
+                    }
+                    mDenseSpan.layer_width = layer_width;
+                    mDenseSpan.layer_height = layer_height;
+                    mDenseSpan.spans_per_row = (layer_width + mDenseSpan.width - 1) / mDenseSpan.width;
+                    mDenseSpan.tiles.resize(std::size_t(mDenseSpan.width) * mDenseSpan.rows);
+                }
+
+                // the block cache isn't used by the dense path.
+                mCacheBlocks.clear();
+                mCacheBlocks.resize(mCacheSets * mCacheWays);
+                for (auto& block : mCacheBlocks)
+                {
+                    if (!mDenseSpan.width)
+                        block.tiles.resize(block_width * block_height);
+                }
+                mCacheBlock = 0;
+                mCacheClock = 0;
+
                 mLoader->LoadState(*mData);
-                mLoader->LoadCache(*mData, mClass->GetDefaultTileValue<Tile>(), mTileCache, 0,
-                                   mClass->MapDimension(mMapWidth),
-                                   mClass->MapDimension(mMapHeight));
             }
             virtual void FlushCache() override
             {
-                if (mDirtyCache)
-                    mLoader->SaveCache(*mData, mClass->GetDefaultTileValue<Tile>(), mTileCache, mCacheIndex,
-                                       mClass->MapDimension(mMapWidth),
-                                       mClass->MapDimension(mMapHeight));
-                mDirtyCache = false;
+                for (auto& block : mCacheBlocks)
+                    save_block(block);
+                save_span();
             }
+            virtual TilemapLayerCacheStats GetCacheStats() const override
+            { return mCacheStats; }
+            virtual void ResetCacheStats() override
+            { mCacheStats = TilemapLayerCacheStats {}; }
+            virtual bool IsStreaming() const override
+            { return mLoader->IsStreaming(); }
+            virtual void UpdateStreaming(const URect& tile_region) override
+            {
+                if (!mLoader->UpdateStreaming(mData, mClass->GetDefaultTileValue<Tile>(), tile_region,
+                                              mClass->MapDimension(mMapWidth),
+                                              mClass->MapDimension(mMapHeight)))
+                    return;
+                // drop the cache blocks that were loaded with the default
+                // tiles so that they get reloaded with the new data.
+                for (auto& block : mCacheBlocks)
+                {
+                    if (!block.fallback)
+                        continue;
+                    ASSERT(!block.dirty);
+                    block.index    = NoBlock;
+                    block.last_use = 0;
+                    block.fallback = false;
+                }
+            }
+            virtual TilemapLayerStreamStats GetStreamStats() const override
+            { return mLoader->GetStreamStats(); }
             virtual void Save() override
             {
                 mLoader->SaveState(*mData);
@@ -688,6 +891,45 @@ namespace game
             { return detail::SetTileValue(get_tile(row, col, true), value); }
             virtual bool GetTileValue(int32_t* value, unsigned row, unsigned col) const override
             { return detail::GetTileValue(get_tile(row, col, false), value); }
+            virtual std::uint64_t GetRevision() const override
+            { return mRevision; }
+            virtual void ListModifiedBlocks(std::uint64_t revision, std::vector<URect>* blocks) const override
+            {
+                const auto layer_width  = mClass->MapDimension(mMapWidth);
+                const auto layer_height = mClass->MapDimension(mMapHeight);
+                const auto block_width  = 1u << mCacheBlockWidthShift;
+                const auto block_height = 1u << mCacheBlockHeightShift;
+                for (size_t i=0; i<mBlockRevisions.size(); ++i)
+                {
+                    if (mBlockRevisions[i] <= revision)
+                        continue;
+                    const auto row = static_cast<unsigned>(i / mLayerWidthBlocks) * block_height;
+                    const auto col = static_cast<unsigned>(i % mLayerWidthBlocks) * block_width;
+                    blocks->push_back(URect(col, row,
+                                            std::min(block_width, layer_width - col),
+                                            std::min(block_height, layer_height - row)));
+                }
+            }
+            virtual void RevertBlock(const URect& block) override
+            {
+                const auto block_row = block.GetY() >> mCacheBlockHeightShift;
+                const auto block_col = block.GetX() >> mCacheBlockWidthShift;
+                const std::size_t block_index = block_row * mLayerWidthBlocks + block_col;
+                const auto* original = base::SafeFind(mOriginalBlocks, block_index);
+                if (original == nullptr)
+                    return;
+                const auto& tiles = *original;
+                const auto block_width  = 1u << mCacheBlockWidthShift;
+                const auto first_row = block_row << mCacheBlockHeightShift;
+                const auto first_col = block_col << mCacheBlockWidthShift;
+                const auto max_row = std::min(first_row + (1u << mCacheBlockHeightShift), GetHeight());
+                const auto max_col = std::min(first_col + block_width, GetWidth());
+                for (unsigned row=first_row; row<max_row; ++row)
+                {
+                    for (unsigned col=first_col; col<max_col; ++col)
+                        get_tile(row, col, true) = tiles[(row - first_row) * block_width + (col - first_col)];
+                }
+            }
             virtual void SetFlags(base::bitflag<Flags> flags) override
             { mFlags = flags; }
             virtual const TilemapLayerClass& GetClass() const override
@@ -697,50 +939,231 @@ namespace game
             void SetTile(const Tile& tile, unsigned row, unsigned col)
             { get_tile(row, col, true) = tile; }
             const Tile& GetTile(unsigned row, unsigned col) const
-            { return get_tile(row, col, false); }
+            { return get_tile(row, col, false, true); }
+            // Get the tile without waiting for the data of a streaming layer
+            // to become resident. If it isn't the layer's default tile is
+            // returned instead. Meant for the renderer which must not block
+            // on loading, any other reader should use GetTile.
+            const Tile& GetResidentTile(unsigned row, unsigned col) const
+            { return get_tile(row, col, false, false); }
         private:
-            const Tile& get_tile(unsigned row, unsigned col, bool dirty) const
-            { return const_cast<TilemapLayerBase*>(this)->get_tile(row, col, dirty); }
-
-            Tile& get_tile(unsigned row, unsigned col, bool dirty)
+            static constexpr unsigned CacheWays = 4;
+            static constexpr std::size_t NoBlock = std::numeric_limits<std::size_t>::max();
+
+            // Span of tiles of a dense layer. Either the whole layer
+            // or a part of a single tile row.
+            struct DenseSpan {
+                // index of the span in the layer (row-major order) or
+                // NoBlock when no span has been loaded.
+                std::size_t index = NoBlock;
+                // span dimensions in tiles. 0 when the layer doesn't
+                // use the dense path.
+                unsigned width = 0;
+                unsigned rows  = 0;
+                unsigned spans_per_row = 0;
+                unsigned layer_width  = 0;
+                unsigned layer_height = 0;
+                bool dirty = false;
+                std::vector<Tile> tiles;
+            };
+
+            struct CacheBlock {
+                // index of the block in the layer in row-major block order
+                // or NoBlock when the cache block is unused.
+                std::size_t index = NoBlock;
+                // the cache clock value on last access.
+                std::uint64_t last_use = 0;
+                bool dirty = false;
+                // the block was filled with the default tile since the
+                // data was not yet resident.
+                bool fallback = false;
+                std::vector<Tile> tiles;
+            };
+
+            const Tile& get_tile(unsigned row, unsigned col, bool dirty, bool wait = true) const
+            { return const_cast<TilemapLayerBase*>(this)->get_tile(row, col, dirty, wait); }
+
+            // Writing to a block requires the real data underneath since the
+            // whole block is written back, so dirty implies wait.
+            Tile& get_tile(unsigned row, unsigned col, bool dirty, bool wait = true)
             {
-                const auto layer_width  = mClass->MapDimension(mMapWidth);
-                const auto layer_height = mClass->MapDimension(mMapHeight);
-                const auto& default_tile = mClass->GetDefaultTileValue<Tile>();
-
-                ASSERT(col < layer_width);
-                ASSERT(row < layer_height);
+                ASSERT(col < mClass->MapDimension(mMapWidth));
+                ASSERT(row < mClass->MapDimension(mMapHeight));
                 // the units here are *tiles*
-                const auto tile_offset = row * layer_width + col;
-                const auto cache_size  = mTileCache.size();
-                const auto cache_index = tile_offset / cache_size;
+                const auto block_row   = row >> mCacheBlockHeightShift;
+                const auto block_col   = col >> mCacheBlockWidthShift;
+                const std::size_t block_index = block_row * mLayerWidthBlocks + block_col;
+                const auto inside_block_row = row & ((1u << mCacheBlockHeightShift) - 1);
+                const auto inside_block_col = col & ((1u << mCacheBlockWidthShift) - 1);
+                const auto inside_block_tile_index = (inside_block_row << mCacheBlockWidthShift) + inside_block_col;
+
+                if (dirty)
+                {
+                    // keep the original tiles of the block around on the
+                    // first write after loading for reverting the block.
+                    if (mBlockRevisions[block_index] == 0)
+                        save_original_block(block_index, block_row, block_col);
+                    mBlockRevisions[block_index] = ++mRevision;
+                }
+                wait = wait || dirty;
+
+                if (mDenseSpan.width)
+                    return get_span_tile(row, col, dirty);
 
-                if (cache_index == mCacheIndex)
+                // fast path, same block as on the previous access.
+                if (mCacheBlocks[mCacheBlock].index == block_index)
                 {
-                    mDirtyCache = mDirtyCache || dirty;
-                    return mTileCache[tile_offset & (cache_size -1)];
+                    auto& block = mCacheBlocks[mCacheBlock];
+                    if (wait && block.fallback)
+                        load_block(block, block_row, block_col, true);
+                    block.dirty = block.dirty || dirty;
+                    ++mCacheStats.hits;
+                    return block.tiles[inside_block_tile_index];
                 }
-                if (mDirtyCache)
+
+                const auto set_base = (block_index & (mCacheSets - 1)) * mCacheWays;
+                auto victim = set_base;
+                for (unsigned way=0; way<mCacheWays; ++way)
+                {
+                    auto& block = mCacheBlocks[set_base + way];
+                    if (block.index == block_index)
+                    {
+                        if (wait && block.fallback)
+                            load_block(block, block_row, block_col, true);
+                        block.dirty = block.dirty || dirty;
+                        block.last_use = ++mCacheClock;
+                        mCacheBlock = set_base + way;
+                        ++mCacheStats.hits;
+                        return block.tiles[inside_block_tile_index];
+                    }
+                    // unused blocks have last_use 0 and get picked first.
+                    if (block.last_use < mCacheBlocks[victim].last_use)
+                        victim = set_base + way;
+                }
+                ++mCacheStats.misses;
+
+                auto& block = mCacheBlocks[victim];
+                save_block(block);
+                block.index    = block_index;
+                block.dirty    = dirty;
+                block.last_use = ++mCacheClock;
+                load_block(block, block_row, block_col, wait);
+                mCacheBlock = victim;
+                return block.tiles[inside_block_tile_index];
+            }
+            Tile& get_span_tile(unsigned row, unsigned col, bool dirty)
+            {
+                const auto span_row = row / mDenseSpan.rows;
+                const auto span_col = col / mDenseSpan.width;
+                const std::size_t span_index = std::size_t(span_row) * mDenseSpan.spans_per_row + span_col;
+                if (mDenseSpan.index == span_index)
+                {
+                    ++mCacheStats.hits;
+                }
+                else
                 {
-                    mLoader->SaveCache(*mData, default_tile, mTileCache, mCacheIndex, layer_width, layer_height);
-                    mDirtyCache = false;
+                    ++mCacheStats.misses;
+                    save_span();
+                    mLoader->LoadCache(*mData, mClass->GetDefaultTileValue<Tile>(), mDenseSpan.tiles,
+                                       span_row, span_col, mDenseSpan.width, mDenseSpan.rows,
+                                       mDenseSpan.layer_width, mDenseSpan.layer_height);
+                    mDenseSpan.index = span_index;
                 }
-                mLoader->LoadCache(*mData, default_tile, mTileCache, cache_index, layer_width, layer_height);
-                mCacheIndex = cache_index;
-                mDirtyCache = dirty;
-                return mTileCache[tile_offset & (cache_size -1)];
+                mDenseSpan.dirty = mDenseSpan.dirty || dirty;
+                const auto inside_row = row - span_row * mDenseSpan.rows;
+                const auto inside_col = col - span_col * mDenseSpan.width;
+                return mDenseSpan.tiles[std::size_t(inside_row) * mDenseSpan.width + inside_col];
+            }
+            void save_span()
+            {
+                if (!mDenseSpan.dirty)
+                    return;
+                const auto span_row = static_cast<unsigned>(mDenseSpan.index / mDenseSpan.spans_per_row);
+                const auto span_col = static_cast<unsigned>(mDenseSpan.index % mDenseSpan.spans_per_row);
+                mLoader->SaveCache(*mData, mClass->GetDefaultTileValue<Tile>(), mDenseSpan.tiles,
+                                   span_row, span_col, mDenseSpan.width, mDenseSpan.rows,
+                                   mDenseSpan.layer_width, mDenseSpan.layer_height);
+                mDenseSpan.dirty = false;
+                ++mCacheStats.writes;
+            }
+            void save_original_block(std::size_t block_index, unsigned block_row, unsigned block_col)
+            {
+                const auto layer_width  = mClass->MapDimension(mMapWidth);
+                const auto layer_height = mClass->MapDimension(mMapHeight);
+                const auto& default_tile = mClass->GetDefaultTileValue<Tile>();
+                // a block that hasn't been written has the same tiles in
+                // the layer data as in any cached copy of the block.
+                auto& tiles = mOriginalBlocks[block_index];
+                tiles.resize(std::size_t(1) << (mCacheBlockWidthShift + mCacheBlockHeightShift));
+                mLoader->WaitStreaming(*mData, default_tile,
+                                       block_row << mCacheBlockHeightShift,
+                                       block_col << mCacheBlockWidthShift,
+                                       layer_width, layer_height);
+                mLoader->LoadCache(*mData, default_tile, tiles, block_row, block_col,
+                                   1u << mCacheBlockWidthShift,
+                                   1u << mCacheBlockHeightShift,
+                                   layer_width, layer_height);
+            }
+            void load_block(CacheBlock& block, unsigned block_row, unsigned block_col, bool wait)
+            {
+                const auto layer_width  = mClass->MapDimension(mMapWidth);
+                const auto layer_height = mClass->MapDimension(mMapHeight);
+                const auto& default_tile = mClass->GetDefaultTileValue<Tile>();
+                if (wait)
+                    mLoader->WaitStreaming(*mData, default_tile,
+                                           block_row << mCacheBlockHeightShift,
+                                           block_col << mCacheBlockWidthShift,
+                                           layer_width, layer_height);
+                block.fallback = !mLoader->LoadCache(*mData, default_tile, block.tiles,
+                                                     block_row, block_col,
+                                                     1u << mCacheBlockWidthShift,
+                                                     1u << mCacheBlockHeightShift,
+                                                     layer_width, layer_height);
+                ASSERT(!(wait && block.fallback));
+            }
+            void save_block(CacheBlock& block)
+            {
+                if (!block.dirty)
+                    return;
+                const auto block_row = static_cast<unsigned>(block.index / mLayerWidthBlocks);
+                const auto block_col = static_cast<unsigned>(block.index % mLayerWidthBlocks);
+                mLoader->SaveCache(*mData, mClass->GetDefaultTileValue<Tile>(), block.tiles,
+                                   block_row, block_col,
+                                   1u << mCacheBlockWidthShift,
+                                   1u << mCacheBlockHeightShift,
+                                   mClass->MapDimension(mMapWidth),
+                                   mClass->MapDimension(mMapHeight));
+                block.dirty = false;
+                ++mCacheStats.writes;
             }
         protected:
             std::shared_ptr<const TilemapLayerClass> mClass;
             std::unique_ptr<TileLoader> mLoader;
             std::shared_ptr<TilemapData> mData;
             std::unordered_map<size_t, std::string> mPalette;
-            std::vector<Tile> mTileCache;
-            std::size_t mCacheIndex = 0;
+            // N-way set associative LRU cache of 2D tile blocks.
+            // The block at set s and way w is at s * mCacheWays + w.
+            std::vector<CacheBlock> mCacheBlocks;
+            std::size_t mCacheBlock = 0;
+            std::uint64_t mCacheClock = 0;
+            // the direct path for dense layers, bypasses the block cache.
+            DenseSpan mDenseSpan;
+            unsigned mCacheWays = 0;
+            unsigned mCacheSets = 0;
+            unsigned mCacheBlockWidthShift  = 0;
+            unsigned mCacheBlockHeightShift = 0;
+            unsigned mLayerWidthBlocks = 0;
+            unsigned mLayerHeightBlocks = 0;
+            // the layer revision of the last write into each layer block.
+            std::vector<std::uint64_t> mBlockRevisions;
+            // the tiles of the blocks written since loading as they were
+            // when the layer was loaded.
+            std::unordered_map<std::size_t, std::vector<Tile>> mOriginalBlocks;
+            std::uint64_t mRevision = 0;
+            TilemapLayerCacheStats mCacheStats;
             base::bitflag<Flags> mFlags;
             unsigned mMapWidth  = 0;
             unsigned mMapHeight = 0;
-            bool mDirtyCache = false;
         };
 
     } // namespace
@@ -908,6 +1331,10 @@ namespace game
         // false if a layer failed to load.
         bool Load(const Loader& loader);
 
+        // Update the streaming layers to load the data around the given
+        // region of the map. The region is in map units on the tile plane.
+        void UpdateStreaming(const FRect& map_region);
+
         void AddLayer(std::unique_ptr<TilemapLayer> layer);
         void DeleteLayer(std::size_t index);
 
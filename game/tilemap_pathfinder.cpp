@@ -0,0 +1,892 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <cstdlib>
+
+#include "base/assert.h"
+#include "base/logging.h"
+#include "base/threadpool.h"
+#include "game/tilemap.h"
+#include "game/tilemap_pathfinder.h"
+
+namespace {
+constexpr uint32_t Infinity     = std::numeric_limits<uint32_t>::max();
+constexpr uint32_t StraightCost = 10;
+constexpr uint32_t DiagonalCost = 14;
+
+struct Direction {
+    int row;
+    int col;
+    uint32_t cost;
+};
+constexpr Direction Directions[] = {
+    { 0,  1, StraightCost},
+    { 0, -1, StraightCost},
+    { 1,  0, StraightCost},
+    {-1,  0, StraightCost},
+    { 1,  1, DiagonalCost},
+    { 1, -1, DiagonalCost},
+    {-1,  1, DiagonalCost},
+    {-1, -1, DiagonalCost}
+};
+
+// The cost of the shortest possible 8-directional path between two tiles.
+uint32_t EstimateCost(unsigned row0, unsigned col0, unsigned row1, unsigned col1)
+{
+    const uint32_t rows = row0 > row1 ? row0 - row1 : row1 - row0;
+    const uint32_t cols = col0 > col1 ? col0 - col1 : col1 - col0;
+    const auto diagonal = std::min(rows, cols);
+    const auto straight = std::max(rows, cols) - diagonal;
+    return diagonal * DiagonalCost + straight * StraightCost;
+}
+
+} // namespace
+
+namespace game
+{
+
+// The clusters are immutable once the graph has been committed and
+// shared between the versions of the graph, i.e. a tile change only
+// copies the clusters that are affected by the change.
+struct TilemapPathfinder::Cluster {
+    struct Edge {
+        uint32_t node = 0;
+        uint32_t cost = 0;
+    };
+    // passability of the tiles in the cluster, indexed by the tile
+    // index inside the cluster rectangle.
+    std::vector<uint8_t> passable;
+    // the (sorted) tile indices of the entrance tiles in the cluster.
+    std::vector<uint32_t> entrances;
+    // the costs of the shortest paths between the entrances
+    // inside the cluster. Infinity when there's no path.
+    std::vector<uint32_t> costs;
+    // the edges of each entrance node inside the cluster and to
+    // the neighboring clusters. the edges of the entrance i are
+    // from first_edge[i] to first_edge[i+1].
+    std::vector<uint32_t> first_edge;
+    std::vector<Edge> edges;
+};
+
+struct TilemapPathfinder::Graph {
+    unsigned width  = 0;
+    unsigned height = 0;
+    unsigned cluster_size = 0;
+    unsigned clusters_x = 0;
+    unsigned clusters_y = 0;
+    // the number of node ids reserved for each cluster. this is the
+    // upper bound of the number of entrances in a cluster.
+    uint32_t max_entrances = 0;
+
+    // The abstract graph is the entrances of all clusters linked by
+    // edges inside the clusters and between the neighboring clusters.
+    // The node id of an entrance is the cluster * max_entrances +
+    // entrance index so that the node ids don't change when the
+    // entrances of some other cluster change.
+    std::vector<std::shared_ptr<const Cluster>> clusters;
+
+    inline bool IsPassable(unsigned row, unsigned col) const noexcept
+    {
+        const auto cluster_x = col / cluster_size;
+        const auto cluster_y = row / cluster_size;
+        const auto x = cluster_x * cluster_size;
+        const auto y = cluster_y * cluster_size;
+        const auto rect_width = std::min(cluster_size, width - x);
+        return clusters[cluster_y * clusters_x + cluster_x]->passable[(row - y) * rect_width + (col - x)];
+    }
+    inline uint32_t GetCluster(unsigned row, unsigned col) const noexcept
+    { return (row / cluster_size) * clusters_x + col / cluster_size; }
+    inline URect GetClusterRect(uint32_t cluster) const noexcept
+    {
+        const auto x = (cluster % clusters_x) * cluster_size;
+        const auto y = (cluster / clusters_x) * cluster_size;
+        return URect(x, y, std::min(cluster_size, width - x), std::min(cluster_size, height - y));
+    }
+    inline uint32_t GetNode(uint32_t cluster, uint32_t entrance) const noexcept
+    { return cluster * max_entrances + entrance; }
+    inline uint32_t GetNodeCluster(uint32_t node) const noexcept
+    { return node / max_entrances; }
+    inline uint32_t GetNodeTile(uint32_t node) const noexcept
+    { return clusters[node / max_entrances]->entrances[node % max_entrances]; }
+    inline std::size_t GetNodeIdCount() const noexcept
+    { return clusters.size() * max_entrances; }
+    uint32_t FindEntrance(uint32_t cluster, uint32_t tile) const noexcept
+    {
+        const auto& entrances = clusters[cluster]->entrances;
+        auto it = std::lower_bound(entrances.begin(), entrances.end(), tile);
+        if (it == entrances.end() || *it != tile)
+            return Infinity;
+        return static_cast<uint32_t>(it - entrances.begin());
+    }
+};
+
+// Search buffers reused between the queries to avoid allocating
+// new buffers for every query.
+struct TilemapPathfinder::SearchState {
+    struct OpenItem {
+        uint32_t estimate = 0;
+        uint32_t index = 0;
+        bool operator<(const OpenItem& other) const noexcept
+        { return estimate > other.estimate; }
+    };
+    std::vector<OpenItem> open;
+    // search over the tiles inside a rectangle, indexed by
+    // the tile index inside the rectangle.
+    std::vector<uint32_t> tile_cost;
+    std::vector<uint32_t> tile_parent;
+    std::vector<uint32_t> tile_visit;
+    uint32_t tile_generation = 0;
+    // search over the abstract graph.
+    std::vector<uint32_t> node_cost;
+    std::vector<uint32_t> node_parent;
+    std::vector<uint32_t> node_visit;
+    uint32_t node_generation = 0;
+    std::vector<uint32_t> start_costs;
+    std::vector<uint32_t> goal_costs;
+    std::vector<uint32_t> abstract_path;
+    std::vector<Tile> segment;
+
+    uint32_t GetTileCost(uint32_t index) const noexcept
+    { return tile_visit[index] == tile_generation ? tile_cost[index] : Infinity; }
+    uint32_t GetNodeCost(uint32_t index) const noexcept
+    { return node_visit[index] == node_generation ? node_cost[index] : Infinity; }
+
+    void BeginTileSearch(std::size_t tiles)
+    {
+        if (tile_visit.size() < tiles)
+        {
+            tile_cost.resize(tiles);
+            tile_parent.resize(tiles);
+            tile_visit.resize(tiles, 0);
+        }
+        if (++tile_generation == 0)
+        {
+            std::fill(tile_visit.begin(), tile_visit.end(), 0);
+            tile_generation = 1;
+        }
+        open.clear();
+    }
+    void BeginNodeSearch(std::size_t nodes)
+    {
+        if (node_visit.size() < nodes)
+        {
+            node_cost.resize(nodes);
+            node_parent.resize(nodes);
+            node_visit.resize(nodes, 0);
+        }
+        if (++node_generation == 0)
+        {
+            std::fill(node_visit.begin(), node_visit.end(), 0);
+            node_generation = 1;
+        }
+        open.clear();
+    }
+    void Push(uint32_t estimate, uint32_t index)
+    {
+        open.push_back({estimate, index});
+        std::push_heap(open.begin(), open.end());
+    }
+    OpenItem Pop()
+    {
+        std::pop_heap(open.begin(), open.end());
+        const auto item = open.back();
+        open.pop_back();
+        return item;
+    }
+};
+
+namespace {
+using Graph       = TilemapPathfinder::Graph;
+using Cluster     = TilemapPathfinder::Cluster;
+using SearchState = TilemapPathfinder::SearchState;
+using Tile        = TilemapPathfinder::Tile;
+using Path        = TilemapPathfinder::Path;
+
+// Search the tiles inside the cluster starting from the start tile.
+// When the goal tile is given the search is A* that stops when the goal
+// is reached. Otherwise the search is Dijkstra that computes the cost to
+// every tile inside the cluster reachable from the start.
+bool SearchCluster(const Graph& graph, uint32_t cluster, const Tile& start, const Tile* goal, SearchState& state)
+{
+    const auto& rect = graph.GetClusterRect(cluster);
+    const auto& passable = graph.clusters[cluster]->passable;
+    const auto rect_x = rect.GetX();
+    const auto rect_y = rect.GetY();
+    const auto rect_width  = rect.GetWidth();
+    const auto rect_height = rect.GetHeight();
+
+    const auto GetIndex = [=](unsigned row, unsigned col) {
+        return (row - rect_y) * rect_width + (col - rect_x);
+    };
+
+    state.BeginTileSearch(rect_width * rect_height);
+
+    const auto start_index = GetIndex(start.row, start.col);
+    const auto goal_index  = goal ? GetIndex(goal->row, goal->col) : Infinity;
+    state.tile_cost[start_index]   = 0;
+    state.tile_parent[start_index] = Infinity;
+    state.tile_visit[start_index]  = state.tile_generation;
+    state.Push(goal ? EstimateCost(start.row, start.col, goal->row, goal->col) : 0, start_index);
+
+    while (!state.open.empty())
+    {
+        const auto item = state.Pop();
+        if (item.index == goal_index)
+            return true;
+
+        const auto row  = rect_y + item.index / rect_width;
+        const auto col  = rect_x + item.index % rect_width;
+        const auto cost = state.tile_cost[item.index];
+        // skip stale entries for tiles that have already been
+        // reached through a cheaper path.
+        const auto estimate = goal ? EstimateCost(row, col, goal->row, goal->col) : 0;
+        if (item.estimate > cost + estimate)
+            continue;
+
+        for (const auto& dir : Directions)
+        {
+            const auto next_row = static_cast<int>(row) + dir.row;
+            const auto next_col = static_cast<int>(col) + dir.col;
+            if (next_row < static_cast<int>(rect_y) || next_row >= static_cast<int>(rect_y + rect_height) ||
+                next_col < static_cast<int>(rect_x) || next_col >= static_cast<int>(rect_x + rect_width))
+                continue;
+            const auto next_index = GetIndex(next_row, next_col);
+            if (!passable[next_index])
+                continue;
+            // no cutting corners when moving diagonally.
+            if (dir.row && dir.col && (!passable[GetIndex(row, next_col)] || !passable[GetIndex(next_row, col)]))
+                continue;
+
+            const auto next_cost  = cost + dir.cost;
+            if (next_cost >= state.GetTileCost(next_index))
+                continue;
+            state.tile_cost[next_index]   = next_cost;
+            state.tile_parent[next_index] = item.index;
+            state.tile_visit[next_index]  = state.tile_generation;
+            const auto next_estimate = goal ? EstimateCost(next_row, next_col, goal->row, goal->col) : 0;
+            state.Push(next_cost + next_estimate, next_index);
+        }
+    }
+    return goal == nullptr;
+}
+
+// Find the path between two tiles inside the cluster and append
+// the tiles (excluding the start tile) to the path.
+bool FindClusterPath(const Graph& graph, uint32_t cluster, const Tile& start, const Tile& goal,
+                     SearchState& state, std::vector<Tile>* path)
+{
+    if (!SearchCluster(graph, cluster, start, &goal, state))
+        return false;
+
+    const auto& rect = graph.GetClusterRect(cluster);
+    auto& segment = state.segment;
+    segment.clear();
+    auto index = static_cast<uint32_t>((goal.row - rect.GetY()) * rect.GetWidth() + (goal.col - rect.GetX()));
+    while (state.tile_parent[index] != Infinity)
+    {
+        segment.push_back({rect.GetY() + index / rect.GetWidth(),
+                           rect.GetX() + index % rect.GetWidth()});
+        index = state.tile_parent[index];
+    }
+    path->insert(path->end(), segment.rbegin(), segment.rend());
+    return true;
+}
+
+// Compute the costs from the tile to each entrance of the cluster.
+void FindEntranceCosts(const Graph& graph, uint32_t cluster, const Tile& tile,
+                       SearchState& state, std::vector<uint32_t>* costs)
+{
+    const auto& rect = graph.GetClusterRect(cluster);
+    const auto& entrances = graph.clusters[cluster]->entrances;
+    SearchCluster(graph, cluster, tile, nullptr, state);
+
+    costs->resize(entrances.size());
+    for (size_t i=0; i<entrances.size(); ++i)
+    {
+        const auto row = entrances[i] / graph.width;
+        const auto col = entrances[i] % graph.width;
+        (*costs)[i] = state.GetTileCost((row - rect.GetY()) * rect.GetWidth() + (col - rect.GetX()));
+    }
+}
+
+// Find the entrances on the border between the cluster and its neighbor.
+// The border is the line of tiles from (row, col) stepping by (step_row,
+// step_col) and the neighbor side is offset by (side_row, side_col).
+// Each maximal span of tiles passable on both sides becomes an entrance.
+// Short spans get one entrance in the middle and long spans get an
+// entrance at both ends.
+void FindBorderEntrances(const Graph& graph, unsigned row, unsigned col, unsigned length,
+                         unsigned step_row, unsigned step_col, int side_row, int side_col,
+                         std::vector<uint32_t>* entrances)
+{
+    const auto IsOpen = [&](unsigned i) {
+        const auto r = row + i * step_row;
+        const auto c = col + i * step_col;
+        return graph.IsPassable(r, c) && graph.IsPassable(r + side_row, c + side_col);
+    };
+    const auto AddEntrance = [&](unsigned i) {
+        entrances->push_back((row + i * step_row) * graph.width + (col + i * step_col));
+    };
+
+    for (unsigned i=0; i<length;)
+    {
+        if (!IsOpen(i))
+        {
+            ++i;
+            continue;
+        }
+        const auto begin = i;
+        while (i < length && IsOpen(i))
+            ++i;
+        const auto span = i - begin;
+        if (span < 6)
+        {
+            AddEntrance(begin + span / 2);
+        }
+        else
+        {
+            AddEntrance(begin);
+            AddEntrance(i - 1);
+        }
+    }
+}
+
+// Find the entrances of the cluster and the costs between them. The
+// cluster must be the graph's (private) copy of the cluster since the
+// entrance costs are searched through the graph.
+void BuildCluster(const Graph& graph, uint32_t cluster, Cluster& data, SearchState& state)
+{
+    ASSERT(graph.clusters[cluster].get() == &data);
+
+    const auto& rect = graph.GetClusterRect(cluster);
+    const auto x0 = rect.GetX();
+    const auto y0 = rect.GetY();
+    const auto x1 = x0 + rect.GetWidth() - 1;
+    const auto y1 = y0 + rect.GetHeight() - 1;
+
+    auto& entrances = data.entrances;
+    entrances.clear();
+    if (x0 > 0)
+        FindBorderEntrances(graph, y0, x0, rect.GetHeight(), 1, 0, 0, -1, &entrances);
+    if (x1 + 1 < graph.width)
+        FindBorderEntrances(graph, y0, x1, rect.GetHeight(), 1, 0, 0, 1, &entrances);
+    if (y0 > 0)
+        FindBorderEntrances(graph, y0, x0, rect.GetWidth(), 0, 1, -1, 0, &entrances);
+    if (y1 + 1 < graph.height)
+        FindBorderEntrances(graph, y1, x0, rect.GetWidth(), 0, 1, 1, 0, &entrances);
+
+    std::sort(entrances.begin(), entrances.end());
+    entrances.erase(std::unique(entrances.begin(), entrances.end()), entrances.end());
+    ASSERT(entrances.size() <= graph.max_entrances);
+
+    const auto count = entrances.size();
+    auto& costs = data.costs;
+    costs.resize(count * count);
+
+    std::vector<uint32_t> entrance_costs;
+    for (size_t i=0; i<count; ++i)
+    {
+        const Tile tile = {entrances[i] / graph.width, entrances[i] % graph.width};
+        FindEntranceCosts(graph, cluster, tile, state, &entrance_costs);
+        std::copy(entrance_costs.begin(), entrance_costs.end(), &costs[i * count]);
+    }
+}
+
+// Build the abstract graph edges of the cluster's entrance nodes. The
+// entrances of the cluster and its neighbors must be up to date.
+void LinkCluster(const Graph& graph, uint32_t cluster, Cluster& data)
+{
+    const auto& entrances = data.entrances;
+    const auto& costs = data.costs;
+    const auto count = entrances.size();
+
+    data.first_edge.resize(count + 1);
+    data.edges.clear();
+
+    for (size_t i=0; i<count; ++i)
+    {
+        data.first_edge[i] = data.edges.size();
+
+        for (size_t j=0; j<count; ++j)
+        {
+            if (i == j || costs[i * count + j] == Infinity)
+                continue;
+            data.edges.push_back({graph.GetNode(cluster, j), costs[i * count + j]});
+        }
+
+        // link to the entrances on the other side of the cluster borders.
+        // the diagonal links connect the entrances at the cluster corners.
+        const int row = entrances[i] / graph.width;
+        const int col = entrances[i] % graph.width;
+        for (const auto& dir : Directions)
+        {
+            const auto next_row = row + dir.row;
+            const auto next_col = col + dir.col;
+            if (next_row < 0 || next_row >= static_cast<int>(graph.height) ||
+                next_col < 0 || next_col >= static_cast<int>(graph.width))
+                continue;
+            const auto next_cluster = graph.GetCluster(next_row, next_col);
+            if (next_cluster == cluster)
+                continue;
+            if (dir.row && dir.col && (!graph.IsPassable(row, next_col) || !graph.IsPassable(next_row, col)))
+                continue;
+            const auto entrance = graph.FindEntrance(next_cluster, next_row * graph.width + next_col);
+            if (entrance == Infinity)
+                continue;
+            data.edges.push_back({graph.GetNode(next_cluster, entrance), dir.cost});
+        }
+    }
+    data.first_edge[count] = data.edges.size();
+}
+
+Path FindGraphPath(const Graph& graph, const Tile& start, const Tile& goal, SearchState& state)
+{
+    Path path;
+    if (start.row >= graph.height || start.col >= graph.width ||
+        goal.row >= graph.height || goal.col >= graph.width)
+        return path;
+    if (!graph.IsPassable(start.row, start.col) || !graph.IsPassable(goal.row, goal.col))
+        return path;
+
+    const auto start_cluster = graph.GetCluster(start.row, start.col);
+    const auto goal_cluster  = graph.GetCluster(goal.row, goal.col);
+
+    path.tiles.push_back(start);
+
+    // when both tiles are in the same cluster try to find a path inside
+    // the cluster first. if that fails the path could still go around
+    // through the neighboring clusters.
+    if (start_cluster == goal_cluster)
+    {
+        const auto& rect = graph.GetClusterRect(start_cluster);
+        if (FindClusterPath(graph, start_cluster, start, goal, state, &path.tiles))
+        {
+            path.found = true;
+            path.cost  = state.tile_cost[(goal.row - rect.GetY()) * rect.GetWidth() + (goal.col - rect.GetX())];
+            return path;
+        }
+    }
+
+    // connect the start and goal tiles to the entrances of their clusters.
+    FindEntranceCosts(graph, start_cluster, start, state, &state.start_costs);
+    FindEntranceCosts(graph, goal_cluster, goal, state, &state.goal_costs);
+
+    // A* over the abstract graph. The goal tile is a virtual node
+    // linked to the entrances of the goal cluster.
+    const auto goal_node = static_cast<uint32_t>(graph.GetNodeIdCount());
+    state.BeginNodeSearch(graph.GetNodeIdCount() + 1);
+
+    const auto Relax = [&state](uint32_t node, uint32_t parent, uint32_t cost, uint32_t estimate) {
+        if (cost >= state.GetNodeCost(node))
+            return;
+        state.node_cost[node]   = cost;
+        state.node_parent[node] = parent;
+        state.node_visit[node]  = state.node_generation;
+        state.Push(cost + estimate, node);
+    };
+    const auto Estimate = [&graph, &goal](uint32_t node) {
+        const auto tile = graph.GetNodeTile(node);
+        return EstimateCost(tile / graph.width, tile % graph.width, goal.row, goal.col);
+    };
+
+    const auto goal_first_node = graph.GetNode(goal_cluster, 0);
+    for (uint32_t i=0; i<state.start_costs.size(); ++i)
+    {
+        if (state.start_costs[i] == Infinity)
+            continue;
+        const auto node = graph.GetNode(start_cluster, i);
+        Relax(node, Infinity, state.start_costs[i], Estimate(node));
+    }
+
+    bool found = false;
+    while (!state.open.empty())
+    {
+        const auto item = state.Pop();
+        if (item.index == goal_node)
+        {
+            found = true;
+            break;
+        }
+        const auto cost = state.node_cost[item.index];
+        if (item.estimate > cost + Estimate(item.index))
+            continue;
+
+        const auto cluster = graph.GetNodeCluster(item.index);
+        if (cluster == goal_cluster)
+        {
+            const auto goal_cost = state.goal_costs[item.index - goal_first_node];
+            if (goal_cost != Infinity)
+                Relax(goal_node, item.index, cost + goal_cost, 0);
+        }
+        const auto& data = *graph.clusters[cluster];
+        const auto entrance = item.index - graph.GetNode(cluster, 0);
+        for (uint32_t i=data.first_edge[entrance]; i<data.first_edge[entrance + 1]; ++i)
+        {
+            const auto& edge = data.edges[i];
+            Relax(edge.node, item.index, cost + edge.cost, Estimate(edge.node));
+        }
+    }
+    if (!found)
+    {
+        path.tiles.clear();
+        return path;
+    }
+
+    auto& abstract_path = state.abstract_path;
+    abstract_path.clear();
+    for (auto node = state.node_parent[goal_node]; node != Infinity; node = state.node_parent[node])
+        abstract_path.push_back(node);
+    std::reverse(abstract_path.begin(), abstract_path.end());
+    path.cost = state.node_cost[goal_node];
+
+    // refine the abstract path into tiles. consecutive nodes in the same
+    // cluster are connected by a path inside the cluster and nodes in
+    // different clusters are next to each other.
+    Tile current = start;
+    for (auto node : abstract_path)
+    {
+        const auto tile = graph.GetNodeTile(node);
+        const Tile next = {tile / graph.width, tile % graph.width};
+        const auto cluster = graph.GetNodeCluster(node);
+        if (graph.GetCluster(current.row, current.col) != cluster)
+            path.tiles.push_back(next);
+        else if (!FindClusterPath(graph, cluster, current, next, state, &path.tiles))
+            BUG("Abstract path refinement failed.");
+        current = next;
+    }
+    if (!FindClusterPath(graph, goal_cluster, current, goal, state, &path.tiles))
+        BUG("Abstract path refinement failed.");
+
+    path.found = true;
+    return path;
+}
+
+} // namespace
+
+struct TilemapPathfinder::QueryState {
+    std::mutex mutex;
+    std::vector<std::pair<QueryId, Path>> completed;
+    std::vector<base::TaskHandle> tasks;
+};
+
+class TilemapPathfinder::FindPathsTask : public base::ThreadTask
+{
+public:
+    FindPathsTask(std::shared_ptr<const Graph> graph,
+                  std::shared_ptr<QueryState> state,
+                  std::vector<Query> queries) noexcept
+      : mGraph(std::move(graph))
+      , mState(std::move(state))
+      , mQueries(std::move(queries))
+    {}
+protected:
+    virtual void DoTask() override
+    {
+        SearchState search;
+        std::vector<std::pair<QueryId, Path>> results;
+        results.reserve(mQueries.size());
+        for (const auto& query : mQueries)
+        {
+            results.emplace_back(query.id, FindGraphPath(*mGraph, query.start, query.goal, search));
+        }
+
+        std::lock_guard<std::mutex> lock(mState->mutex);
+        for (auto& result : results)
+            mState->completed.push_back(std::move(result));
+    }
+private:
+    const std::shared_ptr<const Graph> mGraph;
+    const std::shared_ptr<QueryState> mState;
+    const std::vector<Query> mQueries;
+};
+
+TilemapPathfinder::TilemapPathfinder(const TilemapLayer& layer, const Settings& settings)
+  : mSettings(settings)
+  , mWidth(layer.GetWidth())
+  , mHeight(layer.GetHeight())
+  , mQueryState(std::make_shared<QueryState>())
+  , mSearch(std::make_unique<SearchState>())
+{
+    ASSERT(mSettings.cluster_size > 0);
+
+    auto graph = std::make_shared<Graph>();
+    graph->width  = mWidth;
+    graph->height = mHeight;
+    graph->cluster_size = mSettings.cluster_size;
+    graph->clusters_x = (mWidth + mSettings.cluster_size - 1) / mSettings.cluster_size;
+    graph->clusters_y = (mHeight + mSettings.cluster_size - 1) / mSettings.cluster_size;
+    // every side of a cluster has at most one entrance per tile.
+    graph->max_entrances = 4 * mSettings.cluster_size;
+
+    const auto num_clusters = graph->clusters_x * graph->clusters_y;
+    std::vector<std::shared_ptr<Cluster>> clusters;
+    for (uint32_t cluster=0; cluster<num_clusters; ++cluster)
+    {
+        const auto& rect = graph->GetClusterRect(cluster);
+        auto data = std::make_shared<Cluster>();
+        data->passable.resize(rect.GetWidth() * rect.GetHeight());
+        for (unsigned row=0; row<rect.GetHeight(); ++row)
+        {
+            for (unsigned col=0; col<rect.GetWidth(); ++col)
+                data->passable[row * rect.GetWidth() + col] = ReadTile(layer, rect.GetY() + row, rect.GetX() + col);
+        }
+        graph->clusters.push_back(data);
+        clusters.push_back(std::move(data));
+    }
+    for (uint32_t cluster=0; cluster<num_clusters; ++cluster)
+        BuildCluster(*graph, cluster, *clusters[cluster], *mSearch);
+    for (uint32_t cluster=0; cluster<num_clusters; ++cluster)
+        LinkCluster(*graph, cluster, *clusters[cluster]);
+
+    mClusterRebuilds = num_clusters;
+    mDirtyClusters.resize(num_clusters, false);
+    mEditClusters.resize(num_clusters);
+    mGraph = std::move(graph);
+}
+
+TilemapPathfinder::~TilemapPathfinder()
+{
+    // the running tasks keep the graph and the query state alive
+    // but wait for them anyway to not leave work behind.
+    mQueue.clear();
+    for (auto& handle : mQueryState->tasks)
+        handle.Wait(base::TaskHandle::WaitStrategy::SpinThenPark);
+}
+
+TilemapPathfinder::Path TilemapPathfinder::FindPath(const Tile& start, const Tile& goal)
+{
+    CommitChanges();
+    return FindGraphPath(*mGraph, start, goal, *mSearch);
+}
+
+TilemapPathfinder::QueryId TilemapPathfinder::SubmitQuery(const Tile& start, const Tile& goal)
+{
+    Query query;
+    query.id    = mNextQueryId++;
+    query.start = start;
+    query.goal  = goal;
+    mQueue.push_back(query);
+    mPending.insert(query.id);
+    return query.id;
+}
+
+void TilemapPathfinder::Update()
+{
+    CommitChanges();
+
+    auto* pool = base::GetGlobalThreadPool();
+
+    if (!mQueue.empty())
+    {
+        if (pool)
+        {
+            // split the queries into a few batches per worker thread so
+            // that the work is evenly spread over the workers while each
+            // task still solves enough queries to be worth the overhead.
+            const auto workers = std::max(pool->GetWorkerCount(), std::size_t(1));
+            const auto batch_size = std::max((mQueue.size() + workers * 2 - 1) / (workers * 2), std::size_t(16));
+            for (size_t i=0; i<mQueue.size(); i+=batch_size)
+            {
+                const auto end = std::min(i + batch_size, mQueue.size());
+                std::vector<Query> batch(mQueue.begin() + i, mQueue.begin() + end);
+                auto task = std::make_unique<FindPathsTask>(mGraph, mQueryState, std::move(batch));
+                task->SetTaskName("FindTilemapPaths");
+                mQueryState->tasks.push_back(pool->SubmitTask(std::move(task), base::ThreadPool::AnyWorkerThreadID));
+            }
+        }
+        else
+        {
+            for (const auto& query : mQueue)
+            {
+                mPending.erase(query.id);
+                mResults[query.id] = FindGraphPath(*mGraph, query.start, query.goal, *mSearch);
+            }
+        }
+        mQueue.clear();
+    }
+
+    auto& tasks = mQueryState->tasks;
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [](const base::TaskHandle& handle) {
+        return handle.IsComplete();
+    }), tasks.end());
+
+    std::vector<std::pair<QueryId, Path>> completed;
+    {
+        std::lock_guard<std::mutex> lock(mQueryState->mutex);
+        std::swap(completed, mQueryState->completed);
+    }
+    for (auto& [id, path] : completed)
+    {
+        mPending.erase(id);
+        mResults[id] = std::move(path);
+    }
+}
+
+bool TilemapPathfinder::TakeResult(QueryId id, Path* path)
+{
+    auto it = mResults.find(id);
+    if (it == mResults.end())
+        return false;
+    *path = std::move(it->second);
+    mResults.erase(it);
+    return true;
+}
+
+bool TilemapPathfinder::IsPending(QueryId id) const
+{
+    return mPending.find(id) != mPending.end();
+}
+
+void TilemapPathfinder::UpdateTiles(const TilemapLayer& layer, const URect& tile_region)
+{
+    const auto& region = base::Intersect(tile_region, URect(0, 0, mWidth, mHeight));
+    if (region.IsEmpty())
+        return;
+
+    // copy on write, the current graph might be used by running queries.
+    // the copy shares the clusters with the current graph and the changed
+    // clusters are copied when they're written to.
+    if (!mNextGraph)
+        mNextGraph = std::make_shared<Graph>(*mGraph);
+
+    ReadTiles(layer, region, *mNextGraph);
+}
+
+void TilemapPathfinder::WaitPending()
+{
+    for (auto& handle : mQueryState->tasks)
+        handle.Wait(base::TaskHandle::WaitStrategy::SpinThenPark);
+    Update();
+}
+
+bool TilemapPathfinder::IsPassable(unsigned row, unsigned col) const
+{
+    const auto& graph = mNextGraph ? *mNextGraph : *mGraph;
+    return graph.IsPassable(row, col);
+}
+
+std::size_t TilemapPathfinder::GetNodeCount() const
+{
+    std::size_t count = 0;
+    for (const auto& cluster : mGraph->clusters)
+        count += cluster->entrances.size();
+    return count;
+}
+
+bool TilemapPathfinder::ReadTile(const TilemapLayer& layer, unsigned row, unsigned col) const
+{
+    int32_t value = 0;
+    return !layer.GetTileValue(&value, row, col) || value < mSettings.obstacle_value;
+}
+
+TilemapPathfinder::Cluster& TilemapPathfinder::EditCluster(Graph& graph, uint32_t cluster)
+{
+    auto& edit = mEditClusters[cluster];
+    if (!edit)
+    {
+        edit = std::make_shared<Cluster>(*graph.clusters[cluster]);
+        graph.clusters[cluster] = edit;
+    }
+    return *edit;
+}
+
+void TilemapPathfinder::ReadTiles(const TilemapLayer& layer, const URect& tile_region, Graph& graph)
+{
+    for (unsigned row=tile_region.GetY(); row<tile_region.GetY() + tile_region.GetHeight(); ++row)
+    {
+        for (unsigned col=tile_region.GetX(); col<tile_region.GetX() + tile_region.GetWidth(); ++col)
+        {
+            const auto passable = ReadTile(layer, row, col);
+            if (graph.IsPassable(row, col) == passable)
+                continue;
+            const auto cluster = graph.GetCluster(row, col);
+            const auto& rect = graph.GetClusterRect(cluster);
+            auto& data = EditCluster(graph, cluster);
+            data.passable[(row - rect.GetY()) * rect.GetWidth() + (col - rect.GetX())] = passable;
+            mDirtyClusters[cluster] = true;
+        }
+    }
+}
+
+void TilemapPathfinder::CommitChanges()
+{
+    if (!mNextGraph)
+        return;
+
+    auto& graph = *mNextGraph;
+
+    // the entrances on the borders of a changed cluster are shared with
+    // the neighboring clusters so they need to be rebuilt too.
+    std::vector<uint32_t> rebuild;
+    for (uint32_t cluster=0; cluster<mDirtyClusters.size(); ++cluster)
+    {
+        if (!mDirtyClusters[cluster])
+            continue;
+        const auto x = cluster % graph.clusters_x;
+        const auto y = cluster / graph.clusters_x;
+        rebuild.push_back(cluster);
+        if (x > 0)
+            rebuild.push_back(cluster - 1);
+        if (x + 1 < graph.clusters_x)
+            rebuild.push_back(cluster + 1);
+        if (y > 0)
+            rebuild.push_back(cluster - graph.clusters_x);
+        if (y + 1 < graph.clusters_y)
+            rebuild.push_back(cluster + graph.clusters_x);
+    }
+    std::sort(rebuild.begin(), rebuild.end());
+    rebuild.erase(std::unique(rebuild.begin(), rebuild.end()), rebuild.end());
+
+    // the edges of the rebuilt clusters and the border edges of all
+    // their neighbors (including the diagonal ones at the corners) refer
+    // to the rebuilt entrances so they need to be relinked.
+    std::vector<uint32_t> relink;
+    for (auto cluster : rebuild)
+    {
+        const int x = cluster % graph.clusters_x;
+        const int y = cluster / graph.clusters_x;
+        for (int dy=-1; dy<=1; ++dy)
+        {
+            for (int dx=-1; dx<=1; ++dx)
+            {
+                if (x + dx < 0 || x + dx >= static_cast<int>(graph.clusters_x) ||
+                    y + dy < 0 || y + dy >= static_cast<int>(graph.clusters_y))
+                    continue;
+                relink.push_back((y + dy) * graph.clusters_x + (x + dx));
+            }
+        }
+    }
+    std::sort(relink.begin(), relink.end());
+    relink.erase(std::unique(relink.begin(), relink.end()), relink.end());
+
+    for (auto cluster : rebuild)
+        BuildCluster(graph, cluster, EditCluster(graph, cluster), *mSearch);
+    for (auto cluster : relink)
+        LinkCluster(graph, cluster, EditCluster(graph, cluster));
+
+    mClusterRebuilds += rebuild.size();
+    std::fill(mDirtyClusters.begin(), mDirtyClusters.end(), false);
+    for (auto cluster : relink)
+        mEditClusters[cluster].reset();
+    mGraph = std::move(mNextGraph);
+}
+
+} // namespace
@@ -0,0 +1,155 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstddef>
+#include <cstdint>
+
+#include "game/types.h"
+
+namespace game
+{
+    class TilemapLayer;
+
+    // Find paths over the tiles of a tilemap data layer. The tile data
+    // value decides whether a tile can be moved through or not. Paths
+    // are found with HPA* (hierarchical path finding A*). The layer is
+    // divided into square clusters of tiles and the passable spans on
+    // the borders between clusters become the nodes of an abstract graph.
+    // Path queries search the (small) abstract graph and then refine the
+    // abstract path into tiles inside each cluster.
+    // Movement is 8-directional without cutting corners. Straight moves
+    // cost 10 and diagonal moves 14.
+    class TilemapPathfinder
+    {
+    public:
+        struct Settings {
+            // The size of the clusters in tiles in both dimensions.
+            unsigned cluster_size = 16;
+            // Tiles with a data value equal to or greater than the
+            // obstacle value can't be moved through.
+            int32_t obstacle_value = 1;
+        };
+        struct Tile {
+            unsigned row = 0;
+            unsigned col = 0;
+        };
+        struct Path {
+            // True when a path was found.
+            bool found = false;
+            // The total cost of moving along the path.
+            unsigned cost = 0;
+            // The tiles from start to goal including both.
+            std::vector<Tile> tiles;
+        };
+        using QueryId = std::size_t;
+
+        explicit TilemapPathfinder(const TilemapLayer& layer)
+          : TilemapPathfinder(layer, Settings{})
+        {}
+        TilemapPathfinder(const TilemapLayer& layer, const Settings& settings);
+       ~TilemapPathfinder();
+
+        // Find a path on the calling thread.
+        Path FindPath(const Tile& start, const Tile& goal);
+
+        // Queue a path query to be solved on the thread pool. The queued
+        // queries are submitted as batches on the next call to Update.
+        // Without a thread pool the queries are solved synchronously
+        // in Update.
+        QueryId SubmitQuery(const Tile& start, const Tile& goal);
+
+        // Commit pending tile changes, dispatch the queued queries and
+        // collect the queries that have completed.
+        void Update();
+
+        // Take the result of a completed query. Returns false if the
+        // query is still pending or the id is not known.
+        bool TakeResult(QueryId id, Path* path);
+
+        // Check whether the query has been submitted but its result
+        // is not yet available.
+        bool IsPending(QueryId id) const;
+
+        // Re-read the tiles in the given region of the layer after they
+        // have changed. Only the clusters touching the region are rebuilt
+        // and only they and their neighbors are copied and relinked.
+        // The changes apply to queries dispatched after the next Update
+        // (or FindPath). Queries that are already running see the old tiles.
+        void UpdateTiles(const TilemapLayer& layer, const URect& tile_region);
+
+        // Wait until all the dispatched queries have completed.
+        void WaitPending();
+
+        bool IsPassable(unsigned row, unsigned col) const;
+
+        inline unsigned GetWidth() const noexcept
+        { return mWidth; }
+        inline unsigned GetHeight() const noexcept
+        { return mHeight; }
+        // Get the number of nodes in the abstract graph.
+        std::size_t GetNodeCount() const;
+        // Get the number of clusters rebuilt since the pathfinder was created.
+        inline std::size_t GetClusterRebuildCount() const noexcept
+        { return mClusterRebuilds; }
+
+        struct Graph;
+        struct Cluster;
+        struct SearchState;
+    private:
+        void ReadTiles(const TilemapLayer& layer, const URect& tile_region, Graph& graph);
+        bool ReadTile(const TilemapLayer& layer, unsigned row, unsigned col) const;
+        Cluster& EditCluster(Graph& graph, uint32_t cluster);
+        void CommitChanges();
+
+        struct QueryState;
+        class FindPathsTask;
+    private:
+        const Settings mSettings;
+        unsigned mWidth  = 0;
+        unsigned mHeight = 0;
+        // the graph used by the queries. immutable once built so
+        // that it can be shared with the background tasks.
+        std::shared_ptr<const Graph> mGraph;
+        // copy of the graph with pending tile changes.
+        std::shared_ptr<Graph> mNextGraph;
+        // the clusters whose tiles have changed in the next graph.
+        std::vector<bool> mDirtyClusters;
+        // the clusters of the next graph that have been copied for
+        // writing. the rest are shared with the current graph.
+        std::vector<std::shared_ptr<Cluster>> mEditClusters;
+        std::shared_ptr<QueryState> mQueryState;
+        std::unique_ptr<SearchState> mSearch;
+        struct Query {
+            QueryId id = 0;
+            Tile start;
+            Tile goal;
+        };
+        std::vector<Query> mQueue;
+        std::unordered_set<QueryId> mPending;
+        std::unordered_map<QueryId, Path> mResults;
+        QueryId mNextQueryId = 1;
+        std::size_t mClusterRebuilds = 0;
+    };
+
+} // namespace
@@ -0,0 +1,420 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <algorithm>
+#include <limits>
+#include <cstdlib>
+
+#include "base/assert.h"
+#include "base/threadpool.h"
+#include "base/trace.h"
+#include "game/tilemap.h"
+#include "game/tilemap_visibility.h"
+
+namespace {
+// transforms from the octant coordinates to the map coordinates
+// for each of the 8 octants around the observer.
+struct Octant {
+    int xx, xy, yx, yy;
+};
+constexpr Octant Octants[] = {
+    { 1,  0,  0,  1},
+    { 0,  1,  1,  0},
+    { 0, -1,  1,  0},
+    {-1,  0,  0,  1},
+    {-1,  0,  0, -1},
+    { 0, -1, -1,  0},
+    { 0,  1, -1,  0},
+    { 1,  0,  0, -1}
+};
+
+struct ShadowCaster {
+    const std::vector<uint8_t>& opaque;
+    const int width;
+    const int height;
+    const int row;
+    const int col;
+    const int radius;
+    std::vector<uint32_t>& visible;
+
+    // Scan the octant row by row (depth first) starting at the given
+    // distance from the observer. The visible area of the row is the
+    // span between the start and end slopes. Each blocking tile splits
+    // the span and the part before the blocker is scanned recursively.
+    void Cast(int distance, float start_slope, float end_slope, const Octant& octant) const
+    {
+        if (start_slope < end_slope)
+            return;
+
+        const auto radius_squared = radius * radius;
+        float next_start_slope = start_slope;
+
+        for (int i=distance; i<=radius; ++i)
+        {
+            bool blocked = false;
+            const int dy = -i;
+            for (int dx=-i; dx<=0; ++dx)
+            {
+                const float left_slope  = (dx - 0.5f) / (dy + 0.5f);
+                const float right_slope = (dx + 0.5f) / (dy - 0.5f);
+                if (start_slope < right_slope)
+                    continue;
+                else if (end_slope > left_slope)
+                    break;
+
+                const int x = col + dx * octant.xx + dy * octant.xy;
+                const int y = row + dx * octant.yx + dy * octant.yy;
+                if (x < 0 || y < 0 || x >= width || y >= height)
+                    continue;
+
+                const auto index = static_cast<uint32_t>(y * width + x);
+                if (dx * dx + dy * dy <= radius_squared)
+                    visible.push_back(index);
+
+                const bool is_opaque = opaque[index];
+                if (blocked)
+                {
+                    if (is_opaque)
+                    {
+                        next_start_slope = right_slope;
+                        continue;
+                    }
+                    blocked = false;
+                    start_slope = next_start_slope;
+                }
+                else if (is_opaque && i < radius)
+                {
+                    blocked = true;
+                    Cast(i + 1, start_slope, left_slope, octant);
+                    next_start_slope = right_slope;
+                }
+            }
+            if (blocked)
+                break;
+        }
+    }
+};
+
+} // namespace
+
+namespace game
+{
+
+TilemapVisibility::TilemapVisibility(const TilemapLayer& layer, const Settings& settings)
+  : mSettings(settings)
+  , mWidth(layer.GetWidth())
+  , mHeight(layer.GetHeight())
+{
+    mOpaque.resize(mWidth * mHeight, 0);
+    mVisibleCount.resize(mWidth * mHeight, 0);
+    mFog.resize(mWidth * mHeight, Fog::Unexplored);
+
+    for (unsigned row=0; row<mHeight; ++row)
+    {
+        for (unsigned col=0; col<mWidth; ++col)
+        {
+            int32_t value = 0;
+            if (layer.GetTileValue(&value, row, col))
+                mOpaque[row * mWidth + col] = value >= mSettings.obstacle_value;
+        }
+    }
+}
+
+TilemapVisibility::ObserverId TilemapVisibility::AddObserver(unsigned row, unsigned col, unsigned radius)
+{
+    ASSERT(row < mHeight && col < mWidth);
+
+    const auto id = mNextObserverId++;
+    auto& observer = mObservers[id];
+    observer.row    = row;
+    observer.col    = col;
+    observer.radius = radius;
+    observer.dirty  = true;
+    return id;
+}
+
+void TilemapVisibility::MoveObserver(ObserverId id, unsigned row, unsigned col)
+{
+    ASSERT(row < mHeight && col < mWidth);
+
+    auto it = mObservers.find(id);
+    if (it == mObservers.end())
+        return;
+    auto& observer = it->second;
+    if (observer.row == row && observer.col == col)
+        return;
+    observer.row   = row;
+    observer.col   = col;
+    observer.dirty = true;
+}
+
+void TilemapVisibility::SetObserverRadius(ObserverId id, unsigned radius)
+{
+    auto it = mObservers.find(id);
+    if (it == mObservers.end())
+        return;
+    auto& observer = it->second;
+    if (observer.radius == radius)
+        return;
+    observer.radius = radius;
+    observer.dirty  = true;
+}
+
+void TilemapVisibility::RemoveObserver(ObserverId id)
+{
+    auto it = mObservers.find(id);
+    if (it == mObservers.end())
+        return;
+    // the tiles are removed from the visibility on the next update.
+    mRemoved.push_back(std::move(it->second.visible));
+    mObservers.erase(it);
+}
+
+bool TilemapVisibility::HasObserver(ObserverId id) const
+{
+    return mObservers.find(id) != mObservers.end();
+}
+
+void TilemapVisibility::UpdateTiles(const TilemapLayer& layer, const URect& tile_region)
+{
+    const auto& region = base::Intersect(tile_region, URect(0, 0, mWidth, mHeight));
+    if (region.IsEmpty())
+        return;
+
+    // find the bounds of the tiles that actually changed.
+    unsigned min_row = mHeight;
+    unsigned min_col = mWidth;
+    unsigned max_row = 0;
+    unsigned max_col = 0;
+    for (unsigned row=region.GetY(); row<region.GetY() + region.GetHeight(); ++row)
+    {
+        for (unsigned col=region.GetX(); col<region.GetX() + region.GetWidth(); ++col)
+        {
+            int32_t value = 0;
+            const uint8_t opaque = layer.GetTileValue(&value, row, col) && value >= mSettings.obstacle_value;
+            auto& tile = mOpaque[row * mWidth + col];
+            if (tile == opaque)
+                continue;
+            tile = opaque;
+            min_row = std::min(min_row, row);
+            min_col = std::min(min_col, col);
+            max_row = std::max(max_row, row);
+            max_col = std::max(max_col, col);
+        }
+    }
+    if (min_row > max_row)
+        return;
+
+    for (auto& [id, observer] : mObservers)
+    {
+        const auto radius = observer.radius;
+        if (observer.row + radius < min_row || observer.row > max_row + radius ||
+            observer.col + radius < min_col || observer.col > max_col + radius)
+            continue;
+        observer.dirty = true;
+    }
+}
+
+void TilemapVisibility::Update(TilemapLayer* fog)
+{
+    TRACE_SCOPE("TilemapVisibility::Update");
+
+    ASSERT(fog == nullptr || (fog->GetWidth() == mWidth && fog->GetHeight() == mHeight));
+
+    mChangedTiles.clear();
+
+    for (const auto& tiles : mRemoved)
+    {
+        for (auto tile : tiles)
+            RemoveVisible(tile);
+    }
+    mRemoved.clear();
+
+    mUpdates.clear();
+    for (auto& [id, observer] : mObservers)
+    {
+        if (observer.dirty)
+            mUpdates.push_back(&observer);
+    }
+
+    // computing the field of view only reads the shared tile data
+    // and writes into the observer's own buffer.
+    base::ParallelFor(0, mUpdates.size(), 4, [this](std::size_t index) {
+        ComputeFieldOfView(*mUpdates[index]);
+    });
+
+    // apply the difference between the previous and the new visible
+    // tiles. When an observer moves by a tile only the tiles on the
+    // edges of the field of view change.
+    for (auto* observer : mUpdates)
+    {
+        const auto& prev = observer->visible;
+        const auto& next = observer->next;
+        size_t i = 0;
+        size_t j = 0;
+        while (i < prev.size() || j < next.size())
+        {
+            if (j == next.size() || (i < prev.size() && prev[i] < next[j]))
+                RemoveVisible(prev[i++]);
+            else if (i == prev.size() || next[j] < prev[i])
+                AddVisible(next[j++]);
+            else
+            {
+                ++i;
+                ++j;
+            }
+        }
+        std::swap(observer->visible, observer->next);
+        observer->next.clear();
+        observer->dirty = false;
+    }
+    mObserverUpdates += mUpdates.size();
+    mUpdates.clear();
+
+    // a tile can be both added and removed during the update so
+    // resolve the final fog state of each changed tile only once.
+    std::sort(mChangedTiles.begin(), mChangedTiles.end());
+    mChangedTiles.erase(std::unique(mChangedTiles.begin(), mChangedTiles.end()), mChangedTiles.end());
+    auto end = std::remove_if(mChangedTiles.begin(), mChangedTiles.end(), [this](uint32_t tile) {
+        const auto current = mFog[tile];
+        const auto next = mVisibleCount[tile] ? Fog::Visible : (current == Fog::Unexplored ? Fog::Unexplored : Fog::Explored);
+        mFog[tile] = next;
+        return next == current;
+    });
+    mChangedTiles.erase(end, mChangedTiles.end());
+
+    if (fog == nullptr)
+        return;
+
+    for (auto tile : mChangedTiles)
+    {
+        fog->SetTileValue(GetFogValue(mFog[tile]), tile / mWidth, tile % mWidth);
+    }
+}
+
+void TilemapVisibility::WriteFog(TilemapLayer& fog) const
+{
+    ASSERT(fog.GetWidth() == mWidth && fog.GetHeight() == mHeight);
+
+    for (unsigned row=0; row<mHeight; ++row)
+    {
+        for (unsigned col=0; col<mWidth; ++col)
+        {
+            fog.SetTileValue(GetFogValue(mFog[row * mWidth + col]), row, col);
+        }
+    }
+}
+
+bool TilemapVisibility::HasLineOfSight(unsigned row0, unsigned col0, unsigned row1, unsigned col1) const
+{
+    if (row0 >= mHeight || col0 >= mWidth || row1 >= mHeight || col1 >= mWidth)
+        return false;
+
+    // walk the Bresenham line between the tiles. the end points
+    // themselves don't block the line of sight.
+    int x = col0;
+    int y = row0;
+    const int x1 = col1;
+    const int y1 = row1;
+    const int dx = std::abs(x1 - x);
+    const int dy = -std::abs(y1 - y);
+    const int sx = x < x1 ? 1 : -1;
+    const int sy = y < y1 ? 1 : -1;
+    int error = dx + dy;
+    while (x != x1 || y != y1)
+    {
+        const int error2 = 2 * error;
+        if (error2 >= dy)
+        {
+            error += dy;
+            x += sx;
+        }
+        if (error2 <= dx)
+        {
+            error += dx;
+            y += sy;
+        }
+        if ((x != x1 || y != y1) && mOpaque[y * mWidth + x])
+            return false;
+    }
+    return true;
+}
+
+bool TilemapVisibility::IsVisible(unsigned row, unsigned col) const
+{
+    return mFog[row * mWidth + col] == Fog::Visible;
+}
+bool TilemapVisibility::IsExplored(unsigned row, unsigned col) const
+{
+    return mFog[row * mWidth + col] != Fog::Unexplored;
+}
+bool TilemapVisibility::IsOpaque(unsigned row, unsigned col) const
+{
+    return mOpaque[row * mWidth + col];
+}
+
+const std::vector<uint32_t>* TilemapVisibility::GetVisibleTiles(ObserverId id) const
+{
+    auto it = mObservers.find(id);
+    if (it == mObservers.end())
+        return nullptr;
+    return &it->second.visible;
+}
+
+void TilemapVisibility::ComputeFieldOfView(Observer& observer) const
+{
+    auto& visible = observer.next;
+    visible.clear();
+    visible.push_back(observer.row * mWidth + observer.col);
+
+    const ShadowCaster caster = {
+        mOpaque, static_cast<int>(mWidth), static_cast<int>(mHeight),
+        static_cast<int>(observer.row), static_cast<int>(observer.col),
+        static_cast<int>(observer.radius), visible
+    };
+    for (const auto& octant : Octants)
+        caster.Cast(1, 1.0f, 0.0f, octant);
+
+    // the octants overlap on the diagonals and the axes.
+    std::sort(visible.begin(), visible.end());
+    visible.erase(std::unique(visible.begin(), visible.end()), visible.end());
+}
+
+void TilemapVisibility::AddVisible(uint32_t tile)
+{
+    ASSERT(mVisibleCount[tile] < std::numeric_limits<uint16_t>::max());
+    if (mVisibleCount[tile]++ == 0)
+        mChangedTiles.push_back(tile);
+}
+void TilemapVisibility::RemoveVisible(uint32_t tile)
+{
+    ASSERT(mVisibleCount[tile] > 0);
+    if (--mVisibleCount[tile] == 0)
+        mChangedTiles.push_back(tile);
+}
+
+int32_t TilemapVisibility::GetFogValue(Fog fog) const noexcept
+{
+    if (fog == Fog::Visible)
+        return mSettings.visible_value;
+    else if (fog == Fog::Explored)
+        return mSettings.explored_value;
+    return mSettings.unexplored_value;
+}
+
+} // namespace
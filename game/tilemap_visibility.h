@@ -0,0 +1,149 @@
+// Copyright (C) 2020-2024 Sami Väisänen
+// Copyright (C) 2020-2024 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+#include "game/types.h"
+
+namespace game
+{
+    class TilemapLayer;
+
+    // Compute the field of view of a set of observers over the tiles of
+    // a tilemap data layer and combine the results into fog of war.
+    // The tile data value decides whether a tile blocks the line of sight.
+    // The field of view is computed with recursive shadowcasting limited
+    // to a circle of the observer's view radius. Tiles that block the
+    // sight are themselves visible.
+    // The fog of war is the combination of the visibility of all the
+    // observers and can be written into a data layer where each tile
+    // is either unexplored, explored (seen before) or visible.
+    class TilemapVisibility
+    {
+    public:
+        struct Settings {
+            // Tiles with a data value equal to or greater than the
+            // obstacle value block the line of sight.
+            int32_t obstacle_value = 1;
+            // The fog values written to the fog layer.
+            int32_t unexplored_value = 0;
+            int32_t explored_value   = 1;
+            int32_t visible_value    = 2;
+        };
+        using ObserverId = std::size_t;
+
+        explicit TilemapVisibility(const TilemapLayer& layer)
+          : TilemapVisibility(layer, Settings{})
+        {}
+        TilemapVisibility(const TilemapLayer& layer, const Settings& settings);
+
+        // Add a new observer at the given tile. The observer sees the
+        // tiles within the radius (in tiles) that are not blocked.
+        ObserverId AddObserver(unsigned row, unsigned col, unsigned radius);
+        // Move the observer to a new tile. The field of view is
+        // recomputed on the next Update.
+        void MoveObserver(ObserverId id, unsigned row, unsigned col);
+        void SetObserverRadius(ObserverId id, unsigned radius);
+        void RemoveObserver(ObserverId id);
+        bool HasObserver(ObserverId id) const;
+
+        // Re-read the tiles in the given region of the layer after they
+        // have changed. The observers that can see into the region are
+        // recomputed on the next Update.
+        void UpdateTiles(const TilemapLayer& layer, const URect& tile_region);
+
+        // Recompute the field of view of the observers that have changed
+        // (moved, changed radius or see changed tiles) and update the fog.
+        // When a thread pool is available the observers are computed in
+        // parallel on the worker threads. If the fog layer is given the
+        // fog tiles that changed are written to the layer. The fog layer
+        // must be the same size as the visibility layer and is expected
+        // to start out unexplored.
+        void Update(TilemapLayer* fog = nullptr);
+
+        // Write the current fog of every tile to the layer.
+        void WriteFog(TilemapLayer& fog) const;
+
+        // Check whether there's a clear line of sight between two tiles.
+        bool HasLineOfSight(unsigned row0, unsigned col0, unsigned row1, unsigned col1) const;
+
+        // Check whether the tile is visible to any observer.
+        bool IsVisible(unsigned row, unsigned col) const;
+        // Check whether the tile is visible now or has been visible before.
+        bool IsExplored(unsigned row, unsigned col) const;
+        bool IsOpaque(unsigned row, unsigned col) const;
+
+        // Get the (sorted) indices (row * width + col) of the tiles
+        // visible to the observer as of the last Update.
+        const std::vector<uint32_t>* GetVisibleTiles(ObserverId id) const;
+
+        inline unsigned GetWidth() const noexcept
+        { return mWidth; }
+        inline unsigned GetHeight() const noexcept
+        { return mHeight; }
+        inline std::size_t GetObserverCount() const noexcept
+        { return mObservers.size(); }
+        // Get the number of observer field of view computations done
+        // since the visibility was created.
+        inline std::size_t GetObserverUpdateCount() const noexcept
+        { return mObserverUpdates; }
+        // Get the number of fog tiles that changed on the last Update.
+        inline std::size_t GetChangedTileCount() const noexcept
+        { return mChangedTiles.size(); }
+    private:
+        struct Observer {
+            unsigned row = 0;
+            unsigned col = 0;
+            unsigned radius = 0;
+            bool dirty = true;
+            // the tiles currently included in the visibility counts.
+            std::vector<uint32_t> visible;
+            // the newly computed tiles before they're applied.
+            std::vector<uint32_t> next;
+        };
+        void ComputeFieldOfView(Observer& observer) const;
+        void AddVisible(uint32_t tile);
+        void RemoveVisible(uint32_t tile);
+        enum class Fog : uint8_t {
+            Unexplored, Explored, Visible
+        };
+        int32_t GetFogValue(Fog fog) const noexcept;
+    private:
+        const Settings mSettings;
+        unsigned mWidth  = 0;
+        unsigned mHeight = 0;
+        std::vector<uint8_t> mOpaque;
+        // the number of observers that see each tile.
+        std::vector<uint16_t> mVisibleCount;
+        std::vector<Fog> mFog;
+        std::unordered_map<ObserverId, Observer> mObservers;
+        // observers that have been removed but whose tiles are
+        // still included in the visibility counts.
+        std::vector<std::vector<uint32_t>> mRemoved;
+        std::vector<Observer*> mUpdates;
+        std::vector<uint32_t> mChangedTiles;
+        ObserverId mNextObserverId = 1;
+        std::size_t mObserverUpdates = 0;
+    };
+
+} // namespace
@@ -38,6 +38,8 @@ namespace game
     // type aliases for base types
     using FBox = base::FBox;
     using FRect = base::FRect;
+    using FLine = base::FLine;
+    using FCircle = base::FCircle;
     using IRect = base::IRect;
     using URect = base::URect;
     using USize = base::USize;
@@ -968,6 +968,283 @@ void unit_test_animation_state()
 
 }
 
+game::EntityClass make_curve_test_entity(bool static_instance)
+{
+    game::EntityNodeClass root;
+    root.SetName("root");
+    root.SetTranslation(glm::vec2(5.0f, 5.0f));
+    root.SetSize(glm::vec2(1.0f, 1.0f));
+
+    game::EntityNodeClass child;
+    child.SetName("child");
+    child.SetTranslation(glm::vec2(-10.0f, 2.0f));
+    child.SetSize(glm::vec2(2.0f, 3.0f));
+    child.SetRotation(0.5f);
+    child.SetDrawable(game::DrawableItemClass());
+
+    game::TransformAnimatorClass move;
+    move.SetNodeId(root.GetId());
+    move.SetStartTime(0.0f);
+    move.SetDuration(0.6f);
+    move.SetInterpolation(game::TransformAnimatorClass::Interpolation::Cosine);
+    move.SetEndPosition(glm::vec2(100.0f, 50.0f));
+    move.SetEndRotation(1.5f);
+    move.SetFlag(game::AnimatorClass::Flags::StaticInstance, static_instance);
+
+    game::TransformAnimatorClass grow;
+    grow.SetNodeId(child.GetId());
+    grow.SetStartTime(0.2f);
+    grow.SetDuration(0.5f);
+    grow.SetInterpolation(game::TransformAnimatorClass::Interpolation::Linear);
+    grow.SetEndSize(glm::vec2(5.0f, 6.0f));
+    grow.SetEndScale(glm::vec2(3.0f, 8.0f));
+    grow.SetFlag(game::AnimatorClass::Flags::StaticInstance, static_instance);
+
+    game::TransformAnimatorClass back;
+    back.SetNodeId(root.GetId());
+    back.SetStartTime(0.7f);
+    back.SetDuration(0.3f);
+    back.SetInterpolation(game::TransformAnimatorClass::Interpolation::EaseInQuadratic);
+    back.SetEndPosition(glm::vec2(5.0f, 5.0f));
+    back.SetFlag(game::AnimatorClass::Flags::StaticInstance, static_instance);
+
+    game::BooleanPropertyAnimatorClass hide;
+    hide.SetNodeId(child.GetId());
+    hide.SetStartTime(0.5f);
+    hide.SetDuration(0.1f);
+    hide.SetFlagName(game::BooleanPropertyAnimatorClass::PropertyName::Drawable_VisibleInGame);
+    hide.SetFlagAction(game::BooleanPropertyAnimatorClass::PropertyAction::Toggle);
+
+    game::AnimationClass anim;
+    anim.SetName("anim");
+    anim.SetDuration(2.0f);
+    anim.SetDelay(0.1f);
+    anim.SetLooping(true);
+    anim.AddAnimator(move);
+    anim.AddAnimator(grow);
+    anim.AddAnimator(back);
+    anim.AddAnimator(hide);
+
+    game::EntityClass klass;
+    klass.SetName("entity");
+    klass.AddAnimation(anim);
+    auto* r = klass.AddNode(root);
+    auto* c = klass.AddNode(child);
+    klass.LinkChild(nullptr, r);
+    klass.LinkChild(r, c);
+    return klass;
+}
+
+bool same_node_state(const game::EntityNode& lhs, const game::EntityNode& rhs)
+{
+    if (lhs.GetDrawable() && lhs.GetDrawable()->IsVisible() != rhs.GetDrawable()->IsVisible())
+        return false;
+    return lhs.GetTranslation() == rhs.GetTranslation() &&
+           lhs.GetSize()        == rhs.GetSize() &&
+           lhs.GetScale()       == rhs.GetScale() &&
+           lhs.GetRotation()    == rhs.GetRotation();
+}
+
+void unit_test_animation_curves()
+{
+    TEST_CASE(test::Type::Feature)
+
+    // baking
+    {
+        const auto& klass = make_curve_test_entity(true);
+        const auto& anim = klass.GetAnimation(0);
+        const auto& curves = anim.GetCurves();
+        TEST_REQUIRE(curves);
+        TEST_REQUIRE(curves->GetNumCurves() == 3);
+        TEST_REQUIRE(curves->FindCurve(0) == 0);
+        TEST_REQUIRE(curves->FindCurve(1) == 1);
+        TEST_REQUIRE(curves->FindCurve(2) == 2);
+        TEST_REQUIRE(curves->FindCurve(3) == game::AnimationCurves::NoCurve);
+        TEST_REQUIRE(curves->GetCurve(2).start == real::float32(0.7f));
+        TEST_REQUIRE(curves->GetCurve(2).end == real::float32(1.0f));
+        TEST_REQUIRE(curves->GetCurve(2).end_position == glm::vec2(5.0f, 5.0f));
+        // shared until the class changes.
+        TEST_REQUIRE(anim.GetCurves() == curves);
+        auto copy = anim;
+        copy.GetAnimatorClass(2).SetDuration(0.2f);
+        TEST_REQUIRE(copy.GetCurves() != curves);
+        TEST_REQUIRE(copy.GetCurves()->GetCurve(2).end == real::float32(0.9f));
+        // changes through an animator reference that was taken earlier.
+        auto& animator = copy.GetAnimatorClass(2);
+        const auto& copy_curves = copy.GetCurves();
+        TEST_REQUIRE(copy.GetCurves() == copy_curves);
+        animator.SetDuration(0.1f);
+        TEST_REQUIRE(copy.GetCurves() != copy_curves);
+        TEST_REQUIRE(copy.GetCurves()->GetCurve(2).end == real::float32(0.8f));
+        // changes through the class itself.
+        const auto current = copy.GetCurves();
+        copy.SetDelay(1.0f);
+        TEST_REQUIRE(copy.GetCurves() != current);
+
+        // dynamic transform animator instance can't be baked.
+        TEST_REQUIRE(make_curve_test_entity(false).GetAnimation(0).GetCurves() == nullptr);
+
+        // nothing to bake.
+        game::AnimationClass empty;
+        TEST_REQUIRE(empty.GetCurves() == nullptr);
+        TEST_REQUIRE(empty.GetCurves() == nullptr);
+        {
+            game::TransformAnimatorClass move;
+            move.SetFlag(game::AnimatorClass::Flags::StaticInstance, true);
+            empty.AddAnimator(move);
+        }
+        TEST_REQUIRE(empty.GetCurves() != nullptr);
+    }
+
+    // the baked curves give the same results as the animators.
+    {
+        const auto& baked = game::CreateEntityInstance(make_curve_test_entity(true));
+        const auto& virt  = game::CreateEntityInstance(make_curve_test_entity(false));
+        TEST_REQUIRE(baked->PlayAnimationByName("anim")->HasCurves());
+        TEST_REQUIRE(!virt->PlayAnimationByName("anim")->HasCurves());
+
+        for (int i=0; i<300; ++i)
+        {
+            baked->Update(1.0f/60.0f);
+            virt->Update(1.0f/60.0f);
+            TEST_REQUIRE(same_node_state(baked->GetNode(0), virt->GetNode(0)));
+            TEST_REQUIRE(same_node_state(baked->GetNode(1), virt->GetNode(1)));
+        }
+        TEST_REQUIRE(baked->GetNode(0).GetTranslation() != glm::vec2(5.0f, 5.0f));
+        TEST_REQUIRE(baked->IsAnimating());
+    }
+
+    // applying on a single node.
+    {
+        const auto& klass = make_curve_test_entity(true);
+        game::EntityNode node(klass.GetSharedEntityNodeClass(0));
+        game::Animation instance(klass.GetSharedAnimationClass(0));
+        instance.Update(0.1f + 2.0f * 0.3f);
+        instance.Apply(node);
+        TEST_REQUIRE(node.GetTranslation() != glm::vec2(5.0f, 5.0f));
+        TEST_REQUIRE(!instance.IsComplete());
+        instance.Update(2.0f);
+        instance.Apply(node);
+        TEST_REQUIRE(node.GetTranslation() == glm::vec2(5.0f, 5.0f));
+        TEST_REQUIRE(node.GetRotation() == real::float32(0.0f));
+        // the child node's tracks have not been applied.
+        TEST_REQUIRE(!instance.IsComplete());
+    }
+}
+
+void unit_test_animation_batch()
+{
+    TEST_CASE(test::Type::Feature)
+
+    const auto& klass = std::make_shared<game::EntityClass>(make_curve_test_entity(true));
+
+    std::vector<std::unique_ptr<game::Entity>> batched;
+    std::vector<std::unique_ptr<game::Entity>> serial;
+    for (int i=0; i<10; ++i)
+    {
+        batched.push_back(game::CreateEntityInstance(klass));
+        serial.push_back(game::CreateEntityInstance(klass));
+        // different start times so the entities are at different
+        // positions on the animation timeline.
+        if (i % 3 == 0)
+            continue;
+        batched.back()->PlayAnimationByName("anim")->SetDelay(0.05f * i);
+        serial.back()->PlayAnimationByName("anim")->SetDelay(0.05f * i);
+    }
+
+    game::AnimationBatch batch;
+
+    for (int frame=0; frame<300; ++frame)
+    {
+        for (auto& entity : batched)
+        {
+            entity->SetAnimationDeferred(true);
+            entity->Update(1.0f/60.0f);
+            if (const auto* animation = entity->GetDeferredAnimation())
+                batch.Add(animation, entity.get());
+        }
+        batch.Apply();
+        batch.Clear();
+        TEST_REQUIRE(batch.GetSize() == 0);
+        for (auto& entity : batched)
+        {
+            entity->FinishAnimationUpdate();
+            TEST_REQUIRE(entity->GetDeferredAnimation() == nullptr);
+        }
+
+        for (auto& entity : serial)
+            entity->Update(1.0f/60.0f);
+
+        for (size_t i=0; i<batched.size(); ++i)
+        {
+            TEST_REQUIRE(same_node_state(batched[i]->GetNode(0), serial[i]->GetNode(0)));
+            TEST_REQUIRE(same_node_state(batched[i]->GetNode(1), serial[i]->GetNode(1)));
+            TEST_REQUIRE(batched[i]->IsAnimating() == serial[i]->IsAnimating());
+        }
+    }
+
+    // a non-looping animation completes the same.
+    {
+        auto anim = klass->GetAnimation(0);
+        anim.SetLooping(false);
+        auto entity = game::CreateEntityInstance(klass);
+        entity->PlayAnimation(game::Animation(anim));
+        entity->SetAnimationDeferred(true);
+        for (int i=0; i<200 && entity->IsAnimating(); ++i)
+        {
+            entity->Update(1.0f/60.0f);
+            batch.Add(entity->GetDeferredAnimation(), entity.get());
+            batch.Apply();
+            batch.Clear();
+            entity->FinishAnimationUpdate();
+        }
+        TEST_REQUIRE(!entity->IsAnimating());
+        TEST_REQUIRE(entity->GetFinishedAnimations().size() == 1);
+        TEST_REQUIRE(entity->GetNode(0).GetTranslation() == glm::vec2(5.0f, 5.0f));
+        TEST_REQUIRE(entity->GetNode(1).GetSize() == glm::vec2(5.0f, 6.0f));
+    }
+}
+
+void measure_animation_batch_time()
+{
+    TEST_CASE(test::Type::Other)
+
+    const auto& baked_class = std::make_shared<game::EntityClass>(make_curve_test_entity(true));
+    const auto& virt_class  = std::make_shared<game::EntityClass>(make_curve_test_entity(false));
+
+    std::vector<std::unique_ptr<game::Entity>> baked;
+    std::vector<std::unique_ptr<game::Entity>> virt;
+    for (int i=0; i<1000; ++i)
+    {
+        baked.push_back(game::CreateEntityInstance(baked_class));
+        baked.back()->PlayAnimationByName("anim");
+        virt.push_back(game::CreateEntityInstance(virt_class));
+        virt.back()->PlayAnimationByName("anim");
+    }
+
+    auto virt_ret = test::TimedTest(100, [&virt]() {
+        for (auto& entity : virt)
+            entity->Update(1.0f/60.0f);
+    });
+
+    game::AnimationBatch batch;
+    auto batch_ret = test::TimedTest(100, [&baked, &batch]() {
+        for (auto& entity : baked)
+        {
+            entity->SetAnimationDeferred(true);
+            entity->Update(1.0f/60.0f);
+            if (const auto* animation = entity->GetDeferredAnimation())
+                batch.Add(animation, entity.get());
+        }
+        batch.Apply();
+        batch.Clear();
+        for (auto& entity : baked)
+            entity->FinishAnimationUpdate();
+    });
+    test::PrintTestTimes("animators", virt_ret);
+    test::PrintTestTimes("batch", batch_ret);
+}
+
 EXPORT_TEST_MAIN(
 int test_main(int argc, char* argv[])
 {
@@ -979,6 +1256,10 @@ int test_main(int argc, char* argv[])
     unit_test_animation_track();
     unit_test_animation_complete();
     unit_test_animation_state();
+    unit_test_animation_curves();
+    unit_test_animation_batch();
+
+    measure_animation_batch_time();
     return 0;
 }
 ) // TEST_MAIN
\ No newline at end of file
@@ -28,8 +28,10 @@
 #include "base/assert.h"
 #include "base/math.h"
 #include "base/memory.h"
+#include "base/format.h"
 #include "data/json.h"
 #include "game/entity.h"
+#include "game/treeop.h"
 #include "game/entity_node_rigid_body_joint.h"
 #include "game/entity_node_transformer.h"
 #include "game/entity_node_rigid_body.h"
@@ -1199,6 +1201,205 @@ void unit_test_entity_transformation_precision()
 }
 
 
+void unit_test_entity_transform_cache()
+{
+    TEST_CASE(test::Type::Feature)
+
+    game::EntityClass klass;
+    for (const char* name : {"root", "child_1", "child_2", "child_3"})
+    {
+        game::EntityNodeClass node;
+        node.SetName(name);
+        node.SetTranslation(glm::vec2(10.0f, 5.0f));
+        node.SetSize(glm::vec2(2.0f, 2.0f));
+        node.SetScale(glm::vec2(2.0f, 1.0f));
+        node.SetRotation(0.5f);
+        klass.AddNode(std::move(node));
+    }
+    klass.LinkChild(nullptr, klass.FindNodeByName("root"));
+    klass.LinkChild(klass.FindNodeByName("root"), klass.FindNodeByName("child_1"));
+    klass.LinkChild(klass.FindNodeByName("root"), klass.FindNodeByName("child_2"));
+    klass.LinkChild(klass.FindNodeByName("child_1"), klass.FindNodeByName("child_3"));
+
+    game::Entity instance(klass);
+    auto* root    = instance.FindNodeByClassName("root");
+    auto* child_1 = instance.FindNodeByClassName("child_1");
+    auto* child_2 = instance.FindNodeByClassName("child_2");
+    auto* child_3 = instance.FindNodeByClassName("child_3");
+
+    const auto& tree = instance.GetRenderTree();
+    const auto CheckTransforms = [&]() {
+        for (size_t i=0; i<instance.GetNumNodes(); ++i)
+        {
+            const auto* node = &instance.GetNode(i);
+            TEST_REQUIRE(instance.FindNodeTransform(node) == game::FindNodeTransform(tree, node));
+            TEST_REQUIRE(instance.FindNodeModelTransform(node) == game::FindNodeModelTransform(tree, node));
+            TEST_REQUIRE(instance.FindNodeBoundingRect(node) == game::FindBoundingRect(tree, node));
+        }
+        TEST_REQUIRE(instance.GetBoundingRect() == game::FindBoundingRect(tree));
+    };
+
+    // first lookup computes everything.
+    CheckTransforms();
+    TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 4);
+    instance.ResetNumRecomputedTransforms();
+
+    // nothing changed, nothing is recomputed.
+    CheckTransforms();
+    TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 0);
+
+    // changing a node recomputes the node and its descendants.
+    child_1->Translate(1.0f, 2.0f);
+    CheckTransforms();
+    TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 2);
+    instance.ResetNumRecomputedTransforms();
+
+    child_2->SetScale(3.0f, 3.0f);
+    CheckTransforms();
+    TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 1);
+    instance.ResetNumRecomputedTransforms();
+
+    root->Rotate(1.0f);
+    CheckTransforms();
+    TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 4);
+    instance.ResetNumRecomputedTransforms();
+
+    // the transform data can also be changed through the transform
+    // object that is shared with the scripting batch interface.
+    child_3->GetTransform()->SetRotation(2.0f);
+    CheckTransforms();
+    TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 1);
+    instance.ResetNumRecomputedTransforms();
+
+    // code that writes the transform data directly marks it dirty
+    // which invalidates the cache of the owning entity.
+    {
+        const auto revision = instance.GetTransformRevision();
+        CheckTransforms();
+        TEST_REQUIRE(instance.GetTransformRevision() == revision);
+
+        child_2->GetTransform()->translation = glm::vec2(-1.0f, 1.0f);
+        child_2->GetTransform()->MarkDirty();
+        CheckTransforms();
+        TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 1);
+        TEST_REQUIRE(instance.GetTransformRevision() != revision);
+        instance.ResetNumRecomputedTransforms();
+    }
+
+    // relative transform between nodes.
+    {
+        const auto& relative = instance.FindRelativeTransform(child_1, child_3);
+        const auto& expected = glm::inverse(game::FindNodeTransform(tree, child_1)) * game::FindNodeTransform(tree, child_3);
+        TEST_REQUIRE(relative == expected);
+    }
+
+    // changing the topology recomputes everything.
+    instance.GetRenderTree().ReparentChild(root, child_3);
+    CheckTransforms();
+    TEST_REQUIRE(instance.GetNumRecomputedTransforms() == 4);
+}
+
+void unit_test_node_transformer_batch()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto klass = std::make_shared<game::EntityClass>();
+    {
+        game::NodeTransformerClass transformer;
+        transformer.SetLinearVelocity(glm::vec2(1.0f, -1.0f));
+        transformer.SetLinearAcceleration(glm::vec2(0.5f, 2.0f));
+        transformer.SetAngularVelocity(0.1f);
+        transformer.SetAngularAcceleration(-0.25f);
+
+        game::EntityNodeClass node;
+        node.SetName("body");
+        node.SetTransformer(transformer);
+        klass->LinkChild(nullptr, klass->AddNode(std::move(node)));
+    }
+
+    // use a count that isn't a multiple of the SIMD width
+    // in order to test the remainder as well.
+    constexpr auto EntityCount = 37;
+    std::vector<std::unique_ptr<game::Entity>> reference;
+    std::vector<std::unique_ptr<game::Entity>> batched;
+    for (size_t i=0; i<EntityCount; ++i)
+    {
+        reference.push_back(std::make_unique<game::Entity>(klass));
+        batched.push_back(std::make_unique<game::Entity>(klass));
+        for (auto* entity : {reference.back().get(), batched.back().get()})
+        {
+            auto* transformer = entity->GetNode(0).GetTransformer();
+            transformer->SetLinearVelocity(glm::vec2(0.1f * i, 1.0f));
+            transformer->SetAngularVelocity(0.01f * i);
+            transformer->Enable(i % 5 != 0);
+        }
+    }
+
+    {
+        game::NodeTransformerBatch batch;
+        for (auto& entity : batched)
+        {
+            auto& node = entity->GetNode(0);
+            batch.Attach(node.GetTransformer(), node.GetTransform());
+            TEST_REQUIRE(node.GetTransformer()->IsBatched());
+        }
+        TEST_REQUIRE(batch.GetSize() == EntityCount);
+
+        for (int step=0; step<100; ++step)
+        {
+            // change the state while attached.
+            if (step == 50)
+            {
+                for (auto* entity : {reference[3].get(), batched[3].get()})
+                {
+                    auto* transformer = entity->GetNode(0).GetTransformer();
+                    transformer->SetLinearAcceleration(glm::vec2(-1.0f, 0.0f));
+                    transformer->Enable(false);
+                }
+                for (auto* entity : {reference[5].get(), batched[5].get()})
+                    entity->GetNode(0).GetTransformer()->Enable(true);
+            }
+            batch.Integrate(1.0f/60.0f);
+            for (auto& entity : reference)
+                entity->Update(1.0f/60.0f);
+            // the entity doesn't integrate batched nodes.
+            for (auto& entity : batched)
+                entity->Update(1.0f/60.0f);
+        }
+
+        // detach some in the middle and keep integrating the rest.
+        batch.Detach(batched[10]->GetNode(0).GetTransformer());
+        batch.Detach(batched[0]->GetNode(0).GetTransformer());
+        TEST_REQUIRE(batch.GetSize() == EntityCount - 2);
+        TEST_REQUIRE(!batched[10]->GetNode(0).GetTransformer()->IsBatched());
+        for (int step=0; step<10; ++step)
+        {
+            batch.Integrate(1.0f/60.0f);
+            for (auto& entity : reference)
+                entity->Update(1.0f/60.0f);
+            for (auto& entity : batched)
+                entity->Update(1.0f/60.0f);
+        }
+        // the batch detaches the rest when destroyed.
+    }
+
+    for (size_t i=0; i<EntityCount; ++i)
+    {
+        const auto& expected = reference[i]->GetNode(0);
+        const auto& actual   = batched[i]->GetNode(0);
+        TEST_REQUIRE(!actual.GetTransformer()->IsBatched());
+        // bit-identical results are expected.
+        TEST_REQUIRE(expected.GetTranslation() == actual.GetTranslation());
+        TEST_REQUIRE(expected.GetRotation() == actual.GetRotation());
+        TEST_REQUIRE(expected.GetTransformer()->GetLinearVelocity() == actual.GetTransformer()->GetLinearVelocity());
+        TEST_REQUIRE(expected.GetTransformer()->GetLinearAcceleration() == actual.GetTransformer()->GetLinearAcceleration());
+        TEST_REQUIRE(expected.GetTransformer()->GetAngularVelocity() == actual.GetTransformer()->GetAngularVelocity());
+        TEST_REQUIRE(expected.GetTransformer()->IsEnabled() == actual.GetTransformer()->IsEnabled());
+    }
+    TEST_REQUIRE(reference[1]->GetNode(0).GetTranslation() != glm::vec2(0.0f, 0.0f));
+    TEST_REQUIRE(reference[0]->GetNode(0).GetTranslation() == glm::vec2(0.0f, 0.0f));
+}
+
 void unit_test_entity_animation_state()
 {
     TEST_CASE(test::Type::Feature)
@@ -1451,6 +1652,85 @@ void measure_entity_update_time()
     test::PrintTestTimes("node update", ret);
 }
 
+// measure the cost of looking up the node transforms in an entity
+// with a deep hierarchy when only a single node changes per frame.
+void measure_entity_transform_lookup_time()
+{
+    TEST_CASE(test::Type::Other)
+
+    auto klass = std::make_shared<game::EntityClass>();
+    game::EntityNodeClass* parent = nullptr;
+    for (size_t i=0; i<16; ++i)
+    {
+        game::EntityNodeClass node;
+        node.SetName(base::FormatString("node%1", i));
+        node.SetTranslation(glm::vec2(10.0f, 0.0f));
+        node.SetRotation(0.1f);
+        auto* added = klass->AddNode(std::move(node));
+        klass->LinkChild(parent, added);
+        parent = added;
+    }
+    game::Entity entity(klass);
+    auto* leaf = entity.FindNodeByClassName("node15");
+
+    auto cached = test::TimedTest(1000, [&entity, leaf]() {
+        leaf->Translate(0.01f, 0.0f);
+        for (size_t i=0; i<entity.GetNumNodes(); ++i)
+            entity.FindNodeTransform(&entity.GetNode(i));
+    });
+    test::PrintTestTimes("cached node transforms", cached);
+
+    auto walked = test::TimedTest(1000, [&entity, leaf]() {
+        leaf->Translate(0.01f, 0.0f);
+        for (size_t i=0; i<entity.GetNumNodes(); ++i)
+            game::FindNodeTransform(entity.GetRenderTree(), &entity.GetNode(i));
+    });
+    test::PrintTestTimes("tree walk node transforms", walked);
+}
+
+// integrate 50k moving nodes one entity at a time vs. in a batch.
+void measure_node_transformer_batch_time()
+{
+    TEST_CASE(test::Type::Other)
+
+    auto klass = std::make_shared<game::EntityClass>();
+    {
+        game::NodeTransformerClass transformer;
+        transformer.SetLinearVelocity(glm::vec2(1.0f, -1.0f));
+        transformer.SetLinearAcceleration(glm::vec2(0.5f, 2.0f));
+        transformer.SetAngularVelocity(0.1f);
+
+        game::EntityNodeClass node;
+        node.SetName("body");
+        node.SetTransformer(transformer);
+        klass->LinkChild(nullptr, klass->AddNode(std::move(node)));
+    }
+
+    std::vector<std::unique_ptr<game::Entity>> entities;
+    for (size_t i=0; i<50000; ++i)
+    {
+        entities.push_back(std::make_unique<game::Entity>(klass));
+    }
+
+    auto entity_ret = test::TimedTest(100, [&entities]() {
+        for (auto& entity : entities)
+            entity->Update(1.0f/60.0f);
+    });
+    test::PrintTestTimes("entity update integration", entity_ret);
+
+    game::NodeTransformerBatch batch;
+    for (auto& entity : entities)
+    {
+        auto& node = entity->GetNode(0);
+        batch.Attach(node.GetTransformer(), node.GetTransform());
+    }
+
+    auto batch_ret = test::TimedTest(100, [&batch]() {
+        batch.Integrate(1.0f/60.0f);
+    });
+    test::PrintTestTimes("batch integration", batch_ret);
+}
+
 EXPORT_TEST_MAIN(
 int test_main(int argc, char* argv[])
 {
@@ -1460,12 +1740,16 @@ int test_main(int argc, char* argv[])
     unit_test_entity_clone_track_bug();
     unit_test_entity_class_coords();
     unit_test_entity_transformation_precision();
+    unit_test_entity_transform_cache();
+    unit_test_node_transformer_batch();
     unit_test_entity_animation_state();
     unit_test_entity_args();
 
     measure_item_allocation_time();
     measure_entity_allocation_time();
     measure_entity_update_time();
+    measure_entity_transform_lookup_time();
+    measure_node_transformer_batch_time();
     return 0;
 }
 ) // TEST_MAIN
@@ -26,9 +26,18 @@
 #include "base/assert.h"
 #include "base/math.h"
 #include "base/threadpool.h"
+#include "base/format.h"
 #include "data/json.h"
 #include "game/scene.h"
+#include "game/scene_snapshot.h"
+#include "game/tilemap.h"
+#include "game/loader.h"
 #include "game/entity.h"
+#include "game/entity_node_spatial_node.h"
+#include "game/entity_node_transformer.h"
+#include "game/entity_node_drawable_item.h"
+#include "game/animation.h"
+#include "game/transform_animator.h"
 
 // build easily comparable representation of the render tree
 // by concatenating node names into a string in the order
@@ -1234,6 +1243,124 @@ void unit_test_scene_spatial_update(game::SceneClass::SpatialIndex index)
 
 }
 
+void unit_test_scene_spatial_move(game::SceneClass::SpatialIndex index)
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto entity = std::make_shared<game::EntityClass>();
+    entity->SetName("entity");
+    {
+        game::EntityNodeClass node;
+        node.SetName("node");
+        node.SetTranslation(0.0f, 0.0f);
+        node.SetSize(10.0f, 10.0f);
+        node.CreateSpatialNode();
+        entity->LinkChild(nullptr, entity->AddNode(node));
+    }
+
+    game::SceneClass klass;
+    {
+        game::EntityPlacement node;
+        node.SetName("static0");
+        node.SetEntity(entity);
+        node.SetTranslation(glm::vec2(0.0f, 0.0f));
+        klass.LinkChild(nullptr, klass.PlaceEntity(node));
+    }
+    {
+        game::EntityPlacement node;
+        node.SetName("static1");
+        node.SetEntity(entity);
+        node.SetTranslation(glm::vec2(100.0f, 100.0f));
+        klass.LinkChild(nullptr, klass.PlaceEntity(node));
+    }
+    {
+        game::EntityPlacement node;
+        node.SetName("mover");
+        node.SetEntity(entity);
+        node.SetTranslation(glm::vec2(50.0f, 50.0f));
+        klass.LinkChild(nullptr, klass.PlaceEntity(node));
+    }
+    // child entity that follows the mover
+    {
+        game::EntityPlacement node;
+        node.SetName("follower");
+        node.SetEntity(entity);
+        node.SetParentRenderTreeNodeId(entity->FindNodeByName("node")->GetId());
+        node.SetTranslation(glm::vec2(20.0f, 0.0f));
+        klass.LinkChild(klass.FindPlacementByName("mover"), klass.PlaceEntity(node));
+    }
+    klass.SetDynamicSpatialIndex(index);
+
+    auto scene = game::CreateSceneInstance(klass);
+    scene->Rebuild();
+    TEST_REQUIRE(scene->GetSpatialIndex()->GetNumItems() == 4);
+    const auto space = scene->GetSpatialIndex()->GetRect();
+
+    auto* mover    = scene->FindEntityByInstanceName("mover");
+    auto* follower = scene->FindEntityByInstanceName("follower");
+    auto* static0  = scene->FindEntityByInstanceName("static0");
+
+    // nothing moved.
+    scene->Rebuild();
+    TEST_REQUIRE(scene->GetSpatialIndex()->GetNumItems() == 4);
+    TEST_REQUIRE(scene->GetSpatialIndex()->GetRect() == space);
+
+    // move inside the current index space, index is updated incrementally.
+    // the node matrices being looked up before the rebuild must
+    // not hide the change from the rebuild.
+    mover->GetNode(0).Translate(0.0f, -40.0f);
+    mover->FindNodeTransform(&mover->GetNode(0));
+    scene->Rebuild();
+    TEST_REQUIRE(scene->GetSpatialIndex()->GetRect() == space);
+    {
+        std::set<const game::EntityNode*> result;
+        scene->QuerySpatialNodes(game::FPoint(50.0f, 50.0f), &result);
+        TEST_REQUIRE(result.empty());
+
+        scene->QuerySpatialNodes(game::FPoint(50.0f, 10.0f), &result);
+        TEST_REQUIRE(result.size() == 1);
+        TEST_REQUIRE(*result.begin() == &mover->GetNode(0));
+
+        // the linked child entity moves with its parent
+        result.clear();
+        scene->QuerySpatialNodes(game::FPoint(70.0f, 50.0f), &result);
+        TEST_REQUIRE(result.empty());
+        scene->QuerySpatialNodes(game::FPoint(70.0f, 10.0f), &result);
+        TEST_REQUIRE(result.size() == 1);
+        TEST_REQUIRE(*result.begin() == &follower->GetNode(0));
+    }
+
+    // move outside the current index space, index is rebuilt.
+    mover->GetNode(0).SetTranslation(500.0f, 500.0f);
+    scene->Rebuild();
+    TEST_REQUIRE(scene->GetSpatialIndex()->GetNumItems() == 4);
+    TEST_REQUIRE(!(scene->GetSpatialIndex()->GetRect() == space));
+    {
+        std::set<const game::EntityNode*> result;
+        scene->QuerySpatialNodes(game::FPoint(500.0f, 500.0f), &result);
+        TEST_REQUIRE(result.size() == 1);
+        TEST_REQUIRE(*result.begin() == &mover->GetNode(0));
+
+        result.clear();
+        scene->QuerySpatialNodes(game::FPoint(0.0f, 0.0f), &result);
+        TEST_REQUIRE(result.size() == 1);
+        TEST_REQUIRE(*result.begin() == &static0->GetNode(0));
+    }
+
+    // disabled spatial node is removed from the index.
+    static0->GetNode(0).GetSpatialNode()->Enable(false);
+    scene->Rebuild();
+    TEST_REQUIRE(scene->GetSpatialIndex()->GetNumItems() == 3);
+    {
+        std::set<const game::EntityNode*> result;
+        scene->QuerySpatialNodes(game::FPoint(0.0f, 0.0f), &result);
+        TEST_REQUIRE(result.empty());
+    }
+    static0->GetNode(0).GetSpatialNode()->Enable(true);
+    scene->Rebuild();
+    TEST_REQUIRE(scene->GetSpatialIndex()->GetNumItems() == 4);
+}
+
 void unit_test_async_spawn()
 {
     TEST_CASE(test::Type::Feature)
@@ -1278,6 +1405,1262 @@ void unit_test_async_spawn()
     threadpool.Shutdown();
 }
 
+void unit_test_scene_parallel_update()
+{
+    TEST_CASE(test::Type::Feature)
+
+#if defined(DETONATOR_UNIT_TEST_WASM_BUILD)
+    return;
+#endif
+
+    auto entity = std::make_shared<game::EntityClass>();
+    entity->SetFlag(game::EntityClass::Flags::LimitLifetime, true);
+    entity->SetFlag(game::EntityClass::Flags::KillAtLifetime, true);
+    {
+        game::NodeTransformerClass transformer;
+        transformer.SetLinearAcceleration(glm::vec2(1.0f, 2.0f));
+        transformer.SetAngularAcceleration(0.5f);
+
+        game::EntityNodeClass node;
+        node.SetName("body");
+        node.SetTransformer(transformer);
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    }
+
+    game::SceneClass klass;
+
+    // run the same simulation with the serial and the parallel update
+    // and collect the events and the resulting node transforms.
+    struct Result {
+        std::vector<std::string> events;
+        std::vector<game::EntityNodeTransform> transforms;
+        std::vector<bool> killed;
+    };
+    const auto Simulate = [&klass, &entity](bool parallel, bool batch) {
+        game::Scene scene(klass);
+        scene.SetParallelUpdate(parallel);
+        scene.SetTransformerBatch(batch);
+
+        for (int i=0; i<1000; ++i)
+        {
+            game::EntityArgs args;
+            args.klass = entity;
+            args.name  = base::FormatString("entity%1", i);
+            args.position = glm::vec2(i, -i);
+            auto* instance = scene.SpawnEntity(args);
+            instance->SetTimer("timer", 0.001 * i);
+            instance->SetLifetime(0.5 + 0.002 * i);
+            auto* transformer = instance->GetNode(0).GetTransformer();
+            transformer->SetLinearVelocity(glm::vec2(0.1f * i, 0.0f));
+            transformer->SetAngularVelocity(0.01f * i);
+        }
+
+        Result result;
+        for (int frame=0; frame<100; ++frame)
+        {
+            scene.BeginLoop();
+            for (size_t i=0; i<scene.GetNumEntities(); ++i)
+            {
+                auto& instance = scene.GetEntity(i);
+                if (i % 7 == static_cast<size_t>(frame % 7))
+                {
+                    game::Entity::PostedEvent event;
+                    event.message = base::FormatString("frame%1", frame);
+                    event.sender  = instance.GetName();
+                    event.value   = frame;
+                    instance.PostEvent(std::move(event));
+                }
+            }
+
+            std::vector<game::Scene::Event> events;
+            scene.Update(1.0f/60.0f, &events);
+            for (const auto& event : events)
+            {
+                if (const auto* ptr = std::get_if<game::Scene::EntityTimerEvent>(&event))
+                    result.events.push_back(base::FormatString("timer %1 %2 %3", ptr->entity->GetName(), ptr->event.name, ptr->event.jitter));
+                else if (const auto* ptr = std::get_if<game::Scene::EntityEventPostedEvent>(&event))
+                    result.events.push_back(base::FormatString("posted %1 %2", ptr->entity->GetName(), ptr->event.message));
+            }
+            scene.EndLoop();
+        }
+        for (size_t i=0; i<scene.GetNumEntities(); ++i)
+        {
+            const auto& instance = scene.GetEntity(i);
+            result.transforms.push_back(*instance.GetNode(0).GetTransform());
+            result.killed.push_back(instance.TestFlag(game::Entity::ControlFlags::Killed));
+        }
+        return result;
+    };
+
+    const auto serial = Simulate(false, false);
+    const auto batched = Simulate(false, true);
+
+    base::ThreadPool threadpool;
+    threadpool.AddRealThread(base::ThreadPool::Worker0ThreadID);
+    threadpool.AddRealThread(base::ThreadPool::Worker1ThreadID);
+    threadpool.AddRealThread(base::ThreadPool::Worker2ThreadID);
+    base::SetGlobalThreadPool(&threadpool);
+
+    const auto parallel = Simulate(true, true);
+
+    base::SetGlobalThreadPool(nullptr);
+    threadpool.WaitAll();
+    threadpool.Shutdown();
+
+    // some of the entities have expired and been removed.
+    TEST_REQUIRE(serial.transforms.size() > 100 && serial.transforms.size() < 1000);
+    TEST_REQUIRE(serial.events.size() > 1000);
+    for (const auto* other : {&batched, &parallel})
+    {
+        TEST_REQUIRE(serial.events == other->events);
+        TEST_REQUIRE(serial.killed == other->killed);
+        TEST_REQUIRE(serial.transforms.size() == other->transforms.size());
+        for (size_t i=0; i<serial.transforms.size(); ++i)
+        {
+            // bit-identical results are expected.
+            TEST_REQUIRE(serial.transforms[i].translation == other->transforms[i].translation);
+            TEST_REQUIRE(serial.transforms[i].rotation == other->transforms[i].rotation);
+            TEST_REQUIRE(serial.transforms[i].scale == other->transforms[i].scale);
+        }
+    }
+}
+
+void unit_test_scene_animation_batch()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto entity = std::make_shared<game::EntityClass>();
+    game::EntityNodeClass node;
+    node.SetName("body");
+    entity->LinkChild(nullptr, entity->AddNode(node));
+    {
+        game::TransformAnimatorClass move;
+        move.SetNodeId(node.GetId());
+        move.SetStartTime(0.0f);
+        move.SetDuration(1.0f);
+        move.SetInterpolation(game::TransformAnimatorClass::Interpolation::Linear);
+        move.SetEndPosition(glm::vec2(10.0f, 0.0f));
+        move.SetFlag(game::AnimatorClass::Flags::StaticInstance, true);
+
+        game::AnimationClass idle;
+        idle.SetName("idle");
+        idle.SetDuration(0.25f);
+        idle.SetLooping(false);
+        idle.AddAnimator(move);
+        entity->AddAnimation(idle);
+        entity->SetIdleTrackId(idle.GetId());
+    }
+    {
+        game::TransformAnimatorClass move;
+        move.SetNodeId(node.GetId());
+        move.SetStartTime(0.0f);
+        move.SetDuration(1.0f);
+        move.SetInterpolation(game::TransformAnimatorClass::Interpolation::Cosine);
+        move.SetEndPosition(glm::vec2(0.0f, 10.0f));
+        move.SetFlag(game::AnimatorClass::Flags::StaticInstance, true);
+
+        game::AnimationClass action;
+        action.SetName("action");
+        action.SetDuration(0.4f);
+        action.SetLooping(false);
+        action.AddAnimator(move);
+        entity->AddAnimation(action);
+    }
+
+    game::SceneClass klass;
+
+    // run the same simulation with and without the animation batch and
+    // record the animation state and the node position on every frame.
+    // the idle track must start on the same frame in both cases.
+    const auto Simulate = [&klass, &entity](bool batch) {
+        game::Scene scene(klass);
+        scene.SetAnimationBatch(batch);
+
+        for (int i=0; i<20; ++i)
+        {
+            game::EntityArgs args;
+            args.klass = entity;
+            args.name  = base::FormatString("entity%1", i);
+            auto* instance = scene.SpawnEntity(args);
+            if (i % 2)
+                instance->PlayAnimationByName("action")->SetDelay(0.01f * i);
+        }
+
+        std::vector<std::string> frames;
+        for (int frame=0; frame<120; ++frame)
+        {
+            scene.BeginLoop();
+            scene.Update(1.0f/60.0f);
+            std::string state;
+            for (size_t i=0; i<scene.GetNumEntities(); ++i)
+            {
+                const auto& instance = scene.GetEntity(i);
+                const auto& pos = instance.GetNode(0).GetTranslation();
+                state += base::FormatString("%1:%2:%3,%4 ", i,
+                    instance.IsAnimating() ? instance.GetCurrentAnimation(0)->GetClassName() : "-",
+                    pos.x, pos.y);
+            }
+            frames.push_back(std::move(state));
+            scene.EndLoop();
+        }
+        return frames;
+    };
+
+    const auto serial  = Simulate(false);
+    const auto batched = Simulate(true);
+    TEST_REQUIRE(serial.size() == batched.size());
+    for (size_t i=0; i<serial.size(); ++i)
+    {
+        TEST_REQUIRE(serial[i] == batched[i]);
+    }
+}
+
+void unit_test_scene_entity_pool()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto entity = std::make_shared<game::EntityClass>();
+    entity->SetName("bullet");
+    {
+        game::EntityNodeClass node;
+        node.SetName("body");
+        node.SetTranslation(glm::vec2(1.0f, 2.0f));
+        node.SetTransformer(game::NodeTransformerClass());
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+
+        game::ScriptVar var("health", 100, game::ScriptVar::ReadWrite);
+        entity->AddScriptVar(var);
+    }
+
+    game::SceneClass klass;
+
+    // killed entities are reused by later spawns.
+    {
+        game::Scene scene(klass);
+        // pooling is opt-in.
+        TEST_REQUIRE(scene.GetEntityPoolCapacity() == 0);
+        scene.SetEntityPoolCapacity(1);
+
+        game::EntityArgs args;
+        args.klass    = entity;
+        args.name     = "first";
+        args.position = glm::vec2(10.0f, 20.0f);
+
+        scene.BeginLoop();
+            auto* first = scene.SpawnEntity(args);
+        scene.EndLoop();
+        scene.BeginLoop();
+            TEST_REQUIRE(scene.GetNumEntities() == 1);
+            const auto first_id = first->GetId();
+            const auto first_node_id = first->GetNode(0).GetId();
+            first->GetNode(0).SetTranslation(glm::vec2(-50.0f, 50.0f));
+            first->GetNode(0).GetTransformer()->SetLinearVelocity(glm::vec2(1.0f, 1.0f));
+            first->FindScriptVarByName("health")->SetValue(5);
+            first->SetTimer("timer", 1.0);
+            first->SetLayer(5);
+            scene.KillEntity(first);
+        scene.EndLoop();
+        scene.BeginLoop();
+            TEST_REQUIRE(first->HasBeenKilled());
+        scene.EndLoop();
+
+        TEST_REQUIRE(scene.GetNumEntities() == 0);
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 1);
+        TEST_REQUIRE(scene.GetEntityPoolStats().hits == 0);
+        TEST_REQUIRE(scene.GetEntityPoolStats().misses == 1);
+        // the pooled entity's nodes are not visible in the allocator.
+        TEST_REQUIRE(entity->GetAllocator().GetCount() == 0);
+        for (size_t i=0; i<entity->GetAllocator().GetHighIndex(); ++i)
+        {
+            TEST_REQUIRE(entity->GetAllocator().GetObject<game::EntityNodeTransform>(i) == nullptr);
+            TEST_REQUIRE(entity->GetAllocator().GetObject<game::EntityNodeData>(i) == nullptr);
+        }
+
+        args.name     = "second";
+        args.position = glm::vec2(-1.0f, -2.0f);
+        args.layer    = 2;
+        scene.BeginLoop();
+            auto* second = scene.SpawnEntity(args);
+        scene.EndLoop();
+        scene.BeginLoop();
+
+        TEST_REQUIRE(second == first);
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 0);
+        TEST_REQUIRE(scene.GetEntityPoolStats().hits == 1);
+        TEST_REQUIRE(scene.GetEntityPoolStats().misses == 1);
+        TEST_REQUIRE(scene.GetNumEntities() == 1);
+        TEST_REQUIRE(second->GetId() != first_id);
+        TEST_REQUIRE(second->GetNode(0).GetId() != first_node_id);
+        TEST_REQUIRE(second->GetName() == "second");
+        TEST_REQUIRE(second->GetLayer() == 2);
+        TEST_REQUIRE(second->HasBeenKilled() == false);
+        TEST_REQUIRE(second->HasBeenSpawned() == true);
+        TEST_REQUIRE(second->GetNode(0).GetTranslation() == glm::vec2(0.0f, 0.0f));
+        TEST_REQUIRE(second->GetNode(0).GetTransformer()->GetLinearVelocity() == glm::vec2(0.0f, 0.0f));
+        TEST_REQUIRE(second->GetNode(0).GetEntity() == second);
+        TEST_REQUIRE(entity->GetAllocator().GetCount() == 1);
+        TEST_REQUIRE(second->FindScriptVarByName("health")->GetValue<int>() == 100);
+        TEST_REQUIRE(scene.FindEntityByInstanceName("second") == second);
+        TEST_REQUIRE(scene.FindEntityByInstanceName("first") == nullptr);
+
+        std::vector<game::Entity::Event> events;
+        second->Update(2.0f, &events);
+        TEST_REQUIRE(events.empty());
+        scene.EndLoop();
+
+        // pool is limited by the capacity.
+        scene.BeginLoop();
+            auto* third = scene.SpawnEntity(args);
+            auto* fourth = scene.SpawnEntity(args);
+            TEST_REQUIRE(scene.GetEntityPoolStats().misses == 3);
+        scene.EndLoop();
+        scene.BeginLoop();
+            scene.KillEntity(second);
+            scene.KillEntity(third);
+            scene.KillEntity(fourth);
+        scene.EndLoop();
+        scene.BeginLoop();
+        scene.EndLoop();
+        TEST_REQUIRE(scene.GetNumEntities() == 0);
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 1);
+
+        scene.ClearEntityPool();
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 0);
+    }
+
+    // pre-warm
+    {
+        game::Scene scene(klass);
+        scene.SetEntityPoolCapacity(0);
+        scene.PrewarmEntityPool(entity, 10);
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 10);
+        TEST_REQUIRE(entity->GetAllocator().GetCount() == 0);
+
+        game::EntityArgs args;
+        args.klass = entity;
+        scene.BeginLoop();
+        for (int i=0; i<10; ++i)
+        {
+            args.name = base::FormatString("entity%1", i);
+            args.position = glm::vec2(i, i);
+            scene.SpawnEntity(args);
+        }
+        scene.EndLoop();
+        scene.BeginLoop();
+        scene.EndLoop();
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 0);
+        TEST_REQUIRE(scene.GetEntityPoolStats().hits == 10);
+        TEST_REQUIRE(scene.GetEntityPoolStats().misses == 0);
+        for (int i=0; i<10; ++i)
+        {
+            const auto* instance = scene.FindEntityByInstanceName(base::FormatString("entity%1", i));
+            TEST_REQUIRE(instance);
+            TEST_REQUIRE(instance->GetNode(0).GetTranslation() == glm::vec2(1.0f + i, 2.0f + i));
+        }
+
+        // the pre-warmed capacity is kept even with pooling disabled.
+        scene.BeginLoop();
+        for (size_t i=0; i<scene.GetNumEntities(); ++i)
+            scene.KillEntity(&scene.GetEntity(i));
+        scene.EndLoop();
+        scene.BeginLoop();
+        scene.EndLoop();
+        TEST_REQUIRE(scene.GetNumEntities() == 0);
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 10);
+    }
+
+    // pooling disabled.
+    {
+        game::Scene scene(klass);
+        scene.SetEntityPoolCapacity(0);
+        game::EntityArgs args;
+        args.klass = entity;
+        scene.BeginLoop();
+            auto* instance = scene.SpawnEntity(args);
+        scene.EndLoop();
+        scene.BeginLoop();
+            scene.KillEntity(instance);
+        scene.EndLoop();
+        scene.BeginLoop();
+        scene.EndLoop();
+        TEST_REQUIRE(scene.GetEntityPoolStats().pooled == 0);
+    }
+}
+
+void unit_test_scene_entity_lookup()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto enemy = std::make_shared<game::EntityClass>();
+    enemy->SetName("enemy");
+    enemy->SetTag("#enemy");
+    auto pickup = std::make_shared<game::EntityClass>();
+    pickup->SetName("pickup");
+    pickup->SetTag("#pickup #gold");
+
+    game::SceneClass klass;
+    {
+        game::EntityPlacement placement;
+        placement.SetName("boss");
+        placement.SetEntity(enemy);
+        placement.SetTag("#enemy #boss");
+        klass.LinkChild(nullptr, klass.PlaceEntity(placement));
+    }
+
+    // check the lookups against checking every entity.
+    const auto Check = [](const game::Scene& scene) {
+        for (const std::string name : {"enemy", "pickup", "foobar"})
+        {
+            std::vector<const game::Entity*> expected;
+            for (size_t i=0; i<scene.GetNumEntities(); ++i)
+            {
+                if (scene.GetEntity(i).GetClassName() == name)
+                    expected.push_back(&scene.GetEntity(i));
+            }
+            const auto& list = scene.ListEntitiesByClassName(name);
+            const std::vector<const game::Entity*> actual(list.begin(), list.end());
+            TEST_REQUIRE(actual == expected);
+            TEST_REQUIRE(list.GetSize() == expected.size());
+        }
+        for (const std::string tag : {"#enemy", "#boss", "#gold", "#pickup", "#dead", "#"})
+        {
+            std::set<const game::Entity*> expected;
+            for (size_t i=0; i<scene.GetNumEntities(); ++i)
+            {
+                if (base::Contains(scene.GetEntity(i).GetTag(), tag))
+                    expected.insert(&scene.GetEntity(i));
+            }
+            const auto& list = scene.ListEntitiesByTag(tag);
+            const std::set<const game::Entity*> actual(list.begin(), list.end());
+            TEST_REQUIRE(actual == expected);
+            TEST_REQUIRE(list.GetSize() == expected.size());
+        }
+    };
+
+    game::Scene scene(klass);
+    scene.SetEntityPoolCapacity(64);
+    TEST_REQUIRE(scene.ListEntitiesByClassName("enemy").GetSize() == 1);
+    TEST_REQUIRE(scene.ListEntitiesByClassName("enemy")[0]->GetName() == "boss");
+    TEST_REQUIRE(scene.ListEntitiesByClassName("pickup").IsEmpty());
+    TEST_REQUIRE(scene.ListEntitiesByTag("#boss").GetSize() == 1);
+    Check(scene);
+
+    // the tags that are not indexed are looked up by checking the
+    // entities. the resulting list doesn't change.
+    const auto bosses = scene.ListEntitiesByTag("#boss");
+    scene.IndexEntityTag("#gold");
+    scene.IndexEntityTag("#dead");
+    scene.IndexEntityTag("#gold");
+    Check(scene);
+
+    // the lists are views to the scene's current state.
+    const auto enemies = scene.ListEntitiesByClassName("enemy");
+    const auto gold = scene.ListEntitiesByTag("#gold");
+
+    scene.BeginLoop();
+    for (int i=0; i<10; ++i)
+    {
+        game::EntityArgs args;
+        args.klass = i % 2 ? enemy : pickup;
+        args.name  = base::FormatString("entity%1", i);
+        auto* entity = scene.SpawnEntity(args);
+        // changing the tag before the entity is in the scene.
+        if (i == 0)
+            entity->SetTag("#pickup");
+    }
+    // not spawned yet.
+    TEST_REQUIRE(enemies.GetSize() == 1);
+    Check(scene);
+    scene.EndLoop();
+
+    scene.BeginLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 11);
+    TEST_REQUIRE(enemies.GetSize() == 6);
+    TEST_REQUIRE(gold.GetSize() == 4);
+    Check(scene);
+
+    // tag changes
+    auto* entity = scene.FindEntityByInstanceName("entity1");
+    entity->SetTag("#enemy #gold");
+    TEST_REQUIRE(gold.GetSize() == 5);
+    Check(scene);
+    entity->SetTag("#dead");
+    TEST_REQUIRE(gold.GetSize() == 4);
+    TEST_REQUIRE(scene.ListEntitiesByTag("#dead").GetSize() == 1);
+    Check(scene);
+    scene.FindEntityByInstanceName("entity0")->SetTag("#pickup #gold");
+    TEST_REQUIRE(gold.GetSize() == 5);
+    Check(scene);
+    scene.EndLoop();
+
+    // killed entities are removed at the end of the loop.
+    scene.BeginLoop();
+    scene.KillEntity(scene.FindEntityByInstanceName("entity0"));
+    scene.KillEntity(scene.FindEntityByInstanceName("entity1"));
+    scene.KillEntity(scene.FindEntityByInstanceName("entity2"));
+    scene.KillEntity(scene.FindEntityByInstanceName("entity3"));
+    Check(scene);
+    scene.EndLoop();
+    scene.BeginLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 11);
+    Check(scene);
+    scene.EndLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 7);
+    TEST_REQUIRE(enemies.GetSize() == 4);
+    TEST_REQUIRE(gold.GetSize() == 3);
+    TEST_REQUIRE(scene.ListEntitiesByTag("#dead").IsEmpty());
+    TEST_REQUIRE(bosses.GetSize() == 1);
+    Check(scene);
+
+    // the killed pickups are reused and come back with the class tag.
+    scene.BeginLoop();
+    for (int i=0; i<4; ++i)
+    {
+        game::EntityArgs args;
+        args.klass = pickup;
+        args.name  = base::FormatString("pooled%1", i);
+        scene.SpawnEntity(args);
+    }
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.GetEntityPoolStats().hits == 2);
+    TEST_REQUIRE(gold.GetSize() == 7);
+    Check(scene);
+
+    size_t count = 0;
+    for (auto* pickup : scene.ListEntitiesByClassName("pickup"))
+    {
+        TEST_REQUIRE(pickup->GetClassName() == "pickup");
+        ++count;
+    }
+    TEST_REQUIRE(count == 7);
+}
+
+std::shared_ptr<game::EntityClass> MakeSnapshotEntityClass()
+{
+    auto klass = std::make_shared<game::EntityClass>();
+    klass->SetName("ship");
+    klass->SetTag("#ship");
+    klass->AddScriptVar(game::ScriptVar("health", 100, false));
+    {
+        game::EntityNodeClass node;
+        node.SetName("body");
+        node.SetTransformer(game::NodeTransformerClass());
+        node.SetDrawable(game::DrawableItemClass());
+        klass->LinkChild(nullptr, klass->AddNode(std::move(node)));
+    }
+    {
+        game::EntityNodeClass node;
+        node.SetName("turret");
+        klass->LinkChild(nullptr, klass->AddNode(std::move(node)));
+    }
+    game::AnimationClass animation;
+    animation.SetName("roll");
+    animation.SetDuration(2.0f);
+    klass->AddAnimation(std::move(animation));
+    return klass;
+}
+
+void unit_test_scene_snapshot()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto ship = MakeSnapshotEntityClass();
+
+    game::SceneClass klass;
+    klass.AddScriptVar(game::ScriptVar("score", 0, false));
+
+    game::Scene scene(klass);
+    scene.IndexEntityTag("#damaged");
+    scene.BeginLoop();
+    for (int i=0; i<5; ++i)
+    {
+        game::EntityArgs args;
+        args.klass = ship;
+        args.name  = base::FormatString("ship%1", i);
+        args.position = glm::vec2(10.0f * i, 0.0f);
+        scene.SpawnEntity(args);
+    }
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 5);
+
+    {
+        auto* entity = scene.FindEntityByInstanceName("ship0");
+        auto& node = entity->GetNode(0);
+        node.SetTranslation(1.0f, 2.0f);
+        node.SetScale(2.0f, 3.0f);
+        node.SetRotation(0.5f);
+        node.GetTransformer()->SetLinearVelocity(glm::vec2(4.0f, 5.0f));
+        node.GetTransformer()->SetAngularVelocity(1.5f);
+        node.GetDrawable()->SetMaterialId("material");
+        node.GetDrawable()->SetTimeScale(2.0f);
+        node.GetDrawable()->SetVisible(false);
+        entity->FindScriptVarByName("health")->SetValue(50);
+        entity->SetTag("#ship #damaged");
+        entity->SetLayer(3);
+        entity->SetTimer("timer", 1.0);
+        entity->DieIn(5.0f);
+        entity->PlayAnimationById(ship->GetAnimation(0).GetId())->Update(0.5f);
+        scene.FindScriptVarByName("score")->SetValue(10);
+    }
+
+    auto snapshot = std::make_shared<game::SceneSnapshot>();
+    scene.CaptureSnapshot(snapshot.get());
+    TEST_REQUIRE(!snapshot->IsDelta());
+    TEST_REQUIRE(snapshot->GetNumEntities() == 5);
+    TEST_REQUIRE(snapshot->GetNumStoredEntities() == 5);
+    TEST_REQUIRE(snapshot->GetNumTileBlocks() == 0);
+    TEST_REQUIRE(snapshot->HasEntity(scene.FindEntityByInstanceName("ship3")->GetId()));
+
+    // round trip through the buffer.
+    {
+        game::SceneSnapshot copy;
+        TEST_REQUIRE(copy.FromBuffer(snapshot->GetBuffer()));
+        TEST_REQUIRE(copy.GetNumEntities() == 5);
+        TEST_REQUIRE(copy.GetBuffer() == snapshot->GetBuffer());
+
+        auto buffer = snapshot->GetBuffer();
+        buffer.pop_back();
+        TEST_REQUIRE(!copy.FromBuffer(buffer));
+        buffer = snapshot->GetBuffer();
+        buffer[0] = 0;
+        TEST_REQUIRE(!copy.FromBuffer(buffer));
+    }
+
+    const auto ship1_id = scene.FindEntityByInstanceName("ship1")->GetId();
+
+    // change the scene.
+    scene.BeginLoop();
+    {
+        auto* entity = scene.FindEntityByInstanceName("ship0");
+        entity->GetNode(0).SetTranslation(9.0f, 9.0f);
+        entity->GetNode(0).GetTransformer()->SetLinearVelocity(glm::vec2(0.0f, 0.0f));
+        entity->GetNode(0).GetDrawable()->SetMaterialId("other");
+        entity->FindScriptVarByName("health")->SetValue(0);
+        entity->SetTag("#ship #dead");
+        entity->SetLayer(0);
+        entity->PlayAnimationById(ship->GetAnimation(0).GetId());
+        scene.FindScriptVarByName("score")->SetValue(20);
+
+        scene.KillEntity(scene.FindEntityByInstanceName("ship1"));
+
+        game::EntityArgs args;
+        args.klass = ship;
+        args.name  = "ship5";
+        scene.SpawnEntity(args);
+    }
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 5);
+    TEST_REQUIRE(scene.FindEntityByInstanceName("ship1") == nullptr);
+    TEST_REQUIRE(scene.FindEntityByInstanceName("ship5"));
+    TEST_REQUIRE(scene.ListEntitiesByTag("#damaged").IsEmpty());
+
+    // delta against the original state stores the changed entities.
+    {
+        auto delta = std::make_shared<game::SceneSnapshot>();
+        scene.CaptureSnapshot(delta.get(), snapshot);
+        TEST_REQUIRE(delta->IsDelta());
+        TEST_REQUIRE(delta->GetNumEntities() == 5);
+        TEST_REQUIRE(delta->GetNumStoredEntities() == 2); // ship0 and ship5
+        TEST_REQUIRE(delta->GetByteCount() < snapshot->GetByteCount());
+
+        game::SceneSnapshot copy;
+        TEST_REQUIRE(!copy.FromBuffer(delta->GetBuffer()));
+        TEST_REQUIRE(copy.FromBuffer(delta->GetBuffer(), snapshot));
+        TEST_REQUIRE(copy.GetNumStoredEntities() == 2);
+    }
+
+    // restore the original state.
+    TEST_REQUIRE(scene.RestoreSnapshot(*snapshot));
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 5);
+    TEST_REQUIRE(scene.FindEntityByInstanceName("ship5") == nullptr);
+    TEST_REQUIRE(scene.FindEntityByInstanceId(ship1_id));
+    TEST_REQUIRE(scene.FindEntityByInstanceId(ship1_id)->GetName() == "ship1");
+    TEST_REQUIRE(scene.FindEntityByInstanceName("ship1")->GetNode(0).GetTranslation() == glm::vec2(10.0f, 0.0f));
+    TEST_REQUIRE(scene.FindScriptVarByName("score")->GetValue<int>() == 10);
+    TEST_REQUIRE(scene.ListEntitiesByTag("#damaged").GetSize() == 1);
+    TEST_REQUIRE(scene.ListEntitiesByTag("#dead").IsEmpty());
+    {
+        const auto* entity = scene.FindEntityByInstanceName("ship0");
+        const auto& node = entity->GetNode(0);
+        TEST_REQUIRE(node.GetTranslation() == glm::vec2(1.0f, 2.0f));
+        TEST_REQUIRE(node.GetScale() == glm::vec2(2.0f, 3.0f));
+        TEST_REQUIRE(node.GetRotation() == real::float32(0.5f));
+        TEST_REQUIRE(node.GetTransformer()->GetLinearVelocity() == glm::vec2(4.0f, 5.0f));
+        TEST_REQUIRE(node.GetTransformer()->GetAngularVelocity() == real::float32(1.5f));
+        TEST_REQUIRE(node.GetDrawable()->GetMaterialId() == "material");
+        TEST_REQUIRE(node.GetDrawable()->GetTimeScale() == real::float32(2.0f));
+        TEST_REQUIRE(node.GetDrawable()->IsVisible() == false);
+        TEST_REQUIRE(entity->FindScriptVarByName("health")->GetValue<int>() == 50);
+        TEST_REQUIRE(entity->GetTag() == "#ship #damaged");
+        TEST_REQUIRE(entity->GetLayer() == 3);
+        TEST_REQUIRE(entity->GetNumCurrentAnimations() == 1);
+        TEST_REQUIRE(entity->GetCurrentAnimation(0)->GetCurrentTime() == real::float32(0.5f));
+    }
+
+    // nothing has changed since the restore.
+    {
+        game::SceneSnapshot delta;
+        scene.CaptureSnapshot(&delta, snapshot);
+        TEST_REQUIRE(delta.GetNumEntities() == 5);
+        TEST_REQUIRE(delta.GetNumStoredEntities() == 0);
+    }
+}
+
+class SnapshotTilemapData : public game::TilemapData
+{
+public:
+    virtual void Write(const void* ptr, size_t bytes, size_t offset) override
+    { std::memcpy(&mBytes[offset], ptr, bytes); }
+    virtual void Read(void* ptr, size_t bytes, size_t offset) const override
+    { std::memcpy(ptr, &mBytes[offset], bytes); }
+    virtual size_t AppendChunk(size_t bytes) override
+    {
+        const auto offset = mBytes.size();
+        mBytes.resize(offset + bytes);
+        return offset;
+    }
+    virtual void Resize(size_t bytes) override
+    { mBytes.resize(bytes); }
+    virtual void ClearChunk(const void* value, size_t value_size, size_t offset, size_t num_values) override
+    {
+        for (size_t i=0; i<num_values; ++i)
+            std::memcpy(&mBytes[offset + i * value_size], value, value_size);
+    }
+    virtual size_t GetByteCount() const override
+    { return mBytes.size(); }
+private:
+    std::vector<unsigned char> mBytes;
+};
+
+void unit_test_scene_snapshot_tilemap()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto layer_class = std::make_shared<game::TilemapLayerClass>();
+    layer_class->SetStorage(game::TilemapLayerClass::Storage::Dense);
+    layer_class->SetType(game::TilemapLayerClass::Type::DataUInt8);
+    auto data = std::make_shared<SnapshotTilemapData>();
+    layer_class->Initialize(200, 200, *data);
+    // some loaded layer data that isn't the default tile.
+    {
+        auto layer = game::CreateTilemapLayer(layer_class, 200, 200);
+        layer->Load(data);
+        layer->SetTileValue(7, 100, 20);
+        layer->FlushCache();
+        layer->Save();
+    }
+
+    auto layer = game::CreateTilemapLayer(layer_class, 200, 200);
+    layer->Load(data);
+
+    game::TilemapClass map_class;
+    game::Tilemap map(map_class);
+    map.AddLayer(std::move(layer));
+
+    game::SceneClass klass;
+    game::Scene scene(klass);
+    scene.SetMap(&map);
+
+    const auto GetTile = [&map](unsigned row, unsigned col) {
+        std::int32_t value = 0;
+        TEST_REQUIRE(map.GetLayer(0).GetTileValue(&value, row, col));
+        return value;
+    };
+
+    map.GetLayer(0).SetTileValue(1, 0, 0);
+    map.GetLayer(0).SetTileValue(2, 150, 150);
+
+    auto snapshot = std::make_shared<game::SceneSnapshot>();
+    scene.CaptureSnapshot(snapshot.get());
+    TEST_REQUIRE(snapshot->GetNumTileBlocks() == 2);
+    TEST_REQUIRE(snapshot->GetLayerRevisions().size() == 1);
+
+    map.GetLayer(0).SetTileValue(3, 0, 0);
+    map.GetLayer(0).SetTileValue(4, 151, 151);
+
+    auto delta = std::make_shared<game::SceneSnapshot>();
+    scene.CaptureSnapshot(delta.get(), snapshot);
+    TEST_REQUIRE(delta->GetNumTileBlocks() == 2);
+
+    map.GetLayer(0).SetTileValue(5, 0, 0);
+    map.GetLayer(0).SetTileValue(6, 151, 151);
+
+    // nothing was written after the delta.
+    {
+        game::SceneSnapshot empty;
+        scene.RestoreSnapshot(*delta);
+        scene.CaptureSnapshot(&empty, delta);
+        TEST_REQUIRE(GetTile(0, 0) == 3);
+        TEST_REQUIRE(GetTile(151, 151) == 4);
+        TEST_REQUIRE(GetTile(150, 150) == 2);
+    }
+
+    TEST_REQUIRE(scene.RestoreSnapshot(*snapshot));
+    TEST_REQUIRE(GetTile(0, 0) == 1);
+    TEST_REQUIRE(GetTile(150, 150) == 2);
+    TEST_REQUIRE(GetTile(151, 151) == 0);
+    TEST_REQUIRE(GetTile(199, 199) == 0);
+
+    // the restored delta is the same after loading it from the buffer.
+    game::SceneSnapshot copy;
+    TEST_REQUIRE(copy.FromBuffer(delta->GetBuffer(), snapshot));
+    TEST_REQUIRE(scene.RestoreSnapshot(copy));
+    TEST_REQUIRE(GetTile(0, 0) == 3);
+    TEST_REQUIRE(GetTile(151, 151) == 4);
+
+    // the tiles written after the capture in blocks that the snapshots
+    // don't have are reverted back to the loaded layer data.
+    map.GetLayer(0).SetTileValue(8, 199, 199);
+    map.GetLayer(0).SetTileValue(9, 100, 20);
+    map.GetLayer(0).SetTileValue(10, 100, 21);
+    TEST_REQUIRE(scene.RestoreSnapshot(*delta));
+    TEST_REQUIRE(GetTile(199, 199) == 0);
+    TEST_REQUIRE(GetTile(100, 20) == 7);
+    TEST_REQUIRE(GetTile(100, 21) == 0);
+    TEST_REQUIRE(GetTile(0, 0) == 3);
+    TEST_REQUIRE(GetTile(151, 151) == 4);
+
+    // also when restoring the base snapshot.
+    map.GetLayer(0).SetTileValue(11, 100, 20);
+    TEST_REQUIRE(scene.RestoreSnapshot(*snapshot));
+    TEST_REQUIRE(GetTile(100, 20) == 7);
+    TEST_REQUIRE(GetTile(0, 0) == 1);
+}
+
+void measure_scene_spawn_kill_time()
+{
+    TEST_CASE(test::Type::Other)
+
+    auto entity = std::make_shared<game::EntityClass>();
+    for (int i=0; i<10; ++i)
+    {
+        game::EntityNodeClass node;
+        node.SetName(base::FormatString("node%1", i));
+        node.SetDrawable(game::DrawableItemClass());
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    }
+    game::SceneClass klass;
+
+    const auto SpawnAndKill = [&entity](game::Scene& scene) {
+        game::EntityArgs args;
+        args.klass = entity;
+        args.enable_logging = false;
+        scene.BeginLoop();
+        for (int i=0; i<100; ++i)
+            scene.SpawnEntity(args);
+        scene.EndLoop();
+        scene.BeginLoop();
+        for (size_t i=0; i<scene.GetNumEntities(); ++i)
+            scene.KillEntity(&scene.GetEntity(i));
+        scene.EndLoop();
+        scene.BeginLoop();
+        scene.EndLoop();
+    };
+
+    game::Scene pooled(klass);
+    pooled.SetEntityPoolCapacity(100);
+    auto pooled_ret = test::TimedTest(100, [&pooled, &SpawnAndKill]() {
+        SpawnAndKill(pooled);
+    });
+
+    game::Scene unpooled(klass);
+    unpooled.SetEntityPoolCapacity(0);
+    auto unpooled_ret = test::TimedTest(100, [&unpooled, &SpawnAndKill]() {
+        SpawnAndKill(unpooled);
+    });
+    test::PrintTestTimes("pooled", pooled_ret);
+    test::PrintTestTimes("unpooled", unpooled_ret);
+}
+
+namespace {
+std::unique_ptr<game::Scene> MakeSpatialScene(game::SceneClass::SpatialIndex index, unsigned count)
+{
+    auto entity = std::make_shared<game::EntityClass>();
+    entity->SetName("entity");
+    {
+        game::EntityNodeClass node;
+        node.SetName("node");
+        node.SetSize(10.0f, 10.0f);
+        node.CreateSpatialNode();
+        entity->LinkChild(nullptr, entity->AddNode(node));
+    }
+
+    game::SceneClass klass;
+    klass.SetDynamicSpatialIndex(index);
+    // spawn one entity at each corner so that the index space
+    // is the same with every set of random entities.
+    const float corners[4][2] = {
+        {5.0f, 5.0f}, {995.0f, 5.0f}, {5.0f, 995.0f}, {995.0f, 995.0f}
+    };
+    for (unsigned i=0; i<4; ++i)
+    {
+        game::EntityPlacement placement;
+        placement.SetName("corner" + std::to_string(i));
+        placement.SetEntity(entity);
+        placement.SetTranslation(glm::vec2(corners[i][0], corners[i][1]));
+        klass.LinkChild(nullptr, klass.PlaceEntity(placement));
+    }
+
+    auto scene = game::CreateSceneInstance(klass);
+    scene->BeginLoop();
+    for (unsigned i=0; i<count; ++i)
+    {
+        game::EntityArgs args;
+        args.position.x = math::rand<2349876, int>(10, 990);
+        args.position.y = math::rand<7621897, int>(10, 990);
+        args.klass = entity;
+        args.name  = std::to_string(i);
+        scene->SpawnEntity(args);
+    }
+    scene->EndLoop();
+    scene->BeginLoop();
+    scene->Update(1.0f/60.0f);
+    scene->Rebuild();
+    scene->EndLoop();
+    return scene;
+}
+} // namespace
+
+void unit_test_scene_spatial_query_result(game::SceneClass::SpatialIndex index)
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto scene = MakeSpatialScene(index, 300);
+    const auto* spatial_index = scene->GetSpatialIndex();
+    TEST_REQUIRE(spatial_index->GetNumItems() == 304);
+
+    const auto ToSet = [](const game::Scene::SpatialQueryResult& result, size_t query = 0) {
+        std::set<game::EntityNode*> set;
+        for (size_t i=0; i<result.GetQuerySize(query); ++i)
+            set.insert(result.GetObject(result.GetQueryBegin(query) + i));
+        TEST_REQUIRE(set.size() == result.GetQuerySize(query));
+        return set;
+    };
+    const auto CheckOrder = [](const game::Scene::SpatialQueryResult& result) {
+        for (size_t i=1; i<result.GetSize(); ++i)
+            TEST_REQUIRE(result.GetDistance(i-1) <= result.GetDistance(i));
+    };
+
+    game::Scene::SpatialQueryResult result;
+    std::vector<game::FCircle> circles;
+    std::vector<game::FPoint> points;
+    std::vector<game::FRect> rects;
+    for (unsigned i=0; i<50; ++i)
+    {
+        const game::FPoint point(math::rand<111, int>(0, 1000), math::rand<222, int>(0, 1000));
+        const float radius = math::rand<333, int>(1, 200);
+        circles.push_back(game::FCircle(point, radius));
+        points.push_back(point);
+        rects.push_back(game::FRect(point, radius, radius * 0.5f));
+
+        // the results must match the results of the container queries.
+        std::set<game::EntityNode*> expected;
+        scene->QuerySpatialNodes(point, radius, &expected);
+        scene->QuerySpatialNodes(point, radius, &result);
+        TEST_REQUIRE(result.GetNumQueries() == 1);
+        TEST_REQUIRE(ToSet(result) == expected);
+
+        scene->QuerySpatialNodes(point, radius, &result, game::Scene::SpatialQueryMode::All, game::Scene::SpatialQueryOrder::Distance);
+        TEST_REQUIRE(ToSet(result) == expected);
+        CheckOrder(result);
+        for (const auto& hit : result)
+        {
+            const auto* rect = spatial_index->FindObjectRect(hit.object);
+            TEST_REQUIRE(rect);
+            TEST_REQUIRE(hit.distance <= radius + 0.001f);
+            TEST_REQUIRE(rect->TestPoint(point) == (hit.distance == 0.0f));
+        }
+
+        expected.clear();
+        scene->QuerySpatialNodes(rects.back(), &expected);
+        scene->QuerySpatialNodes(rects.back(), &result);
+        TEST_REQUIRE(ToSet(result) == expected);
+
+        expected.clear();
+        scene->QuerySpatialNodes(point, &expected);
+        scene->QuerySpatialNodes(point, &result);
+        TEST_REQUIRE(ToSet(result) == expected);
+
+        const game::FPoint end(math::rand<444, int>(0, 1000), math::rand<555, int>(0, 1000));
+        expected.clear();
+        scene->QuerySpatialNodes(point, end, &expected);
+        scene->QuerySpatialNodes(point, end, &result, game::Scene::SpatialQueryMode::All, game::Scene::SpatialQueryOrder::Distance);
+        TEST_REQUIRE(ToSet(result) == expected);
+        CheckOrder(result);
+
+        expected.clear();
+        scene->QuerySpatialNodes(point, radius, &expected, game::Scene::SpatialQueryMode::Closest);
+        scene->QuerySpatialNodes(point, radius, &result, game::Scene::SpatialQueryMode::Closest);
+        TEST_REQUIRE(result.GetSize() <= 1);
+        TEST_REQUIRE(ToSet(result) == expected);
+    }
+
+    // batch queries give the same results as the single queries.
+    {
+        game::Scene::SpatialQueryResult single;
+
+        scene->QuerySpatialNodes(circles, &result, game::Scene::SpatialQueryMode::All, game::Scene::SpatialQueryOrder::Distance);
+        TEST_REQUIRE(result.GetNumQueries() == circles.size());
+        for (size_t i=0; i<circles.size(); ++i)
+        {
+            scene->QuerySpatialNodes(circles[i].GetCenter(), circles[i].GetRadius(), &single,
+                                     game::Scene::SpatialQueryMode::All, game::Scene::SpatialQueryOrder::Distance);
+            TEST_REQUIRE(result.GetQuerySize(i) == single.GetSize());
+            TEST_REQUIRE(ToSet(result, i) == ToSet(single));
+            for (size_t j=0; j<single.GetSize(); ++j)
+                TEST_REQUIRE(result.GetDistance(result.GetQueryBegin(i) + j) == single.GetDistance(j));
+        }
+
+        scene->QuerySpatialNodes(rects, &result);
+        TEST_REQUIRE(result.GetNumQueries() == rects.size());
+        for (size_t i=0; i<rects.size(); ++i)
+        {
+            scene->QuerySpatialNodes(rects[i], &single);
+            TEST_REQUIRE(ToSet(result, i) == ToSet(single));
+        }
+
+        scene->QuerySpatialNodes(points, &result);
+        TEST_REQUIRE(result.GetNumQueries() == points.size());
+        for (size_t i=0; i<points.size(); ++i)
+        {
+            scene->QuerySpatialNodes(points[i], &single);
+            TEST_REQUIRE(ToSet(result, i) == ToSet(single));
+        }
+    }
+
+    // k nearest against brute force.
+    {
+        std::vector<game::EntityNode*> nodes;
+        scene->QuerySpatialNodes(game::FRect(-100.0f, -100.0f, 1200.0f, 1200.0f), &result);
+        for (const auto& hit : result)
+            nodes.push_back(hit.object);
+        TEST_REQUIRE(nodes.size() == 304);
+
+        const unsigned ks[] = {1, 5, 20, 400};
+        for (auto k : ks)
+        {
+            scene->QueryNearestSpatialNodes(points, k, &result);
+            TEST_REQUIRE(result.GetNumQueries() == points.size());
+            for (size_t i=0; i<points.size(); ++i)
+            {
+                std::vector<float> distances;
+                for (auto* node : nodes)
+                {
+                    const auto& rect = *spatial_index->FindObjectRect(node);
+                    const auto dx = std::max(std::max(rect.GetX() - points[i].GetX(), 0.0f), points[i].GetX() - rect.GetX() - rect.GetWidth());
+                    const auto dy = std::max(std::max(rect.GetY() - points[i].GetY(), 0.0f), points[i].GetY() - rect.GetY() - rect.GetHeight());
+                    distances.push_back(std::sqrt(dx*dx + dy*dy));
+                }
+                std::sort(distances.begin(), distances.end());
+                TEST_REQUIRE(result.GetQuerySize(i) == std::min<size_t>(k, nodes.size()));
+                for (size_t j=0; j<result.GetQuerySize(i); ++j)
+                    TEST_REQUIRE(math::equals(result.GetDistance(result.GetQueryBegin(i) + j), distances[j], 0.001f));
+            }
+        }
+        // limited by the maximum distance.
+        scene->QueryNearestSpatialNodes(game::FPoint(500.0f, 500.0f), 400, &result, 100.0f);
+        TEST_REQUIRE(!result.IsEmpty());
+        TEST_REQUIRE(result.GetSize() < 304);
+        for (const auto& hit : result)
+            TEST_REQUIRE(hit.distance <= 100.0f);
+        CheckOrder(result);
+
+        scene->QueryNearestSpatialNodes(game::FPoint(500.0f, 500.0f), 0, &result);
+        TEST_REQUIRE(result.IsEmpty());
+        TEST_REQUIRE(result.GetNumQueries() == 1);
+    }
+
+    // scene without an index.
+    {
+        game::SceneClass klass;
+        auto empty = game::CreateSceneInstance(klass);
+        empty->QuerySpatialNodes(game::FPoint(0.0f, 0.0f), &result);
+        TEST_REQUIRE(result.IsEmpty());
+        TEST_REQUIRE(result.GetNumQueries() == 0);
+    }
+}
+
+void measure_scene_spatial_query_time(game::SceneClass::SpatialIndex index)
+{
+    TEST_CASE(test::Type::Other)
+
+    auto scene = MakeSpatialScene(index, 2000);
+
+    std::vector<game::FCircle> circles;
+    for (unsigned i=0; i<1000; ++i)
+    {
+        const game::FPoint point(math::rand<3141, int>(0, 1000), math::rand<2718, int>(0, 1000));
+        circles.push_back(game::FCircle(point, 50.0f));
+    }
+
+    size_t sum = 0;
+    const auto& set = test::TimedTest(10, [&scene, &circles, &sum]() {
+        for (const auto& circle : circles)
+        {
+            std::set<game::EntityNode*> result;
+            scene->QuerySpatialNodes(circle.GetCenter(), circle.GetRadius(), &result);
+            sum += result.size();
+        }
+    });
+    game::Scene::SpatialQueryResult result;
+    const auto& buffer = test::TimedTest(10, [&scene, &circles, &result, &sum]() {
+        for (const auto& circle : circles)
+        {
+            scene->QuerySpatialNodes(circle.GetCenter(), circle.GetRadius(), &result);
+            sum += result.GetSize();
+        }
+    });
+    const auto& batch = test::TimedTest(10, [&scene, &circles, &result, &sum]() {
+        scene->QuerySpatialNodes(circles, &result);
+        sum += result.GetSize();
+    });
+    const auto& sorted = test::TimedTest(10, [&scene, &circles, &result, &sum]() {
+        scene->QuerySpatialNodes(circles, &result, game::Scene::SpatialQueryMode::All, game::Scene::SpatialQueryOrder::Distance);
+        sum += result.GetSize();
+    });
+    std::vector<game::FPoint> points;
+    for (const auto& circle : circles)
+        points.push_back(circle.GetCenter());
+    const auto& nearest = test::TimedTest(10, [&scene, &points, &result, &sum]() {
+        scene->QueryNearestSpatialNodes(points, 8, &result);
+        sum += result.GetSize();
+    });
+    TEST_REQUIRE(sum);
+
+    const std::string name = index == game::SceneClass::SpatialIndex::QuadTree ? "quadtree " : "dense grid ";
+    test::PrintTestTimes((name + "std::set").c_str(), set);
+    test::PrintTestTimes((name + "result buffer").c_str(), buffer);
+    test::PrintTestTimes((name + "batch").c_str(), batch);
+    test::PrintTestTimes((name + "batch sorted").c_str(), sorted);
+    test::PrintTestTimes((name + "8 nearest").c_str(), nearest);
+}
+
+void measure_scene_entity_lookup_time()
+{
+    TEST_CASE(test::Type::Other)
+
+    std::vector<std::shared_ptr<game::EntityClass>> classes;
+    for (int i=0; i<20; ++i)
+    {
+        auto klass = std::make_shared<game::EntityClass>();
+        klass->SetName(base::FormatString("class%1", i));
+        klass->SetTag(base::FormatString("#tag%1", i));
+        classes.push_back(klass);
+    }
+
+    game::SceneClass klass;
+    game::Scene scene(klass);
+    scene.BeginLoop();
+    for (int i=0; i<2000; ++i)
+    {
+        game::EntityArgs args;
+        args.klass = classes[i % classes.size()];
+        args.name  = std::to_string(i);
+        scene.SpawnEntity(args);
+    }
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+
+    size_t sum = 0;
+    // the old way of looking up by checking every entity.
+    const auto& scan = test::TimedTest(100, [&scene, &sum]() {
+        for (int i=0; i<100; ++i)
+        {
+            const auto& name = base::FormatString("class%1", i % 20);
+            std::vector<game::Entity*> ret;
+            for (size_t j=0; j<scene.GetNumEntities(); ++j)
+            {
+                if (scene.GetEntity(j).GetClassName() == name)
+                    ret.push_back(&scene.GetEntity(j));
+            }
+            sum += ret.size();
+        }
+    });
+    const auto& by_class = test::TimedTest(100, [&scene, &sum]() {
+        for (int i=0; i<100; ++i)
+        {
+            for (auto* entity : scene.ListEntitiesByClassName(base::FormatString("class%1", i % 20)))
+                sum += entity != nullptr;
+        }
+    });
+    for (int i=0; i<20; ++i)
+    {
+        scene.IndexEntityTag(base::FormatString("#tag%1", i));
+    }
+    const auto& by_tag = test::TimedTest(100, [&scene, &sum]() {
+        for (int i=0; i<100; ++i)
+        {
+            for (auto* entity : scene.ListEntitiesByTag(base::FormatString("#tag%1", i % 20)))
+                sum += entity != nullptr;
+        }
+    });
+    TEST_REQUIRE(sum);
+    test::PrintTestTimes("scan", scan);
+    test::PrintTestTimes("by class", by_class);
+    test::PrintTestTimes("by tag", by_tag);
+}
+
+void measure_scene_snapshot_time()
+{
+    TEST_CASE(test::Type::Other)
+
+    auto ship = MakeSnapshotEntityClass();
+
+    game::SceneClass klass;
+    game::Scene scene(klass);
+    scene.BeginLoop();
+    for (int i=0; i<5000; ++i)
+    {
+        game::EntityArgs args;
+        args.klass = ship;
+        args.name  = std::to_string(i);
+        args.position = glm::vec2(i % 100, i / 100);
+        scene.SpawnEntity(args);
+    }
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+
+    auto base = std::make_shared<game::SceneSnapshot>();
+    scene.CaptureSnapshot(base.get());
+
+    game::SceneSnapshot snapshot;
+    const auto& full = test::TimedTest(100, [&scene, &snapshot]() {
+        scene.CaptureSnapshot(&snapshot);
+    });
+    TEST_REQUIRE(snapshot.GetNumStoredEntities() == 5000);
+    const auto full_bytes = snapshot.GetByteCount();
+
+    // 1% of the entities have moved since the base.
+    const auto& delta = test::TimedTest(100, [&scene, &snapshot, &base]() {
+        for (size_t i=0; i<50; ++i)
+        {
+            auto& node = scene.GetEntity(i * 100).GetNode(0);
+            node.Translate(1.0f, 0.0f);
+        }
+        scene.CaptureSnapshot(&snapshot, base);
+    });
+    TEST_REQUIRE(snapshot.GetNumStoredEntities() == 50);
+    const auto delta_bytes = snapshot.GetByteCount();
+
+    const auto& restore = test::TimedTest(100, [&scene, &base]() {
+        scene.RestoreSnapshot(*base);
+    });
+    test::PrintTestTimes("full capture", full);
+    test::PrintTestTimes("delta capture", delta);
+    test::PrintTestTimes("restore", restore);
+    TEST_MESSAGE("full snapshot %u bytes, delta snapshot %u bytes", unsigned(full_bytes), unsigned(delta_bytes));
+}
+
 EXPORT_TEST_MAIN(
 int test_main(int argc, char* argv[])
 {
@@ -1292,8 +2675,24 @@ int test_main(int argc, char* argv[])
     unit_test_scene_spatial_update(game::SceneClass::SpatialIndex::QuadTree);
     unit_test_scene_spatial_query(game::SceneClass::SpatialIndex::DenseGrid);
     unit_test_scene_spatial_update(game::SceneClass::SpatialIndex::DenseGrid);
+    unit_test_scene_spatial_move(game::SceneClass::SpatialIndex::QuadTree);
+    unit_test_scene_spatial_move(game::SceneClass::SpatialIndex::DenseGrid);
+    unit_test_scene_spatial_query_result(game::SceneClass::SpatialIndex::QuadTree);
+    unit_test_scene_spatial_query_result(game::SceneClass::SpatialIndex::DenseGrid);
 
     unit_test_async_spawn();
+    unit_test_scene_parallel_update();
+    unit_test_scene_animation_batch();
+    unit_test_scene_entity_pool();
+    unit_test_scene_entity_lookup();
+    unit_test_scene_snapshot();
+    unit_test_scene_snapshot_tilemap();
+
+    measure_scene_spawn_kill_time();
+    measure_scene_spatial_query_time(game::SceneClass::SpatialIndex::QuadTree);
+    measure_scene_spatial_query_time(game::SceneClass::SpatialIndex::DenseGrid);
+    measure_scene_entity_lookup_time();
+    measure_scene_snapshot_time();
     return 0;
 }
 ) // TEST-MAIN
@@ -17,12 +17,21 @@
 #include "config.h"
 
 #include <cstring>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <chrono>
+#include <queue>
+#include <limits>
 
 #include "base/test_minimal.h"
 #include "base/test_help.h"
+#include "base/threadpool.h"
+#include "base/math.h"
 #include "game/tilemap.h"
+#include "game/tilemap_pathfinder.h"
+#include "game/tilemap_visibility.h"
 #include "game/loader.h"
 #include "data/json.h"
 
@@ -308,6 +317,7 @@ void test_tilemap_layer()
     klass.SetStorage(game::TilemapLayerClass::Storage::Sparse);
     klass.SetType(game::TilemapLayerClass::Type::DataUInt16);
     klass.SetCache(game::TilemapLayerClass::Cache::Cache128);
+    klass.SetCacheMemoryBudget(1024);
     klass.SetResolution(game::TilemapLayerClass::Resolution::DownScale8);
     klass.SetDefaultTileValue(game::detail::Data_Tile_UInt16 {5});
     klass.SetDataUri("pck://foobar/data.bin");
@@ -329,6 +339,7 @@ void test_tilemap_layer()
         TEST_REQUIRE(ret.GetStorage() == game::TilemapLayerClass::Storage::Sparse);
         TEST_REQUIRE(ret.GetType() == game::TilemapLayerClass::Type::DataUInt16);
         TEST_REQUIRE(ret.GetCache() == game::TilemapLayerClass::Cache::Cache128);
+        TEST_REQUIRE(ret.GetCacheMemoryBudget() == 1024);
         TEST_REQUIRE(ret.GetResolution() == game::TilemapLayerClass::Resolution::DownScale8);
         TEST_REQUIRE(ret.GetDefaultTileValue<game::detail::Data_Tile_UInt16>().data == 5);
         TEST_REQUIRE(ret.GetDataUri() == "pck://foobar/data.bin");
@@ -726,6 +737,298 @@ void test_tile_access_combinations(game::TilemapLayerClass::Storage storage)
     }
 }
 
+template<typename TileType>
+void test_tile_cache(game::TilemapLayerClass::Storage storage)
+{
+    TEST_CASE(test::Type::Feature)
+
+    using Cache = game::TilemapLayerClass::Cache;
+
+    const auto type = game::detail::TilemapLayerTraits<TileType>::LayerType;
+
+    // cache block dimensions
+    {
+        struct TestCase {
+            Cache cache;
+            unsigned width;
+            unsigned height;
+        } cases[] = {
+            {Cache::Cache8,    4,  2},
+            {Cache::Cache16,   4,  4},
+            {Cache::Cache32,   8,  4},
+            {Cache::Cache64,   8,  8},
+            {Cache::Cache128,  16, 8},
+            {Cache::Cache256,  16, 16},
+            {Cache::Cache512,  32, 16},
+            {Cache::Cache1024, 32, 32}
+        };
+        for (const auto& test : cases)
+        {
+            unsigned width  = 0;
+            unsigned height = 0;
+            game::TilemapLayerClass::GetCacheBlockSize(test.cache, &width, &height);
+            TEST_REQUIRE(width == test.width);
+            TEST_REQUIRE(height == test.height);
+        }
+    }
+
+    // cache block count
+    {
+        // budget for 4 blocks of 8x8 tiles of 2 bytes
+        TEST_REQUIRE(game::TilemapLayerClass::GetCacheBlockCount(Cache::Cache64, 512, 2, 100, 100) == 4);
+        // always at least 1 block
+        TEST_REQUIRE(game::TilemapLayerClass::GetCacheBlockCount(Cache::Cache64, 0, 2, 100, 100) == 1);
+        // no more blocks than there are blocks in the layer
+        TEST_REQUIRE(game::TilemapLayerClass::GetCacheBlockCount(Cache::Cache64, 1024*1024, 2, 16, 9) == 4);
+    }
+
+    // read/write through a cache that is smaller than the layer
+    // with a mix of evictions of dirty and clean blocks.
+    {
+        const unsigned map_width  = 100;
+        const unsigned map_height = 77;
+
+        auto klass = std::make_shared<game::TilemapLayerClass>();
+        klass->SetStorage(storage);
+        klass->SetType(type);
+        klass->SetCache(Cache::Cache64);
+        klass->SetCacheMemoryBudget(4 * 64 * sizeof(TileType));
+
+        TileType default_tile;
+        default_tile.data = 1;
+        klass->SetDefaultTileValue(default_tile);
+
+        auto data = std::make_shared<TestVectorData>();
+        klass->Initialize(map_width, map_height, *data);
+
+        auto layer = game::CreateTilemapLayer(klass, map_width, map_height);
+        layer->Load(data);
+        auto* ptr = game::TilemapLayerCast<game::detail::TilemapLayerBase<TileType>>(layer);
+
+        std::vector<int> expected;
+        expected.resize(map_width * map_height, 1);
+
+        std::srand(1234);
+        for (unsigned i=0; i<5000; ++i)
+        {
+            const auto row = std::rand() % map_height;
+            const auto col = std::rand() % map_width;
+            if (std::rand() % 2)
+            {
+                TileType tile;
+                tile.data = std::rand() % 100;
+                ptr->SetTile(tile, row, col);
+                expected[row * map_width + col] = tile.data;
+            }
+            else
+            {
+                TEST_REQUIRE(ptr->GetTile(row, col).data == expected[row * map_width + col]);
+            }
+        }
+
+        auto stats = layer->GetCacheStats();
+        TEST_REQUIRE(stats.hits + stats.misses == 5000);
+        TEST_REQUIRE(stats.misses > 0);
+        TEST_REQUIRE(stats.writes > 0);
+        layer->ResetCacheStats();
+        stats = layer->GetCacheStats();
+        TEST_REQUIRE(stats.hits == 0);
+        TEST_REQUIRE(stats.misses == 0);
+        TEST_REQUIRE(stats.writes == 0);
+
+        layer->FlushCache();
+        layer->Save();
+
+        // load the data into a new layer and check that everything was written out.
+        auto other = game::CreateTilemapLayer(klass, map_width, map_height);
+        other->Load(data);
+        auto* other_ptr = game::TilemapLayerCast<game::detail::TilemapLayerBase<TileType>>(other);
+        for (unsigned row=0; row<map_height; ++row)
+        {
+            for (unsigned col=0; col<map_width; ++col)
+            {
+                TEST_REQUIRE(other_ptr->GetTile(row, col).data == expected[row * map_width + col]);
+            }
+        }
+
+        if (storage == game::TilemapLayerClass::Storage::Dense)
+        {
+            // the layer doesn't fit in the budget, the dense layer caches
+            // spans of 64 tiles on a row, i.e. 2 spans per row.
+            other->ResetCacheStats();
+            for (unsigned row=0; row<16; ++row)
+            {
+                for (unsigned col=0; col<map_width; ++col)
+                    other_ptr->GetTile(row, col);
+            }
+            TEST_REQUIRE(other->GetCacheStats().misses == 32);
+            TEST_REQUIRE(other->GetCacheStats().hits == 16 * map_width - 32);
+
+            // the whole layer fits in the budget and stays resident.
+            klass->SetCacheMemoryBudget(map_width * map_height * sizeof(TileType));
+            auto resident = game::CreateTilemapLayer(klass, map_width, map_height);
+            resident->Load(data);
+            auto* resident_ptr = game::TilemapLayerCast<game::detail::TilemapLayerBase<TileType>>(resident);
+            for (unsigned i=0; i<1000; ++i)
+            {
+                const auto row = std::rand() % map_height;
+                const auto col = std::rand() % map_width;
+                TEST_REQUIRE(resident_ptr->GetTile(row, col).data == expected[row * map_width + col]);
+            }
+            TEST_REQUIRE(resident->GetCacheStats().misses == 1);
+            return;
+        }
+
+        // scanning the same 2D region again should be all cache hits.
+        other->ResetCacheStats();
+        for (unsigned row=0; row<16; ++row)
+        {
+            for (unsigned col=0; col<16; ++col)
+                other_ptr->GetTile(row, col);
+        }
+        TEST_REQUIRE(other->GetCacheStats().misses == 4);
+        for (unsigned row=0; row<16; ++row)
+        {
+            for (unsigned col=0; col<16; ++col)
+                other_ptr->GetTile(row, col);
+        }
+        TEST_REQUIRE(other->GetCacheStats().misses == 4);
+        TEST_REQUIRE(other->GetCacheStats().hits == 2 * 16 * 16 - 4);
+    }
+}
+
+template<typename TileType>
+void test_tile_streaming(game::TilemapLayerClass::Storage storage, bool async)
+{
+    TEST_CASE(test::Type::Feature)
+
+    const auto type = game::detail::TilemapLayerTraits<TileType>::LayerType;
+    const auto chunk_size = game::TilemapLayerClass::StreamingChunkSize;
+
+    const unsigned map_width  = 300;
+    const unsigned map_height = 200;
+
+    auto klass = std::make_shared<game::TilemapLayerClass>();
+    klass->SetStorage(storage);
+    klass->SetType(type);
+    klass->SetCache(game::TilemapLayerClass::Cache::Cache64);
+
+    TileType default_tile;
+    default_tile.data = 1;
+    klass->SetDefaultTileValue(default_tile);
+
+    auto data = std::make_shared<TestVectorData>();
+    klass->Initialize(map_width, map_height, *data);
+
+    // fill the layer data with a pattern through a normal layer.
+    auto expected = [](unsigned row, unsigned col) {
+        return int((row * 7 + col * 3) % 100 + 2);
+    };
+    {
+        auto layer = game::CreateTilemapLayer(klass, map_width, map_height);
+        layer->Load(data);
+        auto* ptr = game::TilemapLayerCast<game::detail::TilemapLayerBase<TileType>>(layer);
+        for (unsigned row=0; row<map_height; ++row)
+        {
+            for (unsigned col=0; col<map_width; ++col)
+            {
+                TileType tile;
+                tile.data = expected(row, col);
+                ptr->SetTile(tile, row, col);
+            }
+        }
+        layer->FlushCache();
+        layer->Save();
+    }
+
+    base::ThreadPool threadpool;
+    if (async)
+    {
+        threadpool.AddRealThread(base::ThreadPool::Worker0ThreadID);
+        base::SetGlobalThreadPool(&threadpool);
+    }
+
+    klass->SetStreaming(true);
+    auto layer = game::CreateTilemapLayer(klass, map_width, map_height);
+    layer->Load(data);
+    TEST_REQUIRE(layer->IsStreaming());
+    auto* ptr = game::TilemapLayerCast<game::detail::TilemapLayerBase<TileType>>(layer);
+
+    // nothing is resident yet, the renderer's reads fall back to the default tile.
+    TEST_REQUIRE(layer->GetStreamStats().resident_chunks == 0);
+    TEST_REQUIRE(ptr->GetResidentTile(10, 10).data == 1);
+
+    // any other read loads the chunk synchronously.
+    {
+        auto other = game::CreateTilemapLayer(klass, map_width, map_height);
+        other->Load(data);
+        auto* other_ptr = game::TilemapLayerCast<game::detail::TilemapLayerBase<TileType>>(other);
+        TEST_REQUIRE(other_ptr->GetResidentTile(10, 10).data == 1);
+        TEST_REQUIRE(other_ptr->GetTile(10, 10).data == expected(10, 10));
+        TEST_REQUIRE(other_ptr->GetResidentTile(10, 11).data == expected(10, 11));
+        TEST_REQUIRE(other->GetStreamStats().resident_chunks == 1);
+    }
+
+    auto update = [&layer](const game::URect& region) {
+        layer->UpdateStreaming(region);
+        while (layer->GetStreamStats().pending_chunks)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            layer->UpdateStreaming(region);
+        }
+    };
+
+    // the region is inside the first chunk, with the margin of one
+    // chunk this makes the chunks 0,0 0,1 1,0 and 1,1 resident.
+    update(game::URect(0, 0, 32, 32));
+    TEST_REQUIRE(layer->GetStreamStats().resident_chunks == 4);
+    TEST_REQUIRE(layer->GetStreamStats().loaded_chunks == 4);
+    TEST_REQUIRE(ptr->GetTile(10, 10).data == expected(10, 10));
+    TEST_REQUIRE(ptr->GetTile(chunk_size*2-1, chunk_size*2-1).data == expected(chunk_size*2-1, chunk_size*2-1));
+    // outside of the resident chunks.
+    TEST_REQUIRE(ptr->GetResidentTile(0, chunk_size*2).data == 1);
+
+    // move the region to the bottom right, the old chunks get evicted.
+    update(game::URect(map_width-10, map_height-5, 10, 5));
+    const auto stats = layer->GetStreamStats();
+    TEST_REQUIRE(stats.resident_chunks == 4);
+    TEST_REQUIRE(stats.evicted_chunks == 4);
+    TEST_REQUIRE(ptr->GetTile(map_height-1, map_width-1).data == expected(map_height-1, map_width-1));
+    TEST_REQUIRE(ptr->GetTile(chunk_size*2, chunk_size*3).data == expected(chunk_size*2, chunk_size*3));
+
+    // writing a tile in a chunk that isn't resident loads the chunk
+    // synchronously and keeps it resident until saved.
+    TileType tile;
+    tile.data = 0;
+    ptr->SetTile(tile, 5, 5);
+    TEST_REQUIRE(ptr->GetTile(5, 5).data == 0);
+    TEST_REQUIRE(ptr->GetTile(5, 6).data == expected(5, 6));
+    layer->FlushCache();
+    update(game::URect(map_width-10, map_height-5, 10, 5));
+    TEST_REQUIRE(layer->GetStreamStats().resident_chunks == 5);
+    layer->Save();
+    update(game::URect(map_width-10, map_height-5, 10, 5));
+    TEST_REQUIRE(layer->GetStreamStats().resident_chunks == 4);
+
+    // the whole map is streamed in when the region covers all of it.
+    update(game::URect(0, 0, map_width, map_height));
+    for (unsigned row=0; row<map_height; ++row)
+    {
+        for (unsigned col=0; col<map_width; ++col)
+        {
+            if (row == 5 && col == 5)
+                TEST_REQUIRE(ptr->GetTile(row, col).data == 0);
+            else TEST_REQUIRE(ptr->GetTile(row, col).data == expected(row, col));
+        }
+    }
+
+    if (async)
+    {
+        base::SetGlobalThreadPool(nullptr);
+        threadpool.WaitAll();
+        threadpool.Shutdown();
+    }
+}
 
 template<typename TileType>
 void test_layer_save_load(game::TilemapLayerClass::Storage storage)
@@ -970,6 +1273,110 @@ void test_layer_resize(game::TilemapLayerClass::Storage storage)
 }
 
 
+void test_layer_compression(game::TilemapLayerClass::Type type)
+{
+    TEST_CASE(test::Type::Feature)
+
+    const unsigned map_width  = 300;
+    const unsigned map_height = 200;
+    const unsigned fill_rows  = 150;
+
+    auto klass = std::make_shared<game::TilemapLayerClass>();
+    klass->SetStorage(game::TilemapLayerClass::Storage::Compressed);
+    klass->SetCache(game::TilemapLayerClass::Cache::Cache64);
+    klass->SetType(type);
+
+    const auto has_render = game::TilemapLayerClass::HasRenderComponent(type);
+    const auto has_data   = game::TilemapLayerClass::HasDataComponent(type);
+    const auto default_index = has_render ? klass->GetDefaultTilePaletteMaterialIndex() : 0;
+    const auto default_value = has_data ? klass->GetDefaultTileDataValue() : 0;
+
+    auto data = std::make_shared<TestVectorData>();
+    klass->Initialize(map_width, map_height, *data);
+    const auto initial_bytes = data->GetByteCount();
+    const auto raw_bytes = map_width * map_height * klass->GetTileDataSize();
+    // only the block table for a layer with default tiles.
+    TEST_REQUIRE(initial_bytes < raw_bytes / 10);
+
+    // repeating patterns such as what a level would have. the values
+    // are within the range of all the tile types.
+    const auto pattern_index = [](unsigned row, unsigned col) {
+        return uint8_t((col / 4 + row / 16) % 16);
+    };
+    const auto pattern_value = [](unsigned row, unsigned col) {
+        return int32_t((row / 8 + col / 16) % 8);
+    };
+    // values that don't compress well.
+    const auto noise_index = [](unsigned row, unsigned col) {
+        return uint8_t((row * 7 + col * 13) % 16);
+    };
+    const auto noise_value = [](unsigned row, unsigned col) {
+        return int32_t((row * 11 + col * 5) % 8);
+    };
+
+    const auto write = [&](game::TilemapLayer& layer, auto index, auto value) {
+        for (unsigned row=0; row<fill_rows; ++row)
+        {
+            for (unsigned col=0; col<map_width; ++col)
+            {
+                if (has_render)
+                    TEST_REQUIRE(layer.SetTilePaletteIndex(index(row, col), row, col));
+                if (has_data)
+                    TEST_REQUIRE(layer.SetTileValue(value(row, col), row, col));
+            }
+        }
+        layer.FlushCache();
+        layer.Save();
+    };
+    const auto verify = [&](auto index, auto value) {
+        // load the data into a new layer to check the round trip.
+        auto layer = game::CreateTilemapLayer(klass, map_width, map_height);
+        layer->Load(data);
+        for (unsigned row=0; row<map_height; ++row)
+        {
+            for (unsigned col=0; col<map_width; ++col)
+            {
+                const auto filled = row < fill_rows;
+                if (has_render)
+                {
+                    uint8_t tile_index = 0;
+                    TEST_REQUIRE(layer->GetTilePaletteIndex(&tile_index, row, col));
+                    TEST_REQUIRE(tile_index == (filled ? index(row, col) : default_index));
+                }
+                if (has_data)
+                {
+                    int32_t tile_value = 0;
+                    TEST_REQUIRE(layer->GetTileValue(&tile_value, row, col));
+                    TEST_REQUIRE(tile_value == (filled ? value(row, col) : default_value));
+                }
+            }
+        }
+    };
+
+    auto layer = game::CreateTilemapLayer(klass, map_width, map_height);
+    layer->Load(data);
+
+    write(*layer, pattern_index, pattern_value);
+    verify(pattern_index, pattern_value);
+    TEST_REQUIRE(data->GetByteCount() < raw_bytes / 4);
+
+    // the blocks need to grow and are moved in the data buffer.
+    write(*layer, noise_index, noise_value);
+    verify(noise_index, noise_value);
+    // blocks that don't compress are stored as is.
+    TEST_REQUIRE(data->GetByteCount() <= initial_bytes + raw_bytes);
+
+    // the blocks shrink again and the buffer is compacted on save.
+    write(*layer, pattern_index, pattern_value);
+    verify(pattern_index, pattern_value);
+    TEST_REQUIRE(data->GetByteCount() < raw_bytes / 4);
+
+    // writing the default tiles releases all the block data.
+    write(*layer, [=](unsigned, unsigned) { return default_index; },
+                  [=](unsigned, unsigned) { return default_value; });
+    TEST_REQUIRE(data->GetByteCount() == initial_bytes);
+}
+
 template<typename Type>
 void test_tilemaplayer_class_default_serialize(const Type& def)
 {
@@ -992,6 +1399,777 @@ void test_tilemaplayer_class_default_serialize(const Type& def)
     }
 }
 
+void measure_tile_cache_access_time(game::TilemapLayerClass::Storage storage)
+{
+    TEST_CASE(test::Type::Other)
+
+    using Cache = game::TilemapLayerClass::Cache;
+
+    const unsigned map_width  = 1024;
+    const unsigned map_height = 1024;
+
+    // pre-compute the random tile coordinates so that the timing only
+    // measures the tile access itself.
+    std::vector<std::pair<unsigned, unsigned>> random_tiles;
+    std::vector<std::pair<unsigned, unsigned>> window_tiles;
+    std::srand(4141);
+    for (unsigned i=0; i<100000; ++i)
+    {
+        random_tiles.push_back({std::rand() % map_height, std::rand() % map_width});
+    }
+    // random access around a moving 32x32 tile window such as when querying
+    // the tiles in the neighborhood of a moving game object.
+    for (unsigned i=0; i<100000; ++i)
+    {
+        const unsigned window_row = (i / 1000) * 8;
+        const unsigned window_col = (i / 1000) * 8;
+        window_tiles.push_back({window_row + std::rand() % 32, window_col + std::rand() % 32});
+    }
+
+    const Cache caches[] = {
+        Cache::Cache64, Cache::Cache128, Cache::Cache256, Cache::Cache512, Cache::Cache1024
+    };
+    for (auto cache : caches)
+    {
+        auto klass = std::make_shared<game::TilemapLayerClass>();
+        klass->SetStorage(storage);
+        klass->SetType(game::TilemapLayerClass::Type::DataUInt8);
+        klass->SetCache(cache);
+
+        auto data = std::make_shared<TestVectorData>();
+        klass->Initialize(map_width, map_height, *data);
+
+        auto layer = game::CreateTilemapLayer(klass, map_width, map_height);
+        layer->Load(data);
+        auto* ptr = game::TilemapLayerCast<game::TilemapLayer_Data_UInt8>(layer);
+
+        unsigned sum = 0;
+        const auto& random = test::TimedTest(10, [ptr, &random_tiles, &sum]() {
+            for (const auto& [row, col] : random_tiles)
+                sum += ptr->GetTile(row, col).data;
+        });
+        const auto& window = test::TimedTest(10, [ptr, &window_tiles, &sum]() {
+            for (const auto& [row, col] : window_tiles)
+                sum += ptr->GetTile(row, col).data;
+        });
+        const auto& scan = test::TimedTest(10, [ptr, &sum]() {
+            for (unsigned row=0; row<map_height; ++row)
+                for (unsigned col=0; col<map_width; ++col)
+                    sum += ptr->GetTile(row, col).data;
+        });
+        TEST_REQUIRE(sum == 0);
+
+        const auto& name = std::string(storage == game::TilemapLayerClass::Storage::Dense  ? "dense " :
+                                       storage == game::TilemapLayerClass::Storage::Sparse ? "sparse " : "compressed ")
+                                   + std::to_string(klass->GetCacheSize());
+        test::PrintTestTimes((name + " random").c_str(), random);
+        test::PrintTestTimes((name + " window").c_str(), window);
+        test::PrintTestTimes((name + " row scan").c_str(), scan);
+    }
+}
+
+namespace {
+std::unique_ptr<game::TilemapLayer> MakeDataLayer(unsigned width, unsigned height, std::shared_ptr<TestVectorData> data)
+{
+    auto klass = std::make_shared<game::TilemapLayerClass>();
+    klass->SetStorage(game::TilemapLayerClass::Storage::Dense);
+    klass->SetType(game::TilemapLayerClass::Type::DataUInt8);
+    klass->Initialize(width, height, *data);
+
+    auto layer = game::CreateTilemapLayer(klass, width, height);
+    layer->Load(data);
+    return layer;
+}
+
+// Scatter random obstacles and a few long walls with gaps over the layer.
+void MakeObstacles(game::TilemapLayer& layer, unsigned seed)
+{
+    std::srand(seed);
+    const auto width  = layer.GetWidth();
+    const auto height = layer.GetHeight();
+    for (unsigned row=0; row<height; ++row)
+    {
+        for (unsigned col=0; col<width; ++col)
+        {
+            if (std::rand() % 100 < 20)
+                layer.SetTileValue(1, row, col);
+        }
+    }
+    for (unsigned col=10; col<width; col+=23)
+    {
+        for (unsigned row=0; row<height; ++row)
+        {
+            if (row % 37 > 2)
+                layer.SetTileValue(1, row, col);
+        }
+    }
+}
+
+void test_layer_revisions()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(100, 70, data);
+
+    unsigned block_width  = 0;
+    unsigned block_height = 0;
+    layer->GetClass().GetCacheBlockSize(&block_width, &block_height);
+
+    std::vector<game::URect> blocks;
+    layer->ListModifiedBlocks(0, &blocks);
+    TEST_REQUIRE(layer->GetRevision() == 0);
+    TEST_REQUIRE(blocks.empty());
+
+    // reading doesn't modify.
+    int32_t value = 0;
+    TEST_REQUIRE(layer->GetTileValue(&value, 0, 0));
+    TEST_REQUIRE(layer->GetRevision() == 0);
+
+    TEST_REQUIRE(layer->SetTileValue(1, 0, 0));
+    TEST_REQUIRE(layer->SetTileValue(1, 0, 1));
+    const auto revision = layer->GetRevision();
+    TEST_REQUIRE(revision == 2);
+    layer->ListModifiedBlocks(0, &blocks);
+    TEST_REQUIRE(blocks.size() == 1);
+    TEST_REQUIRE(blocks[0] == game::URect(0, 0, block_width, block_height));
+
+    // the blocks at the layer edges are clipped to the layer.
+    TEST_REQUIRE(layer->SetTileValue(2, 69, 99));
+    blocks.clear();
+    layer->ListModifiedBlocks(revision, &blocks);
+    TEST_REQUIRE(blocks.size() == 1);
+    TEST_REQUIRE(blocks[0].GetX() == 99 / block_width * block_width);
+    TEST_REQUIRE(blocks[0].GetY() == 69 / block_height * block_height);
+    TEST_REQUIRE(blocks[0].GetX() + blocks[0].GetWidth() == 100);
+    TEST_REQUIRE(blocks[0].GetY() + blocks[0].GetHeight() == 70);
+
+    blocks.clear();
+    layer->ListModifiedBlocks(0, &blocks);
+    TEST_REQUIRE(blocks.size() == 2);
+    blocks.clear();
+    layer->ListModifiedBlocks(layer->GetRevision(), &blocks);
+    TEST_REQUIRE(blocks.empty());
+
+    layer->Load(data);
+    blocks.clear();
+    layer->ListModifiedBlocks(0, &blocks);
+    TEST_REQUIRE(layer->GetRevision() == 0);
+    TEST_REQUIRE(blocks.empty());
+}
+
+// Reference Dijkstra over the whole layer. Returns the cost of the
+// shortest path or max unsigned when the goal is not reachable.
+unsigned FindOptimalCost(const game::TilemapPathfinder& finder, const game::TilemapPathfinder::Tile& start,
+                         const game::TilemapPathfinder::Tile& goal)
+{
+    const auto width  = finder.GetWidth();
+    const auto height = finder.GetHeight();
+    const auto infinity = std::numeric_limits<unsigned>::max();
+    if (!finder.IsPassable(start.row, start.col) || !finder.IsPassable(goal.row, goal.col))
+        return infinity;
+
+    std::vector<unsigned> cost(width * height, infinity);
+    using Item = std::pair<unsigned, unsigned>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+    cost[start.row * width + start.col] = 0;
+    open.push({0, start.row * width + start.col});
+    while (!open.empty())
+    {
+        const auto [item_cost, index] = open.top();
+        open.pop();
+        if (item_cost > cost[index])
+            continue;
+        const int row = index / width;
+        const int col = index % width;
+        for (int dr=-1; dr<=1; ++dr)
+        {
+            for (int dc=-1; dc<=1; ++dc)
+            {
+                const int r = row + dr;
+                const int c = col + dc;
+                if ((!dr && !dc) || r < 0 || c < 0 || r >= (int)height || c >= (int)width)
+                    continue;
+                if (!finder.IsPassable(r, c))
+                    continue;
+                if (dr && dc && (!finder.IsPassable(row, c) || !finder.IsPassable(r, col)))
+                    continue;
+                const auto next = item_cost + ((dr && dc) ? 14 : 10);
+                if (next < cost[r * width + c])
+                {
+                    cost[r * width + c] = next;
+                    open.push({next, unsigned(r * width + c)});
+                }
+            }
+        }
+    }
+    return cost[goal.row * width + goal.col];
+}
+
+// Check that the path is a valid sequence of moves and return its cost.
+unsigned CheckPath(const game::TilemapPathfinder& finder, const game::TilemapPathfinder::Path& path,
+                   const game::TilemapPathfinder::Tile& start, const game::TilemapPathfinder::Tile& goal)
+{
+    TEST_REQUIRE(path.found);
+    TEST_REQUIRE(!path.tiles.empty());
+    TEST_REQUIRE(path.tiles.front().row == start.row && path.tiles.front().col == start.col);
+    TEST_REQUIRE(path.tiles.back().row == goal.row && path.tiles.back().col == goal.col);
+
+    unsigned cost = 0;
+    for (size_t i=1; i<path.tiles.size(); ++i)
+    {
+        const auto& prev = path.tiles[i-1];
+        const auto& next = path.tiles[i];
+        const int dr = int(next.row) - int(prev.row);
+        const int dc = int(next.col) - int(prev.col);
+        TEST_REQUIRE(std::abs(dr) <= 1 && std::abs(dc) <= 1 && (dr || dc));
+        TEST_REQUIRE(finder.IsPassable(next.row, next.col));
+        if (dr && dc)
+        {
+            TEST_REQUIRE(finder.IsPassable(prev.row, next.col));
+            TEST_REQUIRE(finder.IsPassable(next.row, prev.col));
+        }
+        cost += (dr && dc) ? 14 : 10;
+    }
+    TEST_REQUIRE(cost == path.cost);
+    return cost;
+}
+
+} // namespace
+
+void unit_test_pathfinder_basic()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(40, 40, data);
+
+    game::TilemapPathfinder::Settings settings;
+    settings.cluster_size = 8;
+
+    // open map, straight and diagonal paths.
+    {
+        game::TilemapPathfinder finder(*layer, settings);
+        TEST_REQUIRE(finder.GetWidth() == 40);
+        TEST_REQUIRE(finder.GetHeight() == 40);
+        TEST_REQUIRE(finder.GetNodeCount() > 0);
+
+        auto path = finder.FindPath({0, 0}, {0, 39});
+        TEST_REQUIRE(CheckPath(finder, path, {0, 0}, {0, 39}) == 390);
+        path = finder.FindPath({0, 0}, {39, 39});
+        TEST_REQUIRE(CheckPath(finder, path, {0, 0}, {39, 39}) == 39*14);
+        path = finder.FindPath({5, 5}, {5, 5});
+        TEST_REQUIRE(CheckPath(finder, path, {5, 5}, {5, 5}) == 0);
+        TEST_REQUIRE(path.tiles.size() == 1);
+    }
+
+    // a wall through the whole map blocks every path.
+    for (unsigned row=0; row<40; ++row)
+        layer->SetTileValue(1, row, 20);
+    {
+        game::TilemapPathfinder finder(*layer, settings);
+        TEST_REQUIRE(!finder.FindPath({0, 0}, {0, 39}).found);
+        TEST_REQUIRE(!finder.FindPath({0, 0}, {0, 20}).found);
+        TEST_REQUIRE(!finder.FindPath({0, 20}, {0, 0}).found);
+        TEST_REQUIRE(!finder.FindPath({0, 0}, {40, 0}).found);
+        TEST_REQUIRE(finder.FindPath({0, 0}, {39, 19}).found);
+    }
+
+    // a single gap in the wall.
+    layer->SetTileValue(0, 33, 20);
+    {
+        game::TilemapPathfinder finder(*layer, settings);
+        const auto& path = finder.FindPath({0, 0}, {0, 39});
+        CheckPath(finder, path, {0, 0}, {0, 39});
+        TEST_REQUIRE(path.cost == FindOptimalCost(finder, {0, 0}, {0, 39}));
+    }
+
+    // corner cutting is not allowed.
+    {
+        auto data  = std::make_shared<TestVectorData>();
+        auto layer = MakeDataLayer(4, 4, data);
+        layer->SetTileValue(1, 0, 1);
+        layer->SetTileValue(1, 1, 0);
+        game::TilemapPathfinder finder(*layer, settings);
+        TEST_REQUIRE(!finder.FindPath({0, 0}, {1, 1}).found);
+    }
+}
+
+void unit_test_pathfinder_optimality()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(200, 150, data);
+    MakeObstacles(*layer, 1234);
+
+    game::TilemapPathfinder finder(*layer);
+
+    unsigned found = 0;
+    unsigned total_cost = 0;
+    unsigned total_optimal = 0;
+    std::srand(5678);
+    for (unsigned i=0; i<300; ++i)
+    {
+        const game::TilemapPathfinder::Tile start = {unsigned(std::rand() % 150), unsigned(std::rand() % 200)};
+        const game::TilemapPathfinder::Tile goal  = {unsigned(std::rand() % 150), unsigned(std::rand() % 200)};
+        const auto optimal = FindOptimalCost(finder, start, goal);
+        const auto& path = finder.FindPath(start, goal);
+        TEST_REQUIRE(path.found == (optimal != std::numeric_limits<unsigned>::max()));
+        if (!path.found)
+            continue;
+
+        const auto cost = CheckPath(finder, path, start, goal);
+        TEST_REQUIRE(cost >= optimal);
+        TEST_REQUIRE(cost <= optimal * 13 / 10 + 20);
+        total_cost += cost;
+        total_optimal += optimal;
+        ++found;
+    }
+    TEST_REQUIRE(found > 100);
+    // on average the paths should be close to optimal.
+    TEST_REQUIRE(total_cost <= total_optimal * 11 / 10);
+}
+
+void unit_test_pathfinder_update_tiles()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(128, 128, data);
+    MakeObstacles(*layer, 4321);
+
+    game::TilemapPathfinder finder(*layer);
+    const auto initial_rebuilds = finder.GetClusterRebuildCount();
+    TEST_REQUIRE(initial_rebuilds == 64);
+
+    std::srand(8765);
+    for (unsigned i=0; i<20; ++i)
+    {
+        // change a small region of tiles.
+        const unsigned row = std::rand() % 120;
+        const unsigned col = std::rand() % 120;
+        for (unsigned r=row; r<row+5; ++r)
+        {
+            for (unsigned c=col; c<col+5; ++c)
+                layer->SetTileValue(std::rand() % 2, r, c);
+        }
+        finder.UpdateTiles(*layer, game::URect(col, row, 5, 5));
+        for (unsigned r=row; r<row+5; ++r)
+        {
+            for (unsigned c=col; c<col+5; ++c)
+            {
+                int32_t value = 0;
+                layer->GetTileValue(&value, r, c);
+                TEST_REQUIRE(finder.IsPassable(r, c) == (value == 0));
+            }
+        }
+
+        // the updated pathfinder must match a pathfinder built from scratch.
+        game::TilemapPathfinder reference(*layer);
+        for (unsigned j=0; j<20; ++j)
+        {
+            const game::TilemapPathfinder::Tile start = {unsigned(std::rand() % 128), unsigned(std::rand() % 128)};
+            const game::TilemapPathfinder::Tile goal  = {unsigned(std::rand() % 128), unsigned(std::rand() % 128)};
+            const auto& path = finder.FindPath(start, goal);
+            const auto& expected = reference.FindPath(start, goal);
+            TEST_REQUIRE(path.found == expected.found);
+            TEST_REQUIRE(path.cost == expected.cost);
+            if (path.found)
+                CheckPath(finder, path, start, goal);
+        }
+        TEST_REQUIRE(finder.GetNodeCount() == reference.GetNodeCount());
+    }
+    // only the clusters around the changes are rebuilt.
+    TEST_REQUIRE(finder.GetClusterRebuildCount() - initial_rebuilds < 20 * 16);
+
+    // unchanged tiles don't cause rebuilds.
+    const auto rebuilds = finder.GetClusterRebuildCount();
+    finder.UpdateTiles(*layer, game::URect(0, 0, 128, 128));
+    finder.Update();
+    TEST_REQUIRE(finder.GetClusterRebuildCount() == rebuilds);
+}
+
+void unit_test_pathfinder_queries(bool threaded)
+{
+    TEST_CASE(test::Type::Feature)
+
+    base::ThreadPool threadpool;
+    if (threaded)
+    {
+        threadpool.AddRealThread(base::ThreadPool::Worker0ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker1ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker2ThreadID);
+        base::SetGlobalThreadPool(&threadpool);
+    }
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(128, 128, data);
+    MakeObstacles(*layer, 1111);
+
+    {
+        game::TilemapPathfinder finder(*layer);
+
+        struct Query {
+            game::TilemapPathfinder::QueryId id;
+            game::TilemapPathfinder::Tile start;
+            game::TilemapPathfinder::Tile goal;
+        };
+        std::vector<Query> queries;
+        std::srand(2222);
+        for (unsigned i=0; i<500; ++i)
+        {
+            Query query;
+            query.start = {unsigned(std::rand() % 128), unsigned(std::rand() % 128)};
+            query.goal  = {unsigned(std::rand() % 128), unsigned(std::rand() % 128)};
+            query.id    = finder.SubmitQuery(query.start, query.goal);
+            TEST_REQUIRE(finder.IsPending(query.id));
+            queries.push_back(query);
+        }
+        finder.Update();
+
+        // change the tiles while the queries are running. the running
+        // queries still see the old tiles.
+        game::TilemapPathfinder before(*layer);
+        for (unsigned col=0; col<128; ++col)
+            layer->SetTileValue(1, 64, col);
+        finder.UpdateTiles(*layer, game::URect(0, 64, 128, 1));
+        finder.WaitPending();
+
+        for (const auto& query : queries)
+        {
+            TEST_REQUIRE(!finder.IsPending(query.id));
+            game::TilemapPathfinder::Path path;
+            TEST_REQUIRE(finder.TakeResult(query.id, &path));
+
+            const auto& expected = before.FindPath(query.start, query.goal);
+            TEST_REQUIRE(path.found == expected.found);
+            TEST_REQUIRE(path.cost == expected.cost);
+            // the result can only be taken once.
+            TEST_REQUIRE(!finder.TakeResult(query.id, &path));
+        }
+
+        // the new queries see the new tiles.
+        const auto id = finder.SubmitQuery({0, 0}, {127, 127});
+        finder.Update();
+        finder.WaitPending();
+        game::TilemapPathfinder::Path path;
+        TEST_REQUIRE(finder.TakeResult(id, &path));
+        TEST_REQUIRE(!path.found);
+    }
+
+    if (threaded)
+    {
+        base::SetGlobalThreadPool(nullptr);
+        threadpool.WaitAll();
+        threadpool.Shutdown();
+    }
+}
+
+void measure_pathfinder_query_throughput(bool threaded)
+{
+    TEST_CASE(test::Type::Other)
+
+    base::ThreadPool threadpool;
+    if (threaded)
+    {
+        threadpool.AddRealThread(base::ThreadPool::Worker0ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker1ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker2ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker3ThreadID);
+        base::SetGlobalThreadPool(&threadpool);
+    }
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(512, 512, data);
+    MakeObstacles(*layer, 3333);
+
+    {
+        game::TilemapPathfinder finder(*layer);
+
+        std::vector<std::pair<game::TilemapPathfinder::Tile, game::TilemapPathfinder::Tile>> queries;
+        std::srand(4444);
+        for (unsigned i=0; i<1000; ++i)
+        {
+            queries.push_back({{unsigned(std::rand() % 512), unsigned(std::rand() % 512)},
+                               {unsigned(std::rand() % 512), unsigned(std::rand() % 512)}});
+        }
+
+        const auto& ret = test::TimedTest(10, [&finder, &queries]() {
+            std::vector<game::TilemapPathfinder::QueryId> ids;
+            for (const auto& query : queries)
+                ids.push_back(finder.SubmitQuery(query.first, query.second));
+            finder.Update();
+            finder.WaitPending();
+
+            game::TilemapPathfinder::Path path;
+            for (auto id : ids)
+                TEST_REQUIRE(finder.TakeResult(id, &path));
+        });
+        test::PrintTestTimes(threaded ? "path queries (threaded)" : "path queries", ret);
+    }
+
+    if (threaded)
+    {
+        base::SetGlobalThreadPool(nullptr);
+        threadpool.WaitAll();
+        threadpool.Shutdown();
+    }
+}
+
+void unit_test_visibility_basic()
+{
+    TEST_CASE(test::Type::Feature)
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(30, 30, data);
+    auto fog_data = std::make_shared<TestVectorData>();
+    auto fog = MakeDataLayer(30, 30, fog_data);
+
+    // open map, everything inside the view radius is visible.
+    {
+        game::TilemapVisibility visibility(*layer);
+        const auto id = visibility.AddObserver(15, 15, 5);
+        TEST_REQUIRE(visibility.HasObserver(id));
+        TEST_REQUIRE(visibility.GetObserverCount() == 1);
+        TEST_REQUIRE(!visibility.IsVisible(15, 15));
+        visibility.Update(fog.get());
+
+        for (unsigned row=0; row<30; ++row)
+        {
+            for (unsigned col=0; col<30; ++col)
+            {
+                const int dr = int(row) - 15;
+                const int dc = int(col) - 15;
+                const bool inside = dr*dr + dc*dc <= 25;
+                TEST_REQUIRE(visibility.IsVisible(row, col) == inside);
+                TEST_REQUIRE(visibility.IsExplored(row, col) == inside);
+                int32_t value = 0;
+                TEST_REQUIRE(fog->GetTileValue(&value, row, col));
+                TEST_REQUIRE(value == (inside ? 2 : 0));
+            }
+        }
+        TEST_REQUIRE(visibility.GetVisibleTiles(id)->size() == visibility.GetChangedTileCount());
+        TEST_REQUIRE(visibility.GetVisibleTiles(123) == nullptr);
+
+        // nothing changed, nothing is recomputed.
+        visibility.Update(fog.get());
+        TEST_REQUIRE(visibility.GetObserverUpdateCount() == 1);
+        TEST_REQUIRE(visibility.GetChangedTileCount() == 0);
+
+        // removing the observer leaves the tiles explored.
+        visibility.RemoveObserver(id);
+        TEST_REQUIRE(!visibility.HasObserver(id));
+        visibility.Update(fog.get());
+        TEST_REQUIRE(!visibility.IsVisible(15, 15));
+        TEST_REQUIRE(visibility.IsExplored(15, 15));
+        int32_t value = 0;
+        TEST_REQUIRE(fog->GetTileValue(&value, 15, 15));
+        TEST_REQUIRE(value == 1);
+    }
+
+    // a wall blocks the view but is itself visible.
+    for (unsigned row=0; row<30; ++row)
+        layer->SetTileValue(1, row, 18);
+    {
+        game::TilemapVisibility visibility(*layer);
+        visibility.AddObserver(15, 15, 8);
+        visibility.Update();
+        TEST_REQUIRE(visibility.IsOpaque(15, 18));
+        TEST_REQUIRE(visibility.IsVisible(15, 17));
+        TEST_REQUIRE(visibility.IsVisible(15, 18));
+        TEST_REQUIRE(visibility.IsVisible(12, 18));
+        TEST_REQUIRE(!visibility.IsVisible(15, 19));
+        TEST_REQUIRE(!visibility.IsVisible(15, 20));
+        TEST_REQUIRE(!visibility.IsVisible(10, 22));
+        TEST_REQUIRE(visibility.IsVisible(15, 10));
+
+        TEST_REQUIRE(visibility.HasLineOfSight(15, 15, 15, 18));
+        TEST_REQUIRE(visibility.HasLineOfSight(15, 15, 0, 0));
+        TEST_REQUIRE(!visibility.HasLineOfSight(15, 15, 15, 19));
+        TEST_REQUIRE(!visibility.HasLineOfSight(0, 0, 29, 29));
+        TEST_REQUIRE(!visibility.HasLineOfSight(0, 0, 30, 0));
+    }
+}
+
+void unit_test_visibility_incremental(bool threaded)
+{
+    TEST_CASE(test::Type::Feature)
+
+    base::ThreadPool threadpool;
+    if (threaded)
+    {
+        threadpool.AddRealThread(base::ThreadPool::Worker0ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker1ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker2ThreadID);
+        base::SetGlobalThreadPool(&threadpool);
+    }
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(128, 128, data);
+    MakeObstacles(*layer, 9999);
+    auto fog_data = std::make_shared<TestVectorData>();
+    auto fog = MakeDataLayer(128, 128, fog_data);
+
+    {
+        struct Observer {
+            game::TilemapVisibility::ObserverId id;
+            unsigned row;
+            unsigned col;
+            unsigned radius;
+        };
+        std::vector<Observer> observers;
+
+        game::TilemapVisibility visibility(*layer);
+        std::srand(7777);
+        for (unsigned i=0; i<50; ++i)
+        {
+            Observer observer;
+            observer.row    = std::rand() % 128;
+            observer.col    = std::rand() % 128;
+            observer.radius = 4 + std::rand() % 8;
+            observer.id     = visibility.AddObserver(observer.row, observer.col, observer.radius);
+            observers.push_back(observer);
+        }
+
+        std::vector<bool> explored(128 * 128, false);
+
+        for (unsigned step=0; step<20; ++step)
+        {
+            // move every observer by one tile.
+            for (auto& observer : observers)
+            {
+                observer.row = math::clamp(0, 127, int(observer.row) + std::rand() % 3 - 1);
+                observer.col = math::clamp(0, 127, int(observer.col) + std::rand() % 3 - 1);
+                visibility.MoveObserver(observer.id, observer.row, observer.col);
+            }
+            if (step == 10)
+            {
+                visibility.RemoveObserver(observers.back().id);
+                observers.pop_back();
+                visibility.SetObserverRadius(observers[0].id, 20);
+                observers[0].radius = 20;
+            }
+            if (step == 15)
+            {
+                for (unsigned col=0; col<128; ++col)
+                    layer->SetTileValue(1, 64, col);
+                visibility.UpdateTiles(*layer, game::URect(0, 64, 128, 1));
+            }
+            visibility.Update(fog.get());
+
+            // the incrementally updated visibility must match a visibility
+            // computed from scratch with the same observers.
+            game::TilemapVisibility reference(*layer);
+            for (const auto& observer : observers)
+                reference.AddObserver(observer.row, observer.col, observer.radius);
+            reference.Update();
+
+            for (unsigned row=0; row<128; ++row)
+            {
+                for (unsigned col=0; col<128; ++col)
+                {
+                    const auto visible = reference.IsVisible(row, col);
+                    explored[row * 128 + col] = explored[row * 128 + col] || visible;
+                    TEST_REQUIRE(visibility.IsVisible(row, col) == visible);
+                    TEST_REQUIRE(visibility.IsExplored(row, col) == explored[row * 128 + col]);
+
+                    int32_t value = 0;
+                    TEST_REQUIRE(fog->GetTileValue(&value, row, col));
+                    TEST_REQUIRE(value == (visible ? 2 : (explored[row * 128 + col] ? 1 : 0)));
+                }
+            }
+        }
+
+        // changing tiles that no observer can see doesn't recompute anything.
+        const auto updates = visibility.GetObserverUpdateCount();
+        for (auto& observer : observers)
+        {
+            observer.row = 0;
+            observer.col = 0;
+            visibility.MoveObserver(observer.id, 0, 0);
+            visibility.SetObserverRadius(observer.id, 13);
+        }
+        visibility.Update(fog.get());
+        TEST_REQUIRE(visibility.GetObserverUpdateCount() == updates + observers.size());
+        layer->SetTileValue(1, 100, 100);
+        visibility.UpdateTiles(*layer, game::URect(100, 100, 1, 1));
+        visibility.Update(fog.get());
+        TEST_REQUIRE(visibility.GetObserverUpdateCount() == updates + observers.size());
+        layer->SetTileValue(1, 2, 2);
+        visibility.UpdateTiles(*layer, game::URect(2, 2, 1, 1));
+        visibility.Update(fog.get());
+        TEST_REQUIRE(visibility.GetObserverUpdateCount() == updates + 2 * observers.size());
+    }
+
+    if (threaded)
+    {
+        base::SetGlobalThreadPool(nullptr);
+        threadpool.WaitAll();
+        threadpool.Shutdown();
+    }
+}
+
+void measure_visibility_update_time(bool threaded)
+{
+    TEST_CASE(test::Type::Other)
+
+    base::ThreadPool threadpool;
+    if (threaded)
+    {
+        threadpool.AddRealThread(base::ThreadPool::Worker0ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker1ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker2ThreadID);
+        threadpool.AddRealThread(base::ThreadPool::Worker3ThreadID);
+        base::SetGlobalThreadPool(&threadpool);
+    }
+
+    auto data  = std::make_shared<TestVectorData>();
+    auto layer = MakeDataLayer(512, 512, data);
+    MakeObstacles(*layer, 5555);
+    auto fog_data = std::make_shared<TestVectorData>();
+    auto fog = MakeDataLayer(512, 512, fog_data);
+
+    {
+        std::vector<std::pair<unsigned, unsigned>> positions;
+        std::srand(6666);
+        for (unsigned i=0; i<200; ++i)
+            positions.push_back({20 + std::rand() % 400, 20 + std::rand() % 400});
+
+        // compute every observer from scratch.
+        const auto& full = test::TimedTest(10, [&layer, &fog, &positions]() {
+            game::TilemapVisibility visibility(*layer);
+            for (const auto& pos : positions)
+                visibility.AddObserver(pos.first, pos.second, 12);
+            visibility.Update(fog.get());
+        });
+
+        // move every observer by one tile.
+        game::TilemapVisibility visibility(*layer);
+        std::vector<game::TilemapVisibility::ObserverId> ids;
+        for (const auto& pos : positions)
+            ids.push_back(visibility.AddObserver(pos.first, pos.second, 12));
+        visibility.Update(fog.get());
+
+        unsigned step = 0;
+        const auto& move = test::TimedTest(10, [&visibility, &fog, &ids, &positions, &step]() {
+            ++step;
+            for (size_t i=0; i<ids.size(); ++i)
+                visibility.MoveObserver(ids[i], positions[i].first, positions[i].second + (step % 2));
+            visibility.Update(fog.get());
+        });
+        test::PrintTestTimes(threaded ? "visibility full (threaded)" : "visibility full", full);
+        test::PrintTestTimes(threaded ? "visibility move (threaded)" : "visibility move", move);
+    }
+
+    if (threaded)
+    {
+        base::SetGlobalThreadPool(nullptr);
+        threadpool.WaitAll();
+        threadpool.Shutdown();
+    }
+}
+
 EXPORT_TEST_MAIN(
 int test_main(int argc, char* argv[])
 {
@@ -1029,6 +2207,32 @@ int test_main(int argc, char* argv[])
     test_tile_access_combinations<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Sparse);
     test_tile_access_combinations<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Sparse);
     test_tile_access_combinations<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Sparse);
+    test_tile_access_combinations<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Compressed);
+    test_tile_access_combinations<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Compressed);
+    test_tile_access_combinations<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Compressed);
+    test_tile_access_combinations<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Compressed);
+
+    test_tile_cache<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Dense);
+    test_tile_cache<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Dense);
+    test_tile_cache<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Dense);
+    test_tile_cache<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Dense);
+    test_tile_cache<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Sparse);
+    test_tile_cache<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Sparse);
+    test_tile_cache<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Sparse);
+    test_tile_cache<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Sparse);
+    test_tile_cache<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Compressed);
+    test_tile_cache<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Compressed);
+    test_tile_cache<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Compressed);
+    test_tile_cache<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Compressed);
+
+    test_tile_streaming<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Dense, false);
+    test_tile_streaming<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Dense, false);
+    test_tile_streaming<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Sparse, false);
+    test_tile_streaming<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Sparse, false);
+    test_tile_streaming<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Dense, true);
+    test_tile_streaming<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Sparse, true);
+    test_tile_streaming<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Compressed, false);
+    test_tile_streaming<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Compressed, true);
 
     test_layer_save_load<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Dense);
     test_layer_save_load<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Dense);
@@ -1038,6 +2242,10 @@ int test_main(int argc, char* argv[])
     test_layer_save_load<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Sparse);
     test_layer_save_load<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Sparse);
     test_layer_save_load<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Sparse);
+    test_layer_save_load<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Compressed);
+    test_layer_save_load<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Compressed);
+    test_layer_save_load<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Compressed);
+    test_layer_save_load<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Compressed);
 
     test_layer_resize<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Dense);
     test_layer_resize<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Dense);
@@ -1049,6 +2257,23 @@ int test_main(int argc, char* argv[])
     test_layer_resize<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Sparse);
     test_layer_resize<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Sparse);
 
+    test_layer_resize<det::Render_Data_Tile_UInt8>(game::TilemapLayerClass::Storage::Compressed);
+    test_layer_resize<det::Render_Data_Tile_UInt24>(game::TilemapLayerClass::Storage::Compressed);
+    test_layer_resize<det::Data_Tile_UInt8 >(game::TilemapLayerClass::Storage::Compressed);
+    test_layer_resize<det::Data_Tile_SInt16>(game::TilemapLayerClass::Storage::Compressed);
+
+    test_layer_compression(game::TilemapLayerClass::Type::Render);
+    test_layer_compression(game::TilemapLayerClass::Type::Render_DataSInt4);
+    test_layer_compression(game::TilemapLayerClass::Type::Render_DataSInt8);
+    test_layer_compression(game::TilemapLayerClass::Type::Render_DataSInt24);
+    test_layer_compression(game::TilemapLayerClass::Type::Render_DataUInt4);
+    test_layer_compression(game::TilemapLayerClass::Type::Render_DataUInt8);
+    test_layer_compression(game::TilemapLayerClass::Type::Render_DataUInt24);
+    test_layer_compression(game::TilemapLayerClass::Type::DataSInt8);
+    test_layer_compression(game::TilemapLayerClass::Type::DataSInt16);
+    test_layer_compression(game::TilemapLayerClass::Type::DataUInt8);
+    test_layer_compression(game::TilemapLayerClass::Type::DataUInt16);
+
     test_tilemaplayer_class_default_serialize(det::Render_Tile{uint8_t(123)});
     test_tilemaplayer_class_default_serialize(det::Render_Tile{uint8_t(255)});
     test_tilemaplayer_class_default_serialize(det::Render_Data_Tile_UInt4{uint8_t(4), uint8_t(9)} );
@@ -1082,6 +2307,26 @@ int test_main(int argc, char* argv[])
     test_tilemaplayer_class_default_serialize(det::Data_Tile_UInt16{uint16_t(min_u_16)} );
     test_tilemaplayer_class_default_serialize(det::Data_Tile_UInt16{uint16_t(max_u_16)} );
 
+    test_layer_revisions();
+
+    measure_tile_cache_access_time(game::TilemapLayerClass::Storage::Dense);
+    measure_tile_cache_access_time(game::TilemapLayerClass::Storage::Sparse);
+    measure_tile_cache_access_time(game::TilemapLayerClass::Storage::Compressed);
+
+    unit_test_pathfinder_basic();
+    unit_test_pathfinder_optimality();
+    unit_test_pathfinder_update_tiles();
+    unit_test_pathfinder_queries(false);
+    unit_test_pathfinder_queries(true);
+    measure_pathfinder_query_throughput(false);
+    measure_pathfinder_query_throughput(true);
+
+    unit_test_visibility_basic();
+    unit_test_visibility_incremental(false);
+    unit_test_visibility_incremental(true);
+    measure_visibility_update_time(false);
+    measure_visibility_update_time(true);
+
     return 0;
 }
 ) //
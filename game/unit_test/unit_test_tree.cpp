@@ -22,6 +22,8 @@
 #include <iostream>
 #include <limits>
 #include <algorithm>
+#include <functional>
+#include <memory>
 
 #include "base/test_minimal.h"
 #include "base/test_help.h"
@@ -257,6 +259,169 @@ void unit_test_render_tree()
     }
 }
 
+void unit_test_render_tree_flat()
+{
+    TEST_CASE(test::Type::Feature)
+
+    using MyTree = game::RenderTree<MyNode>;
+    MyNode foo("foo", 123);
+    MyNode bar("bar", 222);
+    MyNode child0("child 0", 1);
+    MyNode child1("child 1", 2);
+    MyNode child2("child 2", 3);
+    MyNode child3("child 3", 3);
+
+    MyTree tree;
+    tree.LinkChild(nullptr, &foo);
+    tree.LinkChild(nullptr, &bar);
+    tree.LinkChild(&foo, &child0);
+    tree.LinkChild(&foo, &child1);
+    tree.LinkChild(&bar, &child2);
+    tree.LinkChild(&bar, &child3);
+
+    // flat layout
+    {
+        const auto& flat = tree.GetFlatTree();
+        TEST_REQUIRE(flat.size() == 7);
+        TEST_REQUIRE(flat[0].node == nullptr);
+        TEST_REQUIRE(flat[0].parent == MyTree::NoParent);
+        TEST_REQUIRE(flat[0].size == 7);
+        TEST_REQUIRE(flat[1].node == &foo);
+        TEST_REQUIRE(flat[1].parent == 0);
+        TEST_REQUIRE(flat[1].size == 3);
+        TEST_REQUIRE(flat[2].node == &child0);
+        TEST_REQUIRE(flat[2].parent == 1);
+        TEST_REQUIRE(flat[2].size == 1);
+        TEST_REQUIRE(flat[4].node == &bar);
+        TEST_REQUIRE(flat[4].parent == 0);
+        TEST_REQUIRE(flat[4].size == 3);
+        TEST_REQUIRE(flat[6].node == &child3);
+        TEST_REQUIRE(flat[6].parent == 4);
+    }
+
+    // enter/leave order
+    {
+        class Visitor : public MyTree::ConstVisitor {
+        public:
+            virtual void EnterNode(const MyNode* node) override
+            {
+                names.append("+");
+                names.append(node ? node->s : "root");
+                names.append(" ");
+            }
+            virtual void LeaveNode(const MyNode* node) override
+            {
+                names.append("-");
+                names.append(node ? node->s : "root");
+                names.append(" ");
+            }
+            std::string names;
+        };
+        Visitor visitor;
+        tree.PreOrderTraverse(visitor);
+        TEST_REQUIRE(visitor.names == "+root +foo +child 0 -child 0 +child 1 -child 1 -foo "
+                                      "+bar +child 2 -child 2 +child 3 -child 3 -bar -root ");
+
+        visitor.names.clear();
+        tree.PreOrderTraverse(visitor, &bar);
+        TEST_REQUIRE(visitor.names == "+bar +child 2 -child 2 +child 3 -child 3 -bar ");
+
+        visitor.names.clear();
+        tree.PreOrderTraverse(visitor, &child1);
+        TEST_REQUIRE(visitor.names == "+child 1 -child 1 ");
+
+        // not part of the tree.
+        MyNode other("other", 0);
+        visitor.names.clear();
+        tree.PreOrderTraverse(visitor, &other);
+        TEST_REQUIRE(visitor.names == "+other -other ");
+    }
+
+    // early exit still leaves the entered nodes.
+    {
+        class Visitor : public MyTree::ConstVisitor {
+        public:
+            virtual void EnterNode(const MyNode* node) override
+            {
+                names.append("+");
+                names.append(node ? node->s : "root");
+                names.append(" ");
+                if (node && node->s == "child 0")
+                    done = true;
+            }
+            virtual void LeaveNode(const MyNode* node) override
+            {
+                names.append("-");
+                names.append(node ? node->s : "root");
+                names.append(" ");
+            }
+            virtual bool IsDone() const override
+            { return done; }
+            std::string names;
+            bool done = false;
+        };
+        Visitor visitor;
+        tree.PreOrderTraverse(visitor);
+        TEST_REQUIRE(visitor.names == "+root +foo +child 0 -child 0 -foo -root ");
+    }
+
+    // for each child
+    {
+        std::string names;
+        tree.ForEachChild([&names](const MyNode* node) {
+            names.append(node->s);
+            names.append(" ");
+        }, &bar);
+        TEST_REQUIRE(names == "child 2 child 3 ");
+
+        names.clear();
+        tree.ForEachChild([&names](const MyNode* node) {
+            names.append(node->s);
+            names.append(" ");
+        });
+        TEST_REQUIRE(names == "foo bar ");
+
+        names.clear();
+        tree.ForEachChild([&names](const MyNode* node) {
+            names.append(node->s);
+        }, &child2);
+        TEST_REQUIRE(names.empty());
+    }
+
+    // topology changes invalidate the flat tree.
+    {
+        tree.ReOrderChildren(nullptr, &bar, &foo);
+        TEST_REQUIRE(WalkTree(tree) == "bar child 2 child 3 foo child 0 child 1");
+        tree.BreakChild(&child2);
+        TEST_REQUIRE(WalkTree(tree) == "bar child 3 foo child 0 child 1");
+        TEST_REQUIRE(tree.GetFlatTree().size() == 6);
+        tree.LinkChild(&child0, &child2);
+        TEST_REQUIRE(WalkTree(tree) == "bar child 3 foo child 0 child 2 child 1");
+        TEST_REQUIRE(tree.GetFlatTree()[4].node == &child0);
+        TEST_REQUIRE(tree.GetFlatTree()[4].size == 2);
+        tree.DeleteChildren(&foo);
+        TEST_REQUIRE(WalkTree(tree) == "bar child 3 foo");
+        tree.Clear();
+        TEST_REQUIRE(WalkTree(tree) == "");
+        TEST_REQUIRE(tree.GetFlatTree().size() == 1);
+    }
+
+    // subtrees that are not linked to the root can still be traversed.
+    {
+        tree.LinkChild(nullptr, &foo);
+        tree.LinkChild(&bar, &child0);
+        tree.LinkChild(&child0, &child1);
+        TEST_REQUIRE(WalkTree(tree) == "foo");
+
+        std::string names;
+        tree.PreOrderTraverseForEach([&names](const MyNode* node) {
+            names.append(node->s);
+            names.append(" ");
+        }, &bar);
+        TEST_REQUIRE(names == "bar child 0 child 1 ");
+    }
+}
+
 void unit_test_render_tree_op()
 {
     TEST_CASE(test::Type::Feature)
@@ -345,6 +510,108 @@ void unit_test_render_tree_op()
     }
 }
 
+
+void measure_render_tree_perf()
+{
+    TEST_CASE(test::Type::Other)
+
+    using MyTree = game::RenderTree<MyNode>;
+
+    // build a scene like hierarchy with some top level nodes
+    // each having a few levels of children. 32 top level nodes
+    // with 4 levels of children and branching factor of 4 gives
+    // 32*341 = 10912 nodes.
+    std::vector<std::unique_ptr<MyNode>> nodes;
+    MyTree tree;
+
+    std::function<void(const MyNode*, unsigned)> build;
+    build = [&](const MyNode* parent, unsigned depth) {
+        if (depth == 0)
+            return;
+        for (unsigned i=0; i<4; ++i)
+        {
+            nodes.push_back(std::make_unique<MyNode>("node", (unsigned)nodes.size()));
+            const auto* node = nodes.back().get();
+            tree.LinkChild(parent, node);
+            build(node, depth-1);
+        }
+    };
+    for (unsigned i=0; i<32; ++i)
+    {
+        nodes.push_back(std::make_unique<MyNode>("root", (unsigned)nodes.size()));
+        const auto* node = nodes.back().get();
+        tree.LinkChild(nullptr, node);
+        build(node, 4);
+    }
+    std::printf("Total render tree nodes = %u\n", (unsigned)nodes.size());
+    TEST_REQUIRE(nodes.size() >= 10000);
+
+    class Visitor : public MyTree::ConstVisitor {
+    public:
+        virtual void EnterNode(const MyNode* node) override
+        {
+            if (node)
+                sum += node->i;
+            ++depth;
+        }
+        virtual void LeaveNode(const MyNode* node) override
+        { --depth; }
+        unsigned sum = 0;
+        int depth = 0;
+    };
+
+    // traversal when the topology changes every time, i.e. includes
+    // the cost of rebuilding the flat tree.
+    {
+        const auto& ret = test::TimedTest(100, [&tree, &nodes]() {
+            tree.ReparentChild(nullptr, nodes[0].get());
+            Visitor visitor;
+            tree.PreOrderTraverse(visitor);
+            if (visitor.depth)
+                std::printf("side effect for not optimizing the test away!");
+        });
+        test::PrintTestTimes("Rebuild + traverse 10k node RenderTree", ret);
+    }
+
+    {
+        const auto& ret = test::TimedTest(1000, [&tree]() {
+            Visitor visitor;
+            tree.PreOrderTraverse(visitor);
+            if (visitor.depth)
+                std::printf("side effect for not optimizing the test away!");
+        });
+        test::PrintTestTimes("Visitor traverse 10k node RenderTree", ret);
+    }
+
+    {
+        const auto& ret = test::TimedTest(1000, [&tree]() {
+            unsigned sum = 0;
+            tree.PreOrderTraverseForEach([&sum](const MyNode* node) {
+                if (node)
+                    sum += node->i;
+            });
+            if (sum == 0)
+                std::printf("side effect for not optimizing the test away!");
+        });
+        test::PrintTestTimes("ForEach traverse 10k node RenderTree", ret);
+    }
+
+    {
+        const auto& ret = test::TimedTest(1000, [&tree, &nodes]() {
+            unsigned count = 0;
+            for (const auto& node : nodes)
+            {
+                tree.ForEachChild([&count](const MyNode* child) {
+                    ++count;
+                }, node.get());
+            }
+            if (count == 0)
+                std::printf("side effect for not optimizing the test away!");
+        });
+        test::PrintTestTimes("ForEachChild 10k node RenderTree", ret);
+    }
+}
+
 struct Entity {
     std::string name;
     base::FRect rect;
@@ -791,6 +1058,71 @@ void unit_test_quadtree_erase()
     }
 }
 
+void unit_test_quadtree_move()
+{
+    TEST_CASE(test::Type::Feature)
+
+    std::vector<Entity> objects;
+    objects.resize(4);
+    objects[0].name = "e0";
+    objects[1].name = "e1";
+    objects[2].name = "e2";
+    objects[3].name = "e3";
+
+    game::QuadTree<Entity*> tree(100.0f, 100.0f, 1);
+
+    const base::FRect rect0(10.0f, 10.0f, 10.0f, 10.0f);
+    const base::FRect rect1(10.0f, 60.0f, 10.0f, 10.0f);
+    const base::FRect rect2(60.0f, 10.0f, 10.0f, 10.0f);
+    const base::FRect rect3(60.0f, 60.0f, 10.0f, 10.0f);
+    TEST_REQUIRE(tree.Insert(rect0, &objects[0]));
+    TEST_REQUIRE(tree.Insert(rect1, &objects[1]));
+    TEST_REQUIRE(tree.Insert(rect2, &objects[2]));
+    TEST_REQUIRE(tree.Insert(rect3, &objects[3]));
+    TEST_REQUIRE(tree->HasChildren());
+
+    // erase by rect only looks in the quadrants that intersect
+    // with the rect.
+    tree.Erase(rect0, [](const Entity* e, const base::FRect&) {
+        return e->name == "e1";
+    });
+    TEST_REQUIRE(tree.GetNumItems() == 4);
+
+    // move e0 to the same quadrant with e3
+    TEST_REQUIRE(tree.Move(rect0, base::FRect(70.0f, 70.0f, 10.0f, 10.0f), &objects[0]));
+    TEST_REQUIRE(tree->GetChildQuadrant(0)->HasItems() == false);
+    TEST_REQUIRE(tree->GetChildQuadrant(3)->HasChildren());
+
+    std::set<Entity*> result;
+    game::QueryQuadTree(base::FRect(0.0f, 0.0f, 100.0f, 100.0f), tree, &result);
+    TEST_REQUIRE(result.size() == 4);
+    result.clear();
+    game::QueryQuadTree(base::FRect(0.0f, 0.0f, 50.0f, 50.0f), tree, &result);
+    TEST_REQUIRE(result.empty());
+    game::QueryQuadTree(base::FPoint(75.0f, 75.0f), tree, &result);
+    TEST_REQUIRE(result.size() == 1);
+    TEST_REQUIRE(*result.begin() == &objects[0]);
+
+    // move e0 over multiple quadrants
+    TEST_REQUIRE(tree.Move(base::FRect(70.0f, 70.0f, 10.0f, 10.0f), base::FRect(40.0f, 40.0f, 20.0f, 20.0f), &objects[0]));
+    result.clear();
+    game::QueryQuadTree(base::FRect(0.0f, 0.0f, 100.0f, 100.0f), tree, &result);
+    TEST_REQUIRE(result.size() == 4);
+    result.clear();
+    game::QueryQuadTree(base::FPoint(75.0f, 75.0f), tree, &result);
+    TEST_REQUIRE(result.empty());
+
+    // erasing the objects from the subdivided quadrant merges the
+    // sub-quadrants back without losing objects in the siblings.
+    tree.Erase(base::FRect(40.0f, 40.0f, 20.0f, 20.0f), [&objects](const Entity* e, const base::FRect&) {
+        return e == &objects[0];
+    });
+    TEST_REQUIRE(tree.GetNumItems() == 3);
+    result.clear();
+    game::QueryQuadTree(base::FRect(0.0f, 0.0f, 100.0f, 100.0f), tree, &result);
+    TEST_REQUIRE(result.size() == 3);
+}
+
 void unit_test_quadtree_query()
 {
     TEST_CASE(test::Type::Feature)
@@ -921,14 +1253,17 @@ EXPORT_TEST_MAIN(
 int test_main(int argc, char* argv[])
 {
     unit_test_render_tree();
+    unit_test_render_tree_flat();
     unit_test_render_tree_op();
     unit_test_quadtree_insert_query();
     unit_test_quadtree_erase();
+    unit_test_quadtree_move();
     unit_test_quadtree_query();
 
     const unsigned num_items  = game::QuadTree<Entity>::DefaultMaxItems;
     const unsigned max_levels = game::QuadTree<Entity>::DefaultMaxLevels;
     measure_quadtree_even_grid_perf(num_items, max_levels);
+    measure_render_tree_perf();
     return 0;
 }
 ) // TEST_MAIN
@@ -198,7 +198,10 @@ std::string MaterialClass::GetShaderId(const State& state) const noexcept
 
     } else BUG("Unknown material type.");
 
-    return base::FormatString("%1+%2", mType, hash);
+    // this is called for every material on every draw so avoid the
+    // runtime format string parsing.
+    static constexpr base::CompiledFormat shader_id("%1+%2");
+    return base::FormatString(shader_id, mType, hash);
 }
 
 std::size_t MaterialClass::GetHash() const noexcept
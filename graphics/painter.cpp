@@ -20,7 +20,6 @@
 #include "warnpop.h"
 
 #include <string>
-#include <unordered_set>
 
 #include "base/format.h"
 #include "base/logging.h"
@@ -68,7 +67,7 @@ void Painter::Prime(DrawCommand& draw) const
         draw.instance_draw_ptr = GetGpuInstancedDraw(draw.instanced_draw.value(), *draw.drawable, drawable_env);
 }
 
-void Painter::Draw(const DrawList& list, const ShaderProgram& program) const
+void Painter::Draw(const DrawCommand* list, size_t count, const ShaderProgram& program) const
 {
     static const glm::mat4 Identity(1.0f);
 
@@ -76,10 +75,9 @@ void Painter::Draw(const DrawList& list, const ShaderProgram& program) const
     device_state.viewport = MapToDevice(mViewport);
     device_state.scissor  = MapToDevice(mScissor);
 
-    std::unordered_set<std::string> used_programs;
-
-    for (const auto& draw : list)
+    for (size_t i=0; i<count; ++i)
     {
+        const auto& draw = list[i];
         // Low level draw filtering.
         if (!program.FilterDraw(draw.user))
             continue;
@@ -141,12 +139,9 @@ void Painter::Draw(const DrawList& list, const ShaderProgram& program) const
         device_state.depth_test    = draw.state.depth_test;
         device_state.winding_order = draw.state.winding;
 
-        // apply shader program state dynamically once on the GPU program object
-        // if the GPU program object changes.
-        if (!base::Contains(used_programs, gpu_program->GetId()))
-        {
-            program.ApplyDynamicState(*mDevice, gpu_program_state);
-        }
+        // the program state is per draw so the shader program's
+        // dynamic state is applied on every draw.
+        program.ApplyDynamicState(*mDevice, gpu_program_state);
 
         program.ApplyDynamicState(*mDevice, gpu_program_state, device_state, draw.user);
 
@@ -171,13 +166,12 @@ void Painter::Draw(const Drawable& shape,
                    const DrawState& state,
                    const ShaderProgram& program) const
 {
-    std::vector<DrawCommand> list;
-    list.resize(1);
-    list[0].drawable = &shape;
-    list[0].material = &material;
-    list[0].model    = &model;
-    list[0].state    = state;
-    Draw(list, program);
+    DrawCommand draw;
+    draw.drawable = &shape;
+    draw.material = &material;
+    draw.model    = &model;
+    draw.state    = state;
+    Draw(&draw, 1, program);
 }
 
 void Painter::Draw(const Drawable& shape,
@@ -187,15 +181,14 @@ void Painter::Draw(const Drawable& shape,
                    const ShaderProgram& program,
                    const LegacyDrawState& legacy_draw_state) const
 {
-    std::vector<DrawCommand> list;
-    list.resize(1);
-    list[0].drawable = &shape;
-    list[0].material = &material;
-    list[0].model    = &model;
-    list[0].state    = state;
-    list[0].state.line_width = legacy_draw_state.line_width;
-    list[0].state.culling    = legacy_draw_state.culling;
-    Draw(list, program);
+    DrawCommand draw;
+    draw.drawable = &shape;
+    draw.material = &material;
+    draw.model    = &model;
+    draw.state    = state;
+    draw.state.line_width = legacy_draw_state.line_width;
+    draw.state.culling    = legacy_draw_state.culling;
+    Draw(&draw, 1, program);
 }
 
 void Painter::Draw(const Drawable& drawable,
@@ -226,7 +226,10 @@ namespace gfx
         // which provides the geometrical information of the object to be drawn, a material,
         // which provides the "look&feel" i.e. the surface properties for the shape
         // and finally a transform which defines the model-to-world transform.
-        void Draw(const DrawList& list, const ShaderProgram& program) const;
+        void Draw(const DrawCommand* list, size_t count, const ShaderProgram& program) const;
+        template<typename Allocator>
+        void Draw(const std::vector<DrawCommand, Allocator>& list, const ShaderProgram& program) const
+        { Draw(list.data(), list.size(), program); }
 
         // legacy draw functions.
 